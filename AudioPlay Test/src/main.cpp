@@ -1,8 +1,6 @@
 #include <iostream>
 #include <algorithm>
-#include <functional>
 #include <chrono>
-#include <thread>
 #include <iomanip>
 #include <io.h>
 #include <fcntl.h>
@@ -11,6 +9,7 @@
 
 #include "Audio.h"
 #include "AudioMetadata.h"
+#include "MetadataSnapshot.h"
 
 #pragma comment (lib, "Shlwapi.lib")
 
@@ -26,40 +25,34 @@ using AudioPlay::ComPtr;
 
 volatile BOOL running = TRUE;
 
-void PrintDuration(std::reference_wrapper<ComPtr<AudioPlay::Audio>> mp3)
+void PrintPosition(const AudioPlay::PositionTick& tick, void* context)
 {
-	while (mp3.get() && running)
-	{
-		if (mp3.get()->GetState() != AudioPlay::AudioStates::Started)
-		{
-			continue;
-		}
-		milliseconds milliSeconds;
-		mp3.get()->GetPosition(milliSeconds);
-
-		seconds second = duration_cast<seconds>(milliSeconds);
-		milliSeconds %= 1000;
-
-		minutes minute = duration_cast<minutes>(second);
-		second %= 60;
-
-		hours hour = duration_cast<hours>(minute);
-		minute %= 60;
-
-		float volume = -1.0f;
-		mp3.get()->GetVolume(volume);
-		BOOL mute = FALSE;
-		mp3.get()->GetMute(mute);
-
-		std::wcout <<
-			hour.count() << " Hours : " <<
-			std::setw(2) << minute.count() << " Minutes : " <<
-			std::setw(2) << second.count() << " Seconds : " <<
-			std::setw(4) << milliSeconds.count() << " Milliseconds" <<
-			" Volume: " << std::setw(3) << std::setprecision(1) << volume <<
-			" Mute: " << std::setw(1) << mute <<
-			'\r';
-	}
+	AudioPlay::Audio* mp3 = static_cast<AudioPlay::Audio*>(context);
+
+	milliseconds milliSeconds = tick.position;
+
+	seconds second = duration_cast<seconds>(milliSeconds);
+	milliSeconds %= 1000;
+
+	minutes minute = duration_cast<minutes>(second);
+	second %= 60;
+
+	hours hour = duration_cast<hours>(minute);
+	minute %= 60;
+
+	float volume = -1.0f;
+	mp3->GetVolume(volume);
+	BOOL mute = FALSE;
+	mp3->GetMute(mute);
+
+	std::wcout <<
+		hour.count() << " Hours : " <<
+		std::setw(2) << minute.count() << " Minutes : " <<
+		std::setw(2) << second.count() << " Seconds : " <<
+		std::setw(4) << milliSeconds.count() << " Milliseconds" <<
+		" Volume: " << std::setw(3) << std::setprecision(1) << volume <<
+		" Mute: " << std::setw(1) << mute <<
+		'\r';
 }
 
 EXTERN_C
@@ -124,32 +117,32 @@ int main()
 
 		while (mp3->GetState() != AudioPlay::AudioStates::Ready);
 
-		std::thread t{ PrintDuration, std::ref(mp3) };
-		AudioPlay::AudioMetadata metadata = mp3->GetMetadata();
+		// 30 updates a second while playing, nothing while paused
+		UINT64 positionCookie = 0;
+		mp3->SubscribePosition(33ms, PrintPosition, mp3.p, positionCookie);
 
 		LPCWSTR filename = PathFindFileName(file);
 		SetConsoleTitleW(filename);
 
-		LPWCH title = nullptr;
-		metadata.GetTitle(title);
-		if (title)
+		AudioPlay::MetadataSnapshot* metadata = nullptr;
+		if (SUCCEEDED(mp3->GetMetadataSnapshot(&metadata)))
 		{
-			std::wcout << L"Title: " << title << '\n';
-			CoTaskMemFree(title);
-		}
-		LPWCH artist = nullptr;
-		metadata.GetArtist(artist);
-		if (artist)
-		{
-			std::wcout << L"Artist: " << artist << '\n';
-			CoTaskMemFree(artist);
-		}
-		LPWCH albumName = nullptr;
-		metadata.GetAlbumName(albumName);
-		if (albumName)
-		{
-			std::wcout << L"Album name: " << albumName << '\n';
-			CoTaskMemFree(albumName);
+			LPCWCH title = nullptr;
+			if (metadata->GetTitle(title) == S_OK)
+			{
+				std::wcout << L"Title: " << title << '\n';
+			}
+			LPCWCH artist = nullptr;
+			if (metadata->GetArtist(artist) == S_OK)
+			{
+				std::wcout << L"Artist: " << artist << '\n';
+			}
+			LPCWCH albumName = nullptr;
+			if (metadata->GetAlbumName(albumName) == S_OK)
+			{
+				std::wcout << L"Album name: " << albumName << '\n';
+			}
+			CoTaskMemFree(metadata);
 		}
 
 		std::wcout << "--------------------------------------------------------------------------------------\n";
@@ -195,8 +188,10 @@ int main()
 				volume = std::clamp(volume - 10, 0, 100);
 				mp3->SetVolume(volume / 100.0f);
 			}
+
+			Sleep(10);
 		}
-		t.join();
+		mp3->UnsubscribePosition(positionCookie);
 		mp3->CloseFile();
 	}
 
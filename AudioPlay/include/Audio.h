@@ -1,10 +1,12 @@
 #pragma once
 
 #include "AudioPlay.h"
+#include "AudioStateMachine.h"
+#include "PositionNotifier.h"
+#include "TopologyCache.h"
 
 #include <chrono>
 
-#define AUDIO_E_CLOSED _HRESULT_TYPEDEF_(0x80080000L)
 #define AUDIO_TIMEOUT _HRESULT_TYPEDEF_(0x00090000L)
 
 
@@ -12,47 +14,118 @@ namespace AudioPlay
 {
 	using MediaEventCallback = void (*)(IMFMediaEvent*);
 
-	class AudioMetadata;
-	enum class AudioStates
-	{
-		Ready = 0x001,
-		Starting = 0x002,
-		Started = 0x004,
-		Pausing = 0x008,
-		Paused = 0x010,
-		Stopping = 0x020,
-		Stopped = 0x040,
-		Opening = 0x080,
-		Closing = 0x100,
-		Closed = 0x200,
-		Start = Started | Starting,
-		Pause = Paused | Pausing,
-		Stop = Stopped | Stopping,
-		Close = Closed | Closing
-	};
+	class Audio;
+	// Called once for every successful BeginOpenFile, result is E_ABORT if the open was cancelled
+	using OpenCompletedCallback = void (*)(Audio* audio, HRESULT result, void* context);
 
-	constexpr AudioStates operator&(const AudioStates& lhs, const AudioStates& rhs)
-	{
-		return (AudioStates)((int)lhs & (int)rhs);
-	}
-	constexpr AudioStates operator|(const AudioStates& lhs, const AudioStates& rhs)
-	{
-		return (AudioStates)((int)lhs | (int)rhs);
-	}
+	class AudioMetadata;
+	class MetadataSnapshot;
+	class MemoryBlock;
+	class PcmSource;
+	class PcmSink;
+	class LoopingSource;
+	class TimeStretchSource;
+	class DspChain;
+	class SpectrumTap;
+	class ReadAheadStream;
+	struct ReadAheadSettings;
+	struct ReadAheadStatistics;
+	class RenderTelemetry;
 
 
 	class Audio : public IMFAsyncCallback
 	{
 		using milliseconds = std::chrono::milliseconds;
 
+		// Runs the work item of BeginOpenFile, Invoke of Audio itself handles the session events
+		class OpenCallback : public IMFAsyncCallback
+		{
+			Audio* audio;
+
+			public:
+			OpenCallback(Audio* p_audio) : audio(p_audio) { }
+
+			STDMETHODIMP QueryInterface(REFIID riid, _COM_Outptr_ void** pPtr);
+			STDMETHODIMP_(ULONG) AddRef() { return audio->AddRef(); }
+			STDMETHODIMP_(ULONG) Release() { return audio->Release(); }
+
+			STDMETHODIMP GetParameters(DWORD* pdwFlags, DWORD* pdwQueue)
+			{
+				UNREFERENCED_PARAMETER(pdwFlags); UNREFERENCED_PARAMETER(pdwQueue);
+				return E_NOTIMPL;
+			}
+			STDMETHODIMP Invoke(IMFAsyncResult* asyncResult) { return audio->OnOpenWorkItem(asyncResult); }
+		};
+
+		// Sends the commands of the state machine to the media session
+		class SessionCommands : public SessionBackend
+		{
+			Audio* audio;
+
+			public:
+			SessionCommands(Audio* p_audio) : audio(p_audio) { }
+
+			HRESULT Start(_In_opt_ const milliseconds* position) override;
+			HRESULT Pause() override;
+			HRESULT Stop() override;
+			HRESULT Close() override;
+			HRESULT GetTime(_Out_ milliseconds& time) override;
+		};
+
+		// Everything in front of the session an open builds, made before the session of the file playing is closed
+		struct PreparedFile
+		{
+			ComPtr<IMFMediaSource> mediaSource;
+			ComPtr<LoopingSource> looping;
+			ComPtr<TimeStretchSource> stretch;
+			ComPtr<ReadAheadStream> readAhead;
+			ComPtr<IPropertyStore> properties;
+
+			// For a file that is never played
+			void Shutdown();
+		};
+
 		private:
 		ULONG referenceCount;
 
-		volatile AudioStates state;
+		SessionCommands sessionCommands;
+		AudioStateMachine stateMachine;
 
 		LPWCH filepath;
 
-		BOOL looping;
+		BOOL deferredClose;
+		BOOL nativeDecoding;
+		BOOL gaplessTrimming;
+		BOOL fileCaching;
+		BOOL topologyCaching;
+
+		// Format of the stream the last topology was made for, learned once the loader resolves it
+		TopologyKey openTopologyKey;
+		bool openTopologyKeyValid;
+		bool openTopologyCached;
+		// From BeginOpen until the player is Ready, kept in the TopologyCache statistics
+		std::chrono::steady_clock::time_point openStarted;
+		bool openTiming;
+
+		BOOL loopRegionSet;
+		UINT64 loopRegionStart;
+		UINT64 loopRegionEnd;
+		UINT32 loopRegionCount;
+		ComPtr<LoopingSource> loopingSource;
+
+		float playbackRate;
+		BOOL preservePitch;
+		ComPtr<TimeStretchSource> timeStretchSource;
+
+		ComPtr<DspChain> dspChain;
+
+		// Chunk size 0 is off
+		UINT32 readAheadChunkSize;
+		UINT32 readAheadDepth;
+		ComPtr<ReadAheadStream> readAheadStream;
+
+		ComPtr<RenderTelemetry> renderTelemetry;
+		ComPtr<EventTraceRecorder> eventTrace;
 
 		CRITICAL_SECTION criticalSection;
 		HANDLE closeEvent;
@@ -61,16 +134,45 @@ namespace AudioPlay
 		ComPtr<IMFMediaSource> mediaSource;
 		ComPtr<IMFSimpleAudioVolume> simpleAudioVolume;
 		ComPtr<IMFPresentationClock> presentationClock;
+		mutable ComPtr<IPropertyStore> propertyStore;
+		ComPtr<PcmSink> offlineSink;
 
 		MediaEventCallback callback;
 
-		milliseconds currentPosition{ 0 };
+		OpenCallback openCallback;
+		// Of the open in progress, the work item keeps its own and compares
+		ComPtr<IMFSourceResolver> sourceResolver;
+		LPWCH pendingPath;
+		OpenCompletedCallback openCompletedCallback;
+		void* openCompletedContext;
 
 		private:
-		HRESULT CreateMediaSource(_In_ LPCWCH path);
+		// Resolves the byte stream if there is one and the path otherwise, a new resolver is made without one
+		HRESULT CreateMediaSource(_In_opt_ IMFSourceResolver* resolver, _In_opt_ IMFByteStream* byteStream, _In_opt_z_ LPCWCH path,
+			_COM_Outptr_ IMFMediaSource** pPtrSource);
+		// The pipeline of every open, OpenFile runs it on the calling thread and BeginOpenFile on a work queue
+		// Only reads the settings, the player and its session aren't touched
+		HRESULT PrepareFile(_In_ LPCWCH path, _In_opt_ IMFSourceResolver* resolver, _Out_ PreparedFile& prepared);
+		HRESULT PrepareBlock(_In_ MemoryBlock* block, _In_opt_z_ LPCWCH hint, _In_opt_ IMFSourceResolver* resolver, _Out_ PreparedFile& prepared);
+		HRESULT CreatePreparedSource(_Inout_ ComPtr<PcmSource>& pcmSource, _In_opt_ IMFByteStream* byteStream, _In_opt_z_ LPCWCH path,
+			_In_opt_ IMFSourceResolver* resolver, _Inout_ PreparedFile& prepared);
+		HRESULT BeginOpen();
+		// Takes what was prepared over after BeginOpen and sets the topology
+		HRESULT FinishOpen(_In_ PreparedFile& prepared, _In_opt_z_ LPCWCH path);
+		HRESULT EndOpen(_In_opt_z_ LPCWCH path);
+		void AbortOpen();
+		HRESULT OnOpenWorkItem(_In_ IMFAsyncResult* asyncResult);
+		bool NeedsPcmSource() const { return loopRegionSet || preservePitch || dspChain || renderTelemetry; }
+		// Puts the loop region, the time stretch and the effects on top of a decoded file
+		HRESULT CreatePcmChain(_Inout_ ComPtr<PcmSource>& source, _Out_ ComPtr<LoopingSource>& looping, _Out_ ComPtr<TimeStretchSource>& stretch);
+		HRESULT ApplySessionRate();
+		HRESULT CreateOfflineSink(_In_ ComPtr<IMFStreamDescriptor>& streamDescriptor, _Out_ ComPtr<IMFActivate>& activate);
 		HRESULT CreateTopology(_In_ ComPtr<IMFTopology>& topology, _In_ ComPtr<IMFPresentationDescriptor>& presentationDescriptor);
+		HRESULT GetPropertyStore(_Out_ ComPtr<IPropertyStore>& store) const;
+		void RecordOpenLatency();
 
 		protected:
+		virtual HRESULT OnMESessionTopologyStatus(_In_ ComPtr<IMFMediaEvent>& mediaEvent);
 		virtual HRESULT OnMESessionTopologySet(_In_ ComPtr<IMFMediaEvent>& mediaEvent);
 		virtual HRESULT OnMESessionCapabilitiesChanged(_In_ ComPtr<IMFMediaEvent>& mediaEvent);
 		virtual HRESULT OnMESessionStarted(_In_ ComPtr<IMFMediaEvent>& mediaEvent);
@@ -111,18 +213,90 @@ namespace AudioPlay
 		#pragma endregion
 
 		const AudioMetadata GetMetadata() const;
+		// Reads every property at once, use CoTaskMemFree when you are done with the pointer
+		HRESULT GetMetadataSnapshot(_Outptr_result_maybenull_ MetadataSnapshot** pPtrSnapshot) const;
 
-		AudioStates GetState() const { return state; }
+		AudioStates GetState() const { return stateMachine.GetState(); }
 		bool CheckState(_In_ AudioStates state) const;
 		HRESULT OpenFile(_In_ LPCWCH path);
+		// The memory has to stay valid until the file is closed
+		// hint is a file name or URL the source resolver uses to pick a parser, it can be nullptr
+		HRESULT OpenFile(_In_reads_bytes_(size) const BYTE* data, _In_ UINT64 size, _In_opt_z_ LPCWCH hint);
+		// The block can be shared between players, use MappedFile::Open to play a file without reading it
+		HRESULT OpenFile(_In_ MemoryBlock* block, _In_opt_z_ LPCWCH hint);
+		// Plays decoded frames, see CrossfadeSource to chain tracks
+		// The source is pulled from a Media Foundation work queue thread
+		HRESULT OpenSource(_In_ PcmSource* source);
+		// Opens the file like OpenFile but decodes and resolves it on a Media Foundation work queue and returns immediately
+		// callback is called from a work queue thread unless the open is cancelled
+		HRESULT BeginOpenFile(_In_ LPCWCH path, _In_opt_ OpenCompletedCallback completedCallback, _In_opt_ void* context);
+		// Returns S_FALSE if there is no open in progress
+		HRESULT CancelOpenFile();
 		HRESULT CloseFile();
 		// Use CoTaskMemFree when you are done with the pointer
 		HRESULT GetFilePath(_Outref_result_maybenull_ LPWCH& path);
 
+		// Restarts the session at the end of the file, use SetLoopRegion for loops without a gap
 		// Always returns S_OK
-		HRESULT SetLoop(_In_ BOOL loop) { looping = loop; return S_OK; }
+		HRESULT SetLoop(_In_ BOOL loop) { stateMachine.SetLoop(loop != FALSE); return S_OK; }
 		// Always returns S_OK
-		HRESULT GetLoop(_Out_ BOOL& loop) const { loop = looping; return S_OK; }
+		HRESULT GetLoop(_Out_ BOOL& loop) const { loop = stateMachine.GetLoop() ? TRUE : FALSE; return S_OK; }
+
+		// With deferred close CloseFile returns right away and the session is shut down on the TeardownPool
+		// Always returns S_OK
+		HRESULT SetDeferredClose(_In_ BOOL deferred) { deferredClose = deferred; return S_OK; }
+		// Always returns S_OK
+		HRESULT GetDeferredClose(_Out_ BOOL& deferred) const { deferred = deferredClose; return S_OK; }
+		// With native decoding WAV, AIFF and FLAC files are read by the library instead of the Media Foundation source resolver
+		// Opening is much faster but GetMetadata has nothing to read for those files
+		// Always returns S_OK
+		HRESULT SetNativeDecoding(_In_ BOOL native) { nativeDecoding = native; return S_OK; }
+		// Always returns S_OK
+		HRESULT GetNativeDecoding(_Out_ BOOL& native) const { native = nativeDecoding; return S_OK; }
+		// MP3 files with a LAME tag, MP4 files with iTunSMPB and Ogg Opus files are decoded to PCM and the encoder's priming and padding are cut off
+		// GetDuration and GetPosition are of the trimmed audio then, off by default
+		// The file is mapped once, the tag and the decoder read the same bytes
+		// Always returns S_OK
+		HRESULT SetGaplessTrimming(_In_ BOOL trim) { gaplessTrimming = trim; return S_OK; }
+		// Always returns S_OK
+		HRESULT GetGaplessTrimming(_Out_ BOOL& trim) const { trim = gaplessTrimming; return S_OK; }
+		// Files opened by path are read once into the process wide EncodedFileCache and played from memory after that
+		// For short files that are played over and over, larger files than the cache's per-file limit are opened as usual
+		// Always returns S_OK
+		HRESULT SetFileCaching(_In_ BOOL cache) { fileCaching = cache; return S_OK; }
+		// Always returns S_OK
+		HRESULT GetFileCaching(_Out_ BOOL& cache) const { cache = fileCaching; return S_OK; }
+		// Topologies are built from the transforms the loader chose the last time a stream of the same format was opened
+		// The process wide TopologyCache learns them from resolved topologies, open latencies are in its statistics either way
+		// Not known to make opens faster, the statistics are there to find out
+		// Always returns S_OK
+		HRESULT SetTopologyCaching(_In_ BOOL cache) { topologyCaching = cache; return S_OK; }
+		// Always returns S_OK
+		HRESULT GetTopologyCaching(_Out_ BOOL& cache) const { cache = topologyCaching; return S_OK; }
+		// Files opened by path afterwards are read by a dedicated I/O thread that keeps settings.depth chunks ahead of the decoder
+		// For network shares and slow disks, files the native decoders read are mapped and not affected
+		HRESULT SetReadAhead(_In_ BOOL enable, _In_ const ReadAheadSettings& settings);
+		// Returns E_NOT_VALID_STATE unless the open file is read ahead
+		HRESULT GetReadAheadStatistics(_Out_ ReadAheadStatistics& statistics);
+		// Records every command, session event and how long Invoke took for it, nullptr stops recording
+		// Give every player its own recorder, ReplayEventTrace replays what it dumps without Media Foundation
+		// Always returns S_OK
+		HRESULT SetEventTrace(_In_opt_ EventTraceRecorder* recorder);
+		// Returns S_FALSE and nullptr while nothing is recorded
+		HRESULT GetEventTrace(_COM_Outptr_result_maybenull_ EventTraceRecorder** pPtrRecorder);
+		// Files opened while a sink is set are rendered into it as fast as they decode instead of playing on the audio device
+		// Volume and mute aren't available then, pass nullptr to play on the device again
+		// Can only be changed while closed
+		HRESULT SetOfflineSink(_In_opt_ PcmSink* sink);
+		// OpenFile decodes the file to PCM and repeats the frames from startFrame up to endFrame loopCount times before playing on to the end
+		// The wrap happens in the decoded stream so it is sample accurate and has no gap, endFrame 0 is the end of the file
+		// loopCount can be LoopingSource::loopForever, calling this while such a file plays only changes the loops left
+		HRESULT SetLoopRegion(_In_ UINT64 startFrame, _In_ UINT64 endFrame, _In_ UINT32 loopCount);
+		// Files play normally again, a file that is playing finishes its current pass and plays on to the end
+		// Always returns S_OK
+		HRESULT ClearLoopRegion();
+		// Number of sessions of all players that are closed but not shut down yet
+		static LONG GetPendingTeardownCount();
 
 		HRESULT WaitForState(_In_ AudioStates state);
 		HRESULT WaitForState(_In_ AudioStates state, _In_ const milliseconds timeout);
@@ -137,6 +311,14 @@ namespace AudioPlay
 		HRESULT Seek(_In_ const milliseconds position);
 
 		HRESULT GetPosition(_Out_ milliseconds& position);
+		// Calls callback every interval while playing and once after every state change, from the timer thread of PositionNotifier::Get
+		// One thread serves every player, use it instead of polling GetPosition
+		HRESULT SubscribePosition(_In_ milliseconds interval, _In_ PositionCallback callback, _In_opt_ void* context, _Out_ UINT64& cookie)
+		{
+			return PositionNotifier::Get().Subscribe(&stateMachine, interval, callback, context, cookie);
+		}
+		// No callback of the subscription runs after it returns, unless called from that callback
+		HRESULT UnsubscribePosition(_In_ UINT64 cookie) { return PositionNotifier::Get().Unsubscribe(cookie); }
 		HRESULT GetDuration(_Out_ milliseconds& duration);
 
 		HRESULT GetVolume(_Out_ float& volume) const;
@@ -144,5 +326,28 @@ namespace AudioPlay
 
 		HRESULT GetMute(_Out_ BOOL& mute) const;
 		HRESULT SetMute(_In_ const BOOL mute);
+
+		// 0.5 to 4, can be changed while playing, GetPosition and Seek stay in the time of the file
+		// Without pitch preservation the session plays faster and the pitch goes up with the rate
+		HRESULT SetRate(_In_ const float rate);
+		// Always returns S_OK
+		HRESULT GetRate(_Out_ float& rate) const { rate = playbackRate; return S_OK; }
+		// Files opened afterwards are decoded to PCM and time stretched so the pitch doesn't change with the rate
+		// Always returns S_OK
+		HRESULT SetPreservePitch(_In_ BOOL preserve) { preservePitch = preserve; return S_OK; }
+		// Always returns S_OK
+		HRESULT GetPreservePitch(_Out_ BOOL& preserve) const { preserve = preservePitch; return S_OK; }
+
+		// Effects on the output, files and sources opened after the first call are decoded to PCM and played through it
+		// The chain can be changed while playing
+		HRESULT GetDspChain(_Out_ ComPtr<DspChain>& chain);
+		// Puts the tap at the end of the DspChain so it sees what is played, after the effects
+		HRESULT AttachSpectrumTap(_In_ SpectrumTap* tap);
+		// Returns S_FALSE if the tap wasn't attached
+		HRESULT DetachSpectrumTap(_In_ SpectrumTap* tap);
+
+		// Times every buffer handed to the renderer and logs late ones and underruns
+		// Files and sources opened after the first call are decoded to PCM so their buffers can be timed
+		HRESULT GetRenderTelemetry(_Out_ ComPtr<RenderTelemetry>& telemetry);
 	};
 }
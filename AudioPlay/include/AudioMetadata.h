@@ -15,6 +15,7 @@ namespace AudioPlay
 
 		protected:
 		AudioMetadata(IMFMediaSource* mediaSource);
+		AudioMetadata(IPropertyStore* store);
 
 		public:
 		virtual ~AudioMetadata();
@@ -33,5 +34,9 @@ namespace AudioPlay
 		HRESULT GetProperityCount(_Out_ DWORD& count) const;
 
 		HRESULT GetThumbnail(_COM_Outptr_ IWICBitmapFrameDecode** pPtrthumbnail);
+		// The encoded image as it is stored in the file, use CoTaskMemFree when you are done with the pointer
+		// Returns S_FALSE and nullptr if the file has no art
+		// A ThumbnailCache decodes each image once and downscales it, use one to show the art of many files
+		HRESULT GetThumbnailData(_Outptr_result_bytebuffer_maybenull_(size) BYTE*& data, _Out_ UINT32& size) const;
 	};
 }
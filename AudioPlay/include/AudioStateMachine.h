@@ -0,0 +1,128 @@
+#pragma once
+
+#include "PortableTypes.h"
+#include "EventTrace.h"
+
+#include <atomic>
+#include <chrono>
+#include <mutex>
+
+
+namespace AudioPlay
+{
+	enum class AudioStates
+	{
+		Ready = 0x001,
+		Starting = 0x002,
+		Started = 0x004,
+		Pausing = 0x008,
+		Paused = 0x010,
+		Stopping = 0x020,
+		Stopped = 0x040,
+		Opening = 0x080,
+		Closing = 0x100,
+		Closed = 0x200,
+		Start = Started | Starting,
+		Pause = Paused | Pausing,
+		Stop = Stopped | Stopping,
+		Close = Closed | Closing
+	};
+
+	constexpr AudioStates operator&(const AudioStates& lhs, const AudioStates& rhs)
+	{
+		return (AudioStates)((int)lhs & (int)rhs);
+	}
+	constexpr AudioStates operator|(const AudioStates& lhs, const AudioStates& rhs)
+	{
+		return (AudioStates)((int)lhs | (int)rhs);
+	}
+
+	// The commands the state machine sends to a media session
+	// Every successful Start, Pause, Stop and Close is answered later with the matching MESession* event
+	class SessionBackend
+	{
+		protected:
+		using milliseconds = std::chrono::milliseconds;
+
+		public:
+		virtual ~SessionBackend() = default;
+
+		// position is nullptr to resume from where the session is
+		virtual HRESULT Start(_In_opt_ const milliseconds* position) = 0;
+		virtual HRESULT Pause() = 0;
+		virtual HRESULT Stop() = 0;
+		virtual HRESULT Close() = 0;
+		// Fails while the session has no running presentation clock
+		virtual HRESULT GetTime(_Out_ milliseconds& time) = 0;
+	};
+
+	// Player state driven by commands and session events, independent of Media Foundation
+	// Audio runs it on an IMFMediaSession, ScriptedSession runs it on a virtual clock
+	class AudioStateMachine
+	{
+		using milliseconds = std::chrono::milliseconds;
+
+		SessionBackend* backend;
+
+		std::mutex mutex;
+		std::atomic<AudioStates> state;
+		std::atomic<bool> looping;
+
+		// State the last completed command left the session in, restored when a command fails
+		AudioStates settledState;
+		// Commands sent to the session that haven't been answered yet
+		UINT32 pendingCommands;
+		bool hasClock;
+		bool hasCapabilities;
+		bool waitForCapabilities;
+
+		milliseconds currentPosition{ 0 };
+
+		ComPtr<EventTraceRecorder> trace;
+
+		HRESULT StartAt(_In_opt_ const milliseconds* position);
+		void Settle(_In_ AudioStates settled, _In_ HRESULT status);
+		// Called with the lock held so commands and events are recorded in the order they were applied
+		void Trace(_In_ EventTraceCommand command, _In_ INT32 argument, _In_ HRESULT result);
+
+		HRESULT StartLocked();
+		HRESULT StartLocked(_In_ const milliseconds position);
+		HRESULT PauseLocked();
+		HRESULT StopLocked();
+		HRESULT SeekLocked(_In_ const milliseconds position);
+		HRESULT CloseLocked();
+		HRESULT HandleEventLocked(_In_ MediaEventType type, _In_ HRESULT status);
+
+		public:
+		AudioStateMachine(_In_ SessionBackend* backend);
+
+		// Every command, its result and every event with the state it left go to the recorder, nullptr stops recording
+		void SetTrace(_In_opt_ EventTraceRecorder* recorder);
+
+		AudioStates GetState() const { return state; }
+		bool CheckState(_In_ AudioStates p_state) const { return (bool)(GetState() & p_state); }
+		// For the steps of opening and closing that happen outside of the session
+		void SetState(_In_ AudioStates p_state);
+		// The topology was handed to the session, the player is Ready after MESessionTopologySet
+		// and also after MESessionCapabilitiesChanged if waitForCapabilities is set
+		void OnOpening(_In_ bool waitForCapabilities);
+
+		void SetLoop(_In_ bool loop);
+		bool GetLoop() const { return looping; }
+
+		HRESULT Start();
+		HRESULT Start(_In_ const milliseconds position);
+		HRESULT Pause();
+		HRESULT Stop();
+		HRESULT Seek(_In_ const milliseconds position);
+		// Moves the state to Closing, Closed comes with MESessionClosed
+		HRESULT Close();
+
+		HRESULT GetPosition(_Out_ milliseconds& position);
+		void ResetPosition();
+
+		// Feeds an event of the session, status is the status of the event
+		// Events that aren't about the player state are ignored
+		HRESULT HandleEvent(_In_ MediaEventType type, _In_ HRESULT status);
+	};
+}
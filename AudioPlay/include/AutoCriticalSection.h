@@ -0,0 +1,28 @@
+#pragma once
+
+#include <windows.h>
+
+#include "RealtimeThread.h"
+
+
+class AutoCriticalSection
+{
+	private:
+	LPCRITICAL_SECTION criticalSection;
+
+	public:
+	AutoCriticalSection(LPCRITICAL_SECTION section) :
+		criticalSection(section)
+	{
+#ifdef AUDIOPLAY_REALTIME_CHECKS
+		AudioPlay::RealtimeThread::ReportLock();
+#endif
+
+		EnterCriticalSection(criticalSection);
+	}
+
+	~AutoCriticalSection()
+	{
+		LeaveCriticalSection(criticalSection);
+	}
+};
@@ -0,0 +1,104 @@
+#pragma once
+
+#include "PcmSource.h"
+
+#include <atomic>
+#include <mutex>
+
+
+namespace AudioPlay
+{
+	enum class CrossfadeCurve
+	{
+		Linear,
+		// Keeps the summed power constant, sin for the incoming and cos for the outgoing source
+		EqualPower,
+		// Set with SetCustomCurve
+		Custom
+	};
+
+	// Fills gains of the incoming and outgoing source for count frames, the fade runs from position 0 to length
+	// The outgoing gain is the incoming curve mirrored
+	void ComputeCrossfadeGains(_In_ CrossfadeCurve curve, _In_reads_opt_(customPointCount) const float* customPoints, _In_ UINT32 customPointCount,
+		_In_ UINT64 position, _In_ UINT64 length, _In_ UINT32 count, _Out_writes_(count) float* incomingGains, _Out_writes_(count) float* outgoingGains);
+	// outgoing = outgoing * outgoingGains + incoming * incomingGains, gains are per frame
+	void MixCrossfade(_Inout_updates_(frameCount * channels) float* outgoing, _In_reads_(frameCount * channels) const float* incoming,
+		_In_reads_(frameCount) const float* incomingGains, _In_reads_(frameCount) const float* outgoingGains, _In_ UINT32 frameCount, _In_ UINT32 channels);
+
+	// Plays sources back to back and overlaps the end of one with the start of the next
+	class CrossfadeSource : public PcmSource
+	{
+		struct Transition
+		{
+			ComPtr<PcmSource> source;
+			UINT64 fadeFrames;
+			CrossfadeCurve curve;
+			bool startNow;
+		};
+
+		static constexpr UINT32 maxCustomPoints = 256;
+		// A transition retires at most the outgoing source and a queued one it replaced before the control thread comes by again
+		static constexpr UINT32 retiredSlots = 4;
+
+		ComPtr<PcmSource> current;
+		ComPtr<PcmSource> next;
+		UINT64 fadeFrames;
+		UINT64 fadePosition;
+		CrossfadeCurve curve;
+		bool fading;
+
+		float customPoints[maxCustomPoints];
+		UINT32 customPointCount;
+
+		// Handed over from the control thread, the audio thread only try_locks
+		std::mutex transitionMutex;
+		Transition pendingTransition;
+		bool hasPendingTransition;
+		float requestedCustomPoints[maxCustomPoints];
+		UINT32 requestedCustomPointCount;
+
+		// Sources the audio thread is done with, the control thread releases them so a decoder is never torn down in Read
+		std::atomic<PcmSource*> retired[retiredSlots];
+
+		float* incomingBuffer;
+		float* incomingGains;
+		float* outgoingGains;
+
+		CrossfadeSource();
+
+		// Publishes the whole transition under one lock so the audio thread never sees it half set
+		HRESULT QueueTransition(_In_ PcmSource* next, _In_ UINT64 fadeFrames, _In_ CrossfadeCurve curve, _In_ bool startNow);
+		void TakePendingTransition();
+		void FinishTransition();
+		void Retire(_Inout_ ComPtr<PcmSource>& source);
+
+		public:
+		static constexpr UINT32 blockFrames = 512;
+
+		~CrossfadeSource();
+
+		static HRESULT Create(_In_ PcmSource* first, _COM_Outptr_ CrossfadeSource** pPtrSource);
+
+		// next has to have the same format, open and preroll it ahead of time so the fade can start on time
+		// The fade starts fadeFrames before the current source ends, or as soon as it ends if its length isn't known
+		HRESULT Queue(_In_ PcmSource* next, _In_ UINT64 fadeFrames, _In_ CrossfadeCurve curve);
+		// Starts fading to next right away
+		HRESULT CrossfadeNow(_In_ PcmSource* next, _In_ UINT64 fadeFrames, _In_ CrossfadeCurve curve);
+		// Gain of the incoming source at evenly spaced points from the start to the end of the fade
+		// Call before queueing a transition that uses CrossfadeCurve::Custom
+		HRESULT SetCustomCurve(_In_reads_(pointCount) const float* points, _In_ UINT32 pointCount);
+		// Releases the sources finished transitions left behind, Queue and CrossfadeNow do it too
+		// Call it from the control thread once a fade is over if no other transition follows
+		void ReleaseRetired();
+
+		bool IsFading() const { return fading; }
+
+		HRESULT Read(_Out_writes_(frameCount * format.channels) float* buffer, _In_ UINT32 frameCount, _Out_ UINT32& framesRead) override;
+		// Seeks the current source, a fade in progress is finished first
+		HRESULT Seek(_In_ UINT64 frame) override;
+		// Position in the current source, the outgoing one while fading
+		HRESULT GetPosition(_Out_ UINT64& frame) const override;
+		// Length of the current source
+		HRESULT GetLength(_Out_ UINT64& frames) const override;
+	};
+}
@@ -0,0 +1,152 @@
+#pragma once
+
+#include "PcmSource.h"
+#include "RenderTelemetry.h"
+
+#include <mutex>
+
+
+namespace AudioPlay
+{
+	// Processes interleaved frames in place on the audio thread
+	// Parameters are set from any thread through atomics, the effect picks them up at the start of the next block
+	// Effects allocate everything they need when they are created, Process never allocates or locks
+	class DspEffect
+	{
+		std::atomic<ULONG> referenceCount;
+
+		std::atomic<bool> bypassed;
+		std::atomic<bool> resetRequested;
+		std::atomic<UINT64> processedFrames;
+		std::atomic<UINT64> processNanoseconds;
+
+		PcmFormat preparedFormat;
+		UINT32 appliedVersion;
+
+		protected:
+		// Bumped by the setters after the parameters are stored
+		std::atomic<UINT32> parameterVersion;
+
+		DspEffect();
+
+		void ParametersChanged() { parameterVersion.fetch_add(1, std::memory_order_release); }
+
+		// Reads the parameters into the processing state, called on the audio thread when they or the format change
+		virtual void Update(_In_ const PcmFormat& format) = 0;
+		// Clears filter memory and delay lines
+		virtual void Reset() = 0;
+		virtual void Process(_Inout_updates_(frameCount * format.channels) float* frames, _In_ UINT32 frameCount, _In_ const PcmFormat& format) = 0;
+
+		public:
+		static constexpr UINT32 maxChannels = 8;
+		static constexpr UINT32 maxSampleRate = 384000;
+
+		virtual ~DspEffect();
+
+		virtual ULONG STDMETHODCALLTYPE AddRef();
+		virtual ULONG STDMETHODCALLTYPE Release();
+
+		// Formats with more than maxChannels channels or a higher rate than maxSampleRate pass through untouched
+		void Run(_Inout_updates_(frameCount * format.channels) float* frames, _In_ UINT32 frameCount, _In_ const PcmFormat& format);
+		// Bypassed effects keep their state, Reset is asked for so they start clean when enabled again
+		void SetBypass(_In_ bool bypass);
+		bool GetBypass() const { return bypassed; }
+		// Picked up by the audio thread before the next block
+		void RequestReset() { resetRequested = true; }
+
+		// Frames processed and time spent in Process since creation
+		UINT64 GetProcessedFrames() const { return processedFrames; }
+		UINT64 GetProcessNanoseconds() const { return processNanoseconds; }
+	};
+
+	// An ordered list of effects, shared by every DspSource that plays through it
+	// The list is changed by the control thread and handed to the audio thread without blocking it
+	class DspChain
+	{
+		static constexpr UINT32 maxEffects = 16;
+
+		struct EffectList
+		{
+			ComPtr<DspEffect> effects[maxEffects];
+			UINT32 count = 0;
+		};
+
+		std::atomic<ULONG> referenceCount;
+
+		// Control thread only
+		std::mutex configureMutex;
+		EffectList configured;
+
+		// The audio thread only try_locks, the list it swaps out stays here until the next change releases it
+		std::mutex pendingMutex;
+		EffectList pending;
+		bool hasPending;
+
+		// Audio thread
+		EffectList active;
+		// Only one stream runs the effects at a time, the others play dry
+		std::atomic_flag processing;
+		std::atomic<bool> resetRequested;
+
+		DspChain();
+
+		HRESULT Publish();
+
+		public:
+		~DspChain();
+
+		static HRESULT Create(_COM_Outptr_ DspChain** pPtrChain);
+
+		ULONG STDMETHODCALLTYPE AddRef();
+		ULONG STDMETHODCALLTYPE Release();
+
+		// index past the end appends, returns E_BOUNDS when the chain holds 16 effects
+		HRESULT Insert(_In_ DspEffect* effect, _In_ UINT32 index);
+		HRESULT Remove(_In_ DspEffect* effect);
+		HRESULT Clear();
+		UINT32 GetEffectCount();
+
+		// Runs every effect over the frames, returns false if another stream is running the chain
+		bool Process(_Inout_updates_(frameCount * format.channels) float* frames, _In_ UINT32 frameCount, _In_ const PcmFormat& format);
+		// Asks every effect to clear its state, used after seeks
+		void RequestReset();
+	};
+
+	// Plays another source through a DspChain, per track or for the whole output
+	class DspSource : public PcmSource
+	{
+		ComPtr<PcmSource> source;
+		ComPtr<DspChain> chain;
+		ComPtr<RenderTelemetry> telemetry;
+
+		DspSource();
+
+		public:
+		// Effects see at most blockFrames frames per call
+		static constexpr UINT32 blockFrames = 512;
+
+		~DspSource();
+
+		static HRESULT Create(_In_ PcmSource* source, _In_ DspChain* chain, _COM_Outptr_ DspSource** pPtrSource);
+
+		// The time the chain takes is reported to it as processing, set it before the first Read
+		void SetTelemetry(_In_opt_ RenderTelemetry* p_telemetry) { telemetry = p_telemetry; }
+
+		HRESULT Read(_Out_writes_(frameCount * format.channels) float* buffer, _In_ UINT32 frameCount, _Out_ UINT32& framesRead) override;
+		HRESULT Seek(_In_ UINT64 frame) override;
+		HRESULT GetPosition(_Out_ UINT64& frame) const override;
+		HRESULT GetLength(_Out_ UINT64& frames) const override;
+	};
+
+	struct DspEffectCost
+	{
+		UINT64 frames;
+		UINT64 nanoseconds;
+		// Time spent per second of audio, 0.01 is one percent of a core
+		double realtimeLoad;
+		double nanosecondsPerFrame;
+	};
+
+	// Runs the effect over generated noise and measures it, the effect must not be in a chain that is playing
+	HRESULT MeasureDspEffect(_In_ DspEffect* effect, _In_ const PcmFormat& format, _In_ UINT32 blockFrames, _In_ UINT64 totalFrames, _Out_ DspEffectCost& cost);
+}
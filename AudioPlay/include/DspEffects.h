@@ -0,0 +1,156 @@
+#pragma once
+
+#include "DspChain.h"
+
+
+namespace AudioPlay
+{
+	enum class BiquadType
+	{
+		Peak,
+		LowShelf,
+		HighShelf,
+		LowPass,
+		HighPass
+	};
+
+	// Parametric EQ as a cascade of biquads (RBJ cookbook), transposed direct form II
+	// Every channel goes through the same coefficients, up to four channels are filtered together with SSE2
+	class BiquadEq : public DspEffect
+	{
+		static constexpr UINT32 bandCount = 8;
+
+		struct BandParameters
+		{
+			std::atomic<bool> enabled;
+			std::atomic<BiquadType> type;
+			std::atomic<float> frequency;
+			std::atomic<float> gain;
+			std::atomic<float> q;
+		};
+
+		struct Coefficients
+		{
+			float b0;
+			float b1;
+			float b2;
+			float a1;
+			float a2;
+		};
+
+		BandParameters parameters[bandCount];
+
+		// Audio thread
+		Coefficients coefficients[bandCount];
+		bool bandActive[bandCount];
+		alignas(16) float z1[bandCount][maxChannels];
+		alignas(16) float z2[bandCount][maxChannels];
+
+		BiquadEq();
+
+		static Coefficients Design(_In_ BiquadType type, _In_ double frequency, _In_ double gain, _In_ double q, _In_ double sampleRate);
+
+		protected:
+		void Update(_In_ const PcmFormat& format) override;
+		void Reset() override;
+		void Process(_Inout_updates_(frameCount * format.channels) float* frames, _In_ UINT32 frameCount, _In_ const PcmFormat& format) override;
+
+		public:
+		static constexpr UINT32 maxBands = bandCount;
+
+		static HRESULT Create(_COM_Outptr_ BiquadEq** pPtrEq);
+
+		// frequency in Hz, gain in dB for peak and shelf bands, q is the bandwidth or the shelf slope
+		HRESULT SetBand(_In_ UINT32 band, _In_ BiquadType type, _In_ float frequency, _In_ float gain, _In_ float q);
+		HRESULT DisableBand(_In_ UINT32 band);
+	};
+
+	// Brickwall peak limiter, the gain starts to go down lookahead before a peak so nothing goes past the ceiling
+	// Channels share the gain so the stereo image doesn't move
+	class Limiter : public DspEffect
+	{
+		std::atomic<float> ceiling;
+		std::atomic<float> release;
+		std::atomic<float> lookahead;
+
+		// Audio thread
+		float ceilingGain;
+		float releaseCoefficient;
+		UINT32 lookaheadFrames;
+
+		// Interleaved frames waiting to be played, lookaheadFrames long
+		float* delay;
+		UINT32 delayPosition;
+		// Sliding minimum of the gains needed over the lookahead as a ring of candidate frames
+		UINT32* minimumFrames;
+		float* minimumGains;
+		UINT32 minimumHead;
+		UINT32 minimumCount;
+		UINT32 frameCounter;
+		// The held gains are averaged over the lookahead so the gain ramps down instead of jumping
+		float* averageGains;
+		UINT32 averagePosition;
+		double averageSum;
+		float gain;
+
+		Limiter();
+
+		protected:
+		void Update(_In_ const PcmFormat& format) override;
+		void Reset() override;
+		void Process(_Inout_updates_(frameCount * format.channels) float* frames, _In_ UINT32 frameCount, _In_ const PcmFormat& format) override;
+
+		public:
+		static constexpr float maxLookahead = 10.0f;
+
+		~Limiter();
+
+		static HRESULT Create(_COM_Outptr_ Limiter** pPtrLimiter);
+
+		// dBFS, 0 or below
+		HRESULT SetCeiling(_In_ float decibels);
+		HRESULT SetRelease(_In_ float milliseconds);
+		// Up to maxLookahead milliseconds, the output is delayed by the lookahead
+		HRESULT SetLookahead(_In_ float milliseconds);
+	};
+
+	// Feed forward compressor with a soft knee, the loudest channel drives the gain of all of them
+	class Compressor : public DspEffect
+	{
+		std::atomic<float> threshold;
+		std::atomic<float> ratio;
+		std::atomic<float> knee;
+		std::atomic<float> attack;
+		std::atomic<float> release;
+		std::atomic<float> makeup;
+		std::atomic<float> reductionMeter;
+
+		// Audio thread
+		float thresholdDecibels;
+		float slope;
+		float kneeDecibels;
+		// Levels below this don't reach the knee and skip the logarithm
+		float quietLevel;
+		float attackCoefficient;
+		float releaseCoefficient;
+		float makeupDecibels;
+		float reduction;
+
+		Compressor();
+
+		protected:
+		void Update(_In_ const PcmFormat& format) override;
+		void Reset() override;
+		void Process(_Inout_updates_(frameCount * format.channels) float* frames, _In_ UINT32 frameCount, _In_ const PcmFormat& format) override;
+
+		public:
+		static HRESULT Create(_COM_Outptr_ Compressor** pPtrCompressor);
+
+		// threshold and knee in dB, ratio 1 or more
+		HRESULT SetThreshold(_In_ float decibels, _In_ float newRatio, _In_ float kneeWidth);
+		HRESULT SetTiming(_In_ float attackMilliseconds, _In_ float releaseMilliseconds);
+		HRESULT SetMakeup(_In_ float decibels);
+		// dB of gain reduction at the end of the last block, read it from any thread for a meter
+		float GetReduction() const { return reductionMeter; }
+	};
+}
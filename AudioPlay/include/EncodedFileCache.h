@@ -0,0 +1,79 @@
+#pragma once
+
+#include "MappedFile.h"
+
+#include <list>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+
+
+namespace AudioPlay
+{
+	struct EncodedFileCacheStatistics
+	{
+		UINT64 hits;
+		UINT64 misses;
+		// Bytes served from memory instead of the disk
+		UINT64 bytesSaved;
+		UINT64 bytesLoaded;
+		UINT64 evictions;
+		// Cached files whose size or modification time changed
+		UINT64 reloads;
+		// Files larger than the per-file limit, they are opened the usual way
+		UINT64 skipped;
+		UINT64 usedBytes;
+		UINT32 entryCount;
+	};
+
+	// Process wide cache of the encoded bytes of short files that are opened over and over, like UI sounds and jingles
+	// Keyed by path, an entry is only used while the file's size and modification time are the ones it was read with
+	// Entries are read-only MemoryBlocks shared by every player, evicting one doesn't affect players that still have it open
+	class EncodedFileCache
+	{
+		struct Entry
+		{
+			std::wstring path;
+			UINT64 modified;
+			UINT64 size;
+			ComPtr<MemoryBlock> block;
+		};
+
+		std::mutex mutex;
+		// Most recently used first
+		std::list<Entry> entries;
+		std::unordered_map<std::wstring, std::list<Entry>::iterator> index;
+		UINT64 maxBytes;
+		UINT64 maxFileBytes;
+		EncodedFileCacheStatistics statistics;
+
+		EncodedFileCache();
+
+		static HRESULT ReadFileInfo(_In_z_ LPCWCH path, _Out_ UINT64& modified, _Out_ UINT64& size);
+		static HRESULT Load(_In_z_ LPCWCH path, _In_ UINT64 size, _COM_Outptr_ MemoryBlock** pPtrBlock);
+
+		void Remove(_In_ std::list<Entry>::iterator entry);
+		void Evict(_In_ UINT64 budget);
+
+		public:
+		static constexpr UINT64 defaultMaxBytes = 64ull << 20;
+		static constexpr UINT64 defaultMaxFileBytes = 8ull << 20;
+
+		static EncodedFileCache& Get();
+
+		EncodedFileCache(const EncodedFileCache&) = delete;
+		EncodedFileCache& operator=(const EncodedFileCache&) = delete;
+
+		// Cached files only cost a look at the file's size and modification time, others are read whole and kept
+		// Returns S_FALSE and nullptr for files larger than the per-file limit
+		HRESULT Open(_In_z_ LPCWCH path, _COM_Outptr_result_maybenull_ MemoryBlock** pPtrBlock);
+
+		// Evicts least recently used files until at most maxBytes are kept, larger files than maxFileBytes aren't cached
+		void SetLimits(_In_ UINT64 maxBytes, _In_ UINT64 maxFileBytes);
+		// Returns S_FALSE if the file wasn't cached
+		HRESULT Invalidate(_In_z_ LPCWCH path);
+		void Clear();
+
+		EncodedFileCacheStatistics GetStatistics();
+	};
+}
@@ -0,0 +1,136 @@
+#pragma once
+
+#include "PortableTypes.h"
+
+#include <atomic>
+#include <chrono>
+#include <mutex>
+#include <vector>
+
+
+namespace AudioPlay
+{
+	enum class EventTraceKind : BYTE
+	{
+		// A call into the state machine, code is the EventTraceCommand
+		Command = 1,
+		// A session event as the state machine saw it, code is the MediaEventType
+		Event = 2,
+		// The whole of Audio::Invoke for an event, from before it waits for the lock until the callback returned
+		Handler = 3
+	};
+
+	enum class EventTraceCommand : UINT32
+	{
+		None = 0,
+		// argument is 1 if the player waits for MESessionCapabilitiesChanged
+		Open = 1,
+		Start = 2,
+		// argument is the position in milliseconds
+		StartAt = 3,
+		Pause = 4,
+		Stop = 5,
+		// argument is the position in milliseconds
+		Seek = 6,
+		Close = 7,
+		// argument is the AudioStates value
+		SetState = 8,
+		// argument is 1 to loop
+		SetLoop = 9,
+		ResetPosition = 10
+	};
+
+	// One entry of the trace, little endian in files
+	struct EventTraceRecord
+	{
+		// Nanoseconds since the recorder was created
+		UINT64 timestamp;
+		UINT32 sequence;
+		// Sequence of the command an event answers, noCause for events nothing asked for
+		UINT32 cause;
+		// The result of a command or a handler, the status of an event
+		HRESULT status;
+		UINT32 code;
+		// Command argument, or the nanoseconds a handler took, clamped
+		INT32 argument;
+		// AudioStates right after the record
+		UINT16 state;
+		EventTraceKind kind;
+		BYTE reserved;
+	};
+
+	static_assert(sizeof(EventTraceRecord) == 32, "The record is written to files as it is");
+
+	struct EventTraceFileHeader
+	{
+		UINT32 magic;
+		UINT32 version;
+		UINT32 recordSize;
+		UINT32 recordCount;
+		// Older records the ring had already overwritten when it was dumped
+		UINT64 lostRecords;
+		UINT64 reserved;
+	};
+
+	static_assert(sizeof(EventTraceFileHeader) == 32, "The header is written to files as it is");
+
+	// Keeps the latest commands and session events of a player in a fixed ring of 32 byte records
+	// Recording takes a short lock and never allocates, a full ring overwrites the oldest records
+	class EventTraceRecorder
+	{
+		using nanoseconds = std::chrono::nanoseconds;
+		using steady_clock = std::chrono::steady_clock;
+
+		std::atomic<ULONG> referenceCount;
+
+		mutable std::mutex mutex;
+		EventTraceRecord* records;
+		UINT32 capacity;
+		// The next record's sequence is its lower 32 bits
+		UINT64 recordCount;
+		steady_clock::time_point origin;
+
+		// Sequence of the last command of each kind that a session event answers
+		UINT32 openCause;
+		UINT32 startCause;
+		UINT32 pauseCause;
+		UINT32 stopCause;
+		UINT32 closeCause;
+
+		EventTraceRecorder();
+
+		void Append(_In_ EventTraceKind kind, _In_ UINT32 code, _In_ HRESULT status, _In_ INT32 argument, _In_ UINT32 state, _In_ UINT32 cause, _In_ steady_clock::time_point time);
+
+		public:
+		static constexpr UINT32 magic = 0x52545041;
+		static constexpr UINT32 version = 1;
+		static constexpr UINT32 noCause = 0xFFFFFFFF;
+		static constexpr UINT32 defaultCapacity = 4096;
+		static constexpr UINT32 maxCapacity = 1 << 24;
+
+		~EventTraceRecorder();
+
+		EventTraceRecorder(const EventTraceRecorder&) = delete;
+		EventTraceRecorder& operator=(const EventTraceRecorder&) = delete;
+
+		// capacity is rounded up to a power of two, up to maxCapacity
+		static HRESULT Create(_In_ UINT32 capacity, _COM_Outptr_ EventTraceRecorder** pPtrRecorder);
+
+		ULONG STDMETHODCALLTYPE AddRef();
+		ULONG STDMETHODCALLTYPE Release();
+
+		void RecordCommand(_In_ EventTraceCommand command, _In_ INT32 argument, _In_ HRESULT result, _In_ UINT32 state);
+		void RecordEvent(_In_ MediaEventType type, _In_ HRESULT status, _In_ UINT32 state);
+		void RecordHandler(_In_ MediaEventType type, _In_ HRESULT result, _In_ steady_clock::time_point started, _In_ UINT32 state);
+
+		// Records written since creation, including the ones overwritten
+		UINT64 GetRecordCount() const;
+		// The records still in the ring, oldest first
+		HRESULT Snapshot(_Out_ std::vector<EventTraceRecord>& snapshot, _Out_opt_ UINT64* lostRecords = nullptr) const;
+		// Writes the snapshot to a file LoadEventTrace reads
+		HRESULT Dump(_In_z_ LPCWCH path) const;
+	};
+
+	// Returns ERROR_INVALID_DATA if the file isn't a trace
+	HRESULT LoadEventTrace(_In_z_ LPCWCH path, _Out_ std::vector<EventTraceRecord>& records);
+}
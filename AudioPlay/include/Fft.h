@@ -0,0 +1,46 @@
+#pragma once
+
+#include "PortableTypes.h"
+
+
+namespace AudioPlay
+{
+	// Radix 2 FFT of real input, the size is a power of two
+	// Runs as a complex FFT of half the size on split real and imaginary arrays so SSE2 does four butterflies at a time
+	class RealFft
+	{
+		UINT32 size;
+		UINT32 half;
+		UINT32* bitReverse;
+		// Twiddles of every stage from length 8 up, one after the other
+		float* twiddleReal;
+		float* twiddleImaginary;
+		// Splits the half size transform into the bins of the real one
+		float* splitReal;
+		float* splitImaginary;
+		float* workReal;
+		float* workImaginary;
+
+		void Release();
+
+		public:
+		static constexpr UINT32 minSize = 16;
+		static constexpr UINT32 maxSize = 65536;
+
+		RealFft();
+		~RealFft();
+
+		RealFft(const RealFft&) = delete;
+		RealFft& operator=(const RealFft&) = delete;
+
+		HRESULT Initialize(_In_ UINT32 fftSize);
+		UINT32 GetSize() const { return size; }
+		UINT32 GetBinCount() const { return half + 1; }
+
+		// Bins 0 to size / 2, unscaled
+		void Forward(_In_reads_(size) const float* input, _Out_writes_(half + 1) float* real, _Out_writes_(half + 1) float* imaginary);
+	};
+
+	// Average time of one Forward call
+	HRESULT MeasureFft(_In_ UINT32 fftSize, _In_ UINT32 iterations, _Out_ double& nanosecondsPerTransform);
+}
@@ -0,0 +1,123 @@
+#pragma once
+
+#include "WorkStealingPool.h"
+
+#include <atomic>
+#include <mutex>
+#include <vector>
+
+
+namespace AudioPlay
+{
+	struct Fingerprint
+	{
+		// One every Fingerprinter::hopSize samples at Fingerprinter::sampleRate, about 21.5 a second
+		std::vector<UINT32> hashes;
+		// Of the whole source if its length is known, of what was fingerprinted otherwise
+		UINT32 durationMilliseconds;
+	};
+
+	struct FingerprintMatch
+	{
+		UINT64 id;
+		// Share of equal bits where the two overlap, around 0.5 for unrelated audio
+		float similarity;
+		// Hashes the match is ahead of the query, negative if it starts later
+		INT32 offset;
+		UINT32 overlap;
+	};
+
+	// Reports every pair once, the entry added first is a
+	using DuplicateCallback = void (*)(const FingerprintMatch& a, const FingerprintMatch& b, void* context);
+
+	// Fingerprints of a catalog for finding the same recording again
+	// Every indexStride'th hash is kept in one sorted array, the entries most hashes of a query agree on an offset with are the candidates
+	// and they are confirmed by comparing every bit where the two overlap
+	// A stored hash agrees with a query hash that is the same or a single bit away, those share the upper or the lower half
+	// so the postings are bucketed by both halves
+	class FingerprintIndex
+	{
+		struct Entry
+		{
+			UINT64 id;
+			UINT64 first;
+			UINT32 count;
+			UINT32 durationMilliseconds;
+		};
+
+		struct Posting
+		{
+			UINT32 hash;
+			UINT32 entry;
+			UINT32 offset;
+
+			bool operator<(const Posting& other) const { return hash < other.hash; }
+		};
+
+		struct DuplicateJob
+		{
+			const FingerprintIndex* index;
+			float minSimilarity;
+			DuplicateCallback callback;
+			void* context;
+			UINT32 first;
+			UINT32 count;
+			HRESULT result;
+		};
+
+		std::atomic<ULONG> referenceCount;
+
+		UINT32 indexStride;
+
+		// Add is called from many threads, Lookup only after Build
+		std::mutex mutex;
+		std::vector<UINT32> hashes;
+		std::vector<Entry> entries;
+		// Sorted by hash, which also buckets them by the upper half
+		std::vector<Posting> postings;
+		// The same sorted by the lower half
+		std::vector<Posting> lowPostings;
+		// Where every value of a half starts in its array, one more than there are values
+		std::vector<size_t> highBuckets;
+		std::vector<size_t> lowBuckets;
+		bool built;
+
+		FingerprintIndex();
+
+		// Only entries from firstEntry on are candidates
+		void Lookup(_In_reads_(count) const UINT32* query, _In_ UINT32 count, _In_ float minSimilarity, _In_ UINT32 firstEntry,
+			_Out_ std::vector<FingerprintMatch>& matches) const;
+		void FindDuplicates(_In_ UINT32 first, _In_ UINT32 count, _In_ float minSimilarity, _In_ DuplicateCallback callback, _In_opt_ void* context) const;
+		static void RunDuplicateJob(_In_ void* context, _In_ UINT32 worker);
+
+		public:
+		static constexpr UINT32 hashBits = 32;
+		static constexpr UINT32 defaultIndexStride = 4;
+		// Hashes that are in more entries than this say nothing, like the ones of silence, Build drops them
+		static constexpr UINT32 maxPostingsPerHash = 4096;
+		// Hashes the query and an entry have to overlap by, about 3 seconds
+		static constexpr UINT32 minOverlap = 64;
+
+		// A larger stride makes the index smaller and needs longer overlaps to find a match
+		static HRESULT Create(_In_ UINT32 indexStride, _COM_Outptr_ FingerprintIndex** pPtrIndex);
+
+		ULONG STDMETHODCALLTYPE AddRef();
+		ULONG STDMETHODCALLTYPE Release();
+
+		// Ids don't have to be unique, adding after Build needs another Build
+		HRESULT Add(_In_ UINT64 id, _In_ const Fingerprint& fingerprint);
+		// Sorts what was added for Lookup
+		HRESULT Build();
+
+		// Matches are sorted by similarity, the best one of every entry
+		// Returns S_FALSE if nothing matched and E_NOT_VALID_STATE before Build
+		// 0.65 keeps different encodes of a recording and drops different recordings
+		HRESULT Lookup(_In_ const Fingerprint& query, _In_ float minSimilarity, _Out_ std::vector<FingerprintMatch>& matches) const;
+		// Looks every entry up and reports the pairs that match, entries are compared with the ones added after them
+		// With a pool the entries are split between its threads and the callback is called from all of them at once
+		HRESULT FindDuplicates(_In_ float minSimilarity, _In_ DuplicateCallback callback, _In_opt_ void* context, _In_opt_ WorkStealingPool* pool = nullptr) const;
+
+		UINT32 GetEntryCount() const { return static_cast<UINT32>(entries.size()); }
+		UINT64 GetMemoryUsage() const;
+	};
+}
@@ -0,0 +1,137 @@
+#pragma once
+
+#include "PcmSource.h"
+#include "Fft.h"
+#include "FingerprintIndex.h"
+#include "WorkStealingPool.h"
+
+#include <vector>
+
+
+namespace AudioPlay
+{
+	// The audio is downmixed and resampled to 11025 Hz through a windowed sinc, a frame of 2048 samples every 512 is one hash
+	// A hash has a bit for each pair of neighbouring bands from 300 Hz to 3 kHz, set if the energy difference of the pair grew
+	// since the frame before that didn't overlap
+	// That is what stays the same through a different encoder, bitrate, volume or sample rate
+	class Fingerprinter
+	{
+		// Hashes compare with the frame this many hops back, the first one that doesn't overlap
+		static constexpr UINT32 compareFrames = 4;
+
+		RealFft fft;
+		float* window;
+		float* frame;
+		float* real;
+		float* imaginary;
+		// Bin where every band starts, one more than there are bands
+		UINT32 bandStart[FingerprintIndex::hashBits + 2];
+		// Band differences of the last frames, a ring
+		float differences[compareFrames][FingerprintIndex::hashBits];
+		UINT32 frameIndex;
+
+		float* decoded;
+		float* resampled;
+		UINT32 resampledCount;
+
+		// Low-pass for the rate of the source, sampled kernelResolution times per input sample from the centre out
+		std::vector<float> kernel;
+		UINT32 kernelHalfWidth;
+		// Downmixed input the next output samples are filtered from, starting kernelHalfWidth samples before the first one with zeros
+		std::vector<float> history;
+		UINT64 historyStart;
+
+		UINT64 inputFrames;
+		UINT32 inputRate;
+		UINT64 outputSamples;
+		bool audible;
+
+		void DesignKernel(_In_ UINT32 rate);
+
+		void Resample(_In_reads_(frameCount * channels) const float* input, _In_ UINT32 frameCount, _In_ UINT32 channels, _In_ UINT32 sampleRate);
+		UINT32 Hash(_In_reads_(frameSize) const float* samples);
+
+		public:
+		static constexpr UINT32 sampleRate = 11025;
+		static constexpr UINT32 frameSize = 2048;
+		static constexpr UINT32 hopSize = 512;
+		static_assert(frameSize == hopSize * compareFrames, "Hashes compare frames that don't overlap");
+		// Leading silence is skipped and not counted, nearly silent frames only carry noise in their bits
+		static constexpr float silenceThreshold = 1e-4f;
+		static constexpr UINT32 decodeFrames = 4096;
+		static constexpr UINT32 maxChannels = 8;
+		// Lower rates would need more than two output samples per input frame
+		static constexpr UINT32 minSampleRate = 8000;
+		static constexpr UINT32 kernelResolution = 128;
+
+		Fingerprinter();
+		~Fingerprinter();
+
+		Fingerprinter(const Fingerprinter&) = delete;
+		Fingerprinter& operator=(const Fingerprinter&) = delete;
+
+		HRESULT Initialize();
+
+		// Reads source from its current position for maxSeconds of audio at most, 0 is everything
+		// Returns S_FALSE if it was too short or silent for a single hash
+		HRESULT Compute(_In_ PcmSource* source, _In_ UINT32 maxSeconds, _Out_ Fingerprint& fingerprint);
+		// Of the last Compute
+		UINT64 GetDecodedMilliseconds() const { return inputRate ? inputFrames * 1000 / inputRate : 0; }
+	};
+
+	struct FingerprintBatchStatistics
+	{
+		UINT64 files;
+		UINT64 failed;
+		// Fingerprints only look at the start of a file, this is how much was decoded
+		double decodedSeconds;
+		UINT64 hashes;
+	};
+
+	// Opens files, fingerprints them on a WorkStealingPool and adds them to an index
+	// WAV, AIFF and FLAC are decoded natively, anything else through Media Foundation on Windows
+	class FingerprintBatch
+	{
+		struct Job
+		{
+			FingerprintBatch* batch;
+			UINT64 id;
+			LPWCH path;
+		};
+
+		std::atomic<ULONG> referenceCount;
+
+		ComPtr<WorkStealingPool> pool;
+		ComPtr<FingerprintIndex> index;
+		UINT32 maxSeconds;
+		// One per pool thread
+		Fingerprinter* fingerprinters;
+
+		std::atomic<UINT64> files;
+		std::atomic<UINT64> failed;
+		std::atomic<UINT64> decodedMilliseconds;
+		std::atomic<UINT64> hashes;
+
+		FingerprintBatch();
+
+		static void Run(_In_ void* context, _In_ UINT32 worker);
+		HRESULT FingerprintFile(_In_ LPCWCH path, _In_ UINT32 worker, _Out_ Fingerprint& fingerprint);
+
+		public:
+		static constexpr UINT32 defaultMaxSeconds = 120;
+
+		~FingerprintBatch();
+
+		static HRESULT Create(_In_ WorkStealingPool* pool, _In_ FingerprintIndex* index, _In_ UINT32 maxSeconds, _COM_Outptr_ FingerprintBatch** pPtrBatch);
+
+		ULONG STDMETHODCALLTYPE AddRef();
+		ULONG STDMETHODCALLTYPE Release();
+
+		// Copies the path, the fingerprint is added to the index under id
+		HRESULT Add(_In_z_ LPCWCH path, _In_ UINT64 id);
+		// Waits for every file added so far and builds the index
+		HRESULT Finish();
+
+		FingerprintBatchStatistics GetStatistics() const;
+	};
+}
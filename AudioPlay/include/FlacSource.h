@@ -0,0 +1,103 @@
+#pragma once
+
+#include "PcmSource.h"
+#include "MappedFile.h"
+#include "Md5.h"
+#include "PcmKernels.h"
+
+
+namespace AudioPlay
+{
+	// Streaming FLAC decoder reading straight out of a mapped file
+	// Supports up to 8 channels and 24 bits per sample
+	class FlacSource : public PcmSource
+	{
+		struct SeekPoint
+		{
+			UINT64 sample;
+			// From the first frame header
+			UINT64 offset;
+		};
+
+		struct FrameHeader
+		{
+			UINT32 blockSize;
+			UINT32 sampleRate;
+			UINT32 channelAssignment;
+			UINT32 bitsPerSample;
+			UINT64 firstSample;
+			// Bytes of the header including its CRC-8
+			UINT32 size;
+		};
+
+		ComPtr<MemoryBlock> block;
+		const BYTE* data;
+		UINT64 size;
+		UINT64 firstFrameOffset;
+		UINT64 nextFrameOffset;
+
+		UINT32 minBlockSize;
+		UINT32 maxBlockSize;
+		UINT32 bitsPerSample;
+		UINT64 totalSamples;
+		BYTE streamMd5[16];
+
+		SeekPoint* seekPoints;
+		UINT32 seekPointCount;
+
+		// One buffer per channel with room for the SIMD kernels to read a little before the first sample
+		INT32* channelBuffers;
+		UINT32 channelStride;
+		UINT32 blockFrames;
+		UINT32 blockOffset;
+		UINT64 blockStart;
+		bool endOfStream;
+
+		// Interleaves the channel buffers, the gains scale the samples from bitsPerSample
+		PcmPipelineKernel interleaveKernel;
+		PcmChannelGains interleaveGains;
+
+		bool verifying;
+		Md5 md5;
+		BYTE* md5Buffer;
+		HRESULT verificationResult;
+
+		UINT64 decodedFrames;
+		UINT64 decodeNanoseconds;
+
+		FlacSource();
+
+		HRESULT ParseMetadata();
+		HRESULT AllocateBuffers();
+		bool ParseFrameHeader(_In_ UINT64 offset, _Out_ FrameHeader& header) const;
+		bool FindFrame(_In_ UINT64 offset, _Out_ UINT64& frameOffset, _Out_ FrameHeader& header) const;
+		HRESULT DecodeFrame();
+		void UpdateMd5();
+		INT32* GetChannel(_In_ UINT32 channel) const;
+
+		public:
+		~FlacSource();
+
+		static HRESULT Open(_In_z_ LPCWCH path, _COM_Outptr_ FlacSource** pPtrSource);
+		// Returns AUDIO_E_UNSUPPORTED_FORMAT if the block isn't a FLAC stream
+		static HRESULT Create(_In_ MemoryBlock* block, _COM_Outptr_ FlacSource** pPtrSource);
+		// True if the block starts with a FLAC stream, an ID3v2 tag in front of it is skipped
+		static bool CanRead(_In_reads_bytes_(size) const BYTE* data, _In_ UINT64 size);
+		// Decodes the whole file and compares it to the MD5 in STREAMINFO
+		// Returns AUDIO_E_CORRUPT_DATA on a mismatch and S_FALSE if the encoder didn't store a checksum
+		static HRESULT Verify(_In_z_ LPCWCH path);
+
+		UINT32 GetBitsPerSample() const { return bitsPerSample; }
+		// Audio decoded per second of decoding time, 0 until something is decoded
+		double GetDecodeSpeed() const;
+		// S_OK if everything from the first frame was decoded without a seek and matched the MD5
+		// S_FALSE if that can't be told yet or the file has no checksum, AUDIO_E_CORRUPT_DATA on a mismatch
+		HRESULT GetVerificationResult() const;
+
+		HRESULT Read(_Out_writes_(frameCount * format.channels) float* buffer, _In_ UINT32 frameCount, _Out_ UINT32& framesRead) override;
+		// Uses the SEEKTABLE if there is one and bisects the file otherwise, exact to the frame
+		HRESULT Seek(_In_ UINT64 frame) override;
+		HRESULT GetPosition(_Out_ UINT64& frame) const override;
+		HRESULT GetLength(_Out_ UINT64& frames) const override;
+	};
+}
@@ -0,0 +1,48 @@
+#pragma once
+
+#include "PcmSource.h"
+#include "MappedFile.h"
+
+
+namespace AudioPlay
+{
+	// Priming and padding the encoder added around the audio, in decoded frames
+	struct GaplessInfo
+	{
+		// Frames to drop at the start of the decoded stream, the decoder's delay included
+		UINT32 leadingFrames;
+		// Frames of padding left at the end of the decoded stream
+		UINT32 trailingFrames;
+		// Frames of the original audio, 0 if the file doesn't say
+		UINT64 validFrames;
+	};
+
+	// Reads the LAME tag of an MP3, the iTunSMPB atom of an MP4 or the pre-skip and end granule position of an Ogg Opus stream
+	// Returns S_FALSE and a zeroed info if the file has neither
+	HRESULT ReadGaplessInfo(_In_reads_bytes_(size) const BYTE* data, _In_ UINT64 size, _Out_ GaplessInfo& info);
+	HRESULT ReadGaplessInfo(_In_ MemoryBlock* block, _Out_ GaplessInfo& info);
+
+	// Plays only the frames of another source the encoder was given, positions and the length are of the trimmed stream
+	class TrimSource : public PcmSource
+	{
+		ComPtr<PcmSource> source;
+
+		UINT64 leadingFrames;
+		// unknownLength if neither the file nor the inner source know it, the padding is played then
+		UINT64 length;
+		UINT64 position;
+
+		TrimSource();
+
+		public:
+		static constexpr UINT64 unknownLength = ~0ULL;
+
+		// Seeks source past the leading frames, the source has to be seekable
+		static HRESULT Create(_In_ PcmSource* source, _In_ const GaplessInfo& info, _COM_Outptr_ TrimSource** pPtrSource);
+
+		HRESULT Read(_Out_writes_(frameCount * format.channels) float* buffer, _In_ UINT32 frameCount, _Out_ UINT32& framesRead) override;
+		HRESULT Seek(_In_ UINT64 frame) override;
+		HRESULT GetPosition(_Out_ UINT64& frame) const override;
+		HRESULT GetLength(_Out_ UINT64& frames) const override;
+	};
+}
@@ -0,0 +1,55 @@
+#pragma once
+
+#include "PcmSource.h"
+
+
+namespace AudioPlay
+{
+	// Repeats a region of another source in the PCM stream, the wrap lands on the exact frame without a gap
+	// Regions that fit in maxPredecodedBytes are decoded once at creation and looped from memory
+	// Longer regions seek the inner source at every wrap
+	class LoopingSource : public PcmSource
+	{
+		ComPtr<PcmSource> source;
+
+		UINT64 loopStart;
+		// unknownEnd until the inner source runs out if its length isn't known
+		UINT64 loopEnd;
+		// Changed by the control thread, the reading thread only decrements it
+		std::atomic<UINT32> loopsRemaining;
+		UINT64 wrapCount;
+
+		float* region;
+		UINT64 regionFrames;
+
+		UINT64 position;
+		UINT64 sourcePosition;
+
+		LoopingSource();
+
+		public:
+		static constexpr UINT32 loopForever = 0xFFFFFFFF;
+		static constexpr UINT64 unknownEnd = ~0ULL;
+		static constexpr UINT64 maxPredecodedBytes = 32 * 1024 * 1024;
+
+		~LoopingSource();
+
+		// Plays source from its current position and goes back to startFrame every time endFrame is reached, loopCount times
+		// endFrame 0 is the end of the source, the source has to be seekable
+		static HRESULT Create(_In_ PcmSource* source, _In_ UINT64 startFrame, _In_ UINT64 endFrame, _In_ UINT32 loopCount, _COM_Outptr_ LoopingSource** pPtrSource);
+
+		// Can be called while playing, 0 lets the source play through to its end after the current pass
+		void SetLoopCount(_In_ UINT32 loopCount) { loopsRemaining = loopCount; }
+		UINT32 GetLoopsRemaining() const { return loopsRemaining; }
+		UINT64 GetWrapCount() const { return wrapCount; }
+		bool IsPredecoded() const { return region != nullptr; }
+
+		HRESULT Read(_Out_writes_(frameCount * format.channels) float* buffer, _In_ UINT32 frameCount, _Out_ UINT32& framesRead) override;
+		HRESULT Seek(_In_ UINT64 frame) override;
+		// Position in the inner source, it jumps back at every wrap
+		HRESULT GetPosition(_Out_ UINT64& frame) const override;
+		// The length of the inner source, looping doesn't change the track
+		// Returns S_FALSE while it loops forever since the stream has no end then
+		HRESULT GetLength(_Out_ UINT64& frames) const override;
+	};
+}
@@ -0,0 +1,52 @@
+#pragma once
+
+#include "PortableTypes.h"
+
+#include <atomic>
+
+
+namespace AudioPlay
+{
+	// Reference counted read-only bytes that can be shared between players
+	class MemoryBlock
+	{
+		std::atomic<ULONG> referenceCount;
+
+		protected:
+		const BYTE* data;
+		UINT64 size;
+
+		MemoryBlock();
+		MemoryBlock(_In_reads_bytes_(size) const BYTE* data, _In_ UINT64 size);
+
+		public:
+		virtual ~MemoryBlock();
+
+		// The memory is owned by the caller and has to outlive the block
+		static HRESULT CreateFromSpan(_In_reads_bytes_(size) const BYTE* data, _In_ UINT64 size, _COM_Outptr_ MemoryBlock** pPtrBlock);
+
+		virtual ULONG STDMETHODCALLTYPE AddRef();
+		virtual ULONG STDMETHODCALLTYPE Release();
+
+		const BYTE* GetData() const { return data; }
+		UINT64 GetSize() const { return size; }
+	};
+
+	// A whole file mapped read-only into memory
+	class MappedFile : public MemoryBlock
+	{
+		#ifdef _WIN32
+		HANDLE file;
+		HANDLE mapping;
+		#else
+		int descriptor;
+		#endif
+
+		MappedFile();
+
+		public:
+		~MappedFile();
+
+		static HRESULT Open(_In_z_ LPCWCH path, _COM_Outptr_ MappedFile** pPtrFile);
+	};
+}
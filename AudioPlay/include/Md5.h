@@ -0,0 +1,25 @@
+#pragma once
+
+#include "PortableTypes.h"
+
+
+namespace AudioPlay
+{
+	// RFC 1321, used to check decoded audio against the checksums stored in lossless files
+	class Md5
+	{
+		UINT32 state[4];
+		UINT64 length;
+		BYTE buffer[64];
+
+		void Transform(_In_reads_bytes_(64) const BYTE* block);
+
+		public:
+		Md5();
+
+		void Reset();
+		void Update(_In_reads_bytes_(size) const void* data, _In_ size_t size);
+		// The hash has to be reset before it's used again
+		void Finish(_Out_writes_bytes_(16) BYTE* digest);
+	};
+}
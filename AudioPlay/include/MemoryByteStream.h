@@ -0,0 +1,57 @@
+#pragma once
+
+#include "AudioPlay.h"
+#include "MappedFile.h"
+
+
+namespace AudioPlay
+{
+	// Read-only IMFByteStream that serves reads straight out of a MemoryBlock
+	// Every stream has its own position so one block can back any number of players
+	class MemoryByteStream : public IMFByteStream
+	{
+		private:
+		ULONG referenceCount;
+
+		CRITICAL_SECTION criticalSection;
+
+		ComPtr<MemoryBlock> block;
+		QWORD position;
+
+		MemoryByteStream(_In_ MemoryBlock* block);
+
+		public:
+		virtual ~MemoryByteStream();
+
+		static HRESULT Create(_In_ MemoryBlock* block, _COM_Outptr_ IMFByteStream** pPtrByteStream);
+
+		#pragma region IMPLEMENT_IUnknown
+
+		STDMETHODIMP QueryInterface(REFIID riid, _COM_Outptr_ void** pPtr);
+
+		STDMETHODIMP_(ULONG) AddRef();
+		STDMETHODIMP_(ULONG) Release();
+
+		#pragma endregion
+
+		#pragma region IMPLEMENT_IMFByteStream
+
+		STDMETHODIMP GetCapabilities(_Out_ DWORD* pdwCapabilities);
+		STDMETHODIMP GetLength(_Out_ QWORD* pqwLength);
+		STDMETHODIMP SetLength(_In_ QWORD qwLength);
+		STDMETHODIMP GetCurrentPosition(_Out_ QWORD* pqwPosition);
+		STDMETHODIMP SetCurrentPosition(_In_ QWORD qwPosition);
+		STDMETHODIMP IsEndOfStream(_Out_ BOOL* pfEndOfStream);
+		STDMETHODIMP Read(_Out_writes_bytes_(cb) BYTE* pb, _In_ ULONG cb, _Out_ ULONG* pcbRead);
+		STDMETHODIMP BeginRead(_Out_writes_bytes_(cb) BYTE* pb, _In_ ULONG cb, _In_ IMFAsyncCallback* pCallback, _In_opt_ IUnknown* punkState);
+		STDMETHODIMP EndRead(_In_ IMFAsyncResult* pResult, _Out_ ULONG* pcbRead);
+		STDMETHODIMP Write(_In_reads_bytes_(cb) const BYTE* pb, _In_ ULONG cb, _Out_ ULONG* pcbWritten);
+		STDMETHODIMP BeginWrite(_In_reads_bytes_(cb) const BYTE* pb, _In_ ULONG cb, _In_ IMFAsyncCallback* pCallback, _In_opt_ IUnknown* punkState);
+		STDMETHODIMP EndWrite(_In_ IMFAsyncResult* pResult, _Out_ ULONG* pcbWritten);
+		STDMETHODIMP Seek(_In_ MFBYTESTREAM_SEEK_ORIGIN SeekOrigin, _In_ LONGLONG llSeekOffset, _In_ DWORD dwSeekFlags, _Out_opt_ QWORD* pqwCurrentPosition);
+		STDMETHODIMP Flush();
+		STDMETHODIMP Close();
+
+		#pragma endregion
+	};
+}
@@ -0,0 +1,56 @@
+#pragma once
+
+#include "AudioPlay.h"
+
+#include <propsys.h>
+
+
+namespace AudioPlay
+{
+	struct MetadataEntry
+	{
+		PROPERTYKEY key;
+		// One of VT_LPWSTR, VT_I4, VT_UI4, VT_I8, VT_UI8, VT_R8, VT_BOOL or VT_FILETIME
+		// String vectors (like PKEY_Music_Artist) are joined with "; "
+		VARTYPE type;
+		union
+		{
+			LPCWCH stringValue;
+			LONGLONG intValue;
+			ULONGLONG uintValue;
+			double doubleValue;
+			BOOL boolValue;
+			FILETIME fileTimeValue;
+		};
+	};
+
+	// Every property of a media source read once into a single block of memory
+	// Strings live in the same block and identical strings are stored once
+	// Use CoTaskMemFree on the snapshot when you are done with it
+	class MetadataSnapshot
+	{
+		DWORD entryCount;
+		const MetadataEntry* entries;
+
+		const MetadataEntry* title;
+		const MetadataEntry* albumName;
+		const MetadataEntry* artist;
+
+		MetadataSnapshot() = default;
+
+		public:
+		static HRESULT Create(_In_ IMFMediaSource* mediaSource, _Outptr_result_maybenull_ MetadataSnapshot** pPtrSnapshot);
+		static HRESULT Create(_In_ IPropertyStore* propertyStore, _Outptr_result_maybenull_ MetadataSnapshot** pPtrSnapshot);
+
+		// Returned strings are valid until the snapshot is freed
+		// Returns S_FALSE and nullptr if the file doesn't have the property
+		HRESULT GetTitle(_Outref_result_maybenull_ LPCWCH& title) const;
+		HRESULT GetAlbumName(_Outref_result_maybenull_ LPCWCH& albumName) const;
+		HRESULT GetArtist(_Outref_result_maybenull_ LPCWCH& artist) const;
+		HRESULT GetString(_In_ REFPROPERTYKEY properityKey, _Outref_result_maybenull_ LPCWCH& value) const;
+
+		DWORD GetCount() const { return entryCount; }
+		const MetadataEntry* GetEntry(_In_ DWORD index) const { return index < entryCount ? &entries[index] : nullptr; }
+		const MetadataEntry* Find(_In_ REFPROPERTYKEY properityKey) const;
+	};
+}
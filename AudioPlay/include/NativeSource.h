@@ -0,0 +1,14 @@
+#pragma once
+
+#include "PcmSource.h"
+#include "MappedFile.h"
+
+
+namespace AudioPlay
+{
+	// Picks a built-in decoder from the first bytes of the block
+	// Returns AUDIO_E_UNSUPPORTED_FORMAT if none of them can read it, Media Foundation has to be used then
+	HRESULT CreateNativeSource(_In_ MemoryBlock* block, _COM_Outptr_ PcmSource** pPtrSource);
+	// Maps the file and calls CreateNativeSource
+	HRESULT OpenNativeSource(_In_z_ LPCWCH path, _COM_Outptr_ PcmSource** pPtrSource);
+}
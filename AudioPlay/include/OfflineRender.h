@@ -0,0 +1,20 @@
+#pragma once
+
+#include "PcmSource.h"
+#include "PcmSink.h"
+
+
+namespace AudioPlay
+{
+	struct OfflineRenderStats
+	{
+		UINT64 frames;
+		UINT64 nanoseconds;
+		// Seconds of audio rendered per second
+		double speed;
+	};
+
+	// Pulls the source from its current position to the end as fast as it decodes and writes everything to the sink
+	// Needs no audio device, Audio::SetOfflineSink does the same for files played through Media Foundation
+	HRESULT RenderOffline(_In_ PcmSource* source, _In_ PcmSink* sink, _Out_opt_ OfflineRenderStats* stats);
+}
@@ -0,0 +1,62 @@
+#pragma once
+
+#include "Audio.h"
+
+#include <deque>
+#include <vector>
+
+
+namespace AudioPlay
+{
+	// Runs BeginOpenFile for any number of players with at most maxConcurrentOpens resolving at once
+	class OpenQueue
+	{
+		struct Request
+		{
+			OpenQueue* queue;
+			ComPtr<Audio> audio;
+			LPWCH path;
+			OpenCompletedCallback callback;
+			void* context;
+			// Between leaving pending and BeginOpenFile returning, Cancel only marks it then
+			bool starting;
+			bool cancelled;
+			// Completed while starting, StartPending frees it
+			bool completed;
+		};
+
+		CRITICAL_SECTION criticalSection;
+		HANDLE idleEvent;
+
+		std::deque<Request*> pending;
+		std::vector<Request*> running;
+
+		UINT32 maxConcurrentOpens;
+		UINT32 callbacksInFlight;
+		bool closing;
+
+		static void OnOpenCompleted(Audio* audio, HRESULT result, void* context);
+		static void Complete(_In_ Request* request, _In_ HRESULT result);
+		void StartPending();
+		void UpdateIdle(_In_ bool leavingCallback);
+
+		public:
+		// 0 uses the number of processors
+		OpenQueue(_In_ UINT32 maxConcurrentOpens = 0);
+		// Cancels everything that hasn't completed yet
+		~OpenQueue();
+
+		OpenQueue(const OpenQueue&) = delete;
+		OpenQueue& operator=(const OpenQueue&) = delete;
+
+		// callback is called exactly once if this succeeds, with E_ABORT if the request is cancelled
+		HRESULT Enqueue(_In_ Audio* audio, _In_ LPCWCH path, _In_opt_ OpenCompletedCallback callback, _In_opt_ void* context);
+		// Returns S_FALSE if the player has no request in the queue
+		HRESULT Cancel(_In_ Audio* audio);
+		void CancelAll();
+
+		UINT32 GetPendingCount();
+		UINT32 GetRunningCount();
+		UINT32 GetMaxConcurrentOpens() const { return maxConcurrentOpens; }
+	};
+}
@@ -0,0 +1,240 @@
+#pragma once
+
+#include "PcmSource.h"
+#include "Simd.h"
+
+#include <cstring>
+
+
+namespace AudioPlay
+{
+	enum class SampleEncoding
+	{
+		UInt8,
+		Int8,
+		Int16,
+		Int24,
+		Int32,
+		Float32,
+		Float64
+	};
+
+	enum class PcmLayout
+	{
+		// The channels of a frame next to each other in one buffer
+		Interleaved,
+		// One buffer per channel, the way decoders produce them
+		Planar
+	};
+
+	// Stages a kernel runs in the same pass, every kernel converts to float
+	enum class PcmStages
+	{
+		Convert = 0x0,
+		// Multiplies every channel by its own gain, volume and pan in one
+		Gain = 0x1,
+		// Adds to the destination instead of overwriting it
+		Mix = 0x2,
+		GainMix = Gain | Mix
+	};
+
+	constexpr PcmStages operator&(const PcmStages& lhs, const PcmStages& rhs)
+	{
+		return (PcmStages)((int)lhs & (int)rhs);
+	}
+
+	constexpr PcmStages operator|(const PcmStages& lhs, const PcmStages& rhs)
+	{
+		return (PcmStages)((int)lhs | (int)rhs);
+	}
+
+	constexpr UINT32 pcmMaxChannels = 8;
+
+	struct PcmChannelGains
+	{
+		float gains[pcmMaxChannels];
+	};
+
+	// volume times a constant power pan law, pan goes from -1 (left) to 1 (right) and only moves stereo
+	void ComputePcmChannelGains(_In_ float volume, _In_ float pan, _In_ UINT32 channels, _Out_ PcmChannelGains& gains);
+
+	// Integers are scaled to [-1, 1), the scale is folded into the gains so every sample is multiplied once
+	template <typename Sample>
+	struct PcmSampleTraits;
+
+	template <>
+	struct PcmSampleTraits<INT16>
+	{
+		static constexpr float scale = 1.0f / 32768.0f;
+
+		static float Load(_In_ const INT16* sample) { INT16 value; memcpy(&value, sample, sizeof(value)); return static_cast<float>(value); }
+
+		#ifdef AUDIOPLAY_SSE2
+		static __m128 Load4(_In_reads_(4) const INT16* samples)
+		{
+			__m128i packed = _mm_loadl_epi64(reinterpret_cast<const __m128i*>(samples));
+
+			// Puts every sample in the upper half of a 32 bit lane, the arithmetic shift sign extends it
+			return _mm_cvtepi32_ps(_mm_srai_epi32(_mm_unpacklo_epi16(packed, packed), 16));
+		}
+		#endif
+	};
+
+	template <>
+	struct PcmSampleTraits<INT32>
+	{
+		static constexpr float scale = 1.0f / 2147483648.0f;
+
+		static float Load(_In_ const INT32* sample) { INT32 value; memcpy(&value, sample, sizeof(value)); return static_cast<float>(value); }
+
+		#ifdef AUDIOPLAY_SSE2
+		static __m128 Load4(_In_reads_(4) const INT32* samples) { return _mm_cvtepi32_ps(_mm_loadu_si128(reinterpret_cast<const __m128i*>(samples))); }
+		#endif
+	};
+
+	template <>
+	struct PcmSampleTraits<float>
+	{
+		static constexpr float scale = 1.0f;
+
+		static float Load(_In_ const float* sample) { float value; memcpy(&value, sample, sizeof(value)); return value; }
+
+		#ifdef AUDIOPLAY_SSE2
+		static __m128 Load4(_In_reads_(4) const float* samples) { return _mm_loadu_ps(samples); }
+		#endif
+	};
+
+	// Converts frameCount frames to interleaved float and runs the other Stages on them in the same pass
+	// planes holds one pointer per channel for planar input and only the first one for interleaved input
+	// Channels is 0 for a channel count only known at run time, known counts are unrolled and mono and stereo use SSE2
+	template <typename Sample, UINT32 Channels, PcmLayout Layout, PcmStages Stages>
+	void RunPcmPipeline(_In_ const void* const* planes, _Inout_updates_(frameCount * channels) float* destination, _In_ UINT32 frameCount,
+		_In_ UINT32 channels, _In_ const PcmChannelGains& gains)
+	{
+		using Traits = PcmSampleTraits<Sample>;
+
+		constexpr bool applyGain = (Stages & PcmStages::Gain) == PcmStages::Gain;
+		constexpr bool mix = (Stages & PcmStages::Mix) == PcmStages::Mix;
+
+		const UINT32 channelCount = Channels ? Channels : channels;
+
+		if constexpr (Layout == PcmLayout::Interleaved && !applyGain && Channels != 1)
+		{
+			// Every sample is scaled the same, the channels don't matter
+			RunPcmPipeline<Sample, 1, Layout, Stages>(planes, destination, frameCount * channelCount, 1, gains);
+			return;
+		}
+		else
+		{
+			if constexpr (Layout == PcmLayout::Interleaved && Channels == 1 && Traits::scale == 1.0f && !applyGain && !mix)
+			{
+				memcpy(destination, planes[0], static_cast<size_t>(frameCount) * sizeof(float));
+				return;
+			}
+
+			float factors[pcmMaxChannels];
+
+			for (UINT32 channel = 0; channel < channelCount; channel++)
+			{
+				factors[channel] = applyGain ? gains.gains[channel] * Traits::scale : Traits::scale;
+			}
+
+			UINT32 frame = 0;
+
+			#ifdef AUDIOPLAY_SSE2
+			if constexpr (Channels == 1 || Channels == 2)
+			{
+				const __m128 factorVector = Channels == 1 ? _mm_set1_ps(factors[0]) : _mm_setr_ps(factors[0], factors[1], factors[0], factors[1]);
+
+				// Four frames, one vector per channel
+				for (; frame + 4 <= frameCount; frame += 4)
+				{
+					__m128 vectors[Channels];
+
+					if constexpr (Layout == PcmLayout::Interleaved || Channels == 1)
+					{
+						const Sample* samples = static_cast<const Sample*>(planes[0]) + static_cast<size_t>(frame) * Channels;
+
+						for (UINT32 vector = 0; vector < Channels; vector++)
+						{
+							vectors[vector] = Traits::Load4(samples + vector * 4);
+						}
+					}
+					else
+					{
+						__m128 left = Traits::Load4(static_cast<const Sample*>(planes[0]) + frame);
+						__m128 right = Traits::Load4(static_cast<const Sample*>(planes[1]) + frame);
+
+						vectors[0] = _mm_unpacklo_ps(left, right);
+						vectors[1] = _mm_unpackhi_ps(left, right);
+					}
+
+					for (UINT32 vector = 0; vector < Channels; vector++)
+					{
+						float* output = destination + static_cast<size_t>(frame) * Channels + vector * 4;
+						__m128 value = _mm_mul_ps(vectors[vector], factorVector);
+
+						if constexpr (mix)
+						{
+							value = _mm_add_ps(value, _mm_loadu_ps(output));
+						}
+
+						_mm_storeu_ps(output, value);
+					}
+				}
+			}
+			#endif
+
+			for (; frame < frameCount; frame++)
+			{
+				float* output = destination + static_cast<size_t>(frame) * channelCount;
+
+				for (UINT32 channel = 0; channel < channelCount; channel++)
+				{
+					const Sample* sample = Layout == PcmLayout::Interleaved ?
+						static_cast<const Sample*>(planes[0]) + static_cast<size_t>(frame) * channelCount + channel :
+						static_cast<const Sample*>(planes[channel]) + frame;
+
+					float value = Traits::Load(sample) * factors[channel];
+					output[channel] = mix ? output[channel] + value : value;
+				}
+			}
+		}
+	}
+
+	struct PcmPipelineConfig
+	{
+		SampleEncoding encoding;
+		UINT32 channels;
+		PcmLayout layout;
+		PcmStages stages;
+	};
+
+	using PcmPipelineKernel = void (*)(_In_ const void* const* planes, _Inout_ float* destination, _In_ UINT32 frameCount,
+		_In_ UINT32 channels, _In_ const PcmChannelGains& gains);
+
+	// Picks the kernel for a configuration once, when a source is opened, so nothing is decided per sample
+	// Mono and stereo get their own kernels, other channel counts share one per sample type, layout and stages
+	// Returns nullptr for encodings without kernels (8 and 24 bit, Float64) and more than pcmMaxChannels channels
+	PcmPipelineKernel SelectPcmPipeline(_In_ const PcmPipelineConfig& config, _Out_opt_ bool* specialized = nullptr);
+
+	// The same stages deciding the encoding, layout and stages for every sample, for comparison with the kernels
+	void RunPcmPipelineGeneric(_In_ const PcmPipelineConfig& config, _In_ const void* const* planes, _Inout_ float* destination, _In_ UINT32 frameCount,
+		_In_ const PcmChannelGains& gains);
+
+	struct PcmPipelineCost
+	{
+		UINT64 frames;
+		UINT64 kernelNanoseconds;
+		UINT64 genericNanoseconds;
+		double kernelNanosecondsPerFrame;
+		double genericNanosecondsPerFrame;
+		// Generic time over kernel time
+		double speedup;
+		// Whether the configuration has its own kernel
+		bool specialized;
+	};
+
+	// Runs the selected kernel and RunPcmPipelineGeneric over the same generated noise and measures both
+	HRESULT MeasurePcmPipeline(_In_ const PcmPipelineConfig& config, _In_ UINT32 blockFrames, _In_ UINT64 totalFrames, _Out_ PcmPipelineCost& cost);
+}
@@ -0,0 +1,145 @@
+#pragma once
+
+#include "AudioPlay.h"
+#include "PcmSource.h"
+#include "RenderTelemetry.h"
+
+#include <vector>
+
+
+namespace AudioPlay
+{
+	class PcmMediaSource;
+
+	class PcmMediaStream : public IMFMediaStream
+	{
+		friend class PcmMediaSource;
+
+		private:
+		ULONG referenceCount;
+
+		PcmMediaSource* mediaSource;
+		ComPtr<IMFStreamDescriptor> streamDescriptor;
+		ComPtr<IMFMediaEventQueue> eventQueue;
+
+		PcmMediaStream(_In_ PcmMediaSource* mediaSource, _In_ IMFStreamDescriptor* streamDescriptor);
+
+		public:
+		virtual ~PcmMediaStream();
+
+		#pragma region IMPLEMENT_IUnknown
+
+		STDMETHODIMP QueryInterface(REFIID riid, _COM_Outptr_ void** pPtr);
+
+		STDMETHODIMP_(ULONG) AddRef();
+		STDMETHODIMP_(ULONG) Release();
+
+		#pragma endregion
+
+		#pragma region IMPLEMENT_IMFMediaEventGenerator
+
+		STDMETHODIMP GetEvent(DWORD dwFlags, _COM_Outptr_ IMFMediaEvent** ppEvent);
+		STDMETHODIMP BeginGetEvent(_In_ IMFAsyncCallback* pCallback, _In_opt_ IUnknown* punkState);
+		STDMETHODIMP EndGetEvent(_In_ IMFAsyncResult* pResult, _COM_Outptr_ IMFMediaEvent** ppEvent);
+		STDMETHODIMP QueueEvent(MediaEventType met, REFGUID guidExtendedType, HRESULT hrStatus, _In_opt_ const PROPVARIANT* pvValue);
+
+		#pragma endregion
+
+		#pragma region IMPLEMENT_IMFMediaStream
+
+		STDMETHODIMP GetMediaSource(_COM_Outptr_ IMFMediaSource** ppMediaSource);
+		STDMETHODIMP GetStreamDescriptor(_COM_Outptr_ IMFStreamDescriptor** ppStreamDescriptor);
+		STDMETHODIMP RequestSample(_In_opt_ IUnknown* pToken);
+
+		#pragma endregion
+	};
+
+	// Media Foundation source with a single float audio stream that pulls its frames from a PcmSource
+	// Samples are produced on the thread that requests them, the PcmSource is never used by two threads at once
+	class PcmMediaSource : public IMFMediaSource, public IMFGetService
+	{
+		friend class PcmMediaStream;
+
+		enum class SourceState
+		{
+			Stopped,
+			Paused,
+			Started,
+			Shutdown
+		};
+
+		private:
+		ULONG referenceCount;
+
+		CRITICAL_SECTION criticalSection;
+
+		ComPtr<IMFMediaEventQueue> eventQueue;
+		ComPtr<IMFPresentationDescriptor> presentationDescriptor;
+		ComPtr<PcmMediaStream> stream;
+		ComPtr<PcmSource> source;
+		ComPtr<RenderTelemetry> telemetry;
+		// Metadata of the file the PCM was decoded from, handed out through MF_PROPERTY_HANDLER_SERVICE
+		ComPtr<IPropertyStore> properties;
+
+		SourceState sourceState;
+		bool streamCreated;
+		bool endOfStream;
+		UINT64 position;
+		UINT32 framesPerSample;
+
+		// Requests that came in while paused, delivered on the next start
+		std::vector<IUnknown*> pendingTokens;
+
+		PcmMediaSource(_In_ PcmSource* source, _In_opt_ RenderTelemetry* telemetry, _In_opt_ IPropertyStore* properties);
+
+		HRESULT Initialize();
+		HRESULT CheckShutdown() const;
+		HRESULT RequestSample(_In_opt_ IUnknown* token);
+		HRESULT DeliverSample(_In_opt_ IUnknown* token);
+		void ReleasePendingTokens();
+		LONGLONG FramesToTime(_In_ UINT64 frames) const;
+
+		public:
+		virtual ~PcmMediaSource();
+
+		// Every delivered buffer is timed and reported to telemetry if there is one
+		// properties keeps the metadata of the decoded file available, see SourceReaderPcmSource::GetPropertyStore
+		static HRESULT Create(_In_ PcmSource* source, _COM_Outptr_ IMFMediaSource** pPtrMediaSource, _In_opt_ RenderTelemetry* telemetry = nullptr,
+			_In_opt_ IPropertyStore* properties = nullptr);
+
+		#pragma region IMPLEMENT_IUnknown
+
+		STDMETHODIMP QueryInterface(REFIID riid, _COM_Outptr_ void** pPtr);
+
+		STDMETHODIMP_(ULONG) AddRef();
+		STDMETHODIMP_(ULONG) Release();
+
+		#pragma endregion
+
+		#pragma region IMPLEMENT_IMFMediaEventGenerator
+
+		STDMETHODIMP GetEvent(DWORD dwFlags, _COM_Outptr_ IMFMediaEvent** ppEvent);
+		STDMETHODIMP BeginGetEvent(_In_ IMFAsyncCallback* pCallback, _In_opt_ IUnknown* punkState);
+		STDMETHODIMP EndGetEvent(_In_ IMFAsyncResult* pResult, _COM_Outptr_ IMFMediaEvent** ppEvent);
+		STDMETHODIMP QueueEvent(MediaEventType met, REFGUID guidExtendedType, HRESULT hrStatus, _In_opt_ const PROPVARIANT* pvValue);
+
+		#pragma endregion
+
+		#pragma region IMPLEMENT_IMFMediaSource
+
+		STDMETHODIMP GetCharacteristics(_Out_ DWORD* pdwCharacteristics);
+		STDMETHODIMP CreatePresentationDescriptor(_COM_Outptr_ IMFPresentationDescriptor** ppPresentationDescriptor);
+		STDMETHODIMP Start(_In_ IMFPresentationDescriptor* pPresentationDescriptor, _In_opt_ const GUID* pguidTimeFormat, _In_opt_ const PROPVARIANT* pvarStartPosition);
+		STDMETHODIMP Stop();
+		STDMETHODIMP Pause();
+		STDMETHODIMP Shutdown();
+
+		#pragma endregion
+
+		#pragma region IMPLEMENT_IMFGetService
+
+		STDMETHODIMP GetService(_In_ REFGUID guidService, _In_ REFIID riid, _COM_Outptr_ LPVOID* ppvObject);
+
+		#pragma endregion
+	};
+}
@@ -0,0 +1,93 @@
+#pragma once
+
+#include "PcmSource.h"
+
+#include <cstdio>
+
+
+namespace AudioPlay
+{
+	// Receives decoded interleaved float frames, the counterpart of PcmSource
+	// BeginStream is called once before the first Write and EndStream once after the last one
+	class PcmSink
+	{
+		std::atomic<ULONG> referenceCount;
+
+		protected:
+		PcmSink();
+
+		public:
+		virtual ~PcmSink();
+
+		virtual ULONG STDMETHODCALLTYPE AddRef();
+		virtual ULONG STDMETHODCALLTYPE Release();
+
+		virtual HRESULT BeginStream(_In_ const PcmFormat& format) = 0;
+		virtual HRESULT Write(_In_reads_(frameCount * format.channels) const float* frames, _In_ UINT32 frameCount) = 0;
+		virtual HRESULT EndStream() = 0;
+	};
+
+	// Drops the frames, for measuring how fast a pipeline runs
+	class NullPcmSink : public PcmSink
+	{
+		UINT64 framesWritten;
+
+		NullPcmSink();
+
+		public:
+		static HRESULT Create(_COM_Outptr_ NullPcmSink** pPtrSink);
+
+		UINT64 GetFramesWritten() const { return framesWritten; }
+
+		HRESULT BeginStream(_In_ const PcmFormat& format) override;
+		HRESULT Write(_In_reads_(frameCount * format.channels) const float* frames, _In_ UINT32 frameCount) override;
+		HRESULT EndStream() override;
+	};
+
+	// Keeps every frame in memory
+	class BufferPcmSink : public PcmSink
+	{
+		PcmFormat format;
+		float* frames;
+		UINT64 frameCount;
+		UINT64 capacity;
+
+		BufferPcmSink();
+
+		public:
+		~BufferPcmSink();
+
+		static HRESULT Create(_COM_Outptr_ BufferPcmSink** pPtrSink);
+
+		const PcmFormat& GetFormat() const { return format; }
+		const float* GetFrames() const { return frames; }
+		UINT64 GetFrameCount() const { return frameCount; }
+
+		HRESULT BeginStream(_In_ const PcmFormat& format) override;
+		HRESULT Write(_In_reads_(frameCount * format.channels) const float* frames, _In_ UINT32 frameCount) override;
+		HRESULT EndStream() override;
+	};
+
+	// Writes a 32 bit float WAV file, it switches to RF64 when the data grows past 4 GB
+	class WavFilePcmSink : public PcmSink
+	{
+		FILE* file;
+		PcmFormat format;
+		UINT64 dataSize;
+
+		WavFilePcmSink();
+
+		HRESULT WriteHeader(_In_ bool final);
+
+		public:
+		// Finishes the file if EndStream wasn't called
+		~WavFilePcmSink();
+
+		// The file is created or truncated right away
+		static HRESULT Create(_In_z_ LPCWCH path, _COM_Outptr_ WavFilePcmSink** pPtrSink);
+
+		HRESULT BeginStream(_In_ const PcmFormat& format) override;
+		HRESULT Write(_In_reads_(frameCount * format.channels) const float* frames, _In_ UINT32 frameCount) override;
+		HRESULT EndStream() override;
+	};
+}
@@ -0,0 +1,55 @@
+#pragma once
+
+#include "AudioPlay.h"
+#include "PcmSink.h"
+
+
+namespace AudioPlay
+{
+	// Sample grabber callback that hands the float samples of an offline session to a PcmSink
+	class PcmSinkGrabber : public IMFSampleGrabberSinkCallback
+	{
+		private:
+		ULONG referenceCount;
+
+		ComPtr<PcmSink> sink;
+		PcmFormat format;
+		bool streaming;
+
+		PcmSinkGrabber(_In_ PcmSink* sink, _In_ const PcmFormat& format);
+
+		public:
+		virtual ~PcmSinkGrabber();
+
+		static HRESULT Create(_In_ PcmSink* sink, _In_ const PcmFormat& format, _COM_Outptr_ IMFSampleGrabberSinkCallback** pPtrCallback);
+
+		#pragma region IMPLEMENT_IUnknown
+
+		STDMETHODIMP QueryInterface(REFIID riid, _COM_Outptr_ void** pPtr);
+
+		STDMETHODIMP_(ULONG) AddRef();
+		STDMETHODIMP_(ULONG) Release();
+
+		#pragma endregion
+
+		#pragma region IMPLEMENT_IMFClockStateSink
+
+		STDMETHODIMP OnClockStart(MFTIME hnsSystemTime, LONGLONG llClockStartOffset) { UNREFERENCED_PARAMETER(hnsSystemTime); UNREFERENCED_PARAMETER(llClockStartOffset); return S_OK; }
+		STDMETHODIMP OnClockStop(MFTIME hnsSystemTime) { UNREFERENCED_PARAMETER(hnsSystemTime); return S_OK; }
+		STDMETHODIMP OnClockPause(MFTIME hnsSystemTime) { UNREFERENCED_PARAMETER(hnsSystemTime); return S_OK; }
+		STDMETHODIMP OnClockRestart(MFTIME hnsSystemTime) { UNREFERENCED_PARAMETER(hnsSystemTime); return S_OK; }
+		STDMETHODIMP OnClockSetRate(MFTIME hnsSystemTime, float flRate) { UNREFERENCED_PARAMETER(hnsSystemTime); UNREFERENCED_PARAMETER(flRate); return S_OK; }
+
+		#pragma endregion
+
+		#pragma region IMPLEMENT_IMFSampleGrabberSinkCallback
+
+		STDMETHODIMP OnSetPresentationClock(_In_opt_ IMFPresentationClock* pPresentationClock) { UNREFERENCED_PARAMETER(pPresentationClock); return S_OK; }
+		STDMETHODIMP OnProcessSample(REFGUID guidMajorMediaType, DWORD dwSampleFlags, LONGLONG llSampleTime, LONGLONG llSampleDuration,
+			_In_reads_bytes_(dwSampleSize) const BYTE* pSampleBuffer, DWORD dwSampleSize);
+		// Ends the sink's stream
+		STDMETHODIMP OnShutdown();
+
+		#pragma endregion
+	};
+}
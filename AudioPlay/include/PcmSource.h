@@ -0,0 +1,78 @@
+#pragma once
+
+#include "PortableTypes.h"
+
+#include <atomic>
+
+
+namespace AudioPlay
+{
+	struct PcmFormat
+	{
+		UINT32 sampleRate;
+		UINT32 channels;
+
+		bool operator==(const PcmFormat& other) const { return sampleRate == other.sampleRate && channels == other.channels; }
+		bool operator!=(const PcmFormat& other) const { return !(*this == other); }
+	};
+
+	// Media Foundation time is in 100 ns units, both directions round to the nearest so a frame converted there and back stays the same frame
+	constexpr UINT64 FramesFromMediaTime(_In_ UINT64 time, _In_ UINT32 sampleRate)
+	{
+		return (time * sampleRate + 5000000) / 10000000;
+	}
+
+	constexpr UINT64 MediaTimeFromFrames(_In_ UINT64 frames, _In_ UINT32 sampleRate)
+	{
+		return (frames * 10000000 + sampleRate / 2) / sampleRate;
+	}
+
+	// Decoded audio as interleaved 32 bit float frames
+	// Sources are pulled by a single thread, the audio thread when playing through Audio::OpenSource
+	class PcmSource
+	{
+		std::atomic<ULONG> referenceCount;
+
+		protected:
+		PcmFormat format;
+
+		PcmSource();
+
+		public:
+		virtual ~PcmSource();
+
+		virtual ULONG STDMETHODCALLTYPE AddRef();
+		virtual ULONG STDMETHODCALLTYPE Release();
+
+		const PcmFormat& GetFormat() const { return format; }
+
+		// framesRead is less than frameCount only at the end of the stream
+		virtual HRESULT Read(_Out_writes_(frameCount * format.channels) float* buffer, _In_ UINT32 frameCount, _Out_ UINT32& framesRead) = 0;
+		virtual HRESULT Seek(_In_ UINT64 frame) = 0;
+		virtual HRESULT GetPosition(_Out_ UINT64& frame) const = 0;
+		// Returns E_NOTIMPL if the length isn't known
+		// S_FALSE if frames is the length of the track but the stream never ends, sources looping forever
+		virtual HRESULT GetLength(_Out_ UINT64& frames) const = 0;
+	};
+
+	// Plays frames that are already in memory, handy for rendering and checking pipelines offline
+	class PcmBufferSource : public PcmSource
+	{
+		float* frames;
+		UINT64 frameCount;
+		UINT64 position;
+
+		PcmBufferSource();
+
+		public:
+		~PcmBufferSource();
+
+		// Copies the frames
+		static HRESULT Create(_In_ const PcmFormat& format, _In_reads_(frameCount * format.channels) const float* frames, _In_ UINT64 frameCount, _COM_Outptr_ PcmBufferSource** pPtrSource);
+
+		HRESULT Read(_Out_writes_(frameCount * format.channels) float* buffer, _In_ UINT32 frameCount, _Out_ UINT32& framesRead) override;
+		HRESULT Seek(_In_ UINT64 frame) override;
+		HRESULT GetPosition(_Out_ UINT64& frame) const override;
+		HRESULT GetLength(_Out_ UINT64& frames) const override;
+	};
+}
@@ -0,0 +1,169 @@
+#pragma once
+
+// Lets the parts of the library that don't talk to Media Foundation build outside of Windows
+// Everything here maps to the Windows SDK definitions on Windows
+
+#ifdef _WIN32
+
+#include "AudioPlay.h"
+
+#else
+
+#include <cstddef>
+#include <cstdint>
+#include <cwchar>
+#include <memory>
+
+
+typedef int32_t HRESULT;
+typedef int BOOL;
+typedef uint8_t BYTE;
+typedef uint16_t WORD;
+typedef uint32_t DWORD;
+typedef uint32_t ULONG;
+typedef int32_t LONG;
+typedef uint16_t UINT16;
+typedef int16_t INT16;
+typedef uint32_t UINT32;
+typedef int32_t INT32;
+typedef uint64_t UINT64;
+typedef int64_t INT64;
+typedef int64_t LONGLONG;
+typedef uint64_t ULONGLONG;
+typedef uint64_t QWORD;
+typedef wchar_t WCHAR;
+typedef WCHAR* LPWCH;
+typedef const WCHAR* LPCWCH;
+typedef DWORD MediaEventType;
+
+#define TRUE 1
+#define FALSE 0
+
+#define STDMETHODCALLTYPE
+
+#define _HRESULT_TYPEDEF_(hresult) ((HRESULT)(hresult))
+#define SUCCEEDED(hresult) (((HRESULT)(hresult)) >= 0)
+#define FAILED(hresult) (((HRESULT)(hresult)) < 0)
+#define HRESULT_FROM_WIN32(error) ((HRESULT)(error) <= 0 ? ((HRESULT)(error)) : ((HRESULT)(((error) & 0x0000FFFF) | (7 << 16) | 0x80000000)))
+
+#define S_OK _HRESULT_TYPEDEF_(0x00000000L)
+#define S_FALSE _HRESULT_TYPEDEF_(0x00000001L)
+#define E_NOTIMPL _HRESULT_TYPEDEF_(0x80004001L)
+#define E_POINTER _HRESULT_TYPEDEF_(0x80004003L)
+#define E_ABORT _HRESULT_TYPEDEF_(0x80004004L)
+#define E_FAIL _HRESULT_TYPEDEF_(0x80004005L)
+#define E_PENDING _HRESULT_TYPEDEF_(0x8000000AL)
+#define E_BOUNDS _HRESULT_TYPEDEF_(0x8000000BL)
+#define E_UNEXPECTED _HRESULT_TYPEDEF_(0x8000FFFFL)
+#define E_OUTOFMEMORY _HRESULT_TYPEDEF_(0x8007000EL)
+#define E_INVALIDARG _HRESULT_TYPEDEF_(0x80070057L)
+#define E_NOT_VALID_STATE _HRESULT_TYPEDEF_(0x8007139FL)
+
+#define ERROR_FILE_NOT_FOUND 2L
+#define ERROR_ACCESS_DENIED 5L
+#define ERROR_INVALID_DATA 13L
+#define ERROR_WRITE_FAULT 29L
+#define ERROR_HANDLE_EOF 38L
+#define ERROR_ALREADY_EXISTS 183L
+
+// The session events of the MediaEventType enumeration in mfobjects.h
+enum
+{
+	MEUnknown = 0,
+	MESessionTopologySet = 101,
+	MESessionStarted = 103,
+	MESessionPaused = 104,
+	MESessionStopped = 105,
+	MESessionClosed = 106,
+	MESessionEnded = 107,
+	MESessionCapabilitiesChanged = 110,
+	MESessionTopologyStatus = 111,
+	MENewPresentation = 113
+};
+
+#define UNREFERENCED_PARAMETER(parameter) (void)(parameter)
+
+#define _In_
+#define _In_opt_
+#define _In_z_
+#define _In_opt_z_
+#define _In_reads_(size)
+#define _In_reads_opt_(size)
+#define _In_reads_bytes_(size)
+#define _Inout_
+#define _Inout_updates_(size)
+#define _Out_
+#define _Out_opt_
+#define _Out_writes_(size)
+#define _Out_writes_bytes_(size)
+#define _Out_writes_bytes_to_(size, count)
+#define _Out_writes_to_(size, count)
+#define _Outref_result_maybenull_
+#define _Outptr_
+#define _Outptr_result_maybenull_
+#define _COM_Outptr_
+#define _COM_Outptr_result_maybenull_
+
+
+namespace AudioPlay
+{
+	// Just enough of CComPtr for the portable classes, they all implement AddRef and Release
+	template<class T>
+	class ComPtr
+	{
+		public:
+		T* p = nullptr;
+
+		ComPtr() = default;
+		ComPtr(T* pointer) : p(pointer) { if (p) { p->AddRef(); } }
+		ComPtr(const ComPtr& other) : ComPtr(other.p) { }
+		ComPtr(ComPtr&& other) noexcept : p(other.p) { other.p = nullptr; }
+		~ComPtr() { Release(); }
+
+		ComPtr& operator=(T* pointer)
+		{
+			if (pointer != p)
+			{
+				ComPtr(pointer).Swap(*this);
+			}
+			return *this;
+		}
+		ComPtr& operator=(const ComPtr& other) { return *this = other.p; }
+		ComPtr& operator=(ComPtr&& other) noexcept
+		{
+			if (this != std::addressof(other))
+			{
+				Release();
+				p = other.p;
+				other.p = nullptr;
+			}
+			return *this;
+		}
+
+		operator T*() const { return p; }
+		T* operator->() const { return p; }
+		T& operator*() const { return *p; }
+		T** operator&() { return &p; }
+		bool operator!() const { return p == nullptr; }
+
+		void Release()
+		{
+			T* pointer = p;
+			if (pointer)
+			{
+				p = nullptr;
+				pointer->Release();
+			}
+		}
+		void Attach(T* pointer) { Release(); p = pointer; }
+		T* Detach() { T* pointer = p; p = nullptr; return pointer; }
+		void Swap(ComPtr& other) { T* pointer = p; p = other.p; other.p = pointer; }
+	};
+}
+
+#endif
+
+#define AUDIO_E_CLOSED _HRESULT_TYPEDEF_(0x80080000L)
+#define AUDIO_E_INVALID_FORMAT _HRESULT_TYPEDEF_(0x80080001L)
+#define AUDIO_E_UNSUPPORTED_FORMAT _HRESULT_TYPEDEF_(0x80080002L)
+#define AUDIO_E_CORRUPT_DATA _HRESULT_TYPEDEF_(0x80080003L)
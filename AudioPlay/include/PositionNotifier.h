@@ -0,0 +1,115 @@
+#pragma once
+
+#include "AudioStateMachine.h"
+
+#include <condition_variable>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+
+namespace AudioPlay
+{
+	struct PositionTick
+	{
+		// -1 if the player has no position, like while it is opening
+		std::chrono::milliseconds position;
+		AudioStates state;
+		// Goes up by one for every delivered tick of the subscription
+		UINT64 sequence;
+		// Ticks that were due but merged into this one because the timer thread fell behind
+		UINT32 coalesced;
+	};
+
+	// Called on the timer thread, keep it short, every subscription of the notifier waits for it
+	using PositionCallback = void (*)(const PositionTick& tick, void* context);
+
+	struct PositionNotifierStatistics
+	{
+		// Times the timer thread woke up with ticks to deliver
+		UINT64 wakeups;
+		UINT64 delivered;
+		// Ticks skipped because the player wasn't playing and its state didn't change
+		UINT64 suppressed;
+		UINT64 coalesced;
+		UINT32 subscriptionCount;
+	};
+
+	// Delivers position ticks of any number of players from one thread on a hashed timer wheel
+	// Subscriptions with the same interval are due on the same wheel ticks so they share wakeups
+	// Ticks are only delivered while playing, plus one for every state change so a paused display shows where it stopped
+	class PositionNotifier
+	{
+		using milliseconds = std::chrono::milliseconds;
+		using steady_clock = std::chrono::steady_clock;
+
+		struct Subscription
+		{
+			UINT64 cookie;
+			AudioStateMachine* stateMachine;
+			PositionCallback callback;
+			void* context;
+			// In wheel ticks
+			UINT64 interval;
+			UINT64 due;
+			UINT64 sequence;
+			UINT32 coalesced;
+			AudioStates lastState;
+			bool firing;
+			bool removed;
+			Subscription* next;
+		};
+
+		// One wheel tick is a millisecond, intervals longer than the wheel wait for more than one turn
+		static constexpr UINT32 wheelSize = 1024;
+
+		std::mutex mutex;
+		std::condition_variable wakeCondition;
+		std::condition_variable firedCondition;
+
+		Subscription* slots[wheelSize];
+		std::unordered_map<UINT64, Subscription*> subscriptions;
+		std::vector<Subscription*> firing;
+		UINT64 nextCookie;
+		UINT64 processedTick;
+		// Goes up after every batch of callbacks so Unsubscribe can wait for one to finish
+		UINT64 batch;
+		steady_clock::time_point epoch;
+		PositionNotifierStatistics statistics;
+
+		bool stopping;
+		std::thread worker;
+
+		UINT64 Now() const;
+		void Link(_In_ Subscription* subscription);
+		void Unlink(_In_ Subscription* subscription);
+		void Remove(_Inout_ std::unique_lock<std::mutex>& lock, _In_ Subscription* subscription);
+		bool Fire(_In_ Subscription* subscription);
+		void Work();
+
+		public:
+		static constexpr milliseconds minInterval{ 4 };
+		static constexpr milliseconds maxInterval{ 60000 };
+
+		PositionNotifier();
+		~PositionNotifier();
+
+		PositionNotifier(const PositionNotifier&) = delete;
+		PositionNotifier& operator=(const PositionNotifier&) = delete;
+
+		// The notifier every Audio subscribes to
+		static PositionNotifier& Get();
+
+		// The first tick comes after interval, cookie identifies the subscription for Unsubscribe
+		// stateMachine has to outlive the subscription
+		HRESULT Subscribe(_In_ AudioStateMachine* stateMachine, _In_ milliseconds interval,
+			_In_ PositionCallback callback, _In_opt_ void* context, _Out_ UINT64& cookie);
+		// No callback of the subscription runs after it returns, unless called from that callback
+		// Returns S_FALSE if there is no such subscription
+		HRESULT Unsubscribe(_In_ UINT64 cookie);
+		// Removes every subscription of the state machine, returns S_FALSE if there were none
+		HRESULT UnsubscribeAll(_In_ AudioStateMachine* stateMachine);
+
+		PositionNotifierStatistics GetStatistics();
+	};
+}
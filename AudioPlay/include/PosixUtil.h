@@ -0,0 +1,24 @@
+#pragma once
+
+#include "PortableTypes.h"
+
+#include <cstdio>
+
+
+// Internal, shared by the sources that open files and shared memory with the C runtime or POSIX calls
+namespace AudioPlay
+{
+	// The HRESULT the Win32 path of the same call returns for an errno value, E_FAIL for the ones without one
+	HRESULT HResultFromErrno(_In_ int error);
+
+	// fopen with a wide path, sets errno if it fails
+	FILE* OpenFileStream(_In_z_ LPCWCH path, _In_z_ const char* mode);
+
+	#ifndef _WIN32
+	// The path in the encoding of the current locale, delete[] it when done
+	HRESULT NarrowPath(_In_z_ LPCWCH path, _Outptr_ char** narrowPath);
+
+	// open with a wide path, -1 with errno set if it fails
+	int OpenDescriptor(_In_z_ LPCWCH path, _In_ int flags);
+	#endif
+}
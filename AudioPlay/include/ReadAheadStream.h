@@ -0,0 +1,167 @@
+#pragma once
+
+#include "PortableTypes.h"
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+
+
+namespace AudioPlay
+{
+	// Positionless reads from storage, called from one I/O thread at a time
+	class ByteReader
+	{
+		std::atomic<ULONG> referenceCount;
+
+		protected:
+		ByteReader();
+
+		public:
+		virtual ~ByteReader();
+
+		virtual ULONG STDMETHODCALLTYPE AddRef();
+		virtual ULONG STDMETHODCALLTYPE Release();
+
+		// bytesRead is less than byteCount only at the end
+		virtual HRESULT ReadAt(_In_ UINT64 offset, _Out_writes_bytes_to_(byteCount, bytesRead) BYTE* buffer, _In_ UINT32 byteCount, _Out_ UINT32& bytesRead) = 0;
+		virtual UINT64 GetSize() const = 0;
+	};
+
+	// Plain file reads, the OS is told the file is read front to back
+	class FileByteReader : public ByteReader
+	{
+		#ifdef _WIN32
+		HANDLE file;
+		#else
+		int descriptor;
+		#endif
+		UINT64 size;
+
+		FileByteReader();
+
+		public:
+		~FileByteReader();
+
+		static HRESULT Open(_In_z_ LPCWCH path, _COM_Outptr_ FileByteReader** pPtrReader);
+
+		HRESULT ReadAt(_In_ UINT64 offset, _Out_writes_bytes_to_(byteCount, bytesRead) BYTE* buffer, _In_ UINT32 byteCount, _Out_ UINT32& bytesRead) override;
+		UINT64 GetSize() const override { return size; }
+	};
+
+	// Makes a fast reader behave like a network share or a spinning disk, for trying read-ahead settings locally
+	class ThrottledByteReader : public ByteReader
+	{
+		using nanoseconds = std::chrono::nanoseconds;
+
+		ComPtr<ByteReader> reader;
+		nanoseconds latency;
+		UINT64 bytesPerSecond;
+		std::atomic<UINT64> readCount;
+
+		ThrottledByteReader();
+
+		public:
+		// Every read waits latency plus its size at bytesPerSecond, 0 is unlimited
+		static HRESULT Create(_In_ ByteReader* reader, _In_ nanoseconds latency, _In_ UINT64 bytesPerSecond, _COM_Outptr_ ThrottledByteReader** pPtrReader);
+
+		UINT64 GetReadCount() const { return readCount; }
+
+		HRESULT ReadAt(_In_ UINT64 offset, _Out_writes_bytes_to_(byteCount, bytesRead) BYTE* buffer, _In_ UINT32 byteCount, _Out_ UINT32& bytesRead) override;
+		UINT64 GetSize() const override { return reader->GetSize(); }
+	};
+
+	struct ReadAheadSettings
+	{
+		// Bytes per read from storage, a power of two from 4 KB up, reads start at multiples of it
+		UINT32 chunkSize;
+		// Chunks kept loaded ahead of the read position
+		UINT32 depth;
+	};
+
+	struct ReadAheadStatistics
+	{
+		// Chunks the reads touched and how many of those were already loaded
+		UINT64 chunkReads;
+		UINT64 hits;
+		// Reads that had to wait for storage and the total time they waited
+		UINT64 stalls;
+		UINT64 stallNanoseconds;
+		UINT64 bytesRead;
+		UINT64 fetches;
+		UINT64 bytesFetched;
+		UINT64 seeks;
+	};
+
+	// Keeps the next depth chunks after the read position loaded by a dedicated I/O thread
+	// The chunk under the read position always goes first so reads after a seek wait for one chunk at most
+	class ReadAheadStream
+	{
+		enum class ChunkState
+		{
+			Empty,
+			Loading,
+			Ready,
+			Failed
+		};
+
+		struct Chunk
+		{
+			UINT64 index;
+			ChunkState state;
+			UINT32 bytes;
+			HRESULT result;
+			BYTE* data;
+		};
+
+		std::atomic<ULONG> referenceCount;
+
+		ComPtr<ByteReader> reader;
+		UINT64 size;
+		UINT32 chunkSize;
+		UINT32 depth;
+
+		// depth + 2 chunks, the one under the position, depth ahead and one behind for small seeks back
+		BYTE* buffer;
+		Chunk* chunks;
+		UINT32 chunkCount;
+
+		std::mutex mutex;
+		std::condition_variable ioCondition;
+		std::condition_variable readyCondition;
+		UINT64 position;
+		bool stopping;
+		ReadAheadStatistics statistics;
+
+		std::thread ioThread;
+
+		ReadAheadStream();
+
+		Chunk* Find(_In_ UINT64 index);
+		bool PickChunk(_Out_ UINT64& index);
+		Chunk* PickSlot(_In_ UINT64 current);
+		void Work();
+
+		public:
+		static constexpr UINT32 defaultChunkSize = 256 * 1024;
+		static constexpr UINT32 defaultDepth = 8;
+		static constexpr UINT32 alignment = 4096;
+
+		~ReadAheadStream();
+
+		static HRESULT Create(_In_ ByteReader* reader, _In_ const ReadAheadSettings& settings, _COM_Outptr_ ReadAheadStream** pPtrStream);
+
+		ULONG STDMETHODCALLTYPE AddRef();
+		ULONG STDMETHODCALLTYPE Release();
+
+		// Waits for storage only if the bytes aren't loaded yet
+		HRESULT Read(_Out_writes_bytes_to_(byteCount, bytesRead) BYTE* destination, _In_ UINT32 byteCount, _Out_ UINT32& bytesRead);
+		HRESULT Seek(_In_ UINT64 newPosition);
+		UINT64 GetPosition();
+		UINT64 GetSize() const { return size; }
+
+		ReadAheadStatistics GetStatistics();
+	};
+}
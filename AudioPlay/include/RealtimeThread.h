@@ -0,0 +1,117 @@
+#pragma once
+
+#include "PortableTypes.h"
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+
+// Counts allocations and locks on real-time threads, on by default in debug builds
+// Allocations are caught with the debug CRT's hook under MSVC, elsewhere only if the host calls ReportAllocation from its own operator new
+#if !defined(AUDIOPLAY_REALTIME_CHECKS) && defined(_DEBUG)
+#define AUDIOPLAY_REALTIME_CHECKS 1
+#endif
+
+
+namespace AudioPlay
+{
+	// Called once every period, it must not allocate, lock, wait or do I/O
+	using RealtimeCallback = void (*)(void* context);
+
+	struct RealtimeThreadSettings
+	{
+		std::chrono::microseconds period;
+		// -1 lets the thread run on any core
+		INT32 core;
+		// MMCSS Pro Audio on Windows, SCHED_FIFO elsewhere, the thread keeps the normal priority if it can't be raised
+		bool elevatePriority;
+	};
+
+	struct RealtimeThreadStatistics
+	{
+		UINT64 callbacks;
+		// Callbacks that were still running when the next period should have started, the missed periods are skipped
+		UINT64 overruns;
+		// From the start of the period to the callback
+		UINT64 totalWakeLatencyMicroseconds;
+		UINT32 maxWakeLatencyMicroseconds;
+		UINT32 maxCallbackMicroseconds;
+		// Callbacks by wake latency, bucket k counts the ones from 2^k up to 2^(k + 1) microseconds, the last one everything later
+		UINT64 wakeLatencyHistogram[16];
+		// Caught in the callback, only with AUDIOPLAY_REALTIME_CHECKS and outside MSVC only if the host reports them
+		UINT64 allocations;
+		UINT64 locks;
+		bool elevated;
+		bool pinned;
+	};
+
+	// A thread that runs a callback at a fixed period with raised priority, for mixing and effects that can't wait for a work queue
+	// A standalone helper, nothing in the player runs on one: Media Foundation pulls PcmMediaSource on its own work queues
+	// and offline renders run as fast as they can. It is for hosts that pull a PcmSource or DspChain at a device period themselves,
+	// the locks on that path (AutoCriticalSection, the DspChain and CrossfadeSource hand overs, ReadAheadStream) are then counted
+	class RealtimeThread
+	{
+		using microseconds = std::chrono::microseconds;
+		using steady_clock = std::chrono::steady_clock;
+
+		std::atomic<ULONG> referenceCount;
+
+		RealtimeThreadSettings settings;
+		RealtimeCallback callback;
+		void* context;
+
+		std::thread thread;
+		std::atomic<bool> stopping;
+
+		// Create waits until the thread has set itself up
+		std::mutex mutex;
+		std::condition_variable startedCondition;
+		bool started;
+
+		// Written by the thread only
+		std::atomic<UINT64> callbacks;
+		std::atomic<UINT64> overruns;
+		std::atomic<UINT64> totalWakeLatency;
+		std::atomic<UINT32> maxWakeLatency;
+		std::atomic<UINT32> maxCallback;
+		std::atomic<UINT64> wakeLatencyHistogram[16];
+		std::atomic<UINT64> allocations;
+		std::atomic<UINT64> locks;
+		std::atomic<bool> elevated;
+		std::atomic<bool> pinned;
+
+		RealtimeThread();
+
+		void Run();
+
+		public:
+		static constexpr microseconds minPeriod{ 500 };
+		static constexpr microseconds maxPeriod{ 1000000 };
+
+		~RealtimeThread();
+
+		RealtimeThread(const RealtimeThread&) = delete;
+		RealtimeThread& operator=(const RealtimeThread&) = delete;
+
+		// The thread is running when it returns, the first callback comes a period later
+		static HRESULT Create(_In_ const RealtimeThreadSettings& settings, _In_ RealtimeCallback callback, _In_opt_ void* context,
+			_COM_Outptr_ RealtimeThread** pPtrThread);
+
+		ULONG STDMETHODCALLTYPE AddRef();
+		ULONG STDMETHODCALLTYPE Release();
+
+		// No callback runs after it returns, can't be called from the callback
+		void Stop();
+
+		RealtimeThreadStatistics GetStatistics() const;
+
+		// True inside the callback of a RealtimeThread
+		static bool IsRealtime();
+		// Counted against the real-time thread if called from its callback, does nothing elsewhere
+		// The library doesn't replace operator new, hosts that want allocations counted outside MSVC call ReportAllocation from theirs
+		static void ReportAllocation();
+		static void ReportLock();
+	};
+}
@@ -0,0 +1,151 @@
+#pragma once
+
+#include "PortableTypes.h"
+
+#include <atomic>
+#include <chrono>
+
+
+namespace AudioPlay
+{
+	enum class RenderEventType : UINT32
+	{
+		Started,
+		Paused,
+		Stopped,
+		// Only logged with SetLogBuffers, Late and Underrun buffers are always logged
+		Buffer,
+		// The renderer had less than the late threshold left when the buffer was delivered
+		Late,
+		// The renderer ran dry before the buffer was delivered
+		Underrun,
+		EndOfStream
+	};
+
+	struct RenderEvent
+	{
+		// Goes up by one for every logged event, starts at 1
+		UINT64 sequence;
+		// Nanoseconds since the telemetry was created, on the steady clock
+		INT64 timestamp;
+		// First frame of the buffer, or the position for the other events
+		UINT64 streamFrame;
+		RenderEventType type;
+		UINT32 frames;
+		// Reading the file and everything in front of the effects, then the effects
+		UINT32 decodeNanoseconds;
+		UINT32 processNanoseconds;
+		// The whole request, decoding included
+		UINT32 deliverNanoseconds;
+		// Audio the renderer had left when the buffer was delivered, negative is how long it had nothing
+		INT32 leadMicroseconds;
+	};
+
+	struct RenderCounters
+	{
+		UINT64 buffers;
+		UINT64 frames;
+		UINT64 lateBuffers;
+		UINT64 underruns;
+		UINT64 underrunNanoseconds;
+		UINT64 decodeNanoseconds;
+		UINT64 processNanoseconds;
+		UINT64 deliverNanoseconds;
+		UINT32 maxDecodeNanoseconds;
+		UINT32 maxProcessNanoseconds;
+		UINT32 maxDeliverNanoseconds;
+		INT32 minLeadMicroseconds;
+		// Requests by deliver time, bucket k counts the ones from 2^k up to 2^(k + 1) microseconds, the last one everything longer
+		UINT64 deliverHistogram[16];
+		// Sequence of the newest event
+		UINT64 lastEvent;
+	};
+
+	// Counters and an event ring about the buffers a PcmMediaSource hands to the renderer
+	// Recording is a few relaxed stores per buffer and never waits, so it can stay on
+	// The recording side is called by one thread at a time, the reading side from any thread without locking it out
+	class RenderTelemetry
+	{
+		using nanoseconds = std::chrono::nanoseconds;
+		using steady_clock = std::chrono::steady_clock;
+
+		static constexpr UINT32 eventWords = sizeof(RenderEvent) / sizeof(UINT64);
+		static_assert(sizeof(RenderEvent) % sizeof(UINT64) == 0, "RenderEvent is copied as whole words");
+
+		// The sequence is 0 while the slot is written, readers drop what they read then
+		struct Slot
+		{
+			std::atomic<UINT64> sequence;
+			std::atomic<UINT64> words[eventWords];
+		};
+
+		std::atomic<ULONG> referenceCount;
+
+		Slot* ring;
+		UINT32 capacity;
+		UINT64 sequence;
+		steady_clock::time_point epoch;
+
+		std::atomic<UINT64> buffers;
+		std::atomic<UINT64> frames;
+		std::atomic<UINT64> lateBuffers;
+		std::atomic<UINT64> underruns;
+		std::atomic<UINT64> underrunNanoseconds;
+		std::atomic<UINT64> decodeNanoseconds;
+		std::atomic<UINT64> processNanoseconds;
+		std::atomic<UINT64> deliverNanoseconds;
+		std::atomic<UINT32> maxDecodeNanoseconds;
+		std::atomic<UINT32> maxProcessNanoseconds;
+		std::atomic<UINT32> maxDeliverNanoseconds;
+		std::atomic<INT32> minLeadMicroseconds;
+		std::atomic<UINT64> deliverHistogram[16];
+		std::atomic<UINT64> lastEvent;
+
+		std::atomic<bool> logBuffers;
+		std::atomic<INT64> lateThreshold;
+
+		// Recording side, estimates what the renderer has left assuming it plays in real time from the first buffer on
+		bool playing;
+		steady_clock::time_point playStart;
+		UINT64 playedFrames;
+		INT64 carriedLead;
+		UINT64 pendingProcess;
+
+		RenderTelemetry();
+
+		void Log(_In_ RenderEventType type, _In_ INT64 timestamp, _In_ UINT64 streamFrame, _In_ UINT32 frameCount,
+			_In_ UINT32 decode, _In_ UINT32 process, _In_ UINT32 deliver, _In_ INT32 lead);
+		INT64 Now() const;
+
+		public:
+		static constexpr UINT32 defaultCapacity = 1024;
+
+		~RenderTelemetry();
+
+		// capacity is the number of events kept, a power of two
+		static HRESULT Create(_In_ UINT32 capacity, _COM_Outptr_ RenderTelemetry** pPtrTelemetry);
+
+		ULONG STDMETHODCALLTYPE AddRef();
+		ULONG STDMETHODCALLTYPE Release();
+
+		// Logs every buffer and not just late ones, a second of audio is around 50 events
+		void SetLogBuffers(_In_ bool log) { logBuffers.store(log, std::memory_order_relaxed); }
+		// Buffers delivered with less than threshold left in the renderer count as late, 10 ms by default
+		void SetLateThreshold(_In_ nanoseconds threshold) { lateThreshold.store(threshold.count(), std::memory_order_relaxed); }
+
+		// Recording side, a seek or a start from stopped means the renderer was flushed
+		void OnStarted(_In_ UINT64 frame, _In_ bool flushed);
+		void OnPaused(_In_ UINT64 frame, _In_ UINT32 sampleRate);
+		void OnStopped(_In_ UINT64 frame);
+		// Time the effects took inside the buffer being read, added to the next OnBuffer
+		void AddProcessing(_In_ nanoseconds duration) { pendingProcess += static_cast<UINT64>(duration.count()); }
+		void OnBuffer(_In_ UINT64 frame, _In_ UINT32 frameCount, _In_ UINT32 sampleRate, _In_ nanoseconds read, _In_ nanoseconds deliver);
+		void OnEndOfStream(_In_ UINT64 frame);
+
+		// Counters are read one at a time, two of them may be a buffer apart
+		void GetCounters(_Out_ RenderCounters& counters) const;
+		// Copies the events newer than afterSequence, oldest first, and returns how many were copied
+		// Events the ring already overwrote are skipped, pass the sequence of the last one to continue from there
+		UINT32 ReadEvents(_In_ UINT64 afterSequence, _Out_writes_to_(count, return) RenderEvent* events, _In_ UINT32 count) const;
+	};
+}
@@ -0,0 +1,114 @@
+#pragma once
+
+#include "AudioStateMachine.h"
+
+#include <vector>
+
+
+namespace AudioPlay
+{
+	// Time that only moves when told to
+	class VirtualClock
+	{
+		using nanoseconds = std::chrono::nanoseconds;
+
+		nanoseconds now{ 0 };
+
+		public:
+		nanoseconds Now() const { return now; }
+		void Advance(_In_ nanoseconds duration) { now += duration; }
+		// Never moves backwards
+		void AdvanceTo(_In_ nanoseconds time) { if (time > now) { now = time; } }
+	};
+
+	// Stands in for IMFMediaSession so the state machine can be driven without Media Foundation or real time
+	// Commands are answered with their events after a configurable latency on the virtual clock
+	// Nothing happens until RunFor or RunUntilIdle dispatches the events that are due
+	class ScriptedSession : public SessionBackend
+	{
+		using nanoseconds = std::chrono::nanoseconds;
+
+		struct ScriptedEvent
+		{
+			nanoseconds time;
+			UINT64 sequence;
+			MediaEventType type;
+			HRESULT status;
+			// Start position, -1 resumes
+			milliseconds position;
+		};
+
+		struct PendingFailure
+		{
+			MediaEventType type;
+			HRESULT status;
+		};
+
+		VirtualClock& clock;
+		AudioStateMachine* target;
+
+		// Min heap on time then sequence so events due at the same time keep their order
+		std::vector<ScriptedEvent> events;
+		std::vector<PendingFailure> failures;
+		UINT64 nextSequence;
+
+		nanoseconds commandLatency{ 0 };
+		milliseconds duration{ 0 };
+
+		// Presentation clock of the session, runs between MESessionStarted and MESessionPaused, Stopped or Ended
+		bool hasClock;
+		bool running;
+		milliseconds presentationBase{ 0 };
+		nanoseconds runningSince{ 0 };
+
+		HRESULT commandResult;
+		bool answerCommands;
+		UINT64 commandCount;
+		UINT64 dispatchedCount;
+
+		HRESULT Schedule(_In_ MediaEventType type, _In_ nanoseconds delay, _In_ milliseconds position);
+		HRESULT TakeFailure(_In_ MediaEventType type);
+		void Apply(_In_ const ScriptedEvent& scriptedEvent);
+		bool PopDue(_In_ nanoseconds until, _Out_ ScriptedEvent& scriptedEvent);
+		void Dispatch(_In_ const ScriptedEvent& scriptedEvent);
+
+		public:
+		ScriptedSession(_In_ VirtualClock& clock);
+
+		// Events are dispatched to the state machine with HandleEvent
+		void SetTarget(_In_opt_ AudioStateMachine* stateMachine) { target = stateMachine; }
+		// Time between a command and its event
+		void SetCommandLatency(_In_ nanoseconds latency) { commandLatency = latency; }
+		// MESessionEnded is sent when the presentation clock reaches the duration, zero never ends
+		void SetDuration(_In_ milliseconds p_duration) { duration = p_duration; }
+		// Start, Pause, Stop and Close return result without sending anything while it is a failure
+		void SetCommandResult(_In_ HRESULT result) { commandResult = result; }
+		// When false commands are only counted and their events have to be posted, for replaying recorded sessions
+		void SetAnswerCommands(_In_ bool answer) { answerCommands = answer; }
+		// The next event of the type is sent with status instead of S_OK
+		void FailNext(_In_ MediaEventType type, _In_ HRESULT status);
+
+		// Sends MESessionTopologySet and then MESessionCapabilitiesChanged, each after the command latency
+		// Call after AudioStateMachine::OnOpening
+		void Open();
+		// Sends any event, MESessionStarted, Paused and Stopped also move the presentation clock as if a command was answered
+		void Post(_In_ MediaEventType type, _In_ nanoseconds delay, _In_ HRESULT status = S_OK);
+
+		// Advances the clock by duration and dispatches the events that became due in order
+		// Returns the number of dispatched events
+		UINT64 RunFor(_In_ nanoseconds duration);
+		// Dispatches events until none are left, moving the clock to each of them
+		// Gives up after maxEvents so a looping file doesn't run forever
+		UINT64 RunUntilIdle(_In_ UINT64 maxEvents = 1000000);
+
+		bool IsIdle() const { return events.empty(); }
+		UINT64 GetCommandCount() const { return commandCount; }
+		UINT64 GetDispatchedCount() const { return dispatchedCount; }
+
+		HRESULT Start(_In_opt_ const milliseconds* position) override;
+		HRESULT Pause() override;
+		HRESULT Stop() override;
+		HRESULT Close() override;
+		HRESULT GetTime(_Out_ milliseconds& time) override;
+	};
+}
@@ -0,0 +1,230 @@
+#pragma once
+
+#include "DspChain.h"
+#include "PcmSink.h"
+
+
+namespace AudioPlay
+{
+	enum class SharedPcmState : UINT32
+	{
+		// Created, no format yet
+		Idle = 0,
+		Streaming = 1,
+		// EndStream was called, another stream may follow
+		Ended = 2,
+		// The writer is gone
+		Closed = 3
+	};
+
+	// Layout of the shared memory, little endian, the samples follow at headerSize
+	// Frame f of the current stream is at sample (f % capacityFrames) * channels, frames are counted since the writer was created
+	// The writer never waits for readers, a reader that falls more than capacityFrames behind loses the oldest frames
+	struct SharedPcmHeader
+	{
+		// 0
+		UINT32 magic;
+		UINT32 version;
+		UINT32 headerSize;
+		UINT32 maxChannels;
+		// A power of two
+		UINT32 capacityFrames;
+		// Process id of the writer, so a segment left by a writer that crashed can be taken over
+		UINT32 writerProcess;
+		BYTE reserved0[40];
+
+		// 64, a seqlock, odd while the writer changes the format
+		std::atomic<UINT32> formatSequence;
+		std::atomic<UINT32> sampleRate;
+		std::atomic<UINT32> channels;
+		UINT32 reserved1;
+		// First frame of the current stream
+		std::atomic<UINT64> streamStart;
+		BYTE reserved2[40];
+
+		// 128, frames published
+		std::atomic<UINT64> writeFrame;
+		// End of the frames being copied, ahead of writeFrame while the writer copies them
+		// A block from frame a was overwritten if this went past a + capacityFrames while it was read
+		std::atomic<UINT64> reserveFrame;
+		std::atomic<SharedPcmState> state;
+		BYTE reserved3[44];
+
+		// 192, bumped after every write, readers wait on it with a futex on Linux
+		std::atomic<UINT32> wakeSequence;
+		// Readers waiting, the writer only wakes them if there are any
+		std::atomic<UINT32> waiters;
+		BYTE reserved4[56];
+	};
+
+	static_assert(sizeof(SharedPcmHeader) == 256, "The layout is shared with other processes");
+	static_assert(std::atomic<UINT64>::is_always_lock_free, "Atomics in shared memory can't use locks");
+
+	// Publishes PCM into a named shared memory ring for other processes
+	// Write is called by one thread and never allocates, locks or waits, it only copies into the ring
+	class SharedPcmWriter
+	{
+		std::atomic<ULONG> referenceCount;
+
+		SharedPcmHeader* header;
+		float* samples;
+		UINT64 mappedSize;
+		PcmFormat format;
+
+		#ifdef _WIN32
+		HANDLE mapping;
+		HANDLE wakeSemaphore;
+		#else
+		int descriptor;
+		char* name;
+		#endif
+
+		SharedPcmWriter();
+
+		void Wake();
+
+		public:
+		static constexpr UINT32 magic = 0x4D435041;
+		static constexpr UINT32 version = 1;
+		static constexpr UINT32 minCapacityFrames = 1024;
+		static constexpr UINT32 maxCapacityFrames = 1 << 22;
+		static constexpr UINT32 maxChannels = DspEffect::maxChannels;
+
+		// Readers see the state as Closed
+		~SharedPcmWriter();
+
+		SharedPcmWriter(const SharedPcmWriter&) = delete;
+		SharedPcmWriter& operator=(const SharedPcmWriter&) = delete;
+
+		// name is up to 200 characters without slashes, Local\AudioPlay.name on Windows and /AudioPlay.name in /dev/shm elsewhere
+		// Fails with ERROR_ALREADY_EXISTS if another writer uses the name
+		static HRESULT Create(_In_z_ LPCWCH name, _In_ UINT32 capacityFrames, _In_ UINT32 maxChannels, _COM_Outptr_ SharedPcmWriter** pPtrWriter);
+
+		ULONG STDMETHODCALLTYPE AddRef();
+		ULONG STDMETHODCALLTYPE Release();
+
+		// Starts a stream, readers move to its first frame
+		HRESULT BeginStream(_In_ const PcmFormat& format);
+		void Write(_In_reads_(frameCount * format.channels) const float* frames, _In_ UINT32 frameCount);
+		void EndStream();
+
+		UINT64 GetWrittenFrames() const { return header->writeFrame.load(std::memory_order_relaxed); }
+	};
+
+	struct SharedPcmBlock
+	{
+		// Points into the shared memory, Release says whether the writer overwrote it while it was read
+		const float* frames;
+		UINT32 frameCount;
+		PcmFormat format;
+		// Counted since the writer was created
+		UINT64 firstFrame;
+		// Lost before this block because the reader fell too far behind
+		UINT64 droppedFrames;
+		UINT32 formatSequence;
+		// First block of a new stream
+		bool streamStarted;
+	};
+
+	// Reads the ring of a SharedPcmWriter in another process without copying
+	// Every reader keeps its own position, any number of them can read the same ring, a reader is used by one thread
+	class SharedPcmReader
+	{
+		std::atomic<ULONG> referenceCount;
+
+		SharedPcmHeader* header;
+		const float* samples;
+		UINT64 mappedSize;
+		UINT32 capacityFrames;
+
+		UINT64 position;
+		UINT32 formatSequence;
+		// Until the first block of the stream is handed out, a stream can start before it has frames
+		bool streamStartPending;
+		// As of the last Wait, a change wakes the next one
+		SharedPcmState observedState;
+		// A writer that crashed never sets Closed, Wait looks for its process when it times out
+		bool writerExited;
+
+		UINT64 droppedFrames;
+		UINT64 underruns;
+		UINT64 tornBlocks;
+
+		#ifdef _WIN32
+		HANDLE mapping;
+		HANDLE wakeSemaphore;
+		#else
+		int descriptor;
+		#endif
+
+		SharedPcmReader();
+
+		bool HasNews() const;
+		bool HasWriterExited() const;
+
+		public:
+		~SharedPcmReader();
+
+		SharedPcmReader(const SharedPcmReader&) = delete;
+		SharedPcmReader& operator=(const SharedPcmReader&) = delete;
+
+		// Starts at the newest frame, ERROR_FILE_NOT_FOUND if there is no writer
+		static HRESULT Open(_In_z_ LPCWCH name, _COM_Outptr_ SharedPcmReader** pPtrReader);
+
+		ULONG STDMETHODCALLTYPE AddRef();
+		ULONG STDMETHODCALLTYPE Release();
+
+		// The oldest frames not read yet, up to where the ring wraps
+		// Returns S_FALSE if there is nothing new, the block is only valid with S_OK
+		HRESULT Acquire(_Out_ SharedPcmBlock& block);
+		// Moves past the block, returns false if the writer overwrote it while it was read and what was read is garbage
+		bool Release(_In_ const SharedPcmBlock& block);
+		// Returns S_OK once there is something to Acquire or the state changed, S_FALSE after the timeout
+		HRESULT Wait(_In_ UINT32 timeoutMilliseconds);
+
+		SharedPcmState GetState() const;
+		UINT32 GetCapacityFrames() const { return capacityFrames; }
+
+		// Overruns, every frame lost because the reader fell too far behind
+		UINT64 GetDroppedFrames() const { return droppedFrames; }
+		// Acquire calls that found nothing new while the writer was streaming
+		UINT64 GetUnderruns() const { return underruns; }
+		// Blocks Release found overwritten
+		UINT64 GetTornBlocks() const { return tornBlocks; }
+	};
+
+	// Feeds an offline render or any other PcmSink producer into a SharedPcmWriter
+	class SharedPcmSink : public PcmSink
+	{
+		ComPtr<SharedPcmWriter> writer;
+
+		SharedPcmSink();
+
+		public:
+		static HRESULT Create(_In_ SharedPcmWriter* writer, _COM_Outptr_ SharedPcmSink** pPtrSink);
+
+		HRESULT BeginStream(_In_ const PcmFormat& format) override;
+		HRESULT Write(_In_reads_(frameCount * format.channels) const float* frames, _In_ UINT32 frameCount) override;
+		HRESULT EndStream() override;
+	};
+
+	// Publishes what goes through a DspChain, last in the chain it is what the device plays
+	class SharedPcmTap : public DspEffect
+	{
+		ComPtr<SharedPcmWriter> writer;
+		std::atomic<UINT64> failedFormats;
+
+		SharedPcmTap();
+
+		protected:
+		void Update(_In_ const PcmFormat& format) override;
+		void Reset() override;
+		void Process(_Inout_updates_(frameCount * format.channels) float* frames, _In_ UINT32 frameCount, _In_ const PcmFormat& format) override;
+
+		public:
+		static HRESULT Create(_In_ SharedPcmWriter* writer, _COM_Outptr_ SharedPcmTap** pPtrTap);
+
+		// Formats with more channels than the writer takes are not published
+		UINT64 GetFailedFormats() const { return failedFormats.load(std::memory_order_relaxed); }
+	};
+}
@@ -0,0 +1,8 @@
+#pragma once
+
+// AUDIOPLAY_SSE2 is defined when the SSE2 kernels can be used, everything has a scalar fallback
+// Defining AUDIOPLAY_NO_SIMD builds the fallbacks only, for comparing them
+#if !defined(AUDIOPLAY_NO_SIMD) && (defined(_M_X64) || defined(_M_AMD64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2) || defined(__SSE2__))
+#define AUDIOPLAY_SSE2 1
+#include <emmintrin.h>
+#endif
@@ -0,0 +1,51 @@
+#pragma once
+
+#include "AudioPlay.h"
+#include "PcmSource.h"
+
+#include <mfreadwrite.h>
+
+
+namespace AudioPlay
+{
+	// Decodes the first audio stream of a file to float frames with an IMFSourceReader
+	class SourceReaderPcmSource : public PcmSource
+	{
+		private:
+		ComPtr<IMFSourceReader> sourceReader;
+		ComPtr<IPropertyStore> propertyStore;
+
+		float* decoded;
+		UINT32 decodedCapacity;
+		UINT32 decodedFrames;
+		UINT32 decodedOffset;
+
+		UINT64 position;
+		UINT64 length;
+		bool lengthKnown;
+		bool endOfStream;
+		// Frames before this are dropped after a seek, the reader seeks to the key frame before the target
+		UINT64 seekTarget;
+		bool discardUntilTarget;
+
+		SourceReaderPcmSource();
+
+		HRESULT Initialize(_In_ IMFSourceReader* reader);
+		HRESULT ReadNextSample();
+
+		public:
+		~SourceReaderPcmSource();
+
+		// The first sample is decoded before returning so the source can start right away
+		static HRESULT Create(_In_ LPCWCH path, _COM_Outptr_ SourceReaderPcmSource** pPtrSource);
+		static HRESULT Create(_In_ IMFByteStream* byteStream, _COM_Outptr_ SourceReaderPcmSource** pPtrSource);
+
+		HRESULT Read(_Out_writes_(frameCount * format.channels) float* buffer, _In_ UINT32 frameCount, _Out_ UINT32& framesRead) override;
+		HRESULT Seek(_In_ UINT64 frame) override;
+		HRESULT GetPosition(_Out_ UINT64& frame) const override;
+		HRESULT GetLength(_Out_ UINT64& frames) const override;
+
+		// Metadata of the file from the media source the reader resolved, MF_E_UNSUPPORTED_SERVICE if it has none
+		HRESULT GetPropertyStore(_COM_Outptr_ IPropertyStore** pPtrStore) const;
+	};
+}
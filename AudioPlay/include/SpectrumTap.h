@@ -0,0 +1,91 @@
+#pragma once
+
+#include "DspChain.h"
+#include "Fft.h"
+
+#include <condition_variable>
+#include <thread>
+
+
+namespace AudioPlay
+{
+	struct SpectrumFrame
+	{
+		// Goes up by one for every published spectrum, 0 until the first one
+		UINT64 sequence;
+		// Frames the tap had seen when the analysed window ended
+		UINT64 streamFrame;
+		UINT32 sampleRate;
+		// fftSize / 2 + 1, bin k is at k * sampleRate / fftSize Hz
+		UINT32 binCount;
+		// dBFS, a full scale sine reads 0 in its bin
+		const float* magnitudes;
+	};
+
+	// Copies what goes through a DspChain into a ring and turns it into spectra on a worker thread
+	// The audio thread only mixes to mono and stores into the ring, it never waits for the worker
+	// Spectra are handed to one reader thread through a triple buffer, the reader never waits either
+	class SpectrumTap : public DspEffect
+	{
+		static constexpr UINT32 ringSize = 65536;
+		static constexpr UINT32 freshBit = 4;
+		static constexpr UINT32 indexMask = 3;
+
+		// Written by the audio thread, relaxed atomics cost the same as plain floats and make the lapped reads defined
+		std::atomic<float>* ring;
+		std::atomic<UINT64> written;
+		std::atomic<UINT32> sampleRate;
+
+		// Worker thread
+		RealFft fft;
+		UINT32 fftSize;
+		float* window;
+		float windowScale;
+		float* analysis;
+		float* real;
+		float* imaginary;
+		UINT64 lastAnalysed;
+		UINT64 published;
+
+		SpectrumFrame spectra[3];
+		float* magnitudes[3];
+		UINT32 backIndex;
+		// Index of the buffer in the middle, with freshBit set when the worker left a new spectrum there
+		std::atomic<UINT32> middleIndex;
+		// Reader thread
+		UINT32 frontIndex;
+
+		std::atomic<float> updateRate;
+		std::mutex stopMutex;
+		std::condition_variable stopCondition;
+		bool stopping;
+		std::thread worker;
+
+		SpectrumTap();
+
+		void Work();
+		bool Analyse();
+
+		protected:
+		void Update(_In_ const PcmFormat& format) override;
+		void Reset() override;
+		void Process(_Inout_updates_(frameCount * format.channels) float* frames, _In_ UINT32 frameCount, _In_ const PcmFormat& format) override;
+
+		public:
+		static constexpr UINT32 minFftSize = 256;
+		static constexpr UINT32 maxFftSize = 16384;
+		static constexpr float silenceFloor = -120.0f;
+
+		~SpectrumTap();
+
+		// fftSize is a power of two, updatesPerSecond from 1 to 240
+		static HRESULT Create(_In_ UINT32 fftSize, _In_ float updatesPerSecond, _COM_Outptr_ SpectrumTap** pPtrTap);
+
+		HRESULT SetUpdateRate(_In_ float updatesPerSecond);
+		UINT32 GetFftSize() const { return fftSize; }
+
+		// Newest spectrum, returns false if nothing new was published since the last call
+		// frame stays valid until the next call, only call it from one thread
+		bool GetLatest(_Out_ const SpectrumFrame*& frame);
+	};
+}
@@ -0,0 +1,59 @@
+#pragma once
+
+#include "AudioPlay.h"
+
+#include <vector>
+
+
+namespace AudioPlay
+{
+	// Finishes closing sessions and sources on a couple of background threads
+	// Call WaitForIdle before ShutdownMediaFoundation if players use deferred close
+	class TeardownPool
+	{
+		struct Job
+		{
+			ComPtr<IMFMediaSession> session;
+			ComPtr<IMFMediaSource> source;
+			PTP_TIMER timer;
+		};
+
+		CRITICAL_SECTION criticalSection;
+		HANDLE idleEvent;
+
+		PTP_POOL pool;
+		TP_CALLBACK_ENVIRON environment;
+
+		std::vector<Job*> waiting;
+		volatile LONG pendingCount;
+
+		TeardownPool();
+		~TeardownPool();
+
+		Job* Claim(_In_opt_ IMFMediaSession* session, _In_opt_ Job* job);
+		void Run(_In_ Job* job, _In_ bool fromTimer);
+
+		static void CALLBACK OnSessionClosedWork(PTP_CALLBACK_INSTANCE instance, PVOID context);
+		static void CALLBACK OnTimeout(PTP_CALLBACK_INSTANCE instance, PVOID context, PTP_TIMER timer);
+
+		public:
+		static constexpr DWORD maxThreads = 2;
+		// Sessions that don't report MESessionClosed in time are shut down anyway
+		static constexpr DWORD closeTimeoutMilliseconds = 10000;
+
+		static TeardownPool& Get();
+
+		TeardownPool(const TeardownPool&) = delete;
+		TeardownPool& operator=(const TeardownPool&) = delete;
+
+		// Closes the session and shuts both down once it reports MESessionClosed
+		// The owner of the session has to pass MESessionClosed to OnSessionClosed
+		HRESULT Defer(_In_ IMFMediaSession* session, _In_opt_ IMFMediaSource* source);
+		void OnSessionClosed(_In_ IMFMediaSession* session);
+
+		// Number of sessions closed but not shut down yet
+		LONG GetPendingCount() const { return pendingCount; }
+		// Returns AUDIO_TIMEOUT if teardowns are still pending after the timeout
+		HRESULT WaitForIdle(_In_ DWORD timeoutMilliseconds = INFINITE);
+	};
+}
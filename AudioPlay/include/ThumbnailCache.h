@@ -0,0 +1,130 @@
+#pragma once
+
+#include "AudioPlay.h"
+
+#include <wincodec.h>
+
+#include <atomic>
+#include <list>
+#include <unordered_map>
+#include <vector>
+
+
+namespace AudioPlay
+{
+	class AudioMetadata;
+
+	// Called from a pool thread, thumbnail is nullptr if result failed
+	using ThumbnailCallback = void (*)(HRESULT result, IWICBitmapSource* thumbnail, void* context);
+
+	struct ThumbnailCacheStatistics
+	{
+		UINT64 hits;
+		UINT64 misses;
+		// Requests that found the same art already being decoded and waited for it
+		UINT64 joins;
+		UINT64 decodes;
+		UINT64 evictions;
+		UINT64 usedBytes;
+		UINT32 entryCount;
+	};
+
+	// Decodes cover art downscaled to the requested size on a small thread pool and keeps the results in a memory bounded LRU
+	// Entries are keyed by a hash of the encoded bytes, so art shared by every track of an album is decoded and stored once
+	class ThumbnailCache
+	{
+		struct Key
+		{
+			UINT64 hash;
+			UINT32 size;
+			UINT32 edge;
+
+			bool operator==(const Key& other) const { return hash == other.hash && size == other.size && edge == other.edge; }
+		};
+
+		struct KeyHash
+		{
+			size_t operator()(const Key& key) const { return static_cast<size_t>(key.hash ^ (static_cast<UINT64>(key.edge) << 32)); }
+		};
+
+		struct Entry
+		{
+			Key key;
+			ComPtr<IWICBitmap> bitmap;
+			UINT64 bytes;
+		};
+
+		struct Waiter
+		{
+			ThumbnailCallback callback;
+			void* context;
+		};
+
+		struct Job
+		{
+			ThumbnailCache* cache;
+			Key key;
+			BYTE* data;
+			std::vector<Waiter> waiters;
+		};
+
+		std::atomic<ULONG> referenceCount;
+
+		CRITICAL_SECTION criticalSection;
+
+		// Most recently used first
+		std::list<Entry> entries;
+		std::unordered_map<Key, std::list<Entry>::iterator, KeyHash> index;
+		std::unordered_map<Key, Job*, KeyHash> pending;
+		UINT64 maxBytes;
+		ThumbnailCacheStatistics statistics;
+
+		PTP_POOL pool;
+		TP_CALLBACK_ENVIRON environment;
+
+		ThumbnailCache();
+
+		static Key MakeKey(_In_reads_bytes_(size) const BYTE* data, _In_ UINT32 size, _In_ UINT32 edge);
+		static HRESULT Decode(_In_reads_bytes_(size) const BYTE* data, _In_ UINT32 size, _In_ UINT32 edge, _COM_Outptr_ IWICBitmap** pPtrBitmap);
+		static void CALLBACK OnDecodeWork(PTP_CALLBACK_INSTANCE instance, PVOID context);
+
+		void Insert(_In_ const Key& key, _In_ IWICBitmap* bitmap);
+		void Evict(_In_ UINT64 budget);
+		void Finish(_In_ Job* job);
+
+		public:
+		static constexpr UINT32 minEdge = 16;
+		static constexpr UINT32 maxEdge = 4096;
+
+		~ThumbnailCache();
+
+		// maxBytes bounds the decoded pixels kept, thumbnails are 32bpp premultiplied BGRA
+		static HRESULT Create(_In_ UINT64 maxBytes, _In_ DWORD threads, _COM_Outptr_ ThumbnailCache** pPtrCache);
+
+		// One imaging factory for the whole process, created on first use
+		// COM has to be initialized on the calling thread
+		static HRESULT GetImagingFactory(_COM_Outptr_ IWICImagingFactory** pPtrFactory);
+
+		ULONG STDMETHODCALLTYPE AddRef();
+		ULONG STDMETHODCALLTYPE Release();
+
+		// Cached thumbnails come back right away in cached with S_OK
+		// Otherwise returns S_FALSE with cached set to nullptr and callback is called once the art is decoded
+		// The longer side of the thumbnail is at most edge, smaller art isn't scaled up
+		// The data is copied, it can be freed when Request returns
+		HRESULT Request(_In_reads_bytes_(size) const BYTE* data, _In_ UINT32 size, _In_ UINT32 edge,
+			_In_ ThumbnailCallback callback, _In_opt_ void* context, _COM_Outptr_result_maybenull_ IWICBitmapSource** cached);
+		// Returns HRESULT_FROM_WIN32(ERROR_NOT_FOUND) if the file has no art
+		HRESULT Request(_In_ const AudioMetadata& metadata, _In_ UINT32 edge,
+			_In_ ThumbnailCallback callback, _In_opt_ void* context, _COM_Outptr_result_maybenull_ IWICBitmapSource** cached);
+
+		// Returns S_FALSE and nullptr if the thumbnail isn't cached
+		HRESULT Lookup(_In_reads_bytes_(size) const BYTE* data, _In_ UINT32 size, _In_ UINT32 edge, _COM_Outptr_result_maybenull_ IWICBitmapSource** cached);
+
+		// Evicts least recently used thumbnails until at most maxBytes are kept, also for later inserts
+		void SetMaxBytes(_In_ UINT64 bytes);
+		void Clear();
+
+		ThumbnailCacheStatistics GetStatistics();
+	};
+}
@@ -0,0 +1,99 @@
+#pragma once
+
+#include "PcmSource.h"
+
+
+namespace AudioPlay
+{
+	// Changes the playback speed of another source without changing its pitch (WSOLA)
+	// 20 ms Hann windowed segments overlap by half, each one is taken from where it lines up best with the previous one
+	// At 1x the frames are passed through untouched
+	class TimeStretchSource : public PcmSource
+	{
+		static constexpr UINT32 positionHistory = 256;
+
+		// Output frame where a block starts and the input frame it was taken from
+		struct PositionMark
+		{
+			std::atomic<UINT64> outputFrame;
+			std::atomic<UINT64> inputFrame;
+			std::atomic<float> rate;
+		};
+
+		ComPtr<PcmSource> source;
+
+		// Set by the control thread, read once per segment
+		std::atomic<float> rate;
+
+		UINT32 segmentFrames;
+		UINT32 hopFrames;
+		UINT32 searchFrames;
+		// Interleaved halves of the window, riseWindow + fallWindow is 1 everywhere
+		float* riseWindow;
+		float* fallWindow;
+
+		// Frames of the source from inputStart on, past the end of the source they are silence
+		float* input;
+		UINT64 inputCapacity;
+		UINT64 inputStart;
+		UINT64 inputFrames;
+		UINT64 sourceEnd;
+
+		// Second half of the last segment, added to the first half of the next one
+		float* tail;
+		float* block;
+		UINT32 blockOffset;
+		UINT32 blockFrames;
+
+		float* mono;
+		float* monoTemplate;
+		float* decimated;
+
+		bool passthrough;
+		bool finished;
+		// Next frame to pass through, or where the last segment would continue naturally
+		UINT64 continuation;
+		double analysisPosition;
+		UINT64 outputPosition;
+
+		PositionMark marks[positionHistory];
+		std::atomic<UINT32> markCount;
+
+		TimeStretchSource();
+
+		HRESULT Initialize(_In_ PcmSource* source);
+		HRESULT Append(_In_ UINT64 frameCount);
+		// Keeps the frames from from up to to in input
+		HRESULT Fill(_In_ UINT64 from, _In_ UINT64 to);
+		const float* FramesAt(_In_ UINT64 frame) const { return input + (frame - inputStart) * format.channels; }
+		UINT64 FindSegment(_In_ UINT64 low, _In_ UINT64 high);
+		HRESULT LeavePassthrough();
+		HRESULT NextSegment(_In_ float segmentRate);
+		HRESULT PassThrough(_Out_writes_(frameCount * format.channels) float* buffer, _In_ UINT32 frameCount, _Out_ UINT32& framesRead);
+		void Mark(_In_ UINT64 inputFrame, _In_ float markRate);
+
+		public:
+		static constexpr float minimumRate = 0.5f;
+		static constexpr float maximumRate = 4.0f;
+
+		~TimeStretchSource();
+
+		static HRESULT Create(_In_ PcmSource* source, _In_ float rate, _COM_Outptr_ TimeStretchSource** pPtrSource);
+
+		// Can be called while playing, takes effect at the next segment
+		HRESULT SetRate(_In_ float newRate);
+		float GetRate() const { return rate; }
+
+		// Frame of the source that was played at outputFrame, output frames count on from the frame of the last seek
+		// Safe to call from any thread, Audio uses it to turn the session clock into a position in the file
+		UINT64 GetInputPosition(_In_ UINT64 outputFrame) const;
+
+		HRESULT Read(_Out_writes_(frameCount * format.channels) float* buffer, _In_ UINT32 frameCount, _Out_ UINT32& framesRead) override;
+		// frame is a frame of the source
+		HRESULT Seek(_In_ UINT64 frame) override;
+		// Frame of the source at the read position
+		HRESULT GetPosition(_Out_ UINT64& frame) const override;
+		// Length of the source
+		HRESULT GetLength(_Out_ UINT64& frames) const override;
+	};
+}
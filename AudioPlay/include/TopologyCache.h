@@ -0,0 +1,98 @@
+#pragma once
+
+#include "AudioPlay.h"
+
+#include <chrono>
+#include <vector>
+
+
+namespace AudioPlay
+{
+	// Format of a source stream as the topology loader sees it
+	struct TopologyKey
+	{
+		GUID subtype;
+		UINT32 sampleRate;
+		UINT32 channels;
+		UINT32 bitsPerSample;
+		UINT32 channelMask;
+		// Offline sessions end in a sample grabber that takes float, the others in the audio renderer
+		bool offline;
+
+		bool operator==(const TopologyKey& other) const
+		{
+			return subtype == other.subtype && sampleRate == other.sampleRate && channels == other.channels &&
+				bitsPerSample == other.bitsPerSample && channelMask == other.channelMask && offline == other.offline;
+		}
+	};
+
+	struct TopologyCacheStatistics
+	{
+		UINT64 hits;
+		UINT64 misses;
+		// Resolved topologies whose transforms were remembered
+		UINT64 learned;
+		// Cached transforms that couldn't be created or connected, and topologies built from them the session rejected
+		UINT64 failures;
+		// From the start of an open until the player is Ready, with and without cached transforms
+		UINT64 cachedOpens;
+		UINT64 cachedOpenMicroseconds;
+		UINT64 uncachedOpens;
+		UINT64 uncachedOpenMicroseconds;
+		UINT32 entryCount;
+	};
+
+	// Remembers the transforms the topology loader put between a source stream and the sink, by stream format
+	// A stream of a format seen before gets the same decoder and converters with their media types already set,
+	// the loader is left to check the connections instead of enumerating and trying transforms
+	// Whether that makes opens any faster hasn't been measured, compare the cached and uncached open times in the statistics
+	// Transforms and sinks aren't shared, every topology gets its own instances and the session shuts them down with it
+	class TopologyCache
+	{
+		struct Step
+		{
+			CLSID clsid;
+			ComPtr<IMFMediaType> outputType;
+		};
+
+		struct Entry
+		{
+			TopologyKey key;
+			std::vector<Step> steps;
+		};
+
+		CRITICAL_SECTION criticalSection;
+
+		// Most recently used first
+		std::vector<Entry> entries;
+		TopologyCacheStatistics statistics;
+
+		TopologyCache();
+		~TopologyCache();
+
+		public:
+		static constexpr size_t maxEntries = 32;
+		// Decoder, resampler and channel mixer at most, longer chains are resolved every time
+		static constexpr size_t maxSteps = 4;
+
+		static TopologyCache& Get();
+
+		TopologyCache(const TopologyCache&) = delete;
+		TopologyCache& operator=(const TopologyCache&) = delete;
+
+		static HRESULT MakeKey(_In_ IMFStreamDescriptor* streamDescriptor, _In_ bool offline, _Out_ TopologyKey& key);
+
+		// Adds the cached transforms of the format to the topology after sourceNode, last is the node the output connects to
+		// Returns S_FALSE and adds nothing if the format isn't cached or the transforms can't be set up
+		HRESULT Build(_In_ const TopologyKey& key, _In_ IMFStreamDescriptor* streamDescriptor, _In_ IMFTopology* topology,
+			_In_ IMFTopologyNode* sourceNode, _Out_ ComPtr<IMFTopologyNode>& last);
+		// Remembers the transforms of a resolved topology, the one MESessionTopologyStatus carries with MF_TOPOSTATUS_READY
+		HRESULT Learn(_In_ const TopologyKey& key, _In_ IMFTopology* fullTopology);
+		// For a topology built from the cache that the session rejected, counted as a failure
+		void Remove(_In_ const TopologyKey& key);
+		void Clear();
+
+		void RecordOpen(_In_ std::chrono::microseconds latency, _In_ bool cached);
+		TopologyCacheStatistics GetStatistics();
+	};
+}
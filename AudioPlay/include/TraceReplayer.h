@@ -0,0 +1,61 @@
+#pragma once
+
+#include "EventTrace.h"
+#include "ScriptedSession.h"
+
+#include <vector>
+
+
+namespace AudioPlay
+{
+	struct TraceReplayOptions
+	{
+		// Records after this sequence aren't replayed, halving it bisects where a replay starts to differ
+		UINT32 lastSequence = EventTraceRecorder::noCause;
+		// Transitions that took less than this in the recording aren't listed
+		std::chrono::nanoseconds slowThreshold{ 0 };
+	};
+
+	// A command and the session event that answered it
+	struct TraceTransition
+	{
+		UINT32 commandSequence;
+		UINT32 eventSequence;
+		EventTraceCommand command;
+		MediaEventType eventType;
+		// From the command returning to the state machine seeing the event, in the recording
+		UINT64 latencyNanoseconds;
+		// Audio::Invoke for the event in the recording, zero if the trace has no handler record for it
+		UINT64 handlerNanoseconds;
+		// The state machine handling the event during the replay
+		UINT64 replayNanoseconds;
+	};
+
+	struct TraceReplayResult
+	{
+		UINT64 replayedRecords;
+		// Records before the first Open, the state they start from isn't known
+		UINT64 skippedRecords;
+		UINT64 commands;
+		UINT64 events;
+		// Records after which the replayed state machine was in another state than the recorded one
+		UINT64 stateMismatches;
+		// Commands that returned another HRESULT than the recorded one
+		UINT64 resultMismatches;
+		// Sequence of the first record that differed, noCause if none did
+		UINT32 firstMismatch;
+		// How long the recording ran from the first Open to the last replayed record
+		UINT64 virtualNanoseconds;
+		// Host time the whole replay took
+		UINT64 replayNanoseconds;
+		// Slowest first
+		std::vector<TraceTransition> transitions;
+	};
+
+	// Feeds a recorded trace through a new AudioStateMachine on a ScriptedSession that doesn't answer commands
+	// Events come from the trace at their recorded time on a virtual clock, commands are issued with their recorded failures
+	// Returns S_FALSE if the trace has no Open to start from, ERROR_INVALID_DATA if it has commands this version doesn't know
+	HRESULT ReplayEventTrace(_In_ const std::vector<EventTraceRecord>& records, _In_ const TraceReplayOptions& options, _Out_ TraceReplayResult& result);
+	// Loads the file with LoadEventTrace first
+	HRESULT ReplayEventTrace(_In_z_ LPCWCH path, _In_ const TraceReplayOptions& options, _Out_ TraceReplayResult& result);
+}
@@ -0,0 +1,60 @@
+#pragma once
+
+#include "PcmSource.h"
+#include "MappedFile.h"
+#include "PcmKernels.h"
+
+
+namespace AudioPlay
+{
+	// Layout of the samples in the data chunk
+	struct SampleLayout
+	{
+		SampleEncoding encoding;
+		bool bigEndian;
+		// Bytes per frame, every channel interleaved
+		UINT32 blockAlign;
+	};
+
+	// Converts interleaved samples to float, integers are scaled to [-1, 1)
+	void ConvertSamples(_In_ const SampleLayout& layout, _In_ const BYTE* source, _Out_writes_(sampleCount) float* destination, _In_ size_t sampleCount);
+
+	// RIFF/WAVE (PCM, float, WAVE_FORMAT_EXTENSIBLE, RF64 and BW64) and AIFF/AIFC read straight out of a mapped file
+	// Opening only parses the headers, frames are converted while reading
+	class WavSource : public PcmSource
+	{
+		ComPtr<MemoryBlock> block;
+
+		SampleLayout layout;
+		const BYTE* frames;
+		UINT64 frameCount;
+		UINT64 position;
+		// Little endian 16 and 32 bit integers and floats, ConvertSamples does the others
+		PcmPipelineKernel convertKernel;
+
+		WavSource();
+
+		HRESULT ParseRiff(_In_reads_bytes_(size) const BYTE* data, _In_ UINT64 size);
+		HRESULT ParseAiff(_In_reads_bytes_(size) const BYTE* data, _In_ UINT64 size);
+
+		public:
+		~WavSource();
+
+		static HRESULT Open(_In_z_ LPCWCH path, _COM_Outptr_ WavSource** pPtrSource);
+		// Returns AUDIO_E_UNSUPPORTED_FORMAT if the block isn't a WAV or AIFF file
+		static HRESULT Create(_In_ MemoryBlock* block, _COM_Outptr_ WavSource** pPtrSource);
+		// True if the header looks like a file WavSource can read
+		static bool CanRead(_In_reads_bytes_(size) const BYTE* data, _In_ UINT64 size);
+
+		const SampleLayout& GetLayout() const { return layout; }
+		// Frames as they are stored in the file, frameCount is clamped to the end of the data
+		// The pointer is valid as long as the source is
+		HRESULT GetRawFrames(_In_ UINT64 frame, _Inout_ UINT64& count, _Outptr_ const BYTE** pPtrFrames) const;
+
+		HRESULT Read(_Out_writes_(frameCount * format.channels) float* buffer, _In_ UINT32 frameCount, _Out_ UINT32& framesRead) override;
+		// Exact to the frame
+		HRESULT Seek(_In_ UINT64 frame) override;
+		HRESULT GetPosition(_Out_ UINT64& frame) const override;
+		HRESULT GetLength(_Out_ UINT64& frames) const override;
+	};
+}
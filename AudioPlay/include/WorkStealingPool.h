@@ -0,0 +1,82 @@
+#pragma once
+
+#include "PortableTypes.h"
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <thread>
+
+
+namespace AudioPlay
+{
+	// worker is the index of the thread running the task, for per thread scratch memory
+	using PoolTask = void (*)(void* context, UINT32 worker);
+
+	struct WorkStealingPoolStatistics
+	{
+		UINT64 executed;
+		// Tasks a thread took from another thread's queue
+		UINT64 stolen;
+	};
+
+	// Threads with a queue each for many small independent jobs, like decoding a batch of files
+	// A thread runs its own newest task first and takes the oldest one of another thread when it runs out
+	// Tasks submitted from a task go to the queue of the thread running it
+	class WorkStealingPool
+	{
+		struct Task
+		{
+			PoolTask callback;
+			void* context;
+		};
+
+		struct Worker
+		{
+			std::mutex mutex;
+			std::deque<Task> tasks;
+			std::thread thread;
+			std::atomic<UINT64> executed;
+			std::atomic<UINT64> stolen;
+		};
+
+		std::atomic<ULONG> referenceCount;
+
+		Worker* workers;
+		UINT32 workerCount;
+		std::atomic<UINT32> nextWorker;
+
+		std::mutex mutex;
+		std::condition_variable wakeCondition;
+		std::condition_variable idleCondition;
+		// Tasks in the queues, goes up under mutex so a sleeping thread doesn't miss it
+		std::atomic<UINT64> queued;
+		// Tasks submitted and not finished
+		std::atomic<UINT64> pending;
+		bool stopping;
+
+		WorkStealingPool();
+
+		bool Take(_In_ UINT32 index, _Out_ Task& task);
+		void Work(_In_ UINT32 index);
+
+		public:
+		~WorkStealingPool();
+
+		// threadCount 0 is one per hardware thread
+		static HRESULT Create(_In_ UINT32 threadCount, _COM_Outptr_ WorkStealingPool** pPtrPool);
+
+		ULONG STDMETHODCALLTYPE AddRef();
+		ULONG STDMETHODCALLTYPE Release();
+
+		UINT32 GetThreadCount() const { return workerCount; }
+
+		HRESULT Submit(_In_ PoolTask callback, _In_opt_ void* context);
+		// Returns once every submitted task has finished, including ones submitted meanwhile
+		// Can't be called from a task
+		void Wait();
+
+		WorkStealingPoolStatistics GetStatistics() const;
+	};
+}
@@ -1,5 +1,22 @@
 #include "Audio.h"
 #include "AudioMetadata.h"
+#include "MetadataSnapshot.h"
+#include "AutoCriticalSection.h"
+#include "MemoryByteStream.h"
+#include "PcmMediaSource.h"
+#include "NativeSource.h"
+#include "PcmSinkGrabber.h"
+#include "LoopingSource.h"
+#include "TimeStretchSource.h"
+#include "DspChain.h"
+#include "GaplessInfo.h"
+#include "EncodedFileCache.h"
+#include "RenderTelemetry.h"
+#include "SpectrumTap.h"
+#include "SourceReaderPcmSource.h"
+#include "ReadAheadByteStream.h"
+#include "TeardownPool.h"
+#include "TopologyCache.h"
 
 #include <strsafe.h>
 
@@ -11,33 +28,47 @@
 #define HR_FAIL_ACTION(hresult, action) if (FAILED(hresult)) { action; return hresult; }
 #define HR_FAIL(hresult) if (FAILED(hresult)) { return hresult; }
 
-#define CHECK_CLOSED if (state == AudioStates::Closed) { return AUDIO_E_CLOSED; }
+#define CHECK_CLOSED if (GetState() == AudioStates::Closed) { return AUDIO_E_CLOSED; }
 
 
 using std::chrono::nanoseconds;
 using std::chrono::duration_cast;
 
 
-class AutoCriticalSection
-{
-	private:
-	LPCRITICAL_SECTION criticalSection;
+using namespace std::chrono_literals;
 
-	public:
-	AutoCriticalSection(LPCRITICAL_SECTION section) :
-		criticalSection(section)
+
+namespace
+{
+	// Use CoTaskMemFree on copy
+	HRESULT DuplicateString(_In_z_ LPCWCH source, _Outref_result_maybenull_ LPWCH& copy)
 	{
+		copy = nullptr;
+
+		size_t length;
+
+		HRESULT hr = StringCbLengthW(source, STRSAFE_MAX_CCH * sizeof(WCHAR), &length); HR_FAIL(hr);
+		length += sizeof(WCHAR);
+
+		copy = reinterpret_cast<LPWCH>(CoTaskMemAlloc(length));
 
-		EnterCriticalSection(criticalSection);
+		if (copy == nullptr)
+		{
+			return E_OUTOFMEMORY;
+		}
+
+		return StringCbCopyW(copy, length, source);
 	}
 
-	~AutoCriticalSection()
+	HRESULT GetEventStatus(_In_ ComPtr<IMFMediaEvent>& mediaEvent)
 	{
-		LeaveCriticalSection(criticalSection);
-	}
-};
+		HRESULT status = S_OK;
 
-using namespace std::chrono_literals;
+		HRESULT hr = mediaEvent->GetStatus(&status); HR_FAIL(hr);
+
+		return status;
+	}
+}
 
 #pragma warning (push)
 #pragma warning (disable: 6388 28196)
@@ -87,12 +118,55 @@ HRESULT AudioPlay::Audio::CreateAudio(_In_opt_z_ LPCWCH path, _COM_Outptr_ Audio
 
 const AudioPlay::AudioMetadata AudioPlay::Audio::GetMetadata() const
 {
-	return AudioPlay::AudioMetadata(mediaSource);
+	ComPtr<IPropertyStore> store;
+	GetPropertyStore(store);
+
+	return AudioPlay::AudioMetadata(store);
+}
+
+HRESULT AudioPlay::Audio::GetMetadataSnapshot(_Outptr_result_maybenull_ MetadataSnapshot** pPtrSnapshot) const
+{
+	if (pPtrSnapshot == nullptr)
+	{
+		return E_INVALIDARG;
+	}
+	*pPtrSnapshot = nullptr;
+
+	ComPtr<IPropertyStore> store;
+
+	HRESULT hr = GetPropertyStore(store); HR_FAIL(hr);
+
+	return MetadataSnapshot::Create(store, pPtrSnapshot);
+}
+
+HRESULT AudioPlay::Audio::GetPropertyStore(_Out_ ComPtr<IPropertyStore>& store) const
+{
+	store = nullptr;
+
+	if (!mediaSource)
+	{
+		return E_POINTER;
+	}
+
+	HRESULT hr = S_OK;
+
+	if (!propertyStore)
+	{
+		hr = MFGetService(mediaSource, MF_PROPERTY_HANDLER_SERVICE, IID_PPV_ARGS(&propertyStore)); HR_FAIL(hr);
+	}
+
+	store = propertyStore;
+
+	return hr;
 }
 
 AudioPlay::Audio::Audio() :
-	referenceCount(1), state(AudioStates::Closed), filepath(nullptr),
-	looping(FALSE),	callback(nullptr)
+	referenceCount(1), sessionCommands(this), stateMachine(&sessionCommands), filepath(nullptr),
+	deferredClose(FALSE), nativeDecoding(FALSE), gaplessTrimming(FALSE), fileCaching(FALSE), topologyCaching(FALSE),
+	openTopologyKey{ }, openTopologyKeyValid(false), openTopologyCached(false), openTiming(false),
+	loopRegionSet(FALSE), loopRegionStart(0), loopRegionEnd(0), loopRegionCount(0),
+	playbackRate(1.0f), preservePitch(FALSE), readAheadChunkSize(0), readAheadDepth(0), callback(nullptr), openCallback(this), pendingPath(nullptr),
+	openCompletedCallback(nullptr), openCompletedContext(nullptr)
 {
 	InitializeCriticalSection(&criticalSection);
 
@@ -101,8 +175,12 @@ AudioPlay::Audio::Audio() :
 
 
 AudioPlay::Audio::Audio(MediaEventCallback p_callback) :
-	referenceCount(1), state(AudioStates::Closed), filepath(nullptr), 
-	looping(FALSE), callback(p_callback)
+	referenceCount(1), sessionCommands(this), stateMachine(&sessionCommands), filepath(nullptr),
+	deferredClose(FALSE), nativeDecoding(FALSE), gaplessTrimming(FALSE), fileCaching(FALSE), topologyCaching(FALSE),
+	openTopologyKey{ }, openTopologyKeyValid(false), openTopologyCached(false), openTiming(false),
+	loopRegionSet(FALSE), loopRegionStart(0), loopRegionEnd(0), loopRegionCount(0),
+	playbackRate(1.0f), preservePitch(FALSE), readAheadChunkSize(0), readAheadDepth(0), callback(p_callback), openCallback(this), pendingPath(nullptr),
+	openCompletedCallback(nullptr), openCompletedContext(nullptr)
 {
 	InitializeCriticalSection(&criticalSection);
 
@@ -111,6 +189,8 @@ AudioPlay::Audio::Audio(MediaEventCallback p_callback) :
 
 AudioPlay::Audio::~Audio()
 {
+	PositionNotifier::Get().UnsubscribeAll(&stateMachine);
+
 	Stop();
 	CloseFile();
 
@@ -127,6 +207,7 @@ HRESULT AudioPlay::Audio::CreateTopology(_In_ ComPtr<IMFTopology>& topology, _In
 	ComPtr <IMFTopologyNode> outputNode;
 	ComPtr<IMFMediaSink> mediaSink;
 	ComPtr<IMFStreamSink> streamSink;
+	ComPtr<IMFActivate> outputActivate;
 
 	HRESULT hr = S_OK;
 
@@ -152,9 +233,16 @@ HRESULT AudioPlay::Audio::CreateTopology(_In_ ComPtr<IMFTopology>& topology, _In
 		}
 	}
 
-	hr = MFCreateAudioRenderer(nullptr, &mediaSink); HR_FAIL(hr);
+	if (offlineSink)
+	{
+		hr = CreateOfflineSink(streamDescriptor, outputActivate); HR_FAIL(hr);
+	}
+	else
+	{
+		hr = MFCreateAudioRenderer(nullptr, &mediaSink); HR_FAIL(hr);
 
-	hr = mediaSink->GetStreamSinkByIndex(streamIndex, &streamSink); HR_FAIL(hr);
+		hr = mediaSink->GetStreamSinkByIndex(streamIndex, &streamSink); HR_FAIL(hr);
+	}
 
 	#pragma region SOURCESTREAM NODE
 	MFCreateTopologyNode(MF_TOPOLOGY_SOURCESTREAM_NODE, &sourceNode); HR_FAIL(hr);
@@ -164,100 +252,766 @@ HRESULT AudioPlay::Audio::CreateTopology(_In_ ComPtr<IMFTopology>& topology, _In
 	#pragma endregion
 	hr = topology->AddNode(sourceNode); HR_FAIL(hr);
 
+	// A format seen before gets the transforms the loader chose for it then
+	ComPtr<IMFTopologyNode> upstream = sourceNode;
+
+	openTopologyKeyValid = false;
+	openTopologyCached = false;
+
+	if (topologyCaching && SUCCEEDED(TopologyCache::MakeKey(streamDescriptor, offlineSink != nullptr, openTopologyKey)))
+	{
+		ComPtr<IMFTopologyNode> last;
+
+		openTopologyKeyValid = true;
+
+		if (TopologyCache::Get().Build(openTopologyKey, streamDescriptor, topology, sourceNode, last) == S_OK)
+		{
+			upstream = last;
+			openTopologyCached = true;
+		}
+	}
+
 	#pragma region OUTPUT_NODE
 	hr = MFCreateTopologyNode(MF_TOPOLOGY_OUTPUT_NODE, &outputNode); HR_FAIL(hr);
-	hr = outputNode->SetObject(streamSink); HR_FAIL(hr);
+	if (outputActivate)
+	{
+		hr = outputNode->SetObject(outputActivate); HR_FAIL(hr);
+	}
+	else
+	{
+		hr = outputNode->SetObject(streamSink); HR_FAIL(hr);
+	}
 	hr = outputNode->SetUINT32(MF_TOPONODE_STREAMID, 0); HR_FAIL(hr);
 	hr = outputNode->SetUINT32(MF_TOPONODE_NOSHUTDOWN_ON_REMOVE, FALSE); HR_FAIL(hr);
 	#pragma endregion
 	hr = topology->AddNode(outputNode); HR_FAIL(hr);
 
-	hr = sourceNode->ConnectOutput(0, outputNode, 0); HR_FAIL(hr);
+	hr = upstream->ConnectOutput(0, outputNode, 0); HR_FAIL(hr);
 
 	return hr;
 }
 
-HRESULT AudioPlay::Audio::CreateMediaSource(_In_ LPCWCH path)
+HRESULT AudioPlay::Audio::CreateOfflineSink(_In_ ComPtr<IMFStreamDescriptor>& streamDescriptor, _Out_ ComPtr<IMFActivate>& activate)
 {
-	ComPtr<IMFSourceResolver> sourceResolver;
+	ComPtr<IMFMediaTypeHandler> typeHandler;
+	ComPtr<IMFMediaType> sourceType;
+	ComPtr<IMFMediaType> mediaType;
+	ComPtr<IMFSampleGrabberSinkCallback> grabber;
 
 	HRESULT hr = S_OK;
 
-	hr = MFCreateSourceResolver(&sourceResolver); HR_FAIL(hr);
+	PcmFormat format = { 0, 0 };
 
-	MF_OBJECT_TYPE objectType = MF_OBJECT_INVALID;
-	hr = sourceResolver->CreateObjectFromURL(path, MF_RESOLUTION_MEDIASOURCE | MF_RESOLUTION_CONTENT_DOES_NOT_HAVE_TO_MATCH_EXTENSION_OR_MIME_TYPE,
-		NULL, &objectType, reinterpret_cast<IUnknown**>(&mediaSource)); HR_FAIL(hr);
+	hr = streamDescriptor->GetMediaTypeHandler(&typeHandler); HR_FAIL(hr);
+	hr = typeHandler->GetMediaTypeByIndex(0, &sourceType); HR_FAIL(hr);
+
+	hr = sourceType->GetUINT32(MF_MT_AUDIO_SAMPLES_PER_SECOND, &format.sampleRate); HR_FAIL(hr);
+	hr = sourceType->GetUINT32(MF_MT_AUDIO_NUM_CHANNELS, &format.channels); HR_FAIL(hr);
+
+	// The topology loader adds the decoder and converter that turn the stream into float samples
+	hr = MFCreateMediaType(&mediaType); HR_FAIL(hr);
+	hr = mediaType->SetGUID(MF_MT_MAJOR_TYPE, MFMediaType_Audio); HR_FAIL(hr);
+	hr = mediaType->SetGUID(MF_MT_SUBTYPE, MFAudioFormat_Float); HR_FAIL(hr);
+	hr = mediaType->SetUINT32(MF_MT_AUDIO_NUM_CHANNELS, format.channels); HR_FAIL(hr);
+	hr = mediaType->SetUINT32(MF_MT_AUDIO_SAMPLES_PER_SECOND, format.sampleRate); HR_FAIL(hr);
+	hr = mediaType->SetUINT32(MF_MT_AUDIO_BITS_PER_SAMPLE, 32); HR_FAIL(hr);
+	hr = mediaType->SetUINT32(MF_MT_AUDIO_BLOCK_ALIGNMENT, format.channels * sizeof(float)); HR_FAIL(hr);
+	hr = mediaType->SetUINT32(MF_MT_AUDIO_AVG_BYTES_PER_SECOND, format.sampleRate * format.channels * sizeof(float)); HR_FAIL(hr);
+	hr = mediaType->SetUINT32(MF_MT_ALL_SAMPLES_INDEPENDENT, TRUE); HR_FAIL(hr);
+
+	hr = PcmSinkGrabber::Create(offlineSink, format, &grabber); HR_FAIL(hr);
+
+	hr = MFCreateSampleGrabberSinkActivate(mediaType, grabber, &activate); HR_FAIL(hr);
+
+	// Without a clock the session delivers samples as fast as they are decoded
+	hr = activate->SetUINT32(MF_SAMPLEGRABBERSINK_IGNORE_CLOCK, TRUE); HR_FAIL(hr);
 
 	return hr;
 }
 
+HRESULT AudioPlay::Audio::SetOfflineSink(_In_opt_ PcmSink* sink)
+{
+	if (GetState() != AudioStates::Closed)
+	{
+		return MF_E_INVALIDREQUEST;
+	}
+
+	offlineSink = sink;
+
+	return S_OK;
+}
+
+HRESULT AudioPlay::Audio::CreateMediaSource(_In_opt_ IMFSourceResolver* resolver, _In_opt_ IMFByteStream* byteStream, _In_opt_z_ LPCWCH path,
+	_COM_Outptr_ IMFMediaSource** pPtrSource)
+{
+	ComPtr<IMFSourceResolver> sourceResolver = resolver;
+	ComPtr<IUnknown> object;
+
+	HRESULT hr = S_OK;
+
+	*pPtrSource = nullptr;
+
+	if (!sourceResolver)
+	{
+		hr = MFCreateSourceResolver(&sourceResolver); HR_FAIL(hr);
+	}
+
+	MF_OBJECT_TYPE objectType = MF_OBJECT_INVALID;
+	if (byteStream)
+	{
+		hr = sourceResolver->CreateObjectFromByteStream(byteStream, path, MF_RESOLUTION_MEDIASOURCE | MF_RESOLUTION_CONTENT_DOES_NOT_HAVE_TO_MATCH_EXTENSION_OR_MIME_TYPE,
+			NULL, &objectType, &object); HR_FAIL(hr);
+	}
+	else
+	{
+		hr = sourceResolver->CreateObjectFromURL(path, MF_RESOLUTION_MEDIASOURCE | MF_RESOLUTION_CONTENT_DOES_NOT_HAVE_TO_MATCH_EXTENSION_OR_MIME_TYPE,
+			NULL, &objectType, &object); HR_FAIL(hr);
+	}
+
+	return object->QueryInterface(pPtrSource);
+}
+
+void AudioPlay::Audio::RecordOpenLatency()
+{
+	// Still waiting for the other event, or the open failed
+	if (!openTiming || CheckState(AudioStates::Opening | AudioStates::Close))
+	{
+		return;
+	}
+
+	openTiming = false;
+
+	TopologyCache::Get().RecordOpen(duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - openStarted), openTopologyCached);
+}
+
 bool AudioPlay::Audio::CheckState(_In_ AudioStates p_state) const
 {
 	return (bool)(GetState() & p_state);
 }
 
-HRESULT AudioPlay::Audio::OpenFile(_In_ LPCWCH path)
+HRESULT AudioPlay::Audio::BeginOpen()
+{
+	HRESULT hr = S_OK;
+
+	if (GetState() != AudioStates::Closed)
+	{
+		hr = CloseFile(); HR_FAIL_ACTION(hr, stateMachine.SetState(AudioStates::Closed));
+	}
+
+	{
+		AutoCriticalSection section(&criticalSection);
+
+		mediaSession = nullptr;
+		mediaSource = nullptr;
+		simpleAudioVolume = nullptr;
+		presentationClock = nullptr;
+		propertyStore = nullptr;
+	}
+
+	openStarted = std::chrono::steady_clock::now();
+	openTiming = true;
+
+	hr = MFCreateMediaSession(nullptr, &mediaSession); HR_FAIL_ACTION(hr, stateMachine.SetState(AudioStates::Closed));
+
+	// The session is passed as the state so events of a session closed with deferred close can be told apart
+	hr = mediaSession->BeginGetEvent(static_cast<IMFAsyncCallback*>(this), mediaSession); HR_FAIL_ACTION(hr, stateMachine.SetState(AudioStates::Closed));
+
+	return hr;
+}
+
+HRESULT AudioPlay::Audio::EndOpen(_In_opt_z_ LPCWCH path)
 {
 	ComPtr<IMFTopology> topology;
 	ComPtr<IMFPresentationDescriptor> presentationDescriptor;
 
 	HRESULT hr = S_OK;
 
-	if (state != AudioStates::Closed)
+	hr = MFCreateTopology(&topology); HR_FAIL_ACTION(hr, stateMachine.SetState(AudioStates::Closed));
+
+	hr = mediaSource->CreatePresentationDescriptor(&presentationDescriptor); HR_FAIL_ACTION(hr, stateMachine.SetState(AudioStates::Closed));
+	hr = CreateTopology(topology, presentationDescriptor); HR_FAIL_ACTION(hr, stateMachine.SetState(AudioStates::Closed));
+
+	// Before SetTopology so an early MESessionTopologySet isn't overwritten
+	// Offline sessions have no renderer and no volume to wait for
+	stateMachine.OnOpening(!offlineSink);
+
+	hr = mediaSession->SetTopology(NULL, topology); HR_FAIL_ACTION(hr, stateMachine.SetState(AudioStates::Closed));
+
+	if (path)
 	{
-		hr = CloseFile(); HR_FAIL_ACTION(hr, state = AudioStates::Closed);
+		hr = DuplicateString(path, filepath);
 	}
 
-	mediaSession = nullptr;
-	mediaSource = nullptr;
-	simpleAudioVolume = nullptr;
-	presentationClock = nullptr;
+	return hr;
+}
+
+HRESULT AudioPlay::Audio::PrepareFile(_In_ LPCWCH path, _In_opt_ IMFSourceResolver* resolver, _Out_ PreparedFile& prepared)
+{
+	HRESULT hr = S_OK;
+
+	prepared = { };
+
+	if (fileCaching)
+	{
+		ComPtr<MemoryBlock> cached;
+
+		// Too large to cache or not readable, opened the usual way below
+		if (EncodedFileCache::Get().Open(path, &cached) == S_OK)
+		{
+			return PrepareBlock(cached, path, resolver, prepared);
+		}
+	}
 
-	hr = MFCreateTopology(&topology); HR_FAIL_ACTION(hr, state = AudioStates::Closed);
+	ComPtr<PcmSource> pcmSource;
+	ComPtr<IMFByteStream> byteStream;
+	ComPtr<MappedFile> mappedFile;
 
-	hr = MFCreateMediaSession(nullptr, &mediaSession); HR_FAIL_ACTION(hr, state = AudioStates::Closed);
+	// Mapped once for the built-in decoders and the gapless tag, URLs and unreadable paths go to the resolver
+	if ((nativeDecoding || gaplessTrimming) && FAILED(MappedFile::Open(path, &mappedFile)))
+	{
+		mappedFile = nullptr;
+	}
 
-	hr = mediaSession->BeginGetEvent(static_cast<IMFAsyncCallback*>(this), nullptr); HR_FAIL_ACTION(hr, state = AudioStates::Closed);
+	if (nativeDecoding && mappedFile)
+	{
+		// Anything the built-in decoders can't read goes through Media Foundation
+		CreateNativeSource(mappedFile, &pcmSource);
+	}
 
-	hr = CreateMediaSource(path); HR_FAIL_ACTION(hr, state = AudioStates::Closed);
+	GaplessInfo gapless = { };
+	bool trim = gaplessTrimming && mappedFile && !pcmSource && ReadGaplessInfo(mappedFile, gapless) == S_OK;
 
-	mediaSource->CreatePresentationDescriptor(&presentationDescriptor); HR_FAIL_ACTION(hr, state = AudioStates::Closed);
-	hr = CreateTopology(topology, presentationDescriptor); HR_FAIL_ACTION(hr, state = AudioStates::Closed);
+	if (readAheadChunkSize && !pcmSource)
+	{
+		ComPtr<FileByteReader> file;
 
-	hr = mediaSession->SetTopology(NULL, topology); HR_FAIL_ACTION(hr, state = AudioStates::Closed);
+		// URLs and anything else the reader can't open go to the resolver without reading ahead
+		if (SUCCEEDED(FileByteReader::Open(path, &file)))
+		{
+			hr = ReadAheadStream::Create(file, { readAheadChunkSize, readAheadDepth }, &prepared.readAhead); HR_FAIL(hr);
+			hr = ReadAheadByteStream::Create(prepared.readAhead, &byteStream); HR_FAIL(hr);
+		}
+	}
 
+	if (trim && !byteStream)
+	{
+		// The decoder reads the bytes the tag was read from instead of opening the file again
+		hr = MemoryByteStream::Create(mappedFile, &byteStream); HR_FAIL(hr);
+	}
 
-	size_t length;
+	if ((NeedsPcmSource() || trim) && !pcmSource)
+	{
+		ComPtr<SourceReaderPcmSource> reader;
+		if (byteStream)
+		{
+			hr = SourceReaderPcmSource::Create(byteStream, &reader); HR_FAIL(hr);
+		}
+		else
+		{
+			hr = SourceReaderPcmSource::Create(path, &reader); HR_FAIL(hr);
+		}
+		reader->GetPropertyStore(&prepared.properties);
+		pcmSource = reader;
+	}
 
-	hr = StringCbLengthW(path, STRSAFE_MAX_CCH * sizeof(WCHAR), &length); HR_FAIL(hr);
-	length += sizeof(WCHAR);
+	if (trim)
+	{
+		ComPtr<TrimSource> trimmed;
+		hr = TrimSource::Create(pcmSource, gapless, &trimmed); HR_FAIL(hr);
+		pcmSource = trimmed;
+	}
+
+	return CreatePreparedSource(pcmSource, byteStream, path, resolver, prepared);
+}
+
+HRESULT AudioPlay::Audio::PrepareBlock(_In_ MemoryBlock* block, _In_opt_z_ LPCWCH hint, _In_opt_ IMFSourceResolver* resolver, _Out_ PreparedFile& prepared)
+{
+	HRESULT hr = S_OK;
+
+	prepared = { };
+
+	ComPtr<PcmSource> pcmSource;
+	ComPtr<IMFByteStream> byteStream;
+
+	if (nativeDecoding)
+	{
+		CreateNativeSource(block, &pcmSource);
+	}
+
+	GaplessInfo gapless = { };
+	bool trim = gaplessTrimming && !pcmSource && ReadGaplessInfo(block, gapless) == S_OK;
+
+	if (!pcmSource)
+	{
+		hr = MemoryByteStream::Create(block, &byteStream); HR_FAIL(hr);
+	}
+
+	if ((NeedsPcmSource() || trim) && !pcmSource)
+	{
+		ComPtr<SourceReaderPcmSource> reader;
+		hr = SourceReaderPcmSource::Create(byteStream, &reader); HR_FAIL(hr);
+		reader->GetPropertyStore(&prepared.properties);
+		pcmSource = reader;
+	}
+
+	if (trim)
+	{
+		ComPtr<TrimSource> trimmed;
+		hr = TrimSource::Create(pcmSource, gapless, &trimmed); HR_FAIL(hr);
+		pcmSource = trimmed;
+	}
+
+	return CreatePreparedSource(pcmSource, byteStream, hint, resolver, prepared);
+}
+
+HRESULT AudioPlay::Audio::CreatePreparedSource(_Inout_ ComPtr<PcmSource>& pcmSource, _In_opt_ IMFByteStream* byteStream, _In_opt_z_ LPCWCH path,
+	_In_opt_ IMFSourceResolver* resolver, _Inout_ PreparedFile& prepared)
+{
+	HRESULT hr = S_OK;
+
+	if (pcmSource)
+	{
+		hr = CreatePcmChain(pcmSource, prepared.looping, prepared.stretch); HR_FAIL(hr);
+		hr = PcmMediaSource::Create(pcmSource, &prepared.mediaSource, renderTelemetry, prepared.properties); HR_FAIL(hr);
+	}
+	else
+	{
+		hr = CreateMediaSource(resolver, byteStream, path, &prepared.mediaSource); HR_FAIL(hr);
+	}
+
+	return hr;
+}
+
+HRESULT AudioPlay::Audio::FinishOpen(_In_ PreparedFile& prepared, _In_opt_z_ LPCWCH path)
+{
+	{
+		AutoCriticalSection section(&criticalSection);
+
+		loopingSource = prepared.looping;
+		timeStretchSource = prepared.stretch;
+		readAheadStream = prepared.readAhead;
+		mediaSource = prepared.mediaSource;
+	}
+
+	prepared = { };
+
+	return EndOpen(path);
+}
+
+void AudioPlay::Audio::PreparedFile::Shutdown()
+{
+	if (mediaSource)
+	{
+		mediaSource->Shutdown();
+	}
+
+	*this = { };
+}
+
+HRESULT AudioPlay::Audio::OpenFile(_In_ LPCWCH path)
+{
+	PreparedFile prepared;
+
+	HRESULT hr = S_OK;
+
+	if (path == nullptr)
+	{
+		return E_POINTER;
+	}
+
+	hr = PrepareFile(path, nullptr, prepared); HR_FAIL(hr);
+
+	hr = BeginOpen(); HR_FAIL_ACTION(hr, prepared.Shutdown());
+
+	return FinishOpen(prepared, path);
+}
 
-	filepath = reinterpret_cast<LPWCH>(CoTaskMemAlloc(length));
+HRESULT AudioPlay::Audio::OpenFile(_In_reads_bytes_(size) const BYTE* data, _In_ UINT64 size, _In_opt_z_ LPCWCH hint)
+{
+	ComPtr<MemoryBlock> block;
+
+	HRESULT hr = MemoryBlock::CreateFromSpan(data, size, &block); HR_FAIL(hr);
+
+	return OpenFile(block, hint);
+}
+
+HRESULT AudioPlay::Audio::OpenFile(_In_ MemoryBlock* block, _In_opt_z_ LPCWCH hint)
+{
+	PreparedFile prepared;
+
+	HRESULT hr = S_OK;
+
+	if (block == nullptr)
+	{
+		return E_POINTER;
+	}
+
+	hr = PrepareBlock(block, hint, nullptr, prepared); HR_FAIL(hr);
+
+	hr = BeginOpen(); HR_FAIL_ACTION(hr, prepared.Shutdown());
 
-	if (filepath != nullptr)
+	return FinishOpen(prepared, hint);
+}
+
+HRESULT AudioPlay::Audio::SetReadAhead(_In_ BOOL enable, _In_ const ReadAheadSettings& settings)
+{
+	if (!enable)
+	{
+		readAheadChunkSize = 0;
+		readAheadDepth = 0;
+		return S_OK;
+	}
+
+	if (settings.chunkSize < ReadAheadStream::alignment || (settings.chunkSize & (settings.chunkSize - 1)) != 0 || settings.depth == 0)
 	{
-		hr = StringCbCopyW(filepath, length, path);
+		return E_INVALIDARG;
 	}
 
-	state = AudioStates::Opening;
+	readAheadChunkSize = settings.chunkSize;
+	readAheadDepth = settings.depth;
+
+	return S_OK;
+}
+
+HRESULT AudioPlay::Audio::GetReadAheadStatistics(_Out_ ReadAheadStatistics& statistics)
+{
+	AutoCriticalSection section(&criticalSection);
+
+	if (!readAheadStream)
+	{
+		statistics = { };
+		return E_NOT_VALID_STATE;
+	}
+
+	statistics = readAheadStream->GetStatistics();
+
+	return S_OK;
+}
+
+HRESULT AudioPlay::Audio::SetEventTrace(_In_opt_ EventTraceRecorder* recorder)
+{
+	AutoCriticalSection section(&criticalSection);
+
+	eventTrace = recorder;
+	stateMachine.SetTrace(recorder);
+
+	return S_OK;
+}
+
+HRESULT AudioPlay::Audio::GetEventTrace(_COM_Outptr_result_maybenull_ EventTraceRecorder** pPtrRecorder)
+{
+	if (pPtrRecorder == nullptr)
+	{
+		return E_POINTER;
+	}
+
+	AutoCriticalSection section(&criticalSection);
+
+	*pPtrRecorder = eventTrace;
+
+	if (eventTrace == nullptr)
+	{
+		return S_FALSE;
+	}
+
+	eventTrace->AddRef();
+
+	return S_OK;
+}
+
+HRESULT AudioPlay::Audio::CreatePcmChain(_Inout_ ComPtr<PcmSource>& source, _Out_ ComPtr<LoopingSource>& looping, _Out_ ComPtr<TimeStretchSource>& stretch)
+{
+	HRESULT hr = S_OK;
+
+	looping = nullptr;
+	stretch = nullptr;
+
+	if (loopRegionSet)
+	{
+		hr = LoopingSource::Create(source, loopRegionStart, loopRegionEnd, loopRegionCount, &looping); HR_FAIL(hr);
+		source = looping;
+	}
+
+	if (preservePitch)
+	{
+		hr = TimeStretchSource::Create(source, playbackRate, &stretch); HR_FAIL(hr);
+		source = stretch;
+	}
+
+	if (dspChain)
+	{
+		ComPtr<DspSource> effects;
+		hr = DspSource::Create(source, dspChain, &effects); HR_FAIL(hr);
+		effects->SetTelemetry(renderTelemetry);
+		source = effects;
+	}
 
 	return hr;
 }
+
+HRESULT AudioPlay::Audio::SetLoopRegion(_In_ UINT64 startFrame, _In_ UINT64 endFrame, _In_ UINT32 loopCount)
+{
+	if (endFrame != 0 && startFrame >= endFrame)
+	{
+		return E_INVALIDARG;
+	}
+
+	loopRegionSet = TRUE;
+	loopRegionStart = startFrame;
+	loopRegionEnd = endFrame;
+	loopRegionCount = loopCount;
+
+	if (loopingSource)
+	{
+		loopingSource->SetLoopCount(loopCount);
+	}
+
+	return S_OK;
+}
+
+HRESULT AudioPlay::Audio::ClearLoopRegion()
+{
+	loopRegionSet = FALSE;
+
+	if (loopingSource)
+	{
+		loopingSource->SetLoopCount(0);
+	}
+
+	return S_OK;
+}
+
+HRESULT AudioPlay::Audio::OpenSource(_In_ PcmSource* source)
+{
+	HRESULT hr = S_OK;
+
+	if (source == nullptr)
+	{
+		return E_POINTER;
+	}
+
+	ComPtr<PcmSource> pcmSource = source;
+
+	if (dspChain)
+	{
+		ComPtr<DspSource> effects;
+		hr = DspSource::Create(source, dspChain, &effects); HR_FAIL(hr);
+		effects->SetTelemetry(renderTelemetry);
+		pcmSource = effects;
+	}
+
+	hr = BeginOpen(); HR_FAIL(hr);
+
+	hr = PcmMediaSource::Create(pcmSource, &mediaSource, renderTelemetry); HR_FAIL_ACTION(hr, stateMachine.SetState(AudioStates::Closed));
+
+	return EndOpen(nullptr);
+}
+
+HRESULT AudioPlay::Audio::BeginOpenFile(_In_ LPCWCH path, _In_opt_ OpenCompletedCallback completedCallback, _In_opt_ void* context)
+{
+	if (path == nullptr)
+	{
+		return E_POINTER;
+	}
+
+	HRESULT hr = S_OK;
+
+	hr = BeginOpen(); HR_FAIL(hr);
+
+	AutoCriticalSection section(&criticalSection);
+
+	hr = DuplicateString(path, pendingPath); HR_FAIL_ACTION(hr, AbortOpen());
+
+	hr = MFCreateSourceResolver(&sourceResolver); HR_FAIL_ACTION(hr, AbortOpen());
+
+	openCompletedCallback = completedCallback;
+	openCompletedContext = context;
+
+	stateMachine.OnOpening(!offlineSink);
+
+	// Decoders and the resolver block on the file, they run on the long function queue and the topology is set once they are done
+	// The resolver is passed as the state so results of a cancelled open can be told apart
+	hr = MFPutWorkItem(MFASYNC_CALLBACK_QUEUE_LONG_FUNCTION, &openCallback, sourceResolver); HR_FAIL_ACTION(hr, AbortOpen());
+
+	return hr;
+}
+
+HRESULT AudioPlay::Audio::CancelOpenFile()
+{
+	OpenCompletedCallback completedCallback = nullptr;
+	void* context = nullptr;
+
+	{
+		AutoCriticalSection section(&criticalSection);
+
+		if (!sourceResolver)
+		{
+			return S_FALSE;
+		}
+
+		// A work item that is already running finishes and finds its resolver replaced
+		completedCallback = openCompletedCallback;
+		context = openCompletedContext;
+
+		AbortOpen();
+	}
+
+	if (completedCallback)
+	{
+		completedCallback(this, E_ABORT, context);
+	}
+
+	return S_OK;
+}
+
+void AudioPlay::Audio::AbortOpen()
+{
+	sourceResolver = nullptr;
+	openCompletedCallback = nullptr;
+	openCompletedContext = nullptr;
+
+	CoTaskMemFree(pendingPath);
+	pendingPath = nullptr;
+
+	if (mediaSource)
+	{
+		mediaSource->Shutdown();
+		mediaSource = nullptr;
+	}
+	loopingSource = nullptr;
+	timeStretchSource = nullptr;
+	readAheadStream = nullptr;
+
+	if (mediaSession)
+	{
+		mediaSession->Shutdown();
+		mediaSession = nullptr;
+	}
+
+	stateMachine.SetState(AudioStates::Closed);
+}
+
+HRESULT AudioPlay::Audio::OnOpenWorkItem(_In_ IMFAsyncResult* asyncResult)
+{
+	ComPtr<IUnknown> stateObject;
+	ComPtr<IMFSourceResolver> resolver;
+	PreparedFile prepared;
+	LPWCH path = nullptr;
+
+	OpenCompletedCallback completedCallback = nullptr;
+	void* context = nullptr;
+
+	HRESULT hr = S_OK;
+
+	hr = asyncResult->GetState(&stateObject); HR_FAIL(hr);
+	hr = stateObject->QueryInterface(&resolver); HR_FAIL(hr);
+
+	{
+		AutoCriticalSection section(&criticalSection);
+
+		if (resolver != sourceResolver)
+		{
+			// Cancelled or replaced by another open before it ran, the callback was already called
+			return S_OK;
+		}
+
+		hr = DuplicateString(pendingPath, path);
+	}
+
+	// Without the lock, the player stays Opening and a cancel only has to replace the resolver
+	if (SUCCEEDED(hr))
+	{
+		hr = PrepareFile(path, resolver, prepared);
+	}
+
+	{
+		AutoCriticalSection section(&criticalSection);
+
+		if (resolver != sourceResolver)
+		{
+			prepared.Shutdown();
+			CoTaskMemFree(path);
+
+			return S_OK;
+		}
+
+		completedCallback = openCompletedCallback;
+		context = openCompletedContext;
+
+		if (SUCCEEDED(hr))
+		{
+			hr = FinishOpen(prepared, path);
+		}
+
+		if (FAILED(hr))
+		{
+			prepared.Shutdown();
+			AbortOpen();
+		}
+		else
+		{
+			sourceResolver = nullptr;
+			openCompletedCallback = nullptr;
+			openCompletedContext = nullptr;
+
+			CoTaskMemFree(pendingPath);
+			pendingPath = nullptr;
+		}
+	}
+
+	CoTaskMemFree(path);
+
+	if (completedCallback)
+	{
+		completedCallback(this, hr, context);
+	}
+
+	return S_OK;
+}
+
 HRESULT AudioPlay::Audio::CloseFile()
 {
 	HRESULT hr = S_OK;
 
-	if (state == AudioStates::Closed)
+	CancelOpenFile();
+
+	if (GetState() == AudioStates::Closed)
 	{
 		return hr;
 	}
 
-	currentPosition = 0ms;
+	stateMachine.ResetPosition();
+
+	if (deferredClose)
+	{
+		ComPtr<IMFMediaSession> session;
+		ComPtr<IMFMediaSource> source;
+
+		{
+			AutoCriticalSection section(&criticalSection);
+
+			session = mediaSession;
+			source = mediaSource;
 
-	state = AudioStates::Closing;
+			mediaSession = nullptr;
+			mediaSource = nullptr;
+			loopingSource = nullptr;
+			timeStretchSource = nullptr;
+			readAheadStream = nullptr;
+			presentationClock = nullptr;
+			simpleAudioVolume = nullptr;
+			propertyStore = nullptr;
 
-	hr = mediaSession->Close();
+			stateMachine.SetState(AudioStates::Closed);
+		}
+
+		CoTaskMemFree(filepath);
+		filepath = nullptr;
+
+		return TeardownPool::Get().Defer(session, source);
+	}
+
+	hr = stateMachine.Close();
 
 	WaitForSingleObject(closeEvent, static_cast<DWORD>(duration_cast<milliseconds>(10s).count()));
 
@@ -267,8 +1021,12 @@ HRESULT AudioPlay::Audio::CloseFile()
 
 	mediaSession = nullptr;
 	mediaSource = nullptr;
+	loopingSource = nullptr;
+	timeStretchSource = nullptr;
+	readAheadStream = nullptr;
 	presentationClock = nullptr;
 	simpleAudioVolume = nullptr;
+	propertyStore = nullptr;
 
 	if (filepath)
 	{
@@ -276,11 +1034,16 @@ HRESULT AudioPlay::Audio::CloseFile()
 	}
 	filepath = nullptr;
 
-	state = AudioStates::Closed;
+	stateMachine.SetState(AudioStates::Closed);
 
 	return hr;
 }
 
+LONG AudioPlay::Audio::GetPendingTeardownCount()
+{
+	return TeardownPool::Get().GetPendingCount();
+}
+
 HRESULT AudioPlay::Audio::GetFilePath(_Outref_result_maybenull_ LPWCH& path)
 {
 	if (filepath == nullptr)
@@ -340,120 +1103,110 @@ HRESULT AudioPlay::Audio::WaitForState(_In_ AudioPlay::AudioStates waitState, _I
 	return AUDIO_TIMEOUT;
 }
 
-HRESULT AudioPlay::Audio::Start()
-{
-	CHECK_CLOSED;
-	HRESULT hr = S_OK;
-
-	PROPVARIANT var;
-	PropVariantInit(&var);
-
-	if (!CheckState(AudioStates::Start))
-	{
-		hr = Start(currentPosition);
-	}
-	else
-	{
-		var.vt = VT_EMPTY;
+HRESULT AudioPlay::Audio::Start()
+{
+	return stateMachine.Start();
+}
+HRESULT AudioPlay::Audio::Start(_In_ const milliseconds position)
+{
+	return stateMachine.Start(position);
+}
 
-		state = AudioStates::Starting;
+HRESULT AudioPlay::Audio::Pause()
+{
+	return stateMachine.Pause();
+}
 
-		hr = mediaSession->Start(&GUID_NULL, &var);
-	}
+HRESULT AudioPlay::Audio::Stop()
+{
+	return stateMachine.Stop();
+}
 
-	PropVariantClear(&var);
+HRESULT AudioPlay::Audio::Seek(_In_ const milliseconds position)
+{
+	return stateMachine.Seek(position);
+}
 
-	return hr;
+HRESULT AudioPlay::Audio::GetPosition(_Out_ milliseconds& position)
+{
+	return stateMachine.GetPosition(position);
 }
-HRESULT AudioPlay::Audio::Start(_In_ const milliseconds position)
+
+HRESULT AudioPlay::Audio::SessionCommands::Start(_In_opt_ const milliseconds* position)
 {
-	CHECK_CLOSED;
 	HRESULT hr = S_OK;
 
 	PROPVARIANT var;
 	PropVariantInit(&var);
 
-	var.vt = VT_I8;
-	var.hVal.QuadPart = duration_cast<nanoseconds>(position).count() / 100;
-
-	state = AudioStates::Starting;
+	// VT_EMPTY resumes from the current position
+	if (position)
+	{
+		var.vt = VT_I8;
+		var.hVal.QuadPart = duration_cast<nanoseconds>(*position).count() / 100;
+	}
 
-	hr = mediaSession->Start(&GUID_NULL, &var); HR_FAIL_ACTION(hr, state = AudioStates::Closed);
+	hr = audio->mediaSession->Start(&GUID_NULL, &var);
 
 	PropVariantClear(&var);
 
 	return hr;
 }
 
-HRESULT AudioPlay::Audio::Pause()
+HRESULT AudioPlay::Audio::SessionCommands::Pause()
 {
-	CHECK_CLOSED;
-	HRESULT hr = S_OK;
-
-	state = AudioStates::Pausing;
-
-	GetPosition(currentPosition);
-
-	hr = mediaSession->Pause(); HR_FAIL_ACTION(hr, state = AudioStates::Closed);
-
-	return hr;
-
+	return audio->mediaSession->Pause();
 }
 
-HRESULT AudioPlay::Audio::Stop()
+HRESULT AudioPlay::Audio::SessionCommands::Stop()
 {
-	CHECK_CLOSED;
-	HRESULT hr = S_OK;
-
-	state = AudioStates::Stopping;
-
-	hr = mediaSession->Stop(); HR_FAIL_ACTION(hr, state = AudioStates::Closed);
-
-	currentPosition = 0ms;
+	return audio->mediaSession->Stop();
+}
 
-	return hr;
+HRESULT AudioPlay::Audio::SessionCommands::Close()
+{
+	return audio->mediaSession->Close();
 }
 
-HRESULT AudioPlay::Audio::Seek(_In_ const milliseconds position)
+HRESULT AudioPlay::Audio::SessionCommands::GetTime(_Out_ milliseconds& time)
 {
-	CHECK_CLOSED;
-	HRESULT hr = S_OK;
+	ComPtr<IMFPresentationTimeSource> presentationTimeSource;
+	ComPtr<IMFPresentationClock> presentationClock;
+	ComPtr<TimeStretchSource> timeStretchSource;
 
-	currentPosition = position;
+	HRESULT hr = S_OK;
 
-	if (!CheckState(AudioStates::Close | AudioStates::Stop | AudioStates::Pause))
 	{
-		hr = Start(currentPosition);
+		// Called from the PositionNotifier thread while CloseFile and the session events replace both
+		AutoCriticalSection section(&audio->criticalSection);
+
+		presentationClock = audio->presentationClock;
+		timeStretchSource = audio->timeStretchSource;
 	}
 
-	return hr;
-}
+	if (!presentationClock)
+	{
+		return MF_E_NO_CLOCK;
+	}
 
-HRESULT AudioPlay::Audio::GetPosition(_Out_ milliseconds& position)
-{
-	CHECK_CLOSED;
-	HRESULT hr = S_OK;
+	hr = presentationClock->GetTimeSource(&presentationTimeSource); HR_FAIL(hr);
 
 	MFTIME mfTime = -1;
+	hr = presentationClock->GetTime(&mfTime); HR_FAIL(hr);
 
-	if (state == AudioStates::Opening || state == AudioStates::Closed || state == AudioStates::Closing)
+	if (timeStretchSource)
 	{
-		position = milliseconds{ -1 };
-		return E_FAIL;
-	}
+		// The session runs on the stretched frames, the source knows where in the file they came from
+		UINT32 sampleRate = timeStretchSource->GetFormat().sampleRate;
+		UINT64 outputFrame = FramesFromMediaTime(static_cast<UINT64>(mfTime < 0 ? 0 : mfTime), sampleRate);
+		UINT64 inputFrame = timeStretchSource->GetInputPosition(outputFrame);
 
-	ComPtr<IMFPresentationTimeSource> presentationTimeSource;
-	presentationClock->GetTimeSource(&presentationTimeSource);
-	if ((!presentationTimeSource || CheckState(AudioStates::Pause)) && (&position != &currentPosition))
-	{
-		position = currentPosition;
-		return S_OK;
-	}
+		time = milliseconds{ static_cast<INT64>(inputFrame * 1000 / sampleRate) };
 
-	hr = presentationClock->GetTime(&mfTime); HR_FAIL_ACTION(hr, position = milliseconds{ -1 });
-	nanoseconds nanosec{ mfTime * 100 };
+		return hr;
+	}
 
-	position = duration_cast<milliseconds>(nanosec);
+	time = duration_cast<milliseconds>(nanoseconds{ mfTime * 100 });
 
 	return hr;
 }
@@ -465,7 +1218,7 @@ HRESULT AudioPlay::Audio::GetDuration(_Out_ milliseconds& duration)
 
 	HRESULT hr = S_OK;
 
-	if (state == AudioStates::Opening || state == AudioStates::Closed || state == AudioStates::Closing)
+	if (CheckState(AudioStates::Opening | AudioStates::Close))
 	{
 		duration = milliseconds{ -1 };
 		return E_FAIL;
@@ -487,12 +1240,18 @@ HRESULT AudioPlay::Audio::GetVolume(_Out_ float& volume) const
 	CHECK_CLOSED;
 	HRESULT hr = S_OK;
 
-	if (state == AudioStates::Opening || state == AudioStates::Closed || state == AudioStates::Closing)
+	if (CheckState(AudioStates::Opening | AudioStates::Close))
 	{
 		volume = -1.0f;
 		return E_FAIL;
 	}
 
+	if (!simpleAudioVolume)
+	{
+		volume = -1.0f;
+		return MF_E_UNSUPPORTED_SERVICE;
+	}
+
 	hr = simpleAudioVolume->GetMasterVolume(&volume); HR_FAIL_ACTION(hr, volume = -1.0f);
 
 	return hr;
@@ -502,10 +1261,16 @@ HRESULT AudioPlay::Audio::SetVolume(_In_ const float volume)
 	CHECK_CLOSED;
 	HRESULT hr = S_OK;
 
-	if (state == AudioStates::Opening || state == AudioStates::Closed || state == AudioStates::Closing)
+	if (CheckState(AudioStates::Opening | AudioStates::Close))
 	{
 		return E_FAIL;
 	}
+
+	if (!simpleAudioVolume)
+	{
+		return MF_E_UNSUPPORTED_SERVICE;
+	}
+
 	hr = simpleAudioVolume->SetMasterVolume(volume);
 
 	return hr;
@@ -516,12 +1281,18 @@ HRESULT AudioPlay::Audio::GetMute(_Out_ BOOL& mute) const
 	CHECK_CLOSED;
 	HRESULT hr = S_OK;
 
-	if (state == AudioStates::Opening || state == AudioStates::Closed || state == AudioStates::Closing)
+	if (CheckState(AudioStates::Opening | AudioStates::Close))
 	{
 		mute = FALSE;
 		return E_FAIL;
 	}
 
+	if (!simpleAudioVolume)
+	{
+		mute = FALSE;
+		return MF_E_UNSUPPORTED_SERVICE;
+	}
+
 	hr = simpleAudioVolume->GetMute(&mute);
 
 	return hr;
@@ -531,16 +1302,112 @@ HRESULT AudioPlay::Audio::SetMute(_In_ const BOOL mute)
 	CHECK_CLOSED;
 	HRESULT hr = S_OK;
 
-	if (state == AudioStates::Opening || state == AudioStates::Closed || state == AudioStates::Closing)
+	if (CheckState(AudioStates::Opening | AudioStates::Close))
 	{
 		return E_FAIL;
 	}
 
+	if (!simpleAudioVolume)
+	{
+		return MF_E_UNSUPPORTED_SERVICE;
+	}
+
 	hr = simpleAudioVolume->SetMute(mute);
 
 	return hr;
 }
 
+HRESULT AudioPlay::Audio::SetRate(_In_ const float rate)
+{
+	if (!(rate >= TimeStretchSource::minimumRate && rate <= TimeStretchSource::maximumRate))
+	{
+		return E_INVALIDARG;
+	}
+
+	playbackRate = rate;
+
+	if (timeStretchSource)
+	{
+		return timeStretchSource->SetRate(rate);
+	}
+
+	// Applied when the topology is set
+	if (CheckState(AudioStates::Opening | AudioStates::Close))
+	{
+		return S_OK;
+	}
+
+	return ApplySessionRate();
+}
+
+HRESULT AudioPlay::Audio::GetDspChain(_Out_ ComPtr<DspChain>& chain)
+{
+	HRESULT hr = S_OK;
+
+	if (!dspChain)
+	{
+		hr = DspChain::Create(&dspChain); HR_FAIL(hr);
+	}
+
+	chain = dspChain;
+
+	return hr;
+}
+
+HRESULT AudioPlay::Audio::GetRenderTelemetry(_Out_ ComPtr<RenderTelemetry>& telemetry)
+{
+	HRESULT hr = S_OK;
+
+	if (!renderTelemetry)
+	{
+		hr = RenderTelemetry::Create(RenderTelemetry::defaultCapacity, &renderTelemetry); HR_FAIL(hr);
+	}
+
+	telemetry = renderTelemetry;
+
+	return hr;
+}
+
+HRESULT AudioPlay::Audio::AttachSpectrumTap(_In_ SpectrumTap* tap)
+{
+	if (tap == nullptr)
+	{
+		return E_POINTER;
+	}
+
+	ComPtr<DspChain> chain;
+
+	HRESULT hr = GetDspChain(chain); HR_FAIL(hr);
+
+	// Moves it to the end if it was attached already
+	chain->Remove(tap);
+
+	return chain->Insert(tap, ~0u);
+}
+
+HRESULT AudioPlay::Audio::DetachSpectrumTap(_In_ SpectrumTap* tap)
+{
+	if (!dspChain)
+	{
+		return S_FALSE;
+	}
+
+	return dspChain->Remove(tap);
+}
+
+HRESULT AudioPlay::Audio::ApplySessionRate()
+{
+	ComPtr<IMFRateControl> rateControl;
+
+	HRESULT hr = S_OK;
+
+	hr = MFGetService(mediaSession, MF_RATE_CONTROL_SERVICE, IID_PPV_ARGS(&rateControl)); HR_FAIL(hr);
+
+	hr = rateControl->SetRate(FALSE, playbackRate);
+
+	return hr;
+}
+
 #pragma region IMPLEMET_IUnknown
 
 STDMETHODIMP_(ULONG) AudioPlay::Audio::AddRef()
@@ -581,25 +1448,70 @@ STDMETHODIMP AudioPlay::Audio::QueryInterface(REFIID riid, _COM_Outptr_ void** p
 	return S_OK;
 }
 
+STDMETHODIMP AudioPlay::Audio::OpenCallback::QueryInterface(REFIID riid, _COM_Outptr_ void** pPtr)
+{
+	if (riid == IID_IUnknown)
+	{
+		*pPtr = static_cast<IUnknown*>(this);
+	}
+	else if (riid == IID_IMFAsyncCallback)
+	{
+		*pPtr = static_cast<IMFAsyncCallback*>(this);
+	}
+	else
+	{
+		*pPtr = NULL;
+		return E_NOINTERFACE;
+	}
+
+	AddRef();
+	return S_OK;
+}
+
 #pragma endregion
 
 STDMETHODIMP AudioPlay::Audio::Invoke(IMFAsyncResult* asyncResult)
 {
+	// Before the lock so a handler waiting on a command shows in the trace
+	std::chrono::steady_clock::time_point started = std::chrono::steady_clock::now();
+
 	AutoCriticalSection section(&criticalSection);
 
+	ComPtr<IUnknown> stateObject;
+	ComPtr<IMFMediaSession> eventSession;
 	ComPtr<IMFMediaEvent> mediaEvent;
-	MediaEventType mediaEventType;
+	MediaEventType mediaEventType = MEUnknown;
 
 	HRESULT hr = S_OK;
 
+	hr = asyncResult->GetState(&stateObject); HR_FAIL(hr);
+	hr = stateObject->QueryInterface(&eventSession); HR_FAIL(hr);
 
-	hr = mediaSession->EndGetEvent(asyncResult, &mediaEvent); HR_FAIL(hr);
+	hr = eventSession->EndGetEvent(asyncResult, &mediaEvent); HR_FAIL(hr);
 
 	hr = mediaEvent->GetType(&mediaEventType);
+
+	if (eventSession != mediaSession)
+	{
+		// Closed with deferred close, the player has already moved on
+		if (mediaEventType == MESessionClosed)
+		{
+			TeardownPool::Get().OnSessionClosed(eventSession);
+			return S_OK;
+		}
+
+		return eventSession->BeginGetEvent(static_cast<IMFAsyncCallback*>(this), eventSession);
+	}
+
 	if (SUCCEEDED(hr))
 	{
 		switch (mediaEventType)
 		{
+			case MESessionTopologyStatus:
+			{
+				OnMESessionTopologyStatus(mediaEvent);
+				break;
+			}
 			case MESessionTopologySet:
 			{
 				OnMESessionTopologySet(mediaEvent);
@@ -641,6 +1553,12 @@ STDMETHODIMP AudioPlay::Audio::Invoke(IMFAsyncResult* asyncResult)
 				hr = OnMENewPresentation(mediaEvent);
 				break;
 			}
+			default:
+			{
+				// Nothing to do, only recorded
+				hr = stateMachine.HandleEvent(mediaEventType, GetEventStatus(mediaEvent));
+				break;
+			}
 		}
 	}
 
@@ -649,9 +1567,14 @@ STDMETHODIMP AudioPlay::Audio::Invoke(IMFAsyncResult* asyncResult)
 		callback(mediaEvent);
 	}
 
+	if (eventTrace)
+	{
+		eventTrace->RecordHandler(mediaEventType, hr, started, static_cast<UINT32>(stateMachine.GetState()));
+	}
+
 	if (mediaEventType != MESessionClosed)
 	{
-		hr = mediaSession->BeginGetEvent(static_cast<IMFAsyncCallback*>(this), nullptr); HR_FAIL(hr);
+		hr = mediaSession->BeginGetEvent(static_cast<IMFAsyncCallback*>(this), mediaSession); HR_FAIL(hr);
 	}
 
 	return hr;
@@ -659,98 +1582,117 @@ STDMETHODIMP AudioPlay::Audio::Invoke(IMFAsyncResult* asyncResult)
 
 #pragma region EVENT_HANDLERS
 
-HRESULT AudioPlay::Audio::OnMESessionTopologySet(_In_ ComPtr<IMFMediaEvent>& mediaEvent)
+HRESULT AudioPlay::Audio::OnMESessionTopologyStatus(_In_ ComPtr<IMFMediaEvent>& mediaEvent)
 {
-	UNREFERENCED_PARAMETER(mediaEvent);
+	HRESULT hr = stateMachine.HandleEvent(MESessionTopologyStatus, GetEventStatus(mediaEvent));
 
-	HRESULT hr = S_OK;
-
-	presentationClock = nullptr;
-	hr = mediaSession->GetClock(reinterpret_cast<IMFClock**>(&presentationClock)); HR_FAIL(hr);
+	// Topologies built from the cache are already known
+	if (!openTopologyKeyValid || openTopologyCached)
+	{
+		return hr;
+	}
 
-	if (simpleAudioVolume)
+	if (MFGetAttributeUINT32(mediaEvent, MF_EVENT_TOPOLOGY_STATUS, MF_TOPOSTATUS_INVALID) != MF_TOPOSTATUS_READY)
 	{
-		state = AudioStates::Ready;
+		return hr;
 	}
 
-	return hr;
-}
+	ComPtr<IMFTopology> fullTopology;
 
-HRESULT AudioPlay::Audio::OnMESessionCapabilitiesChanged(_In_ ComPtr<IMFMediaEvent>& mediaEvent)
-{
-	UNREFERENCED_PARAMETER(mediaEvent);
+	PROPVARIANT var;
+	PropVariantInit(&var);
 
-	HRESULT hr = S_OK;
+	hr = mediaEvent->GetValue(&var); HR_FAIL(hr);
 
-	simpleAudioVolume = nullptr;
-	hr = MFGetService(mediaSession, MR_POLICY_VOLUME_SERVICE, IID_PPV_ARGS(&simpleAudioVolume)); HR_FAIL(hr);
+	if (var.vt == VT_UNKNOWN && var.punkVal)
+	{
+		hr = var.punkVal->QueryInterface(&fullTopology);
+	}
+
+	PropVariantClear(&var);
 
-	if (presentationClock)
+	if (fullTopology)
 	{
-		state = AudioStates::Ready;
+		hr = TopologyCache::Get().Learn(openTopologyKey, fullTopology);
 	}
 
+	openTopologyKeyValid = false;
+
 	return hr;
 }
 
-HRESULT AudioPlay::Audio::OnMESessionStarted(_In_ ComPtr<IMFMediaEvent>& mediaEvent)
+HRESULT AudioPlay::Audio::OnMESessionTopologySet(_In_ ComPtr<IMFMediaEvent>& mediaEvent)
 {
-	UNREFERENCED_PARAMETER(mediaEvent);
-
 	HRESULT hr = S_OK;
 
-	state = AudioStates::Started;
+	HRESULT status = GetEventStatus(mediaEvent);
 
-	return hr;
-}
+	// The transforms from the cache didn't work this time, the next open lets the loader choose
+	if (FAILED(status) && openTopologyCached)
+	{
+		TopologyCache::Get().Remove(openTopologyKey);
+		openTopologyCached = false;
+	}
 
-HRESULT AudioPlay::Audio::OnMESessionPaused(_In_ ComPtr<IMFMediaEvent>& mediaEvent)
-{
-	UNREFERENCED_PARAMETER(mediaEvent);
+	presentationClock = nullptr;
+	hr = mediaSession->GetClock(reinterpret_cast<IMFClock**>(&presentationClock)); HR_FAIL(hr);
 
-	HRESULT hr = S_OK;
+	if (!timeStretchSource && playbackRate != 1.0f)
+	{
+		// Plays at normal speed if the session can't do the rate
+		ApplySessionRate();
+	}
 
-	state = AudioStates::Paused;
+	hr = stateMachine.HandleEvent(MESessionTopologySet, status);
+
+	RecordOpenLatency();
 
 	return hr;
 }
 
-HRESULT AudioPlay::Audio::OnMESessionStopped(_In_ ComPtr<IMFMediaEvent>& mediaEvent)
+HRESULT AudioPlay::Audio::OnMESessionCapabilitiesChanged(_In_ ComPtr<IMFMediaEvent>& mediaEvent)
 {
-	UNREFERENCED_PARAMETER(mediaEvent);
-
 	HRESULT hr = S_OK;
 
-	state = AudioStates::Stopped;
+	if (offlineSink)
+	{
+		return hr;
+	}
+
+	simpleAudioVolume = nullptr;
+	hr = MFGetService(mediaSession, MR_POLICY_VOLUME_SERVICE, IID_PPV_ARGS(&simpleAudioVolume)); HR_FAIL(hr);
+
+	hr = stateMachine.HandleEvent(MESessionCapabilitiesChanged, GetEventStatus(mediaEvent));
+
+	RecordOpenLatency();
 
 	return hr;
 }
 
-HRESULT AudioPlay::Audio::OnMESessionEnded(_In_ ComPtr<IMFMediaEvent>& mediaEvent)
+HRESULT AudioPlay::Audio::OnMESessionStarted(_In_ ComPtr<IMFMediaEvent>& mediaEvent)
 {
-	UNREFERENCED_PARAMETER(mediaEvent);
+	return stateMachine.HandleEvent(MESessionStarted, GetEventStatus(mediaEvent));
+}
 
-	HRESULT hr = S_OK;
+HRESULT AudioPlay::Audio::OnMESessionPaused(_In_ ComPtr<IMFMediaEvent>& mediaEvent)
+{
+	return stateMachine.HandleEvent(MESessionPaused, GetEventStatus(mediaEvent));
+}
 
-	if (looping)
-	{
-		Start(0ms);
-	}
-	else
-	{
-		state = AudioStates::Stopped;
-	}
+HRESULT AudioPlay::Audio::OnMESessionStopped(_In_ ComPtr<IMFMediaEvent>& mediaEvent)
+{
+	return stateMachine.HandleEvent(MESessionStopped, GetEventStatus(mediaEvent));
+}
 
-	return hr;
+HRESULT AudioPlay::Audio::OnMESessionEnded(_In_ ComPtr<IMFMediaEvent>& mediaEvent)
+{
+	// Starts over if looping
+	return stateMachine.HandleEvent(MESessionEnded, GetEventStatus(mediaEvent));
 }
 
 HRESULT AudioPlay::Audio::OnMESessionClosed(_In_ ComPtr<IMFMediaEvent>& mediaEvent)
 {
-	UNREFERENCED_PARAMETER(mediaEvent);
-
-	HRESULT hr = S_OK;
-
-	state = AudioStates::Closed;
+	HRESULT hr = stateMachine.HandleEvent(MESessionClosed, GetEventStatus(mediaEvent));
 
 	SetEvent(closeEvent);
 
@@ -768,19 +1710,17 @@ HRESULT AudioPlay::Audio::OnMENewPresentation(_In_ ComPtr<IMFMediaEvent>& mediaE
 	PropVariantInit(&var);
 	var.vt = VT_UNKNOWN;
 
-	hr = MFCreateTopology(&topology); HR_FAIL_ACTION(hr, state = AudioStates::Closed);
-
-	hr = mediaEvent->GetValue(&var); HR_FAIL_ACTION(hr, state = AudioStates::Closed);
+	hr = MFCreateTopology(&topology); HR_FAIL_ACTION(hr, stateMachine.SetState(AudioStates::Closed));
 
-	hr = var.punkVal->QueryInterface(&presentationDescriptor); HR_FAIL_ACTION(hr, state = AudioStates::Closed);
+	hr = mediaEvent->GetValue(&var); HR_FAIL_ACTION(hr, stateMachine.SetState(AudioStates::Closed));
 
-	CreateTopology(topology, presentationDescriptor); HR_FAIL_ACTION(hr, state = AudioStates::Closed);
+	hr = var.punkVal->QueryInterface(&presentationDescriptor); HR_FAIL_ACTION(hr, stateMachine.SetState(AudioStates::Closed));
 
-	hr = mediaSession->SetTopology(NULL, topology); HR_FAIL_ACTION(hr, state = AudioStates::Closed);
+	CreateTopology(topology, presentationDescriptor); HR_FAIL_ACTION(hr, stateMachine.SetState(AudioStates::Closed));
 
-	state = AudioStates::Opening;
+	hr = mediaSession->SetTopology(NULL, topology); HR_FAIL_ACTION(hr, stateMachine.SetState(AudioStates::Closed));
 
-	return hr;
+	return stateMachine.HandleEvent(MENewPresentation, S_OK);
 }
 
-#pragma endregion
\ No newline at end of file
+#pragma endregion
@@ -1,4 +1,5 @@
 #include "AudioMetadata.h"
+#include "ThumbnailCache.h"
 
 #include <Propkey.h>
 #include <strsafe.h>
@@ -43,6 +44,11 @@ AudioPlay::AudioMetadata::AudioMetadata(IMFMediaSource* mediaSource)
 	}
 }
 
+AudioPlay::AudioMetadata::AudioMetadata(IPropertyStore* store) :
+	propertyStore(store)
+{
+}
+
 AudioPlay::AudioMetadata::~AudioMetadata()
 {
 	propertyStore = nullptr;
@@ -170,6 +176,74 @@ HRESULT AudioPlay::AudioMetadata::GetProperityCount(_Out_ DWORD& count) const
 	return hr;
 }
 
+HRESULT AudioPlay::AudioMetadata::GetThumbnailData(_Outptr_result_bytebuffer_maybenull_(size) BYTE*& data, _Out_ UINT32& size) const
+{
+	data = nullptr;
+	size = 0;
+	CHECK_PROPERITYSTORE;
+
+	ComPtr<IStream> thumbnailStream = nullptr;
+
+	HRESULT hr = S_OK;
+
+	PROPVARIANT thumbnail;
+	PropVariantInit(&thumbnail);
+
+	hr = propertyStore->GetValue(PKEY_ThumbnailStream, &thumbnail); HR_FAIL(hr);
+
+	if (thumbnail.vt == VT_EMPTY)
+	{
+		return S_FALSE;
+	}
+
+	hr = thumbnail.pStream->Clone(&thumbnailStream);
+
+	PropVariantClear(&thumbnail);
+
+	HR_FAIL(hr);
+
+	STATSTG stat;
+	hr = thumbnailStream->Stat(&stat, STATFLAG_NONAME); HR_FAIL(hr);
+
+	if (stat.cbSize.QuadPart == 0 || stat.cbSize.QuadPart >= MAXDWORD)
+	{
+		return S_FALSE;
+	}
+
+	ULONG streamSize = static_cast<ULONG>(stat.cbSize.QuadPart);
+	// Two extra zeros so both string searches of GetHeaderOffset stop inside the buffer
+	BYTE* buffer = static_cast<BYTE*>(CoTaskMemAlloc(static_cast<SIZE_T>(streamSize) + 2));
+
+	if (buffer == nullptr)
+	{
+		return E_OUTOFMEMORY;
+	}
+
+	ULONG read = 0;
+	LARGE_INTEGER seekPos = { 0 };
+
+	hr = thumbnailStream->Seek(seekPos, STREAM_SEEK_SET, nullptr); HR_FAIL_ACTION(hr, CoTaskMemFree(buffer));
+	hr = thumbnailStream->Read(buffer, streamSize, &read); HR_FAIL_ACTION(hr, CoTaskMemFree(buffer));
+	buffer[read] = 0;
+	buffer[read + 1] = 0;
+
+	// Skips the header the property handler puts in front of the image
+	size_t offset = GetHeaderOffset(buffer);
+
+	if (offset >= read)
+	{
+		CoTaskMemFree(buffer);
+		return S_FALSE;
+	}
+
+	MoveMemory(buffer, buffer + offset, read - offset);
+
+	data = buffer;
+	size = static_cast<UINT32>(read - offset);
+
+	return S_OK;
+}
+
 #pragma warning (push)
 #pragma warning (disable: 6388 6387 28196)
 HRESULT AudioPlay::AudioMetadata::GetThumbnail(_COM_Outptr_ IWICBitmapFrameDecode** pPtrthumbnail)
@@ -239,7 +313,7 @@ HRESULT AudioPlay::AudioMetadata::GetThumbnail(_COM_Outptr_ IWICBitmapFrameDecod
 
 	delete[] data;
 
-	hr = CoCreateInstance(CLSID_WICImagingFactory, NULL, CLSCTX_INPROC_SERVER, IID_PPV_ARGS(&factory)); HR_FAIL(hr);
+	hr = ThumbnailCache::GetImagingFactory(&factory); HR_FAIL(hr);
 
 	hr = factory->CreateStream(&stream); HR_FAIL(hr);
 	hr = stream->InitializeFromIStream(thumbnailStream); HR_FAIL(hr);
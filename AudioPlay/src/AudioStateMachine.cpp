@@ -0,0 +1,384 @@
+#include "AudioStateMachine.h"
+
+#include <cstdint>
+
+
+#define HR_FAIL_ACTION(hresult, action) if (FAILED(hresult)) { action; return hresult; }
+#define HR_FAIL(hresult) if (FAILED(hresult)) { return hresult; }
+
+#define CHECK_CLOSED if (state == AudioStates::Closed) { return AUDIO_E_CLOSED; }
+
+
+using namespace std::chrono_literals;
+
+
+namespace
+{
+	INT32 ClampPosition(_In_ std::chrono::milliseconds position)
+	{
+		return position.count() > INT32_MAX ? INT32_MAX : (position.count() < INT32_MIN ? INT32_MIN : static_cast<INT32>(position.count()));
+	}
+}
+
+
+AudioPlay::AudioStateMachine::AudioStateMachine(_In_ SessionBackend* p_backend) :
+	backend(p_backend), state(AudioStates::Closed), looping(false), settledState(AudioStates::Closed), pendingCommands(0),
+	hasClock(false), hasCapabilities(false), waitForCapabilities(true)
+{
+}
+
+void AudioPlay::AudioStateMachine::SetTrace(_In_opt_ EventTraceRecorder* recorder)
+{
+	std::lock_guard<std::mutex> lock(mutex);
+
+	trace = recorder;
+}
+
+void AudioPlay::AudioStateMachine::Trace(_In_ EventTraceCommand command, _In_ INT32 argument, _In_ HRESULT result)
+{
+	if (trace)
+	{
+		trace->RecordCommand(command, argument, result, static_cast<UINT32>(state.load()));
+	}
+}
+
+void AudioPlay::AudioStateMachine::SetState(_In_ AudioStates p_state)
+{
+	std::lock_guard<std::mutex> lock(mutex);
+
+	state = p_state;
+
+	if (p_state == AudioStates::Closed)
+	{
+		settledState = p_state;
+		pendingCommands = 0;
+	}
+
+	Trace(EventTraceCommand::SetState, static_cast<INT32>(p_state), S_OK);
+}
+
+void AudioPlay::AudioStateMachine::OnOpening(_In_ bool p_waitForCapabilities)
+{
+	std::lock_guard<std::mutex> lock(mutex);
+
+	state = AudioStates::Opening;
+	settledState = AudioStates::Opening;
+	pendingCommands = 0;
+	hasClock = false;
+	hasCapabilities = false;
+	waitForCapabilities = p_waitForCapabilities;
+
+	Trace(EventTraceCommand::Open, p_waitForCapabilities ? 1 : 0, S_OK);
+}
+
+HRESULT AudioPlay::AudioStateMachine::StartAt(_In_opt_ const milliseconds* position)
+{
+	AudioStates previous = state;
+
+	state = AudioStates::Starting;
+
+	HRESULT hr = backend->Start(position); HR_FAIL_ACTION(hr, state = previous);
+
+	pendingCommands++;
+
+	return hr;
+}
+
+HRESULT AudioPlay::AudioStateMachine::StartLocked()
+{
+	CHECK_CLOSED;
+
+	if (!CheckState(AudioStates::Start))
+	{
+		return StartAt(&currentPosition);
+	}
+
+	return StartAt(nullptr);
+}
+
+HRESULT AudioPlay::AudioStateMachine::StartLocked(_In_ const milliseconds position)
+{
+	CHECK_CLOSED;
+
+	return StartAt(&position);
+}
+
+HRESULT AudioPlay::AudioStateMachine::PauseLocked()
+{
+	CHECK_CLOSED;
+
+	AudioStates previous = state;
+
+	state = AudioStates::Pausing;
+
+	// Keeps the last position if there is no clock yet
+	backend->GetTime(currentPosition);
+
+	HRESULT hr = backend->Pause(); HR_FAIL_ACTION(hr, state = previous);
+
+	pendingCommands++;
+
+	return hr;
+}
+
+HRESULT AudioPlay::AudioStateMachine::StopLocked()
+{
+	CHECK_CLOSED;
+
+	AudioStates previous = state;
+
+	state = AudioStates::Stopping;
+
+	HRESULT hr = backend->Stop(); HR_FAIL_ACTION(hr, state = previous);
+
+	pendingCommands++;
+	currentPosition = 0ms;
+
+	return hr;
+}
+
+HRESULT AudioPlay::AudioStateMachine::SeekLocked(_In_ const milliseconds position)
+{
+	CHECK_CLOSED;
+
+	currentPosition = position;
+
+	if (!CheckState(AudioStates::Close | AudioStates::Stop | AudioStates::Pause))
+	{
+		return StartAt(&currentPosition);
+	}
+
+	return S_OK;
+}
+
+HRESULT AudioPlay::AudioStateMachine::CloseLocked()
+{
+	if (CheckState(AudioStates::Close))
+	{
+		return S_OK;
+	}
+
+	state = AudioStates::Closing;
+
+	return backend->Close();
+}
+
+void AudioPlay::AudioStateMachine::SetLoop(_In_ bool loop)
+{
+	std::lock_guard<std::mutex> lock(mutex);
+
+	looping = loop;
+
+	Trace(EventTraceCommand::SetLoop, loop ? 1 : 0, S_OK);
+}
+
+HRESULT AudioPlay::AudioStateMachine::Start()
+{
+	std::lock_guard<std::mutex> lock(mutex);
+
+	HRESULT hr = StartLocked();
+	Trace(EventTraceCommand::Start, -1, hr);
+
+	return hr;
+}
+
+HRESULT AudioPlay::AudioStateMachine::Start(_In_ const milliseconds position)
+{
+	std::lock_guard<std::mutex> lock(mutex);
+
+	HRESULT hr = StartLocked(position);
+	Trace(EventTraceCommand::StartAt, ClampPosition(position), hr);
+
+	return hr;
+}
+
+HRESULT AudioPlay::AudioStateMachine::Pause()
+{
+	std::lock_guard<std::mutex> lock(mutex);
+
+	HRESULT hr = PauseLocked();
+	Trace(EventTraceCommand::Pause, -1, hr);
+
+	return hr;
+}
+
+HRESULT AudioPlay::AudioStateMachine::Stop()
+{
+	std::lock_guard<std::mutex> lock(mutex);
+
+	HRESULT hr = StopLocked();
+	Trace(EventTraceCommand::Stop, -1, hr);
+
+	return hr;
+}
+
+HRESULT AudioPlay::AudioStateMachine::Seek(_In_ const milliseconds position)
+{
+	std::lock_guard<std::mutex> lock(mutex);
+
+	HRESULT hr = SeekLocked(position);
+	Trace(EventTraceCommand::Seek, ClampPosition(position), hr);
+
+	return hr;
+}
+
+HRESULT AudioPlay::AudioStateMachine::Close()
+{
+	std::lock_guard<std::mutex> lock(mutex);
+
+	HRESULT hr = CloseLocked();
+	Trace(EventTraceCommand::Close, -1, hr);
+
+	return hr;
+}
+
+HRESULT AudioPlay::AudioStateMachine::GetPosition(_Out_ milliseconds& position)
+{
+	std::lock_guard<std::mutex> lock(mutex);
+
+	position = milliseconds{ -1 };
+
+	CHECK_CLOSED;
+
+	if (CheckState(AudioStates::Opening | AudioStates::Close))
+	{
+		return E_FAIL;
+	}
+
+	if (CheckState(AudioStates::Pause) || FAILED(backend->GetTime(position)))
+	{
+		position = currentPosition;
+	}
+
+	return S_OK;
+}
+
+void AudioPlay::AudioStateMachine::ResetPosition()
+{
+	std::lock_guard<std::mutex> lock(mutex);
+
+	currentPosition = 0ms;
+
+	Trace(EventTraceCommand::ResetPosition, 0, S_OK);
+}
+
+void AudioPlay::AudioStateMachine::Settle(_In_ AudioStates settled, _In_ HRESULT status)
+{
+	if (pendingCommands)
+	{
+		pendingCommands--;
+	}
+
+	// Answers to older commands don't override the state of the newest one
+	if (pendingCommands)
+	{
+		return;
+	}
+
+	if (SUCCEEDED(status))
+	{
+		settledState = settled;
+	}
+
+	state = settledState;
+}
+
+HRESULT AudioPlay::AudioStateMachine::HandleEventLocked(_In_ MediaEventType type, _In_ HRESULT status)
+{
+	switch (type)
+	{
+		case MESessionTopologySet:
+		{
+			HR_FAIL(status);
+
+			hasClock = true;
+
+			if (state == AudioStates::Opening && (hasCapabilities || !waitForCapabilities))
+			{
+				state = AudioStates::Ready;
+				settledState = AudioStates::Ready;
+			}
+			break;
+		}
+		case MESessionCapabilitiesChanged:
+		{
+			HR_FAIL(status);
+
+			hasCapabilities = true;
+
+			// Capabilities also change while playing, only opening waits for them
+			if (state == AudioStates::Opening && hasClock && waitForCapabilities)
+			{
+				state = AudioStates::Ready;
+				settledState = AudioStates::Ready;
+			}
+			break;
+		}
+		case MESessionStarted:
+		{
+			Settle(AudioStates::Started, status);
+			break;
+		}
+		case MESessionPaused:
+		{
+			Settle(AudioStates::Paused, status);
+			break;
+		}
+		case MESessionStopped:
+		{
+			Settle(AudioStates::Stopped, status);
+			break;
+		}
+		case MESessionEnded:
+		{
+			// A command sent right before the end is answered after this
+			if (pendingCommands)
+			{
+				break;
+			}
+
+			if (looping)
+			{
+				milliseconds start = 0ms;
+				return StartAt(&start);
+			}
+
+			state = AudioStates::Stopped;
+			settledState = AudioStates::Stopped;
+			break;
+		}
+		case MESessionClosed:
+		{
+			state = AudioStates::Closed;
+			settledState = AudioStates::Closed;
+			pendingCommands = 0;
+			break;
+		}
+		case MENewPresentation:
+		{
+			state = AudioStates::Opening;
+			settledState = AudioStates::Opening;
+			pendingCommands = 0;
+			hasClock = false;
+			hasCapabilities = false;
+			break;
+		}
+	}
+
+	return status;
+}
+
+HRESULT AudioPlay::AudioStateMachine::HandleEvent(_In_ MediaEventType type, _In_ HRESULT status)
+{
+	std::lock_guard<std::mutex> lock(mutex);
+
+	HRESULT hr = HandleEventLocked(type, status);
+
+	// With the state the event left, a loop restart shows as Starting
+	if (trace)
+	{
+		trace->RecordEvent(type, status, static_cast<UINT32>(state.load()));
+	}
+
+	return hr;
+}
@@ -0,0 +1,539 @@
+#include "Crossfade.h"
+#include "RealtimeThread.h"
+#include "Simd.h"
+
+#include <cstring>
+#include <new>
+
+
+#define HR_FAIL_ACTION(hresult, action) if (FAILED(hresult)) { action; return hresult; }
+#define HR_FAIL(hresult) if (FAILED(hresult)) { return hresult; }
+
+
+namespace
+{
+	constexpr float halfPi = 1.57079632679489661923f;
+
+	// Taylor series up to x^9, the error is below 4e-6 on [0, pi/2]
+	inline float SinQuarter(float x)
+	{
+		float x2 = x * x;
+		return x * (1.0f + x2 * (-1.0f / 6.0f + x2 * (1.0f / 120.0f + x2 * (-1.0f / 5040.0f + x2 * (1.0f / 362880.0f)))));
+	}
+
+	inline float Clamp01(float value)
+	{
+		return value < 0.0f ? 0.0f : (value > 1.0f ? 1.0f : value);
+	}
+
+	inline float CustomGain(const float* points, UINT32 pointCount, float t)
+	{
+		float x = t * static_cast<float>(pointCount - 1);
+		UINT32 index = static_cast<UINT32>(x);
+		if (index >= pointCount - 1)
+		{
+			return points[pointCount - 1];
+		}
+		float fraction = x - static_cast<float>(index);
+		return points[index] + (points[index + 1] - points[index]) * fraction;
+	}
+
+	#ifdef AUDIOPLAY_SSE2
+	inline __m128 SinQuarter(__m128 x)
+	{
+		__m128 x2 = _mm_mul_ps(x, x);
+		__m128 result = _mm_set1_ps(1.0f / 362880.0f);
+		result = _mm_add_ps(_mm_mul_ps(result, x2), _mm_set1_ps(-1.0f / 5040.0f));
+		result = _mm_add_ps(_mm_mul_ps(result, x2), _mm_set1_ps(1.0f / 120.0f));
+		result = _mm_add_ps(_mm_mul_ps(result, x2), _mm_set1_ps(-1.0f / 6.0f));
+		result = _mm_add_ps(_mm_mul_ps(result, x2), _mm_set1_ps(1.0f));
+		return _mm_mul_ps(result, x);
+	}
+
+	inline __m128 CustomGain(const float* points, UINT32 pointCount, __m128 t)
+	{
+		__m128 x = _mm_mul_ps(t, _mm_set1_ps(static_cast<float>(pointCount - 1)));
+		__m128i index = _mm_cvttps_epi32(x);
+		__m128 fraction = _mm_sub_ps(x, _mm_cvtepi32_ps(index));
+
+		alignas(16) INT32 indices[4];
+		_mm_store_si128(reinterpret_cast<__m128i*>(indices), index);
+
+		alignas(16) float lower[4];
+		alignas(16) float upper[4];
+		for (int lane = 0; lane < 4; lane++)
+		{
+			UINT32 laneIndex = static_cast<UINT32>(indices[lane]);
+			if (laneIndex >= pointCount - 1)
+			{
+				lower[lane] = upper[lane] = points[pointCount - 1];
+			}
+			else
+			{
+				lower[lane] = points[laneIndex];
+				upper[lane] = points[laneIndex + 1];
+			}
+		}
+
+		__m128 lowerValues = _mm_load_ps(lower);
+		return _mm_add_ps(lowerValues, _mm_mul_ps(_mm_sub_ps(_mm_load_ps(upper), lowerValues), fraction));
+	}
+	#endif
+}
+
+void AudioPlay::ComputeCrossfadeGains(_In_ CrossfadeCurve curve, _In_reads_opt_(customPointCount) const float* customPoints, _In_ UINT32 customPointCount,
+	_In_ UINT64 position, _In_ UINT64 length, _In_ UINT32 count, _Out_writes_(count) float* incomingGains, _Out_writes_(count) float* outgoingGains)
+{
+	if (curve == CrossfadeCurve::Custom && (customPoints == nullptr || customPointCount < 2))
+	{
+		curve = CrossfadeCurve::EqualPower;
+	}
+
+	const float step = length ? 1.0f / static_cast<float>(length) : 0.0f;
+	const float start = length ? static_cast<float>(position) * step : 1.0f;
+
+	UINT32 index = 0;
+
+	#ifdef AUDIOPLAY_SSE2
+	const __m128 zero = _mm_setzero_ps();
+	const __m128 one = _mm_set1_ps(1.0f);
+	const __m128 laneOffsets = _mm_set_ps(3.0f, 2.0f, 1.0f, 0.0f);
+	const __m128 stepVector = _mm_set1_ps(step);
+
+	for (; index + 4 <= count; index += 4)
+	{
+		__m128 t = _mm_add_ps(_mm_set1_ps(start + static_cast<float>(index) * step), _mm_mul_ps(laneOffsets, stepVector));
+		t = _mm_min_ps(_mm_max_ps(t, zero), one);
+		__m128 mirrored = _mm_sub_ps(one, t);
+
+		__m128 incoming;
+		__m128 outgoing;
+
+		switch (curve)
+		{
+			case CrossfadeCurve::Linear:
+			{
+				incoming = t;
+				outgoing = mirrored;
+				break;
+			}
+			case CrossfadeCurve::Custom:
+			{
+				incoming = CustomGain(customPoints, customPointCount, t);
+				outgoing = CustomGain(customPoints, customPointCount, mirrored);
+				break;
+			}
+			default:
+			{
+				const __m128 halfPiVector = _mm_set1_ps(halfPi);
+				incoming = SinQuarter(_mm_mul_ps(t, halfPiVector));
+				outgoing = SinQuarter(_mm_mul_ps(mirrored, halfPiVector));
+				break;
+			}
+		}
+
+		_mm_storeu_ps(incomingGains + index, incoming);
+		_mm_storeu_ps(outgoingGains + index, outgoing);
+	}
+	#endif
+
+	for (; index < count; index++)
+	{
+		float t = Clamp01(start + static_cast<float>(index) * step);
+
+		switch (curve)
+		{
+			case CrossfadeCurve::Linear:
+			{
+				incomingGains[index] = t;
+				outgoingGains[index] = 1.0f - t;
+				break;
+			}
+			case CrossfadeCurve::Custom:
+			{
+				incomingGains[index] = CustomGain(customPoints, customPointCount, t);
+				outgoingGains[index] = CustomGain(customPoints, customPointCount, 1.0f - t);
+				break;
+			}
+			default:
+			{
+				incomingGains[index] = SinQuarter(t * halfPi);
+				outgoingGains[index] = SinQuarter((1.0f - t) * halfPi);
+				break;
+			}
+		}
+	}
+}
+
+void AudioPlay::MixCrossfade(_Inout_updates_(frameCount * channels) float* outgoing, _In_reads_(frameCount * channels) const float* incoming,
+	_In_reads_(frameCount) const float* incomingGains, _In_reads_(frameCount) const float* outgoingGains, _In_ UINT32 frameCount, _In_ UINT32 channels)
+{
+	UINT32 frame = 0;
+
+	#ifdef AUDIOPLAY_SSE2
+	if (channels == 1)
+	{
+		for (; frame + 4 <= frameCount; frame += 4)
+		{
+			__m128 mixed = _mm_add_ps(
+				_mm_mul_ps(_mm_loadu_ps(outgoing + frame), _mm_loadu_ps(outgoingGains + frame)),
+				_mm_mul_ps(_mm_loadu_ps(incoming + frame), _mm_loadu_ps(incomingGains + frame)));
+			_mm_storeu_ps(outgoing + frame, mixed);
+		}
+	}
+	else if (channels == 2)
+	{
+		for (; frame + 4 <= frameCount; frame += 4)
+		{
+			__m128 incomingGain = _mm_loadu_ps(incomingGains + frame);
+			__m128 outgoingGain = _mm_loadu_ps(outgoingGains + frame);
+
+			// Gains of frames 0 and 1 as L R L R, then frames 2 and 3
+			__m128 incomingLow = _mm_unpacklo_ps(incomingGain, incomingGain);
+			__m128 incomingHigh = _mm_unpackhi_ps(incomingGain, incomingGain);
+			__m128 outgoingLow = _mm_unpacklo_ps(outgoingGain, outgoingGain);
+			__m128 outgoingHigh = _mm_unpackhi_ps(outgoingGain, outgoingGain);
+
+			float* output = outgoing + frame * 2;
+			const float* input = incoming + frame * 2;
+
+			_mm_storeu_ps(output, _mm_add_ps(_mm_mul_ps(_mm_loadu_ps(output), outgoingLow), _mm_mul_ps(_mm_loadu_ps(input), incomingLow)));
+			_mm_storeu_ps(output + 4, _mm_add_ps(_mm_mul_ps(_mm_loadu_ps(output + 4), outgoingHigh), _mm_mul_ps(_mm_loadu_ps(input + 4), incomingHigh)));
+		}
+	}
+	#endif
+
+	for (; frame < frameCount; frame++)
+	{
+		float* output = outgoing + static_cast<size_t>(frame) * channels;
+		const float* input = incoming + static_cast<size_t>(frame) * channels;
+
+		for (UINT32 channel = 0; channel < channels; channel++)
+		{
+			output[channel] = output[channel] * outgoingGains[frame] + input[channel] * incomingGains[frame];
+		}
+	}
+}
+
+AudioPlay::CrossfadeSource::CrossfadeSource() :
+	fadeFrames(0), fadePosition(0), curve(CrossfadeCurve::EqualPower), fading(false),
+	customPointCount(0), pendingTransition{ nullptr, 0, CrossfadeCurve::EqualPower, false }, hasPendingTransition(false),
+	requestedCustomPointCount(0), incomingBuffer(nullptr), incomingGains(nullptr), outgoingGains(nullptr)
+{
+	for (std::atomic<PcmSource*>& slot : retired)
+	{
+		slot.store(nullptr, std::memory_order_relaxed);
+	}
+}
+
+AudioPlay::CrossfadeSource::~CrossfadeSource()
+{
+	ReleaseRetired();
+
+	delete[] incomingBuffer;
+	delete[] incomingGains;
+	delete[] outgoingGains;
+}
+
+HRESULT AudioPlay::CrossfadeSource::Create(_In_ PcmSource* first, _COM_Outptr_ CrossfadeSource** pPtrSource)
+{
+	if (pPtrSource == nullptr)
+	{
+		return E_INVALIDARG;
+	}
+	*pPtrSource = nullptr;
+
+	if (first == nullptr)
+	{
+		return E_POINTER;
+	}
+
+	ComPtr<CrossfadeSource> source;
+	source.Attach(new (std::nothrow) CrossfadeSource());
+
+	if (!source)
+	{
+		return E_OUTOFMEMORY;
+	}
+
+	source->format = first->GetFormat();
+	source->current = first;
+
+	source->incomingBuffer = new (std::nothrow) float[static_cast<size_t>(blockFrames) * source->format.channels];
+	source->incomingGains = new (std::nothrow) float[blockFrames];
+	source->outgoingGains = new (std::nothrow) float[blockFrames];
+
+	if (!source->incomingBuffer || !source->incomingGains || !source->outgoingGains)
+	{
+		return E_OUTOFMEMORY;
+	}
+
+	*pPtrSource = source.Detach();
+
+	return S_OK;
+}
+
+HRESULT AudioPlay::CrossfadeSource::QueueTransition(_In_ PcmSource* p_next, _In_ UINT64 p_fadeFrames, _In_ CrossfadeCurve p_curve, _In_ bool startNow)
+{
+	if (p_next == nullptr)
+	{
+		return E_POINTER;
+	}
+	if (p_next->GetFormat() != format)
+	{
+		return AUDIO_E_UNSUPPORTED_FORMAT;
+	}
+
+	ReleaseRetired();
+
+	std::lock_guard<std::mutex> lock(transitionMutex);
+
+	pendingTransition = Transition{ p_next, p_fadeFrames, p_curve, startNow };
+	hasPendingTransition = true;
+
+	return S_OK;
+}
+
+HRESULT AudioPlay::CrossfadeSource::Queue(_In_ PcmSource* p_next, _In_ UINT64 p_fadeFrames, _In_ CrossfadeCurve p_curve)
+{
+	return QueueTransition(p_next, p_fadeFrames, p_curve, false);
+}
+
+HRESULT AudioPlay::CrossfadeSource::CrossfadeNow(_In_ PcmSource* p_next, _In_ UINT64 p_fadeFrames, _In_ CrossfadeCurve p_curve)
+{
+	return QueueTransition(p_next, p_fadeFrames, p_curve, true);
+}
+
+HRESULT AudioPlay::CrossfadeSource::SetCustomCurve(_In_reads_(pointCount) const float* points, _In_ UINT32 pointCount)
+{
+	if (points == nullptr)
+	{
+		return E_POINTER;
+	}
+	if (pointCount < 2 || pointCount > maxCustomPoints)
+	{
+		return E_INVALIDARG;
+	}
+
+	std::lock_guard<std::mutex> lock(transitionMutex);
+
+	memcpy(requestedCustomPoints, points, pointCount * sizeof(float));
+	requestedCustomPointCount = pointCount;
+
+	return S_OK;
+}
+
+void AudioPlay::CrossfadeSource::TakePendingTransition()
+{
+#ifdef AUDIOPLAY_REALTIME_CHECKS
+	RealtimeThread::ReportLock();
+#endif
+
+	// Never waits, a busy control thread just delays the hand over to the next read
+	std::unique_lock<std::mutex> lock(transitionMutex, std::try_to_lock);
+
+	if (!lock.owns_lock() || !hasPendingTransition || fading)
+	{
+		return;
+	}
+
+	// A queued transition that never started is replaced
+	Retire(next);
+	next.Attach(pendingTransition.source.Detach());
+	fadeFrames = pendingTransition.fadeFrames;
+	curve = pendingTransition.curve;
+	fadePosition = 0;
+	fading = pendingTransition.startNow;
+
+	if (curve == CrossfadeCurve::Custom)
+	{
+		memcpy(customPoints, requestedCustomPoints, requestedCustomPointCount * sizeof(float));
+		customPointCount = requestedCustomPointCount;
+	}
+
+	hasPendingTransition = false;
+}
+
+void AudioPlay::CrossfadeSource::FinishTransition()
+{
+	Retire(current);
+	current.Attach(next.Detach());
+	fading = false;
+	fadePosition = 0;
+
+	TakePendingTransition();
+}
+
+void AudioPlay::CrossfadeSource::Retire(_Inout_ ComPtr<PcmSource>& source)
+{
+	PcmSource* retiring = source.Detach();
+
+	if (retiring == nullptr)
+	{
+		return;
+	}
+
+	for (std::atomic<PcmSource*>& slot : retired)
+	{
+		PcmSource* empty = nullptr;
+
+		if (slot.compare_exchange_strong(empty, retiring, std::memory_order_release, std::memory_order_relaxed))
+		{
+			return;
+		}
+	}
+
+	// Only if the control thread stopped collecting, releasing here beats leaking
+	retiring->Release();
+}
+
+void AudioPlay::CrossfadeSource::ReleaseRetired()
+{
+	for (std::atomic<PcmSource*>& slot : retired)
+	{
+		PcmSource* retiring = slot.exchange(nullptr, std::memory_order_acquire);
+
+		if (retiring != nullptr)
+		{
+			retiring->Release();
+		}
+	}
+}
+
+HRESULT AudioPlay::CrossfadeSource::Read(_Out_writes_(frameCount * format.channels) float* buffer, _In_ UINT32 frameCount, _Out_ UINT32& framesRead)
+{
+	framesRead = 0;
+
+	HRESULT hr = S_OK;
+
+	const UINT32 channels = format.channels;
+
+	TakePendingTransition();
+
+	while (framesRead < frameCount && current)
+	{
+		UINT32 chunk = frameCount - framesRead;
+		float* output = buffer + static_cast<size_t>(framesRead) * channels;
+
+		if (!fading)
+		{
+			if (next)
+			{
+				UINT64 length = 0;
+				UINT64 currentPosition = 0;
+
+				// A source looping forever has no end to fade out before
+				if (current->GetLength(length) == S_OK && SUCCEEDED(current->GetPosition(currentPosition)))
+				{
+					UINT64 fadeStart = length > fadeFrames ? length - fadeFrames : 0;
+
+					if (currentPosition >= fadeStart)
+					{
+						fading = true;
+						fadePosition = 0;
+						continue;
+					}
+					if (fadeStart - currentPosition < chunk)
+					{
+						chunk = static_cast<UINT32>(fadeStart - currentPosition);
+					}
+				}
+			}
+
+			UINT32 read = 0;
+			hr = current->Read(output, chunk, read); HR_FAIL(hr);
+
+			framesRead += read;
+
+			if (read < chunk)
+			{
+				if (!next)
+				{
+					break;
+				}
+
+				// Ended without an overlap, the next source just carries on
+				FinishTransition();
+			}
+
+			continue;
+		}
+
+		if (fadePosition >= fadeFrames)
+		{
+			FinishTransition();
+			continue;
+		}
+
+		UINT64 remaining = fadeFrames - fadePosition;
+		chunk = chunk < blockFrames ? chunk : blockFrames;
+		chunk = remaining < chunk ? static_cast<UINT32>(remaining) : chunk;
+
+		UINT32 outgoingRead = 0;
+		hr = current->Read(output, chunk, outgoingRead); HR_FAIL(hr);
+
+		if (outgoingRead < chunk)
+		{
+			memset(output + static_cast<size_t>(outgoingRead) * channels, 0, static_cast<size_t>(chunk - outgoingRead) * channels * sizeof(float));
+		}
+
+		UINT32 incomingRead = 0;
+		hr = next->Read(incomingBuffer, chunk, incomingRead); HR_FAIL(hr);
+
+		if (incomingRead < chunk)
+		{
+			memset(incomingBuffer + static_cast<size_t>(incomingRead) * channels, 0, static_cast<size_t>(chunk - incomingRead) * channels * sizeof(float));
+		}
+
+		ComputeCrossfadeGains(curve, customPoints, customPointCount, fadePosition, fadeFrames, chunk, incomingGains, outgoingGains);
+		MixCrossfade(output, incomingBuffer, incomingGains, outgoingGains, chunk, channels);
+
+		fadePosition += chunk;
+		framesRead += chunk;
+
+		// An incoming source shorter than the fade ends the fade with it
+		if (fadePosition >= fadeFrames || incomingRead < chunk)
+		{
+			FinishTransition();
+		}
+	}
+
+	return hr;
+}
+
+HRESULT AudioPlay::CrossfadeSource::Seek(_In_ UINT64 frame)
+{
+	if (fading)
+	{
+		FinishTransition();
+	}
+
+	if (!current)
+	{
+		return E_UNEXPECTED;
+	}
+
+	return current->Seek(frame);
+}
+
+HRESULT AudioPlay::CrossfadeSource::GetPosition(_Out_ UINT64& frame) const
+{
+	if (!current)
+	{
+		frame = 0;
+		return E_UNEXPECTED;
+	}
+
+	return current->GetPosition(frame);
+}
+
+HRESULT AudioPlay::CrossfadeSource::GetLength(_Out_ UINT64& frames) const
+{
+	if (!current)
+	{
+		frames = 0;
+		return E_UNEXPECTED;
+	}
+
+	return current->GetLength(frames);
+}
@@ -0,0 +1,415 @@
+#include "DspChain.h"
+#include "RealtimeThread.h"
+
+#include <chrono>
+#include <cstring>
+#include <new>
+
+
+#define HR_FAIL_ACTION(hresult, action) if (FAILED(hresult)) { action; return hresult; }
+#define HR_FAIL(hresult) if (FAILED(hresult)) { return hresult; }
+
+
+using std::chrono::duration_cast;
+using std::chrono::nanoseconds;
+using std::chrono::steady_clock;
+
+
+AudioPlay::DspEffect::DspEffect() :
+	referenceCount(1), bypassed(false), resetRequested(false), processedFrames(0), processNanoseconds(0),
+	preparedFormat{ 0, 0 }, appliedVersion(0), parameterVersion(0)
+{
+}
+
+AudioPlay::DspEffect::~DspEffect()
+{
+}
+
+ULONG STDMETHODCALLTYPE AudioPlay::DspEffect::AddRef()
+{
+	return ++referenceCount;
+}
+
+ULONG STDMETHODCALLTYPE AudioPlay::DspEffect::Release()
+{
+	ULONG count = --referenceCount;
+	if (count == 0)
+	{
+		delete this;
+	}
+	return count;
+}
+
+void AudioPlay::DspEffect::Run(_Inout_updates_(frameCount * format.channels) float* frames, _In_ UINT32 frameCount, _In_ const PcmFormat& format)
+{
+	if (format.channels == 0 || format.channels > maxChannels || format.sampleRate == 0 || format.sampleRate > maxSampleRate)
+	{
+		return;
+	}
+
+	UINT32 version = parameterVersion.load(std::memory_order_acquire);
+
+	if (format != preparedFormat)
+	{
+		preparedFormat = format;
+		appliedVersion = version;
+		Update(format);
+		Reset();
+	}
+	else if (version != appliedVersion)
+	{
+		appliedVersion = version;
+		Update(format);
+	}
+
+	if (resetRequested.load(std::memory_order_relaxed) && resetRequested.exchange(false, std::memory_order_acquire))
+	{
+		Reset();
+	}
+
+	if (bypassed.load(std::memory_order_relaxed))
+	{
+		return;
+	}
+
+	steady_clock::time_point start = steady_clock::now();
+
+	Process(frames, frameCount, format);
+
+	processNanoseconds.fetch_add(duration_cast<nanoseconds>(steady_clock::now() - start).count(), std::memory_order_relaxed);
+	processedFrames.fetch_add(frameCount, std::memory_order_relaxed);
+}
+
+void AudioPlay::DspEffect::SetBypass(_In_ bool bypass)
+{
+	if (bypass)
+	{
+		resetRequested = true;
+	}
+
+	bypassed = bypass;
+}
+
+
+AudioPlay::DspChain::DspChain() :
+	referenceCount(1), hasPending(false), resetRequested(false)
+{
+	processing.clear();
+}
+
+AudioPlay::DspChain::~DspChain()
+{
+}
+
+HRESULT AudioPlay::DspChain::Create(_COM_Outptr_ DspChain** pPtrChain)
+{
+	if (pPtrChain == nullptr)
+	{
+		return E_INVALIDARG;
+	}
+
+	*pPtrChain = new (std::nothrow) DspChain();
+
+	if (*pPtrChain == nullptr)
+	{
+		return E_OUTOFMEMORY;
+	}
+
+	return S_OK;
+}
+
+ULONG STDMETHODCALLTYPE AudioPlay::DspChain::AddRef()
+{
+	return ++referenceCount;
+}
+
+ULONG STDMETHODCALLTYPE AudioPlay::DspChain::Release()
+{
+	ULONG count = --referenceCount;
+	if (count == 0)
+	{
+		delete this;
+	}
+	return count;
+}
+
+HRESULT AudioPlay::DspChain::Publish()
+{
+	std::lock_guard<std::mutex> lock(pendingMutex);
+
+	// Releases the list the audio thread swapped out last time here instead of on the audio thread
+	for (UINT32 index = 0; index < maxEffects; index++)
+	{
+		pending.effects[index] = index < configured.count ? configured.effects[index] : nullptr;
+	}
+	pending.count = configured.count;
+	hasPending = true;
+
+	return S_OK;
+}
+
+HRESULT AudioPlay::DspChain::Insert(_In_ DspEffect* effect, _In_ UINT32 index)
+{
+	if (effect == nullptr)
+	{
+		return E_POINTER;
+	}
+
+	std::lock_guard<std::mutex> lock(configureMutex);
+
+	if (configured.count == maxEffects)
+	{
+		return E_BOUNDS;
+	}
+
+	if (index > configured.count)
+	{
+		index = configured.count;
+	}
+
+	for (UINT32 move = configured.count; move > index; move--)
+	{
+		configured.effects[move] = configured.effects[move - 1];
+	}
+	configured.effects[index] = effect;
+	configured.count++;
+
+	return Publish();
+}
+
+HRESULT AudioPlay::DspChain::Remove(_In_ DspEffect* effect)
+{
+	std::lock_guard<std::mutex> lock(configureMutex);
+
+	for (UINT32 index = 0; index < configured.count; index++)
+	{
+		if (configured.effects[index] == effect)
+		{
+			for (UINT32 move = index; move + 1 < configured.count; move++)
+			{
+				configured.effects[move] = configured.effects[move + 1];
+			}
+			configured.count--;
+			configured.effects[configured.count] = nullptr;
+
+			return Publish();
+		}
+	}
+
+	return S_FALSE;
+}
+
+HRESULT AudioPlay::DspChain::Clear()
+{
+	std::lock_guard<std::mutex> lock(configureMutex);
+
+	for (UINT32 index = 0; index < configured.count; index++)
+	{
+		configured.effects[index] = nullptr;
+	}
+	configured.count = 0;
+
+	return Publish();
+}
+
+UINT32 AudioPlay::DspChain::GetEffectCount()
+{
+	std::lock_guard<std::mutex> lock(configureMutex);
+
+	return configured.count;
+}
+
+bool AudioPlay::DspChain::Process(_Inout_updates_(frameCount * format.channels) float* frames, _In_ UINT32 frameCount, _In_ const PcmFormat& format)
+{
+	if (processing.test_and_set(std::memory_order_acquire))
+	{
+		return false;
+	}
+
+#ifdef AUDIOPLAY_REALTIME_CHECKS
+	// Only tried, but still a lock on the audio thread
+	RealtimeThread::ReportLock();
+#endif
+
+	if (pendingMutex.try_lock())
+	{
+		if (hasPending)
+		{
+			// Swapping doesn't release anything, the old effects go back to the control thread
+			for (UINT32 index = 0; index < maxEffects; index++)
+			{
+				DspEffect* effect = active.effects[index].Detach();
+				active.effects[index].Attach(pending.effects[index].Detach());
+				pending.effects[index].Attach(effect);
+			}
+			UINT32 count = active.count;
+			active.count = pending.count;
+			pending.count = count;
+			hasPending = false;
+		}
+		pendingMutex.unlock();
+	}
+
+	bool reset = resetRequested.load(std::memory_order_relaxed) && resetRequested.exchange(false, std::memory_order_acquire);
+
+	for (UINT32 index = 0; index < active.count; index++)
+	{
+		if (reset)
+		{
+			active.effects[index]->RequestReset();
+		}
+		active.effects[index]->Run(frames, frameCount, format);
+	}
+
+	processing.clear(std::memory_order_release);
+
+	return true;
+}
+
+void AudioPlay::DspChain::RequestReset()
+{
+	resetRequested.store(true, std::memory_order_release);
+}
+
+
+AudioPlay::DspSource::DspSource()
+{
+}
+
+AudioPlay::DspSource::~DspSource()
+{
+}
+
+HRESULT AudioPlay::DspSource::Create(_In_ PcmSource* source, _In_ DspChain* chain, _COM_Outptr_ DspSource** pPtrSource)
+{
+	if (pPtrSource == nullptr)
+	{
+		return E_INVALIDARG;
+	}
+	*pPtrSource = nullptr;
+
+	if (source == nullptr || chain == nullptr)
+	{
+		return E_POINTER;
+	}
+
+	DspSource* dspSource = new (std::nothrow) DspSource();
+
+	if (dspSource == nullptr)
+	{
+		return E_OUTOFMEMORY;
+	}
+
+	dspSource->source = source;
+	dspSource->chain = chain;
+	dspSource->format = source->GetFormat();
+
+	*pPtrSource = dspSource;
+
+	return S_OK;
+}
+
+HRESULT AudioPlay::DspSource::Read(_Out_writes_(frameCount * format.channels) float* buffer, _In_ UINT32 frameCount, _Out_ UINT32& framesRead)
+{
+	HRESULT hr = source->Read(buffer, frameCount, framesRead); HR_FAIL(hr);
+
+	steady_clock::time_point start = telemetry ? steady_clock::now() : steady_clock::time_point{ };
+
+	for (UINT32 offset = 0; offset < framesRead; offset += blockFrames)
+	{
+		UINT32 count = framesRead - offset < blockFrames ? framesRead - offset : blockFrames;
+
+		chain->Process(buffer + static_cast<size_t>(offset) * format.channels, count, format);
+	}
+
+	if (telemetry)
+	{
+		telemetry->AddProcessing(duration_cast<nanoseconds>(steady_clock::now() - start));
+	}
+
+	return hr;
+}
+
+HRESULT AudioPlay::DspSource::Seek(_In_ UINT64 frame)
+{
+	HRESULT hr = source->Seek(frame); HR_FAIL(hr);
+
+	// Filter tails and delayed frames belong to the old position
+	chain->RequestReset();
+
+	return hr;
+}
+
+HRESULT AudioPlay::DspSource::GetPosition(_Out_ UINT64& frame) const
+{
+	return source->GetPosition(frame);
+}
+
+HRESULT AudioPlay::DspSource::GetLength(_Out_ UINT64& frames) const
+{
+	return source->GetLength(frames);
+}
+
+
+HRESULT AudioPlay::MeasureDspEffect(_In_ DspEffect* effect, _In_ const PcmFormat& format, _In_ UINT32 blockFrames, _In_ UINT64 totalFrames, _Out_ DspEffectCost& cost)
+{
+	cost = { };
+
+	if (effect == nullptr)
+	{
+		return E_POINTER;
+	}
+
+	if (format.channels == 0 || format.channels > DspEffect::maxChannels || format.sampleRate == 0 || format.sampleRate > DspEffect::maxSampleRate || blockFrames == 0)
+	{
+		return E_INVALIDARG;
+	}
+
+	size_t sampleCount = static_cast<size_t>(blockFrames) * format.channels;
+
+	// Every block starts from the same noise so filters can't run away or into denormals
+	float* noise = new (std::nothrow) float[sampleCount * 2];
+
+	if (noise == nullptr)
+	{
+		return E_OUTOFMEMORY;
+	}
+
+	float* block = noise + sampleCount;
+	UINT32 seed = 0x9E3779B9;
+
+	for (size_t index = 0; index < sampleCount; index++)
+	{
+		seed = seed * 1664525 + 1013904223;
+		noise[index] = static_cast<float>(static_cast<INT32>(seed)) / 2147483648.0f;
+	}
+
+	memcpy(block, noise, sampleCount * sizeof(float));
+
+	// Warm up so the first Update and Reset aren't measured
+	effect->Run(block, blockFrames, format);
+
+	UINT64 framesBefore = effect->GetProcessedFrames();
+	UINT64 nanosecondsBefore = effect->GetProcessNanoseconds();
+
+	for (UINT64 done = 0; done < totalFrames; done += blockFrames)
+	{
+		UINT32 count = totalFrames - done < blockFrames ? static_cast<UINT32>(totalFrames - done) : blockFrames;
+
+		memcpy(block, noise, sampleCount * sizeof(float));
+		effect->Run(block, count, format);
+	}
+
+	delete[] noise;
+
+	cost.frames = effect->GetProcessedFrames() - framesBefore;
+	cost.nanoseconds = effect->GetProcessNanoseconds() - nanosecondsBefore;
+
+	if (cost.frames)
+	{
+		cost.nanosecondsPerFrame = static_cast<double>(cost.nanoseconds) / cost.frames;
+		cost.realtimeLoad = cost.nanosecondsPerFrame * format.sampleRate / 1e9;
+	}
+
+	return S_OK;
+}
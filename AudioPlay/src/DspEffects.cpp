@@ -0,0 +1,656 @@
+#include "DspEffects.h"
+#include "Simd.h"
+
+#include <cmath>
+#include <cstring>
+#include <new>
+
+
+#define HR_FAIL_ACTION(hresult, action) if (FAILED(hresult)) { action; return hresult; }
+#define HR_FAIL(hresult) if (FAILED(hresult)) { return hresult; }
+
+
+namespace
+{
+	constexpr double pi = 3.14159265358979323846;
+
+	// Filter memory this small would only decay into denormals
+	constexpr float denormalLimit = 1e-15f;
+
+	// dB = decibelsPerOctave * log2(gain), exp2 and log2 are a lot cheaper than pow and log10 per frame
+	constexpr float decibelsPerOctave = 6.02059991f;
+
+	float DecibelsToGain(float decibels)
+	{
+		return std::pow(10.0f, decibels / 20.0f);
+	}
+
+	float TimeCoefficient(float milliseconds, UINT32 sampleRate)
+	{
+		if (milliseconds <= 0.0f)
+		{
+			return 0.0f;
+		}
+		return static_cast<float>(std::exp(-1000.0 / (static_cast<double>(milliseconds) * sampleRate)));
+	}
+
+	float FramePeak(const float* frame, UINT32 channels)
+	{
+		float peak = 0.0f;
+		for (UINT32 channel = 0; channel < channels; channel++)
+		{
+			float magnitude = std::fabs(frame[channel]);
+			peak = magnitude > peak ? magnitude : peak;
+		}
+		return peak;
+	}
+
+	#ifdef AUDIOPLAY_SSE2
+	// Channels of one frame into the low lanes
+	template<UINT32 lanes>
+	__m128 LoadLanes(const float* source)
+	{
+		if constexpr (lanes == 4)
+		{
+			return _mm_loadu_ps(source);
+		}
+		else if constexpr (lanes == 3)
+		{
+			return _mm_setr_ps(source[0], source[1], source[2], 0.0f);
+		}
+		else if constexpr (lanes == 2)
+		{
+			return _mm_castpd_ps(_mm_load_sd(reinterpret_cast<const double*>(source)));
+		}
+		else
+		{
+			return _mm_load_ss(source);
+		}
+	}
+
+	template<UINT32 lanes>
+	void StoreLanes(float* destination, __m128 value)
+	{
+		if constexpr (lanes == 4)
+		{
+			_mm_storeu_ps(destination, value);
+		}
+		else if constexpr (lanes == 3)
+		{
+			_mm_store_sd(reinterpret_cast<double*>(destination), _mm_castps_pd(value));
+			_mm_store_ss(destination + 2, _mm_movehl_ps(value, value));
+		}
+		else if constexpr (lanes == 2)
+		{
+			_mm_store_sd(reinterpret_cast<double*>(destination), _mm_castps_pd(value));
+		}
+		else
+		{
+			_mm_store_ss(destination, value);
+		}
+	}
+
+	// One band over lanes channels starting at the first sample of frames, the state stays in registers for the whole block
+	template<UINT32 lanes>
+	void FilterLanes(float* frames, UINT32 frameCount, UINT32 stride, float numerator0, float numerator1, float numerator2, float denominator1, float denominator2, float* z1, float* z2)
+	{
+		__m128 b0 = _mm_set1_ps(numerator0);
+		__m128 b1 = _mm_set1_ps(numerator1);
+		__m128 b2 = _mm_set1_ps(numerator2);
+		__m128 a1 = _mm_set1_ps(denominator1);
+		__m128 a2 = _mm_set1_ps(denominator2);
+		__m128 state1 = _mm_load_ps(z1);
+		__m128 state2 = _mm_load_ps(z2);
+
+		for (UINT32 frame = 0; frame < frameCount; frame++)
+		{
+			float* sample = frames + static_cast<size_t>(frame) * stride;
+			__m128 x = LoadLanes<lanes>(sample);
+			__m128 y = _mm_add_ps(_mm_mul_ps(b0, x), state1);
+			state1 = _mm_add_ps(_mm_sub_ps(_mm_mul_ps(b1, x), _mm_mul_ps(a1, y)), state2);
+			state2 = _mm_sub_ps(_mm_mul_ps(b2, x), _mm_mul_ps(a2, y));
+			StoreLanes<lanes>(sample, y);
+		}
+
+		_mm_store_ps(z1, state1);
+		_mm_store_ps(z2, state2);
+	}
+	#endif
+}
+
+
+AudioPlay::BiquadEq::BiquadEq()
+{
+	for (UINT32 band = 0; band < bandCount; band++)
+	{
+		parameters[band].enabled = false;
+		parameters[band].type = BiquadType::Peak;
+		parameters[band].frequency = 1000.0f;
+		parameters[band].gain = 0.0f;
+		parameters[band].q = 0.7071f;
+		coefficients[band] = { 1.0f, 0.0f, 0.0f, 0.0f, 0.0f };
+		bandActive[band] = false;
+	}
+	Reset();
+}
+
+HRESULT AudioPlay::BiquadEq::Create(_COM_Outptr_ BiquadEq** pPtrEq)
+{
+	if (pPtrEq == nullptr)
+	{
+		return E_INVALIDARG;
+	}
+
+	*pPtrEq = new (std::nothrow) BiquadEq();
+
+	if (*pPtrEq == nullptr)
+	{
+		return E_OUTOFMEMORY;
+	}
+
+	return S_OK;
+}
+
+HRESULT AudioPlay::BiquadEq::SetBand(_In_ UINT32 band, _In_ BiquadType type, _In_ float frequency, _In_ float gain, _In_ float q)
+{
+	if (band >= bandCount)
+	{
+		return E_BOUNDS;
+	}
+
+	if (!(frequency > 0.0f) || !(q > 0.0f) || !std::isfinite(gain) || type < BiquadType::Peak || type > BiquadType::HighPass)
+	{
+		return E_INVALIDARG;
+	}
+
+	parameters[band].type = type;
+	parameters[band].frequency = frequency;
+	parameters[band].gain = gain;
+	parameters[band].q = q;
+	parameters[band].enabled = true;
+
+	ParametersChanged();
+
+	return S_OK;
+}
+
+HRESULT AudioPlay::BiquadEq::DisableBand(_In_ UINT32 band)
+{
+	if (band >= bandCount)
+	{
+		return E_BOUNDS;
+	}
+
+	parameters[band].enabled = false;
+
+	ParametersChanged();
+
+	return S_OK;
+}
+
+AudioPlay::BiquadEq::Coefficients AudioPlay::BiquadEq::Design(_In_ BiquadType type, _In_ double frequency, _In_ double gain, _In_ double q, _In_ double sampleRate)
+{
+	// Keeps the filter stable when the rate drops under twice the frequency
+	if (frequency > sampleRate * 0.49)
+	{
+		frequency = sampleRate * 0.49;
+	}
+
+	double w0 = 2.0 * pi * frequency / sampleRate;
+	double cosine = std::cos(w0);
+	double alpha = std::sin(w0) / (2.0 * q);
+	double a = std::pow(10.0, gain / 40.0);
+	double shelf = 2.0 * std::sqrt(a) * alpha;
+
+	double b0 = 1.0, b1 = 0.0, b2 = 0.0, a0 = 1.0, a1 = 0.0, a2 = 0.0;
+
+	switch (type)
+	{
+		case BiquadType::Peak:
+		{
+			b0 = 1.0 + alpha * a;
+			b1 = -2.0 * cosine;
+			b2 = 1.0 - alpha * a;
+			a0 = 1.0 + alpha / a;
+			a1 = -2.0 * cosine;
+			a2 = 1.0 - alpha / a;
+			break;
+		}
+		case BiquadType::LowShelf:
+		{
+			b0 = a * ((a + 1.0) - (a - 1.0) * cosine + shelf);
+			b1 = 2.0 * a * ((a - 1.0) - (a + 1.0) * cosine);
+			b2 = a * ((a + 1.0) - (a - 1.0) * cosine - shelf);
+			a0 = (a + 1.0) + (a - 1.0) * cosine + shelf;
+			a1 = -2.0 * ((a - 1.0) + (a + 1.0) * cosine);
+			a2 = (a + 1.0) + (a - 1.0) * cosine - shelf;
+			break;
+		}
+		case BiquadType::HighShelf:
+		{
+			b0 = a * ((a + 1.0) + (a - 1.0) * cosine + shelf);
+			b1 = -2.0 * a * ((a - 1.0) + (a + 1.0) * cosine);
+			b2 = a * ((a + 1.0) + (a - 1.0) * cosine - shelf);
+			a0 = (a + 1.0) - (a - 1.0) * cosine + shelf;
+			a1 = 2.0 * ((a - 1.0) - (a + 1.0) * cosine);
+			a2 = (a + 1.0) - (a - 1.0) * cosine - shelf;
+			break;
+		}
+		case BiquadType::LowPass:
+		{
+			b0 = (1.0 - cosine) / 2.0;
+			b1 = 1.0 - cosine;
+			b2 = (1.0 - cosine) / 2.0;
+			a0 = 1.0 + alpha;
+			a1 = -2.0 * cosine;
+			a2 = 1.0 - alpha;
+			break;
+		}
+		case BiquadType::HighPass:
+		{
+			b0 = (1.0 + cosine) / 2.0;
+			b1 = -(1.0 + cosine);
+			b2 = (1.0 + cosine) / 2.0;
+			a0 = 1.0 + alpha;
+			a1 = -2.0 * cosine;
+			a2 = 1.0 - alpha;
+			break;
+		}
+	}
+
+	return { static_cast<float>(b0 / a0), static_cast<float>(b1 / a0), static_cast<float>(b2 / a0), static_cast<float>(a1 / a0), static_cast<float>(a2 / a0) };
+}
+
+void AudioPlay::BiquadEq::Update(_In_ const PcmFormat& format)
+{
+	for (UINT32 band = 0; band < bandCount; band++)
+	{
+		bool enabled = parameters[band].enabled;
+
+		if (enabled)
+		{
+			coefficients[band] = Design(parameters[band].type, parameters[band].frequency, parameters[band].gain, parameters[band].q, format.sampleRate);
+		}
+
+		if (enabled && !bandActive[band])
+		{
+			// Memory left from before the band was turned off would pop
+			memset(z1[band], 0, sizeof(z1[band]));
+			memset(z2[band], 0, sizeof(z2[band]));
+		}
+
+		bandActive[band] = enabled;
+	}
+}
+
+void AudioPlay::BiquadEq::Reset()
+{
+	memset(z1, 0, sizeof(z1));
+	memset(z2, 0, sizeof(z2));
+}
+
+void AudioPlay::BiquadEq::Process(_Inout_updates_(frameCount * format.channels) float* frames, _In_ UINT32 frameCount, _In_ const PcmFormat& format)
+{
+	UINT32 channels = format.channels;
+
+	for (UINT32 band = 0; band < bandCount; band++)
+	{
+		if (!bandActive[band])
+		{
+			continue;
+		}
+
+		const Coefficients& coefficient = coefficients[band];
+
+		#ifdef AUDIOPLAY_SSE2
+		for (UINT32 first = 0; first < channels; first += 4)
+		{
+			float* start = frames + first;
+			float* bandZ1 = z1[band] + first;
+			float* bandZ2 = z2[band] + first;
+
+			switch (channels - first)
+			{
+				case 1: FilterLanes<1>(start, frameCount, channels, coefficient.b0, coefficient.b1, coefficient.b2, coefficient.a1, coefficient.a2, bandZ1, bandZ2); break;
+				case 2: FilterLanes<2>(start, frameCount, channels, coefficient.b0, coefficient.b1, coefficient.b2, coefficient.a1, coefficient.a2, bandZ1, bandZ2); break;
+				case 3: FilterLanes<3>(start, frameCount, channels, coefficient.b0, coefficient.b1, coefficient.b2, coefficient.a1, coefficient.a2, bandZ1, bandZ2); break;
+				default: FilterLanes<4>(start, frameCount, channels, coefficient.b0, coefficient.b1, coefficient.b2, coefficient.a1, coefficient.a2, bandZ1, bandZ2); break;
+			}
+		}
+		#else
+		for (UINT32 channel = 0; channel < channels; channel++)
+		{
+			float state1 = z1[band][channel];
+			float state2 = z2[band][channel];
+
+			for (UINT32 frame = 0; frame < frameCount; frame++)
+			{
+				float& sample = frames[static_cast<size_t>(frame) * channels + channel];
+				float x = sample;
+				float y = coefficient.b0 * x + state1;
+				state1 = coefficient.b1 * x - coefficient.a1 * y + state2;
+				state2 = coefficient.b2 * x - coefficient.a2 * y;
+				sample = y;
+			}
+
+			z1[band][channel] = state1;
+			z2[band][channel] = state2;
+		}
+		#endif
+
+		for (UINT32 channel = 0; channel < channels; channel++)
+		{
+			if (std::fabs(z1[band][channel]) < denormalLimit && std::fabs(z2[band][channel]) < denormalLimit)
+			{
+				z1[band][channel] = 0.0f;
+				z2[band][channel] = 0.0f;
+			}
+		}
+	}
+}
+
+
+AudioPlay::Limiter::Limiter() :
+	ceiling(-1.0f), release(50.0f), lookahead(2.0f), ceilingGain(1.0f), releaseCoefficient(0.0f), lookaheadFrames(1),
+	delay(nullptr), delayPosition(0), minimumFrames(nullptr), minimumGains(nullptr), minimumHead(0), minimumCount(0), frameCounter(0),
+	averageGains(nullptr), averagePosition(0), averageSum(0.0), gain(1.0f)
+{
+}
+
+AudioPlay::Limiter::~Limiter()
+{
+	delete[] delay;
+	delete[] minimumFrames;
+	delete[] minimumGains;
+	delete[] averageGains;
+}
+
+HRESULT AudioPlay::Limiter::Create(_COM_Outptr_ Limiter** pPtrLimiter)
+{
+	if (pPtrLimiter == nullptr)
+	{
+		return E_INVALIDARG;
+	}
+	*pPtrLimiter = nullptr;
+
+	ComPtr<Limiter> limiter;
+	limiter.Attach(new (std::nothrow) Limiter());
+
+	if (!limiter)
+	{
+		return E_OUTOFMEMORY;
+	}
+
+	// Sized for the longest lookahead at the highest rate so nothing is allocated on the audio thread
+	size_t maxFrames = static_cast<size_t>(maxLookahead * maxSampleRate / 1000.0f) + 1;
+
+	limiter->delay = new (std::nothrow) float[maxFrames * maxChannels];
+	limiter->minimumFrames = new (std::nothrow) UINT32[maxFrames + 1];
+	limiter->minimumGains = new (std::nothrow) float[maxFrames + 1];
+	limiter->averageGains = new (std::nothrow) float[maxFrames];
+
+	if (!limiter->delay || !limiter->minimumFrames || !limiter->minimumGains || !limiter->averageGains)
+	{
+		return E_OUTOFMEMORY;
+	}
+
+	*pPtrLimiter = limiter.Detach();
+
+	return S_OK;
+}
+
+HRESULT AudioPlay::Limiter::SetCeiling(_In_ float decibels)
+{
+	if (!(decibels <= 0.0f) || !std::isfinite(decibels))
+	{
+		return E_INVALIDARG;
+	}
+
+	ceiling = decibels;
+
+	ParametersChanged();
+
+	return S_OK;
+}
+
+HRESULT AudioPlay::Limiter::SetRelease(_In_ float milliseconds)
+{
+	if (!(milliseconds >= 0.0f) || !std::isfinite(milliseconds))
+	{
+		return E_INVALIDARG;
+	}
+
+	release = milliseconds;
+
+	ParametersChanged();
+
+	return S_OK;
+}
+
+HRESULT AudioPlay::Limiter::SetLookahead(_In_ float milliseconds)
+{
+	if (!(milliseconds >= 0.0f && milliseconds <= maxLookahead))
+	{
+		return E_INVALIDARG;
+	}
+
+	lookahead = milliseconds;
+
+	ParametersChanged();
+
+	return S_OK;
+}
+
+void AudioPlay::Limiter::Update(_In_ const PcmFormat& format)
+{
+	ceilingGain = DecibelsToGain(ceiling);
+	releaseCoefficient = TimeCoefficient(release, format.sampleRate);
+
+	UINT32 frames = static_cast<UINT32>(lookahead * format.sampleRate / 1000.0f);
+	frames = frames ? frames : 1;
+
+	if (frames != lookaheadFrames)
+	{
+		// The delay line changes length, starting over is quieter than stretching it
+		lookaheadFrames = frames;
+		Reset();
+	}
+}
+
+void AudioPlay::Limiter::Reset()
+{
+	memset(delay, 0, static_cast<size_t>(lookaheadFrames) * maxChannels * sizeof(float));
+	delayPosition = 0;
+	minimumHead = 0;
+	minimumCount = 0;
+	frameCounter = 0;
+
+	for (UINT32 index = 0; index < lookaheadFrames; index++)
+	{
+		averageGains[index] = 1.0f;
+	}
+	averagePosition = 0;
+	averageSum = lookaheadFrames;
+	gain = 1.0f;
+}
+
+void AudioPlay::Limiter::Process(_Inout_updates_(frameCount * format.channels) float* frames, _In_ UINT32 frameCount, _In_ const PcmFormat& format)
+{
+	UINT32 channels = format.channels;
+	UINT32 window = lookaheadFrames + 1;
+	float average = 1.0f / lookaheadFrames;
+
+	for (UINT32 frame = 0; frame < frameCount; frame++)
+	{
+		float* sample = frames + static_cast<size_t>(frame) * channels;
+
+		float peak = FramePeak(sample, channels);
+		float required = peak > ceilingGain ? ceilingGain / peak : 1.0f;
+
+		// Smallest gain needed by any frame from lookaheadFrames ago up to this one
+		while (minimumCount && minimumGains[(minimumHead + minimumCount - 1) % window] >= required)
+		{
+			minimumCount--;
+		}
+		UINT32 tail = (minimumHead + minimumCount) % window;
+		minimumFrames[tail] = frameCounter;
+		minimumGains[tail] = required;
+		minimumCount++;
+
+		if (frameCounter - minimumFrames[minimumHead] >= window)
+		{
+			minimumHead = (minimumHead + 1) % window;
+			minimumCount--;
+		}
+		float held = minimumGains[minimumHead];
+		frameCounter++;
+
+		// Every held gain in the average is at most the gain the delayed frame needs
+		averageSum += held - averageGains[averagePosition];
+		averageGains[averagePosition] = held;
+		averagePosition = averagePosition + 1 == lookaheadFrames ? 0 : averagePosition + 1;
+
+		float target = static_cast<float>(averageSum) * average;
+		gain = target < gain ? target : target + (gain - target) * releaseCoefficient;
+
+		float* delayed = delay + static_cast<size_t>(delayPosition) * channels;
+		for (UINT32 channel = 0; channel < channels; channel++)
+		{
+			float output = delayed[channel] * gain;
+			// The running sum can be a rounding error above the exact gain
+			output = output > ceilingGain ? ceilingGain : (output < -ceilingGain ? -ceilingGain : output);
+
+			delayed[channel] = sample[channel];
+			sample[channel] = output;
+		}
+		delayPosition = delayPosition + 1 == lookaheadFrames ? 0 : delayPosition + 1;
+	}
+}
+
+
+AudioPlay::Compressor::Compressor() :
+	threshold(-18.0f), ratio(4.0f), knee(6.0f), attack(10.0f), release(100.0f), makeup(0.0f), reductionMeter(0.0f),
+	thresholdDecibels(-18.0f), slope(0.75f), kneeDecibels(6.0f), quietLevel(0.0f), attackCoefficient(0.0f), releaseCoefficient(0.0f),
+	makeupDecibels(0.0f), reduction(0.0f)
+{
+}
+
+HRESULT AudioPlay::Compressor::Create(_COM_Outptr_ Compressor** pPtrCompressor)
+{
+	if (pPtrCompressor == nullptr)
+	{
+		return E_INVALIDARG;
+	}
+
+	*pPtrCompressor = new (std::nothrow) Compressor();
+
+	if (*pPtrCompressor == nullptr)
+	{
+		return E_OUTOFMEMORY;
+	}
+
+	return S_OK;
+}
+
+HRESULT AudioPlay::Compressor::SetThreshold(_In_ float decibels, _In_ float newRatio, _In_ float kneeWidth)
+{
+	if (!std::isfinite(decibels) || !(newRatio >= 1.0f) || !(kneeWidth >= 0.0f) || !std::isfinite(kneeWidth))
+	{
+		return E_INVALIDARG;
+	}
+
+	threshold = decibels;
+	ratio = newRatio;
+	knee = kneeWidth;
+
+	ParametersChanged();
+
+	return S_OK;
+}
+
+HRESULT AudioPlay::Compressor::SetTiming(_In_ float attackMilliseconds, _In_ float releaseMilliseconds)
+{
+	if (!(attackMilliseconds >= 0.0f) || !(releaseMilliseconds >= 0.0f) || !std::isfinite(attackMilliseconds) || !std::isfinite(releaseMilliseconds))
+	{
+		return E_INVALIDARG;
+	}
+
+	attack = attackMilliseconds;
+	release = releaseMilliseconds;
+
+	ParametersChanged();
+
+	return S_OK;
+}
+
+HRESULT AudioPlay::Compressor::SetMakeup(_In_ float decibels)
+{
+	if (!std::isfinite(decibels))
+	{
+		return E_INVALIDARG;
+	}
+
+	makeup = decibels;
+
+	ParametersChanged();
+
+	return S_OK;
+}
+
+void AudioPlay::Compressor::Update(_In_ const PcmFormat& format)
+{
+	thresholdDecibels = threshold;
+	slope = 1.0f - 1.0f / ratio;
+	kneeDecibels = knee;
+	quietLevel = DecibelsToGain(thresholdDecibels - kneeDecibels / 2.0f);
+	attackCoefficient = TimeCoefficient(attack, format.sampleRate);
+	releaseCoefficient = TimeCoefficient(release, format.sampleRate);
+	makeupDecibels = makeup;
+}
+
+void AudioPlay::Compressor::Reset()
+{
+	reduction = 0.0f;
+	reductionMeter = 0.0f;
+}
+
+void AudioPlay::Compressor::Process(_Inout_updates_(frameCount * format.channels) float* frames, _In_ UINT32 frameCount, _In_ const PcmFormat& format)
+{
+	UINT32 channels = format.channels;
+	float halfKnee = kneeDecibels / 2.0f;
+
+	for (UINT32 frame = 0; frame < frameCount; frame++)
+	{
+		float* sample = frames + static_cast<size_t>(frame) * channels;
+
+		float peak = FramePeak(sample, channels);
+		float target = 0.0f;
+
+		if (peak > quietLevel)
+		{
+			float over = decibelsPerOctave * std::log2(peak) - thresholdDecibels;
+
+			if (over >= halfKnee)
+			{
+				target = slope * over;
+			}
+			else if (kneeDecibels > 0.0f)
+			{
+				// Inside the knee the ratio fades in quadratically
+				float into = over + halfKnee;
+				target = slope * into * into / (2.0f * kneeDecibels);
+			}
+		}
+
+		float coefficient = target > reduction ? attackCoefficient : releaseCoefficient;
+		reduction = target + (reduction - target) * coefficient;
+
+		float frameGain = std::exp2((makeupDecibels - reduction) / decibelsPerOctave);
+		for (UINT32 channel = 0; channel < channels; channel++)
+		{
+			sample[channel] *= frameGain;
+		}
+	}
+
+	reductionMeter.store(reduction, std::memory_order_relaxed);
+}
@@ -0,0 +1,301 @@
+#include "EncodedFileCache.h"
+#include "PosixUtil.h"
+
+#include <cstring>
+#include <new>
+
+#ifndef _WIN32
+#include <cerrno>
+#include <sys/stat.h>
+#endif
+
+
+#define HR_FAIL_ACTION(hresult, action) if (FAILED(hresult)) { action; return hresult; }
+#define HR_FAIL(hresult) if (FAILED(hresult)) { return hresult; }
+
+
+namespace
+{
+	// Owns a copy of the file, the mapping is closed once it is read so the file can be changed or deleted
+	class HeapMemoryBlock : public AudioPlay::MemoryBlock
+	{
+		public:
+		HeapMemoryBlock(_In_reads_bytes_(size) const BYTE* data, _In_ UINT64 size) : MemoryBlock(data, size) { }
+		~HeapMemoryBlock() { delete[] data; }
+	};
+
+}
+
+
+AudioPlay::EncodedFileCache::EncodedFileCache() :
+	maxBytes(defaultMaxBytes), maxFileBytes(defaultMaxFileBytes), statistics{ }
+{
+}
+
+AudioPlay::EncodedFileCache& AudioPlay::EncodedFileCache::Get()
+{
+	static EncodedFileCache instance;
+
+	return instance;
+}
+
+HRESULT AudioPlay::EncodedFileCache::ReadFileInfo(_In_z_ LPCWCH path, _Out_ UINT64& modified, _Out_ UINT64& size)
+{
+	modified = 0;
+	size = 0;
+
+	#ifdef _WIN32
+	WIN32_FILE_ATTRIBUTE_DATA attributes = { };
+
+	if (!GetFileAttributesExW(path, GetFileExInfoStandard, &attributes))
+	{
+		return HRESULT_FROM_WIN32(GetLastError());
+	}
+
+	if (attributes.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY)
+	{
+		return HRESULT_FROM_WIN32(ERROR_ACCESS_DENIED);
+	}
+
+	modified = (static_cast<UINT64>(attributes.ftLastWriteTime.dwHighDateTime) << 32) | attributes.ftLastWriteTime.dwLowDateTime;
+	size = (static_cast<UINT64>(attributes.nFileSizeHigh) << 32) | attributes.nFileSizeLow;
+	#else
+	char* narrowPath = nullptr;
+	HRESULT hr = NarrowPath(path, &narrowPath); HR_FAIL(hr);
+
+	struct stat status;
+	int result = stat(narrowPath, &status);
+
+	delete[] narrowPath;
+
+	if (result != 0)
+	{
+		return HResultFromErrno(errno);
+	}
+
+	if (!S_ISREG(status.st_mode))
+	{
+		return HRESULT_FROM_WIN32(ERROR_ACCESS_DENIED);
+	}
+
+	modified = static_cast<UINT64>(status.st_mtim.tv_sec) * 1000000000 + static_cast<UINT64>(status.st_mtim.tv_nsec);
+	size = static_cast<UINT64>(status.st_size);
+	#endif
+
+	return S_OK;
+}
+
+HRESULT AudioPlay::EncodedFileCache::Load(_In_z_ LPCWCH path, _In_ UINT64 size, _COM_Outptr_ MemoryBlock** pPtrBlock)
+{
+	*pPtrBlock = nullptr;
+
+	ComPtr<MappedFile> mappedFile;
+
+	HRESULT hr = MappedFile::Open(path, &mappedFile); HR_FAIL(hr);
+
+	// Changed since its size was read, the next Open sees the new modification time and reads it again
+	if (mappedFile->GetSize() != size)
+	{
+		return HRESULT_FROM_WIN32(ERROR_FILE_NOT_FOUND);
+	}
+
+	BYTE* data = nullptr;
+
+	if (size != 0)
+	{
+		data = new (std::nothrow) BYTE[static_cast<size_t>(size)];
+
+		if (data == nullptr)
+		{
+			return E_OUTOFMEMORY;
+		}
+
+		memcpy(data, mappedFile->GetData(), static_cast<size_t>(size));
+	}
+
+	MemoryBlock* block = new (std::nothrow) HeapMemoryBlock(data, size);
+
+	if (block == nullptr)
+	{
+		delete[] data;
+		return E_OUTOFMEMORY;
+	}
+
+	*pPtrBlock = block;
+
+	return S_OK;
+}
+
+void AudioPlay::EncodedFileCache::Remove(_In_ std::list<Entry>::iterator entry)
+{
+	statistics.usedBytes -= entry->size;
+	index.erase(entry->path);
+	entries.erase(entry);
+}
+
+void AudioPlay::EncodedFileCache::Evict(_In_ UINT64 budget)
+{
+	while (statistics.usedBytes > budget && !entries.empty())
+	{
+		Remove(std::prev(entries.end()));
+		statistics.evictions++;
+	}
+}
+
+HRESULT AudioPlay::EncodedFileCache::Open(_In_z_ LPCWCH path, _COM_Outptr_result_maybenull_ MemoryBlock** pPtrBlock)
+{
+	if (pPtrBlock == nullptr || path == nullptr)
+	{
+		return E_POINTER;
+	}
+	*pPtrBlock = nullptr;
+
+	UINT64 modified = 0;
+	UINT64 size = 0;
+
+	HRESULT hr = ReadFileInfo(path, modified, size); HR_FAIL(hr);
+
+	try
+	{
+		std::wstring key = path;
+
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+
+			auto found = index.find(key);
+
+			if (found != index.end())
+			{
+				auto entry = found->second;
+
+				if (entry->modified == modified && entry->size == size)
+				{
+					entries.splice(entries.begin(), entries, entry);
+
+					statistics.hits++;
+					statistics.bytesSaved += size;
+
+					*pPtrBlock = entry->block;
+					(*pPtrBlock)->AddRef();
+
+					return S_OK;
+				}
+
+				Remove(entry);
+				statistics.reloads++;
+			}
+
+			if (size > maxFileBytes || size > maxBytes)
+			{
+				statistics.skipped++;
+				return S_FALSE;
+			}
+
+			statistics.misses++;
+		}
+
+		// Read without the lock, players opening other cached files don't wait for the disk
+		ComPtr<MemoryBlock> block;
+		hr = Load(path, size, &block); HR_FAIL(hr);
+
+		std::lock_guard<std::mutex> lock(mutex);
+
+		statistics.bytesLoaded += size;
+
+		// Another player may have read it at the same time
+		auto found = index.find(key);
+
+		if (found != index.end())
+		{
+			Remove(found->second);
+		}
+
+		// The limits may have changed while it was read
+		if (size <= maxFileBytes && size <= maxBytes)
+		{
+			Evict(maxBytes - size);
+
+			entries.push_front({ key, modified, size, block });
+			index[key] = entries.begin();
+			statistics.usedBytes += size;
+		}
+
+		*pPtrBlock = block.Detach();
+	}
+	catch (const std::bad_alloc&)
+	{
+		return E_OUTOFMEMORY;
+	}
+
+	return S_OK;
+}
+
+void AudioPlay::EncodedFileCache::SetLimits(_In_ UINT64 p_maxBytes, _In_ UINT64 p_maxFileBytes)
+{
+	std::lock_guard<std::mutex> lock(mutex);
+
+	maxBytes = p_maxBytes;
+	maxFileBytes = p_maxFileBytes;
+
+	Evict(maxBytes);
+
+	for (auto entry = entries.begin(); entry != entries.end();)
+	{
+		auto next = std::next(entry);
+
+		if (entry->size > maxFileBytes)
+		{
+			Remove(entry);
+			statistics.evictions++;
+		}
+
+		entry = next;
+	}
+}
+
+HRESULT AudioPlay::EncodedFileCache::Invalidate(_In_z_ LPCWCH path)
+{
+	if (path == nullptr)
+	{
+		return E_POINTER;
+	}
+
+	try
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+
+		auto found = index.find(path);
+
+		if (found == index.end())
+		{
+			return S_FALSE;
+		}
+
+		Remove(found->second);
+	}
+	catch (const std::bad_alloc&)
+	{
+		return E_OUTOFMEMORY;
+	}
+
+	return S_OK;
+}
+
+void AudioPlay::EncodedFileCache::Clear()
+{
+	std::lock_guard<std::mutex> lock(mutex);
+
+	index.clear();
+	entries.clear();
+	statistics.usedBytes = 0;
+}
+
+AudioPlay::EncodedFileCacheStatistics AudioPlay::EncodedFileCache::GetStatistics()
+{
+	std::lock_guard<std::mutex> lock(mutex);
+
+	EncodedFileCacheStatistics result = statistics;
+	result.entryCount = static_cast<UINT32>(entries.size());
+
+	return result;
+}
@@ -0,0 +1,288 @@
+#include "EventTrace.h"
+#include "PosixUtil.h"
+
+#include <cerrno>
+#include <cstdint>
+#include <cstdio>
+#include <new>
+
+
+#define HR_FAIL_ACTION(hresult, action) if (FAILED(hresult)) { action; return hresult; }
+#define HR_FAIL(hresult) if (FAILED(hresult)) { return hresult; }
+
+
+using std::chrono::duration_cast;
+using std::chrono::nanoseconds;
+using std::chrono::steady_clock;
+
+
+AudioPlay::EventTraceRecorder::EventTraceRecorder() :
+	referenceCount(1), records(nullptr), capacity(0), recordCount(0), origin(steady_clock::now()),
+	openCause(noCause), startCause(noCause), pauseCause(noCause), stopCause(noCause), closeCause(noCause)
+{
+}
+
+AudioPlay::EventTraceRecorder::~EventTraceRecorder()
+{
+	delete[] records;
+}
+
+HRESULT AudioPlay::EventTraceRecorder::Create(_In_ UINT32 p_capacity, _COM_Outptr_ EventTraceRecorder** pPtrRecorder)
+{
+	if (pPtrRecorder == nullptr)
+	{
+		return E_POINTER;
+	}
+	*pPtrRecorder = nullptr;
+
+	if (p_capacity == 0 || p_capacity > maxCapacity)
+	{
+		return E_INVALIDARG;
+	}
+
+	UINT32 rounded = 1;
+
+	while (rounded < p_capacity)
+	{
+		rounded <<= 1;
+	}
+
+	EventTraceRecorder* recorder = new (std::nothrow) EventTraceRecorder();
+
+	if (recorder == nullptr)
+	{
+		return E_OUTOFMEMORY;
+	}
+
+	recorder->records = new (std::nothrow) EventTraceRecord[rounded];
+
+	if (recorder->records == nullptr)
+	{
+		recorder->Release();
+		return E_OUTOFMEMORY;
+	}
+
+	recorder->capacity = rounded;
+
+	*pPtrRecorder = recorder;
+
+	return S_OK;
+}
+
+ULONG STDMETHODCALLTYPE AudioPlay::EventTraceRecorder::AddRef()
+{
+	return ++referenceCount;
+}
+
+ULONG STDMETHODCALLTYPE AudioPlay::EventTraceRecorder::Release()
+{
+	ULONG newRefCount = --referenceCount;
+
+	if (newRefCount == 0)
+	{
+		delete this;
+	}
+
+	return newRefCount;
+}
+
+void AudioPlay::EventTraceRecorder::Append(_In_ EventTraceKind kind, _In_ UINT32 code, _In_ HRESULT status, _In_ INT32 argument, _In_ UINT32 state, _In_ UINT32 cause,
+	_In_ steady_clock::time_point time)
+{
+	EventTraceRecord& record = records[recordCount & (capacity - 1)];
+
+	record.timestamp = time > origin ? duration_cast<nanoseconds>(time - origin).count() : 0;
+	record.sequence = static_cast<UINT32>(recordCount);
+	record.cause = cause;
+	record.status = status;
+	record.code = code;
+	record.argument = argument;
+	record.state = static_cast<UINT16>(state);
+	record.kind = kind;
+	record.reserved = 0;
+
+	recordCount++;
+}
+
+void AudioPlay::EventTraceRecorder::RecordCommand(_In_ EventTraceCommand command, _In_ INT32 argument, _In_ HRESULT result, _In_ UINT32 state)
+{
+	steady_clock::time_point now = steady_clock::now();
+
+	std::lock_guard<std::mutex> lock(mutex);
+
+	UINT32 sequence = static_cast<UINT32>(recordCount);
+
+	// Failed commands send nothing to the session, nothing answers them
+	if (SUCCEEDED(result))
+	{
+		switch (command)
+		{
+			case EventTraceCommand::Open: openCause = sequence; break;
+			case EventTraceCommand::Start:
+			case EventTraceCommand::StartAt:
+			case EventTraceCommand::Seek: startCause = sequence; break;
+			case EventTraceCommand::Pause: pauseCause = sequence; break;
+			case EventTraceCommand::Stop: stopCause = sequence; break;
+			case EventTraceCommand::Close: closeCause = sequence; break;
+			default: break;
+		}
+	}
+
+	Append(EventTraceKind::Command, static_cast<UINT32>(command), result, argument, state, noCause, now);
+}
+
+void AudioPlay::EventTraceRecorder::RecordEvent(_In_ MediaEventType type, _In_ HRESULT status, _In_ UINT32 state)
+{
+	steady_clock::time_point now = steady_clock::now();
+
+	std::lock_guard<std::mutex> lock(mutex);
+
+	UINT32 cause = noCause;
+
+	// Every command is answered once, later events of the same type come from the session itself
+	switch (type)
+	{
+		case MESessionTopologySet:
+		case MESessionCapabilitiesChanged: cause = openCause; break;
+		case MESessionStarted: cause = startCause; startCause = noCause; break;
+		case MESessionPaused: cause = pauseCause; pauseCause = noCause; break;
+		case MESessionStopped: cause = stopCause; stopCause = noCause; break;
+		case MESessionClosed: cause = closeCause; closeCause = noCause; break;
+	}
+
+	// Capabilities also change while playing, only the first ones after opening answer it
+	if (type == MESessionCapabilitiesChanged)
+	{
+		openCause = noCause;
+	}
+
+	Append(EventTraceKind::Event, type, status, 0, state, cause, now);
+}
+
+void AudioPlay::EventTraceRecorder::RecordHandler(_In_ MediaEventType type, _In_ HRESULT result, _In_ steady_clock::time_point started, _In_ UINT32 state)
+{
+	steady_clock::time_point now = steady_clock::now();
+
+	INT64 elapsed = duration_cast<nanoseconds>(now - started).count();
+	INT32 argument = elapsed > INT32_MAX ? INT32_MAX : static_cast<INT32>(elapsed);
+
+	std::lock_guard<std::mutex> lock(mutex);
+
+	Append(EventTraceKind::Handler, type, result, argument, state, noCause, started);
+}
+
+UINT64 AudioPlay::EventTraceRecorder::GetRecordCount() const
+{
+	std::lock_guard<std::mutex> lock(mutex);
+
+	return recordCount;
+}
+
+HRESULT AudioPlay::EventTraceRecorder::Snapshot(_Out_ std::vector<EventTraceRecord>& snapshot, _Out_opt_ UINT64* lostRecords) const
+{
+	try
+	{
+		snapshot.clear();
+		snapshot.reserve(capacity);
+
+		std::lock_guard<std::mutex> lock(mutex);
+
+		UINT64 first = recordCount > capacity ? recordCount - capacity : 0;
+
+		for (UINT64 index = first; index < recordCount; index++)
+		{
+			snapshot.push_back(records[index & (capacity - 1)]);
+		}
+
+		if (lostRecords)
+		{
+			*lostRecords = first;
+		}
+	}
+	catch (const std::bad_alloc&)
+	{
+		return E_OUTOFMEMORY;
+	}
+
+	return S_OK;
+}
+
+HRESULT AudioPlay::EventTraceRecorder::Dump(_In_z_ LPCWCH path) const
+{
+	if (path == nullptr)
+	{
+		return E_POINTER;
+	}
+
+	std::vector<EventTraceRecord> snapshot;
+	UINT64 lostRecords = 0;
+
+	HRESULT hr = Snapshot(snapshot, &lostRecords); HR_FAIL(hr);
+
+	EventTraceFileHeader header = { magic, version, sizeof(EventTraceRecord), static_cast<UINT32>(snapshot.size()), lostRecords, 0 };
+
+	FILE* file = OpenFileStream(path, "wb");
+
+	if (file == nullptr)
+	{
+		return HResultFromErrno(errno);
+	}
+
+	bool written = fwrite(&header, sizeof(header), 1, file) == 1 &&
+		fwrite(snapshot.data(), sizeof(EventTraceRecord), snapshot.size(), file) == snapshot.size();
+
+	if (fclose(file) != 0 || !written)
+	{
+		return HRESULT_FROM_WIN32(ERROR_WRITE_FAULT);
+	}
+
+	return S_OK;
+}
+
+HRESULT AudioPlay::LoadEventTrace(_In_z_ LPCWCH path, _Out_ std::vector<EventTraceRecord>& records)
+{
+	records.clear();
+
+	if (path == nullptr)
+	{
+		return E_POINTER;
+	}
+
+	FILE* file = OpenFileStream(path, "rb");
+
+	if (file == nullptr)
+	{
+		return HResultFromErrno(errno);
+	}
+
+	HRESULT hr = S_OK;
+	EventTraceFileHeader header = { };
+
+	if (fread(&header, sizeof(header), 1, file) != 1 || header.magic != EventTraceRecorder::magic ||
+		header.version != EventTraceRecorder::version || header.recordSize != sizeof(EventTraceRecord) || header.recordCount > EventTraceRecorder::maxCapacity)
+	{
+		hr = HRESULT_FROM_WIN32(ERROR_INVALID_DATA);
+	}
+
+	if (SUCCEEDED(hr))
+	{
+		try
+		{
+			records.resize(header.recordCount);
+
+			if (fread(records.data(), sizeof(EventTraceRecord), records.size(), file) != records.size())
+			{
+				records.clear();
+				hr = HRESULT_FROM_WIN32(ERROR_INVALID_DATA);
+			}
+		}
+		catch (const std::bad_alloc&)
+		{
+			hr = E_OUTOFMEMORY;
+		}
+	}
+
+	fclose(file);
+
+	return hr;
+}
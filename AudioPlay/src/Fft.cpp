@@ -0,0 +1,268 @@
+#include "Fft.h"
+#include "Simd.h"
+
+#include <chrono>
+#include <cmath>
+#include <new>
+
+
+#define HR_FAIL_ACTION(hresult, action) if (FAILED(hresult)) { action; return hresult; }
+#define HR_FAIL(hresult) if (FAILED(hresult)) { return hresult; }
+
+
+using std::chrono::duration_cast;
+using std::chrono::nanoseconds;
+using std::chrono::steady_clock;
+
+
+namespace
+{
+	constexpr double pi = 3.14159265358979323846;
+}
+
+
+AudioPlay::RealFft::RealFft() :
+	size(0), half(0), bitReverse(nullptr), twiddleReal(nullptr), twiddleImaginary(nullptr),
+	splitReal(nullptr), splitImaginary(nullptr), workReal(nullptr), workImaginary(nullptr)
+{
+}
+
+AudioPlay::RealFft::~RealFft()
+{
+	Release();
+}
+
+void AudioPlay::RealFft::Release()
+{
+	delete[] bitReverse;
+	delete[] twiddleReal;
+	delete[] twiddleImaginary;
+	delete[] splitReal;
+	delete[] splitImaginary;
+	delete[] workReal;
+	delete[] workImaginary;
+
+	bitReverse = nullptr;
+	twiddleReal = nullptr;
+	twiddleImaginary = nullptr;
+	splitReal = nullptr;
+	splitImaginary = nullptr;
+	workReal = nullptr;
+	workImaginary = nullptr;
+	size = 0;
+	half = 0;
+}
+
+HRESULT AudioPlay::RealFft::Initialize(_In_ UINT32 fftSize)
+{
+	if (fftSize < minSize || fftSize > maxSize || (fftSize & (fftSize - 1)) != 0)
+	{
+		return E_INVALIDARG;
+	}
+
+	Release();
+
+	UINT32 count = fftSize / 2;
+
+	bitReverse = new (std::nothrow) UINT32[count];
+	twiddleReal = new (std::nothrow) float[count];
+	twiddleImaginary = new (std::nothrow) float[count];
+	splitReal = new (std::nothrow) float[count];
+	splitImaginary = new (std::nothrow) float[count];
+	workReal = new (std::nothrow) float[count];
+	workImaginary = new (std::nothrow) float[count];
+
+	if (!bitReverse || !twiddleReal || !twiddleImaginary || !splitReal || !splitImaginary || !workReal || !workImaginary)
+	{
+		Release();
+		return E_OUTOFMEMORY;
+	}
+
+	size = fftSize;
+	half = count;
+
+	UINT32 bits = 0;
+	while ((1u << bits) < half)
+	{
+		bits++;
+	}
+
+	for (UINT32 index = 0; index < half; index++)
+	{
+		UINT32 reversed = 0;
+		for (UINT32 bit = 0; bit < bits; bit++)
+		{
+			reversed |= ((index >> bit) & 1) << (bits - 1 - bit);
+		}
+		bitReverse[index] = reversed;
+	}
+
+	UINT32 offset = 0;
+	for (UINT32 length = 8; length <= half; length *= 2)
+	{
+		for (UINT32 index = 0; index < length / 2; index++)
+		{
+			double angle = -2.0 * pi * index / length;
+			twiddleReal[offset + index] = static_cast<float>(std::cos(angle));
+			twiddleImaginary[offset + index] = static_cast<float>(std::sin(angle));
+		}
+		offset += length / 2;
+	}
+
+	for (UINT32 index = 0; index < half; index++)
+	{
+		double angle = -2.0 * pi * index / size;
+		splitReal[index] = static_cast<float>(std::cos(angle));
+		splitImaginary[index] = static_cast<float>(std::sin(angle));
+	}
+
+	return S_OK;
+}
+
+void AudioPlay::RealFft::Forward(_In_reads_(size) const float* input, _Out_writes_(half + 1) float* real, _Out_writes_(half + 1) float* imaginary)
+{
+	float* re = workReal;
+	float* im = workImaginary;
+
+	// Even samples are the real part and odd ones the imaginary part of the half size transform
+	for (UINT32 index = 0; index < half; index++)
+	{
+		re[bitReverse[index]] = input[2 * index];
+		im[bitReverse[index]] = input[2 * index + 1];
+	}
+
+	// The first two stages together, their twiddles are 1 and -i
+	for (UINT32 index = 0; index < half; index += 4)
+	{
+		float r0 = re[index] + re[index + 1], i0 = im[index] + im[index + 1];
+		float r1 = re[index] - re[index + 1], i1 = im[index] - im[index + 1];
+		float r2 = re[index + 2] + re[index + 3], i2 = im[index + 2] + im[index + 3];
+		float r3 = re[index + 2] - re[index + 3], i3 = im[index + 2] - im[index + 3];
+
+		re[index] = r0 + r2;
+		im[index] = i0 + i2;
+		re[index + 2] = r0 - r2;
+		im[index + 2] = i0 - i2;
+		re[index + 1] = r1 + i3;
+		im[index + 1] = i1 - r3;
+		re[index + 3] = r1 - i3;
+		im[index + 3] = i1 + r3;
+	}
+
+	const float* stageReal = twiddleReal;
+	const float* stageImaginary = twiddleImaginary;
+
+	for (UINT32 length = 8; length <= half; length *= 2)
+	{
+		UINT32 span = length / 2;
+
+		for (UINT32 start = 0; start < half; start += length)
+		{
+			float* topReal = re + start;
+			float* topImaginary = im + start;
+			float* bottomReal = topReal + span;
+			float* bottomImaginary = topImaginary + span;
+
+			#ifdef AUDIOPLAY_SSE2
+			for (UINT32 index = 0; index < span; index += 4)
+			{
+				__m128 wr = _mm_loadu_ps(stageReal + index);
+				__m128 wi = _mm_loadu_ps(stageImaginary + index);
+				__m128 vr = _mm_loadu_ps(bottomReal + index);
+				__m128 vi = _mm_loadu_ps(bottomImaginary + index);
+				__m128 ur = _mm_loadu_ps(topReal + index);
+				__m128 ui = _mm_loadu_ps(topImaginary + index);
+
+				__m128 tr = _mm_sub_ps(_mm_mul_ps(vr, wr), _mm_mul_ps(vi, wi));
+				__m128 ti = _mm_add_ps(_mm_mul_ps(vr, wi), _mm_mul_ps(vi, wr));
+
+				_mm_storeu_ps(topReal + index, _mm_add_ps(ur, tr));
+				_mm_storeu_ps(topImaginary + index, _mm_add_ps(ui, ti));
+				_mm_storeu_ps(bottomReal + index, _mm_sub_ps(ur, tr));
+				_mm_storeu_ps(bottomImaginary + index, _mm_sub_ps(ui, ti));
+			}
+			#else
+			for (UINT32 index = 0; index < span; index++)
+			{
+				float tr = bottomReal[index] * stageReal[index] - bottomImaginary[index] * stageImaginary[index];
+				float ti = bottomReal[index] * stageImaginary[index] + bottomImaginary[index] * stageReal[index];
+
+				bottomReal[index] = topReal[index] - tr;
+				bottomImaginary[index] = topImaginary[index] - ti;
+				topReal[index] += tr;
+				topImaginary[index] += ti;
+			}
+			#endif
+		}
+
+		stageReal += span;
+		stageImaginary += span;
+	}
+
+	// X[k] = (Z[k] + conj(Z[N/2 - k])) / 2 - i * W^k * (Z[k] - conj(Z[N/2 - k])) / 2
+	real[0] = re[0] + im[0];
+	imaginary[0] = 0.0f;
+	real[half] = re[0] - im[0];
+	imaginary[half] = 0.0f;
+
+	for (UINT32 index = 1; index < half; index++)
+	{
+		float ar = re[index], ai = im[index];
+		float br = re[half - index], bi = -im[half - index];
+
+		float evenReal = (ar + br) * 0.5f, evenImaginary = (ai + bi) * 0.5f;
+		float oddReal = (ar - br) * 0.5f, oddImaginary = (ai - bi) * 0.5f;
+
+		// -i * W^k * odd
+		float wr = splitReal[index], wi = splitImaginary[index];
+		float tr = oddReal * wr - oddImaginary * wi;
+		float ti = oddReal * wi + oddImaginary * wr;
+
+		real[index] = evenReal + ti;
+		imaginary[index] = evenImaginary - tr;
+	}
+}
+
+HRESULT AudioPlay::MeasureFft(_In_ UINT32 fftSize, _In_ UINT32 iterations, _Out_ double& nanosecondsPerTransform)
+{
+	nanosecondsPerTransform = 0.0;
+
+	if (iterations == 0)
+	{
+		return E_INVALIDARG;
+	}
+
+	RealFft fft;
+	HRESULT hr = fft.Initialize(fftSize); HR_FAIL(hr);
+
+	float* buffers = new (std::nothrow) float[fftSize + 2 * fft.GetBinCount()];
+
+	if (buffers == nullptr)
+	{
+		return E_OUTOFMEMORY;
+	}
+
+	float* input = buffers;
+	float* real = input + fftSize;
+	float* imaginary = real + fft.GetBinCount();
+
+	for (UINT32 index = 0; index < fftSize; index++)
+	{
+		input[index] = static_cast<float>(std::sin(index * 0.37) + 0.5 * std::sin(index * 1.91));
+	}
+
+	fft.Forward(input, real, imaginary);
+
+	steady_clock::time_point start = steady_clock::now();
+
+	for (UINT32 iteration = 0; iteration < iterations; iteration++)
+	{
+		fft.Forward(input, real, imaginary);
+	}
+
+	nanosecondsPerTransform = static_cast<double>(duration_cast<nanoseconds>(steady_clock::now() - start).count()) / iterations;
+
+	delete[] buffers;
+
+	return hr;
+}
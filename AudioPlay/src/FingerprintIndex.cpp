@@ -0,0 +1,421 @@
+#include "FingerprintIndex.h"
+
+#include <algorithm>
+#include <new>
+#include <unordered_map>
+
+
+#define HR_FAIL_ACTION(hresult, action) if (FAILED(hresult)) { action; return hresult; }
+#define HR_FAIL(hresult) if (FAILED(hresult)) { return hresult; }
+
+
+namespace
+{
+	// Candidates confirmed per lookup, the ones with the most votes
+	// Different encodes share few exact hashes, a single hit is enough to be confirmed if there aren't better candidates
+	constexpr size_t maxCandidates = 32;
+	// Entries per task of FindDuplicates
+	constexpr UINT32 duplicateBatchSize = 256;
+	constexpr UINT32 halfValues = 0x10000;
+
+	UINT32 CountBits(UINT32 value)
+	{
+		value = value - ((value >> 1) & 0x55555555);
+		value = (value & 0x33333333) + ((value >> 2) & 0x33333333);
+		return (((value + (value >> 4)) & 0x0F0F0F0F) * 0x01010101) >> 24;
+	}
+}
+
+
+AudioPlay::FingerprintIndex::FingerprintIndex() :
+	referenceCount(1), indexStride(defaultIndexStride), built(false)
+{
+}
+
+HRESULT AudioPlay::FingerprintIndex::Create(_In_ UINT32 indexStride, _COM_Outptr_ FingerprintIndex** pPtrIndex)
+{
+	if (pPtrIndex == nullptr)
+	{
+		return E_INVALIDARG;
+	}
+	*pPtrIndex = nullptr;
+
+	if (indexStride == 0 || indexStride > minOverlap)
+	{
+		return E_INVALIDARG;
+	}
+
+	FingerprintIndex* index = new (std::nothrow) FingerprintIndex();
+
+	if (index == nullptr)
+	{
+		return E_OUTOFMEMORY;
+	}
+
+	index->indexStride = indexStride;
+
+	*pPtrIndex = index;
+
+	return S_OK;
+}
+
+ULONG STDMETHODCALLTYPE AudioPlay::FingerprintIndex::AddRef()
+{
+	return ++referenceCount;
+}
+
+ULONG STDMETHODCALLTYPE AudioPlay::FingerprintIndex::Release()
+{
+	ULONG count = --referenceCount;
+	if (count == 0)
+	{
+		delete this;
+	}
+	return count;
+}
+
+HRESULT AudioPlay::FingerprintIndex::Add(_In_ UINT64 id, _In_ const Fingerprint& fingerprint)
+{
+	if (fingerprint.hashes.empty() || fingerprint.hashes.size() > 0xFFFFFFFF)
+	{
+		return E_INVALIDARG;
+	}
+
+	std::lock_guard<std::mutex> lock(mutex);
+
+	if (entries.size() >= 0xFFFFFFFF)
+	{
+		return E_OUTOFMEMORY;
+	}
+
+	UINT32 count = static_cast<UINT32>(fingerprint.hashes.size());
+	UINT32 entry = static_cast<UINT32>(entries.size());
+	size_t hashCount = hashes.size();
+	size_t postingCount = postings.size();
+
+	try
+	{
+		hashes.insert(hashes.end(), fingerprint.hashes.begin(), fingerprint.hashes.end());
+
+		for (UINT32 offset = 0; offset < count; offset += indexStride)
+		{
+			postings.push_back({ fingerprint.hashes[offset], entry, offset });
+		}
+
+		entries.push_back({ id, hashCount, count, fingerprint.durationMilliseconds });
+	}
+	catch (const std::bad_alloc&)
+	{
+		hashes.resize(hashCount);
+		postings.resize(postingCount);
+		return E_OUTOFMEMORY;
+	}
+
+	built = false;
+
+	return S_OK;
+}
+
+HRESULT AudioPlay::FingerprintIndex::Build()
+{
+	std::lock_guard<std::mutex> lock(mutex);
+
+	try
+	{
+		// Stable so the postings of a hash stay in the order the entries were added
+		std::stable_sort(postings.begin(), postings.end());
+
+		size_t kept = 0;
+
+		for (size_t first = 0, last = 0; first < postings.size(); first = last)
+		{
+			last = std::upper_bound(postings.begin() + first, postings.end(), postings[first]) - postings.begin();
+
+			if (last - first <= maxPostingsPerHash)
+			{
+				std::copy(postings.begin() + first, postings.begin() + last, postings.begin() + kept);
+				kept += last - first;
+			}
+		}
+
+		postings.resize(kept);
+
+		lowPostings = postings;
+		std::stable_sort(lowPostings.begin(), lowPostings.end(), [](const Posting& a, const Posting& b) { return (a.hash & 0xFFFF) < (b.hash & 0xFFFF); });
+
+		highBuckets.assign(halfValues + 1, 0);
+		lowBuckets.assign(halfValues + 1, 0);
+
+		for (size_t index = 0; index < postings.size(); index++)
+		{
+			highBuckets[(postings[index].hash >> 16) + 1]++;
+			lowBuckets[(lowPostings[index].hash & 0xFFFF) + 1]++;
+		}
+
+		for (UINT32 value = 0; value < halfValues; value++)
+		{
+			highBuckets[value + 1] += highBuckets[value];
+			lowBuckets[value + 1] += lowBuckets[value];
+		}
+	}
+	catch (const std::bad_alloc&)
+	{
+		return E_OUTOFMEMORY;
+	}
+
+	built = true;
+
+	return S_OK;
+}
+
+void AudioPlay::FingerprintIndex::Lookup(_In_reads_(count) const UINT32* query, _In_ UINT32 count, _In_ float minSimilarity, _In_ UINT32 firstEntry,
+	_Out_ std::vector<FingerprintMatch>& matches) const
+{
+	matches.clear();
+
+	// Entry and offset, the offset biased by the query length so it isn't negative
+	std::unordered_map<UINT64, UINT32> votes;
+
+	for (UINT32 position = 0; position < count; position++)
+	{
+		UINT32 hash = query[position];
+
+		// Bits of bands with nearly the same energy flip between encodes, the hashes a bit away vote as well
+		for (UINT32 half = 0; half < 2; half++)
+		{
+			const std::vector<Posting>& sorted = half ? lowPostings : postings;
+			const std::vector<size_t>& buckets = half ? lowBuckets : highBuckets;
+			UINT32 bucket = half ? hash & 0xFFFF : hash >> 16;
+
+			for (size_t index = buckets[bucket]; index < buckets[bucket + 1]; index++)
+			{
+				const Posting& posting = sorted[index];
+				UINT32 difference = posting.hash ^ hash;
+
+				// Further apart, or counted with the upper half already
+				if ((difference & (difference - 1)) != 0 || (half && (difference >> 16) == 0) || posting.entry < firstEntry)
+				{
+					continue;
+				}
+
+				UINT64 offset = static_cast<UINT64>(posting.offset) + count - position;
+				votes[(static_cast<UINT64>(posting.entry) << 32) | offset]++;
+			}
+		}
+	}
+
+	std::vector<std::pair<UINT32, UINT64>> candidates;
+	std::vector<std::pair<UINT32, FingerprintMatch>> found;
+
+	for (const auto& vote : votes)
+	{
+		candidates.push_back({ vote.second, vote.first });
+	}
+
+	if (candidates.size() > maxCandidates)
+	{
+		std::partial_sort(candidates.begin(), candidates.begin() + maxCandidates, candidates.end(),
+			[](const std::pair<UINT32, UINT64>& a, const std::pair<UINT32, UINT64>& b) { return a.first > b.first; });
+		candidates.resize(maxCandidates);
+	}
+
+	for (const auto& candidate : candidates)
+	{
+		const Entry& entry = entries[static_cast<size_t>(candidate.second >> 32)];
+		INT64 offset = static_cast<INT64>(candidate.second & 0xFFFFFFFF) - count;
+
+		// Query hash q lines up with entry hash q + offset
+		INT64 start = offset < 0 ? -offset : 0;
+		INT64 end = static_cast<INT64>(entry.count) - offset < count ? static_cast<INT64>(entry.count) - offset : count;
+
+		if (end <= start)
+		{
+			continue;
+		}
+
+		UINT32 overlap = static_cast<UINT32>(end - start);
+		UINT32 shorter = entry.count < count ? entry.count : count;
+
+		if (overlap < (shorter < minOverlap ? shorter : minOverlap))
+		{
+			continue;
+		}
+
+		const UINT32* stored = hashes.data() + entry.first + offset;
+		UINT64 errors = 0;
+
+		for (INT64 position = start; position < end; position++)
+		{
+			errors += CountBits(query[position] ^ stored[position]);
+		}
+
+		float similarity = 1.0f - static_cast<float>(errors) / (static_cast<float>(overlap) * hashBits);
+
+		if (similarity < minSimilarity)
+		{
+			continue;
+		}
+
+		FingerprintMatch match = { entry.id, similarity, static_cast<INT32>(offset), overlap };
+		UINT32 entryIndex = static_cast<UINT32>(candidate.second >> 32);
+
+		// The best offset of every entry, ids may be shared so entries are told apart by index
+		auto same = std::find_if(found.begin(), found.end(), [entryIndex](const std::pair<UINT32, FingerprintMatch>& other) { return other.first == entryIndex; });
+
+		if (same == found.end())
+		{
+			found.push_back({ entryIndex, match });
+		}
+		else if (same->second.similarity < similarity)
+		{
+			same->second = match;
+		}
+	}
+
+	for (const auto& match : found)
+	{
+		matches.push_back(match.second);
+	}
+
+	std::sort(matches.begin(), matches.end(), [](const FingerprintMatch& a, const FingerprintMatch& b) { return a.similarity > b.similarity; });
+}
+
+HRESULT AudioPlay::FingerprintIndex::Lookup(_In_ const Fingerprint& query, _In_ float minSimilarity, _Out_ std::vector<FingerprintMatch>& matches) const
+{
+	matches.clear();
+
+	if (!built)
+	{
+		return E_NOT_VALID_STATE;
+	}
+
+	if (query.hashes.empty() || query.hashes.size() > 0x7FFFFFFF)
+	{
+		return E_INVALIDARG;
+	}
+
+	try
+	{
+		Lookup(query.hashes.data(), static_cast<UINT32>(query.hashes.size()), minSimilarity, 0, matches);
+	}
+	catch (const std::bad_alloc&)
+	{
+		matches.clear();
+		return E_OUTOFMEMORY;
+	}
+
+	return matches.empty() ? S_FALSE : S_OK;
+}
+
+void AudioPlay::FingerprintIndex::FindDuplicates(_In_ UINT32 first, _In_ UINT32 count, _In_ float minSimilarity, _In_ DuplicateCallback callback, _In_opt_ void* context) const
+{
+	std::vector<FingerprintMatch> matches;
+
+	for (UINT32 index = first; index < first + count; index++)
+	{
+		const Entry& entry = entries[index];
+
+		Lookup(hashes.data() + entry.first, entry.count, minSimilarity, index + 1, matches);
+
+		FingerprintMatch self = { entry.id, 1.0f, 0, entry.count };
+
+		for (const FingerprintMatch& match : matches)
+		{
+			callback(self, match, context);
+		}
+	}
+}
+
+void AudioPlay::FingerprintIndex::RunDuplicateJob(_In_ void* context, _In_ UINT32 worker)
+{
+	UNREFERENCED_PARAMETER(worker);
+
+	DuplicateJob* job = static_cast<DuplicateJob*>(context);
+
+	try
+	{
+		job->index->FindDuplicates(job->first, job->count, job->minSimilarity, job->callback, job->context);
+		job->result = S_OK;
+	}
+	catch (const std::bad_alloc&)
+	{
+		job->result = E_OUTOFMEMORY;
+	}
+}
+
+HRESULT AudioPlay::FingerprintIndex::FindDuplicates(_In_ float minSimilarity, _In_ DuplicateCallback callback, _In_opt_ void* context, _In_opt_ WorkStealingPool* pool) const
+{
+	if (callback == nullptr)
+	{
+		return E_POINTER;
+	}
+
+	if (!built)
+	{
+		return E_NOT_VALID_STATE;
+	}
+
+	UINT32 entryCount = static_cast<UINT32>(entries.size());
+
+	if (pool == nullptr)
+	{
+		try
+		{
+			FindDuplicates(0, entryCount, minSimilarity, callback, context);
+		}
+		catch (const std::bad_alloc&)
+		{
+			return E_OUTOFMEMORY;
+		}
+
+		return S_OK;
+	}
+
+	UINT32 jobCount = (entryCount + duplicateBatchSize - 1) / duplicateBatchSize;
+	DuplicateJob* jobs = new (std::nothrow) DuplicateJob[jobCount];
+
+	if (jobs == nullptr)
+	{
+		return E_OUTOFMEMORY;
+	}
+
+	HRESULT hr = S_OK;
+
+	for (UINT32 index = 0; index < jobCount; index++)
+	{
+		UINT32 first = index * duplicateBatchSize;
+
+		DuplicateJob& job = jobs[index];
+		job.index = this;
+		job.minSimilarity = minSimilarity;
+		job.callback = callback;
+		job.context = context;
+		job.first = first;
+		job.count = entryCount - first < duplicateBatchSize ? entryCount - first : duplicateBatchSize;
+		job.result = E_PENDING;
+
+		hr = pool->Submit(RunDuplicateJob, &job);
+
+		if (FAILED(hr))
+		{
+			break;
+		}
+	}
+
+	pool->Wait();
+
+	for (UINT32 index = 0; index < jobCount && SUCCEEDED(hr); index++)
+	{
+		hr = jobs[index].result;
+	}
+
+	delete[] jobs;
+
+	return hr;
+}
+
+UINT64 AudioPlay::FingerprintIndex::GetMemoryUsage() const
+{
+	return hashes.capacity() * sizeof(UINT32) + entries.capacity() * sizeof(Entry) + (postings.capacity() + lowPostings.capacity()) * sizeof(Posting) +
+		(highBuckets.capacity() + lowBuckets.capacity()) * sizeof(size_t);
+}
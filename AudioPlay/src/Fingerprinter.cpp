@@ -0,0 +1,513 @@
+#include "Fingerprinter.h"
+#include "NativeSource.h"
+
+#ifdef _WIN32
+#include "SourceReaderPcmSource.h"
+#endif
+
+#include <cmath>
+#include <cstring>
+#include <new>
+
+
+#define HR_FAIL_ACTION(hresult, action) if (FAILED(hresult)) { action; return hresult; }
+#define HR_FAIL(hresult) if (FAILED(hresult)) { return hresult; }
+
+
+namespace
+{
+	constexpr double pi = 3.14159265358979323846;
+	constexpr double lowestBand = 300.0;
+	constexpr double highestBand = 3000.0;
+	// Passed unchanged up to a little above the highest band, gone by half the output rate so nothing folds back into the bands
+	constexpr double passband = 3300.0;
+
+	constexpr UINT32 bandCount = AudioPlay::FingerprintIndex::hashBits + 1;
+	// Enough for the frame being hashed and what one read resamples to
+	constexpr UINT32 resampledCapacity = AudioPlay::Fingerprinter::frameSize + 2 * AudioPlay::Fingerprinter::decodeFrames + 2;
+}
+
+
+AudioPlay::Fingerprinter::Fingerprinter() :
+	window(nullptr), frame(nullptr), real(nullptr), imaginary(nullptr), bandStart{ }, differences{ }, frameIndex(0),
+	decoded(nullptr), resampled(nullptr), resampledCount(0), kernelHalfWidth(0), historyStart(0),
+	inputFrames(0), inputRate(0), outputSamples(0), audible(false)
+{
+}
+
+AudioPlay::Fingerprinter::~Fingerprinter()
+{
+	delete[] window;
+	delete[] frame;
+	delete[] real;
+	delete[] imaginary;
+	delete[] decoded;
+	delete[] resampled;
+}
+
+HRESULT AudioPlay::Fingerprinter::Initialize()
+{
+	HRESULT hr = fft.Initialize(frameSize); HR_FAIL(hr);
+
+	if (window == nullptr)
+	{
+		window = new (std::nothrow) float[frameSize];
+		frame = new (std::nothrow) float[frameSize];
+		real = new (std::nothrow) float[frameSize / 2 + 1];
+		imaginary = new (std::nothrow) float[frameSize / 2 + 1];
+		decoded = new (std::nothrow) float[decodeFrames * maxChannels];
+		resampled = new (std::nothrow) float[resampledCapacity];
+	}
+
+	if (!window || !frame || !real || !imaginary || !decoded || !resampled)
+	{
+		return E_OUTOFMEMORY;
+	}
+
+	for (UINT32 index = 0; index < frameSize; index++)
+	{
+		window[index] = static_cast<float>(0.5 - 0.5 * std::cos(2.0 * pi * index / frameSize));
+	}
+
+	// Equal steps on a log scale, every band at least a bin wide
+	for (UINT32 band = 0; band <= bandCount; band++)
+	{
+		double frequency = lowestBand * std::pow(highestBand / lowestBand, static_cast<double>(band) / bandCount);
+		UINT32 bin = static_cast<UINT32>(frequency * frameSize / sampleRate + 0.5);
+
+		bandStart[band] = band && bin <= bandStart[band - 1] ? bandStart[band - 1] + 1 : bin;
+	}
+
+	return hr;
+}
+
+void AudioPlay::Fingerprinter::DesignKernel(_In_ UINT32 rate)
+{
+	// Below the output rate the source's own Nyquist frequency is the limit
+	double stop = rate < sampleRate ? rate / 2.0 : sampleRate / 2.0;
+	double pass = passband < 0.8 * stop ? passband : 0.8 * stop;
+	double cutoff = (pass + stop) / 2.0 / rate;
+
+	// A Blackman window makes the transition about 6 / taps of the rate wide and keeps the stopband 74 dB down
+	kernelHalfWidth = static_cast<UINT32>(std::ceil(3.0 * rate / (stop - pass)));
+	kernel.assign(static_cast<size_t>(kernelHalfWidth) * kernelResolution + 2, 0.0f);
+
+	for (UINT32 index = 0; index <= kernelHalfWidth * kernelResolution; index++)
+	{
+		double time = static_cast<double>(index) / kernelResolution;
+		double phase = pi * time / kernelHalfWidth;
+		double sinc = index ? std::sin(2.0 * pi * cutoff * time) / (pi * time) : 2.0 * cutoff;
+
+		kernel[index] = static_cast<float>(sinc * (0.42 + 0.5 * std::cos(phase) + 0.08 * std::cos(2.0 * phase)));
+	}
+
+	// Output samples near the start reach back before the first input sample
+	history.assign(kernelHalfWidth, 0.0f);
+	historyStart = 0;
+}
+
+void AudioPlay::Fingerprinter::Resample(_In_reads_(frameCount * channels) const float* input, _In_ UINT32 frameCount, _In_ UINT32 channels, _In_ UINT32 rate)
+{
+	float scale = 1.0f / channels;
+	size_t appended = history.size();
+
+	history.resize(appended + frameCount);
+
+	for (UINT32 index = 0; index < frameCount; index++)
+	{
+		float sample = 0.0f;
+		for (UINT32 channel = 0; channel < channels; channel++)
+		{
+			sample += input[index * channels + channel];
+		}
+		history[appended + index] = sample * scale;
+	}
+
+	inputFrames += frameCount;
+
+	const float* taps = kernel.data();
+
+	for (;;)
+	{
+		// Output sample n is at input sample n * rate / sampleRate, centre is the input sample at or before it
+		UINT64 position = outputSamples * rate;
+		UINT64 centre = position / sampleRate;
+
+		if (centre + kernelHalfWidth >= inputFrames)
+		{
+			break;
+		}
+
+		float fraction = static_cast<float>(position % sampleRate) / sampleRate;
+		// History starts kernelHalfWidth samples before the input
+		const float* samples = history.data() + (centre + kernelHalfWidth - historyStart);
+
+		// Input samples on either side are a whole sample apart, so every tap of a side shares the interpolation weight
+		float left = fraction * kernelResolution;
+		float right = (1.0f - fraction) * kernelResolution;
+		UINT32 leftIndex = static_cast<UINT32>(left);
+		UINT32 rightIndex = static_cast<UINT32>(right);
+		float leftWeight = left - leftIndex;
+		float rightWeight = right - rightIndex;
+
+		float left0 = 0.0f, left1 = 0.0f, right0 = 0.0f, right1 = 0.0f;
+
+		for (UINT32 tap = 0; tap < kernelHalfWidth; tap++)
+		{
+			const float* leftTap = taps + leftIndex + tap * kernelResolution;
+			const float* rightTap = taps + rightIndex + tap * kernelResolution;
+
+			left0 += samples[-static_cast<INT64>(tap)] * leftTap[0];
+			left1 += samples[-static_cast<INT64>(tap)] * leftTap[1];
+			right0 += samples[1 + tap] * rightTap[0];
+			right1 += samples[1 + tap] * rightTap[1];
+		}
+
+		float output = left0 + leftWeight * (left1 - left0) + right0 + rightWeight * (right1 - right0);
+
+		outputSamples++;
+
+		audible = audible || std::fabs(output) > silenceThreshold;
+
+		if (audible)
+		{
+			resampled[resampledCount++] = output;
+		}
+	}
+
+	// The next output sample reaches back to the input sample after its centre
+	UINT64 keepFrom = outputSamples * rate / sampleRate + 1;
+
+	if (keepFrom > historyStart)
+	{
+		history.erase(history.begin(), history.begin() + static_cast<size_t>(keepFrom - historyStart));
+		historyStart = keepFrom;
+	}
+}
+
+UINT32 AudioPlay::Fingerprinter::Hash(_In_reads_(frameSize) const float* samples)
+{
+	for (UINT32 index = 0; index < frameSize; index++)
+	{
+		frame[index] = samples[index] * window[index];
+	}
+
+	fft.Forward(frame, real, imaginary);
+
+	float energy[bandCount];
+
+	for (UINT32 band = 0; band < bandCount; band++)
+	{
+		float sum = 0.0f;
+		for (UINT32 bin = bandStart[band]; bin < bandStart[band + 1]; bin++)
+		{
+			sum += real[bin] * real[bin] + imaginary[bin] * imaginary[bin];
+		}
+		energy[band] = sum;
+	}
+
+	// Frames a hop apart overlap so much that noise decides which way a difference went
+	float* current = differences[frameIndex % compareFrames];
+	UINT32 hash = 0;
+
+	for (UINT32 bit = 0; bit < FingerprintIndex::hashBits; bit++)
+	{
+		float difference = energy[bit] - energy[bit + 1];
+
+		// The slot still holds the frame compareFrames back
+		if (difference > current[bit])
+		{
+			hash |= 1u << bit;
+		}
+
+		current[bit] = difference;
+	}
+
+	frameIndex++;
+
+	return hash;
+}
+
+HRESULT AudioPlay::Fingerprinter::Compute(_In_ PcmSource* source, _In_ UINT32 maxSeconds, _Out_ Fingerprint& fingerprint)
+{
+	fingerprint.hashes.clear();
+	fingerprint.durationMilliseconds = 0;
+
+	inputFrames = 0;
+	inputRate = 0;
+
+	if (source == nullptr)
+	{
+		return E_POINTER;
+	}
+
+	if (window == nullptr)
+	{
+		return E_NOT_VALID_STATE;
+	}
+
+	const PcmFormat& format = source->GetFormat();
+
+	if (format.channels == 0 || format.channels > maxChannels || format.sampleRate < minSampleRate)
+	{
+		return AUDIO_E_UNSUPPORTED_FORMAT;
+	}
+
+	HRESULT hr = S_OK;
+
+	inputRate = format.sampleRate;
+	outputSamples = 0;
+	audible = false;
+	frameIndex = 0;
+	resampledCount = 0;
+
+	UINT64 frameLimit = maxSeconds ? static_cast<UINT64>(maxSeconds) * format.sampleRate : ~0ULL;
+
+	try
+	{
+		DesignKernel(format.sampleRate);
+
+		while (inputFrames < frameLimit)
+		{
+			UINT32 wanted = frameLimit - inputFrames < decodeFrames ? static_cast<UINT32>(frameLimit - inputFrames) : decodeFrames;
+			UINT32 framesRead = 0;
+
+			hr = source->Read(decoded, wanted, framesRead); HR_FAIL(hr);
+
+			Resample(decoded, framesRead, format.channels, format.sampleRate);
+
+			UINT32 consumed = 0;
+
+			for (; resampledCount - consumed >= frameSize; consumed += hopSize)
+			{
+				UINT32 hash = Hash(resampled + consumed);
+
+				// The first frames have nothing to compare with
+				if (frameIndex > compareFrames)
+				{
+					fingerprint.hashes.push_back(hash);
+				}
+			}
+
+			memmove(resampled, resampled + consumed, (resampledCount - consumed) * sizeof(float));
+			resampledCount -= consumed;
+
+			if (framesRead < wanted)
+			{
+				break;
+			}
+		}
+	}
+	catch (const std::bad_alloc&)
+	{
+		return E_OUTOFMEMORY;
+	}
+
+	UINT64 length = 0;
+	if (FAILED(source->GetLength(length)))
+	{
+		length = inputFrames;
+	}
+
+	UINT64 milliseconds = length * 1000 / format.sampleRate;
+	fingerprint.durationMilliseconds = milliseconds > 0xFFFFFFFF ? 0xFFFFFFFF : static_cast<UINT32>(milliseconds);
+
+	return fingerprint.hashes.empty() ? S_FALSE : S_OK;
+}
+
+
+AudioPlay::FingerprintBatch::FingerprintBatch() :
+	referenceCount(1), maxSeconds(defaultMaxSeconds), fingerprinters(nullptr), files(0), failed(0), decodedMilliseconds(0), hashes(0)
+{
+}
+
+AudioPlay::FingerprintBatch::~FingerprintBatch()
+{
+	delete[] fingerprinters;
+}
+
+HRESULT AudioPlay::FingerprintBatch::Create(_In_ WorkStealingPool* pool, _In_ FingerprintIndex* index, _In_ UINT32 maxSeconds, _COM_Outptr_ FingerprintBatch** pPtrBatch)
+{
+	if (pPtrBatch == nullptr)
+	{
+		return E_INVALIDARG;
+	}
+	*pPtrBatch = nullptr;
+
+	if (pool == nullptr || index == nullptr)
+	{
+		return E_POINTER;
+	}
+
+	HRESULT hr = S_OK;
+
+	ComPtr<FingerprintBatch> batch;
+	batch.Attach(new (std::nothrow) FingerprintBatch());
+
+	if (!batch)
+	{
+		return E_OUTOFMEMORY;
+	}
+
+	batch->pool = pool;
+	batch->index = index;
+	batch->maxSeconds = maxSeconds;
+	batch->fingerprinters = new (std::nothrow) Fingerprinter[pool->GetThreadCount()];
+
+	if (batch->fingerprinters == nullptr)
+	{
+		return E_OUTOFMEMORY;
+	}
+
+	for (UINT32 worker = 0; worker < pool->GetThreadCount(); worker++)
+	{
+		hr = batch->fingerprinters[worker].Initialize(); HR_FAIL(hr);
+	}
+
+	*pPtrBatch = batch.Detach();
+
+	return hr;
+}
+
+ULONG STDMETHODCALLTYPE AudioPlay::FingerprintBatch::AddRef()
+{
+	return ++referenceCount;
+}
+
+ULONG STDMETHODCALLTYPE AudioPlay::FingerprintBatch::Release()
+{
+	ULONG count = --referenceCount;
+	if (count == 0)
+	{
+		delete this;
+	}
+	return count;
+}
+
+HRESULT AudioPlay::FingerprintBatch::Add(_In_z_ LPCWCH path, _In_ UINT64 id)
+{
+	if (path == nullptr)
+	{
+		return E_POINTER;
+	}
+
+	size_t length = wcslen(path);
+
+	Job* job = new (std::nothrow) Job{ this, id, nullptr };
+
+	if (job == nullptr)
+	{
+		return E_OUTOFMEMORY;
+	}
+
+	job->path = new (std::nothrow) WCHAR[length + 1];
+
+	if (job->path == nullptr)
+	{
+		delete job;
+		return E_OUTOFMEMORY;
+	}
+
+	memcpy(job->path, path, (length + 1) * sizeof(WCHAR));
+
+	// The job keeps the batch alive
+	AddRef();
+
+	HRESULT hr = pool->Submit(Run, job);
+
+	if (FAILED(hr))
+	{
+		delete[] job->path;
+		delete job;
+		Release();
+	}
+
+	return hr;
+}
+
+void AudioPlay::FingerprintBatch::Run(_In_ void* context, _In_ UINT32 worker)
+{
+	Job* job = static_cast<Job*>(context);
+	FingerprintBatch* batch = job->batch;
+
+	Fingerprint fingerprint;
+
+	HRESULT hr = batch->FingerprintFile(job->path, worker, fingerprint);
+
+	if (hr == S_OK)
+	{
+		hr = batch->index->Add(job->id, fingerprint);
+	}
+
+	batch->files++;
+
+	if (hr == S_OK)
+	{
+		batch->decodedMilliseconds += batch->fingerprinters[worker].GetDecodedMilliseconds();
+		batch->hashes += fingerprint.hashes.size();
+	}
+	else
+	{
+		batch->failed++;
+	}
+
+	delete[] job->path;
+	delete job;
+
+	batch->Release();
+}
+
+HRESULT AudioPlay::FingerprintBatch::FingerprintFile(_In_ LPCWCH path, _In_ UINT32 worker, _Out_ Fingerprint& fingerprint)
+{
+	ComPtr<PcmSource> source;
+
+	HRESULT hr = OpenNativeSource(path, &source);
+
+	#ifdef _WIN32
+	if (FAILED(hr))
+	{
+		// Media Foundation needs COM on the pool's threads, the native decoders don't
+		HRESULT comResult = CoInitializeEx(nullptr, COINIT_MULTITHREADED);
+
+		ComPtr<SourceReaderPcmSource> reader;
+		hr = SourceReaderPcmSource::Create(path, &reader);
+
+		if (SUCCEEDED(hr))
+		{
+			hr = fingerprinters[worker].Compute(reader, maxSeconds, fingerprint);
+		}
+
+		reader = nullptr;
+
+		if (SUCCEEDED(comResult))
+		{
+			CoUninitialize();
+		}
+
+		return hr;
+	}
+	#endif
+
+	HR_FAIL(hr);
+
+	return fingerprinters[worker].Compute(source, maxSeconds, fingerprint);
+}
+
+HRESULT AudioPlay::FingerprintBatch::Finish()
+{
+	pool->Wait();
+
+	return index->Build();
+}
+
+AudioPlay::FingerprintBatchStatistics AudioPlay::FingerprintBatch::GetStatistics() const
+{
+	FingerprintBatchStatistics statistics = { };
+
+	statistics.files = files;
+	statistics.failed = failed;
+	statistics.decodedSeconds = decodedMilliseconds / 1000.0;
+	statistics.hashes = hashes;
+
+	return statistics;
+}
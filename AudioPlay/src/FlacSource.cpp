@@ -0,0 +1,1230 @@
+#include "FlacSource.h"
+#include "Simd.h"
+
+#include <chrono>
+#include <cstring>
+#include <new>
+
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+
+
+#define HR_FAIL_ACTION(hresult, action) if (FAILED(hresult)) { action; return hresult; }
+#define HR_FAIL(hresult) if (FAILED(hresult)) { return hresult; }
+
+
+namespace
+{
+	constexpr UINT32 maxChannels = 8;
+	constexpr UINT32 maxBitsPerSample = 24;
+	constexpr UINT32 maxLpcOrder = 32;
+	// The LPC kernel reads whole vectors, up to 3 samples before the first one of a block
+	constexpr UINT32 historyPadding = 4;
+	// Seeking without a SEEKTABLE bisects until the frame is this close and decodes forward from there
+	constexpr UINT64 bisectionWindow = 1 << 16;
+
+	constexpr UINT32 sampleRates[12] = { 0, 88200, 176400, 192000, 8000, 16000, 22050, 24000, 32000, 44100, 48000, 96000 };
+	constexpr UINT32 sampleSizes[8] = { 0, 8, 12, 0, 16, 20, 24, 0 };
+
+	enum ChannelAssignment : UINT32
+	{
+		LeftSide = 8,
+		SideRight = 9,
+		MidSide = 10
+	};
+
+	struct CrcTables
+	{
+		BYTE crc8[256];
+		UINT16 crc16[256];
+
+		constexpr CrcTables() : crc8(), crc16()
+		{
+			for (UINT32 value = 0; value < 256; value++)
+			{
+				UINT32 crc = value;
+				for (int bit = 0; bit < 8; bit++)
+				{
+					crc = (crc & 0x80) ? ((crc << 1) ^ 0x07) : (crc << 1);
+				}
+				crc8[value] = static_cast<BYTE>(crc);
+
+				crc = value << 8;
+				for (int bit = 0; bit < 8; bit++)
+				{
+					crc = (crc & 0x8000) ? ((crc << 1) ^ 0x8005) : (crc << 1);
+				}
+				crc16[value] = static_cast<UINT16>(crc);
+			}
+		}
+	};
+
+	constexpr CrcTables crcTables;
+
+	BYTE Crc8(_In_reads_bytes_(size) const BYTE* data, _In_ size_t size)
+	{
+		BYTE crc = 0;
+		for (size_t index = 0; index < size; index++)
+		{
+			crc = crcTables.crc8[crc ^ data[index]];
+		}
+		return crc;
+	}
+
+	UINT16 Crc16(_In_reads_bytes_(size) const BYTE* data, _In_ size_t size)
+	{
+		UINT16 crc = 0;
+		for (size_t index = 0; index < size; index++)
+		{
+			crc = static_cast<UINT16>((crc << 8) ^ crcTables.crc16[(crc >> 8) ^ data[index]]);
+		}
+		return crc;
+	}
+
+	inline UINT64 ByteSwap64(UINT64 value)
+	{
+		#ifdef _MSC_VER
+		return _byteswap_uint64(value);
+		#else
+		return __builtin_bswap64(value);
+		#endif
+	}
+
+	// value can't be 0
+	inline UINT32 CountLeadingZeros64(UINT64 value)
+	{
+		#ifdef _MSC_VER
+		unsigned long index;
+		_BitScanReverse64(&index, value);
+		return 63 - index;
+		#else
+		return static_cast<UINT32>(__builtin_clzll(value));
+		#endif
+	}
+
+	inline UINT32 Log2(UINT32 value)
+	{
+		UINT32 log = 0;
+		while (value >>= 1)
+		{
+			log++;
+		}
+		return log;
+	}
+
+	// Big endian bit reader, reading past the end returns zeros and sets overrun
+	class BitReader
+	{
+		const BYTE* data;
+		UINT64 size;
+		UINT64 position;
+
+		public:
+		bool overrun;
+
+		BitReader(_In_reads_bytes_(size) const BYTE* p_data, _In_ UINT64 p_size) :
+			data(p_data), size(p_size), position(0), overrun(false)
+		{
+		}
+
+		// At least 57 valid bits starting at the current position
+		UINT64 Peek() const
+		{
+			UINT64 byteOffset = position >> 3;
+			UINT64 window = 0;
+
+			if (byteOffset + 8 <= size)
+			{
+				memcpy(&window, data + byteOffset, sizeof(window));
+				window = ByteSwap64(window);
+			}
+			else
+			{
+				for (UINT32 index = 0; byteOffset + index < size; index++)
+				{
+					window |= static_cast<UINT64>(data[byteOffset + index]) << (56 - 8 * index);
+				}
+			}
+
+			return window << (position & 7);
+		}
+
+		// count is at most 32
+		UINT32 ReadBits(_In_ UINT32 count)
+		{
+			if (count == 0)
+			{
+				return 0;
+			}
+			if (position + count > size * 8)
+			{
+				overrun = true;
+				position = size * 8;
+				return 0;
+			}
+
+			UINT32 value = static_cast<UINT32>(Peek() >> (64 - count));
+			position += count;
+
+			return value;
+		}
+
+		INT32 ReadSigned(_In_ UINT32 count)
+		{
+			if (count == 0)
+			{
+				return 0;
+			}
+
+			UINT32 value = ReadBits(count) << (32 - count);
+			return static_cast<INT32>(value) >> (32 - count);
+		}
+
+		// Number of zeros before the next one
+		UINT32 ReadUnary()
+		{
+			UINT32 zeros = 0;
+
+			for (;;)
+			{
+				UINT64 remaining = size * 8 - position;
+
+				if (remaining == 0)
+				{
+					overrun = true;
+					return zeros;
+				}
+
+				UINT64 window = Peek();
+				UINT32 valid = remaining < 57 ? static_cast<UINT32>(remaining) : 57;
+				UINT32 leading = window ? CountLeadingZeros64(window) : 64;
+
+				if (leading < valid)
+				{
+					position += leading + 1;
+					return zeros + leading;
+				}
+
+				zeros += valid;
+				position += valid;
+			}
+		}
+
+		INT32 ReadRice(_In_ UINT32 parameter)
+		{
+			UINT32 quotient = ReadUnary();
+			UINT32 value = (quotient << parameter) | ReadBits(parameter);
+
+			return static_cast<INT32>(value >> 1) ^ -static_cast<INT32>(value & 1);
+		}
+
+		void AlignToByte()
+		{
+			position = (position + 7) & ~static_cast<UINT64>(7);
+		}
+
+		UINT64 GetBytePosition() const
+		{
+			return position >> 3;
+		}
+	};
+
+	HRESULT DecodeResidual(_Inout_ BitReader& reader, _Out_writes_(blockSize) INT32* samples, _In_ UINT32 blockSize, _In_ UINT32 order)
+	{
+		UINT32 method = reader.ReadBits(2);
+
+		if (method > 1)
+		{
+			return AUDIO_E_CORRUPT_DATA;
+		}
+
+		UINT32 parameterBits = method ? 5 : 4;
+		UINT32 escape = method ? 31 : 15;
+
+		UINT32 partitionOrder = reader.ReadBits(4);
+		UINT32 partitionCount = 1u << partitionOrder;
+		UINT32 partitionSize = blockSize >> partitionOrder;
+
+		if ((blockSize & (partitionCount - 1)) || partitionSize < order)
+		{
+			return AUDIO_E_CORRUPT_DATA;
+		}
+
+		INT32* output = samples + order;
+
+		for (UINT32 partition = 0; partition < partitionCount; partition++)
+		{
+			UINT32 count = partition ? partitionSize : partitionSize - order;
+			UINT32 parameter = reader.ReadBits(parameterBits);
+
+			if (parameter == escape)
+			{
+				UINT32 rawBits = reader.ReadBits(5);
+
+				for (UINT32 index = 0; index < count; index++)
+				{
+					output[index] = reader.ReadSigned(rawBits);
+				}
+			}
+			else
+			{
+				for (UINT32 index = 0; index < count; index++)
+				{
+					output[index] = reader.ReadRice(parameter);
+				}
+			}
+
+			if (reader.overrun)
+			{
+				return AUDIO_E_CORRUPT_DATA;
+			}
+
+			output += count;
+		}
+
+		return S_OK;
+	}
+
+	// samples hold the warm-up samples followed by the residual, the signal is restored in place
+	void RestoreFixed(_Inout_updates_(blockSize) INT32* samples, _In_ UINT32 blockSize, _In_ UINT32 order)
+	{
+		switch (order)
+		{
+			case 1:
+			{
+				for (UINT32 index = 1; index < blockSize; index++)
+				{
+					samples[index] += samples[index - 1];
+				}
+				break;
+			}
+			case 2:
+			{
+				for (UINT32 index = 2; index < blockSize; index++)
+				{
+					samples[index] += 2 * samples[index - 1] - samples[index - 2];
+				}
+				break;
+			}
+			case 3:
+			{
+				for (UINT32 index = 3; index < blockSize; index++)
+				{
+					samples[index] += 3 * (samples[index - 1] - samples[index - 2]) + samples[index - 3];
+				}
+				break;
+			}
+			case 4:
+			{
+				for (UINT32 index = 4; index < blockSize; index++)
+				{
+					samples[index] += 4 * (samples[index - 1] + samples[index - 3]) - 6 * samples[index - 2] - samples[index - 4];
+				}
+				break;
+			}
+		}
+	}
+
+	#ifdef AUDIOPLAY_SSE2
+	// Low 32 bits of the products, the same for signed and unsigned values
+	inline __m128i MultiplyLow32(__m128i lhs, __m128i rhs)
+	{
+		__m128i even = _mm_mul_epu32(lhs, rhs);
+		__m128i odd = _mm_mul_epu32(_mm_srli_si128(lhs, 4), _mm_srli_si128(rhs, 4));
+
+		return _mm_unpacklo_epi32(_mm_shuffle_epi32(even, _MM_SHUFFLE(0, 0, 2, 0)), _mm_shuffle_epi32(odd, _MM_SHUFFLE(0, 0, 2, 0)));
+	}
+	#endif
+
+	// fitsIn32Bits is true when bits + precision + log2(order) <= 32, the sums can't overflow then
+	void RestoreLpc(_Inout_updates_(blockSize) INT32* samples, _In_ UINT32 blockSize, _In_reads_(order) const INT32* coefficients,
+		_In_ UINT32 order, _In_ INT32 shift, _In_ bool fitsIn32Bits)
+	{
+		UINT32 index = order;
+
+		#ifdef AUDIOPLAY_SSE2
+		if (fitsIn32Bits)
+		{
+			// Coefficients reversed and padded with zeros in front so every tap is one unaligned load of history
+			alignas(16) INT32 reversed[maxLpcOrder + 3] = { };
+			UINT32 paddedOrder = (order + 3) & ~3u;
+
+			for (UINT32 tap = 0; tap < order; tap++)
+			{
+				reversed[paddedOrder - 1 - tap] = coefficients[tap];
+			}
+
+			for (; index < blockSize; index++)
+			{
+				const INT32* history = samples + index - paddedOrder;
+				__m128i sum = _mm_setzero_si128();
+
+				for (UINT32 tap = 0; tap < paddedOrder; tap += 4)
+				{
+					__m128i coefficient = _mm_load_si128(reinterpret_cast<const __m128i*>(reversed + tap));
+					__m128i sample = _mm_loadu_si128(reinterpret_cast<const __m128i*>(history + tap));
+					sum = _mm_add_epi32(sum, MultiplyLow32(coefficient, sample));
+				}
+
+				sum = _mm_add_epi32(sum, _mm_shuffle_epi32(sum, _MM_SHUFFLE(1, 0, 3, 2)));
+				sum = _mm_add_epi32(sum, _mm_shuffle_epi32(sum, _MM_SHUFFLE(2, 3, 0, 1)));
+
+				samples[index] += _mm_cvtsi128_si32(sum) >> shift;
+			}
+
+			return;
+		}
+		#else
+		UNREFERENCED_PARAMETER(fitsIn32Bits);
+		#endif
+
+		for (; index < blockSize; index++)
+		{
+			INT64 sum = 0;
+
+			for (UINT32 tap = 0; tap < order; tap++)
+			{
+				sum += static_cast<INT64>(coefficients[tap]) * samples[index - 1 - tap];
+			}
+
+			samples[index] += static_cast<INT32>(sum >> shift);
+		}
+	}
+
+	HRESULT DecodeSubframe(_Inout_ BitReader& reader, _Out_writes_(blockSize) INT32* samples, _In_ UINT32 blockSize, _In_ UINT32 bits)
+	{
+		HRESULT hr = S_OK;
+
+		if (reader.ReadBits(1))
+		{
+			return AUDIO_E_CORRUPT_DATA;
+		}
+
+		UINT32 type = reader.ReadBits(6);
+		UINT32 wastedBits = 0;
+
+		if (reader.ReadBits(1))
+		{
+			wastedBits = reader.ReadUnary() + 1;
+
+			if (wastedBits >= bits)
+			{
+				return AUDIO_E_CORRUPT_DATA;
+			}
+
+			bits -= wastedBits;
+		}
+
+		if (type == 0)
+		{
+			INT32 value = reader.ReadSigned(bits);
+
+			for (UINT32 index = 0; index < blockSize; index++)
+			{
+				samples[index] = value;
+			}
+		}
+		else if (type == 1)
+		{
+			for (UINT32 index = 0; index < blockSize; index++)
+			{
+				samples[index] = reader.ReadSigned(bits);
+			}
+		}
+		else if ((type & 0x38) == 0x08)
+		{
+			UINT32 order = type & 0x07;
+
+			if (order > 4 || order > blockSize)
+			{
+				return AUDIO_E_CORRUPT_DATA;
+			}
+
+			for (UINT32 index = 0; index < order; index++)
+			{
+				samples[index] = reader.ReadSigned(bits);
+			}
+
+			hr = DecodeResidual(reader, samples, blockSize, order); HR_FAIL(hr);
+
+			RestoreFixed(samples, blockSize, order);
+		}
+		else if (type & 0x20)
+		{
+			UINT32 order = (type & 0x1F) + 1;
+
+			if (order > blockSize)
+			{
+				return AUDIO_E_CORRUPT_DATA;
+			}
+
+			for (UINT32 index = 0; index < order; index++)
+			{
+				samples[index] = reader.ReadSigned(bits);
+			}
+
+			UINT32 precision = reader.ReadBits(4) + 1;
+			INT32 shift = reader.ReadSigned(5);
+
+			if (precision == 16 || shift < 0)
+			{
+				return AUDIO_E_CORRUPT_DATA;
+			}
+
+			INT32 coefficients[maxLpcOrder];
+
+			for (UINT32 tap = 0; tap < order; tap++)
+			{
+				coefficients[tap] = reader.ReadSigned(precision);
+			}
+
+			hr = DecodeResidual(reader, samples, blockSize, order); HR_FAIL(hr);
+
+			RestoreLpc(samples, blockSize, coefficients, order, shift, bits + precision + Log2(order) <= 32);
+		}
+		else
+		{
+			return AUDIO_E_CORRUPT_DATA;
+		}
+
+		if (reader.overrun)
+		{
+			return AUDIO_E_CORRUPT_DATA;
+		}
+
+		if (wastedBits)
+		{
+			for (UINT32 index = 0; index < blockSize; index++)
+			{
+				samples[index] = static_cast<INT32>(static_cast<UINT32>(samples[index]) << wastedBits);
+			}
+		}
+
+		return hr;
+	}
+
+	void Decorrelate(_In_ UINT32 assignment, _Inout_updates_(count) INT32* first, _Inout_updates_(count) INT32* second, _In_ UINT32 count)
+	{
+		UINT32 index = 0;
+
+		#ifdef AUDIOPLAY_SSE2
+		for (; index + 4 <= count; index += 4)
+		{
+			__m128i a = _mm_loadu_si128(reinterpret_cast<const __m128i*>(first + index));
+			__m128i b = _mm_loadu_si128(reinterpret_cast<const __m128i*>(second + index));
+
+			switch (assignment)
+			{
+				case LeftSide:
+				{
+					_mm_storeu_si128(reinterpret_cast<__m128i*>(second + index), _mm_sub_epi32(a, b));
+					break;
+				}
+				case SideRight:
+				{
+					_mm_storeu_si128(reinterpret_cast<__m128i*>(first + index), _mm_add_epi32(a, b));
+					break;
+				}
+				case MidSide:
+				{
+					__m128i mid = _mm_or_si128(_mm_slli_epi32(a, 1), _mm_and_si128(b, _mm_set1_epi32(1)));
+					_mm_storeu_si128(reinterpret_cast<__m128i*>(first + index), _mm_srai_epi32(_mm_add_epi32(mid, b), 1));
+					_mm_storeu_si128(reinterpret_cast<__m128i*>(second + index), _mm_srai_epi32(_mm_sub_epi32(mid, b), 1));
+					break;
+				}
+			}
+		}
+		#endif
+
+		for (; index < count; index++)
+		{
+			switch (assignment)
+			{
+				case LeftSide:
+				{
+					second[index] = first[index] - second[index];
+					break;
+				}
+				case SideRight:
+				{
+					first[index] = first[index] + second[index];
+					break;
+				}
+				case MidSide:
+				{
+					INT32 side = second[index];
+					INT32 mid = static_cast<INT32>(static_cast<UINT32>(first[index]) << 1) | (side & 1);
+					first[index] = (mid + side) >> 1;
+					second[index] = (mid - side) >> 1;
+					break;
+				}
+			}
+		}
+	}
+
+	// Encoders that can't compute the checksum leave it zeroed
+	bool HasChecksum(_In_reads_bytes_(16) const BYTE* md5)
+	{
+		for (int index = 0; index < 16; index++)
+		{
+			if (md5[index])
+			{
+				return true;
+			}
+		}
+		return false;
+	}
+
+	// Offset of the fLaC marker, an ID3v2 tag some taggers put in front is skipped
+	UINT64 FindStreamStart(_In_reads_bytes_(size) const BYTE* data, _In_ UINT64 size)
+	{
+		UINT64 offset = 0;
+
+		if (size >= 10 && memcmp(data, "ID3", 3) == 0)
+		{
+			UINT64 tagSize = (static_cast<UINT64>(data[6] & 0x7F) << 21) | ((data[7] & 0x7F) << 14) | ((data[8] & 0x7F) << 7) | (data[9] & 0x7F);
+			// Footer flag
+			offset = 10 + tagSize + ((data[5] & 0x10) ? 10 : 0);
+		}
+
+		return offset;
+	}
+}
+
+AudioPlay::FlacSource::FlacSource() :
+	data(nullptr), size(0), firstFrameOffset(0), nextFrameOffset(0),
+	minBlockSize(0), maxBlockSize(0), bitsPerSample(0), totalSamples(0), streamMd5{ },
+	seekPoints(nullptr), seekPointCount(0),
+	channelBuffers(nullptr), channelStride(0), blockFrames(0), blockOffset(0), blockStart(0), endOfStream(false),
+	interleaveKernel(nullptr), interleaveGains{ },
+	verifying(false), md5Buffer(nullptr), verificationResult(S_FALSE),
+	decodedFrames(0), decodeNanoseconds(0)
+{
+}
+
+AudioPlay::FlacSource::~FlacSource()
+{
+	delete[] seekPoints;
+	delete[] channelBuffers;
+	delete[] md5Buffer;
+}
+
+bool AudioPlay::FlacSource::CanRead(_In_reads_bytes_(size) const BYTE* data, _In_ UINT64 size)
+{
+	if (data == nullptr)
+	{
+		return false;
+	}
+
+	UINT64 offset = FindStreamStart(data, size);
+
+	return offset + 4 <= size && memcmp(data + offset, "fLaC", 4) == 0;
+}
+
+HRESULT AudioPlay::FlacSource::Open(_In_z_ LPCWCH path, _COM_Outptr_ FlacSource** pPtrSource)
+{
+	if (pPtrSource == nullptr)
+	{
+		return E_INVALIDARG;
+	}
+	*pPtrSource = nullptr;
+
+	ComPtr<MappedFile> mappedFile;
+
+	HRESULT hr = MappedFile::Open(path, &mappedFile); HR_FAIL(hr);
+
+	return Create(mappedFile, pPtrSource);
+}
+
+HRESULT AudioPlay::FlacSource::Create(_In_ MemoryBlock* block, _COM_Outptr_ FlacSource** pPtrSource)
+{
+	if (pPtrSource == nullptr)
+	{
+		return E_INVALIDARG;
+	}
+	*pPtrSource = nullptr;
+
+	if (block == nullptr)
+	{
+		return E_POINTER;
+	}
+
+	if (!CanRead(block->GetData(), block->GetSize()))
+	{
+		return AUDIO_E_UNSUPPORTED_FORMAT;
+	}
+
+	ComPtr<FlacSource> source;
+	source.Attach(new (std::nothrow) FlacSource());
+
+	if (!source)
+	{
+		return E_OUTOFMEMORY;
+	}
+
+	source->block = block;
+	source->data = block->GetData();
+	source->size = block->GetSize();
+
+	HRESULT hr = source->ParseMetadata(); HR_FAIL(hr);
+	hr = source->AllocateBuffers(); HR_FAIL(hr);
+
+	// Up to 8 channels, the kernel always exists
+	source->interleaveKernel = SelectPcmPipeline({ SampleEncoding::Int32, source->format.channels, PcmLayout::Planar, PcmStages::Gain });
+	ComputePcmChannelGains(static_cast<float>(1u << (32 - source->bitsPerSample)), 0.0f, 1, source->interleaveGains);
+
+	*pPtrSource = source.Detach();
+
+	return hr;
+}
+
+HRESULT AudioPlay::FlacSource::Verify(_In_z_ LPCWCH path)
+{
+	ComPtr<FlacSource> source;
+
+	HRESULT hr = Open(path, &source); HR_FAIL(hr);
+
+	const UINT32 chunkFrames = 4096;
+	float* buffer = new (std::nothrow) float[static_cast<size_t>(chunkFrames) * source->format.channels];
+
+	if (buffer == nullptr)
+	{
+		return E_OUTOFMEMORY;
+	}
+
+	UINT32 framesRead = 0;
+
+	do
+	{
+		hr = source->Read(buffer, chunkFrames, framesRead);
+	}
+	while (SUCCEEDED(hr) && framesRead == chunkFrames);
+
+	delete[] buffer;
+
+	HR_FAIL(hr);
+
+	return source->GetVerificationResult();
+}
+
+HRESULT AudioPlay::FlacSource::ParseMetadata()
+{
+	UINT64 offset = FindStreamStart(data, size) + 4;
+
+	bool streamInfoFound = false;
+	bool lastBlock = false;
+
+	while (!lastBlock)
+	{
+		if (offset + 4 > size)
+		{
+			return AUDIO_E_INVALID_FORMAT;
+		}
+
+		lastBlock = (data[offset] & 0x80) != 0;
+		UINT32 type = data[offset] & 0x7F;
+		UINT32 length = (static_cast<UINT32>(data[offset + 1]) << 16) | (static_cast<UINT32>(data[offset + 2]) << 8) | data[offset + 3];
+
+		const BYTE* body = data + offset + 4;
+		offset += 4 + static_cast<UINT64>(length);
+
+		if (offset > size)
+		{
+			return AUDIO_E_INVALID_FORMAT;
+		}
+
+		if (type == 0)
+		{
+			if (length < 34)
+			{
+				return AUDIO_E_INVALID_FORMAT;
+			}
+
+			BitReader reader(body, length);
+
+			minBlockSize = reader.ReadBits(16);
+			maxBlockSize = reader.ReadBits(16);
+			reader.ReadBits(24);
+			reader.ReadBits(24);
+			format.sampleRate = reader.ReadBits(20);
+			format.channels = reader.ReadBits(3) + 1;
+			bitsPerSample = reader.ReadBits(5) + 1;
+			totalSamples = (static_cast<UINT64>(reader.ReadBits(4)) << 32) | reader.ReadBits(32);
+
+			memcpy(streamMd5, body + 18, sizeof(streamMd5));
+
+			streamInfoFound = true;
+		}
+		else if (type == 3 && seekPoints == nullptr)
+		{
+			UINT32 count = length / 18;
+			seekPoints = new (std::nothrow) SeekPoint[count ? count : 1];
+
+			if (seekPoints == nullptr)
+			{
+				return E_OUTOFMEMORY;
+			}
+
+			BitReader reader(body, length);
+
+			for (UINT32 index = 0; index < count; index++)
+			{
+				UINT64 sample = (static_cast<UINT64>(reader.ReadBits(32)) << 32) | reader.ReadBits(32);
+				UINT64 pointOffset = (static_cast<UINT64>(reader.ReadBits(32)) << 32) | reader.ReadBits(32);
+				reader.ReadBits(16);
+
+				// Placeholders are always at the end
+				if (sample == ~static_cast<UINT64>(0))
+				{
+					break;
+				}
+
+				seekPoints[seekPointCount++] = SeekPoint{ sample, pointOffset };
+			}
+		}
+	}
+
+	if (!streamInfoFound)
+	{
+		return AUDIO_E_INVALID_FORMAT;
+	}
+	if (format.sampleRate == 0 || maxBlockSize < 16 || minBlockSize > maxBlockSize || bitsPerSample < 4)
+	{
+		return AUDIO_E_INVALID_FORMAT;
+	}
+	if (bitsPerSample > maxBitsPerSample || format.channels > maxChannels)
+	{
+		return AUDIO_E_UNSUPPORTED_FORMAT;
+	}
+
+	firstFrameOffset = offset;
+	nextFrameOffset = offset;
+
+	verifying = HasChecksum(streamMd5);
+
+	return S_OK;
+}
+
+HRESULT AudioPlay::FlacSource::AllocateBuffers()
+{
+	channelStride = historyPadding + ((maxBlockSize + 3) & ~3u);
+
+	channelBuffers = new (std::nothrow) INT32[static_cast<size_t>(channelStride) * format.channels]();
+	md5Buffer = new (std::nothrow) BYTE[static_cast<size_t>(maxBlockSize) * format.channels * ((bitsPerSample + 7) / 8)];
+
+	if (channelBuffers == nullptr || md5Buffer == nullptr)
+	{
+		return E_OUTOFMEMORY;
+	}
+
+	return S_OK;
+}
+
+INT32* AudioPlay::FlacSource::GetChannel(_In_ UINT32 channel) const
+{
+	return channelBuffers + static_cast<size_t>(channel) * channelStride + historyPadding;
+}
+
+bool AudioPlay::FlacSource::ParseFrameHeader(_In_ UINT64 offset, _Out_ FrameHeader& header) const
+{
+	header = FrameHeader{ };
+
+	if (offset + 5 > size)
+	{
+		return false;
+	}
+
+	const BYTE* frame = data + offset;
+
+	if (frame[0] != 0xFF || (frame[1] & 0xFE) != 0xF8 || (frame[3] & 0x01))
+	{
+		return false;
+	}
+
+	bool variableBlockSize = (frame[1] & 0x01) != 0;
+	UINT32 blockSizeCode = frame[2] >> 4;
+	UINT32 sampleRateCode = frame[2] & 0x0F;
+	UINT32 channelCode = frame[3] >> 4;
+	UINT32 sampleSizeCode = (frame[3] >> 1) & 0x07;
+
+	if (blockSizeCode == 0 || sampleRateCode == 15 || channelCode > MidSide)
+	{
+		return false;
+	}
+
+	UINT64 at = offset + 4;
+
+	// Frame or sample number, coded like UTF-8
+	BYTE first = data[at++];
+	UINT32 extraBytes = 0;
+	UINT64 number = 0;
+
+	if (first < 0x80) { number = first; }
+	else if ((first & 0xE0) == 0xC0) { number = first & 0x1F; extraBytes = 1; }
+	else if ((first & 0xF0) == 0xE0) { number = first & 0x0F; extraBytes = 2; }
+	else if ((first & 0xF8) == 0xF0) { number = first & 0x07; extraBytes = 3; }
+	else if ((first & 0xFC) == 0xF8) { number = first & 0x03; extraBytes = 4; }
+	else if ((first & 0xFE) == 0xFC) { number = first & 0x01; extraBytes = 5; }
+	else if (first == 0xFE) { extraBytes = 6; }
+	else { return false; }
+
+	if (at + extraBytes > size)
+	{
+		return false;
+	}
+
+	for (UINT32 index = 0; index < extraBytes; index++)
+	{
+		BYTE next = data[at++];
+
+		if ((next & 0xC0) != 0x80)
+		{
+			return false;
+		}
+
+		number = (number << 6) | (next & 0x3F);
+	}
+
+	UINT32 extraHeaderBytes = (blockSizeCode == 6 ? 1 : (blockSizeCode == 7 ? 2 : 0)) + (sampleRateCode == 12 ? 1 : (sampleRateCode >= 13 ? 2 : 0));
+
+	if (at + extraHeaderBytes + 1 > size)
+	{
+		return false;
+	}
+
+	if (blockSizeCode == 1) { header.blockSize = 192; }
+	else if (blockSizeCode <= 5) { header.blockSize = 576u << (blockSizeCode - 2); }
+	else if (blockSizeCode == 6) { header.blockSize = data[at++] + 1u; }
+	else if (blockSizeCode == 7) { header.blockSize = ((static_cast<UINT32>(data[at]) << 8) | data[at + 1]) + 1; at += 2; }
+	else { header.blockSize = 256u << (blockSizeCode - 8); }
+
+	if (sampleRateCode == 0) { header.sampleRate = format.sampleRate; }
+	else if (sampleRateCode < 12) { header.sampleRate = sampleRates[sampleRateCode]; }
+	else if (sampleRateCode == 12) { header.sampleRate = data[at++] * 1000u; }
+	else if (sampleRateCode == 13) { header.sampleRate = (static_cast<UINT32>(data[at]) << 8) | data[at + 1]; at += 2; }
+	else { header.sampleRate = ((static_cast<UINT32>(data[at]) << 8) | data[at + 1]) * 10; at += 2; }
+
+	header.bitsPerSample = sampleSizeCode ? sampleSizes[sampleSizeCode] : bitsPerSample;
+	header.channelAssignment = channelCode;
+
+	if (Crc8(frame, static_cast<size_t>(at - offset)) != data[at])
+	{
+		return false;
+	}
+
+	at++;
+
+	// Anything that doesn't match STREAMINFO is a false sync code in the middle of a frame
+	UINT32 channels = channelCode < LeftSide ? channelCode + 1 : 2;
+
+	if (channels != format.channels || header.bitsPerSample != bitsPerSample || header.sampleRate != format.sampleRate || header.blockSize > maxBlockSize)
+	{
+		return false;
+	}
+
+	header.firstSample = variableBlockSize ? number : number * (minBlockSize == maxBlockSize ? maxBlockSize : header.blockSize);
+	header.size = static_cast<UINT32>(at - offset);
+
+	return true;
+}
+
+bool AudioPlay::FlacSource::FindFrame(_In_ UINT64 offset, _Out_ UINT64& frameOffset, _Out_ FrameHeader& header) const
+{
+	for (; offset + 1 < size; offset++)
+	{
+		if (data[offset] == 0xFF && (data[offset + 1] & 0xFE) == 0xF8 && ParseFrameHeader(offset, header))
+		{
+			frameOffset = offset;
+			return true;
+		}
+	}
+
+	frameOffset = size;
+	return false;
+}
+
+HRESULT AudioPlay::FlacSource::DecodeFrame()
+{
+	HRESULT hr = S_OK;
+
+	auto decodeStart = std::chrono::steady_clock::now();
+
+	blockStart += blockFrames;
+	blockFrames = 0;
+	blockOffset = 0;
+
+	FrameHeader header;
+
+	if (!ParseFrameHeader(nextFrameOffset, header))
+	{
+		UINT64 frameOffset;
+
+		// Tags after the last frame just end the stream, a frame further on means this one is broken
+		if (FindFrame(nextFrameOffset, frameOffset, header))
+		{
+			return AUDIO_E_CORRUPT_DATA;
+		}
+
+		endOfStream = true;
+		nextFrameOffset = size;
+
+		if (verifying)
+		{
+			BYTE digest[16];
+			md5.Finish(digest);
+
+			verificationResult = memcmp(digest, streamMd5, sizeof(digest)) == 0 ? S_OK : AUDIO_E_CORRUPT_DATA;
+			verifying = false;
+		}
+
+		return hr;
+	}
+
+	UINT64 subframeOffset = nextFrameOffset + header.size;
+	BitReader reader(data + subframeOffset, size - subframeOffset);
+
+	for (UINT32 channel = 0; channel < format.channels; channel++)
+	{
+		UINT32 bits = header.bitsPerSample;
+
+		// The side channel needs an extra bit
+		if ((header.channelAssignment == LeftSide && channel == 1) || (header.channelAssignment == SideRight && channel == 0) ||
+			(header.channelAssignment == MidSide && channel == 1))
+		{
+			bits++;
+		}
+
+		hr = DecodeSubframe(reader, GetChannel(channel), header.blockSize, bits); HR_FAIL(hr);
+	}
+
+	reader.AlignToByte();
+
+	UINT64 frameEnd = subframeOffset + reader.GetBytePosition() + 2;
+
+	if (frameEnd > size)
+	{
+		return AUDIO_E_CORRUPT_DATA;
+	}
+
+	UINT16 storedCrc = static_cast<UINT16>((data[frameEnd - 2] << 8) | data[frameEnd - 1]);
+
+	if (Crc16(data + nextFrameOffset, static_cast<size_t>(frameEnd - 2 - nextFrameOffset)) != storedCrc)
+	{
+		return AUDIO_E_CORRUPT_DATA;
+	}
+
+	if (header.channelAssignment >= LeftSide)
+	{
+		Decorrelate(header.channelAssignment, GetChannel(0), GetChannel(1), header.blockSize);
+	}
+
+	blockStart = header.firstSample;
+	blockFrames = header.blockSize;
+	nextFrameOffset = frameEnd;
+
+	if (verifying)
+	{
+		UpdateMd5();
+	}
+
+	decodedFrames += blockFrames;
+	decodeNanoseconds += static_cast<UINT64>(std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - decodeStart).count());
+
+	return hr;
+}
+
+void AudioPlay::FlacSource::UpdateMd5()
+{
+	// The checksum is over the samples as signed little endian integers in whole bytes
+	const UINT32 bytesPerSample = (bitsPerSample + 7) / 8;
+	BYTE* output = md5Buffer;
+
+	for (UINT32 index = 0; index < blockFrames; index++)
+	{
+		for (UINT32 channel = 0; channel < format.channels; channel++)
+		{
+			UINT32 sample = static_cast<UINT32>(GetChannel(channel)[index]);
+
+			for (UINT32 byte = 0; byte < bytesPerSample; byte++)
+			{
+				*output++ = static_cast<BYTE>(sample >> (byte * 8));
+			}
+		}
+	}
+
+	md5.Update(md5Buffer, static_cast<size_t>(output - md5Buffer));
+}
+
+double AudioPlay::FlacSource::GetDecodeSpeed() const
+{
+	if (decodeNanoseconds == 0)
+	{
+		return 0.0;
+	}
+
+	double audioSeconds = static_cast<double>(decodedFrames) / format.sampleRate;
+
+	return audioSeconds / (static_cast<double>(decodeNanoseconds) / 1e9);
+}
+
+HRESULT AudioPlay::FlacSource::GetVerificationResult() const
+{
+	return verificationResult;
+}
+
+HRESULT AudioPlay::FlacSource::Read(_Out_writes_(frameCount * format.channels) float* buffer, _In_ UINT32 frameCount, _Out_ UINT32& framesRead)
+{
+	framesRead = 0;
+
+	HRESULT hr = S_OK;
+
+	const void* channels[maxChannels];
+
+	while (framesRead < frameCount)
+	{
+		if (blockOffset == blockFrames)
+		{
+			if (endOfStream)
+			{
+				break;
+			}
+
+			hr = DecodeFrame(); HR_FAIL(hr);
+			continue;
+		}
+
+		UINT32 available = blockFrames - blockOffset;
+		UINT32 count = frameCount - framesRead;
+		count = available < count ? available : count;
+
+		for (UINT32 channel = 0; channel < format.channels; channel++)
+		{
+			channels[channel] = GetChannel(channel) + blockOffset;
+		}
+
+		interleaveKernel(channels, buffer + static_cast<size_t>(framesRead) * format.channels, count, format.channels, interleaveGains);
+
+		blockOffset += count;
+		framesRead += count;
+	}
+
+	return hr;
+}
+
+HRESULT AudioPlay::FlacSource::Seek(_In_ UINT64 frame)
+{
+	if (totalSamples && frame > totalSamples)
+	{
+		return E_INVALIDARG;
+	}
+
+	HRESULT hr = S_OK;
+
+	blockFrames = 0;
+	blockOffset = 0;
+	endOfStream = false;
+	verificationResult = S_FALSE;
+
+	if (frame == 0)
+	{
+		nextFrameOffset = firstFrameOffset;
+		blockStart = 0;
+
+		md5.Reset();
+		verifying = HasChecksum(streamMd5);
+
+		return hr;
+	}
+
+	verifying = false;
+
+	UINT64 start = firstFrameOffset;
+
+	if (seekPointCount)
+	{
+		UINT32 low = 0;
+		UINT32 high = seekPointCount;
+
+		// Last point at or before the frame
+		while (low < high)
+		{
+			UINT32 middle = (low + high) / 2;
+
+			if (seekPoints[middle].sample <= frame)
+			{
+				low = middle + 1;
+			}
+			else
+			{
+				high = middle;
+			}
+		}
+
+		if (low && firstFrameOffset + seekPoints[low - 1].offset < size)
+		{
+			start = firstFrameOffset + seekPoints[low - 1].offset;
+		}
+	}
+	else
+	{
+		UINT64 low = firstFrameOffset;
+		UINT64 high = size;
+
+		while (high - low > bisectionWindow)
+		{
+			UINT64 middle = low + (high - low) / 2;
+			UINT64 frameOffset;
+			FrameHeader header;
+
+			if (!FindFrame(middle, frameOffset, header) || frameOffset >= high || header.firstSample > frame)
+			{
+				high = middle;
+			}
+			else
+			{
+				low = frameOffset;
+			}
+		}
+
+		start = low;
+	}
+
+	FrameHeader header;
+
+	// A seek point has to land on a frame, searching makes a stale table harmless
+	if (!FindFrame(start, nextFrameOffset, header) || header.firstSample > frame)
+	{
+		nextFrameOffset = firstFrameOffset;
+		header.firstSample = 0;
+	}
+
+	blockStart = header.firstSample;
+
+	while (!endOfStream)
+	{
+		hr = DecodeFrame(); HR_FAIL(hr);
+
+		if (blockStart + blockFrames > frame)
+		{
+			blockOffset = frame > blockStart ? static_cast<UINT32>(frame - blockStart) : 0;
+			break;
+		}
+	}
+
+	return hr;
+}
+
+HRESULT AudioPlay::FlacSource::GetPosition(_Out_ UINT64& frame) const
+{
+	frame = blockStart + blockOffset;
+
+	return S_OK;
+}
+
+HRESULT AudioPlay::FlacSource::GetLength(_Out_ UINT64& frames) const
+{
+	frames = totalSamples;
+
+	return totalSamples ? S_OK : E_NOTIMPL;
+}
@@ -0,0 +1,503 @@
+#include "GaplessInfo.h"
+
+#include <cstring>
+#include <new>
+
+
+#define HR_FAIL_ACTION(hresult, action) if (FAILED(hresult)) { action; return hresult; }
+#define HR_FAIL(hresult) if (FAILED(hresult)) { return hresult; }
+
+
+namespace
+{
+	// The MP3 decoder's synthesis filter delays its output by this many frames, the LAME tag doesn't count it
+	constexpr UINT32 mp3DecoderDelay = 529;
+	// How far past the ID3 tag the first frame header is looked for
+	constexpr UINT64 maxSyncSearch = 64 * 1024;
+	// Ogg page header without the segment table, and the largest a whole page can be
+	constexpr UINT64 oggHeaderSize = 27;
+	constexpr UINT64 maxOggPageSize = oggHeaderSize + 255 + 255 * 255;
+
+	UINT32 ReadBigEndian32(_In_reads_bytes_(4) const BYTE* data)
+	{
+		return (static_cast<UINT32>(data[0]) << 24) | (static_cast<UINT32>(data[1]) << 16) | (static_cast<UINT32>(data[2]) << 8) | data[3];
+	}
+
+	UINT32 ReadLittleEndian32(_In_reads_bytes_(4) const BYTE* data)
+	{
+		return data[0] | (static_cast<UINT32>(data[1]) << 8) | (static_cast<UINT32>(data[2]) << 16) | (static_cast<UINT32>(data[3]) << 24);
+	}
+
+	UINT64 ReadLittleEndian64(_In_reads_bytes_(8) const BYTE* data)
+	{
+		return ReadLittleEndian32(data) | (static_cast<UINT64>(ReadLittleEndian32(data + 4)) << 32);
+	}
+
+	UINT64 SkipId3Tag(_In_reads_bytes_(size) const BYTE* data, _In_ UINT64 size)
+	{
+		UINT64 offset = 0;
+
+		if (size >= 10 && memcmp(data, "ID3", 3) == 0)
+		{
+			UINT64 tagSize = (static_cast<UINT64>(data[6] & 0x7F) << 21) | ((data[7] & 0x7F) << 14) | ((data[8] & 0x7F) << 7) | (data[9] & 0x7F);
+			// Footer flag
+			offset = 10 + tagSize + ((data[5] & 0x10) ? 10 : 0);
+		}
+
+		return offset;
+	}
+
+	bool IsLayer3Header(_In_reads_bytes_(4) const BYTE* header)
+	{
+		return header[0] == 0xFF && (header[1] & 0xE0) == 0xE0
+			// Reserved version, Layer III only, free and bad bitrates, reserved sample rate
+			&& ((header[1] >> 3) & 3) != 1 && ((header[1] >> 1) & 3) == 1
+			&& (header[2] >> 4) != 0 && (header[2] >> 4) != 0xF && ((header[2] >> 2) & 3) != 3;
+	}
+
+	// The Xing or Info header in the first frame and the LAME tag after it
+	HRESULT ReadLameTag(_In_reads_bytes_(size) const BYTE* data, _In_ UINT64 size, _Out_ AudioPlay::GaplessInfo& info)
+	{
+		UINT64 offset = SkipId3Tag(data, size);
+		UINT64 searchEnd = offset + maxSyncSearch;
+
+		while (offset + 4 <= size && offset < searchEnd && !IsLayer3Header(data + offset))
+		{
+			offset++;
+		}
+
+		if (offset + 4 > size || offset >= searchEnd)
+		{
+			return S_FALSE;
+		}
+
+		const BYTE* header = data + offset;
+		bool mpeg1 = ((header[1] >> 3) & 3) == 3;
+		bool mono = (header[3] >> 6) == 3;
+
+		UINT64 sideInfoSize = mpeg1 ? (mono ? 17 : 32) : (mono ? 9 : 17);
+		UINT32 framesPerMp3Frame = mpeg1 ? 1152 : 576;
+
+		UINT64 xing = offset + 4 + sideInfoSize;
+
+		if (xing + 8 > size || (memcmp(data + xing, "Xing", 4) != 0 && memcmp(data + xing, "Info", 4) != 0))
+		{
+			return S_FALSE;
+		}
+
+		UINT32 flags = ReadBigEndian32(data + xing + 4);
+		UINT64 field = xing + 8;
+		UINT32 mp3Frames = 0;
+
+		if (flags & 1)
+		{
+			if (field + 4 > size)
+			{
+				return S_FALSE;
+			}
+			mp3Frames = ReadBigEndian32(data + field);
+			field += 4;
+		}
+		// Byte count, seek table, quality
+		field += (flags & 2) ? 4 : 0;
+		field += (flags & 4) ? 100 : 0;
+		field += (flags & 8) ? 4 : 0;
+
+		const BYTE* lame = data + field;
+
+		// FFmpeg writes the same tag under its own name
+		if (field + 24 > size || (memcmp(lame, "LAME", 4) != 0 && memcmp(lame, "Lavc", 4) != 0 && memcmp(lame, "Lavf", 4) != 0))
+		{
+			return S_FALSE;
+		}
+
+		UINT32 encoderDelay = (static_cast<UINT32>(lame[21]) << 4) | (lame[22] >> 4);
+		UINT32 padding = (static_cast<UINT32>(lame[22] & 0x0F) << 8) | lame[23];
+
+		info.leadingFrames = encoderDelay + mp3DecoderDelay;
+		// The decoder delay pushes that much of the padding out of the decoded stream
+		info.trailingFrames = padding > mp3DecoderDelay ? padding - mp3DecoderDelay : 0;
+
+		// The Xing frame itself isn't counted, decoders that know it skip it
+		UINT64 totalFrames = static_cast<UINT64>(mp3Frames) * framesPerMp3Frame;
+		info.validFrames = totalFrames > encoderDelay + padding ? totalFrames - encoderDelay - padding : 0;
+
+		return S_OK;
+	}
+
+	struct Box
+	{
+		char type[4];
+		UINT64 payload;
+		UINT64 end;
+	};
+
+	// Reads the box header at offset and moves offset past the box
+	bool NextBox(_In_reads_bytes_(end) const BYTE* data, _In_ UINT64 end, _Inout_ UINT64& offset, _Out_ Box& box)
+	{
+		if (offset + 8 > end)
+		{
+			return false;
+		}
+
+		UINT64 size = ReadBigEndian32(data + offset);
+		UINT64 headerSize = 8;
+
+		memcpy(box.type, data + offset + 4, 4);
+
+		if (size == 1)
+		{
+			if (offset + 16 > end)
+			{
+				return false;
+			}
+			size = (static_cast<UINT64>(ReadBigEndian32(data + offset + 8)) << 32) | ReadBigEndian32(data + offset + 12);
+			headerSize = 16;
+		}
+		else if (size == 0)
+		{
+			// Up to the end of the file
+			size = end - offset;
+		}
+
+		if (size < headerSize || size > end - offset)
+		{
+			return false;
+		}
+
+		box.payload = offset + headerSize;
+		box.end = offset + size;
+		offset = box.end;
+
+		return true;
+	}
+
+	bool FindBox(_In_reads_bytes_(end) const BYTE* data, _In_ UINT64 start, _In_ UINT64 end, _In_reads_(4) const char* type, _Out_ Box& box)
+	{
+		UINT64 offset = start;
+
+		while (NextBox(data, end, offset, box))
+		{
+			if (memcmp(box.type, type, 4) == 0)
+			{
+				return true;
+			}
+		}
+
+		return false;
+	}
+
+	// Hex numbers separated by spaces, returns how many were read
+	UINT32 ParseHexFields(_In_reads_bytes_(size) const BYTE* text, _In_ UINT64 size, _Out_writes_(count) UINT64* fields, _In_ UINT32 count)
+	{
+		UINT32 parsed = 0;
+		UINT64 offset = 0;
+
+		while (parsed < count)
+		{
+			while (offset < size && text[offset] == ' ')
+			{
+				offset++;
+			}
+
+			UINT64 value = 0;
+			UINT32 digits = 0;
+
+			for (; offset < size && digits < 16; offset++, digits++)
+			{
+				BYTE c = text[offset];
+				UINT32 digit = 0;
+
+				if (c >= '0' && c <= '9') digit = c - '0';
+				else if (c >= 'A' && c <= 'F') digit = c - 'A' + 10;
+				else if (c >= 'a' && c <= 'f') digit = c - 'a' + 10;
+				else break;
+
+				value = (value << 4) | digit;
+			}
+
+			if (digits == 0)
+			{
+				break;
+			}
+
+			fields[parsed++] = value;
+		}
+
+		return parsed;
+	}
+
+	// moov/udta/meta/ilst/---- with the name iTunSMPB, the delay already includes the AAC decoder's
+	HRESULT ReadItunSmpb(_In_reads_bytes_(size) const BYTE* data, _In_ UINT64 size, _Out_ AudioPlay::GaplessInfo& info)
+	{
+		Box moov, udta, meta, ilst;
+
+		if (!FindBox(data, 0, size, "moov", moov) || !FindBox(data, moov.payload, moov.end, "udta", udta)
+			|| !FindBox(data, udta.payload, udta.end, "meta", meta))
+		{
+			return S_FALSE;
+		}
+
+		// A full box in MP4, QuickTime writes it without the version and flags
+		UINT64 metaPayload = meta.payload;
+		if (metaPayload + 4 <= meta.end && ReadBigEndian32(data + metaPayload) == 0)
+		{
+			metaPayload += 4;
+		}
+
+		if (!FindBox(data, metaPayload, meta.end, "ilst", ilst))
+		{
+			return S_FALSE;
+		}
+
+		Box item;
+		UINT64 itemOffset = ilst.payload;
+
+		while (NextBox(data, ilst.end, itemOffset, item))
+		{
+			if (memcmp(item.type, "----", 4) != 0)
+			{
+				continue;
+			}
+
+			Box child;
+			UINT64 childOffset = item.payload;
+			bool named = false;
+			const BYTE* text = nullptr;
+			UINT64 textSize = 0;
+
+			while (NextBox(data, item.end, childOffset, child))
+			{
+				// Version and flags in front of the name, type and locale in front of the value
+				if (memcmp(child.type, "name", 4) == 0 && child.end - child.payload == 4 + 8)
+				{
+					named = memcmp(data + child.payload + 4, "iTunSMPB", 8) == 0;
+				}
+				else if (memcmp(child.type, "data", 4) == 0 && child.end - child.payload > 8)
+				{
+					text = data + child.payload + 8;
+					textSize = child.end - child.payload - 8;
+				}
+			}
+
+			if (!named || text == nullptr)
+			{
+				continue;
+			}
+
+			UINT64 fields[4] = { };
+
+			if (ParseHexFields(text, textSize, fields, 4) < 4 || fields[1] > 0xFFFFFFFF || fields[2] > 0xFFFFFFFF)
+			{
+				return AUDIO_E_CORRUPT_DATA;
+			}
+
+			info.leadingFrames = static_cast<UINT32>(fields[1]);
+			info.trailingFrames = static_cast<UINT32>(fields[2]);
+			info.validFrames = fields[3];
+
+			return S_OK;
+		}
+
+		return S_FALSE;
+	}
+
+	// The pre-skip in the OpusHead packet and the granule position of the last page, both count 48 kHz frames
+	HRESULT ReadOpusPreSkip(_In_reads_bytes_(size) const BYTE* data, _In_ UINT64 size, _Out_ AudioPlay::GaplessInfo& info)
+	{
+		// The identification header is alone in the first page
+		UINT64 packet = oggHeaderSize + data[26];
+
+		if (packet + 19 > size || memcmp(data + packet, "OpusHead", 8) != 0)
+		{
+			return S_FALSE;
+		}
+
+		UINT32 serial = ReadLittleEndian32(data + 14);
+		UINT32 preSkip = data[packet + 10] | (data[packet + 11] << 8);
+
+		info.leadingFrames = preSkip;
+
+		// Pages don't say where the one before starts, the last one is found from the end
+		UINT64 searchStart = size > maxOggPageSize ? size - maxOggPageSize : 0;
+
+		for (UINT64 offset = size - oggHeaderSize + 1; offset-- > searchStart;)
+		{
+			const BYTE* page = data + offset;
+
+			if (memcmp(page, "OggS", 4) != 0 || page[4] != 0 || ReadLittleEndian32(page + 14) != serial)
+			{
+				continue;
+			}
+
+			UINT64 granule = ReadLittleEndian64(page + 6);
+
+			// No packet ends on the page
+			if (granule == ~0ULL)
+			{
+				continue;
+			}
+
+			if (granule < preSkip)
+			{
+				return AUDIO_E_CORRUPT_DATA;
+			}
+
+			// The decoder's output past the granule position of the last page is padding
+			info.validFrames = granule - preSkip;
+
+			break;
+		}
+
+		// A cut off stream still has its pre-skip, the length is the decoder's then
+		return S_OK;
+	}
+}
+
+HRESULT AudioPlay::ReadGaplessInfo(_In_reads_bytes_(size) const BYTE* data, _In_ UINT64 size, _Out_ GaplessInfo& info)
+{
+	info = { };
+
+	if (data == nullptr)
+	{
+		return E_POINTER;
+	}
+
+	HRESULT hr = S_FALSE;
+
+	if (size >= 8 && memcmp(data + 4, "ftyp", 4) == 0)
+	{
+		hr = ReadItunSmpb(data, size, info);
+	}
+	else if (size >= oggHeaderSize && memcmp(data, "OggS", 4) == 0)
+	{
+		hr = ReadOpusPreSkip(data, size, info);
+	}
+	else
+	{
+		hr = ReadLameTag(data, size, info);
+	}
+
+	if (hr != S_OK)
+	{
+		info = { };
+	}
+
+	return hr;
+}
+
+HRESULT AudioPlay::ReadGaplessInfo(_In_ MemoryBlock* block, _Out_ GaplessInfo& info)
+{
+	if (block == nullptr)
+	{
+		info = { };
+		return E_POINTER;
+	}
+
+	return ReadGaplessInfo(block->GetData(), block->GetSize(), info);
+}
+
+
+AudioPlay::TrimSource::TrimSource() :
+	leadingFrames(0), length(unknownLength), position(0)
+{
+}
+
+HRESULT AudioPlay::TrimSource::Create(_In_ PcmSource* source, _In_ const GaplessInfo& info, _COM_Outptr_ TrimSource** pPtrSource)
+{
+	if (pPtrSource == nullptr)
+	{
+		return E_INVALIDARG;
+	}
+	*pPtrSource = nullptr;
+
+	if (source == nullptr)
+	{
+		return E_POINTER;
+	}
+
+	HRESULT hr = S_OK;
+
+	ComPtr<TrimSource> trim;
+	trim.Attach(new (std::nothrow) TrimSource());
+
+	if (!trim)
+	{
+		return E_OUTOFMEMORY;
+	}
+
+	trim->source = source;
+	trim->format = source->GetFormat();
+	trim->leadingFrames = info.leadingFrames;
+
+	UINT64 sourceLength = 0;
+
+	if (info.validFrames)
+	{
+		trim->length = info.validFrames;
+	}
+	else if (SUCCEEDED(source->GetLength(sourceLength)) && sourceLength > static_cast<UINT64>(info.leadingFrames) + info.trailingFrames)
+	{
+		// Media Foundation estimates it from the duration, it may be a few frames off
+		trim->length = sourceLength - info.leadingFrames - info.trailingFrames;
+	}
+
+	hr = source->Seek(info.leadingFrames); HR_FAIL(hr);
+
+	*pPtrSource = trim.Detach();
+
+	return hr;
+}
+
+HRESULT AudioPlay::TrimSource::Read(_Out_writes_(frameCount * format.channels) float* buffer, _In_ UINT32 frameCount, _Out_ UINT32& framesRead)
+{
+	framesRead = 0;
+
+	UINT32 wanted = frameCount;
+
+	if (length != unknownLength)
+	{
+		UINT64 remaining = position < length ? length - position : 0;
+		wanted = remaining < wanted ? static_cast<UINT32>(remaining) : wanted;
+	}
+
+	if (wanted == 0)
+	{
+		return S_OK;
+	}
+
+	HRESULT hr = source->Read(buffer, wanted, framesRead); HR_FAIL(hr);
+
+	position += framesRead;
+
+	return hr;
+}
+
+HRESULT AudioPlay::TrimSource::Seek(_In_ UINT64 frame)
+{
+	HRESULT hr = source->Seek(frame + leadingFrames); HR_FAIL(hr);
+
+	position = frame;
+
+	return hr;
+}
+
+HRESULT AudioPlay::TrimSource::GetPosition(_Out_ UINT64& frame) const
+{
+	frame = position;
+
+	return S_OK;
+}
+
+HRESULT AudioPlay::TrimSource::GetLength(_Out_ UINT64& frames) const
+{
+	if (length == unknownLength)
+	{
+		frames = 0;
+		return E_NOTIMPL;
+	}
+
+	frames = length;
+
+	return S_OK;
+}
@@ -0,0 +1,209 @@
+#include "LoopingSource.h"
+
+#include <cstring>
+#include <new>
+
+
+#define HR_FAIL_ACTION(hresult, action) if (FAILED(hresult)) { action; return hresult; }
+#define HR_FAIL(hresult) if (FAILED(hresult)) { return hresult; }
+
+
+AudioPlay::LoopingSource::LoopingSource() :
+	loopStart(0), loopEnd(unknownEnd), loopsRemaining(0), wrapCount(0), region(nullptr), regionFrames(0), position(0), sourcePosition(0)
+{
+}
+
+AudioPlay::LoopingSource::~LoopingSource()
+{
+	delete[] region;
+}
+
+HRESULT AudioPlay::LoopingSource::Create(_In_ PcmSource* source, _In_ UINT64 startFrame, _In_ UINT64 endFrame, _In_ UINT32 loopCount, _COM_Outptr_ LoopingSource** pPtrSource)
+{
+	if (pPtrSource == nullptr)
+	{
+		return E_INVALIDARG;
+	}
+	*pPtrSource = nullptr;
+
+	if (source == nullptr)
+	{
+		return E_POINTER;
+	}
+
+	HRESULT hr = S_OK;
+
+	UINT64 length = 0;
+	bool lengthKnown = SUCCEEDED(source->GetLength(length));
+
+	if (endFrame == 0)
+	{
+		endFrame = lengthKnown ? length : unknownEnd;
+	}
+
+	if (startFrame >= endFrame || (lengthKnown && endFrame > length))
+	{
+		return E_INVALIDARG;
+	}
+
+	ComPtr<LoopingSource> looping;
+	looping.Attach(new (std::nothrow) LoopingSource());
+
+	if (!looping)
+	{
+		return E_OUTOFMEMORY;
+	}
+
+	looping->source = source;
+	looping->format = source->GetFormat();
+	looping->loopStart = startFrame;
+	looping->loopEnd = endFrame;
+	looping->loopsRemaining = loopCount;
+
+	hr = source->GetPosition(looping->position); HR_FAIL(hr);
+	looping->sourcePosition = looping->position;
+
+	UINT64 frameBytes = static_cast<UINT64>(looping->format.channels) * sizeof(float);
+
+	if (endFrame != unknownEnd && (endFrame - startFrame) * frameBytes <= maxPredecodedBytes)
+	{
+		UINT64 frameCount = endFrame - startFrame;
+
+		looping->region = new (std::nothrow) float[static_cast<size_t>(frameCount * looping->format.channels)];
+
+		if (looping->region == nullptr)
+		{
+			return E_OUTOFMEMORY;
+		}
+
+		hr = source->Seek(startFrame); HR_FAIL(hr);
+
+		while (looping->regionFrames < frameCount)
+		{
+			UINT64 remaining = frameCount - looping->regionFrames;
+			UINT32 wanted = remaining < 65536 ? static_cast<UINT32>(remaining) : 65536;
+			UINT32 framesRead = 0;
+
+			hr = source->Read(looping->region + looping->regionFrames * looping->format.channels, wanted, framesRead); HR_FAIL(hr);
+
+			looping->regionFrames += framesRead;
+
+			if (framesRead < wanted)
+			{
+				break;
+			}
+		}
+
+		if (looping->regionFrames == 0)
+		{
+			return E_INVALIDARG;
+		}
+
+		// The source ended early, its length was an estimate
+		looping->loopEnd = startFrame + looping->regionFrames;
+		looping->sourcePosition = looping->loopEnd;
+	}
+
+	*pPtrSource = looping.Detach();
+
+	return hr;
+}
+
+HRESULT AudioPlay::LoopingSource::Read(_Out_writes_(frameCount * format.channels) float* buffer, _In_ UINT32 frameCount, _Out_ UINT32& framesRead)
+{
+	HRESULT hr = S_OK;
+
+	framesRead = 0;
+
+	while (framesRead < frameCount)
+	{
+		UINT32 loops = loopsRemaining.load(std::memory_order_relaxed);
+		bool looping = loops != 0 && position < loopEnd;
+
+		if (loops != 0 && position == loopEnd)
+		{
+			// SetLoopCount may have changed it, the new count wins
+			if (loops != loopForever && !loopsRemaining.compare_exchange_strong(loops, loops - 1, std::memory_order_relaxed))
+			{
+				continue;
+			}
+
+			position = loopStart;
+			wrapCount++;
+			continue;
+		}
+
+		UINT32 wanted = frameCount - framesRead;
+
+		if (looping && loopEnd - position < wanted)
+		{
+			wanted = static_cast<UINT32>(loopEnd - position);
+		}
+
+		float* output = buffer + static_cast<size_t>(framesRead) * format.channels;
+
+		if (region && position >= loopStart && position < loopStart + regionFrames)
+		{
+			UINT64 available = loopStart + regionFrames - position;
+			UINT32 count = available < wanted ? static_cast<UINT32>(available) : wanted;
+
+			memcpy(output, region + (position - loopStart) * format.channels, static_cast<size_t>(count) * format.channels * sizeof(float));
+
+			position += count;
+			framesRead += count;
+			continue;
+		}
+
+		if (sourcePosition != position)
+		{
+			hr = source->Seek(position); HR_FAIL(hr);
+			sourcePosition = position;
+		}
+
+		UINT32 sourceRead = 0;
+
+		hr = source->Read(output, wanted, sourceRead); HR_FAIL(hr);
+
+		position += sourceRead;
+		sourcePosition += sourceRead;
+		framesRead += sourceRead;
+
+		if (sourceRead < wanted)
+		{
+			// The end of the source is the end of the loop when its length wasn't known
+			if (looping && position > loopStart)
+			{
+				loopEnd = position;
+				continue;
+			}
+
+			break;
+		}
+	}
+
+	return hr;
+}
+
+HRESULT AudioPlay::LoopingSource::Seek(_In_ UINT64 frame)
+{
+	HRESULT hr = source->Seek(frame); HR_FAIL(hr);
+
+	position = frame;
+	sourcePosition = frame;
+
+	return hr;
+}
+
+HRESULT AudioPlay::LoopingSource::GetPosition(_Out_ UINT64& frame) const
+{
+	frame = position;
+
+	return S_OK;
+}
+
+HRESULT AudioPlay::LoopingSource::GetLength(_Out_ UINT64& frames) const
+{
+	HRESULT hr = source->GetLength(frames); HR_FAIL(hr);
+
+	return loopsRemaining == loopForever ? S_FALSE : hr;
+}
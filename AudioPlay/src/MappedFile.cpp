@@ -0,0 +1,230 @@
+#include "MappedFile.h"
+#include "PosixUtil.h"
+
+#include <new>
+
+#ifndef _WIN32
+#include <cerrno>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+
+#define HR_FAIL_ACTION(hresult, action) if (FAILED(hresult)) { action; return hresult; }
+#define HR_FAIL(hresult) if (FAILED(hresult)) { return hresult; }
+
+
+AudioPlay::MemoryBlock::MemoryBlock() :
+	referenceCount(1), data(nullptr), size(0)
+{
+}
+
+AudioPlay::MemoryBlock::MemoryBlock(_In_reads_bytes_(p_size) const BYTE* p_data, _In_ UINT64 p_size) :
+	referenceCount(1), data(p_data), size(p_size)
+{
+}
+
+AudioPlay::MemoryBlock::~MemoryBlock()
+{
+}
+
+HRESULT AudioPlay::MemoryBlock::CreateFromSpan(_In_reads_bytes_(size) const BYTE* data, _In_ UINT64 size, _COM_Outptr_ MemoryBlock** pPtrBlock)
+{
+	if (pPtrBlock == nullptr)
+	{
+		return E_INVALIDARG;
+	}
+	*pPtrBlock = nullptr;
+
+	if (data == nullptr && size != 0)
+	{
+		return E_POINTER;
+	}
+
+	MemoryBlock* block = new (std::nothrow) MemoryBlock(data, size);
+
+	if (block == nullptr)
+	{
+		return E_OUTOFMEMORY;
+	}
+
+	*pPtrBlock = block;
+
+	return S_OK;
+}
+
+ULONG STDMETHODCALLTYPE AudioPlay::MemoryBlock::AddRef()
+{
+	return ++referenceCount;
+}
+
+ULONG STDMETHODCALLTYPE AudioPlay::MemoryBlock::Release()
+{
+	ULONG newRefCount = --referenceCount;
+
+	if (newRefCount == 0)
+	{
+		delete this;
+	}
+
+	return newRefCount;
+}
+
+#ifdef _WIN32
+
+AudioPlay::MappedFile::MappedFile() :
+	file(INVALID_HANDLE_VALUE), mapping(nullptr)
+{
+}
+
+AudioPlay::MappedFile::~MappedFile()
+{
+	if (data)
+	{
+		UnmapViewOfFile(data);
+	}
+	if (mapping)
+	{
+		CloseHandle(mapping);
+	}
+	if (file != INVALID_HANDLE_VALUE)
+	{
+		CloseHandle(file);
+	}
+}
+
+HRESULT AudioPlay::MappedFile::Open(_In_z_ LPCWCH path, _COM_Outptr_ MappedFile** pPtrFile)
+{
+	if (pPtrFile == nullptr)
+	{
+		return E_INVALIDARG;
+	}
+	*pPtrFile = nullptr;
+
+	if (path == nullptr)
+	{
+		return E_POINTER;
+	}
+
+	ComPtr<MappedFile> mappedFile;
+	mappedFile.Attach(new (std::nothrow) MappedFile());
+
+	if (!mappedFile)
+	{
+		return E_OUTOFMEMORY;
+	}
+
+	mappedFile->file = CreateFileW(path, GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+
+	if (mappedFile->file == INVALID_HANDLE_VALUE)
+	{
+		return HRESULT_FROM_WIN32(GetLastError());
+	}
+
+	LARGE_INTEGER fileSize = { 0 };
+	if (!GetFileSizeEx(mappedFile->file, &fileSize))
+	{
+		return HRESULT_FROM_WIN32(GetLastError());
+	}
+
+	mappedFile->size = static_cast<UINT64>(fileSize.QuadPart);
+
+	// Empty files can't be mapped
+	if (mappedFile->size != 0)
+	{
+		mappedFile->mapping = CreateFileMappingW(mappedFile->file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+
+		if (mappedFile->mapping == nullptr)
+		{
+			return HRESULT_FROM_WIN32(GetLastError());
+		}
+
+		mappedFile->data = reinterpret_cast<const BYTE*>(MapViewOfFile(mappedFile->mapping, FILE_MAP_READ, 0, 0, 0));
+
+		if (mappedFile->data == nullptr)
+		{
+			return HRESULT_FROM_WIN32(GetLastError());
+		}
+	}
+
+	*pPtrFile = mappedFile.Detach();
+
+	return S_OK;
+}
+
+#else
+
+AudioPlay::MappedFile::MappedFile() :
+	descriptor(-1)
+{
+}
+
+AudioPlay::MappedFile::~MappedFile()
+{
+	if (data)
+	{
+		munmap(const_cast<BYTE*>(data), static_cast<size_t>(size));
+	}
+	if (descriptor != -1)
+	{
+		close(descriptor);
+	}
+}
+
+HRESULT AudioPlay::MappedFile::Open(_In_z_ LPCWCH path, _COM_Outptr_ MappedFile** pPtrFile)
+{
+	if (pPtrFile == nullptr)
+	{
+		return E_INVALIDARG;
+	}
+	*pPtrFile = nullptr;
+
+	if (path == nullptr)
+	{
+		return E_POINTER;
+	}
+
+	ComPtr<MappedFile> mappedFile;
+	mappedFile.Attach(new (std::nothrow) MappedFile());
+
+	if (!mappedFile)
+	{
+		return E_OUTOFMEMORY;
+	}
+
+	mappedFile->descriptor = OpenDescriptor(path, O_RDONLY | O_CLOEXEC);
+
+	if (mappedFile->descriptor == -1)
+	{
+		return HResultFromErrno(errno);
+	}
+
+	struct stat status;
+	if (fstat(mappedFile->descriptor, &status) != 0)
+	{
+		return HResultFromErrno(errno);
+	}
+
+	mappedFile->size = static_cast<UINT64>(status.st_size);
+
+	// Empty files can't be mapped
+	if (mappedFile->size != 0)
+	{
+		void* view = mmap(nullptr, static_cast<size_t>(mappedFile->size), PROT_READ, MAP_PRIVATE, mappedFile->descriptor, 0);
+
+		if (view == MAP_FAILED)
+		{
+			return HResultFromErrno(errno);
+		}
+
+		mappedFile->data = reinterpret_cast<const BYTE*>(view);
+	}
+
+	*pPtrFile = mappedFile.Detach();
+
+	return S_OK;
+}
+
+#endif
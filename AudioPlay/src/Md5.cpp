@@ -0,0 +1,155 @@
+#include "Md5.h"
+
+#include <cstring>
+
+
+namespace
+{
+	constexpr UINT32 shifts[64] =
+	{
+		7, 12, 17, 22, 7, 12, 17, 22, 7, 12, 17, 22, 7, 12, 17, 22,
+		5, 9, 14, 20, 5, 9, 14, 20, 5, 9, 14, 20, 5, 9, 14, 20,
+		4, 11, 16, 23, 4, 11, 16, 23, 4, 11, 16, 23, 4, 11, 16, 23,
+		6, 10, 15, 21, 6, 10, 15, 21, 6, 10, 15, 21, 6, 10, 15, 21
+	};
+
+	// floor(abs(sin(i + 1)) * 2^32)
+	constexpr UINT32 constants[64] =
+	{
+		0xd76aa478, 0xe8c7b756, 0x242070db, 0xc1bdceee, 0xf57c0faf, 0x4787c62a, 0xa8304613, 0xfd469501,
+		0x698098d8, 0x8b44f7af, 0xffff5bb1, 0x895cd7be, 0x6b901122, 0xfd987193, 0xa679438e, 0x49b40821,
+		0xf61e2562, 0xc040b340, 0x265e5a51, 0xe9b6c7aa, 0xd62f105d, 0x02441453, 0xd8a1e681, 0xe7d3fbc8,
+		0x21e1cde6, 0xc33707d6, 0xf4d50d87, 0x455a14ed, 0xa9e3e905, 0xfcefa3f8, 0x676f02d9, 0x8d2a4c8a,
+		0xfffa3942, 0x8771f681, 0x6d9d6122, 0xfde5380c, 0xa4beea44, 0x4bdecfa9, 0xf6bb4b60, 0xbebfbc70,
+		0x289b7ec6, 0xeaa127fa, 0xd4ef3085, 0x04881d05, 0xd9d4d039, 0xe6db99e5, 0x1fa27cf8, 0xc4ac5665,
+		0xf4292244, 0x432aff97, 0xab9423a7, 0xfc93a039, 0x655b59c3, 0x8f0ccc92, 0xffeff47d, 0x85845dd1,
+		0x6fa87e4f, 0xfe2ce6e0, 0xa3014314, 0x4e0811a1, 0xf7537e82, 0xbd3af235, 0x2ad7d2bb, 0xeb86d391
+	};
+
+	inline UINT32 RotateLeft(UINT32 value, UINT32 count)
+	{
+		return (value << count) | (value >> (32 - count));
+	}
+}
+
+AudioPlay::Md5::Md5()
+{
+	Reset();
+}
+
+void AudioPlay::Md5::Reset()
+{
+	state[0] = 0x67452301;
+	state[1] = 0xefcdab89;
+	state[2] = 0x98badcfe;
+	state[3] = 0x10325476;
+	length = 0;
+}
+
+void AudioPlay::Md5::Transform(_In_reads_bytes_(64) const BYTE* block)
+{
+	UINT32 words[16];
+
+	for (int index = 0; index < 16; index++)
+	{
+		const BYTE* word = block + index * 4;
+		words[index] = static_cast<UINT32>(word[0]) | (static_cast<UINT32>(word[1]) << 8) | (static_cast<UINT32>(word[2]) << 16) | (static_cast<UINT32>(word[3]) << 24);
+	}
+
+	UINT32 a = state[0];
+	UINT32 b = state[1];
+	UINT32 c = state[2];
+	UINT32 d = state[3];
+
+	for (UINT32 round = 0; round < 64; round++)
+	{
+		UINT32 f;
+		UINT32 g;
+
+		if (round < 16)
+		{
+			f = (b & c) | (~b & d);
+			g = round;
+		}
+		else if (round < 32)
+		{
+			f = (d & b) | (~d & c);
+			g = (5 * round + 1) & 15;
+		}
+		else if (round < 48)
+		{
+			f = b ^ c ^ d;
+			g = (3 * round + 5) & 15;
+		}
+		else
+		{
+			f = c ^ (b | ~d);
+			g = (7 * round) & 15;
+		}
+
+		UINT32 rotated = d;
+		d = c;
+		c = b;
+		b = b + RotateLeft(a + f + constants[round] + words[g], shifts[round]);
+		a = rotated;
+	}
+
+	state[0] += a;
+	state[1] += b;
+	state[2] += c;
+	state[3] += d;
+}
+
+void AudioPlay::Md5::Update(_In_reads_bytes_(size) const void* data, _In_ size_t size)
+{
+	const BYTE* bytes = static_cast<const BYTE*>(data);
+	size_t buffered = static_cast<size_t>(length & 63);
+
+	length += size;
+
+	if (buffered)
+	{
+		size_t count = 64 - buffered < size ? 64 - buffered : size;
+		memcpy(buffer + buffered, bytes, count);
+
+		bytes += count;
+		size -= count;
+
+		if (buffered + count < 64)
+		{
+			return;
+		}
+
+		Transform(buffer);
+	}
+
+	for (; size >= 64; bytes += 64, size -= 64)
+	{
+		Transform(bytes);
+	}
+
+	memcpy(buffer, bytes, size);
+}
+
+void AudioPlay::Md5::Finish(_Out_writes_bytes_(16) BYTE* digest)
+{
+	UINT64 bitLength = length * 8;
+
+	static const BYTE padding[64] = { 0x80 };
+	size_t buffered = static_cast<size_t>(length & 63);
+
+	Update(padding, buffered < 56 ? 56 - buffered : 120 - buffered);
+
+	BYTE lengthBytes[8];
+	for (int index = 0; index < 8; index++)
+	{
+		lengthBytes[index] = static_cast<BYTE>(bitLength >> (index * 8));
+	}
+
+	Update(lengthBytes, 8);
+
+	for (int index = 0; index < 16; index++)
+	{
+		digest[index] = static_cast<BYTE>(state[index / 4] >> ((index % 4) * 8));
+	}
+}
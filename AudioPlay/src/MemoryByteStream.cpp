@@ -0,0 +1,340 @@
+#include "MemoryByteStream.h"
+#include "AutoCriticalSection.h"
+
+#include <new>
+
+
+#define HR_FAIL_ACTION(hresult, action) if (FAILED(hresult)) { action; return hresult; }
+#define HR_FAIL(hresult) if (FAILED(hresult)) { return hresult; }
+
+
+namespace
+{
+	// Carries the byte count of a BeginRead to its EndRead
+	class ReadOperation : public IUnknown
+	{
+		ULONG referenceCount;
+
+		public:
+		ULONG bytesRead;
+
+		ReadOperation(ULONG read) : referenceCount(1), bytesRead(read) { }
+		virtual ~ReadOperation() = default;
+
+		STDMETHODIMP QueryInterface(REFIID riid, _COM_Outptr_ void** pPtr)
+		{
+			if (pPtr == nullptr)
+			{
+				return E_POINTER;
+			}
+			if (riid == IID_IUnknown)
+			{
+				*pPtr = static_cast<IUnknown*>(this);
+				AddRef();
+				return S_OK;
+			}
+			*pPtr = nullptr;
+			return E_NOINTERFACE;
+		}
+
+		STDMETHODIMP_(ULONG) AddRef() { return InterlockedIncrement(&referenceCount); }
+		STDMETHODIMP_(ULONG) Release()
+		{
+			ULONG newRefCount = InterlockedDecrement(&referenceCount);
+			if (newRefCount == 0)
+			{
+				delete this;
+			}
+			return newRefCount;
+		}
+	};
+}
+
+AudioPlay::MemoryByteStream::MemoryByteStream(_In_ MemoryBlock* p_block) :
+	referenceCount(1), block(p_block), position(0)
+{
+	InitializeCriticalSection(&criticalSection);
+}
+
+AudioPlay::MemoryByteStream::~MemoryByteStream()
+{
+	DeleteCriticalSection(&criticalSection);
+}
+
+HRESULT AudioPlay::MemoryByteStream::Create(_In_ MemoryBlock* block, _COM_Outptr_ IMFByteStream** pPtrByteStream)
+{
+	if (pPtrByteStream == nullptr)
+	{
+		return E_INVALIDARG;
+	}
+	*pPtrByteStream = nullptr;
+
+	if (block == nullptr)
+	{
+		return E_POINTER;
+	}
+
+	MemoryByteStream* byteStream = new (std::nothrow) MemoryByteStream(block);
+
+	if (byteStream == nullptr)
+	{
+		return E_OUTOFMEMORY;
+	}
+
+	*pPtrByteStream = byteStream;
+
+	return S_OK;
+}
+
+#pragma region IMPLEMET_IUnknown
+
+STDMETHODIMP_(ULONG) AudioPlay::MemoryByteStream::AddRef()
+{
+	return InterlockedIncrement(&referenceCount);
+}
+
+STDMETHODIMP_(ULONG) AudioPlay::MemoryByteStream::Release()
+{
+	ULONG newRefCount = InterlockedDecrement(&referenceCount);
+
+	if (newRefCount == 0)
+	{
+		delete this;
+	}
+
+	return newRefCount;
+}
+
+STDMETHODIMP AudioPlay::MemoryByteStream::QueryInterface(REFIID riid, _COM_Outptr_ void** pPtr)
+{
+	if (pPtr == nullptr)
+	{
+		return E_POINTER;
+	}
+
+	if (riid == IID_IUnknown)
+	{
+		*pPtr = static_cast<IUnknown*>(this);
+	}
+	else if (riid == IID_IMFByteStream)
+	{
+		*pPtr = static_cast<IMFByteStream*>(this);
+	}
+	else
+	{
+		*pPtr = NULL;
+		return E_NOINTERFACE;
+	}
+
+	AddRef();
+	return S_OK;
+}
+
+#pragma endregion
+
+#pragma region IMPLEMENT_IMFByteStream
+
+STDMETHODIMP AudioPlay::MemoryByteStream::GetCapabilities(_Out_ DWORD* pdwCapabilities)
+{
+	if (pdwCapabilities == nullptr)
+	{
+		return E_POINTER;
+	}
+
+	*pdwCapabilities = MFBYTESTREAM_IS_READABLE | MFBYTESTREAM_IS_SEEKABLE | MFBYTESTREAM_DOES_NOT_USE_NETWORK;
+
+	return S_OK;
+}
+
+STDMETHODIMP AudioPlay::MemoryByteStream::GetLength(_Out_ QWORD* pqwLength)
+{
+	if (pqwLength == nullptr)
+	{
+		return E_POINTER;
+	}
+
+	*pqwLength = block->GetSize();
+
+	return S_OK;
+}
+
+STDMETHODIMP AudioPlay::MemoryByteStream::SetLength(_In_ QWORD qwLength)
+{
+	UNREFERENCED_PARAMETER(qwLength);
+
+	return E_ACCESSDENIED;
+}
+
+STDMETHODIMP AudioPlay::MemoryByteStream::GetCurrentPosition(_Out_ QWORD* pqwPosition)
+{
+	if (pqwPosition == nullptr)
+	{
+		return E_POINTER;
+	}
+
+	AutoCriticalSection section(&criticalSection);
+
+	*pqwPosition = position;
+
+	return S_OK;
+}
+
+STDMETHODIMP AudioPlay::MemoryByteStream::SetCurrentPosition(_In_ QWORD qwPosition)
+{
+	AutoCriticalSection section(&criticalSection);
+
+	if (qwPosition > block->GetSize())
+	{
+		return E_INVALIDARG;
+	}
+
+	position = qwPosition;
+
+	return S_OK;
+}
+
+STDMETHODIMP AudioPlay::MemoryByteStream::IsEndOfStream(_Out_ BOOL* pfEndOfStream)
+{
+	if (pfEndOfStream == nullptr)
+	{
+		return E_POINTER;
+	}
+
+	AutoCriticalSection section(&criticalSection);
+
+	*pfEndOfStream = position >= block->GetSize();
+
+	return S_OK;
+}
+
+STDMETHODIMP AudioPlay::MemoryByteStream::Read(_Out_writes_bytes_(cb) BYTE* pb, _In_ ULONG cb, _Out_ ULONG* pcbRead)
+{
+	if (pb == nullptr || pcbRead == nullptr)
+	{
+		return E_POINTER;
+	}
+
+	AutoCriticalSection section(&criticalSection);
+
+	UINT64 available = block->GetSize() - position;
+	ULONG read = available < cb ? static_cast<ULONG>(available) : cb;
+
+	// The decoder's buffer is the only copy, the bytes come straight from the block
+	if (read)
+	{
+		CopyMemory(pb, block->GetData() + position, read);
+	}
+
+	position += read;
+	*pcbRead = read;
+
+	return S_OK;
+}
+
+STDMETHODIMP AudioPlay::MemoryByteStream::BeginRead(_Out_writes_bytes_(cb) BYTE* pb, _In_ ULONG cb, _In_ IMFAsyncCallback* pCallback, _In_opt_ IUnknown* punkState)
+{
+	if (pCallback == nullptr)
+	{
+		return E_POINTER;
+	}
+
+	ComPtr<IMFAsyncResult> asyncResult;
+	ComPtr<ReadOperation> operation;
+
+	ULONG read = 0;
+	HRESULT readResult = Read(pb, cb, &read);
+
+	operation.Attach(new (std::nothrow) ReadOperation(read));
+
+	if (!operation)
+	{
+		return E_OUTOFMEMORY;
+	}
+
+	HRESULT hr = MFCreateAsyncResult(operation, pCallback, punkState, &asyncResult); HR_FAIL(hr);
+
+	asyncResult->SetStatus(readResult);
+
+	hr = MFInvokeCallback(asyncResult);
+
+	return hr;
+}
+
+STDMETHODIMP AudioPlay::MemoryByteStream::EndRead(_In_ IMFAsyncResult* pResult, _Out_ ULONG* pcbRead)
+{
+	if (pResult == nullptr || pcbRead == nullptr)
+	{
+		return E_POINTER;
+	}
+	*pcbRead = 0;
+
+	ComPtr<IUnknown> object;
+
+	HRESULT hr = pResult->GetObject(&object); HR_FAIL(hr);
+
+	*pcbRead = static_cast<ReadOperation*>(object.p)->bytesRead;
+
+	return pResult->GetStatus();
+}
+
+STDMETHODIMP AudioPlay::MemoryByteStream::Write(_In_reads_bytes_(cb) const BYTE* pb, _In_ ULONG cb, _Out_ ULONG* pcbWritten)
+{
+	UNREFERENCED_PARAMETER(pb); UNREFERENCED_PARAMETER(cb); UNREFERENCED_PARAMETER(pcbWritten);
+
+	return E_ACCESSDENIED;
+}
+
+STDMETHODIMP AudioPlay::MemoryByteStream::BeginWrite(_In_reads_bytes_(cb) const BYTE* pb, _In_ ULONG cb, _In_ IMFAsyncCallback* pCallback, _In_opt_ IUnknown* punkState)
+{
+	UNREFERENCED_PARAMETER(pb); UNREFERENCED_PARAMETER(cb);
+	UNREFERENCED_PARAMETER(pCallback); UNREFERENCED_PARAMETER(punkState);
+
+	return E_ACCESSDENIED;
+}
+
+STDMETHODIMP AudioPlay::MemoryByteStream::EndWrite(_In_ IMFAsyncResult* pResult, _Out_ ULONG* pcbWritten)
+{
+	UNREFERENCED_PARAMETER(pResult); UNREFERENCED_PARAMETER(pcbWritten);
+
+	return E_ACCESSDENIED;
+}
+
+STDMETHODIMP AudioPlay::MemoryByteStream::Seek(_In_ MFBYTESTREAM_SEEK_ORIGIN SeekOrigin, _In_ LONGLONG llSeekOffset, _In_ DWORD dwSeekFlags, _Out_opt_ QWORD* pqwCurrentPosition)
+{
+	UNREFERENCED_PARAMETER(dwSeekFlags);
+
+	AutoCriticalSection section(&criticalSection);
+
+	LONGLONG newPosition = llSeekOffset;
+
+	if (SeekOrigin == msoCurrent)
+	{
+		newPosition += static_cast<LONGLONG>(position);
+	}
+
+	if (newPosition < 0 || static_cast<UINT64>(newPosition) > block->GetSize())
+	{
+		return E_INVALIDARG;
+	}
+
+	position = static_cast<QWORD>(newPosition);
+
+	if (pqwCurrentPosition)
+	{
+		*pqwCurrentPosition = position;
+	}
+
+	return S_OK;
+}
+
+STDMETHODIMP AudioPlay::MemoryByteStream::Flush()
+{
+	return S_OK;
+}
+
+STDMETHODIMP AudioPlay::MemoryByteStream::Close()
+{
+	return S_OK;
+}
+
+#pragma endregion
@@ -0,0 +1,376 @@
+#include "MetadataSnapshot.h"
+
+#include <Propkey.h>
+#include <new>
+
+
+#define HR_FAIL_ACTION(hresult, action) if (FAILED(hresult)) { action; return hresult; }
+#define HR_FAIL(hresult) if (FAILED(hresult)) { return hresult; }
+
+
+namespace
+{
+	constexpr WCHAR separator[] = L"; ";
+	constexpr DWORD stackValueCount = 64;
+
+	bool IsString(const PROPVARIANT& value)
+	{
+		return value.vt == VT_LPWSTR || value.vt == VT_BSTR || value.vt == (VT_VECTOR | VT_LPWSTR);
+	}
+
+	bool IsSupported(const PROPVARIANT& value)
+	{
+		switch (value.vt)
+		{
+			case VT_I2: case VT_I4: case VT_I8:
+			case VT_UI2: case VT_UI4: case VT_UI8:
+			case VT_R8: case VT_BOOL: case VT_FILETIME:
+			{
+				return true;
+			}
+		}
+		return IsString(value);
+	}
+
+	bool IsEqualKey(REFPROPERTYKEY lhs, REFPROPERTYKEY rhs)
+	{
+		return lhs.pid == rhs.pid && IsEqualGUID(lhs.fmtid, rhs.fmtid);
+	}
+
+	// Walks the characters of a string property, vector elements are joined with the separator
+	class StringCursor
+	{
+		const PROPVARIANT& value;
+		ULONG element = 0;
+		LPCWCH current = nullptr;
+		LPCWCH pendingSeparator = nullptr;
+
+		public:
+		StringCursor(const PROPVARIANT& p_value) :
+			value(p_value)
+		{
+			if (value.vt == (VT_VECTOR | VT_LPWSTR))
+			{
+				current = value.calpwstr.cElems ? value.calpwstr.pElems[0] : nullptr;
+			}
+			else
+			{
+				current = value.vt == VT_BSTR ? value.bstrVal : value.pwszVal;
+			}
+		}
+
+		// Returns L'\0' after the last character
+		WCHAR Next()
+		{
+			while (true)
+			{
+				if (pendingSeparator && *pendingSeparator)
+				{
+					return *pendingSeparator++;
+				}
+				pendingSeparator = nullptr;
+
+				if (current && *current)
+				{
+					return *current++;
+				}
+
+				if (value.vt != (VT_VECTOR | VT_LPWSTR) || element + 1 >= value.calpwstr.cElems)
+				{
+					return L'\0';
+				}
+
+				element++;
+				current = value.calpwstr.pElems[element];
+				pendingSeparator = separator;
+			}
+		}
+	};
+
+	size_t StringLength(const PROPVARIANT& value)
+	{
+		StringCursor cursor(value);
+
+		size_t length = 0;
+		while (cursor.Next())
+		{
+			length++;
+		}
+
+		return length;
+	}
+
+	bool StringEquals(const PROPVARIANT& lhs, const PROPVARIANT& rhs)
+	{
+		StringCursor lhsCursor(lhs);
+		StringCursor rhsCursor(rhs);
+
+		while (true)
+		{
+			WCHAR lhsChar = lhsCursor.Next();
+			if (lhsChar != rhsCursor.Next())
+			{
+				return false;
+			}
+			if (lhsChar == L'\0')
+			{
+				return true;
+			}
+		}
+	}
+
+	// Scratch storage for the values read from the store, on the stack unless the file has a lot of properties
+	class PropertyValues
+	{
+		PROPERTYKEY stackKeys[stackValueCount];
+		PROPVARIANT stackValues[stackValueCount];
+		DWORD stackSameAs[stackValueCount];
+
+		DWORD count = 0;
+
+		public:
+		PROPERTYKEY* keys = stackKeys;
+		PROPVARIANT* values = stackValues;
+		// Index of the first entry with an identical string
+		DWORD* sameAs = stackSameAs;
+
+		HRESULT Reserve(DWORD capacity)
+		{
+			if (capacity <= stackValueCount)
+			{
+				return S_OK;
+			}
+
+			keys = new (std::nothrow) PROPERTYKEY[capacity];
+			values = new (std::nothrow) PROPVARIANT[capacity];
+			sameAs = new (std::nothrow) DWORD[capacity];
+
+			return (keys && values && sameAs) ? S_OK : E_OUTOFMEMORY;
+		}
+
+		void SetCount(DWORD p_count) { count = p_count; }
+
+		~PropertyValues()
+		{
+			if (values)
+			{
+				for (DWORD index = 0; index < count; index++)
+				{
+					PropVariantClear(&values[index]);
+				}
+			}
+
+			if (keys != stackKeys)
+			{
+				delete[] keys;
+			}
+			if (values != stackValues)
+			{
+				delete[] values;
+			}
+			if (sameAs != stackSameAs)
+			{
+				delete[] sameAs;
+			}
+		}
+	};
+}
+
+HRESULT AudioPlay::MetadataSnapshot::Create(_In_ IMFMediaSource* mediaSource, _Outptr_result_maybenull_ MetadataSnapshot** pPtrSnapshot)
+{
+	if (pPtrSnapshot == nullptr)
+	{
+		return E_INVALIDARG;
+	}
+	*pPtrSnapshot = nullptr;
+
+	if (mediaSource == nullptr)
+	{
+		return E_POINTER;
+	}
+
+	ComPtr<IPropertyStore> propertyStore;
+
+	HRESULT hr = MFGetService(mediaSource, MF_PROPERTY_HANDLER_SERVICE, IID_PPV_ARGS(&propertyStore)); HR_FAIL(hr);
+
+	return Create(propertyStore, pPtrSnapshot);
+}
+
+HRESULT AudioPlay::MetadataSnapshot::Create(_In_ IPropertyStore* propertyStore, _Outptr_result_maybenull_ MetadataSnapshot** pPtrSnapshot)
+{
+	if (pPtrSnapshot == nullptr)
+	{
+		return E_INVALIDARG;
+	}
+	*pPtrSnapshot = nullptr;
+
+	if (propertyStore == nullptr)
+	{
+		return E_POINTER;
+	}
+
+	HRESULT hr = S_OK;
+
+	DWORD propertyCount = 0;
+	hr = propertyStore->GetCount(&propertyCount); HR_FAIL(hr);
+
+	PropertyValues properties;
+	hr = properties.Reserve(propertyCount); HR_FAIL(hr);
+
+	DWORD entryCount = 0;
+	for (DWORD index = 0; index < propertyCount; index++)
+	{
+		PROPERTYKEY& key = properties.keys[entryCount];
+		PROPVARIANT& value = properties.values[entryCount];
+
+		PropVariantInit(&value);
+
+		if (FAILED(propertyStore->GetAt(index, &key)))
+		{
+			continue;
+		}
+		if (FAILED(propertyStore->GetValue(key, &value)) || !IsSupported(value))
+		{
+			PropVariantClear(&value);
+			continue;
+		}
+
+		entryCount++;
+		properties.SetCount(entryCount);
+	}
+
+	size_t characterCount = 0;
+	for (DWORD index = 0; index < entryCount; index++)
+	{
+		properties.sameAs[index] = index;
+
+		if (!IsString(properties.values[index]))
+		{
+			continue;
+		}
+
+		for (DWORD previous = 0; previous < index; previous++)
+		{
+			if (properties.sameAs[previous] == previous && IsString(properties.values[previous]) &&
+				StringEquals(properties.values[previous], properties.values[index]))
+			{
+				properties.sameAs[index] = previous;
+				break;
+			}
+		}
+
+		if (properties.sameAs[index] == index)
+		{
+			characterCount += StringLength(properties.values[index]) + 1;
+		}
+	}
+
+	constexpr size_t alignment = alignof(MetadataEntry);
+	constexpr size_t headerSize = (sizeof(MetadataSnapshot) + alignment - 1) & ~(alignment - 1);
+
+	size_t size = headerSize + entryCount * sizeof(MetadataEntry) + characterCount * sizeof(WCHAR);
+
+	BYTE* block = reinterpret_cast<BYTE*>(CoTaskMemAlloc(size));
+
+	if (block == nullptr)
+	{
+		return E_OUTOFMEMORY;
+	}
+
+	MetadataSnapshot* snapshot = new (block) MetadataSnapshot();
+	MetadataEntry* entries = reinterpret_cast<MetadataEntry*>(block + headerSize);
+	LPWCH strings = reinterpret_cast<LPWCH>(block + headerSize + entryCount * sizeof(MetadataEntry));
+
+	for (DWORD index = 0; index < entryCount; index++)
+	{
+		const PROPVARIANT& value = properties.values[index];
+		MetadataEntry& entry = entries[index];
+
+		entry.key = properties.keys[index];
+		entry.type = value.vt;
+		entry.uintValue = 0;
+
+		switch (value.vt)
+		{
+			case VT_I2: entry.type = VT_I4; entry.intValue = value.iVal; break;
+			case VT_I4: entry.intValue = value.lVal; break;
+			case VT_I8: entry.intValue = value.hVal.QuadPart; break;
+			case VT_UI2: entry.type = VT_UI4; entry.uintValue = value.uiVal; break;
+			case VT_UI4: entry.uintValue = value.ulVal; break;
+			case VT_UI8: entry.uintValue = value.uhVal.QuadPart; break;
+			case VT_R8: entry.doubleValue = value.dblVal; break;
+			case VT_BOOL: entry.boolValue = value.boolVal != VARIANT_FALSE; break;
+			case VT_FILETIME: entry.fileTimeValue = value.filetime; break;
+			default:
+			{
+				entry.type = VT_LPWSTR;
+
+				if (properties.sameAs[index] != index)
+				{
+					entry.stringValue = entries[properties.sameAs[index]].stringValue;
+					break;
+				}
+
+				entry.stringValue = strings;
+
+				StringCursor cursor(value);
+				while ((*strings++ = cursor.Next()) != L'\0');
+
+				break;
+			}
+		}
+	}
+
+	snapshot->entryCount = entryCount;
+	snapshot->entries = entries;
+	snapshot->title = snapshot->Find(PKEY_Title);
+	snapshot->albumName = snapshot->Find(PKEY_Music_AlbumTitle);
+	snapshot->artist = snapshot->Find(PKEY_Music_Artist);
+
+	*pPtrSnapshot = snapshot;
+
+	return hr;
+}
+
+const AudioPlay::MetadataEntry* AudioPlay::MetadataSnapshot::Find(_In_ REFPROPERTYKEY properityKey) const
+{
+	for (DWORD index = 0; index < entryCount; index++)
+	{
+		if (IsEqualKey(entries[index].key, properityKey))
+		{
+			return &entries[index];
+		}
+	}
+
+	return nullptr;
+}
+
+HRESULT AudioPlay::MetadataSnapshot::GetTitle(_Outref_result_maybenull_ LPCWCH& p_title) const
+{
+	p_title = (title && title->type == VT_LPWSTR) ? title->stringValue : nullptr;
+
+	return p_title ? S_OK : S_FALSE;
+}
+
+HRESULT AudioPlay::MetadataSnapshot::GetAlbumName(_Outref_result_maybenull_ LPCWCH& p_albumName) const
+{
+	p_albumName = (albumName && albumName->type == VT_LPWSTR) ? albumName->stringValue : nullptr;
+
+	return p_albumName ? S_OK : S_FALSE;
+}
+
+HRESULT AudioPlay::MetadataSnapshot::GetArtist(_Outref_result_maybenull_ LPCWCH& p_artist) const
+{
+	p_artist = (artist && artist->type == VT_LPWSTR) ? artist->stringValue : nullptr;
+
+	return p_artist ? S_OK : S_FALSE;
+}
+
+HRESULT AudioPlay::MetadataSnapshot::GetString(_In_ REFPROPERTYKEY properityKey, _Outref_result_maybenull_ LPCWCH& value) const
+{
+	const MetadataEntry* entry = Find(properityKey);
+
+	value = (entry && entry->type == VT_LPWSTR) ? entry->stringValue : nullptr;
+
+	return value ? S_OK : S_FALSE;
+}
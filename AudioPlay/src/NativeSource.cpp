@@ -0,0 +1,56 @@
+#include "NativeSource.h"
+#include "WavSource.h"
+#include "FlacSource.h"
+
+
+#define HR_FAIL_ACTION(hresult, action) if (FAILED(hresult)) { action; return hresult; }
+#define HR_FAIL(hresult) if (FAILED(hresult)) { return hresult; }
+
+
+HRESULT AudioPlay::CreateNativeSource(_In_ MemoryBlock* block, _COM_Outptr_ PcmSource** pPtrSource)
+{
+	if (pPtrSource == nullptr)
+	{
+		return E_INVALIDARG;
+	}
+	*pPtrSource = nullptr;
+
+	if (block == nullptr)
+	{
+		return E_POINTER;
+	}
+
+	HRESULT hr = AUDIO_E_UNSUPPORTED_FORMAT;
+
+	if (WavSource::CanRead(block->GetData(), block->GetSize()))
+	{
+		WavSource* source = nullptr;
+		hr = WavSource::Create(block, &source); HR_FAIL(hr);
+
+		*pPtrSource = source;
+	}
+	else if (FlacSource::CanRead(block->GetData(), block->GetSize()))
+	{
+		FlacSource* source = nullptr;
+		hr = FlacSource::Create(block, &source); HR_FAIL(hr);
+
+		*pPtrSource = source;
+	}
+
+	return hr;
+}
+
+HRESULT AudioPlay::OpenNativeSource(_In_z_ LPCWCH path, _COM_Outptr_ PcmSource** pPtrSource)
+{
+	if (pPtrSource == nullptr)
+	{
+		return E_INVALIDARG;
+	}
+	*pPtrSource = nullptr;
+
+	ComPtr<MappedFile> mappedFile;
+
+	HRESULT hr = MappedFile::Open(path, &mappedFile); HR_FAIL(hr);
+
+	return CreateNativeSource(mappedFile, pPtrSource);
+}
@@ -0,0 +1,73 @@
+#include "OfflineRender.h"
+
+#include <chrono>
+#include <new>
+
+
+#define HR_FAIL_ACTION(hresult, action) if (FAILED(hresult)) { action; return hresult; }
+#define HR_FAIL(hresult) if (FAILED(hresult)) { return hresult; }
+
+
+namespace
+{
+	constexpr UINT32 renderBlockFrames = 4096;
+}
+
+HRESULT AudioPlay::RenderOffline(_In_ PcmSource* source, _In_ PcmSink* sink, _Out_opt_ OfflineRenderStats* stats)
+{
+	if (stats)
+	{
+		*stats = OfflineRenderStats{ 0, 0, 0.0 };
+	}
+
+	if (source == nullptr || sink == nullptr)
+	{
+		return E_POINTER;
+	}
+
+	const PcmFormat& format = source->GetFormat();
+
+	float* buffer = new (std::nothrow) float[static_cast<size_t>(renderBlockFrames) * format.channels];
+
+	if (buffer == nullptr)
+	{
+		return E_OUTOFMEMORY;
+	}
+
+	auto start = std::chrono::steady_clock::now();
+
+	HRESULT hr = sink->BeginStream(format); HR_FAIL_ACTION(hr, delete[] buffer);
+
+	UINT64 frames = 0;
+	UINT32 framesRead = 0;
+
+	do
+	{
+		hr = source->Read(buffer, renderBlockFrames, framesRead);
+
+		if (SUCCEEDED(hr) && framesRead)
+		{
+			hr = sink->Write(buffer, framesRead);
+		}
+
+		frames += framesRead;
+	}
+	while (SUCCEEDED(hr) && framesRead == renderBlockFrames);
+
+	delete[] buffer;
+
+	HR_FAIL(hr);
+
+	hr = sink->EndStream(); HR_FAIL(hr);
+
+	if (stats)
+	{
+		UINT64 nanoseconds = static_cast<UINT64>(std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count());
+
+		stats->frames = frames;
+		stats->nanoseconds = nanoseconds;
+		stats->speed = nanoseconds ? (static_cast<double>(frames) / format.sampleRate) / (nanoseconds / 1e9) : 0.0;
+	}
+
+	return hr;
+}
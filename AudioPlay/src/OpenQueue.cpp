@@ -0,0 +1,317 @@
+#include "OpenQueue.h"
+#include "AutoCriticalSection.h"
+
+#include <algorithm>
+#include <new>
+#include <strsafe.h>
+
+
+#define HR_FAIL_ACTION(hresult, action) if (FAILED(hresult)) { action; return hresult; }
+#define HR_FAIL(hresult) if (FAILED(hresult)) { return hresult; }
+
+
+AudioPlay::OpenQueue::OpenQueue(_In_ UINT32 p_maxConcurrentOpens) :
+	maxConcurrentOpens(p_maxConcurrentOpens), callbacksInFlight(0), closing(false)
+{
+	if (maxConcurrentOpens == 0)
+	{
+		DWORD processorCount = GetActiveProcessorCount(ALL_PROCESSOR_GROUPS);
+		maxConcurrentOpens = processorCount ? processorCount : 1;
+	}
+
+	InitializeCriticalSection(&criticalSection);
+
+	idleEvent = CreateEvent(nullptr, TRUE, TRUE, nullptr);
+}
+
+AudioPlay::OpenQueue::~OpenQueue()
+{
+	{
+		AutoCriticalSection section(&criticalSection);
+		closing = true;
+	}
+
+	CancelAll();
+
+	WaitForSingleObject(idleEvent, INFINITE);
+
+	// The thread that signalled the event may still be leaving the critical section
+	EnterCriticalSection(&criticalSection);
+	LeaveCriticalSection(&criticalSection);
+
+	DeleteCriticalSection(&criticalSection);
+	CloseHandle(idleEvent);
+}
+
+HRESULT AudioPlay::OpenQueue::Enqueue(_In_ Audio* audio, _In_ LPCWCH path, _In_opt_ OpenCompletedCallback callback, _In_opt_ void* context)
+{
+	if (audio == nullptr || path == nullptr)
+	{
+		return E_POINTER;
+	}
+
+	HRESULT hr = S_OK;
+
+	size_t length;
+
+	hr = StringCbLengthW(path, STRSAFE_MAX_CCH * sizeof(WCHAR), &length); HR_FAIL(hr);
+	length += sizeof(WCHAR);
+
+	Request* request = new (std::nothrow) Request{ this, audio, nullptr, callback, context, false, false, false };
+
+	if (request == nullptr)
+	{
+		return E_OUTOFMEMORY;
+	}
+
+	request->path = reinterpret_cast<LPWCH>(CoTaskMemAlloc(length));
+
+	if (request->path == nullptr)
+	{
+		delete request;
+		return E_OUTOFMEMORY;
+	}
+
+	hr = StringCbCopyW(request->path, length, path); HR_FAIL_ACTION(hr, CoTaskMemFree(request->path); delete request);
+
+	{
+		AutoCriticalSection section(&criticalSection);
+
+		if (closing)
+		{
+			CoTaskMemFree(request->path);
+			delete request;
+			return E_ABORT;
+		}
+
+		pending.push_back(request);
+		ResetEvent(idleEvent);
+	}
+
+	StartPending();
+
+	return hr;
+}
+
+HRESULT AudioPlay::OpenQueue::Cancel(_In_ Audio* audio)
+{
+	Request* waiting = nullptr;
+	bool isRunning = false;
+
+	{
+		AutoCriticalSection section(&criticalSection);
+
+		auto found = std::find_if(pending.begin(), pending.end(), [audio](const Request* request) { return request->audio == audio; });
+
+		if (found != pending.end())
+		{
+			waiting = *found;
+			pending.erase(found);
+		}
+		else
+		{
+			auto started = std::find_if(running.begin(), running.end(), [audio](const Request* request) { return request->audio == audio; });
+
+			if (started != running.end() && (*started)->starting)
+			{
+				// StartPending completes it or cancels the open once BeginOpenFile returned
+				(*started)->cancelled = true;
+				return S_OK;
+			}
+
+			isRunning = started != running.end();
+		}
+	}
+
+	if (waiting)
+	{
+		Complete(waiting, E_ABORT);
+		UpdateIdle(false);
+		return S_OK;
+	}
+
+	if (isRunning)
+	{
+		// Completes the request through OnOpenCompleted before returning
+		audio->CancelOpenFile();
+		return S_OK;
+	}
+
+	return S_FALSE;
+}
+
+void AudioPlay::OpenQueue::CancelAll()
+{
+	std::deque<Request*> waiting;
+	std::vector<ComPtr<Audio>> opening;
+
+	{
+		AutoCriticalSection section(&criticalSection);
+
+		waiting.swap(pending);
+
+		for (Request* request : running)
+		{
+			if (request->starting)
+			{
+				request->cancelled = true;
+			}
+			else
+			{
+				opening.push_back(request->audio);
+			}
+		}
+	}
+
+	for (Request* request : waiting)
+	{
+		Complete(request, E_ABORT);
+	}
+
+	for (ComPtr<Audio>& audio : opening)
+	{
+		audio->CancelOpenFile();
+	}
+
+	UpdateIdle(false);
+}
+
+UINT32 AudioPlay::OpenQueue::GetPendingCount()
+{
+	AutoCriticalSection section(&criticalSection);
+
+	return static_cast<UINT32>(pending.size());
+}
+
+UINT32 AudioPlay::OpenQueue::GetRunningCount()
+{
+	AutoCriticalSection section(&criticalSection);
+
+	return static_cast<UINT32>(running.size());
+}
+
+void AudioPlay::OpenQueue::OnOpenCompleted(Audio* audio, HRESULT result, void* context)
+{
+	UNREFERENCED_PARAMETER(audio);
+
+	Request* request = reinterpret_cast<Request*>(context);
+	OpenQueue* queue = request->queue;
+
+	{
+		AutoCriticalSection section(&queue->criticalSection);
+		queue->callbacksInFlight++;
+	}
+
+	Complete(request, result);
+
+	queue->StartPending();
+	queue->UpdateIdle(true);
+}
+
+void AudioPlay::OpenQueue::Complete(_In_ Request* request, _In_ HRESULT result)
+{
+	OpenQueue* queue = request->queue;
+
+	{
+		AutoCriticalSection section(&queue->criticalSection);
+
+		auto found = std::find(queue->running.begin(), queue->running.end(), request);
+
+		if (found != queue->running.end())
+		{
+			queue->running.erase(found);
+		}
+	}
+
+	if (request->callback)
+	{
+		request->callback(request->audio, result, request->context);
+	}
+
+	{
+		AutoCriticalSection section(&queue->criticalSection);
+
+		// Completed from inside BeginOpenFile or on another thread before it returned
+		if (request->starting)
+		{
+			request->completed = true;
+			return;
+		}
+	}
+
+	CoTaskMemFree(request->path);
+	delete request;
+}
+
+void AudioPlay::OpenQueue::StartPending()
+{
+	while (true)
+	{
+		Request* request = nullptr;
+		bool cancelled = false;
+		bool completed = false;
+
+		{
+			AutoCriticalSection section(&criticalSection);
+
+			if (closing || pending.empty() || running.size() >= maxConcurrentOpens)
+			{
+				break;
+			}
+
+			request = pending.front();
+			pending.pop_front();
+			running.push_back(request);
+
+			request->starting = true;
+			cancelled = request->cancelled;
+		}
+
+		ComPtr<Audio> audio = request->audio;
+
+		HRESULT hr = cancelled ? E_ABORT : audio->BeginOpenFile(request->path, OnOpenCompleted, request);
+
+		{
+			AutoCriticalSection section(&criticalSection);
+
+			request->starting = false;
+			completed = request->completed;
+			cancelled = request->cancelled && !completed;
+		}
+
+		if (completed)
+		{
+			CoTaskMemFree(request->path);
+			delete request;
+		}
+		else if (FAILED(hr))
+		{
+			Complete(request, hr);
+		}
+		else if (cancelled)
+		{
+			// Cancelled while BeginOpenFile ran, completes the request through OnOpenCompleted
+			audio->CancelOpenFile();
+		}
+	}
+}
+
+void AudioPlay::OpenQueue::UpdateIdle(_In_ bool leavingCallback)
+{
+	AutoCriticalSection section(&criticalSection);
+
+	if (leavingCallback)
+	{
+		callbacksInFlight--;
+	}
+
+	// Signalled while holding the lock, the destructor waits for it to be released
+	if (pending.empty() && running.empty() && callbacksInFlight == 0)
+	{
+		SetEvent(idleEvent);
+	}
+	else
+	{
+		ResetEvent(idleEvent);
+	}
+}
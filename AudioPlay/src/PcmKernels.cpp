@@ -0,0 +1,249 @@
+#include "PcmKernels.h"
+
+#include <chrono>
+#include <cmath>
+#include <new>
+
+
+#define HR_FAIL_ACTION(hresult, action) if (FAILED(hresult)) { action; return hresult; }
+#define HR_FAIL(hresult) if (FAILED(hresult)) { return hresult; }
+
+
+using std::chrono::duration_cast;
+using std::chrono::nanoseconds;
+using std::chrono::steady_clock;
+
+
+namespace
+{
+	using AudioPlay::PcmLayout;
+	using AudioPlay::PcmStages;
+	using AudioPlay::PcmPipelineKernel;
+
+	template <typename Sample, PcmLayout Layout, PcmStages Stages>
+	PcmPipelineKernel SelectChannels(_In_ UINT32 channels, _Out_ bool& specialized)
+	{
+		specialized = true;
+
+		switch (channels)
+		{
+			case 1: return AudioPlay::RunPcmPipeline<Sample, 1, Layout, Stages>;
+			case 2: return AudioPlay::RunPcmPipeline<Sample, 2, Layout, Stages>;
+		}
+
+		specialized = false;
+
+		return AudioPlay::RunPcmPipeline<Sample, 0, Layout, Stages>;
+	}
+
+	template <typename Sample, PcmLayout Layout>
+	PcmPipelineKernel SelectStages(_In_ PcmStages stages, _In_ UINT32 channels, _Out_ bool& specialized)
+	{
+		switch (stages)
+		{
+			case PcmStages::Convert: return SelectChannels<Sample, Layout, PcmStages::Convert>(channels, specialized);
+			case PcmStages::Gain: return SelectChannels<Sample, Layout, PcmStages::Gain>(channels, specialized);
+			case PcmStages::Mix: return SelectChannels<Sample, Layout, PcmStages::Mix>(channels, specialized);
+			case PcmStages::GainMix: return SelectChannels<Sample, Layout, PcmStages::GainMix>(channels, specialized);
+		}
+
+		specialized = false;
+
+		return nullptr;
+	}
+
+	template <typename Sample>
+	PcmPipelineKernel SelectLayout(_In_ const AudioPlay::PcmPipelineConfig& config, _Out_ bool& specialized)
+	{
+		if (config.layout == PcmLayout::Planar)
+		{
+			return SelectStages<Sample, PcmLayout::Planar>(config.stages, config.channels, specialized);
+		}
+
+		return SelectStages<Sample, PcmLayout::Interleaved>(config.stages, config.channels, specialized);
+	}
+
+	UINT32 BytesPerSample(_In_ AudioPlay::SampleEncoding encoding)
+	{
+		switch (encoding)
+		{
+			case AudioPlay::SampleEncoding::Int16:
+				return 2;
+			case AudioPlay::SampleEncoding::Int32:
+			case AudioPlay::SampleEncoding::Float32:
+				return 4;
+			default:
+				return 0;
+		}
+	}
+
+	template <typename Kernel>
+	UINT64 TimeBlocks(_In_ Kernel kernel, _In_ UINT32 blockFrames, _In_ UINT64 totalFrames)
+	{
+		auto start = steady_clock::now();
+
+		for (UINT64 done = 0; done < totalFrames; done += blockFrames)
+		{
+			kernel(totalFrames - done < blockFrames ? static_cast<UINT32>(totalFrames - done) : blockFrames);
+		}
+
+		return duration_cast<nanoseconds>(steady_clock::now() - start).count();
+	}
+}
+
+
+void AudioPlay::ComputePcmChannelGains(_In_ float volume, _In_ float pan, _In_ UINT32 channels, _Out_ PcmChannelGains& gains)
+{
+	for (UINT32 channel = 0; channel < pcmMaxChannels; channel++)
+	{
+		gains.gains[channel] = volume;
+	}
+
+	if (channels == 2)
+	{
+		pan = pan < -1.0f ? -1.0f : (pan > 1.0f ? 1.0f : pan);
+
+		// Centre is -3 dB on both sides so the loudness doesn't change while panning
+		float angle = (pan + 1.0f) * 0.785398163f;
+
+		gains.gains[0] = volume * std::cos(angle);
+		gains.gains[1] = volume * std::sin(angle);
+	}
+}
+
+AudioPlay::PcmPipelineKernel AudioPlay::SelectPcmPipeline(_In_ const PcmPipelineConfig& config, _Out_opt_ bool* specialized)
+{
+	bool selectedSpecialized = false;
+	PcmPipelineKernel kernel = nullptr;
+
+	if (config.channels != 0 && config.channels <= pcmMaxChannels)
+	{
+		switch (config.encoding)
+		{
+			case SampleEncoding::Int16: kernel = SelectLayout<INT16>(config, selectedSpecialized); break;
+			case SampleEncoding::Int32: kernel = SelectLayout<INT32>(config, selectedSpecialized); break;
+			case SampleEncoding::Float32: kernel = SelectLayout<float>(config, selectedSpecialized); break;
+			default: break;
+		}
+	}
+
+	if (specialized)
+	{
+		*specialized = kernel && selectedSpecialized;
+	}
+
+	return kernel;
+}
+
+void AudioPlay::RunPcmPipelineGeneric(_In_ const PcmPipelineConfig& config, _In_ const void* const* planes, _Inout_ float* destination, _In_ UINT32 frameCount,
+	_In_ const PcmChannelGains& gains)
+{
+	UINT32 channels = config.channels;
+	UINT32 bytesPerSample = BytesPerSample(config.encoding);
+
+	for (UINT32 frame = 0; frame < frameCount; frame++)
+	{
+		for (UINT32 channel = 0; channel < channels; channel++)
+		{
+			const BYTE* sample = config.layout == PcmLayout::Interleaved ?
+				static_cast<const BYTE*>(planes[0]) + (static_cast<size_t>(frame) * channels + channel) * bytesPerSample :
+				static_cast<const BYTE*>(planes[channel]) + static_cast<size_t>(frame) * bytesPerSample;
+
+			float value = 0.0f;
+
+			switch (config.encoding)
+			{
+				case SampleEncoding::Int16: value = PcmSampleTraits<INT16>::Load(reinterpret_cast<const INT16*>(sample)) * PcmSampleTraits<INT16>::scale; break;
+				case SampleEncoding::Int32: value = PcmSampleTraits<INT32>::Load(reinterpret_cast<const INT32*>(sample)) * PcmSampleTraits<INT32>::scale; break;
+				case SampleEncoding::Float32: value = PcmSampleTraits<float>::Load(reinterpret_cast<const float*>(sample)); break;
+				default: break;
+			}
+
+			if ((config.stages & PcmStages::Gain) == PcmStages::Gain)
+			{
+				value *= gains.gains[channel];
+			}
+
+			float& output = destination[static_cast<size_t>(frame) * channels + channel];
+			output = (config.stages & PcmStages::Mix) == PcmStages::Mix ? output + value : value;
+		}
+	}
+}
+
+HRESULT AudioPlay::MeasurePcmPipeline(_In_ const PcmPipelineConfig& config, _In_ UINT32 blockFrames, _In_ UINT64 totalFrames, _Out_ PcmPipelineCost& cost)
+{
+	cost = { };
+
+	bool specialized = false;
+	PcmPipelineKernel kernel = SelectPcmPipeline(config, &specialized);
+
+	if (kernel == nullptr || blockFrames == 0)
+	{
+		return E_INVALIDARG;
+	}
+
+	size_t sampleCount = static_cast<size_t>(blockFrames) * config.channels;
+	UINT32 bytesPerSample = BytesPerSample(config.encoding);
+
+	BYTE* source = new (std::nothrow) BYTE[sampleCount * bytesPerSample];
+	float* destination = new (std::nothrow) float[sampleCount];
+
+	if (source == nullptr || destination == nullptr)
+	{
+		delete[] source;
+		delete[] destination;
+		return E_OUTOFMEMORY;
+	}
+
+	UINT32 seed = 0x9E3779B9;
+
+	for (size_t index = 0; index < sampleCount; index++)
+	{
+		seed = seed * 1664525 + 1013904223;
+
+		switch (config.encoding)
+		{
+			case SampleEncoding::Int16: { INT16 value = static_cast<INT16>(seed >> 16); memcpy(source + index * 2, &value, 2); break; }
+			case SampleEncoding::Int32: { INT32 value = static_cast<INT32>(seed); memcpy(source + index * 4, &value, 4); break; }
+			default: { float value = static_cast<INT32>(seed) / 2147483648.0f; memcpy(source + index * 4, &value, 4); break; }
+		}
+	}
+
+	const void* planes[pcmMaxChannels];
+
+	for (UINT32 channel = 0; channel < config.channels; channel++)
+	{
+		planes[channel] = config.layout == PcmLayout::Planar ? source + static_cast<size_t>(channel) * blockFrames * bytesPerSample : source;
+	}
+
+	PcmChannelGains gains = { };
+	ComputePcmChannelGains(0.5f, 0.25f, config.channels, gains);
+
+	memset(destination, 0, sampleCount * sizeof(float));
+
+	// Warm up so the first touches of the buffers aren't measured
+	kernel(planes, destination, blockFrames, config.channels, gains);
+	RunPcmPipelineGeneric(config, planes, destination, blockFrames, gains);
+
+	cost.frames = totalFrames;
+	cost.specialized = specialized;
+
+	cost.genericNanoseconds = TimeBlocks([&](UINT32 count) { RunPcmPipelineGeneric(config, planes, destination, count, gains); }, blockFrames, totalFrames);
+	cost.kernelNanoseconds = TimeBlocks([&](UINT32 count) { kernel(planes, destination, count, config.channels, gains); }, blockFrames, totalFrames);
+
+	delete[] source;
+	delete[] destination;
+
+	if (cost.frames)
+	{
+		cost.kernelNanosecondsPerFrame = static_cast<double>(cost.kernelNanoseconds) / cost.frames;
+		cost.genericNanosecondsPerFrame = static_cast<double>(cost.genericNanoseconds) / cost.frames;
+	}
+
+	if (cost.kernelNanoseconds)
+	{
+		cost.speedup = static_cast<double>(cost.genericNanoseconds) / cost.kernelNanoseconds;
+	}
+
+	return S_OK;
+}
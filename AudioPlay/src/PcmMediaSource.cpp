@@ -0,0 +1,709 @@
+#include "PcmMediaSource.h"
+#include "AutoCriticalSection.h"
+
+#include <chrono>
+#include <new>
+
+
+#define HR_FAIL_ACTION(hresult, action) if (FAILED(hresult)) { action; return hresult; }
+#define HR_FAIL(hresult) if (FAILED(hresult)) { return hresult; }
+
+
+using std::chrono::duration_cast;
+using std::chrono::nanoseconds;
+using std::chrono::steady_clock;
+
+
+namespace
+{
+	// 20 ms per sample keeps the renderer fed without adding latency to transitions
+	constexpr UINT32 samplesPerSecond = 50;
+}
+
+#pragma region PcmMediaStream
+
+AudioPlay::PcmMediaStream::PcmMediaStream(_In_ PcmMediaSource* p_mediaSource, _In_ IMFStreamDescriptor* p_streamDescriptor) :
+	referenceCount(1), mediaSource(p_mediaSource), streamDescriptor(p_streamDescriptor)
+{
+	mediaSource->AddRef();
+}
+
+AudioPlay::PcmMediaStream::~PcmMediaStream()
+{
+	mediaSource->Release();
+}
+
+STDMETHODIMP_(ULONG) AudioPlay::PcmMediaStream::AddRef()
+{
+	return InterlockedIncrement(&referenceCount);
+}
+
+STDMETHODIMP_(ULONG) AudioPlay::PcmMediaStream::Release()
+{
+	ULONG newRefCount = InterlockedDecrement(&referenceCount);
+
+	if (newRefCount == 0)
+	{
+		delete this;
+	}
+
+	return newRefCount;
+}
+
+STDMETHODIMP AudioPlay::PcmMediaStream::QueryInterface(REFIID riid, _COM_Outptr_ void** pPtr)
+{
+	if (pPtr == nullptr)
+	{
+		return E_POINTER;
+	}
+
+	if (riid == IID_IUnknown)
+	{
+		*pPtr = static_cast<IUnknown*>(this);
+	}
+	else if (riid == IID_IMFMediaEventGenerator)
+	{
+		*pPtr = static_cast<IMFMediaEventGenerator*>(this);
+	}
+	else if (riid == IID_IMFMediaStream)
+	{
+		*pPtr = static_cast<IMFMediaStream*>(this);
+	}
+	else
+	{
+		*pPtr = NULL;
+		return E_NOINTERFACE;
+	}
+
+	AddRef();
+	return S_OK;
+}
+
+STDMETHODIMP AudioPlay::PcmMediaStream::GetEvent(DWORD dwFlags, _COM_Outptr_ IMFMediaEvent** ppEvent)
+{
+	ComPtr<IMFMediaEventQueue> queue;
+
+	{
+		AutoCriticalSection section(&mediaSource->criticalSection);
+
+		HRESULT hr = mediaSource->CheckShutdown(); HR_FAIL(hr);
+
+		queue = eventQueue;
+	}
+
+	// Blocks, so it can't hold the lock
+	return queue->GetEvent(dwFlags, ppEvent);
+}
+
+STDMETHODIMP AudioPlay::PcmMediaStream::BeginGetEvent(_In_ IMFAsyncCallback* pCallback, _In_opt_ IUnknown* punkState)
+{
+	AutoCriticalSection section(&mediaSource->criticalSection);
+
+	HRESULT hr = mediaSource->CheckShutdown(); HR_FAIL(hr);
+
+	return eventQueue->BeginGetEvent(pCallback, punkState);
+}
+
+STDMETHODIMP AudioPlay::PcmMediaStream::EndGetEvent(_In_ IMFAsyncResult* pResult, _COM_Outptr_ IMFMediaEvent** ppEvent)
+{
+	AutoCriticalSection section(&mediaSource->criticalSection);
+
+	HRESULT hr = mediaSource->CheckShutdown(); HR_FAIL(hr);
+
+	return eventQueue->EndGetEvent(pResult, ppEvent);
+}
+
+STDMETHODIMP AudioPlay::PcmMediaStream::QueueEvent(MediaEventType met, REFGUID guidExtendedType, HRESULT hrStatus, _In_opt_ const PROPVARIANT* pvValue)
+{
+	AutoCriticalSection section(&mediaSource->criticalSection);
+
+	HRESULT hr = mediaSource->CheckShutdown(); HR_FAIL(hr);
+
+	return eventQueue->QueueEventParamVar(met, guidExtendedType, hrStatus, pvValue);
+}
+
+STDMETHODIMP AudioPlay::PcmMediaStream::GetMediaSource(_COM_Outptr_ IMFMediaSource** ppMediaSource)
+{
+	if (ppMediaSource == nullptr)
+	{
+		return E_POINTER;
+	}
+	*ppMediaSource = nullptr;
+
+	AutoCriticalSection section(&mediaSource->criticalSection);
+
+	HRESULT hr = mediaSource->CheckShutdown(); HR_FAIL(hr);
+
+	*ppMediaSource = mediaSource;
+	mediaSource->AddRef();
+
+	return hr;
+}
+
+STDMETHODIMP AudioPlay::PcmMediaStream::GetStreamDescriptor(_COM_Outptr_ IMFStreamDescriptor** ppStreamDescriptor)
+{
+	if (ppStreamDescriptor == nullptr)
+	{
+		return E_POINTER;
+	}
+	*ppStreamDescriptor = nullptr;
+
+	AutoCriticalSection section(&mediaSource->criticalSection);
+
+	HRESULT hr = mediaSource->CheckShutdown(); HR_FAIL(hr);
+
+	return streamDescriptor.CopyTo(ppStreamDescriptor);
+}
+
+STDMETHODIMP AudioPlay::PcmMediaStream::RequestSample(_In_opt_ IUnknown* pToken)
+{
+	return mediaSource->RequestSample(pToken);
+}
+
+#pragma endregion
+
+#pragma region PcmMediaSource
+
+AudioPlay::PcmMediaSource::PcmMediaSource(_In_ PcmSource* p_source, _In_opt_ RenderTelemetry* p_telemetry, _In_opt_ IPropertyStore* p_properties) :
+	referenceCount(1), source(p_source), telemetry(p_telemetry), properties(p_properties), sourceState(SourceState::Stopped), streamCreated(false), endOfStream(false),
+	position(0), framesPerSample(0)
+{
+	InitializeCriticalSection(&criticalSection);
+}
+
+AudioPlay::PcmMediaSource::~PcmMediaSource()
+{
+	ReleasePendingTokens();
+
+	DeleteCriticalSection(&criticalSection);
+}
+
+HRESULT AudioPlay::PcmMediaSource::Create(_In_ PcmSource* source, _COM_Outptr_ IMFMediaSource** pPtrMediaSource, _In_opt_ RenderTelemetry* telemetry,
+	_In_opt_ IPropertyStore* properties)
+{
+	if (pPtrMediaSource == nullptr)
+	{
+		return E_INVALIDARG;
+	}
+	*pPtrMediaSource = nullptr;
+
+	if (source == nullptr)
+	{
+		return E_POINTER;
+	}
+	if (source->GetFormat().sampleRate == 0 || source->GetFormat().channels == 0)
+	{
+		return AUDIO_E_INVALID_FORMAT;
+	}
+
+	ComPtr<PcmMediaSource> mediaSource;
+	mediaSource.Attach(new (std::nothrow) PcmMediaSource(source, telemetry, properties));
+
+	if (!mediaSource)
+	{
+		return E_OUTOFMEMORY;
+	}
+
+	HRESULT hr = mediaSource->Initialize(); HR_FAIL_ACTION(hr, mediaSource->Shutdown());
+
+	*pPtrMediaSource = mediaSource.Detach();
+
+	return hr;
+}
+
+HRESULT AudioPlay::PcmMediaSource::Initialize()
+{
+	ComPtr<IMFMediaType> mediaType;
+	ComPtr<IMFStreamDescriptor> streamDescriptor;
+	ComPtr<IMFMediaTypeHandler> mediaTypeHandler;
+
+	HRESULT hr = S_OK;
+
+	const PcmFormat& format = source->GetFormat();
+
+	framesPerSample = format.sampleRate / samplesPerSecond;
+	framesPerSample = framesPerSample ? framesPerSample : 1;
+
+	hr = MFCreateEventQueue(&eventQueue); HR_FAIL(hr);
+
+	hr = MFCreateMediaType(&mediaType); HR_FAIL(hr);
+	hr = mediaType->SetGUID(MF_MT_MAJOR_TYPE, MFMediaType_Audio); HR_FAIL(hr);
+	hr = mediaType->SetGUID(MF_MT_SUBTYPE, MFAudioFormat_Float); HR_FAIL(hr);
+	hr = mediaType->SetUINT32(MF_MT_AUDIO_NUM_CHANNELS, format.channels); HR_FAIL(hr);
+	hr = mediaType->SetUINT32(MF_MT_AUDIO_SAMPLES_PER_SECOND, format.sampleRate); HR_FAIL(hr);
+	hr = mediaType->SetUINT32(MF_MT_AUDIO_BITS_PER_SAMPLE, 32); HR_FAIL(hr);
+	hr = mediaType->SetUINT32(MF_MT_AUDIO_BLOCK_ALIGNMENT, format.channels * sizeof(float)); HR_FAIL(hr);
+	hr = mediaType->SetUINT32(MF_MT_AUDIO_AVG_BYTES_PER_SECOND, format.sampleRate * format.channels * sizeof(float)); HR_FAIL(hr);
+	hr = mediaType->SetUINT32(MF_MT_ALL_SAMPLES_INDEPENDENT, TRUE); HR_FAIL(hr);
+
+	IMFMediaType* mediaTypes[] = { mediaType };
+
+	hr = MFCreateStreamDescriptor(0, 1, mediaTypes, &streamDescriptor); HR_FAIL(hr);
+	hr = streamDescriptor->GetMediaTypeHandler(&mediaTypeHandler); HR_FAIL(hr);
+	hr = mediaTypeHandler->SetCurrentMediaType(mediaType); HR_FAIL(hr);
+
+	IMFStreamDescriptor* streamDescriptors[] = { streamDescriptor };
+
+	hr = MFCreatePresentationDescriptor(1, streamDescriptors, &presentationDescriptor); HR_FAIL(hr);
+	hr = presentationDescriptor->SelectStream(0); HR_FAIL(hr);
+
+	UINT64 length = 0;
+	// A source looping forever can still seek but has no duration
+	if (source->GetLength(length) == S_OK)
+	{
+		hr = presentationDescriptor->SetUINT64(MF_PD_DURATION, static_cast<UINT64>(FramesToTime(length))); HR_FAIL(hr);
+	}
+
+	stream.Attach(new (std::nothrow) PcmMediaStream(this, streamDescriptor));
+
+	if (!stream)
+	{
+		return E_OUTOFMEMORY;
+	}
+
+	hr = MFCreateEventQueue(&stream->eventQueue); HR_FAIL(hr);
+
+	return hr;
+}
+
+LONGLONG AudioPlay::PcmMediaSource::FramesToTime(_In_ UINT64 frames) const
+{
+	return static_cast<LONGLONG>(MediaTimeFromFrames(frames, source->GetFormat().sampleRate));
+}
+
+HRESULT AudioPlay::PcmMediaSource::CheckShutdown() const
+{
+	return sourceState == SourceState::Shutdown ? MF_E_SHUTDOWN : S_OK;
+}
+
+void AudioPlay::PcmMediaSource::ReleasePendingTokens()
+{
+	for (IUnknown* token : pendingTokens)
+	{
+		if (token)
+		{
+			token->Release();
+		}
+	}
+
+	pendingTokens.clear();
+}
+
+HRESULT AudioPlay::PcmMediaSource::RequestSample(_In_opt_ IUnknown* token)
+{
+	AutoCriticalSection section(&criticalSection);
+
+	HRESULT hr = CheckShutdown(); HR_FAIL(hr);
+
+	if (sourceState == SourceState::Stopped)
+	{
+		return MF_E_INVALIDREQUEST;
+	}
+	if (endOfStream)
+	{
+		return MF_E_END_OF_STREAM;
+	}
+
+	if (sourceState == SourceState::Paused)
+	{
+		pendingTokens.push_back(token);
+
+		if (token)
+		{
+			token->AddRef();
+		}
+
+		return hr;
+	}
+
+	return DeliverSample(token);
+}
+
+HRESULT AudioPlay::PcmMediaSource::DeliverSample(_In_opt_ IUnknown* token)
+{
+	ComPtr<IMFMediaBuffer> buffer;
+	ComPtr<IMFSample> sample;
+
+	HRESULT hr = S_OK;
+
+	const PcmFormat& format = source->GetFormat();
+	const DWORD frameSize = format.channels * sizeof(float);
+
+	steady_clock::time_point requestStart = telemetry ? steady_clock::now() : steady_clock::time_point{ };
+
+	hr = MFCreateMemoryBuffer(framesPerSample * frameSize, &buffer); HR_FAIL(hr);
+
+	BYTE* data = nullptr;
+	hr = buffer->Lock(&data, nullptr, nullptr); HR_FAIL(hr);
+
+	steady_clock::time_point readStart = telemetry ? steady_clock::now() : steady_clock::time_point{ };
+
+	UINT32 framesRead = 0;
+	hr = source->Read(reinterpret_cast<float*>(data), framesPerSample, framesRead);
+
+	steady_clock::time_point readEnd = telemetry ? steady_clock::now() : steady_clock::time_point{ };
+
+	buffer->Unlock();
+
+	HR_FAIL(hr);
+
+	if (framesRead)
+	{
+		hr = buffer->SetCurrentLength(framesRead * frameSize); HR_FAIL(hr);
+
+		hr = MFCreateSample(&sample); HR_FAIL(hr);
+		hr = sample->AddBuffer(buffer); HR_FAIL(hr);
+		hr = sample->SetSampleTime(FramesToTime(position)); HR_FAIL(hr);
+		hr = sample->SetSampleDuration(FramesToTime(position + framesRead) - FramesToTime(position)); HR_FAIL(hr);
+
+		if (token)
+		{
+			hr = sample->SetUnknown(MFSampleExtension_Token, token); HR_FAIL(hr);
+		}
+
+		hr = stream->eventQueue->QueueEventParamUnk(MEMediaSample, GUID_NULL, S_OK, sample); HR_FAIL(hr);
+
+		if (telemetry)
+		{
+			telemetry->OnBuffer(position, framesRead, format.sampleRate,
+				duration_cast<nanoseconds>(readEnd - readStart), duration_cast<nanoseconds>(steady_clock::now() - requestStart));
+		}
+
+		position += framesRead;
+	}
+
+	if (framesRead < framesPerSample)
+	{
+		endOfStream = true;
+
+		if (telemetry)
+		{
+			telemetry->OnEndOfStream(position);
+		}
+
+		hr = stream->eventQueue->QueueEventParamVar(MEEndOfStream, GUID_NULL, S_OK, nullptr); HR_FAIL(hr);
+		hr = eventQueue->QueueEventParamVar(MEEndOfPresentation, GUID_NULL, S_OK, nullptr); HR_FAIL(hr);
+	}
+
+	return hr;
+}
+
+STDMETHODIMP_(ULONG) AudioPlay::PcmMediaSource::AddRef()
+{
+	return InterlockedIncrement(&referenceCount);
+}
+
+STDMETHODIMP_(ULONG) AudioPlay::PcmMediaSource::Release()
+{
+	ULONG newRefCount = InterlockedDecrement(&referenceCount);
+
+	if (newRefCount == 0)
+	{
+		delete this;
+	}
+
+	return newRefCount;
+}
+
+STDMETHODIMP AudioPlay::PcmMediaSource::QueryInterface(REFIID riid, _COM_Outptr_ void** pPtr)
+{
+	if (pPtr == nullptr)
+	{
+		return E_POINTER;
+	}
+
+	if (riid == IID_IUnknown)
+	{
+		*pPtr = static_cast<IUnknown*>(static_cast<IMFMediaSource*>(this));
+	}
+	else if (riid == IID_IMFMediaEventGenerator)
+	{
+		*pPtr = static_cast<IMFMediaEventGenerator*>(this);
+	}
+	else if (riid == IID_IMFMediaSource)
+	{
+		*pPtr = static_cast<IMFMediaSource*>(this);
+	}
+	else if (riid == IID_IMFGetService)
+	{
+		*pPtr = static_cast<IMFGetService*>(this);
+	}
+	else
+	{
+		*pPtr = NULL;
+		return E_NOINTERFACE;
+	}
+
+	AddRef();
+	return S_OK;
+}
+
+STDMETHODIMP AudioPlay::PcmMediaSource::GetEvent(DWORD dwFlags, _COM_Outptr_ IMFMediaEvent** ppEvent)
+{
+	ComPtr<IMFMediaEventQueue> queue;
+
+	{
+		AutoCriticalSection section(&criticalSection);
+
+		HRESULT hr = CheckShutdown(); HR_FAIL(hr);
+
+		queue = eventQueue;
+	}
+
+	return queue->GetEvent(dwFlags, ppEvent);
+}
+
+STDMETHODIMP AudioPlay::PcmMediaSource::BeginGetEvent(_In_ IMFAsyncCallback* pCallback, _In_opt_ IUnknown* punkState)
+{
+	AutoCriticalSection section(&criticalSection);
+
+	HRESULT hr = CheckShutdown(); HR_FAIL(hr);
+
+	return eventQueue->BeginGetEvent(pCallback, punkState);
+}
+
+STDMETHODIMP AudioPlay::PcmMediaSource::EndGetEvent(_In_ IMFAsyncResult* pResult, _COM_Outptr_ IMFMediaEvent** ppEvent)
+{
+	AutoCriticalSection section(&criticalSection);
+
+	HRESULT hr = CheckShutdown(); HR_FAIL(hr);
+
+	return eventQueue->EndGetEvent(pResult, ppEvent);
+}
+
+STDMETHODIMP AudioPlay::PcmMediaSource::QueueEvent(MediaEventType met, REFGUID guidExtendedType, HRESULT hrStatus, _In_opt_ const PROPVARIANT* pvValue)
+{
+	AutoCriticalSection section(&criticalSection);
+
+	HRESULT hr = CheckShutdown(); HR_FAIL(hr);
+
+	return eventQueue->QueueEventParamVar(met, guidExtendedType, hrStatus, pvValue);
+}
+
+STDMETHODIMP AudioPlay::PcmMediaSource::GetCharacteristics(_Out_ DWORD* pdwCharacteristics)
+{
+	if (pdwCharacteristics == nullptr)
+	{
+		return E_POINTER;
+	}
+
+	AutoCriticalSection section(&criticalSection);
+
+	HRESULT hr = CheckShutdown(); HR_FAIL(hr);
+
+	UINT64 length = 0;
+	*pdwCharacteristics = MFMEDIASOURCE_CAN_PAUSE;
+
+	if (SUCCEEDED(source->GetLength(length)))
+	{
+		*pdwCharacteristics |= MFMEDIASOURCE_CAN_SEEK;
+	}
+
+	return hr;
+}
+
+STDMETHODIMP AudioPlay::PcmMediaSource::CreatePresentationDescriptor(_COM_Outptr_ IMFPresentationDescriptor** ppPresentationDescriptor)
+{
+	if (ppPresentationDescriptor == nullptr)
+	{
+		return E_POINTER;
+	}
+	*ppPresentationDescriptor = nullptr;
+
+	AutoCriticalSection section(&criticalSection);
+
+	HRESULT hr = CheckShutdown(); HR_FAIL(hr);
+
+	return presentationDescriptor->Clone(ppPresentationDescriptor);
+}
+
+STDMETHODIMP AudioPlay::PcmMediaSource::Start(_In_ IMFPresentationDescriptor* pPresentationDescriptor, _In_opt_ const GUID* pguidTimeFormat, _In_opt_ const PROPVARIANT* pvarStartPosition)
+{
+	if (pPresentationDescriptor == nullptr || pvarStartPosition == nullptr)
+	{
+		return E_INVALIDARG;
+	}
+	if (pguidTimeFormat != nullptr && *pguidTimeFormat != GUID_NULL)
+	{
+		return MF_E_UNSUPPORTED_TIME_FORMAT;
+	}
+	if (pvarStartPosition->vt != VT_EMPTY && pvarStartPosition->vt != VT_I8)
+	{
+		return MF_E_UNSUPPORTED_TIME_FORMAT;
+	}
+
+	AutoCriticalSection section(&criticalSection);
+
+	HRESULT hr = CheckShutdown(); HR_FAIL(hr);
+
+	bool seek = pvarStartPosition->vt == VT_I8;
+
+	// A stopped source starts over, VT_EMPTY only resumes from a pause
+	if (!seek && sourceState == SourceState::Stopped)
+	{
+		hr = source->Seek(0); HR_FAIL(hr);
+
+		position = 0;
+		endOfStream = false;
+	}
+
+	if (seek)
+	{
+		LONGLONG time = pvarStartPosition->hVal.QuadPart;
+		UINT64 frame = FramesFromMediaTime(static_cast<UINT64>(time < 0 ? 0 : time), source->GetFormat().sampleRate);
+
+		hr = source->Seek(frame); HR_FAIL(hr);
+
+		position = frame;
+		endOfStream = false;
+	}
+
+	PROPVARIANT var;
+	PropVariantInit(&var);
+
+	var.vt = VT_UNKNOWN;
+	var.punkVal = static_cast<IMFMediaStream*>(stream);
+	var.punkVal->AddRef();
+
+	hr = eventQueue->QueueEventParamVar(streamCreated ? MEUpdatedStream : MENewStream, GUID_NULL, S_OK, &var);
+
+	PropVariantClear(&var);
+
+	HR_FAIL(hr);
+
+	streamCreated = true;
+
+	var.vt = VT_I8;
+	var.hVal.QuadPart = FramesToTime(position);
+
+	bool seeked = seek && sourceState != SourceState::Stopped;
+
+	hr = eventQueue->QueueEventParamVar(seeked ? MESourceSeeked : MESourceStarted, GUID_NULL, S_OK, &var); HR_FAIL(hr);
+	hr = stream->eventQueue->QueueEventParamVar(seeked ? MEStreamSeeked : MEStreamStarted, GUID_NULL, S_OK, &var); HR_FAIL(hr);
+
+	if (telemetry)
+	{
+		// The renderer drops what it has queued on a seek and after a stop
+		telemetry->OnStarted(position, seek || sourceState == SourceState::Stopped);
+	}
+
+	sourceState = SourceState::Started;
+
+	if (seek)
+	{
+		// Requests queued before a seek belong to the old position
+		ReleasePendingTokens();
+	}
+
+	for (IUnknown* token : pendingTokens)
+	{
+		if (SUCCEEDED(hr) && !endOfStream)
+		{
+			hr = DeliverSample(token);
+		}
+
+		if (token)
+		{
+			token->Release();
+		}
+	}
+
+	pendingTokens.clear();
+
+	return hr;
+}
+
+STDMETHODIMP AudioPlay::PcmMediaSource::Stop()
+{
+	AutoCriticalSection section(&criticalSection);
+
+	HRESULT hr = CheckShutdown(); HR_FAIL(hr);
+
+	sourceState = SourceState::Stopped;
+
+	ReleasePendingTokens();
+
+	if (telemetry)
+	{
+		telemetry->OnStopped(position);
+	}
+
+	hr = eventQueue->QueueEventParamVar(MESourceStopped, GUID_NULL, S_OK, nullptr); HR_FAIL(hr);
+	hr = stream->eventQueue->QueueEventParamVar(MEStreamStopped, GUID_NULL, S_OK, nullptr); HR_FAIL(hr);
+
+	return hr;
+}
+
+STDMETHODIMP AudioPlay::PcmMediaSource::Pause()
+{
+	AutoCriticalSection section(&criticalSection);
+
+	HRESULT hr = CheckShutdown(); HR_FAIL(hr);
+
+	if (sourceState != SourceState::Started)
+	{
+		return MF_E_INVALID_STATE_TRANSITION;
+	}
+
+	sourceState = SourceState::Paused;
+
+	if (telemetry)
+	{
+		telemetry->OnPaused(position, source->GetFormat().sampleRate);
+	}
+
+	hr = eventQueue->QueueEventParamVar(MESourcePaused, GUID_NULL, S_OK, nullptr); HR_FAIL(hr);
+	hr = stream->eventQueue->QueueEventParamVar(MEStreamPaused, GUID_NULL, S_OK, nullptr); HR_FAIL(hr);
+
+	return hr;
+}
+
+STDMETHODIMP AudioPlay::PcmMediaSource::Shutdown()
+{
+	ComPtr<PcmMediaStream> oldStream;
+
+	AutoCriticalSection section(&criticalSection);
+
+	HRESULT hr = CheckShutdown(); HR_FAIL(hr);
+
+	if (eventQueue)
+	{
+		eventQueue->Shutdown();
+	}
+	if (stream && stream->eventQueue)
+	{
+		stream->eventQueue->Shutdown();
+	}
+
+	ReleasePendingTokens();
+
+	sourceState = SourceState::Shutdown;
+
+	// The stream keeps the source alive, breaking the cycle here
+	// Released after the lock since the stream's destructor can release the source
+	oldStream.Attach(stream.Detach());
+
+	return hr;
+}
+
+STDMETHODIMP AudioPlay::PcmMediaSource::GetService(_In_ REFGUID guidService, _In_ REFIID riid, _COM_Outptr_ LPVOID* ppvObject)
+{
+	if (ppvObject == nullptr)
+	{
+		return E_POINTER;
+	}
+	*ppvObject = nullptr;
+
+	AutoCriticalSection section(&criticalSection);
+
+	HRESULT hr = CheckShutdown(); HR_FAIL(hr);
+
+	if (guidService != MF_PROPERTY_HANDLER_SERVICE || !properties)
+	{
+		return MF_E_UNSUPPORTED_SERVICE;
+	}
+
+	return properties->QueryInterface(riid, ppvObject);
+}
+
+#pragma endregion
@@ -0,0 +1,347 @@
+#include "PcmSink.h"
+#include "PosixUtil.h"
+
+#include <cerrno>
+#include <cstring>
+#include <new>
+
+
+#define HR_FAIL_ACTION(hresult, action) if (FAILED(hresult)) { action; return hresult; }
+#define HR_FAIL(hresult) if (FAILED(hresult)) { return hresult; }
+
+
+namespace
+{
+	constexpr WORD waveFormatIeeeFloat = 0x0003;
+	// RIFF, WAVE, JUNK or ds64 with 28 bytes, fmt with 18 bytes, fact with 4 bytes and the data chunk header
+	constexpr UINT32 headerSize = 12 + 36 + 26 + 12 + 8;
+
+	BYTE* PutTag(_Out_writes_bytes_(4) BYTE* output, _In_reads_(4) const char* tag)
+	{
+		memcpy(output, tag, 4);
+		return output + 4;
+	}
+
+	BYTE* PutUInt16(_Out_writes_bytes_(2) BYTE* output, _In_ UINT32 value)
+	{
+		output[0] = static_cast<BYTE>(value);
+		output[1] = static_cast<BYTE>(value >> 8);
+		return output + 2;
+	}
+
+	BYTE* PutUInt32(_Out_writes_bytes_(4) BYTE* output, _In_ UINT32 value)
+	{
+		for (int index = 0; index < 4; index++)
+		{
+			output[index] = static_cast<BYTE>(value >> (index * 8));
+		}
+		return output + 4;
+	}
+
+	BYTE* PutUInt64(_Out_writes_bytes_(8) BYTE* output, _In_ UINT64 value)
+	{
+		output = PutUInt32(output, static_cast<UINT32>(value));
+		return PutUInt32(output, static_cast<UINT32>(value >> 32));
+	}
+}
+
+AudioPlay::PcmSink::PcmSink() :
+	referenceCount(1)
+{
+}
+
+AudioPlay::PcmSink::~PcmSink()
+{
+}
+
+ULONG STDMETHODCALLTYPE AudioPlay::PcmSink::AddRef()
+{
+	return ++referenceCount;
+}
+
+ULONG STDMETHODCALLTYPE AudioPlay::PcmSink::Release()
+{
+	ULONG newRefCount = --referenceCount;
+
+	if (newRefCount == 0)
+	{
+		delete this;
+	}
+
+	return newRefCount;
+}
+
+AudioPlay::NullPcmSink::NullPcmSink() :
+	framesWritten(0)
+{
+}
+
+HRESULT AudioPlay::NullPcmSink::Create(_COM_Outptr_ NullPcmSink** pPtrSink)
+{
+	if (pPtrSink == nullptr)
+	{
+		return E_INVALIDARG;
+	}
+
+	*pPtrSink = new (std::nothrow) NullPcmSink();
+
+	return *pPtrSink ? S_OK : E_OUTOFMEMORY;
+}
+
+HRESULT AudioPlay::NullPcmSink::BeginStream(_In_ const PcmFormat& format)
+{
+	UNREFERENCED_PARAMETER(format);
+
+	framesWritten = 0;
+
+	return S_OK;
+}
+
+HRESULT AudioPlay::NullPcmSink::Write(_In_reads_(frameCount * format.channels) const float* frames, _In_ UINT32 frameCount)
+{
+	UNREFERENCED_PARAMETER(frames);
+
+	framesWritten += frameCount;
+
+	return S_OK;
+}
+
+HRESULT AudioPlay::NullPcmSink::EndStream()
+{
+	return S_OK;
+}
+
+AudioPlay::BufferPcmSink::BufferPcmSink() :
+	format{ 0, 0 }, frames(nullptr), frameCount(0), capacity(0)
+{
+}
+
+AudioPlay::BufferPcmSink::~BufferPcmSink()
+{
+	delete[] frames;
+}
+
+HRESULT AudioPlay::BufferPcmSink::Create(_COM_Outptr_ BufferPcmSink** pPtrSink)
+{
+	if (pPtrSink == nullptr)
+	{
+		return E_INVALIDARG;
+	}
+
+	*pPtrSink = new (std::nothrow) BufferPcmSink();
+
+	return *pPtrSink ? S_OK : E_OUTOFMEMORY;
+}
+
+HRESULT AudioPlay::BufferPcmSink::BeginStream(_In_ const PcmFormat& p_format)
+{
+	if (p_format.channels == 0)
+	{
+		return E_INVALIDARG;
+	}
+
+	format = p_format;
+	frameCount = 0;
+
+	return S_OK;
+}
+
+HRESULT AudioPlay::BufferPcmSink::Write(_In_reads_(frameCount * format.channels) const float* p_frames, _In_ UINT32 p_frameCount)
+{
+	if (format.channels == 0)
+	{
+		return E_UNEXPECTED;
+	}
+
+	if (frameCount + p_frameCount > capacity)
+	{
+		UINT64 newCapacity = capacity ? capacity * 2 : 65536;
+		newCapacity = newCapacity < frameCount + p_frameCount ? frameCount + p_frameCount : newCapacity;
+
+		float* grown = new (std::nothrow) float[static_cast<size_t>(newCapacity * format.channels)];
+
+		if (grown == nullptr)
+		{
+			return E_OUTOFMEMORY;
+		}
+
+		if (frameCount)
+		{
+			memcpy(grown, frames, static_cast<size_t>(frameCount * format.channels) * sizeof(float));
+		}
+
+		delete[] frames;
+		frames = grown;
+		capacity = newCapacity;
+	}
+
+	memcpy(frames + frameCount * format.channels, p_frames, static_cast<size_t>(p_frameCount) * format.channels * sizeof(float));
+	frameCount += p_frameCount;
+
+	return S_OK;
+}
+
+HRESULT AudioPlay::BufferPcmSink::EndStream()
+{
+	return S_OK;
+}
+
+AudioPlay::WavFilePcmSink::WavFilePcmSink() :
+	file(nullptr), format{ 0, 0 }, dataSize(0)
+{
+}
+
+AudioPlay::WavFilePcmSink::~WavFilePcmSink()
+{
+	EndStream();
+}
+
+HRESULT AudioPlay::WavFilePcmSink::Create(_In_z_ LPCWCH path, _COM_Outptr_ WavFilePcmSink** pPtrSink)
+{
+	if (pPtrSink == nullptr)
+	{
+		return E_INVALIDARG;
+	}
+	*pPtrSink = nullptr;
+
+	if (path == nullptr)
+	{
+		return E_POINTER;
+	}
+
+	ComPtr<WavFilePcmSink> sink;
+	sink.Attach(new (std::nothrow) WavFilePcmSink());
+
+	if (!sink)
+	{
+		return E_OUTOFMEMORY;
+	}
+
+	sink->file = OpenFileStream(path, "wb");
+
+	if (sink->file == nullptr)
+	{
+		return HResultFromErrno(errno);
+	}
+
+	*pPtrSink = sink.Detach();
+
+	return S_OK;
+}
+
+HRESULT AudioPlay::WavFilePcmSink::WriteHeader(_In_ bool final)
+{
+	BYTE header[headerSize];
+	BYTE* output = header;
+
+	const UINT32 blockAlign = format.channels * sizeof(float);
+	const UINT64 riffSize = headerSize - 8 + dataSize + (dataSize & 1);
+	// RIFF sizes are 32 bit, the JUNK chunk reserved the room to turn the file into RF64
+	const bool rf64 = riffSize > 0xFFFFFFFF;
+
+	output = PutTag(output, rf64 ? "RF64" : "RIFF");
+	output = PutUInt32(output, rf64 ? 0xFFFFFFFF : static_cast<UINT32>(riffSize));
+	output = PutTag(output, "WAVE");
+
+	output = PutTag(output, rf64 ? "ds64" : "JUNK");
+	output = PutUInt32(output, 28);
+	output = PutUInt64(output, rf64 ? riffSize : 0);
+	output = PutUInt64(output, rf64 ? dataSize : 0);
+	output = PutUInt64(output, rf64 ? dataSize / blockAlign : 0);
+	output = PutUInt32(output, 0);
+
+	output = PutTag(output, "fmt ");
+	output = PutUInt32(output, 18);
+	output = PutUInt16(output, waveFormatIeeeFloat);
+	output = PutUInt16(output, format.channels);
+	output = PutUInt32(output, format.sampleRate);
+	output = PutUInt32(output, format.sampleRate * blockAlign);
+	output = PutUInt16(output, blockAlign);
+	output = PutUInt16(output, 32);
+	output = PutUInt16(output, 0);
+
+	UINT64 frames = dataSize / blockAlign;
+
+	output = PutTag(output, "fact");
+	output = PutUInt32(output, 4);
+	output = PutUInt32(output, frames > 0xFFFFFFFF ? 0xFFFFFFFF : static_cast<UINT32>(frames));
+
+	output = PutTag(output, "data");
+	output = PutUInt32(output, rf64 ? 0xFFFFFFFF : static_cast<UINT32>(dataSize));
+
+	if (final && fseek(file, 0, SEEK_SET) != 0)
+	{
+		return HResultFromErrno(errno);
+	}
+	if (fwrite(header, 1, sizeof(header), file) != sizeof(header))
+	{
+		return HResultFromErrno(errno);
+	}
+
+	return S_OK;
+}
+
+HRESULT AudioPlay::WavFilePcmSink::BeginStream(_In_ const PcmFormat& p_format)
+{
+	if (file == nullptr)
+	{
+		return E_UNEXPECTED;
+	}
+	if (p_format.channels == 0 || p_format.channels > 0xFFFF || p_format.sampleRate == 0)
+	{
+		return E_INVALIDARG;
+	}
+
+	format = p_format;
+	dataSize = 0;
+
+	return WriteHeader(false);
+}
+
+HRESULT AudioPlay::WavFilePcmSink::Write(_In_reads_(frameCount * format.channels) const float* frames, _In_ UINT32 frameCount)
+{
+	if (file == nullptr || format.channels == 0)
+	{
+		return E_UNEXPECTED;
+	}
+
+	size_t size = static_cast<size_t>(frameCount) * format.channels * sizeof(float);
+
+	if (fwrite(frames, 1, size, file) != size)
+	{
+		return HResultFromErrno(errno);
+	}
+
+	dataSize += size;
+
+	return S_OK;
+}
+
+HRESULT AudioPlay::WavFilePcmSink::EndStream()
+{
+	if (file == nullptr)
+	{
+		return S_FALSE;
+	}
+
+	HRESULT hr = S_OK;
+
+	if (format.channels)
+	{
+		if (dataSize & 1)
+		{
+			fputc(0, file);
+		}
+
+		hr = WriteHeader(true);
+	}
+
+	if (fclose(file) != 0 && SUCCEEDED(hr))
+	{
+		hr = HResultFromErrno(errno);
+	}
+
+	file = nullptr;
+
+	return hr;
+}
@@ -0,0 +1,127 @@
+#include "PcmSinkGrabber.h"
+
+#include <new>
+
+
+#define HR_FAIL_ACTION(hresult, action) if (FAILED(hresult)) { action; return hresult; }
+#define HR_FAIL(hresult) if (FAILED(hresult)) { return hresult; }
+
+
+AudioPlay::PcmSinkGrabber::PcmSinkGrabber(_In_ PcmSink* p_sink, _In_ const PcmFormat& p_format) :
+	referenceCount(1), sink(p_sink), format(p_format), streaming(false)
+{
+}
+
+AudioPlay::PcmSinkGrabber::~PcmSinkGrabber()
+{
+}
+
+HRESULT AudioPlay::PcmSinkGrabber::Create(_In_ PcmSink* sink, _In_ const PcmFormat& format, _COM_Outptr_ IMFSampleGrabberSinkCallback** pPtrCallback)
+{
+	if (pPtrCallback == nullptr)
+	{
+		return E_INVALIDARG;
+	}
+	*pPtrCallback = nullptr;
+
+	if (sink == nullptr)
+	{
+		return E_POINTER;
+	}
+
+	PcmSinkGrabber* grabber = new (std::nothrow) PcmSinkGrabber(sink, format);
+
+	if (grabber == nullptr)
+	{
+		return E_OUTOFMEMORY;
+	}
+
+	*pPtrCallback = grabber;
+
+	return S_OK;
+}
+
+#pragma region IMPLEMET_IUnknown
+
+STDMETHODIMP_(ULONG) AudioPlay::PcmSinkGrabber::AddRef()
+{
+	return InterlockedIncrement(&referenceCount);
+}
+
+STDMETHODIMP_(ULONG) AudioPlay::PcmSinkGrabber::Release()
+{
+	ULONG newRefCount = InterlockedDecrement(&referenceCount);
+
+	if (newRefCount == 0)
+	{
+		delete this;
+	}
+
+	return newRefCount;
+}
+
+STDMETHODIMP AudioPlay::PcmSinkGrabber::QueryInterface(REFIID riid, _COM_Outptr_ void** pPtr)
+{
+	if (pPtr == nullptr)
+	{
+		return E_POINTER;
+	}
+
+	if (riid == IID_IUnknown)
+	{
+		*pPtr = static_cast<IUnknown*>(this);
+	}
+	else if (riid == IID_IMFClockStateSink)
+	{
+		*pPtr = static_cast<IMFClockStateSink*>(this);
+	}
+	else if (riid == IID_IMFSampleGrabberSinkCallback)
+	{
+		*pPtr = static_cast<IMFSampleGrabberSinkCallback*>(this);
+	}
+	else
+	{
+		*pPtr = NULL;
+		return E_NOINTERFACE;
+	}
+
+	AddRef();
+	return S_OK;
+}
+
+#pragma endregion
+
+#pragma region IMPLEMENT_IMFSampleGrabberSinkCallback
+
+STDMETHODIMP AudioPlay::PcmSinkGrabber::OnProcessSample(REFGUID guidMajorMediaType, DWORD dwSampleFlags, LONGLONG llSampleTime, LONGLONG llSampleDuration,
+	_In_reads_bytes_(dwSampleSize) const BYTE* pSampleBuffer, DWORD dwSampleSize)
+{
+	UNREFERENCED_PARAMETER(guidMajorMediaType); UNREFERENCED_PARAMETER(dwSampleFlags);
+	UNREFERENCED_PARAMETER(llSampleTime); UNREFERENCED_PARAMETER(llSampleDuration);
+
+	HRESULT hr = S_OK;
+
+	if (!streaming)
+	{
+		hr = sink->BeginStream(format); HR_FAIL(hr);
+		streaming = true;
+	}
+
+	UINT32 frameCount = dwSampleSize / (format.channels * sizeof(float));
+
+	return sink->Write(reinterpret_cast<const float*>(pSampleBuffer), frameCount);
+}
+
+STDMETHODIMP AudioPlay::PcmSinkGrabber::OnShutdown()
+{
+	if (!streaming)
+	{
+		return S_OK;
+	}
+
+	streaming = false;
+
+	return sink->EndStream();
+}
+
+#pragma endregion
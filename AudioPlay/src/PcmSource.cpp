@@ -0,0 +1,129 @@
+#include "PcmSource.h"
+
+#include <cstring>
+#include <new>
+
+
+#define HR_FAIL_ACTION(hresult, action) if (FAILED(hresult)) { action; return hresult; }
+#define HR_FAIL(hresult) if (FAILED(hresult)) { return hresult; }
+
+
+AudioPlay::PcmSource::PcmSource() :
+	referenceCount(1), format{ 0, 0 }
+{
+}
+
+AudioPlay::PcmSource::~PcmSource()
+{
+}
+
+ULONG STDMETHODCALLTYPE AudioPlay::PcmSource::AddRef()
+{
+	return ++referenceCount;
+}
+
+ULONG STDMETHODCALLTYPE AudioPlay::PcmSource::Release()
+{
+	ULONG newRefCount = --referenceCount;
+
+	if (newRefCount == 0)
+	{
+		delete this;
+	}
+
+	return newRefCount;
+}
+
+AudioPlay::PcmBufferSource::PcmBufferSource() :
+	frames(nullptr), frameCount(0), position(0)
+{
+}
+
+AudioPlay::PcmBufferSource::~PcmBufferSource()
+{
+	delete[] frames;
+}
+
+HRESULT AudioPlay::PcmBufferSource::Create(_In_ const PcmFormat& format, _In_reads_(frameCount * format.channels) const float* frames, _In_ UINT64 frameCount, _COM_Outptr_ PcmBufferSource** pPtrSource)
+{
+	if (pPtrSource == nullptr)
+	{
+		return E_INVALIDARG;
+	}
+	*pPtrSource = nullptr;
+
+	if (format.channels == 0 || format.sampleRate == 0)
+	{
+		return E_INVALIDARG;
+	}
+	if (frames == nullptr && frameCount != 0)
+	{
+		return E_POINTER;
+	}
+
+	ComPtr<PcmBufferSource> source;
+	source.Attach(new (std::nothrow) PcmBufferSource());
+
+	if (!source)
+	{
+		return E_OUTOFMEMORY;
+	}
+
+	size_t sampleCount = static_cast<size_t>(frameCount * format.channels);
+
+	source->format = format;
+	source->frameCount = frameCount;
+	source->frames = new (std::nothrow) float[sampleCount ? sampleCount : 1];
+
+	if (source->frames == nullptr)
+	{
+		return E_OUTOFMEMORY;
+	}
+
+	if (sampleCount)
+	{
+		memcpy(source->frames, frames, sampleCount * sizeof(float));
+	}
+
+	*pPtrSource = source.Detach();
+
+	return S_OK;
+}
+
+HRESULT AudioPlay::PcmBufferSource::Read(_Out_writes_(frameCount * format.channels) float* buffer, _In_ UINT32 p_frameCount, _Out_ UINT32& framesRead)
+{
+	UINT64 available = frameCount - position;
+	framesRead = available < p_frameCount ? static_cast<UINT32>(available) : p_frameCount;
+
+	memcpy(buffer, frames + position * format.channels, static_cast<size_t>(framesRead) * format.channels * sizeof(float));
+
+	position += framesRead;
+
+	return S_OK;
+}
+
+HRESULT AudioPlay::PcmBufferSource::Seek(_In_ UINT64 frame)
+{
+	if (frame > frameCount)
+	{
+		return E_INVALIDARG;
+	}
+
+	position = frame;
+
+	return S_OK;
+}
+
+HRESULT AudioPlay::PcmBufferSource::GetPosition(_Out_ UINT64& frame) const
+{
+	frame = position;
+
+	return S_OK;
+}
+
+HRESULT AudioPlay::PcmBufferSource::GetLength(_Out_ UINT64& frames) const
+{
+	frames = frameCount;
+
+	return S_OK;
+}
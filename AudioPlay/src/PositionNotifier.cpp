@@ -0,0 +1,330 @@
+#include "PositionNotifier.h"
+
+#include <new>
+#include <system_error>
+
+
+#define HR_FAIL_ACTION(hresult, action) if (FAILED(hresult)) { action; return hresult; }
+#define HR_FAIL(hresult) if (FAILED(hresult)) { return hresult; }
+
+
+using std::chrono::duration_cast;
+
+
+AudioPlay::PositionNotifier::PositionNotifier() :
+	slots{ }, nextCookie(1), processedTick(0), batch(0), epoch(steady_clock::now()), statistics{ }, stopping(false)
+{
+}
+
+AudioPlay::PositionNotifier::~PositionNotifier()
+{
+	if (worker.joinable())
+	{
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			stopping = true;
+		}
+		wakeCondition.notify_all();
+		worker.join();
+	}
+
+	for (auto& entry : subscriptions)
+	{
+		delete entry.second;
+	}
+}
+
+AudioPlay::PositionNotifier& AudioPlay::PositionNotifier::Get()
+{
+	static PositionNotifier instance;
+
+	return instance;
+}
+
+UINT64 AudioPlay::PositionNotifier::Now() const
+{
+	return static_cast<UINT64>(duration_cast<milliseconds>(steady_clock::now() - epoch).count());
+}
+
+void AudioPlay::PositionNotifier::Link(_In_ Subscription* subscription)
+{
+	Subscription*& slot = slots[subscription->due & (wheelSize - 1)];
+
+	subscription->next = slot;
+	slot = subscription;
+}
+
+void AudioPlay::PositionNotifier::Unlink(_In_ Subscription* subscription)
+{
+	Subscription** link = &slots[subscription->due & (wheelSize - 1)];
+
+	while (*link && *link != subscription)
+	{
+		link = &(*link)->next;
+	}
+
+	if (*link)
+	{
+		*link = subscription->next;
+	}
+	subscription->next = nullptr;
+}
+
+HRESULT AudioPlay::PositionNotifier::Subscribe(_In_ AudioStateMachine* stateMachine, _In_ milliseconds interval,
+	_In_ PositionCallback callback, _In_opt_ void* context, _Out_ UINT64& cookie)
+{
+	cookie = 0;
+
+	if (stateMachine == nullptr || callback == nullptr)
+	{
+		return E_POINTER;
+	}
+
+	if (interval < minInterval || interval > maxInterval)
+	{
+		return E_INVALIDARG;
+	}
+
+	Subscription* subscription = new (std::nothrow) Subscription{ };
+
+	if (subscription == nullptr)
+	{
+		return E_OUTOFMEMORY;
+	}
+
+	std::lock_guard<std::mutex> lock(mutex);
+
+	if (!worker.joinable())
+	{
+		try
+		{
+			worker = std::thread(&PositionNotifier::Work, this);
+		}
+		catch (const std::system_error&)
+		{
+			delete subscription;
+			return E_OUTOFMEMORY;
+		}
+	}
+
+	subscription->cookie = nextCookie++;
+	subscription->stateMachine = stateMachine;
+	subscription->callback = callback;
+	subscription->context = context;
+	subscription->interval = static_cast<UINT64>(interval.count());
+	// On a multiple of the interval so every subscription with the same interval fires on the same wakeup
+	subscription->due = (Now() / subscription->interval + 1) * subscription->interval;
+	// Anything but a real state so the first tick is delivered even while paused
+	subscription->lastState = static_cast<AudioStates>(0);
+
+	Link(subscription);
+	subscriptions[subscription->cookie] = subscription;
+	statistics.subscriptionCount++;
+
+	cookie = subscription->cookie;
+
+	wakeCondition.notify_one();
+
+	return S_OK;
+}
+
+void AudioPlay::PositionNotifier::Remove(_Inout_ std::unique_lock<std::mutex>& lock, _In_ Subscription* subscription)
+{
+	subscriptions.erase(subscription->cookie);
+	statistics.subscriptionCount--;
+
+	if (!subscription->firing)
+	{
+		Unlink(subscription);
+		delete subscription;
+		return;
+	}
+
+	// The timer thread deletes it after the batch
+	subscription->removed = true;
+
+	if (std::this_thread::get_id() != worker.get_id())
+	{
+		UINT64 current = batch;
+		firedCondition.wait(lock, [this, current] { return batch != current; });
+	}
+}
+
+HRESULT AudioPlay::PositionNotifier::Unsubscribe(_In_ UINT64 cookie)
+{
+	std::unique_lock<std::mutex> lock(mutex);
+
+	auto found = subscriptions.find(cookie);
+
+	if (found == subscriptions.end())
+	{
+		return S_FALSE;
+	}
+
+	Remove(lock, found->second);
+
+	return S_OK;
+}
+
+HRESULT AudioPlay::PositionNotifier::UnsubscribeAll(_In_ AudioStateMachine* stateMachine)
+{
+	std::unique_lock<std::mutex> lock(mutex);
+
+	HRESULT hr = S_FALSE;
+
+	// Remove may wait and let the map change, look the next one up again every time
+	for (bool removed = true; removed; )
+	{
+		removed = false;
+
+		for (auto& entry : subscriptions)
+		{
+			if (entry.second->stateMachine == stateMachine)
+			{
+				Remove(lock, entry.second);
+				removed = true;
+				hr = S_OK;
+				break;
+			}
+		}
+	}
+
+	return hr;
+}
+
+bool AudioPlay::PositionNotifier::Fire(_In_ Subscription* subscription)
+{
+	AudioStates state = subscription->stateMachine->GetState();
+
+	// Only the first tick after leaving Started or Starting gets through
+	if (!(bool)(state & AudioStates::Start) && state == subscription->lastState)
+	{
+		return false;
+	}
+
+	PositionTick tick = { milliseconds{ -1 }, state, ++subscription->sequence, subscription->coalesced };
+
+	if (FAILED(subscription->stateMachine->GetPosition(tick.position)))
+	{
+		tick.position = milliseconds{ -1 };
+	}
+
+	subscription->lastState = state;
+	subscription->callback(tick, subscription->context);
+
+	return true;
+}
+
+void AudioPlay::PositionNotifier::Work()
+{
+	std::unique_lock<std::mutex> lock(mutex);
+
+	processedTick = Now();
+
+	while (!stopping)
+	{
+		UINT64 now = Now();
+
+		// Every slot once at most, even if the thread was held up for longer than a turn of the wheel
+		UINT64 from = now - processedTick > wheelSize ? now - wheelSize + 1 : processedTick + 1;
+
+		for (UINT64 tick = from; tick <= now; tick++)
+		{
+			Subscription** link = &slots[tick & (wheelSize - 1)];
+
+			while (*link)
+			{
+				Subscription* subscription = *link;
+
+				// Still turns of the wheel to go
+				if (subscription->due > now)
+				{
+					link = &subscription->next;
+					continue;
+				}
+
+				*link = subscription->next;
+				subscription->next = nullptr;
+				subscription->firing = true;
+				subscription->coalesced = static_cast<UINT32>((now - subscription->due) / subscription->interval);
+
+				firing.push_back(subscription);
+			}
+		}
+
+		processedTick = now;
+
+		if (!firing.empty())
+		{
+			lock.unlock();
+
+			UINT64 delivered = 0;
+			UINT64 coalesced = 0;
+
+			for (Subscription* subscription : firing)
+			{
+				if (Fire(subscription))
+				{
+					delivered++;
+					coalesced += subscription->coalesced;
+				}
+			}
+
+			lock.lock();
+
+			statistics.wakeups++;
+			statistics.delivered += delivered;
+			statistics.suppressed += firing.size() - delivered;
+			statistics.coalesced += coalesced;
+
+			for (Subscription* subscription : firing)
+			{
+				subscription->firing = false;
+
+				if (subscription->removed)
+				{
+					delete subscription;
+					continue;
+				}
+
+				// The next multiple of the interval after now, ticks missed on the way are the coalesced ones
+				subscription->due = (now / subscription->interval + 1) * subscription->interval;
+				Link(subscription);
+			}
+
+			firing.clear();
+
+			batch++;
+			firedCondition.notify_all();
+
+			continue;
+		}
+
+		if (subscriptions.empty())
+		{
+			wakeCondition.wait(lock);
+			continue;
+		}
+
+		// Sleeps up to the next slot with anything in it, a subscription waiting for another turn of the wheel wakes it early once per turn
+		UINT64 next = now + wheelSize;
+
+		for (UINT64 tick = now + 1; tick < now + wheelSize; tick++)
+		{
+			if (slots[tick & (wheelSize - 1)])
+			{
+				next = tick;
+				break;
+			}
+		}
+
+		wakeCondition.wait_until(lock, epoch + milliseconds{ next });
+	}
+}
+
+AudioPlay::PositionNotifierStatistics AudioPlay::PositionNotifier::GetStatistics()
+{
+	std::lock_guard<std::mutex> lock(mutex);
+
+	return statistics;
+}
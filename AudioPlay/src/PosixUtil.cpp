@@ -0,0 +1,112 @@
+#include "PosixUtil.h"
+
+#include <cerrno>
+#include <new>
+
+#ifndef _WIN32
+#include <cstdlib>
+#include <fcntl.h>
+#endif
+
+
+#ifndef _WIN32
+namespace
+{
+	// Narrowing fails before the call, its error is reported the way the call reports its own
+	void SetErrno(_In_ HRESULT hr)
+	{
+		errno = hr == E_OUTOFMEMORY ? ENOMEM : EINVAL;
+	}
+}
+#endif
+
+HRESULT AudioPlay::HResultFromErrno(_In_ int error)
+{
+	switch (error)
+	{
+		case ENOENT: return HRESULT_FROM_WIN32(ERROR_FILE_NOT_FOUND);
+		case EACCES: return HRESULT_FROM_WIN32(ERROR_ACCESS_DENIED);
+		case EEXIST: return HRESULT_FROM_WIN32(ERROR_ALREADY_EXISTS);
+		case ENOMEM: return E_OUTOFMEMORY;
+		case EINVAL: return E_INVALIDARG;
+	}
+	return E_FAIL;
+}
+
+FILE* AudioPlay::OpenFileStream(_In_z_ LPCWCH path, _In_z_ const char* mode)
+{
+	#ifdef _WIN32
+	wchar_t wideMode[4] = { };
+
+	for (int index = 0; index < 3 && mode[index]; index++)
+	{
+		wideMode[index] = mode[index];
+	}
+
+	FILE* file = nullptr;
+	return _wfopen_s(&file, path, wideMode) == 0 ? file : nullptr;
+	#else
+	char* narrowPath = nullptr;
+	HRESULT hr = NarrowPath(path, &narrowPath);
+
+	if (FAILED(hr))
+	{
+		SetErrno(hr);
+		return nullptr;
+	}
+
+	FILE* file = fopen(narrowPath, mode);
+	int error = errno;
+
+	delete[] narrowPath;
+
+	errno = error;
+	return file;
+	#endif
+}
+
+#ifndef _WIN32
+HRESULT AudioPlay::NarrowPath(_In_z_ LPCWCH path, _Outptr_ char** narrowPath)
+{
+	*narrowPath = nullptr;
+
+	size_t length = wcstombs(nullptr, path, 0);
+
+	if (length == static_cast<size_t>(-1))
+	{
+		return E_INVALIDARG;
+	}
+
+	char* buffer = new (std::nothrow) char[length + 1];
+
+	if (buffer == nullptr)
+	{
+		return E_OUTOFMEMORY;
+	}
+
+	wcstombs(buffer, path, length + 1);
+
+	*narrowPath = buffer;
+	return S_OK;
+}
+
+int AudioPlay::OpenDescriptor(_In_z_ LPCWCH path, _In_ int flags)
+{
+	char* narrowPath = nullptr;
+	HRESULT hr = NarrowPath(path, &narrowPath);
+
+	if (FAILED(hr))
+	{
+		SetErrno(hr);
+		return -1;
+	}
+
+	int descriptor = open(narrowPath, flags);
+	int error = errno;
+
+	delete[] narrowPath;
+
+	errno = error;
+	return descriptor;
+}
+#endif
@@ -0,0 +1,372 @@
+#include "ReadAheadByteStream.h"
+#include "AutoCriticalSection.h"
+
+#include <new>
+
+
+#define HR_FAIL_ACTION(hresult, action) if (FAILED(hresult)) { action; return hresult; }
+#define HR_FAIL(hresult) if (FAILED(hresult)) { return hresult; }
+
+
+namespace
+{
+	// Runs a BeginRead on the read queue and carries the byte count to its EndRead
+	class ReadOperation : public IMFAsyncCallback
+	{
+		ULONG referenceCount;
+
+		// Both released once the caller was called back, the result holds this operation
+		AudioPlay::ComPtr<IMFByteStream> byteStream;
+		AudioPlay::ComPtr<IMFAsyncResult> callerResult;
+		BYTE* buffer;
+		ULONG size;
+
+		public:
+		ULONG bytesRead;
+
+		ReadOperation(_In_ IMFByteStream* stream, _In_ BYTE* p_buffer, _In_ ULONG p_size) :
+			referenceCount(1), byteStream(stream), buffer(p_buffer), size(p_size), bytesRead(0) { }
+		virtual ~ReadOperation() = default;
+
+		void SetCallerResult(_In_ IMFAsyncResult* result) { callerResult = result; }
+
+		STDMETHODIMP QueryInterface(REFIID riid, _COM_Outptr_ void** pPtr)
+		{
+			if (pPtr == nullptr)
+			{
+				return E_POINTER;
+			}
+			if (riid == IID_IUnknown || riid == IID_IMFAsyncCallback)
+			{
+				*pPtr = static_cast<IMFAsyncCallback*>(this);
+				AddRef();
+				return S_OK;
+			}
+			*pPtr = nullptr;
+			return E_NOINTERFACE;
+		}
+
+		STDMETHODIMP GetParameters(_Out_ DWORD* pdwFlags, _Out_ DWORD* pdwQueue)
+		{
+			UNREFERENCED_PARAMETER(pdwFlags); UNREFERENCED_PARAMETER(pdwQueue);
+
+			return E_NOTIMPL;
+		}
+
+		STDMETHODIMP Invoke(_In_ IMFAsyncResult* asyncResult)
+		{
+			UNREFERENCED_PARAMETER(asyncResult);
+
+			ULONG read = 0;
+
+			// Waits only when the decoder got ahead of the I/O thread
+			HRESULT readResult = byteStream->Read(buffer, size, &read);
+
+			bytesRead = read;
+
+			AudioPlay::ComPtr<IMFAsyncResult> result;
+			result.Attach(callerResult.Detach());
+
+			byteStream = nullptr;
+
+			result->SetStatus(readResult);
+
+			return MFInvokeCallback(result);
+		}
+
+		STDMETHODIMP_(ULONG) AddRef() { return InterlockedIncrement(&referenceCount); }
+		STDMETHODIMP_(ULONG) Release()
+		{
+			ULONG newRefCount = InterlockedDecrement(&referenceCount);
+			if (newRefCount == 0)
+			{
+				delete this;
+			}
+			return newRefCount;
+		}
+	};
+}
+
+AudioPlay::ReadAheadByteStream::ReadAheadByteStream(_In_ ReadAheadStream* p_stream) :
+	referenceCount(1), stream(p_stream), readQueue(0)
+{
+	InitializeCriticalSection(&criticalSection);
+}
+
+AudioPlay::ReadAheadByteStream::~ReadAheadByteStream()
+{
+	if (readQueue)
+	{
+		MFUnlockWorkQueue(readQueue);
+	}
+
+	DeleteCriticalSection(&criticalSection);
+}
+
+HRESULT AudioPlay::ReadAheadByteStream::Initialize()
+{
+	return MFAllocateSerialWorkQueue(MFASYNC_CALLBACK_QUEUE_LONG_FUNCTION, &readQueue);
+}
+
+HRESULT AudioPlay::ReadAheadByteStream::Create(_In_ ReadAheadStream* stream, _COM_Outptr_ IMFByteStream** pPtrByteStream)
+{
+	if (pPtrByteStream == nullptr)
+	{
+		return E_INVALIDARG;
+	}
+	*pPtrByteStream = nullptr;
+
+	if (stream == nullptr)
+	{
+		return E_POINTER;
+	}
+
+	ComPtr<ReadAheadByteStream> byteStream;
+	byteStream.Attach(new (std::nothrow) ReadAheadByteStream(stream));
+
+	if (!byteStream)
+	{
+		return E_OUTOFMEMORY;
+	}
+
+	HRESULT hr = byteStream->Initialize(); HR_FAIL(hr);
+
+	*pPtrByteStream = byteStream.Detach();
+
+	return hr;
+}
+
+#pragma region IMPLEMET_IUnknown
+
+STDMETHODIMP_(ULONG) AudioPlay::ReadAheadByteStream::AddRef()
+{
+	return InterlockedIncrement(&referenceCount);
+}
+
+STDMETHODIMP_(ULONG) AudioPlay::ReadAheadByteStream::Release()
+{
+	ULONG newRefCount = InterlockedDecrement(&referenceCount);
+
+	if (newRefCount == 0)
+	{
+		delete this;
+	}
+
+	return newRefCount;
+}
+
+STDMETHODIMP AudioPlay::ReadAheadByteStream::QueryInterface(REFIID riid, _COM_Outptr_ void** pPtr)
+{
+	if (pPtr == nullptr)
+	{
+		return E_POINTER;
+	}
+
+	if (riid == IID_IUnknown)
+	{
+		*pPtr = static_cast<IUnknown*>(this);
+	}
+	else if (riid == IID_IMFByteStream)
+	{
+		*pPtr = static_cast<IMFByteStream*>(this);
+	}
+	else
+	{
+		*pPtr = NULL;
+		return E_NOINTERFACE;
+	}
+
+	AddRef();
+	return S_OK;
+}
+
+#pragma endregion
+
+#pragma region IMPLEMENT_IMFByteStream
+
+STDMETHODIMP AudioPlay::ReadAheadByteStream::GetCapabilities(_Out_ DWORD* pdwCapabilities)
+{
+	if (pdwCapabilities == nullptr)
+	{
+		return E_POINTER;
+	}
+
+	*pdwCapabilities = MFBYTESTREAM_IS_READABLE | MFBYTESTREAM_IS_SEEKABLE | MFBYTESTREAM_DOES_NOT_USE_NETWORK;
+
+	return S_OK;
+}
+
+STDMETHODIMP AudioPlay::ReadAheadByteStream::GetLength(_Out_ QWORD* pqwLength)
+{
+	if (pqwLength == nullptr)
+	{
+		return E_POINTER;
+	}
+
+	*pqwLength = stream->GetSize();
+
+	return S_OK;
+}
+
+STDMETHODIMP AudioPlay::ReadAheadByteStream::SetLength(_In_ QWORD qwLength)
+{
+	UNREFERENCED_PARAMETER(qwLength);
+
+	return E_ACCESSDENIED;
+}
+
+STDMETHODIMP AudioPlay::ReadAheadByteStream::GetCurrentPosition(_Out_ QWORD* pqwPosition)
+{
+	if (pqwPosition == nullptr)
+	{
+		return E_POINTER;
+	}
+
+	*pqwPosition = stream->GetPosition();
+
+	return S_OK;
+}
+
+STDMETHODIMP AudioPlay::ReadAheadByteStream::SetCurrentPosition(_In_ QWORD qwPosition)
+{
+	AutoCriticalSection section(&criticalSection);
+
+	return stream->Seek(qwPosition);
+}
+
+STDMETHODIMP AudioPlay::ReadAheadByteStream::IsEndOfStream(_Out_ BOOL* pfEndOfStream)
+{
+	if (pfEndOfStream == nullptr)
+	{
+		return E_POINTER;
+	}
+
+	*pfEndOfStream = stream->GetPosition() >= stream->GetSize();
+
+	return S_OK;
+}
+
+STDMETHODIMP AudioPlay::ReadAheadByteStream::Read(_Out_writes_bytes_(cb) BYTE* pb, _In_ ULONG cb, _Out_ ULONG* pcbRead)
+{
+	if (pb == nullptr || pcbRead == nullptr)
+	{
+		return E_POINTER;
+	}
+
+	AutoCriticalSection section(&criticalSection);
+
+	UINT32 read = 0;
+
+	// Waits only when the decoder got ahead of the I/O thread
+	HRESULT hr = stream->Read(pb, cb, read);
+
+	*pcbRead = read;
+
+	return hr;
+}
+
+STDMETHODIMP AudioPlay::ReadAheadByteStream::BeginRead(_Out_writes_bytes_(cb) BYTE* pb, _In_ ULONG cb, _In_ IMFAsyncCallback* pCallback, _In_opt_ IUnknown* punkState)
+{
+	if (pCallback == nullptr)
+	{
+		return E_POINTER;
+	}
+
+	ComPtr<IMFAsyncResult> asyncResult;
+	ComPtr<ReadOperation> operation;
+
+	operation.Attach(new (std::nothrow) ReadOperation(this, pb, cb));
+
+	if (!operation)
+	{
+		return E_OUTOFMEMORY;
+	}
+
+	HRESULT hr = MFCreateAsyncResult(operation, pCallback, punkState, &asyncResult); HR_FAIL(hr);
+
+	operation->SetCallerResult(asyncResult);
+
+	// The read runs on the queue, the caller is called back from there once it finished
+	hr = MFPutWorkItem(readQueue, operation, nullptr); HR_FAIL_ACTION(hr, operation->SetCallerResult(nullptr));
+
+	return hr;
+}
+
+STDMETHODIMP AudioPlay::ReadAheadByteStream::EndRead(_In_ IMFAsyncResult* pResult, _Out_ ULONG* pcbRead)
+{
+	if (pResult == nullptr || pcbRead == nullptr)
+	{
+		return E_POINTER;
+	}
+	*pcbRead = 0;
+
+	ComPtr<IUnknown> object;
+
+	HRESULT hr = pResult->GetObject(&object); HR_FAIL(hr);
+
+	*pcbRead = static_cast<ReadOperation*>(object.p)->bytesRead;
+
+	return pResult->GetStatus();
+}
+
+STDMETHODIMP AudioPlay::ReadAheadByteStream::Write(_In_reads_bytes_(cb) const BYTE* pb, _In_ ULONG cb, _Out_ ULONG* pcbWritten)
+{
+	UNREFERENCED_PARAMETER(pb); UNREFERENCED_PARAMETER(cb); UNREFERENCED_PARAMETER(pcbWritten);
+
+	return E_ACCESSDENIED;
+}
+
+STDMETHODIMP AudioPlay::ReadAheadByteStream::BeginWrite(_In_reads_bytes_(cb) const BYTE* pb, _In_ ULONG cb, _In_ IMFAsyncCallback* pCallback, _In_opt_ IUnknown* punkState)
+{
+	UNREFERENCED_PARAMETER(pb); UNREFERENCED_PARAMETER(cb);
+	UNREFERENCED_PARAMETER(pCallback); UNREFERENCED_PARAMETER(punkState);
+
+	return E_ACCESSDENIED;
+}
+
+STDMETHODIMP AudioPlay::ReadAheadByteStream::EndWrite(_In_ IMFAsyncResult* pResult, _Out_ ULONG* pcbWritten)
+{
+	UNREFERENCED_PARAMETER(pResult); UNREFERENCED_PARAMETER(pcbWritten);
+
+	return E_ACCESSDENIED;
+}
+
+STDMETHODIMP AudioPlay::ReadAheadByteStream::Seek(_In_ MFBYTESTREAM_SEEK_ORIGIN SeekOrigin, _In_ LONGLONG llSeekOffset, _In_ DWORD dwSeekFlags, _Out_opt_ QWORD* pqwCurrentPosition)
+{
+	UNREFERENCED_PARAMETER(dwSeekFlags);
+
+	AutoCriticalSection section(&criticalSection);
+
+	LONGLONG newPosition = llSeekOffset;
+
+	if (SeekOrigin == msoCurrent)
+	{
+		newPosition += static_cast<LONGLONG>(stream->GetPosition());
+	}
+
+	if (newPosition < 0)
+	{
+		return E_INVALIDARG;
+	}
+
+	HRESULT hr = stream->Seek(static_cast<UINT64>(newPosition)); HR_FAIL(hr);
+
+	if (pqwCurrentPosition)
+	{
+		*pqwCurrentPosition = static_cast<QWORD>(newPosition);
+	}
+
+	return hr;
+}
+
+STDMETHODIMP AudioPlay::ReadAheadByteStream::Flush()
+{
+	return S_OK;
+}
+
+STDMETHODIMP AudioPlay::ReadAheadByteStream::Close()
+{
+	return S_OK;
+}
+
+#pragma endregion
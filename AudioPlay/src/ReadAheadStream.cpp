@@ -0,0 +1,600 @@
+#include "ReadAheadStream.h"
+#include "PosixUtil.h"
+#include "RealtimeThread.h"
+
+#include <cstring>
+#include <new>
+#include <system_error>
+
+#ifndef _WIN32
+#include <cerrno>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+
+#define HR_FAIL_ACTION(hresult, action) if (FAILED(hresult)) { action; return hresult; }
+#define HR_FAIL(hresult) if (FAILED(hresult)) { return hresult; }
+
+
+using std::chrono::duration_cast;
+using std::chrono::nanoseconds;
+using std::chrono::steady_clock;
+
+
+AudioPlay::ByteReader::ByteReader() :
+	referenceCount(1)
+{
+}
+
+AudioPlay::ByteReader::~ByteReader()
+{
+}
+
+ULONG STDMETHODCALLTYPE AudioPlay::ByteReader::AddRef()
+{
+	return ++referenceCount;
+}
+
+ULONG STDMETHODCALLTYPE AudioPlay::ByteReader::Release()
+{
+	ULONG count = --referenceCount;
+	if (count == 0)
+	{
+		delete this;
+	}
+	return count;
+}
+
+#ifdef _WIN32
+
+AudioPlay::FileByteReader::FileByteReader() :
+	file(INVALID_HANDLE_VALUE), size(0)
+{
+}
+
+AudioPlay::FileByteReader::~FileByteReader()
+{
+	if (file != INVALID_HANDLE_VALUE)
+	{
+		CloseHandle(file);
+	}
+}
+
+HRESULT AudioPlay::FileByteReader::Open(_In_z_ LPCWCH path, _COM_Outptr_ FileByteReader** pPtrReader)
+{
+	if (pPtrReader == nullptr)
+	{
+		return E_INVALIDARG;
+	}
+	*pPtrReader = nullptr;
+
+	if (path == nullptr)
+	{
+		return E_POINTER;
+	}
+
+	ComPtr<FileByteReader> reader;
+	reader.Attach(new (std::nothrow) FileByteReader());
+
+	if (!reader)
+	{
+		return E_OUTOFMEMORY;
+	}
+
+	reader->file = CreateFileW(path, GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL | FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+
+	if (reader->file == INVALID_HANDLE_VALUE)
+	{
+		return HRESULT_FROM_WIN32(GetLastError());
+	}
+
+	LARGE_INTEGER fileSize = { 0 };
+	if (!GetFileSizeEx(reader->file, &fileSize))
+	{
+		return HRESULT_FROM_WIN32(GetLastError());
+	}
+
+	reader->size = static_cast<UINT64>(fileSize.QuadPart);
+
+	*pPtrReader = reader.Detach();
+
+	return S_OK;
+}
+
+HRESULT AudioPlay::FileByteReader::ReadAt(_In_ UINT64 offset, _Out_writes_bytes_to_(byteCount, bytesRead) BYTE* buffer, _In_ UINT32 byteCount, _Out_ UINT32& bytesRead)
+{
+	bytesRead = 0;
+
+	while (bytesRead < byteCount)
+	{
+		OVERLAPPED overlapped = { 0 };
+		overlapped.Offset = static_cast<DWORD>(offset + bytesRead);
+		overlapped.OffsetHigh = static_cast<DWORD>((offset + bytesRead) >> 32);
+
+		DWORD read = 0;
+		if (!ReadFile(file, buffer + bytesRead, byteCount - bytesRead, &read, &overlapped))
+		{
+			DWORD error = GetLastError();
+
+			if (error == ERROR_HANDLE_EOF)
+			{
+				break;
+			}
+			return HRESULT_FROM_WIN32(error);
+		}
+
+		if (read == 0)
+		{
+			break;
+		}
+
+		bytesRead += read;
+	}
+
+	return S_OK;
+}
+
+#else
+
+AudioPlay::FileByteReader::FileByteReader() :
+	descriptor(-1), size(0)
+{
+}
+
+AudioPlay::FileByteReader::~FileByteReader()
+{
+	if (descriptor != -1)
+	{
+		close(descriptor);
+	}
+}
+
+HRESULT AudioPlay::FileByteReader::Open(_In_z_ LPCWCH path, _COM_Outptr_ FileByteReader** pPtrReader)
+{
+	if (pPtrReader == nullptr)
+	{
+		return E_INVALIDARG;
+	}
+	*pPtrReader = nullptr;
+
+	if (path == nullptr)
+	{
+		return E_POINTER;
+	}
+
+	ComPtr<FileByteReader> reader;
+	reader.Attach(new (std::nothrow) FileByteReader());
+
+	if (!reader)
+	{
+		return E_OUTOFMEMORY;
+	}
+
+	reader->descriptor = OpenDescriptor(path, O_RDONLY | O_CLOEXEC);
+
+	if (reader->descriptor == -1)
+	{
+		return HResultFromErrno(errno);
+	}
+
+	struct stat status;
+	if (fstat(reader->descriptor, &status) != 0)
+	{
+		return HResultFromErrno(errno);
+	}
+
+	reader->size = static_cast<UINT64>(status.st_size);
+
+	posix_fadvise(reader->descriptor, 0, 0, POSIX_FADV_SEQUENTIAL);
+
+	*pPtrReader = reader.Detach();
+
+	return S_OK;
+}
+
+HRESULT AudioPlay::FileByteReader::ReadAt(_In_ UINT64 offset, _Out_writes_bytes_to_(byteCount, bytesRead) BYTE* buffer, _In_ UINT32 byteCount, _Out_ UINT32& bytesRead)
+{
+	bytesRead = 0;
+
+	while (bytesRead < byteCount)
+	{
+		ssize_t read = pread(descriptor, buffer + bytesRead, byteCount - bytesRead, static_cast<off_t>(offset + bytesRead));
+
+		if (read < 0)
+		{
+			if (errno == EINTR)
+			{
+				continue;
+			}
+			return HResultFromErrno(errno);
+		}
+
+		if (read == 0)
+		{
+			break;
+		}
+
+		bytesRead += static_cast<UINT32>(read);
+	}
+
+	return S_OK;
+}
+
+#endif
+
+AudioPlay::ThrottledByteReader::ThrottledByteReader() :
+	latency(0), bytesPerSecond(0), readCount(0)
+{
+}
+
+HRESULT AudioPlay::ThrottledByteReader::Create(_In_ ByteReader* reader, _In_ nanoseconds latency, _In_ UINT64 bytesPerSecond, _COM_Outptr_ ThrottledByteReader** pPtrReader)
+{
+	if (pPtrReader == nullptr)
+	{
+		return E_INVALIDARG;
+	}
+	*pPtrReader = nullptr;
+
+	if (reader == nullptr)
+	{
+		return E_POINTER;
+	}
+
+	ThrottledByteReader* throttled = new (std::nothrow) ThrottledByteReader();
+
+	if (throttled == nullptr)
+	{
+		return E_OUTOFMEMORY;
+	}
+
+	throttled->reader = reader;
+	throttled->latency = latency;
+	throttled->bytesPerSecond = bytesPerSecond;
+
+	*pPtrReader = throttled;
+
+	return S_OK;
+}
+
+HRESULT AudioPlay::ThrottledByteReader::ReadAt(_In_ UINT64 offset, _Out_writes_bytes_to_(byteCount, bytesRead) BYTE* buffer, _In_ UINT32 byteCount, _Out_ UINT32& bytesRead)
+{
+	readCount++;
+
+	nanoseconds wait = latency;
+
+	if (bytesPerSecond)
+	{
+		wait += nanoseconds{ static_cast<INT64>(static_cast<double>(byteCount) * 1e9 / bytesPerSecond) };
+	}
+
+	std::this_thread::sleep_for(wait);
+
+	return reader->ReadAt(offset, buffer, byteCount, bytesRead);
+}
+
+
+AudioPlay::ReadAheadStream::ReadAheadStream() :
+	referenceCount(1), size(0), chunkSize(0), depth(0), buffer(nullptr), chunks(nullptr), chunkCount(0),
+	position(0), stopping(false), statistics{ }
+{
+}
+
+AudioPlay::ReadAheadStream::~ReadAheadStream()
+{
+	if (ioThread.joinable())
+	{
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			stopping = true;
+		}
+		ioCondition.notify_all();
+		ioThread.join();
+	}
+
+	delete[] chunks;
+	operator delete[](buffer, std::align_val_t{ alignment }, std::nothrow);
+}
+
+HRESULT AudioPlay::ReadAheadStream::Create(_In_ ByteReader* reader, _In_ const ReadAheadSettings& settings, _COM_Outptr_ ReadAheadStream** pPtrStream)
+{
+	if (pPtrStream == nullptr)
+	{
+		return E_INVALIDARG;
+	}
+	*pPtrStream = nullptr;
+
+	if (reader == nullptr)
+	{
+		return E_POINTER;
+	}
+
+	if (settings.chunkSize < alignment || (settings.chunkSize & (settings.chunkSize - 1)) != 0 || settings.depth == 0 || settings.depth > 1024)
+	{
+		return E_INVALIDARG;
+	}
+
+	ComPtr<ReadAheadStream> stream;
+	stream.Attach(new (std::nothrow) ReadAheadStream());
+
+	if (!stream)
+	{
+		return E_OUTOFMEMORY;
+	}
+
+	stream->reader = reader;
+	stream->size = reader->GetSize();
+	stream->chunkSize = settings.chunkSize;
+	stream->depth = settings.depth;
+	stream->chunkCount = settings.depth + 2;
+
+	stream->chunks = new (std::nothrow) Chunk[stream->chunkCount];
+	// Chunk aligned offsets into sector aligned memory, what unbuffered reads need
+	stream->buffer = static_cast<BYTE*>(operator new[](static_cast<size_t>(stream->chunkCount) * stream->chunkSize, std::align_val_t{ alignment }, std::nothrow));
+
+	if (stream->chunks == nullptr || stream->buffer == nullptr)
+	{
+		return E_OUTOFMEMORY;
+	}
+
+	for (UINT32 index = 0; index < stream->chunkCount; index++)
+	{
+		stream->chunks[index] = { 0, ChunkState::Empty, 0, S_OK, stream->buffer + static_cast<size_t>(index) * stream->chunkSize };
+	}
+
+	try
+	{
+		stream->ioThread = std::thread(&ReadAheadStream::Work, stream.p);
+	}
+	catch (const std::system_error&)
+	{
+		return E_OUTOFMEMORY;
+	}
+
+	*pPtrStream = stream.Detach();
+
+	return S_OK;
+}
+
+ULONG STDMETHODCALLTYPE AudioPlay::ReadAheadStream::AddRef()
+{
+	return ++referenceCount;
+}
+
+ULONG STDMETHODCALLTYPE AudioPlay::ReadAheadStream::Release()
+{
+	ULONG count = --referenceCount;
+	if (count == 0)
+	{
+		delete this;
+	}
+	return count;
+}
+
+AudioPlay::ReadAheadStream::Chunk* AudioPlay::ReadAheadStream::Find(_In_ UINT64 index)
+{
+	for (UINT32 slot = 0; slot < chunkCount; slot++)
+	{
+		if (chunks[slot].state != ChunkState::Empty && chunks[slot].index == index)
+		{
+			return &chunks[slot];
+		}
+	}
+	return nullptr;
+}
+
+bool AudioPlay::ReadAheadStream::PickChunk(_Out_ UINT64& index)
+{
+	UINT64 current = position / chunkSize;
+
+	// Nearest first, the chunk under the position is the one a reader may be waiting for
+	for (UINT64 ahead = 0; ahead <= depth; ahead++)
+	{
+		index = current + ahead;
+
+		if (index * chunkSize >= size)
+		{
+			break;
+		}
+
+		if (Find(index) == nullptr)
+		{
+			return true;
+		}
+	}
+
+	return false;
+}
+
+AudioPlay::ReadAheadStream::Chunk* AudioPlay::ReadAheadStream::PickSlot(_In_ UINT64 current)
+{
+	Chunk* farthest = nullptr;
+	UINT64 farthestDistance = 0;
+
+	for (UINT32 slot = 0; slot < chunkCount; slot++)
+	{
+		Chunk& chunk = chunks[slot];
+
+		if (chunk.state == ChunkState::Empty)
+		{
+			return &chunk;
+		}
+		if (chunk.state == ChunkState::Loading)
+		{
+			continue;
+		}
+
+		// Keeps the window and the chunk just behind it
+		if (chunk.index + 1 < current || chunk.index > current + depth)
+		{
+			UINT64 distance = chunk.index < current ? current - chunk.index : chunk.index - current;
+
+			if (distance > farthestDistance)
+			{
+				farthest = &chunk;
+				farthestDistance = distance;
+			}
+		}
+	}
+
+	return farthest;
+}
+
+void AudioPlay::ReadAheadStream::Work()
+{
+	std::unique_lock<std::mutex> lock(mutex);
+
+	while (!stopping)
+	{
+		UINT64 index = 0;
+		Chunk* chunk = nullptr;
+
+		if (PickChunk(index))
+		{
+			chunk = PickSlot(position / chunkSize);
+		}
+
+		if (chunk == nullptr)
+		{
+			ioCondition.wait(lock);
+			continue;
+		}
+
+		chunk->index = index;
+		chunk->state = ChunkState::Loading;
+
+		UINT64 offset = index * chunkSize;
+		UINT32 wanted = size - offset < chunkSize ? static_cast<UINT32>(size - offset) : chunkSize;
+		UINT32 read = 0;
+
+		lock.unlock();
+		HRESULT hr = reader->ReadAt(offset, chunk->data, wanted, read);
+		lock.lock();
+
+		chunk->state = SUCCEEDED(hr) ? ChunkState::Ready : ChunkState::Failed;
+		chunk->bytes = read;
+		chunk->result = hr;
+
+		statistics.fetches++;
+		statistics.bytesFetched += read;
+
+		readyCondition.notify_all();
+	}
+
+	readyCondition.notify_all();
+}
+
+HRESULT AudioPlay::ReadAheadStream::Read(_Out_writes_bytes_to_(byteCount, bytesRead) BYTE* destination, _In_ UINT32 byteCount, _Out_ UINT32& bytesRead)
+{
+	HRESULT hr = S_OK;
+
+	bytesRead = 0;
+
+#ifdef AUDIOPLAY_REALTIME_CHECKS
+	// Under a Media Foundation decoder this is reached from SourceReaderPcmSource::Read
+	RealtimeThread::ReportLock();
+#endif
+
+	std::unique_lock<std::mutex> lock(mutex);
+
+	while (bytesRead < byteCount && position < size)
+	{
+		UINT64 index = position / chunkSize;
+		Chunk* chunk = Find(index);
+
+		statistics.chunkReads++;
+
+		if (chunk && (chunk->state == ChunkState::Ready || chunk->state == ChunkState::Failed))
+		{
+			statistics.hits++;
+		}
+		else
+		{
+			statistics.stalls++;
+			steady_clock::time_point start = steady_clock::now();
+
+			ioCondition.notify_one();
+			readyCondition.wait(lock, [&]
+			{
+				chunk = Find(index);
+				return stopping || (chunk && (chunk->state == ChunkState::Ready || chunk->state == ChunkState::Failed));
+			});
+
+			statistics.stallNanoseconds += duration_cast<nanoseconds>(steady_clock::now() - start).count();
+
+			if (stopping)
+			{
+				return E_ABORT;
+			}
+		}
+
+		if (chunk->state == ChunkState::Failed)
+		{
+			// Tried again on the next read
+			hr = chunk->result;
+			chunk->state = ChunkState::Empty;
+			break;
+		}
+
+		UINT32 offset = static_cast<UINT32>(position - index * chunkSize);
+
+		if (offset >= chunk->bytes)
+		{
+			// The file got shorter than it was when it was opened
+			break;
+		}
+
+		UINT32 count = chunk->bytes - offset;
+		count = count < byteCount - bytesRead ? count : byteCount - bytesRead;
+
+		memcpy(destination + bytesRead, chunk->data + offset, count);
+
+		bytesRead += count;
+		position += count;
+
+		if (position / chunkSize != index)
+		{
+			// The window moved, there is room for one more chunk
+			ioCondition.notify_one();
+		}
+	}
+
+	statistics.bytesRead += bytesRead;
+
+	return hr;
+}
+
+HRESULT AudioPlay::ReadAheadStream::Seek(_In_ UINT64 newPosition)
+{
+	if (newPosition > size)
+	{
+		return E_INVALIDARG;
+	}
+
+	std::lock_guard<std::mutex> lock(mutex);
+
+	if (newPosition / chunkSize != position / chunkSize)
+	{
+		statistics.seeks++;
+		ioCondition.notify_one();
+	}
+
+	position = newPosition;
+
+	return S_OK;
+}
+
+UINT64 AudioPlay::ReadAheadStream::GetPosition()
+{
+	std::lock_guard<std::mutex> lock(mutex);
+
+	return position;
+}
+
+AudioPlay::ReadAheadStatistics AudioPlay::ReadAheadStream::GetStatistics()
+{
+	std::lock_guard<std::mutex> lock(mutex);
+
+	return statistics;
+}
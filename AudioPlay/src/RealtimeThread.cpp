@@ -0,0 +1,367 @@
+#include "RealtimeThread.h"
+
+#include <new>
+#include <system_error>
+
+#ifdef _WIN32
+#include <avrt.h>
+
+#pragma comment (lib, "Avrt.lib")
+
+#ifndef CREATE_WAITABLE_TIMER_HIGH_RESOLUTION
+#define CREATE_WAITABLE_TIMER_HIGH_RESOLUTION 0x00000002
+#endif
+#else
+#include <cerrno>
+#include <pthread.h>
+#include <sched.h>
+#include <time.h>
+#endif
+
+#if defined(AUDIOPLAY_REALTIME_CHECKS) && defined(_MSC_VER)
+#include <crtdbg.h>
+#endif
+
+
+#define HR_FAIL_ACTION(hresult, action) if (FAILED(hresult)) { action; return hresult; }
+#define HR_FAIL(hresult) if (FAILED(hresult)) { return hresult; }
+
+
+using std::chrono::duration_cast;
+
+
+namespace
+{
+	// Set while a callback runs, plain pointer so reading it can't allocate
+	thread_local AudioPlay::RealtimeThread* currentThread = nullptr;
+
+	// Only the thread writes its counters
+	template<class T>
+	void Add(std::atomic<T>& counter, T value)
+	{
+		counter.store(counter.load(std::memory_order_relaxed) + value, std::memory_order_relaxed);
+	}
+
+	void Max(std::atomic<UINT32>& counter, UINT32 value)
+	{
+		if (value > counter.load(std::memory_order_relaxed))
+		{
+			counter.store(value, std::memory_order_relaxed);
+		}
+	}
+
+	UINT32 Clamp(INT64 value)
+	{
+		return value < 0 ? 0 : value > 0xFFFFFFFF ? 0xFFFFFFFF : static_cast<UINT32>(value);
+	}
+
+#ifndef _WIN32
+	// Below the priorities the kernel uses for its own threads, like JACK and PipeWire
+	constexpr int fifoPriority = 70;
+#endif
+
+#if defined(AUDIOPLAY_REALTIME_CHECKS) && defined(_MSC_VER)
+	_CRT_ALLOC_HOOK previousHook = nullptr;
+	std::once_flag hookInstalled;
+
+	int __cdecl AllocationHook(int allocationType, void* userData, size_t size, int blockType, long request, const unsigned char* fileName, int line)
+	{
+		if (allocationType != _HOOK_FREE)
+		{
+			AudioPlay::RealtimeThread::ReportAllocation();
+		}
+
+		return previousHook ? previousHook(allocationType, userData, size, blockType, request, fileName, line) : TRUE;
+	}
+#endif
+}
+
+
+AudioPlay::RealtimeThread::RealtimeThread() :
+	referenceCount(1), settings{ }, callback(nullptr), context(nullptr), stopping(false), started(false),
+	callbacks(0), overruns(0), totalWakeLatency(0), maxWakeLatency(0), maxCallback(0), wakeLatencyHistogram{ },
+	allocations(0), locks(0), elevated(false), pinned(false)
+{
+}
+
+AudioPlay::RealtimeThread::~RealtimeThread()
+{
+	Stop();
+}
+
+HRESULT AudioPlay::RealtimeThread::Create(_In_ const RealtimeThreadSettings& settings, _In_ RealtimeCallback callback, _In_opt_ void* context,
+	_COM_Outptr_ RealtimeThread** pPtrThread)
+{
+	if (pPtrThread == nullptr || callback == nullptr)
+	{
+		return E_POINTER;
+	}
+	*pPtrThread = nullptr;
+
+	if (settings.period < minPeriod || settings.period > maxPeriod)
+	{
+		return E_INVALIDARG;
+	}
+
+	if (settings.core < -1 || (settings.core >= 0 && static_cast<UINT32>(settings.core) >= std::thread::hardware_concurrency()))
+	{
+		return E_INVALIDARG;
+	}
+
+#if defined(AUDIOPLAY_REALTIME_CHECKS) && defined(_MSC_VER)
+	std::call_once(hookInstalled, []() { previousHook = _CrtSetAllocHook(AllocationHook); });
+#endif
+
+	ComPtr<RealtimeThread> thread;
+	thread.Attach(new (std::nothrow) RealtimeThread());
+
+	if (!thread)
+	{
+		return E_OUTOFMEMORY;
+	}
+
+	thread->settings = settings;
+	thread->callback = callback;
+	thread->context = context;
+
+	try
+	{
+		thread->thread = std::thread(&RealtimeThread::Run, thread.p);
+	}
+	catch (const std::system_error&)
+	{
+		return E_OUTOFMEMORY;
+	}
+
+	// So the statistics say whether the priority and the affinity were set
+	std::unique_lock<std::mutex> lock(thread->mutex);
+	thread->startedCondition.wait(lock, [&thread]() { return thread->started; });
+	lock.unlock();
+
+	*pPtrThread = thread.Detach();
+
+	return S_OK;
+}
+
+ULONG STDMETHODCALLTYPE AudioPlay::RealtimeThread::AddRef()
+{
+	return ++referenceCount;
+}
+
+ULONG STDMETHODCALLTYPE AudioPlay::RealtimeThread::Release()
+{
+	ULONG count = --referenceCount;
+	if (count == 0)
+	{
+		delete this;
+	}
+	return count;
+}
+
+void AudioPlay::RealtimeThread::Run()
+{
+	const INT64 period = duration_cast<microseconds>(settings.period).count();
+
+#ifdef _WIN32
+	HANDLE task = nullptr;
+
+	if (settings.elevatePriority)
+	{
+		DWORD taskIndex = 0;
+		task = AvSetMmThreadCharacteristicsW(L"Pro Audio", &taskIndex);
+
+		if (task != nullptr)
+		{
+			AvSetMmThreadPriority(task, AVRT_PRIORITY_CRITICAL);
+			elevated.store(true, std::memory_order_relaxed);
+		}
+	}
+
+	if (settings.core >= 0)
+	{
+		pinned.store(SetThreadAffinityMask(GetCurrentThread(), static_cast<DWORD_PTR>(1) << settings.core) != 0, std::memory_order_relaxed);
+	}
+
+	// The default timer resolution of 15.6 ms is longer than most periods, high resolution timers are there from Windows 10 1803
+	HANDLE timer = CreateWaitableTimerExW(nullptr, nullptr, CREATE_WAITABLE_TIMER_HIGH_RESOLUTION, TIMER_ALL_ACCESS);
+
+	if (timer == nullptr)
+	{
+		timer = CreateWaitableTimerExW(nullptr, nullptr, 0, TIMER_ALL_ACCESS);
+	}
+#else
+	if (settings.elevatePriority)
+	{
+		// Needs CAP_SYS_NICE or an RLIMIT_RTPRIO, without them the thread stays SCHED_OTHER
+		int maxPriority = sched_get_priority_max(SCHED_FIFO);
+		int minPriority = sched_get_priority_min(SCHED_FIFO);
+
+		sched_param parameters = { };
+		parameters.sched_priority = fifoPriority > maxPriority ? maxPriority : fifoPriority < minPriority ? minPriority : fifoPriority;
+
+		elevated.store(pthread_setschedparam(pthread_self(), SCHED_FIFO, &parameters) == 0, std::memory_order_relaxed);
+	}
+
+#ifdef __linux__
+	if (settings.core >= 0)
+	{
+		cpu_set_t set;
+		CPU_ZERO(&set);
+		CPU_SET(settings.core, &set);
+
+		pinned.store(pthread_setaffinity_np(pthread_self(), sizeof(set), &set) == 0, std::memory_order_relaxed);
+	}
+#endif
+#endif
+
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		started = true;
+	}
+	startedCondition.notify_all();
+
+	steady_clock::time_point deadline = steady_clock::now() + settings.period;
+
+	while (!stopping.load(std::memory_order_acquire))
+	{
+#ifdef _WIN32
+		INT64 wait = duration_cast<std::chrono::nanoseconds>(deadline - steady_clock::now()).count() / 100;
+
+		if (wait > 0)
+		{
+			LARGE_INTEGER dueTime;
+			dueTime.QuadPart = -wait;
+
+			if (timer != nullptr && SetWaitableTimer(timer, &dueTime, 0, nullptr, nullptr, FALSE))
+			{
+				WaitForSingleObject(timer, INFINITE);
+			}
+			else
+			{
+				Sleep(static_cast<DWORD>((wait + 9999) / 10000));
+			}
+		}
+#else
+		// steady_clock is CLOCK_MONOTONIC, an absolute deadline doesn't drift by the time spent in the callback
+		auto sinceEpoch = duration_cast<std::chrono::nanoseconds>(deadline.time_since_epoch()).count();
+
+		timespec wake = { };
+		wake.tv_sec = static_cast<time_t>(sinceEpoch / 1000000000);
+		wake.tv_nsec = static_cast<long>(sinceEpoch % 1000000000);
+
+		while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &wake, nullptr) == EINTR)
+		{
+		}
+#endif
+
+		if (stopping.load(std::memory_order_acquire))
+		{
+			break;
+		}
+
+		steady_clock::time_point woke = steady_clock::now();
+
+		currentThread = this;
+		callback(context);
+		currentThread = nullptr;
+
+		steady_clock::time_point finished = steady_clock::now();
+
+		UINT32 latency = Clamp(duration_cast<microseconds>(woke - deadline).count());
+		UINT32 duration = Clamp(duration_cast<microseconds>(finished - woke).count());
+
+		Add<UINT64>(callbacks, 1);
+		Add<UINT64>(totalWakeLatency, latency);
+		Max(maxWakeLatency, latency);
+		Max(maxCallback, duration);
+
+		UINT32 bucket = 0;
+		for (UINT32 micro = latency; micro > 1 && bucket < 15; micro >>= 1)
+		{
+			bucket++;
+		}
+		Add<UINT64>(wakeLatencyHistogram[bucket], 1);
+
+		deadline += settings.period;
+
+		// Running late, the periods that were missed are dropped instead of run back to back
+		if (finished >= deadline)
+		{
+			Add<UINT64>(overruns, 1);
+
+			INT64 missed = duration_cast<microseconds>(finished - deadline).count() / period + 1;
+			deadline += settings.period * missed;
+		}
+	}
+
+#ifdef _WIN32
+	if (timer != nullptr)
+	{
+		CloseHandle(timer);
+	}
+
+	if (task != nullptr)
+	{
+		AvRevertMmThreadCharacteristics(task);
+	}
+#endif
+}
+
+void AudioPlay::RealtimeThread::Stop()
+{
+	stopping.store(true, std::memory_order_release);
+
+	// Wakes up at the end of the period at the latest
+	if (thread.joinable())
+	{
+		thread.join();
+	}
+}
+
+AudioPlay::RealtimeThreadStatistics AudioPlay::RealtimeThread::GetStatistics() const
+{
+	RealtimeThreadStatistics statistics = { };
+
+	statistics.callbacks = callbacks.load(std::memory_order_relaxed);
+	statistics.overruns = overruns.load(std::memory_order_relaxed);
+	statistics.totalWakeLatencyMicroseconds = totalWakeLatency.load(std::memory_order_relaxed);
+	statistics.maxWakeLatencyMicroseconds = maxWakeLatency.load(std::memory_order_relaxed);
+	statistics.maxCallbackMicroseconds = maxCallback.load(std::memory_order_relaxed);
+
+	for (UINT32 bucket = 0; bucket < 16; bucket++)
+	{
+		statistics.wakeLatencyHistogram[bucket] = wakeLatencyHistogram[bucket].load(std::memory_order_relaxed);
+	}
+
+	statistics.allocations = allocations.load(std::memory_order_relaxed);
+	statistics.locks = locks.load(std::memory_order_relaxed);
+	statistics.elevated = elevated.load(std::memory_order_relaxed);
+	statistics.pinned = pinned.load(std::memory_order_relaxed);
+
+	return statistics;
+}
+
+bool AudioPlay::RealtimeThread::IsRealtime()
+{
+	return currentThread != nullptr;
+}
+
+void AudioPlay::RealtimeThread::ReportAllocation()
+{
+	RealtimeThread* thread = currentThread;
+
+	if (thread != nullptr)
+	{
+		Add<UINT64>(thread->allocations, 1);
+	}
+}
+
+void AudioPlay::RealtimeThread::ReportLock()
+{
+	RealtimeThread* thread = currentThread;
+
+	if (thread != nullptr)
+	{
+		Add<UINT64>(thread->locks, 1);
+	}
+}
@@ -0,0 +1,323 @@
+#include "RenderTelemetry.h"
+
+#include <cstdint>
+#include <cstring>
+#include <new>
+
+
+#define HR_FAIL_ACTION(hresult, action) if (FAILED(hresult)) { action; return hresult; }
+#define HR_FAIL(hresult) if (FAILED(hresult)) { return hresult; }
+
+
+using std::chrono::duration_cast;
+
+
+namespace
+{
+	// One writer, a plain load and store is enough and cheaper than an interlocked add
+	template<class T>
+	void Add(std::atomic<T>& counter, T value)
+	{
+		counter.store(counter.load(std::memory_order_relaxed) + value, std::memory_order_relaxed);
+	}
+
+	void Max(std::atomic<UINT32>& counter, UINT32 value)
+	{
+		if (value > counter.load(std::memory_order_relaxed))
+		{
+			counter.store(value, std::memory_order_relaxed);
+		}
+	}
+
+	UINT32 Clamp(INT64 value)
+	{
+		return value < 0 ? 0 : value > 0xFFFFFFFF ? 0xFFFFFFFF : static_cast<UINT32>(value);
+	}
+
+	INT32 ToMicroseconds(INT64 nanoseconds)
+	{
+		INT64 micro = nanoseconds / 1000;
+		return micro < INT32_MIN ? INT32_MIN : micro > INT32_MAX ? INT32_MAX : static_cast<INT32>(micro);
+	}
+}
+
+
+AudioPlay::RenderTelemetry::RenderTelemetry() :
+	referenceCount(1), ring(nullptr), capacity(0), sequence(0), epoch(steady_clock::now()),
+	buffers(0), frames(0), lateBuffers(0), underruns(0), underrunNanoseconds(0),
+	decodeNanoseconds(0), processNanoseconds(0), deliverNanoseconds(0),
+	maxDecodeNanoseconds(0), maxProcessNanoseconds(0), maxDeliverNanoseconds(0), minLeadMicroseconds(INT32_MAX),
+	deliverHistogram{ }, lastEvent(0), logBuffers(false), lateThreshold(10000000),
+	playing(false), playedFrames(0), carriedLead(0), pendingProcess(0)
+{
+}
+
+AudioPlay::RenderTelemetry::~RenderTelemetry()
+{
+	delete[] ring;
+}
+
+HRESULT AudioPlay::RenderTelemetry::Create(_In_ UINT32 capacity, _COM_Outptr_ RenderTelemetry** pPtrTelemetry)
+{
+	if (pPtrTelemetry == nullptr)
+	{
+		return E_INVALIDARG;
+	}
+	*pPtrTelemetry = nullptr;
+
+	if (capacity == 0 || (capacity & (capacity - 1)) != 0)
+	{
+		return E_INVALIDARG;
+	}
+
+	RenderTelemetry* telemetry = new (std::nothrow) RenderTelemetry();
+
+	if (telemetry == nullptr)
+	{
+		return E_OUTOFMEMORY;
+	}
+
+	telemetry->ring = new (std::nothrow) Slot[capacity]();
+
+	if (telemetry->ring == nullptr)
+	{
+		telemetry->Release();
+		return E_OUTOFMEMORY;
+	}
+
+	telemetry->capacity = capacity;
+
+	*pPtrTelemetry = telemetry;
+
+	return S_OK;
+}
+
+ULONG STDMETHODCALLTYPE AudioPlay::RenderTelemetry::AddRef()
+{
+	return ++referenceCount;
+}
+
+ULONG STDMETHODCALLTYPE AudioPlay::RenderTelemetry::Release()
+{
+	ULONG count = --referenceCount;
+	if (count == 0)
+	{
+		delete this;
+	}
+	return count;
+}
+
+INT64 AudioPlay::RenderTelemetry::Now() const
+{
+	return duration_cast<nanoseconds>(steady_clock::now() - epoch).count();
+}
+
+void AudioPlay::RenderTelemetry::Log(_In_ RenderEventType type, _In_ INT64 timestamp, _In_ UINT64 streamFrame, _In_ UINT32 frameCount,
+	_In_ UINT32 decode, _In_ UINT32 process, _In_ UINT32 deliver, _In_ INT32 lead)
+{
+	RenderEvent renderEvent = { ++sequence, timestamp, streamFrame, type, frameCount, decode, process, deliver, lead };
+
+	UINT64 words[eventWords];
+	memcpy(words, &renderEvent, sizeof(words));
+
+	Slot& slot = ring[renderEvent.sequence & (capacity - 1)];
+
+	slot.sequence.store(0, std::memory_order_relaxed);
+	std::atomic_thread_fence(std::memory_order_release);
+
+	for (UINT32 index = 0; index < eventWords; index++)
+	{
+		slot.words[index].store(words[index], std::memory_order_relaxed);
+	}
+
+	slot.sequence.store(renderEvent.sequence, std::memory_order_release);
+	lastEvent.store(renderEvent.sequence, std::memory_order_release);
+}
+
+void AudioPlay::RenderTelemetry::OnStarted(_In_ UINT64 frame, _In_ bool flushed)
+{
+	if (flushed)
+	{
+		carriedLead = 0;
+	}
+
+	// The renderer starts pulling when it is ready, the clock starts with the first buffer
+	playing = false;
+	pendingProcess = 0;
+
+	Log(RenderEventType::Started, Now(), frame, 0, 0, 0, 0, 0);
+}
+
+void AudioPlay::RenderTelemetry::OnPaused(_In_ UINT64 frame, _In_ UINT32 sampleRate)
+{
+	steady_clock::time_point wallNow = steady_clock::now();
+
+	// What the renderer still holds is played first after the pause
+	if (playing && sampleRate)
+	{
+		INT64 queued = static_cast<INT64>(playedFrames * 1000000000ull / sampleRate);
+		INT64 lead = queued - duration_cast<nanoseconds>(wallNow - playStart).count();
+
+		carriedLead = lead > 0 ? lead : 0;
+	}
+
+	playing = false;
+
+	Log(RenderEventType::Paused, duration_cast<nanoseconds>(wallNow - epoch).count(), frame, 0, 0, 0, 0, 0);
+}
+
+void AudioPlay::RenderTelemetry::OnStopped(_In_ UINT64 frame)
+{
+	playing = false;
+	carriedLead = 0;
+
+	Log(RenderEventType::Stopped, Now(), frame, 0, 0, 0, 0, 0);
+}
+
+void AudioPlay::RenderTelemetry::OnBuffer(_In_ UINT64 frame, _In_ UINT32 frameCount, _In_ UINT32 sampleRate, _In_ nanoseconds read, _In_ nanoseconds deliver)
+{
+	steady_clock::time_point wallNow = steady_clock::now();
+	INT64 now = duration_cast<nanoseconds>(wallNow - epoch).count();
+
+	if (!playing)
+	{
+		playing = true;
+		// Carried lead is audio from before the pause, as if those frames were delivered right at the start
+		playStart = wallNow;
+		playedFrames = sampleRate ? static_cast<UINT64>(carriedLead) * sampleRate / 1000000000ull : 0;
+		carriedLead = 0;
+	}
+
+	INT64 queued = sampleRate ? static_cast<INT64>(playedFrames * 1000000000ull / sampleRate) : 0;
+	INT64 lead = queued - duration_cast<nanoseconds>(wallNow - playStart).count();
+
+	UINT32 process = Clamp(static_cast<INT64>(pendingProcess));
+	UINT32 decode = Clamp(read.count() - static_cast<INT64>(pendingProcess));
+	UINT32 total = Clamp(deliver.count());
+	INT32 leadMicroseconds = ToMicroseconds(lead);
+
+	pendingProcess = 0;
+	playedFrames += frameCount;
+
+	Add<UINT64>(buffers, 1);
+	Add<UINT64>(frames, frameCount);
+	Add<UINT64>(decodeNanoseconds, decode);
+	Add<UINT64>(processNanoseconds, process);
+	Add<UINT64>(deliverNanoseconds, total);
+	Max(maxDecodeNanoseconds, decode);
+	Max(maxProcessNanoseconds, process);
+	Max(maxDeliverNanoseconds, total);
+
+	// The first buffer after a start only sets the clock
+	if (queued && leadMicroseconds < minLeadMicroseconds.load(std::memory_order_relaxed))
+	{
+		minLeadMicroseconds.store(leadMicroseconds, std::memory_order_relaxed);
+	}
+
+	UINT32 bucket = 0;
+	for (UINT64 micro = total / 1000; micro > 1 && bucket < 15; micro >>= 1)
+	{
+		bucket++;
+	}
+	Add<UINT64>(deliverHistogram[bucket], 1);
+
+	RenderEventType type = RenderEventType::Buffer;
+
+	if (queued && lead < 0)
+	{
+		type = RenderEventType::Underrun;
+
+		Add<UINT64>(underruns, 1);
+		Add<UINT64>(underrunNanoseconds, static_cast<UINT64>(-lead));
+
+		// The renderer played silence meanwhile and is that much behind now
+		playStart += nanoseconds{ -lead };
+	}
+	else if (queued && lead < lateThreshold.load(std::memory_order_relaxed))
+	{
+		type = RenderEventType::Late;
+
+		Add<UINT64>(lateBuffers, 1);
+	}
+
+	if (type != RenderEventType::Buffer || logBuffers.load(std::memory_order_relaxed))
+	{
+		Log(type, now, frame, frameCount, decode, process, total, leadMicroseconds);
+	}
+}
+
+void AudioPlay::RenderTelemetry::OnEndOfStream(_In_ UINT64 frame)
+{
+	Log(RenderEventType::EndOfStream, Now(), frame, 0, 0, 0, 0, 0);
+}
+
+void AudioPlay::RenderTelemetry::GetCounters(_Out_ RenderCounters& counters) const
+{
+	counters.buffers = buffers.load(std::memory_order_relaxed);
+	counters.frames = frames.load(std::memory_order_relaxed);
+	counters.lateBuffers = lateBuffers.load(std::memory_order_relaxed);
+	counters.underruns = underruns.load(std::memory_order_relaxed);
+	counters.underrunNanoseconds = underrunNanoseconds.load(std::memory_order_relaxed);
+	counters.decodeNanoseconds = decodeNanoseconds.load(std::memory_order_relaxed);
+	counters.processNanoseconds = processNanoseconds.load(std::memory_order_relaxed);
+	counters.deliverNanoseconds = deliverNanoseconds.load(std::memory_order_relaxed);
+	counters.maxDecodeNanoseconds = maxDecodeNanoseconds.load(std::memory_order_relaxed);
+	counters.maxProcessNanoseconds = maxProcessNanoseconds.load(std::memory_order_relaxed);
+	counters.maxDeliverNanoseconds = maxDeliverNanoseconds.load(std::memory_order_relaxed);
+	counters.minLeadMicroseconds = minLeadMicroseconds.load(std::memory_order_relaxed);
+
+	for (UINT32 bucket = 0; bucket < 16; bucket++)
+	{
+		counters.deliverHistogram[bucket] = deliverHistogram[bucket].load(std::memory_order_relaxed);
+	}
+
+	counters.lastEvent = lastEvent.load(std::memory_order_acquire);
+}
+
+UINT32 AudioPlay::RenderTelemetry::ReadEvents(_In_ UINT64 afterSequence, _Out_writes_to_(count, return) RenderEvent* events, _In_ UINT32 count) const
+{
+	if (events == nullptr || count == 0)
+	{
+		return 0;
+	}
+
+	UINT64 last = lastEvent.load(std::memory_order_acquire);
+	UINT64 first = afterSequence + 1;
+
+	// Only the newest capacity events are still in the ring, and only count of them fit
+	if (last >= capacity && first < last - capacity + 1)
+	{
+		first = last - capacity + 1;
+	}
+	if (last >= count && first < last - count + 1)
+	{
+		first = last - count + 1;
+	}
+
+	UINT32 copied = 0;
+
+	for (UINT64 wanted = first; wanted <= last; wanted++)
+	{
+		const Slot& slot = ring[wanted & (capacity - 1)];
+
+		UINT64 before = slot.sequence.load(std::memory_order_acquire);
+		UINT64 words[eventWords];
+
+		for (UINT32 index = 0; index < eventWords; index++)
+		{
+			words[index] = slot.words[index].load(std::memory_order_relaxed);
+		}
+
+		std::atomic_thread_fence(std::memory_order_acquire);
+
+		// Overwritten or being written while it was copied
+		if (before != wanted || slot.sequence.load(std::memory_order_relaxed) != wanted)
+		{
+			continue;
+		}
+
+		memcpy(&events[copied++], words, sizeof(words));
+	}
+
+	return copied;
+}
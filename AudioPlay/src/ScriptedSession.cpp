@@ -0,0 +1,264 @@
+#include "ScriptedSession.h"
+
+#include <algorithm>
+
+
+#define HR_FAIL_ACTION(hresult, action) if (FAILED(hresult)) { action; return hresult; }
+#define HR_FAIL(hresult) if (FAILED(hresult)) { return hresult; }
+
+
+using std::chrono::duration_cast;
+
+
+using namespace std::chrono_literals;
+
+
+namespace
+{
+	template<class Event>
+	bool LaterThan(const Event& lhs, const Event& rhs)
+	{
+		if (lhs.time != rhs.time)
+		{
+			return lhs.time > rhs.time;
+		}
+		return lhs.sequence > rhs.sequence;
+	}
+}
+
+AudioPlay::ScriptedSession::ScriptedSession(_In_ VirtualClock& p_clock) :
+	clock(p_clock), target(nullptr), nextSequence(0), hasClock(false), running(false),
+	commandResult(S_OK), answerCommands(true), commandCount(0), dispatchedCount(0)
+{
+}
+
+void AudioPlay::ScriptedSession::FailNext(_In_ MediaEventType type, _In_ HRESULT status)
+{
+	failures.push_back({ type, status });
+}
+
+HRESULT AudioPlay::ScriptedSession::TakeFailure(_In_ MediaEventType type)
+{
+	for (auto failure = failures.begin(); failure != failures.end(); ++failure)
+	{
+		if (failure->type == type)
+		{
+			HRESULT status = failure->status;
+			failures.erase(failure);
+			return status;
+		}
+	}
+
+	return S_OK;
+}
+
+HRESULT AudioPlay::ScriptedSession::Schedule(_In_ MediaEventType type, _In_ nanoseconds delay, _In_ milliseconds position)
+{
+	HR_FAIL(commandResult);
+
+	commandCount++;
+
+	if (!answerCommands)
+	{
+		return S_OK;
+	}
+
+	events.push_back({ clock.Now() + delay, nextSequence++, type, TakeFailure(type), position });
+	std::push_heap(events.begin(), events.end(), LaterThan<ScriptedEvent>);
+
+	return S_OK;
+}
+
+void AudioPlay::ScriptedSession::Open()
+{
+	Post(MESessionTopologySet, commandLatency, TakeFailure(MESessionTopologySet));
+	Post(MESessionCapabilitiesChanged, commandLatency, TakeFailure(MESessionCapabilitiesChanged));
+}
+
+void AudioPlay::ScriptedSession::Post(_In_ MediaEventType type, _In_ nanoseconds delay, _In_ HRESULT status)
+{
+	events.push_back({ clock.Now() + delay, nextSequence++, type, status, -1ms });
+	std::push_heap(events.begin(), events.end(), LaterThan<ScriptedEvent>);
+}
+
+HRESULT AudioPlay::ScriptedSession::Start(_In_opt_ const milliseconds* position)
+{
+	return Schedule(MESessionStarted, commandLatency, position ? *position : -1ms);
+}
+
+HRESULT AudioPlay::ScriptedSession::Pause()
+{
+	return Schedule(MESessionPaused, commandLatency, -1ms);
+}
+
+HRESULT AudioPlay::ScriptedSession::Stop()
+{
+	return Schedule(MESessionStopped, commandLatency, -1ms);
+}
+
+HRESULT AudioPlay::ScriptedSession::Close()
+{
+	return Schedule(MESessionClosed, commandLatency, -1ms);
+}
+
+HRESULT AudioPlay::ScriptedSession::GetTime(_Out_ milliseconds& time)
+{
+	if (!hasClock)
+	{
+		time = -1ms;
+		return E_UNEXPECTED;
+	}
+
+	time = presentationBase;
+
+	if (running)
+	{
+		time += duration_cast<milliseconds>(clock.Now() - runningSince);
+	}
+
+	if (duration > 0ms && time > duration)
+	{
+		time = duration;
+	}
+
+	return S_OK;
+}
+
+bool AudioPlay::ScriptedSession::PopDue(_In_ nanoseconds until, _Out_ ScriptedEvent& scriptedEvent)
+{
+	bool hasEvent = !events.empty() && events.front().time <= until;
+
+	if (running && duration > 0ms)
+	{
+		// The presentation clock reaching the duration doesn't go through the queue so pausing or seeking moves it
+		nanoseconds endTime = runningSince + (duration > presentationBase ? duration - presentationBase : 0ms);
+
+		if (endTime <= until && (!hasEvent || endTime < events.front().time))
+		{
+			scriptedEvent = { endTime, 0, MESessionEnded, S_OK, -1ms };
+			return true;
+		}
+	}
+
+	if (!hasEvent)
+	{
+		return false;
+	}
+
+	std::pop_heap(events.begin(), events.end(), LaterThan<ScriptedEvent>);
+	scriptedEvent = events.back();
+	events.pop_back();
+
+	return true;
+}
+
+void AudioPlay::ScriptedSession::Apply(_In_ const ScriptedEvent& scriptedEvent)
+{
+	if (FAILED(scriptedEvent.status))
+	{
+		return;
+	}
+
+	milliseconds time = 0ms;
+
+	switch (scriptedEvent.type)
+	{
+		case MESessionTopologySet:
+		{
+			hasClock = true;
+			running = false;
+			presentationBase = 0ms;
+			break;
+		}
+		case MESessionStarted:
+		{
+			if (scriptedEvent.position >= 0ms)
+			{
+				presentationBase = scriptedEvent.position;
+			}
+			else if (SUCCEEDED(GetTime(time)))
+			{
+				presentationBase = time;
+			}
+			running = true;
+			runningSince = scriptedEvent.time;
+			break;
+		}
+		case MESessionPaused:
+		{
+			if (SUCCEEDED(GetTime(time)))
+			{
+				presentationBase = time;
+			}
+			running = false;
+			break;
+		}
+		case MESessionStopped:
+		{
+			presentationBase = 0ms;
+			running = false;
+			break;
+		}
+		case MESessionEnded:
+		{
+			presentationBase = duration;
+			running = false;
+			break;
+		}
+		case MESessionClosed:
+		{
+			hasClock = false;
+			running = false;
+			break;
+		}
+	}
+}
+
+void AudioPlay::ScriptedSession::Dispatch(_In_ const ScriptedEvent& scriptedEvent)
+{
+	clock.AdvanceTo(scriptedEvent.time);
+
+	Apply(scriptedEvent);
+
+	if (target)
+	{
+		target->HandleEvent(scriptedEvent.type, scriptedEvent.status);
+	}
+}
+
+UINT64 AudioPlay::ScriptedSession::RunFor(_In_ nanoseconds runDuration)
+{
+	nanoseconds until = clock.Now() + runDuration;
+	UINT64 dispatched = 0;
+
+	ScriptedEvent scriptedEvent;
+
+	while (PopDue(until, scriptedEvent))
+	{
+		Dispatch(scriptedEvent);
+		dispatched++;
+	}
+
+	clock.AdvanceTo(until);
+
+	dispatchedCount += dispatched;
+
+	return dispatched;
+}
+
+UINT64 AudioPlay::ScriptedSession::RunUntilIdle(_In_ UINT64 maxEvents)
+{
+	UINT64 dispatched = 0;
+
+	ScriptedEvent scriptedEvent;
+
+	while (dispatched < maxEvents && PopDue(nanoseconds::max(), scriptedEvent))
+	{
+		Dispatch(scriptedEvent);
+		dispatched++;
+	}
+
+	dispatchedCount += dispatched;
+
+	return dispatched;
+}
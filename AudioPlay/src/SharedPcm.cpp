@@ -0,0 +1,831 @@
+#include "SharedPcm.h"
+#include "PosixUtil.h"
+
+#include <climits>
+#include <cstring>
+#include <cwchar>
+#include <new>
+
+#ifndef _WIN32
+#include <cerrno>
+#include <cstdlib>
+#include <fcntl.h>
+#include <signal.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+#ifdef __linux__
+#include <linux/futex.h>
+#include <sys/syscall.h>
+#endif
+#endif
+
+
+#define HR_FAIL_ACTION(hresult, action) if (FAILED(hresult)) { action; return hresult; }
+#define HR_FAIL(hresult) if (FAILED(hresult)) { return hresult; }
+
+
+namespace
+{
+	constexpr size_t maxNameLength = 200;
+
+	bool IsValidName(_In_z_ LPCWCH name)
+	{
+		size_t length = wcslen(name);
+
+		return length != 0 && length <= maxNameLength && wcspbrk(name, L"/\\") == nullptr;
+	}
+
+	UINT64 MappedSize(_In_ UINT32 capacityFrames, _In_ UINT32 maxChannels)
+	{
+		return sizeof(AudioPlay::SharedPcmHeader) + static_cast<UINT64>(capacityFrames) * maxChannels * sizeof(float);
+	}
+
+	#ifdef _WIN32
+	constexpr size_t maxObjectName = maxNameLength + 32;
+
+	void ObjectNames(_In_z_ LPCWCH name, _Out_writes_(maxObjectName) WCHAR* mappingName, _Out_writes_(maxObjectName) WCHAR* semaphoreName)
+	{
+		swprintf_s(mappingName, maxObjectName, L"Local\\AudioPlay.%s", name);
+		swprintf_s(semaphoreName, maxObjectName, L"Local\\AudioPlay.%s.Wake", name);
+	}
+	#else
+	constexpr size_t maxObjectName = maxNameLength * MB_LEN_MAX + 16;
+
+	HRESULT ObjectName(_In_z_ LPCWCH name, _Out_writes_(maxObjectName) char* objectName)
+	{
+		strcpy(objectName, "/AudioPlay.");
+
+		size_t prefix = strlen(objectName);
+
+		if (wcstombs(objectName + prefix, name, maxObjectName - prefix) == static_cast<size_t>(-1))
+		{
+			return E_INVALIDARG;
+		}
+
+		objectName[maxObjectName - 1] = '\0';
+
+		return S_OK;
+	}
+
+	// True if the process that created a segment is gone, its segment can be replaced
+	bool IsStale(_In_z_ const char* objectName)
+	{
+		int descriptor = shm_open(objectName, O_RDONLY, 0);
+
+		if (descriptor == -1)
+		{
+			return errno == ENOENT;
+		}
+
+		bool stale = false;
+		struct stat status;
+
+		if (fstat(descriptor, &status) == 0 && status.st_size >= static_cast<off_t>(sizeof(AudioPlay::SharedPcmHeader)))
+		{
+			void* view = mmap(nullptr, sizeof(AudioPlay::SharedPcmHeader), PROT_READ, MAP_SHARED, descriptor, 0);
+
+			if (view != MAP_FAILED)
+			{
+				const AudioPlay::SharedPcmHeader* header = static_cast<const AudioPlay::SharedPcmHeader*>(view);
+				pid_t writer = static_cast<pid_t>(header->writerProcess);
+
+				// A writer that is still setting the header up has no process id yet
+				stale = writer != 0 && kill(writer, 0) != 0 && errno == ESRCH;
+
+				munmap(view, sizeof(AudioPlay::SharedPcmHeader));
+			}
+		}
+
+		close(descriptor);
+
+		return stale;
+	}
+	#endif
+}
+
+
+AudioPlay::SharedPcmWriter::SharedPcmWriter() :
+	referenceCount(1), header(nullptr), samples(nullptr), mappedSize(0), format{ 0, 0 },
+	#ifdef _WIN32
+	mapping(nullptr), wakeSemaphore(nullptr)
+	#else
+	descriptor(-1), name(nullptr)
+	#endif
+{
+}
+
+AudioPlay::SharedPcmWriter::~SharedPcmWriter()
+{
+	if (header)
+	{
+		header->state.store(SharedPcmState::Closed, std::memory_order_release);
+		Wake();
+	}
+
+	#ifdef _WIN32
+	if (header)
+	{
+		UnmapViewOfFile(header);
+	}
+	if (wakeSemaphore)
+	{
+		CloseHandle(wakeSemaphore);
+	}
+	if (mapping)
+	{
+		CloseHandle(mapping);
+	}
+	#else
+	if (header)
+	{
+		munmap(header, static_cast<size_t>(mappedSize));
+	}
+	if (descriptor != -1)
+	{
+		close(descriptor);
+	}
+	// Readers that have it mapped keep it until they close it
+	if (name)
+	{
+		shm_unlink(name);
+	}
+	delete[] name;
+	#endif
+}
+
+HRESULT AudioPlay::SharedPcmWriter::Create(_In_z_ LPCWCH name, _In_ UINT32 capacityFrames, _In_ UINT32 maxChannels, _COM_Outptr_ SharedPcmWriter** pPtrWriter)
+{
+	if (pPtrWriter == nullptr || name == nullptr)
+	{
+		return E_POINTER;
+	}
+	*pPtrWriter = nullptr;
+
+	if (!IsValidName(name))
+	{
+		return E_INVALIDARG;
+	}
+
+	if (capacityFrames < minCapacityFrames || capacityFrames > maxCapacityFrames || (capacityFrames & (capacityFrames - 1)) != 0)
+	{
+		return E_INVALIDARG;
+	}
+
+	if (maxChannels == 0 || maxChannels > SharedPcmWriter::maxChannels)
+	{
+		return E_INVALIDARG;
+	}
+
+	ComPtr<SharedPcmWriter> writer;
+	writer.Attach(new (std::nothrow) SharedPcmWriter());
+
+	if (!writer)
+	{
+		return E_OUTOFMEMORY;
+	}
+
+	writer->mappedSize = MappedSize(capacityFrames, maxChannels);
+
+	#ifdef _WIN32
+	WCHAR mappingName[maxObjectName];
+	WCHAR semaphoreName[maxObjectName];
+	ObjectNames(name, mappingName, semaphoreName);
+
+	// The mapping goes away with its last handle, an existing one has a live writer or readers of one
+	writer->mapping = CreateFileMappingW(INVALID_HANDLE_VALUE, nullptr, PAGE_READWRITE,
+		static_cast<DWORD>(writer->mappedSize >> 32), static_cast<DWORD>(writer->mappedSize), mappingName);
+
+	if (writer->mapping == nullptr)
+	{
+		return HRESULT_FROM_WIN32(GetLastError());
+	}
+
+	if (GetLastError() == ERROR_ALREADY_EXISTS)
+	{
+		return HRESULT_FROM_WIN32(ERROR_ALREADY_EXISTS);
+	}
+
+	writer->wakeSemaphore = CreateSemaphoreW(nullptr, 0, LONG_MAX, semaphoreName);
+
+	if (writer->wakeSemaphore == nullptr)
+	{
+		return HRESULT_FROM_WIN32(GetLastError());
+	}
+
+	void* view = MapViewOfFile(writer->mapping, FILE_MAP_READ | FILE_MAP_WRITE, 0, 0, 0);
+
+	if (view == nullptr)
+	{
+		return HRESULT_FROM_WIN32(GetLastError());
+	}
+
+	DWORD process = GetCurrentProcessId();
+	#else
+	char objectName[maxObjectName];
+	HR_FAIL(ObjectName(name, objectName));
+
+	writer->descriptor = shm_open(objectName, O_RDWR | O_CREAT | O_EXCL, 0600);
+
+	// Segments outlive a writer that crashed, those are taken over
+	if (writer->descriptor == -1 && errno == EEXIST && IsStale(objectName))
+	{
+		shm_unlink(objectName);
+		writer->descriptor = shm_open(objectName, O_RDWR | O_CREAT | O_EXCL, 0600);
+	}
+
+	if (writer->descriptor == -1)
+	{
+		return HResultFromErrno(errno);
+	}
+
+	// Kept for unlinking, an existing segment that wasn't ours isn't
+	writer->name = new (std::nothrow) char[strlen(objectName) + 1];
+
+	if (writer->name == nullptr)
+	{
+		shm_unlink(objectName);
+		return E_OUTOFMEMORY;
+	}
+
+	strcpy(writer->name, objectName);
+
+	if (ftruncate(writer->descriptor, static_cast<off_t>(writer->mappedSize)) != 0)
+	{
+		return HResultFromErrno(errno);
+	}
+
+	void* view = mmap(nullptr, static_cast<size_t>(writer->mappedSize), PROT_READ | PROT_WRITE, MAP_SHARED, writer->descriptor, 0);
+
+	if (view == MAP_FAILED)
+	{
+		return HResultFromErrno(errno);
+	}
+
+	UINT32 process = static_cast<UINT32>(getpid());
+	#endif
+
+	// New mappings are zeroed, so every counter starts at 0 and the state at Idle
+	writer->header = static_cast<SharedPcmHeader*>(view);
+	writer->samples = reinterpret_cast<float*>(static_cast<BYTE*>(view) + sizeof(SharedPcmHeader));
+
+	SharedPcmHeader* header = writer->header;
+	header->version = version;
+	header->headerSize = sizeof(SharedPcmHeader);
+	header->maxChannels = maxChannels;
+	header->capacityFrames = capacityFrames;
+	header->writerProcess = process;
+
+	// Readers check the magic last
+	std::atomic_thread_fence(std::memory_order_release);
+	header->magic = magic;
+
+	*pPtrWriter = writer.Detach();
+
+	return S_OK;
+}
+
+ULONG STDMETHODCALLTYPE AudioPlay::SharedPcmWriter::AddRef()
+{
+	return ++referenceCount;
+}
+
+ULONG STDMETHODCALLTYPE AudioPlay::SharedPcmWriter::Release()
+{
+	ULONG count = --referenceCount;
+	if (count == 0)
+	{
+		delete this;
+	}
+	return count;
+}
+
+void AudioPlay::SharedPcmWriter::Wake()
+{
+	header->wakeSequence.fetch_add(1, std::memory_order_seq_cst);
+
+	UINT32 waiting = header->waiters.load(std::memory_order_seq_cst);
+
+	if (waiting == 0)
+	{
+		return;
+	}
+
+	#ifdef _WIN32
+	// Extra counts left by readers that timed out only cause a spurious wakeup
+	ReleaseSemaphore(wakeSemaphore, static_cast<LONG>(waiting), nullptr);
+	#elif defined(__linux__)
+	syscall(SYS_futex, reinterpret_cast<UINT32*>(&header->wakeSequence), FUTEX_WAKE, INT_MAX, nullptr, nullptr, 0);
+	#endif
+}
+
+HRESULT AudioPlay::SharedPcmWriter::BeginStream(_In_ const PcmFormat& newFormat)
+{
+	if (newFormat.channels == 0 || newFormat.channels > header->maxChannels || newFormat.sampleRate == 0)
+	{
+		format = { 0, 0 };
+		return E_INVALIDARG;
+	}
+
+	format = newFormat;
+
+	UINT32 sequence = header->formatSequence.load(std::memory_order_relaxed);
+
+	header->formatSequence.store(sequence + 1, std::memory_order_relaxed);
+	std::atomic_thread_fence(std::memory_order_release);
+
+	header->sampleRate.store(format.sampleRate, std::memory_order_relaxed);
+	header->channels.store(format.channels, std::memory_order_relaxed);
+	header->streamStart.store(header->writeFrame.load(std::memory_order_relaxed), std::memory_order_relaxed);
+	header->state.store(SharedPcmState::Streaming, std::memory_order_relaxed);
+
+	header->formatSequence.store(sequence + 2, std::memory_order_release);
+
+	Wake();
+
+	return S_OK;
+}
+
+void AudioPlay::SharedPcmWriter::Write(_In_reads_(frameCount * format.channels) const float* frames, _In_ UINT32 frameCount)
+{
+	if (format.channels == 0 || frameCount == 0)
+	{
+		return;
+	}
+
+	const UINT32 capacity = header->capacityFrames;
+	UINT64 written = header->writeFrame.load(std::memory_order_relaxed);
+
+	// Only the last capacity frames would survive
+	if (frameCount > capacity)
+	{
+		frames += static_cast<size_t>(frameCount - capacity) * format.channels;
+		written += frameCount - capacity;
+		frameCount = capacity;
+	}
+
+	while (frameCount != 0)
+	{
+		UINT32 slot = static_cast<UINT32>(written & (capacity - 1));
+		UINT32 count = capacity - slot < frameCount ? capacity - slot : frameCount;
+
+		header->reserveFrame.store(written + count, std::memory_order_relaxed);
+		std::atomic_thread_fence(std::memory_order_release);
+
+		memcpy(samples + static_cast<size_t>(slot) * format.channels, frames, static_cast<size_t>(count) * format.channels * sizeof(float));
+
+		written += count;
+		header->writeFrame.store(written, std::memory_order_release);
+
+		frames += static_cast<size_t>(count) * format.channels;
+		frameCount -= count;
+	}
+
+	Wake();
+}
+
+void AudioPlay::SharedPcmWriter::EndStream()
+{
+	header->state.store(SharedPcmState::Ended, std::memory_order_release);
+
+	Wake();
+}
+
+AudioPlay::SharedPcmReader::SharedPcmReader() :
+	referenceCount(1), header(nullptr), samples(nullptr), mappedSize(0), capacityFrames(0), position(0), formatSequence(0), streamStartPending(false), observedState(SharedPcmState::Idle), writerExited(false),
+	droppedFrames(0), underruns(0), tornBlocks(0),
+	#ifdef _WIN32
+	mapping(nullptr), wakeSemaphore(nullptr)
+	#else
+	descriptor(-1)
+	#endif
+{
+}
+
+AudioPlay::SharedPcmReader::~SharedPcmReader()
+{
+	#ifdef _WIN32
+	if (header)
+	{
+		UnmapViewOfFile(header);
+	}
+	if (wakeSemaphore)
+	{
+		CloseHandle(wakeSemaphore);
+	}
+	if (mapping)
+	{
+		CloseHandle(mapping);
+	}
+	#else
+	if (header)
+	{
+		munmap(header, static_cast<size_t>(mappedSize));
+	}
+	if (descriptor != -1)
+	{
+		close(descriptor);
+	}
+	#endif
+}
+
+HRESULT AudioPlay::SharedPcmReader::Open(_In_z_ LPCWCH name, _COM_Outptr_ SharedPcmReader** pPtrReader)
+{
+	if (pPtrReader == nullptr || name == nullptr)
+	{
+		return E_POINTER;
+	}
+	*pPtrReader = nullptr;
+
+	if (!IsValidName(name))
+	{
+		return E_INVALIDARG;
+	}
+
+	ComPtr<SharedPcmReader> reader;
+	reader.Attach(new (std::nothrow) SharedPcmReader());
+
+	if (!reader)
+	{
+		return E_OUTOFMEMORY;
+	}
+
+	// Readers write the waiter count, so the mapping is writable
+	#ifdef _WIN32
+	WCHAR mappingName[maxObjectName];
+	WCHAR semaphoreName[maxObjectName];
+	ObjectNames(name, mappingName, semaphoreName);
+
+	reader->mapping = OpenFileMappingW(FILE_MAP_READ | FILE_MAP_WRITE, FALSE, mappingName);
+
+	if (reader->mapping == nullptr)
+	{
+		return HRESULT_FROM_WIN32(GetLastError());
+	}
+
+	reader->wakeSemaphore = OpenSemaphoreW(SYNCHRONIZE, FALSE, semaphoreName);
+
+	if (reader->wakeSemaphore == nullptr)
+	{
+		return HRESULT_FROM_WIN32(GetLastError());
+	}
+
+	void* view = MapViewOfFile(reader->mapping, FILE_MAP_READ | FILE_MAP_WRITE, 0, 0, 0);
+
+	if (view == nullptr)
+	{
+		return HRESULT_FROM_WIN32(GetLastError());
+	}
+
+	reader->header = static_cast<SharedPcmHeader*>(view);
+
+	MEMORY_BASIC_INFORMATION region = { };
+
+	if (VirtualQuery(view, &region, sizeof(region)) == 0)
+	{
+		return HRESULT_FROM_WIN32(GetLastError());
+	}
+
+	reader->mappedSize = region.RegionSize;
+	#else
+	char objectName[maxObjectName];
+	HR_FAIL(ObjectName(name, objectName));
+
+	reader->descriptor = shm_open(objectName, O_RDWR, 0);
+
+	if (reader->descriptor == -1)
+	{
+		return HResultFromErrno(errno);
+	}
+
+	struct stat status;
+	if (fstat(reader->descriptor, &status) != 0)
+	{
+		return HResultFromErrno(errno);
+	}
+
+	// The writer may not have sized it yet
+	if (status.st_size < static_cast<off_t>(sizeof(SharedPcmHeader)))
+	{
+		return HRESULT_FROM_WIN32(ERROR_FILE_NOT_FOUND);
+	}
+
+	reader->mappedSize = static_cast<UINT64>(status.st_size);
+
+	void* view = mmap(nullptr, static_cast<size_t>(reader->mappedSize), PROT_READ | PROT_WRITE, MAP_SHARED, reader->descriptor, 0);
+
+	if (view == MAP_FAILED)
+	{
+		return HResultFromErrno(errno);
+	}
+
+	reader->header = static_cast<SharedPcmHeader*>(view);
+	#endif
+
+	const SharedPcmHeader* header = reader->header;
+
+	if (header->magic != SharedPcmWriter::magic)
+	{
+		return HRESULT_FROM_WIN32(ERROR_FILE_NOT_FOUND);
+	}
+
+	std::atomic_thread_fence(std::memory_order_acquire);
+
+	if (header->version != SharedPcmWriter::version || header->headerSize != sizeof(SharedPcmHeader) ||
+		header->capacityFrames == 0 || (header->capacityFrames & (header->capacityFrames - 1)) != 0 ||
+		header->maxChannels == 0 || header->maxChannels > SharedPcmWriter::maxChannels ||
+		MappedSize(header->capacityFrames, header->maxChannels) > reader->mappedSize)
+	{
+		return HRESULT_FROM_WIN32(ERROR_INVALID_DATA);
+	}
+
+	reader->capacityFrames = header->capacityFrames;
+	reader->samples = reinterpret_cast<const float*>(reinterpret_cast<const BYTE*>(header) + header->headerSize);
+	reader->position = header->writeFrame.load(std::memory_order_acquire);
+	// A format change in progress is picked up by the first Acquire
+	reader->formatSequence = header->formatSequence.load(std::memory_order_acquire) & ~1u;
+	reader->observedState = header->state.load(std::memory_order_acquire);
+
+	*pPtrReader = reader.Detach();
+
+	return S_OK;
+}
+
+ULONG STDMETHODCALLTYPE AudioPlay::SharedPcmReader::AddRef()
+{
+	return ++referenceCount;
+}
+
+ULONG STDMETHODCALLTYPE AudioPlay::SharedPcmReader::Release()
+{
+	ULONG count = --referenceCount;
+	if (count == 0)
+	{
+		delete this;
+	}
+	return count;
+}
+
+HRESULT AudioPlay::SharedPcmReader::Acquire(_Out_ SharedPcmBlock& block)
+{
+	block = { };
+
+	UINT32 sequence = header->formatSequence.load(std::memory_order_acquire);
+
+	if (sequence & 1)
+	{
+		return S_FALSE;
+	}
+
+	PcmFormat format = { header->sampleRate.load(std::memory_order_relaxed), header->channels.load(std::memory_order_relaxed) };
+	UINT64 streamStart = header->streamStart.load(std::memory_order_relaxed);
+
+	std::atomic_thread_fence(std::memory_order_acquire);
+
+	if (header->formatSequence.load(std::memory_order_relaxed) != sequence || format.channels == 0)
+	{
+		return S_FALSE;
+	}
+
+	// A writer that lies about its format can't make the reader go past the mapping
+	if (format.channels > header->maxChannels)
+	{
+		return HRESULT_FROM_WIN32(ERROR_INVALID_DATA);
+	}
+
+	if (sequence != formatSequence)
+	{
+		formatSequence = sequence;
+		streamStartPending = position <= streamStart;
+	}
+
+	if (position < streamStart)
+	{
+		position = streamStart;
+	}
+
+	UINT64 written = header->writeFrame.load(std::memory_order_acquire);
+	UINT64 dropped = 0;
+
+	if (written - position > capacityFrames)
+	{
+		dropped = written - capacityFrames - position;
+		position = written - capacityFrames;
+		droppedFrames += dropped;
+	}
+
+	if (written == position)
+	{
+		if (header->state.load(std::memory_order_relaxed) == SharedPcmState::Streaming)
+		{
+			underruns++;
+		}
+
+		return S_FALSE;
+	}
+
+	UINT32 slot = static_cast<UINT32>(position & (capacityFrames - 1));
+	UINT64 available = written - position;
+
+	block.frames = samples + static_cast<size_t>(slot) * format.channels;
+	block.frameCount = static_cast<UINT32>(capacityFrames - slot < available ? capacityFrames - slot : available);
+	block.format = format;
+	block.firstFrame = position;
+	block.droppedFrames = dropped;
+	block.formatSequence = sequence;
+	block.streamStarted = streamStartPending;
+
+	streamStartPending = false;
+
+	return S_OK;
+}
+
+bool AudioPlay::SharedPcmReader::Release(_In_ const SharedPcmBlock& block)
+{
+	std::atomic_thread_fence(std::memory_order_acquire);
+
+	UINT64 reserved = header->reserveFrame.load(std::memory_order_relaxed);
+	bool intact = reserved <= block.firstFrame + capacityFrames && header->formatSequence.load(std::memory_order_relaxed) == block.formatSequence;
+
+	if (block.firstFrame + block.frameCount > position)
+	{
+		position = block.firstFrame + block.frameCount;
+	}
+
+	if (!intact)
+	{
+		tornBlocks++;
+	}
+
+	return intact;
+}
+
+bool AudioPlay::SharedPcmReader::HasNews() const
+{
+	return header->writeFrame.load(std::memory_order_seq_cst) != position ||
+		header->formatSequence.load(std::memory_order_seq_cst) != formatSequence ||
+		header->state.load(std::memory_order_seq_cst) != observedState;
+}
+
+bool AudioPlay::SharedPcmReader::HasWriterExited() const
+{
+	#ifdef _WIN32
+	HANDLE process = OpenProcess(SYNCHRONIZE, FALSE, header->writerProcess);
+
+	if (process == nullptr)
+	{
+		return GetLastError() == ERROR_INVALID_PARAMETER;
+	}
+
+	bool exited = WaitForSingleObject(process, 0) == WAIT_OBJECT_0;
+	CloseHandle(process);
+
+	return exited;
+	#else
+	return kill(static_cast<pid_t>(header->writerProcess), 0) != 0 && errno == ESRCH;
+	#endif
+}
+
+HRESULT AudioPlay::SharedPcmReader::Wait(_In_ UINT32 timeoutMilliseconds)
+{
+	// Registered before looking, so the writer either sees the waiter or the reader sees the frames
+	header->waiters.fetch_add(1, std::memory_order_seq_cst);
+
+	UINT32 wakeSequence = header->wakeSequence.load(std::memory_order_seq_cst);
+	bool news = HasNews();
+
+	if (!news)
+	{
+		#ifdef _WIN32
+		WaitForSingleObject(wakeSemaphore, timeoutMilliseconds);
+		#elif defined(__linux__)
+		timespec timeout = { };
+		timeout.tv_sec = static_cast<time_t>(timeoutMilliseconds / 1000);
+		timeout.tv_nsec = static_cast<long>(timeoutMilliseconds % 1000) * 1000000;
+
+		// Returns right away if the writer bumped the sequence since it was read
+		syscall(SYS_futex, reinterpret_cast<UINT32*>(&header->wakeSequence), FUTEX_WAIT, wakeSequence, &timeout, nullptr, 0);
+		#else
+		UNREFERENCED_PARAMETER(wakeSequence);
+
+		// No shared futex, looks again every millisecond
+		for (UINT32 waited = 0; waited < timeoutMilliseconds && !HasNews(); waited++)
+		{
+			timespec interval = { 0, 1000000 };
+			nanosleep(&interval, nullptr);
+		}
+		#endif
+
+		news = HasNews();
+
+		if (!news && HasWriterExited())
+		{
+			writerExited = true;
+			news = true;
+		}
+	}
+
+	header->waiters.fetch_sub(1, std::memory_order_seq_cst);
+
+	observedState = header->state.load(std::memory_order_acquire);
+
+	return news ? S_OK : S_FALSE;
+}
+
+AudioPlay::SharedPcmState AudioPlay::SharedPcmReader::GetState() const
+{
+	return writerExited ? SharedPcmState::Closed : header->state.load(std::memory_order_acquire);
+}
+
+AudioPlay::SharedPcmSink::SharedPcmSink()
+{
+}
+
+HRESULT AudioPlay::SharedPcmSink::Create(_In_ SharedPcmWriter* writer, _COM_Outptr_ SharedPcmSink** pPtrSink)
+{
+	if (pPtrSink == nullptr || writer == nullptr)
+	{
+		return E_POINTER;
+	}
+	*pPtrSink = nullptr;
+
+	SharedPcmSink* sink = new (std::nothrow) SharedPcmSink();
+
+	if (sink == nullptr)
+	{
+		return E_OUTOFMEMORY;
+	}
+
+	sink->writer = writer;
+
+	*pPtrSink = sink;
+
+	return S_OK;
+}
+
+HRESULT AudioPlay::SharedPcmSink::BeginStream(_In_ const PcmFormat& format)
+{
+	return writer->BeginStream(format);
+}
+
+HRESULT AudioPlay::SharedPcmSink::Write(_In_reads_(frameCount * format.channels) const float* frames, _In_ UINT32 frameCount)
+{
+	writer->Write(frames, frameCount);
+
+	return S_OK;
+}
+
+HRESULT AudioPlay::SharedPcmSink::EndStream()
+{
+	writer->EndStream();
+
+	return S_OK;
+}
+
+AudioPlay::SharedPcmTap::SharedPcmTap() :
+	failedFormats(0)
+{
+}
+
+HRESULT AudioPlay::SharedPcmTap::Create(_In_ SharedPcmWriter* writer, _COM_Outptr_ SharedPcmTap** pPtrTap)
+{
+	if (pPtrTap == nullptr || writer == nullptr)
+	{
+		return E_POINTER;
+	}
+	*pPtrTap = nullptr;
+
+	SharedPcmTap* tap = new (std::nothrow) SharedPcmTap();
+
+	if (tap == nullptr)
+	{
+		return E_OUTOFMEMORY;
+	}
+
+	tap->writer = writer;
+
+	*pPtrTap = tap;
+
+	return S_OK;
+}
+
+void AudioPlay::SharedPcmTap::Update(_In_ const PcmFormat& format)
+{
+	// Also called when parameters change, the tap has none so every call is a new format
+	if (FAILED(writer->BeginStream(format)))
+	{
+		failedFormats.fetch_add(1, std::memory_order_relaxed);
+	}
+}
+
+void AudioPlay::SharedPcmTap::Reset()
+{
+}
+
+void AudioPlay::SharedPcmTap::Process(_Inout_updates_(frameCount * format.channels) float* frames, _In_ UINT32 frameCount, _In_ const PcmFormat& format)
+{
+	UNREFERENCED_PARAMETER(format);
+
+	writer->Write(frames, frameCount);
+}
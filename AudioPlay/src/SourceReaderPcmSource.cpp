@@ -0,0 +1,297 @@
+#include "SourceReaderPcmSource.h"
+
+#include <cstring>
+#include <new>
+
+#pragma comment (lib, "Mfreadwrite.lib")
+
+
+#define HR_FAIL_ACTION(hresult, action) if (FAILED(hresult)) { action; return hresult; }
+#define HR_FAIL(hresult) if (FAILED(hresult)) { return hresult; }
+
+
+AudioPlay::SourceReaderPcmSource::SourceReaderPcmSource() :
+	decoded(nullptr), decodedCapacity(0), decodedFrames(0), decodedOffset(0),
+	position(0), length(0), lengthKnown(false), endOfStream(false), seekTarget(0), discardUntilTarget(false)
+{
+}
+
+AudioPlay::SourceReaderPcmSource::~SourceReaderPcmSource()
+{
+	delete[] decoded;
+}
+
+HRESULT AudioPlay::SourceReaderPcmSource::Create(_In_ LPCWCH path, _COM_Outptr_ SourceReaderPcmSource** pPtrSource)
+{
+	if (pPtrSource == nullptr)
+	{
+		return E_INVALIDARG;
+	}
+	*pPtrSource = nullptr;
+
+	if (path == nullptr)
+	{
+		return E_POINTER;
+	}
+
+	ComPtr<IMFSourceReader> reader;
+	ComPtr<SourceReaderPcmSource> source;
+
+	HRESULT hr = MFCreateSourceReaderFromURL(path, nullptr, &reader); HR_FAIL(hr);
+
+	source.Attach(new (std::nothrow) SourceReaderPcmSource());
+
+	if (!source)
+	{
+		return E_OUTOFMEMORY;
+	}
+
+	hr = source->Initialize(reader); HR_FAIL(hr);
+
+	*pPtrSource = source.Detach();
+
+	return hr;
+}
+
+HRESULT AudioPlay::SourceReaderPcmSource::Create(_In_ IMFByteStream* byteStream, _COM_Outptr_ SourceReaderPcmSource** pPtrSource)
+{
+	if (pPtrSource == nullptr)
+	{
+		return E_INVALIDARG;
+	}
+	*pPtrSource = nullptr;
+
+	if (byteStream == nullptr)
+	{
+		return E_POINTER;
+	}
+
+	ComPtr<IMFSourceReader> reader;
+	ComPtr<SourceReaderPcmSource> source;
+
+	HRESULT hr = MFCreateSourceReaderFromByteStream(byteStream, nullptr, &reader); HR_FAIL(hr);
+
+	source.Attach(new (std::nothrow) SourceReaderPcmSource());
+
+	if (!source)
+	{
+		return E_OUTOFMEMORY;
+	}
+
+	hr = source->Initialize(reader); HR_FAIL(hr);
+
+	*pPtrSource = source.Detach();
+
+	return hr;
+}
+
+HRESULT AudioPlay::SourceReaderPcmSource::Initialize(_In_ IMFSourceReader* reader)
+{
+	ComPtr<IMFMediaType> requestedType;
+	ComPtr<IMFMediaType> currentType;
+
+	HRESULT hr = S_OK;
+
+	sourceReader = reader;
+
+	hr = sourceReader->SetStreamSelection(static_cast<DWORD>(MF_SOURCE_READER_ALL_STREAMS), FALSE); HR_FAIL(hr);
+	hr = sourceReader->SetStreamSelection(static_cast<DWORD>(MF_SOURCE_READER_FIRST_AUDIO_STREAM), TRUE); HR_FAIL(hr);
+
+	hr = MFCreateMediaType(&requestedType); HR_FAIL(hr);
+	hr = requestedType->SetGUID(MF_MT_MAJOR_TYPE, MFMediaType_Audio); HR_FAIL(hr);
+	hr = requestedType->SetGUID(MF_MT_SUBTYPE, MFAudioFormat_Float); HR_FAIL(hr);
+
+	hr = sourceReader->SetCurrentMediaType(static_cast<DWORD>(MF_SOURCE_READER_FIRST_AUDIO_STREAM), nullptr, requestedType); HR_FAIL(hr);
+	hr = sourceReader->GetCurrentMediaType(static_cast<DWORD>(MF_SOURCE_READER_FIRST_AUDIO_STREAM), &currentType); HR_FAIL(hr);
+
+	hr = currentType->GetUINT32(MF_MT_AUDIO_SAMPLES_PER_SECOND, &format.sampleRate); HR_FAIL(hr);
+	hr = currentType->GetUINT32(MF_MT_AUDIO_NUM_CHANNELS, &format.channels); HR_FAIL(hr);
+
+	if (format.sampleRate == 0 || format.channels == 0)
+	{
+		return AUDIO_E_INVALID_FORMAT;
+	}
+
+	PROPVARIANT var;
+	PropVariantInit(&var);
+
+	if (SUCCEEDED(sourceReader->GetPresentationAttribute(static_cast<DWORD>(MF_SOURCE_READER_MEDIASOURCE), MF_PD_DURATION, &var)) && var.vt == VT_UI8)
+	{
+		length = FramesFromMediaTime(var.uhVal.QuadPart, format.sampleRate);
+		lengthKnown = true;
+	}
+
+	PropVariantClear(&var);
+
+	// Not every source has metadata, playing doesn't depend on it
+	sourceReader->GetServiceForStream(static_cast<DWORD>(MF_SOURCE_READER_MEDIASOURCE), MF_PROPERTY_HANDLER_SERVICE, IID_PPV_ARGS(&propertyStore));
+
+	return ReadNextSample();
+}
+
+HRESULT AudioPlay::SourceReaderPcmSource::ReadNextSample()
+{
+	ComPtr<IMFSample> sample;
+	ComPtr<IMFMediaBuffer> buffer;
+
+	HRESULT hr = S_OK;
+
+	decodedFrames = 0;
+	decodedOffset = 0;
+
+	DWORD flags = 0;
+	LONGLONG timestamp = 0;
+
+	hr = sourceReader->ReadSample(static_cast<DWORD>(MF_SOURCE_READER_FIRST_AUDIO_STREAM), 0, nullptr, &flags, &timestamp, &sample); HR_FAIL(hr);
+
+	if (flags & MF_SOURCE_READERF_ENDOFSTREAM)
+	{
+		endOfStream = true;
+		return hr;
+	}
+
+	// Gaps come back without a sample
+	if (!sample)
+	{
+		return hr;
+	}
+
+	hr = sample->ConvertToContiguousBuffer(&buffer); HR_FAIL(hr);
+
+	BYTE* data = nullptr;
+	DWORD size = 0;
+
+	hr = buffer->Lock(&data, nullptr, &size); HR_FAIL(hr);
+
+	UINT32 frames = size / (format.channels * sizeof(float));
+
+	if (frames > decodedCapacity)
+	{
+		float* grown = new (std::nothrow) float[static_cast<size_t>(frames) * format.channels];
+
+		if (grown == nullptr)
+		{
+			buffer->Unlock();
+			return E_OUTOFMEMORY;
+		}
+
+		delete[] decoded;
+		decoded = grown;
+		decodedCapacity = frames;
+	}
+
+	memcpy(decoded, data, static_cast<size_t>(frames) * format.channels * sizeof(float));
+	decodedFrames = frames;
+
+	hr = buffer->Unlock(); HR_FAIL(hr);
+
+	if (discardUntilTarget)
+	{
+		UINT64 sampleFrame = FramesFromMediaTime(static_cast<UINT64>(timestamp < 0 ? 0 : timestamp), format.sampleRate);
+
+		if (sampleFrame + decodedFrames <= seekTarget)
+		{
+			decodedOffset = decodedFrames;
+			return hr;
+		}
+
+		decodedOffset = sampleFrame < seekTarget ? static_cast<UINT32>(seekTarget - sampleFrame) : 0;
+		discardUntilTarget = false;
+	}
+
+	return hr;
+}
+
+HRESULT AudioPlay::SourceReaderPcmSource::Read(_Out_writes_(frameCount * format.channels) float* buffer, _In_ UINT32 frameCount, _Out_ UINT32& framesRead)
+{
+	framesRead = 0;
+
+	HRESULT hr = S_OK;
+
+	while (framesRead < frameCount)
+	{
+		if (decodedOffset == decodedFrames)
+		{
+			if (endOfStream)
+			{
+				break;
+			}
+
+			hr = ReadNextSample(); HR_FAIL(hr);
+			continue;
+		}
+
+		UINT32 available = decodedFrames - decodedOffset;
+		UINT32 count = frameCount - framesRead;
+		count = available < count ? available : count;
+
+		memcpy(buffer + static_cast<size_t>(framesRead) * format.channels, decoded + static_cast<size_t>(decodedOffset) * format.channels,
+			static_cast<size_t>(count) * format.channels * sizeof(float));
+
+		decodedOffset += count;
+		framesRead += count;
+	}
+
+	position += framesRead;
+
+	return hr;
+}
+
+HRESULT AudioPlay::SourceReaderPcmSource::Seek(_In_ UINT64 frame)
+{
+	HRESULT hr = S_OK;
+
+	PROPVARIANT var;
+	PropVariantInit(&var);
+
+	var.vt = VT_I8;
+	var.hVal.QuadPart = static_cast<LONGLONG>(MediaTimeFromFrames(frame, format.sampleRate));
+
+	hr = sourceReader->SetCurrentPosition(GUID_NULL, var);
+
+	PropVariantClear(&var);
+
+	HR_FAIL(hr);
+
+	decodedFrames = 0;
+	decodedOffset = 0;
+	endOfStream = false;
+	position = frame;
+	seekTarget = frame;
+	discardUntilTarget = true;
+
+	return hr;
+}
+
+HRESULT AudioPlay::SourceReaderPcmSource::GetPosition(_Out_ UINT64& frame) const
+{
+	frame = position;
+
+	return S_OK;
+}
+
+HRESULT AudioPlay::SourceReaderPcmSource::GetLength(_Out_ UINT64& frames) const
+{
+	frames = length;
+
+	return lengthKnown ? S_OK : E_NOTIMPL;
+}
+
+HRESULT AudioPlay::SourceReaderPcmSource::GetPropertyStore(_COM_Outptr_ IPropertyStore** pPtrStore) const
+{
+	if (pPtrStore == nullptr)
+	{
+		return E_POINTER;
+	}
+	*pPtrStore = nullptr;
+
+	if (!propertyStore)
+	{
+		return MF_E_UNSUPPORTED_SERVICE;
+	}
+
+	*pPtrStore = propertyStore;
+	propertyStore->AddRef();
+
+	return S_OK;
+}
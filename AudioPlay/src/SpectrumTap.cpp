@@ -0,0 +1,271 @@
+#include "SpectrumTap.h"
+
+#include <chrono>
+#include <cmath>
+#include <new>
+#include <system_error>
+
+
+#define HR_FAIL_ACTION(hresult, action) if (FAILED(hresult)) { action; return hresult; }
+#define HR_FAIL(hresult) if (FAILED(hresult)) { return hresult; }
+
+
+using std::chrono::duration;
+using std::chrono::duration_cast;
+using std::chrono::steady_clock;
+
+
+namespace
+{
+	constexpr double pi = 3.14159265358979323846;
+
+	// 10 * log10(power) as a multiple of log2, log2 is cheaper
+	constexpr float decibelsPerPowerOctave = 3.01029996f;
+}
+
+
+AudioPlay::SpectrumTap::SpectrumTap() :
+	ring(nullptr), written(0), sampleRate(0), fftSize(0), window(nullptr), windowScale(0.0f), analysis(nullptr), real(nullptr), imaginary(nullptr),
+	lastAnalysed(0), published(0), spectra{ }, magnitudes{ }, backIndex(0), middleIndex(1), frontIndex(2), updateRate(30.0f), stopping(false)
+{
+}
+
+AudioPlay::SpectrumTap::~SpectrumTap()
+{
+	if (worker.joinable())
+	{
+		{
+			std::lock_guard<std::mutex> lock(stopMutex);
+			stopping = true;
+		}
+		stopCondition.notify_all();
+		worker.join();
+	}
+
+	delete[] ring;
+	delete[] window;
+	delete[] analysis;
+	delete[] real;
+	delete[] imaginary;
+
+	for (float* buffer : magnitudes)
+	{
+		delete[] buffer;
+	}
+}
+
+HRESULT AudioPlay::SpectrumTap::Create(_In_ UINT32 fftSize, _In_ float updatesPerSecond, _COM_Outptr_ SpectrumTap** pPtrTap)
+{
+	if (pPtrTap == nullptr)
+	{
+		return E_INVALIDARG;
+	}
+	*pPtrTap = nullptr;
+
+	if (fftSize < minFftSize || fftSize > maxFftSize || (fftSize & (fftSize - 1)) != 0)
+	{
+		return E_INVALIDARG;
+	}
+
+	ComPtr<SpectrumTap> tap;
+	tap.Attach(new (std::nothrow) SpectrumTap());
+
+	if (!tap)
+	{
+		return E_OUTOFMEMORY;
+	}
+
+	HRESULT hr = tap->SetUpdateRate(updatesPerSecond); HR_FAIL(hr);
+	hr = tap->fft.Initialize(fftSize); HR_FAIL(hr);
+
+	tap->fftSize = fftSize;
+	UINT32 binCount = tap->fft.GetBinCount();
+
+	tap->ring = new (std::nothrow) std::atomic<float>[ringSize]();
+	tap->window = new (std::nothrow) float[fftSize];
+	tap->analysis = new (std::nothrow) float[fftSize];
+	tap->real = new (std::nothrow) float[binCount];
+	tap->imaginary = new (std::nothrow) float[binCount];
+
+	if (!tap->ring || !tap->window || !tap->analysis || !tap->real || !tap->imaginary)
+	{
+		return E_OUTOFMEMORY;
+	}
+
+	for (UINT32 index = 0; index < 3; index++)
+	{
+		tap->magnitudes[index] = new (std::nothrow) float[binCount];
+
+		if (tap->magnitudes[index] == nullptr)
+		{
+			return E_OUTOFMEMORY;
+		}
+
+		for (UINT32 bin = 0; bin < binCount; bin++)
+		{
+			tap->magnitudes[index][bin] = silenceFloor;
+		}
+
+		tap->spectra[index] = { 0, 0, 0, binCount, tap->magnitudes[index] };
+	}
+
+	// Hann, scaled so a full scale sine comes out at 0 dB
+	double sum = 0.0;
+	for (UINT32 index = 0; index < fftSize; index++)
+	{
+		tap->window[index] = static_cast<float>(0.5 - 0.5 * std::cos(2.0 * pi * index / fftSize));
+		sum += tap->window[index];
+	}
+	tap->windowScale = static_cast<float>(20.0 * std::log10(2.0 / sum));
+
+	try
+	{
+		tap->worker = std::thread(&SpectrumTap::Work, tap.p);
+	}
+	catch (const std::system_error&)
+	{
+		return E_OUTOFMEMORY;
+	}
+
+	*pPtrTap = tap.Detach();
+
+	return hr;
+}
+
+HRESULT AudioPlay::SpectrumTap::SetUpdateRate(_In_ float updatesPerSecond)
+{
+	if (!(updatesPerSecond >= 1.0f && updatesPerSecond <= 240.0f))
+	{
+		return E_INVALIDARG;
+	}
+
+	updateRate = updatesPerSecond;
+
+	return S_OK;
+}
+
+void AudioPlay::SpectrumTap::Update(_In_ const PcmFormat& format)
+{
+	sampleRate.store(format.sampleRate, std::memory_order_relaxed);
+}
+
+void AudioPlay::SpectrumTap::Reset()
+{
+}
+
+void AudioPlay::SpectrumTap::Process(_Inout_updates_(frameCount * format.channels) float* frames, _In_ UINT32 frameCount, _In_ const PcmFormat& format)
+{
+	UINT32 channels = format.channels;
+	float scale = 1.0f / channels;
+	UINT64 position = written.load(std::memory_order_relaxed);
+
+	for (UINT32 frame = 0; frame < frameCount; frame++)
+	{
+		const float* sample = frames + static_cast<size_t>(frame) * channels;
+		float mono = 0.0f;
+
+		for (UINT32 channel = 0; channel < channels; channel++)
+		{
+			mono += sample[channel];
+		}
+
+		ring[(position + frame) & (ringSize - 1)].store(mono * scale, std::memory_order_relaxed);
+	}
+
+	written.store(position + frameCount, std::memory_order_release);
+}
+
+bool AudioPlay::SpectrumTap::Analyse()
+{
+	UINT64 end = written.load(std::memory_order_acquire);
+
+	if (end == lastAnalysed || end < fftSize)
+	{
+		return false;
+	}
+
+	UINT64 start = end - fftSize;
+
+	for (UINT32 index = 0; index < fftSize; index++)
+	{
+		analysis[index] = ring[(start + index) & (ringSize - 1)].load(std::memory_order_relaxed);
+	}
+
+	// The audio thread lapped the copy, try again at the next tick
+	if (written.load(std::memory_order_acquire) - start > ringSize)
+	{
+		return false;
+	}
+
+	lastAnalysed = end;
+
+	for (UINT32 index = 0; index < fftSize; index++)
+	{
+		analysis[index] *= window[index];
+	}
+
+	fft.Forward(analysis, real, imaginary);
+
+	float* output = magnitudes[backIndex];
+	UINT32 binCount = fft.GetBinCount();
+
+	for (UINT32 bin = 0; bin < binCount; bin++)
+	{
+		float power = real[bin] * real[bin] + imaginary[bin] * imaginary[bin];
+		float decibels = power > 0.0f ? decibelsPerPowerOctave * std::log2(power) + windowScale : silenceFloor;
+
+		output[bin] = decibels > silenceFloor ? decibels : silenceFloor;
+	}
+
+	SpectrumFrame& frame = spectra[backIndex];
+	frame.sequence = ++published;
+	frame.streamFrame = end;
+	frame.sampleRate = sampleRate.load(std::memory_order_relaxed);
+
+	backIndex = middleIndex.exchange(backIndex | freshBit, std::memory_order_acq_rel) & indexMask;
+
+	return true;
+}
+
+void AudioPlay::SpectrumTap::Work()
+{
+	steady_clock::time_point next = steady_clock::now();
+
+	std::unique_lock<std::mutex> lock(stopMutex);
+
+	while (!stopping)
+	{
+		next += duration_cast<steady_clock::duration>(duration<double>(1.0 / updateRate.load(std::memory_order_relaxed)));
+
+		// Don't try to catch up after a stall
+		steady_clock::time_point now = steady_clock::now();
+		if (next < now)
+		{
+			next = now;
+		}
+
+		if (stopCondition.wait_until(lock, next, [this] { return stopping; }))
+		{
+			break;
+		}
+
+		lock.unlock();
+		Analyse();
+		lock.lock();
+	}
+}
+
+bool AudioPlay::SpectrumTap::GetLatest(_Out_ const SpectrumFrame*& frame)
+{
+	bool fresh = false;
+
+	if (middleIndex.load(std::memory_order_relaxed) & freshBit)
+	{
+		frontIndex = middleIndex.exchange(frontIndex, std::memory_order_acq_rel) & indexMask;
+		fresh = true;
+	}
+
+	frame = &spectra[frontIndex];
+
+	return fresh;
+}
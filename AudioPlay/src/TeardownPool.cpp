@@ -0,0 +1,195 @@
+#include "TeardownPool.h"
+#include "Audio.h"
+#include "AutoCriticalSection.h"
+
+#include <algorithm>
+#include <new>
+
+
+#define HR_FAIL_ACTION(hresult, action) if (FAILED(hresult)) { action; return hresult; }
+#define HR_FAIL(hresult) if (FAILED(hresult)) { return hresult; }
+
+
+AudioPlay::TeardownPool::TeardownPool() :
+	pendingCount(0)
+{
+	InitializeCriticalSection(&criticalSection);
+
+	idleEvent = CreateEvent(nullptr, TRUE, TRUE, nullptr);
+
+	InitializeThreadpoolEnvironment(&environment);
+
+	pool = CreateThreadpool(nullptr);
+
+	if (pool)
+	{
+		SetThreadpoolThreadMaximum(pool, maxThreads);
+		SetThreadpoolThreadMinimum(pool, 1);
+		SetThreadpoolCallbackPool(&environment, pool);
+	}
+}
+
+AudioPlay::TeardownPool::~TeardownPool()
+{
+	// Only runs at process exit, whatever is still waiting is left to the OS
+	if (pool)
+	{
+		CloseThreadpool(pool);
+	}
+
+	DestroyThreadpoolEnvironment(&environment);
+	DeleteCriticalSection(&criticalSection);
+	CloseHandle(idleEvent);
+}
+
+AudioPlay::TeardownPool& AudioPlay::TeardownPool::Get()
+{
+	static TeardownPool instance;
+
+	return instance;
+}
+
+HRESULT AudioPlay::TeardownPool::Defer(_In_ IMFMediaSession* session, _In_opt_ IMFMediaSource* source)
+{
+	if (session == nullptr)
+	{
+		return E_POINTER;
+	}
+
+	Job* job = new (std::nothrow) Job{ session, source, nullptr };
+
+	if (job == nullptr)
+	{
+		return E_OUTOFMEMORY;
+	}
+
+	job->timer = CreateThreadpoolTimer(OnTimeout, job, &environment);
+
+	if (job->timer == nullptr)
+	{
+		HRESULT hr = HRESULT_FROM_WIN32(GetLastError());
+		delete job;
+		return hr;
+	}
+
+	{
+		AutoCriticalSection section(&criticalSection);
+
+		waiting.push_back(job);
+
+		InterlockedIncrement(&pendingCount);
+		ResetEvent(idleEvent);
+	}
+
+	// Relative due time in 100 nanosecond units
+	ULARGE_INTEGER relativeDueTime;
+	relativeDueTime.QuadPart = static_cast<ULONGLONG>(-static_cast<LONGLONG>(closeTimeoutMilliseconds) * 10000);
+
+	FILETIME dueTime;
+	dueTime.dwLowDateTime = relativeDueTime.LowPart;
+	dueTime.dwHighDateTime = relativeDueTime.HighPart;
+
+	SetThreadpoolTimer(job->timer, &dueTime, 0, 0);
+
+	HRESULT hr = session->Close();
+
+	if (FAILED(hr) && Claim(nullptr, job))
+	{
+		// No MESessionClosed is coming, shut it down right away
+		if (!TrySubmitThreadpoolCallback(OnSessionClosedWork, job, &environment))
+		{
+			Run(job, false);
+		}
+	}
+
+	return S_OK;
+}
+
+void AudioPlay::TeardownPool::OnSessionClosed(_In_ IMFMediaSession* session)
+{
+	Job* job = Claim(session, nullptr);
+
+	if (job == nullptr)
+	{
+		return;
+	}
+
+	if (!TrySubmitThreadpoolCallback(OnSessionClosedWork, job, &environment))
+	{
+		Run(job, false);
+	}
+}
+
+HRESULT AudioPlay::TeardownPool::WaitForIdle(_In_ DWORD timeoutMilliseconds)
+{
+	DWORD result = WaitForSingleObject(idleEvent, timeoutMilliseconds);
+
+	return result == WAIT_OBJECT_0 ? S_OK : AUDIO_TIMEOUT;
+}
+
+AudioPlay::TeardownPool::Job* AudioPlay::TeardownPool::Claim(_In_opt_ IMFMediaSession* session, _In_opt_ Job* job)
+{
+	AutoCriticalSection section(&criticalSection);
+
+	auto found = std::find_if(waiting.begin(), waiting.end(), [session, job](const Job* waitingJob)
+	{
+		return waitingJob == job || (session && waitingJob->session == session);
+	});
+
+	if (found == waiting.end())
+	{
+		return nullptr;
+	}
+
+	Job* claimed = *found;
+	waiting.erase(found);
+
+	return claimed;
+}
+
+void AudioPlay::TeardownPool::Run(_In_ Job* job, _In_ bool fromTimer)
+{
+	if (!fromTimer)
+	{
+		SetThreadpoolTimer(job->timer, nullptr, 0, 0);
+		WaitForThreadpoolTimerCallbacks(job->timer, TRUE);
+	}
+	CloseThreadpoolTimer(job->timer);
+
+	job->session->Shutdown();
+
+	if (job->source)
+	{
+		job->source->Shutdown();
+	}
+
+	delete job;
+
+	AutoCriticalSection section(&criticalSection);
+
+	if (InterlockedDecrement(&pendingCount) == 0)
+	{
+		SetEvent(idleEvent);
+	}
+}
+
+void CALLBACK AudioPlay::TeardownPool::OnSessionClosedWork(PTP_CALLBACK_INSTANCE instance, PVOID context)
+{
+	UNREFERENCED_PARAMETER(instance);
+
+	Get().Run(reinterpret_cast<Job*>(context), false);
+}
+
+void CALLBACK AudioPlay::TeardownPool::OnTimeout(PTP_CALLBACK_INSTANCE instance, PVOID context, PTP_TIMER timer)
+{
+	UNREFERENCED_PARAMETER(instance); UNREFERENCED_PARAMETER(timer);
+
+	TeardownPool& teardownPool = Get();
+
+	Job* job = teardownPool.Claim(nullptr, reinterpret_cast<Job*>(context));
+
+	if (job)
+	{
+		teardownPool.Run(job, true);
+	}
+}
@@ -0,0 +1,453 @@
+#include "ThumbnailCache.h"
+#include "AudioMetadata.h"
+#include "AutoCriticalSection.h"
+
+#include <new>
+
+
+#define HR_FAIL_ACTION(hresult, action) if (FAILED(hresult)) { action; return hresult; }
+#define HR_FAIL(hresult) if (FAILED(hresult)) { return hresult; }
+
+
+namespace
+{
+	SRWLOCK factoryLock = SRWLOCK_INIT;
+	// Never released, releasing it after the last CoUninitialize at exit would crash
+	IWICImagingFactory* sharedFactory = nullptr;
+}
+
+
+AudioPlay::ThumbnailCache::ThumbnailCache() :
+	referenceCount(1), maxBytes(0), statistics{ }, pool(nullptr)
+{
+	InitializeCriticalSection(&criticalSection);
+	InitializeThreadpoolEnvironment(&environment);
+}
+
+AudioPlay::ThumbnailCache::~ThumbnailCache()
+{
+	// Queued decodes hold a reference, nothing is pending by now
+	if (pool)
+	{
+		CloseThreadpool(pool);
+	}
+
+	DestroyThreadpoolEnvironment(&environment);
+	DeleteCriticalSection(&criticalSection);
+}
+
+HRESULT AudioPlay::ThumbnailCache::Create(_In_ UINT64 maxBytes, _In_ DWORD threads, _COM_Outptr_ ThumbnailCache** pPtrCache)
+{
+	if (pPtrCache == nullptr)
+	{
+		return E_INVALIDARG;
+	}
+	*pPtrCache = nullptr;
+
+	if (threads == 0)
+	{
+		return E_INVALIDARG;
+	}
+
+	ComPtr<ThumbnailCache> cache;
+	cache.Attach(new (std::nothrow) ThumbnailCache());
+
+	if (!cache)
+	{
+		return E_OUTOFMEMORY;
+	}
+
+	cache->maxBytes = maxBytes;
+	cache->pool = CreateThreadpool(nullptr);
+
+	if (cache->pool == nullptr)
+	{
+		return HRESULT_FROM_WIN32(GetLastError());
+	}
+
+	SetThreadpoolThreadMaximum(cache->pool, threads);
+	SetThreadpoolCallbackPool(&cache->environment, cache->pool);
+
+	*pPtrCache = cache.Detach();
+
+	return S_OK;
+}
+
+HRESULT AudioPlay::ThumbnailCache::GetImagingFactory(_COM_Outptr_ IWICImagingFactory** pPtrFactory)
+{
+	if (pPtrFactory == nullptr)
+	{
+		return E_INVALIDARG;
+	}
+	*pPtrFactory = nullptr;
+
+	AcquireSRWLockExclusive(&factoryLock);
+
+	HRESULT hr = S_OK;
+
+	// Not a function static so a failed creation, like on a thread without COM, is tried again next time
+	if (sharedFactory == nullptr)
+	{
+		hr = CoCreateInstance(CLSID_WICImagingFactory, nullptr, CLSCTX_INPROC_SERVER, IID_PPV_ARGS(&sharedFactory));
+	}
+
+	if (SUCCEEDED(hr))
+	{
+		*pPtrFactory = sharedFactory;
+		sharedFactory->AddRef();
+	}
+
+	ReleaseSRWLockExclusive(&factoryLock);
+
+	return hr;
+}
+
+ULONG STDMETHODCALLTYPE AudioPlay::ThumbnailCache::AddRef()
+{
+	return ++referenceCount;
+}
+
+ULONG STDMETHODCALLTYPE AudioPlay::ThumbnailCache::Release()
+{
+	ULONG count = --referenceCount;
+	if (count == 0)
+	{
+		delete this;
+	}
+	return count;
+}
+
+AudioPlay::ThumbnailCache::Key AudioPlay::ThumbnailCache::MakeKey(_In_reads_bytes_(size) const BYTE* data, _In_ UINT32 size, _In_ UINT32 edge)
+{
+	// FNV-1a over 8 bytes at a time, a few hundred microseconds for a large JPEG
+	constexpr UINT64 prime = 0x100000001b3ull;
+	UINT64 hash = 0xcbf29ce484222325ull;
+
+	UINT32 index = 0;
+	for (; index + 8 <= size; index += 8)
+	{
+		UINT64 word;
+		CopyMemory(&word, data + index, sizeof(word));
+		hash = (hash ^ word) * prime;
+	}
+	for (; index < size; index++)
+	{
+		hash = (hash ^ data[index]) * prime;
+	}
+
+	return { hash, size, edge };
+}
+
+HRESULT AudioPlay::ThumbnailCache::Decode(_In_reads_bytes_(size) const BYTE* data, _In_ UINT32 size, _In_ UINT32 edge, _COM_Outptr_ IWICBitmap** pPtrBitmap)
+{
+	*pPtrBitmap = nullptr;
+
+	ComPtr<IWICImagingFactory> factory;
+	ComPtr<IWICStream> stream;
+	ComPtr<IWICBitmapDecoder> decoder;
+	ComPtr<IWICBitmapFrameDecode> frame;
+	ComPtr<IWICBitmapScaler> scaler;
+	ComPtr<IWICFormatConverter> converter;
+
+	HRESULT hr = GetImagingFactory(&factory); HR_FAIL(hr);
+
+	hr = factory->CreateStream(&stream); HR_FAIL(hr);
+	hr = stream->InitializeFromMemory(const_cast<BYTE*>(data), size); HR_FAIL(hr);
+
+	hr = factory->CreateDecoderFromStream(stream, nullptr, WICDecodeMetadataCacheOnDemand, &decoder); HR_FAIL(hr);
+	hr = decoder->GetFrame(0, &frame); HR_FAIL(hr);
+
+	UINT width = 0;
+	UINT height = 0;
+	hr = frame->GetSize(&width, &height); HR_FAIL(hr);
+
+	if (width == 0 || height == 0)
+	{
+		return AUDIO_E_CORRUPT_DATA;
+	}
+
+	UINT longer = width > height ? width : height;
+
+	if (longer > edge)
+	{
+		width = static_cast<UINT>((static_cast<UINT64>(width) * edge + longer / 2) / longer);
+		height = static_cast<UINT>((static_cast<UINT64>(height) * edge + longer / 2) / longer);
+
+		width = width ? width : 1;
+		height = height ? height : 1;
+	}
+
+	// The JPEG decoder scales while decoding when the scaler asks it to, a 3000 x 3000 cover is never decoded at full size
+	hr = factory->CreateBitmapScaler(&scaler); HR_FAIL(hr);
+	hr = scaler->Initialize(frame, width, height, WICBitmapInterpolationModeFant); HR_FAIL(hr);
+
+	hr = factory->CreateFormatConverter(&converter); HR_FAIL(hr);
+	hr = converter->Initialize(scaler, GUID_WICPixelFormat32bppPBGRA, WICBitmapDitherTypeNone, nullptr, 0.0, WICBitmapPaletteTypeCustom); HR_FAIL(hr);
+
+	// Pulls the pixels through now, the cached bitmap doesn't keep the encoded data alive
+	hr = factory->CreateBitmapFromSource(converter, WICBitmapCacheOnLoad, pPtrBitmap);
+
+	return hr;
+}
+
+void CALLBACK AudioPlay::ThumbnailCache::OnDecodeWork(PTP_CALLBACK_INSTANCE instance, PVOID context)
+{
+	UNREFERENCED_PARAMETER(instance);
+
+	Job* job = static_cast<Job*>(context);
+
+	job->cache->Finish(job);
+}
+
+void AudioPlay::ThumbnailCache::Finish(_In_ Job* job)
+{
+	HRESULT hr = CoInitializeEx(nullptr, COINIT_MULTITHREADED);
+	bool uninitialize = SUCCEEDED(hr);
+
+	ComPtr<IWICBitmap> bitmap;
+	hr = Decode(job->data, job->key.size, job->key.edge, &bitmap);
+
+	std::vector<Waiter> waiters;
+
+	{
+		AutoCriticalSection section(&criticalSection);
+
+		statistics.decodes++;
+
+		if (SUCCEEDED(hr))
+		{
+			Insert(job->key, bitmap);
+		}
+
+		pending.erase(job->key);
+
+		// Later requests for the same art joined the job until it left pending
+		waiters.swap(job->waiters);
+	}
+
+	for (const Waiter& waiter : waiters)
+	{
+		waiter.callback(hr, SUCCEEDED(hr) ? bitmap.p : nullptr, waiter.context);
+	}
+
+	bitmap.Release();
+
+	if (uninitialize)
+	{
+		CoUninitialize();
+	}
+
+	CoTaskMemFree(job->data);
+	delete job;
+
+	// Taken by Request for the queued job, may be the last one
+	Release();
+}
+
+void AudioPlay::ThumbnailCache::Insert(_In_ const Key& key, _In_ IWICBitmap* bitmap)
+{
+	UINT width = 0;
+	UINT height = 0;
+	bitmap->GetSize(&width, &height);
+
+	UINT64 bytes = static_cast<UINT64>(width) * height * 4;
+
+	// Too big for the cache, the waiters still get it
+	if (bytes > maxBytes || index.find(key) != index.end())
+	{
+		return;
+	}
+
+	Evict(maxBytes - bytes);
+
+	entries.push_front({ key, bitmap, bytes });
+	index[key] = entries.begin();
+
+	statistics.usedBytes += bytes;
+	statistics.entryCount++;
+}
+
+void AudioPlay::ThumbnailCache::Evict(_In_ UINT64 budget)
+{
+	while (statistics.usedBytes > budget && !entries.empty())
+	{
+		Entry& last = entries.back();
+
+		statistics.usedBytes -= last.bytes;
+		statistics.entryCount--;
+		statistics.evictions++;
+
+		index.erase(last.key);
+		entries.pop_back();
+	}
+}
+
+HRESULT AudioPlay::ThumbnailCache::Lookup(_In_reads_bytes_(size) const BYTE* data, _In_ UINT32 size, _In_ UINT32 edge, _COM_Outptr_result_maybenull_ IWICBitmapSource** cached)
+{
+	if (cached == nullptr)
+	{
+		return E_INVALIDARG;
+	}
+	*cached = nullptr;
+
+	if (data == nullptr)
+	{
+		return E_POINTER;
+	}
+
+	Key key = MakeKey(data, size, edge);
+
+	AutoCriticalSection section(&criticalSection);
+
+	auto found = index.find(key);
+
+	if (found == index.end())
+	{
+		return S_FALSE;
+	}
+
+	// Most recently used goes to the front
+	entries.splice(entries.begin(), entries, found->second);
+
+	*cached = found->second->bitmap;
+	(*cached)->AddRef();
+
+	return S_OK;
+}
+
+HRESULT AudioPlay::ThumbnailCache::Request(_In_reads_bytes_(size) const BYTE* data, _In_ UINT32 size, _In_ UINT32 edge,
+	_In_ ThumbnailCallback callback, _In_opt_ void* context, _COM_Outptr_result_maybenull_ IWICBitmapSource** cached)
+{
+	if (cached == nullptr)
+	{
+		return E_INVALIDARG;
+	}
+	*cached = nullptr;
+
+	if (data == nullptr || callback == nullptr)
+	{
+		return E_POINTER;
+	}
+
+	if (size == 0 || edge < minEdge || edge > maxEdge)
+	{
+		return E_INVALIDARG;
+	}
+
+	Key key = MakeKey(data, size, edge);
+
+	AutoCriticalSection section(&criticalSection);
+
+	auto found = index.find(key);
+
+	if (found != index.end())
+	{
+		statistics.hits++;
+
+		entries.splice(entries.begin(), entries, found->second);
+
+		*cached = found->second->bitmap;
+		(*cached)->AddRef();
+
+		return S_OK;
+	}
+
+	statistics.misses++;
+
+	auto running = pending.find(key);
+
+	if (running != pending.end())
+	{
+		statistics.joins++;
+
+		running->second->waiters.push_back({ callback, context });
+
+		return S_FALSE;
+	}
+
+	Job* job = new (std::nothrow) Job{ this, key, nullptr, { } };
+
+	if (job == nullptr)
+	{
+		return E_OUTOFMEMORY;
+	}
+
+	job->data = static_cast<BYTE*>(CoTaskMemAlloc(size));
+
+	if (job->data == nullptr)
+	{
+		delete job;
+		return E_OUTOFMEMORY;
+	}
+
+	CopyMemory(job->data, data, size);
+	job->waiters.push_back({ callback, context });
+
+	AddRef();
+
+	if (!TrySubmitThreadpoolCallback(OnDecodeWork, job, &environment))
+	{
+		HRESULT hr = HRESULT_FROM_WIN32(GetLastError());
+
+		CoTaskMemFree(job->data);
+		delete job;
+
+		// Can't be the last reference, the caller holds one
+		--referenceCount;
+
+		return hr;
+	}
+
+	pending[key] = job;
+
+	return S_FALSE;
+}
+
+HRESULT AudioPlay::ThumbnailCache::Request(_In_ const AudioMetadata& metadata, _In_ UINT32 edge,
+	_In_ ThumbnailCallback callback, _In_opt_ void* context, _COM_Outptr_result_maybenull_ IWICBitmapSource** cached)
+{
+	if (cached == nullptr)
+	{
+		return E_INVALIDARG;
+	}
+	*cached = nullptr;
+
+	BYTE* data = nullptr;
+	UINT32 size = 0;
+
+	HRESULT hr = metadata.GetThumbnailData(data, size); HR_FAIL(hr);
+
+	if (hr == S_FALSE)
+	{
+		return HRESULT_FROM_WIN32(ERROR_NOT_FOUND);
+	}
+
+	hr = Request(data, size, edge, callback, context, cached);
+
+	CoTaskMemFree(data);
+
+	return hr;
+}
+
+void AudioPlay::ThumbnailCache::SetMaxBytes(_In_ UINT64 bytes)
+{
+	AutoCriticalSection section(&criticalSection);
+
+	maxBytes = bytes;
+
+	Evict(maxBytes);
+}
+
+void AudioPlay::ThumbnailCache::Clear()
+{
+	AutoCriticalSection section(&criticalSection);
+
+	Evict(0);
+}
+
+AudioPlay::ThumbnailCacheStatistics AudioPlay::ThumbnailCache::GetStatistics()
+{
+	AutoCriticalSection section(&criticalSection);
+
+	return statistics;
+}
@@ -0,0 +1,649 @@
+#include "TimeStretchSource.h"
+#include "Simd.h"
+
+#include <cmath>
+#include <cstring>
+#include <new>
+
+
+#define HR_FAIL_ACTION(hresult, action) if (FAILED(hresult)) { action; return hresult; }
+#define HR_FAIL(hresult) if (FAILED(hresult)) { return hresult; }
+
+
+namespace
+{
+	constexpr UINT64 unknownEnd = ~0ULL;
+	constexpr UINT32 decimation = 4;
+	constexpr double pi = 3.14159265358979323846;
+
+	float DotProduct(_In_reads_(count) const float* lhs, _In_reads_(count) const float* rhs, _In_ UINT32 count)
+	{
+		UINT32 index = 0;
+		float sum = 0.0f;
+
+		#ifdef AUDIOPLAY_SSE2
+		__m128 sum0 = _mm_setzero_ps();
+		__m128 sum1 = _mm_setzero_ps();
+
+		for (; index + 8 <= count; index += 8)
+		{
+			sum0 = _mm_add_ps(sum0, _mm_mul_ps(_mm_loadu_ps(lhs + index), _mm_loadu_ps(rhs + index)));
+			sum1 = _mm_add_ps(sum1, _mm_mul_ps(_mm_loadu_ps(lhs + index + 4), _mm_loadu_ps(rhs + index + 4)));
+		}
+
+		sum0 = _mm_add_ps(sum0, sum1);
+		sum0 = _mm_add_ps(sum0, _mm_movehl_ps(sum0, sum0));
+		sum0 = _mm_add_ss(sum0, _mm_shuffle_ps(sum0, sum0, 1));
+		sum = _mm_cvtss_f32(sum0);
+		#endif
+
+		for (; index < count; index++)
+		{
+			sum += lhs[index] * rhs[index];
+		}
+
+		return sum;
+	}
+
+	// output = previous + window * segment
+	void OverlapAdd(_In_reads_(count) const float* previous, _In_reads_(count) const float* window, _In_reads_(count) const float* segment,
+		_Out_writes_(count) float* output, _In_ UINT32 count)
+	{
+		UINT32 index = 0;
+
+		#ifdef AUDIOPLAY_SSE2
+		for (; index + 4 <= count; index += 4)
+		{
+			__m128 product = _mm_mul_ps(_mm_loadu_ps(window + index), _mm_loadu_ps(segment + index));
+			_mm_storeu_ps(output + index, _mm_add_ps(_mm_loadu_ps(previous + index), product));
+		}
+		#endif
+
+		for (; index < count; index++)
+		{
+			output[index] = previous[index] + window[index] * segment[index];
+		}
+	}
+
+	// output = window * segment
+	void ApplyWindow(_In_reads_(count) const float* window, _In_reads_(count) const float* segment, _Out_writes_(count) float* output, _In_ UINT32 count)
+	{
+		UINT32 index = 0;
+
+		#ifdef AUDIOPLAY_SSE2
+		for (; index + 4 <= count; index += 4)
+		{
+			_mm_storeu_ps(output + index, _mm_mul_ps(_mm_loadu_ps(window + index), _mm_loadu_ps(segment + index)));
+		}
+		#endif
+
+		for (; index < count; index++)
+		{
+			output[index] = window[index] * segment[index];
+		}
+	}
+
+	void Downmix(_In_reads_(frameCount * channels) const float* frames, _In_ UINT32 channels, _In_ UINT64 frameCount, _Out_writes_(frameCount) float* mono)
+	{
+		if (channels == 1)
+		{
+			memcpy(mono, frames, static_cast<size_t>(frameCount) * sizeof(float));
+			return;
+		}
+
+		for (UINT64 frame = 0; frame < frameCount; frame++)
+		{
+			float sum = 0.0f;
+			for (UINT32 channel = 0; channel < channels; channel++)
+			{
+				sum += frames[frame * channels + channel];
+			}
+			mono[frame] = sum;
+		}
+	}
+
+	// How well a candidate lines up, correlation normalized by the candidate's energy without the square root
+	float Score(_In_ float correlation, _In_ float energy)
+	{
+		return correlation * std::fabs(correlation) / (energy + 1e-9f);
+	}
+}
+
+AudioPlay::TimeStretchSource::TimeStretchSource() :
+	rate(1.0f), segmentFrames(0), hopFrames(0), searchFrames(0), riseWindow(nullptr), fallWindow(nullptr),
+	input(nullptr), inputCapacity(0), inputStart(0), inputFrames(0), sourceEnd(unknownEnd),
+	tail(nullptr), block(nullptr), blockOffset(0), blockFrames(0), mono(nullptr), monoTemplate(nullptr), decimated(nullptr),
+	passthrough(true), finished(false), continuation(0), analysisPosition(0.0), outputPosition(0), markCount(0)
+{
+}
+
+AudioPlay::TimeStretchSource::~TimeStretchSource()
+{
+	delete[] riseWindow;
+	delete[] fallWindow;
+	delete[] input;
+	delete[] tail;
+	delete[] block;
+	delete[] mono;
+	delete[] monoTemplate;
+	delete[] decimated;
+}
+
+HRESULT AudioPlay::TimeStretchSource::Create(_In_ PcmSource* source, _In_ float rate, _COM_Outptr_ TimeStretchSource** pPtrSource)
+{
+	if (pPtrSource == nullptr)
+	{
+		return E_INVALIDARG;
+	}
+	*pPtrSource = nullptr;
+
+	if (source == nullptr)
+	{
+		return E_POINTER;
+	}
+
+	ComPtr<TimeStretchSource> stretch;
+	stretch.Attach(new (std::nothrow) TimeStretchSource());
+
+	if (!stretch)
+	{
+		return E_OUTOFMEMORY;
+	}
+
+	HRESULT hr = stretch->SetRate(rate); HR_FAIL(hr);
+	hr = stretch->Initialize(source); HR_FAIL(hr);
+
+	*pPtrSource = stretch.Detach();
+
+	return hr;
+}
+
+HRESULT AudioPlay::TimeStretchSource::Initialize(_In_ PcmSource* p_source)
+{
+	HRESULT hr = S_OK;
+
+	source = p_source;
+	format = source->GetFormat();
+
+	UINT32 channels = format.channels;
+
+	// Multiples of the decimation so the coarse search lines up with whole frames
+	segmentFrames = (format.sampleRate / 50) & ~(2 * decimation - 1);
+	if (segmentFrames < 64)
+	{
+		segmentFrames = 64;
+	}
+	hopFrames = segmentFrames / 2;
+	searchFrames = (hopFrames / 2) & ~(decimation - 1);
+
+	UINT32 hopSamples = hopFrames * channels;
+	UINT32 regionFrames = 2 * searchFrames + hopFrames + decimation;
+
+	inputCapacity = 8 * static_cast<UINT64>(segmentFrames);
+
+	riseWindow = new (std::nothrow) float[hopSamples];
+	fallWindow = new (std::nothrow) float[hopSamples];
+	input = new (std::nothrow) float[static_cast<size_t>(inputCapacity * channels)];
+	tail = new (std::nothrow) float[hopSamples];
+	block = new (std::nothrow) float[hopSamples];
+	mono = new (std::nothrow) float[regionFrames];
+	monoTemplate = new (std::nothrow) float[hopFrames];
+	decimated = new (std::nothrow) float[regionFrames / decimation + hopFrames / decimation + 1];
+
+	if (!riseWindow || !fallWindow || !input || !tail || !block || !mono || !monoTemplate || !decimated)
+	{
+		return E_OUTOFMEMORY;
+	}
+
+	// Periodic Hann, the two halves of overlapping segments add up to exactly 1
+	for (UINT32 frame = 0; frame < hopFrames; frame++)
+	{
+		float rise = static_cast<float>(0.5 - 0.5 * cos(2.0 * pi * frame / segmentFrames));
+
+		for (UINT32 channel = 0; channel < channels; channel++)
+		{
+			riseWindow[frame * channels + channel] = rise;
+			fallWindow[frame * channels + channel] = 1.0f - rise;
+		}
+	}
+
+	UINT64 position = 0;
+	hr = source->GetPosition(position); HR_FAIL(hr);
+
+	inputStart = position;
+	continuation = position;
+	outputPosition = position;
+
+	Mark(position, 1.0f);
+
+	return hr;
+}
+
+HRESULT AudioPlay::TimeStretchSource::SetRate(_In_ float newRate)
+{
+	if (!(newRate >= minimumRate && newRate <= maximumRate))
+	{
+		return E_INVALIDARG;
+	}
+
+	rate = newRate;
+
+	return S_OK;
+}
+
+void AudioPlay::TimeStretchSource::Mark(_In_ UINT64 inputFrame, _In_ float markRate)
+{
+	UINT32 count = markCount.load(std::memory_order_relaxed);
+	PositionMark& mark = marks[count % positionHistory];
+
+	mark.outputFrame.store(outputPosition, std::memory_order_relaxed);
+	mark.inputFrame.store(inputFrame, std::memory_order_relaxed);
+	mark.rate.store(markRate, std::memory_order_relaxed);
+
+	markCount.store(count + 1, std::memory_order_release);
+}
+
+UINT64 AudioPlay::TimeStretchSource::GetInputPosition(_In_ UINT64 outputFrame) const
+{
+	UINT32 count = markCount.load(std::memory_order_acquire);
+	UINT32 oldest = count > positionHistory ? count - positionHistory : 0;
+
+	// Newest mark at or before the frame, the session plays a little behind the reads
+	for (UINT32 index = count; index > oldest; index--)
+	{
+		const PositionMark& mark = marks[(index - 1) % positionHistory];
+		UINT64 markOutput = mark.outputFrame.load(std::memory_order_relaxed);
+
+		if (markOutput <= outputFrame)
+		{
+			UINT64 markInput = mark.inputFrame.load(std::memory_order_relaxed);
+			return markInput + static_cast<UINT64>((outputFrame - markOutput) * static_cast<double>(mark.rate.load(std::memory_order_relaxed)));
+		}
+	}
+
+	return outputFrame;
+}
+
+HRESULT AudioPlay::TimeStretchSource::Append(_In_ UINT64 frameCount)
+{
+	HRESULT hr = S_OK;
+
+	UINT32 channels = format.channels;
+
+	while (frameCount)
+	{
+		float* output = input + inputFrames * channels;
+		UINT32 count = frameCount < 65536 ? static_cast<UINT32>(frameCount) : 65536;
+		UINT32 framesRead = 0;
+
+		if (sourceEnd == unknownEnd)
+		{
+			hr = source->Read(output, count, framesRead); HR_FAIL(hr);
+
+			if (framesRead < count)
+			{
+				sourceEnd = inputStart + inputFrames + framesRead;
+			}
+		}
+
+		// Silence after the end lets the last segments fade out
+		memset(output + static_cast<size_t>(framesRead) * channels, 0, static_cast<size_t>(count - framesRead) * channels * sizeof(float));
+
+		inputFrames += count;
+		frameCount -= count;
+	}
+
+	return hr;
+}
+
+HRESULT AudioPlay::TimeStretchSource::Fill(_In_ UINT64 from, _In_ UINT64 to)
+{
+	HRESULT hr = S_OK;
+
+	UINT32 channels = format.channels;
+
+	if (from > inputStart)
+	{
+		UINT64 drop = from - inputStart;
+
+		if (drop < inputFrames)
+		{
+			memmove(input, input + drop * channels, static_cast<size_t>((inputFrames - drop) * channels) * sizeof(float));
+			inputFrames -= drop;
+			inputStart = from;
+		}
+		else
+		{
+			// Frames skipped at high rates are decoded and dropped, the source is only read forward
+			UINT64 skip = drop - inputFrames;
+
+			inputStart += inputFrames;
+			inputFrames = 0;
+
+			while (skip)
+			{
+				UINT64 count = skip < inputCapacity ? skip : inputCapacity;
+
+				hr = Append(count); HR_FAIL(hr);
+
+				inputStart += count;
+				inputFrames = 0;
+				skip -= count;
+			}
+		}
+	}
+
+	if (to - inputStart > inputCapacity)
+	{
+		UINT64 capacity = 2 * (to - inputStart);
+		float* grown = new (std::nothrow) float[static_cast<size_t>(capacity * channels)];
+
+		if (grown == nullptr)
+		{
+			return E_OUTOFMEMORY;
+		}
+
+		memcpy(grown, input, static_cast<size_t>(inputFrames * channels) * sizeof(float));
+		delete[] input;
+		input = grown;
+		inputCapacity = capacity;
+	}
+
+	if (inputStart + inputFrames < to)
+	{
+		hr = Append(to - inputStart - inputFrames); HR_FAIL(hr);
+	}
+
+	return hr;
+}
+
+UINT64 AudioPlay::TimeStretchSource::FindSegment(_In_ UINT64 low, _In_ UINT64 high)
+{
+	if (high <= low)
+	{
+		return low;
+	}
+
+	UINT32 channels = format.channels;
+	UINT32 candidates = static_cast<UINT32>(high - low);
+	UINT32 regionFrames = candidates + hopFrames;
+
+	Downmix(FramesAt(continuation), channels, hopFrames, monoTemplate);
+	Downmix(FramesAt(low), channels, regionFrames, mono);
+
+	// Coarse search on a quarter of the rate, then the best neighbourhood at the full rate
+	UINT32 templateLength = hopFrames / decimation;
+	UINT32 regionLength = regionFrames / decimation;
+	float* decimatedTemplate = decimated;
+	float* decimatedRegion = decimated + templateLength;
+
+	for (UINT32 index = 0; index < templateLength; index++)
+	{
+		const float* frames = monoTemplate + index * decimation;
+		decimatedTemplate[index] = frames[0] + frames[1] + frames[2] + frames[3];
+	}
+	for (UINT32 index = 0; index < regionLength; index++)
+	{
+		const float* frames = mono + index * decimation;
+		decimatedRegion[index] = frames[0] + frames[1] + frames[2] + frames[3];
+	}
+
+	UINT32 coarseCount = candidates / decimation + 1;
+	if (coarseCount + templateLength > regionLength)
+	{
+		coarseCount = regionLength - templateLength + 1;
+	}
+
+	float energy = DotProduct(decimatedRegion, decimatedRegion, templateLength);
+	float bestScore = -1e30f;
+	UINT32 bestCoarse = 0;
+
+	for (UINT32 offset = 0; offset < coarseCount; offset++)
+	{
+		float score = Score(DotProduct(decimatedTemplate, decimatedRegion + offset, templateLength), energy);
+
+		if (score > bestScore)
+		{
+			bestScore = score;
+			bestCoarse = offset;
+		}
+
+		if (offset + templateLength < regionLength)
+		{
+			float leaving = decimatedRegion[offset];
+			float entering = decimatedRegion[offset + templateLength];
+			energy += entering * entering - leaving * leaving;
+			energy = energy < 0.0f ? 0.0f : energy;
+		}
+	}
+
+	UINT32 center = bestCoarse * decimation;
+	UINT32 first = center >= decimation - 1 ? center - (decimation - 1) : 0;
+	UINT32 last = center + (decimation - 1) < candidates ? center + (decimation - 1) : candidates;
+	UINT32 best = center;
+
+	bestScore = -1e30f;
+
+	for (UINT32 offset = first; offset <= last; offset++)
+	{
+		const float* candidate = mono + offset;
+		float score = Score(DotProduct(monoTemplate, candidate, hopFrames), DotProduct(candidate, candidate, hopFrames));
+
+		if (score > bestScore)
+		{
+			bestScore = score;
+			best = offset;
+		}
+	}
+
+	return low + best;
+}
+
+HRESULT AudioPlay::TimeStretchSource::LeavePassthrough()
+{
+	HRESULT hr = Fill(continuation, continuation + hopFrames); HR_FAIL(hr);
+
+	// As if the frames passed through so far were the first half of a segment starting hopFrames earlier
+	ApplyWindow(fallWindow, FramesAt(continuation), tail, hopFrames * format.channels);
+
+	analysisPosition = static_cast<double>(continuation) - hopFrames;
+	passthrough = false;
+
+	return hr;
+}
+
+HRESULT AudioPlay::TimeStretchSource::NextSegment(_In_ float segmentRate)
+{
+	HRESULT hr = S_OK;
+
+	UINT32 hopSamples = hopFrames * format.channels;
+
+	analysisPosition += hopFrames * static_cast<double>(segmentRate);
+
+	double lowest = analysisPosition - searchFrames;
+	double highest = analysisPosition + searchFrames;
+
+	// Frames before inputStart are gone, they were before a seek or skipped at a high rate
+	UINT64 low = lowest <= static_cast<double>(inputStart) ? inputStart : static_cast<UINT64>(lowest);
+	UINT64 high = highest <= static_cast<double>(low) ? low : static_cast<UINT64>(highest);
+
+	UINT64 from = low < continuation ? low : continuation;
+	UINT64 to = high + segmentFrames > continuation + hopFrames ? high + segmentFrames : continuation + hopFrames;
+
+	hr = Fill(from, to); HR_FAIL(hr);
+
+	UINT64 start = FindSegment(low, high);
+	const float* segment = FramesAt(start);
+
+	// The block starts with the continuation at full weight and crossfades into the new segment
+	Mark(continuation, segmentRate);
+
+	OverlapAdd(tail, riseWindow, segment, block, hopSamples);
+	ApplyWindow(fallWindow, segment + hopSamples, tail, hopSamples);
+
+	blockOffset = 0;
+	blockFrames = hopFrames;
+	continuation = start + hopFrames;
+
+	// Only silence is left to overlap
+	if (sourceEnd != unknownEnd && start >= sourceEnd)
+	{
+		finished = true;
+	}
+
+	return hr;
+}
+
+HRESULT AudioPlay::TimeStretchSource::PassThrough(_Out_writes_(frameCount * format.channels) float* buffer, _In_ UINT32 frameCount, _Out_ UINT32& framesRead)
+{
+	HRESULT hr = S_OK;
+
+	UINT32 channels = format.channels;
+
+	framesRead = 0;
+
+	// Frames buffered for the segment search come first, the source continues after them
+	UINT64 bufferedEnd = inputStart + inputFrames;
+	if (sourceEnd != unknownEnd && bufferedEnd > sourceEnd)
+	{
+		bufferedEnd = sourceEnd;
+	}
+
+	if (continuation < bufferedEnd)
+	{
+		UINT64 available = bufferedEnd - continuation;
+		UINT32 count = available < frameCount ? static_cast<UINT32>(available) : frameCount;
+
+		memcpy(buffer, FramesAt(continuation), static_cast<size_t>(count) * channels * sizeof(float));
+
+		continuation += count;
+		framesRead = count;
+	}
+
+	if (framesRead == frameCount || sourceEnd != unknownEnd)
+	{
+		return hr;
+	}
+
+	UINT32 wanted = frameCount - framesRead;
+	UINT32 sourceRead = 0;
+
+	hr = source->Read(buffer + static_cast<size_t>(framesRead) * channels, wanted, sourceRead); HR_FAIL(hr);
+
+	continuation += sourceRead;
+	framesRead += sourceRead;
+
+	if (sourceRead < wanted)
+	{
+		sourceEnd = continuation;
+	}
+
+	inputStart = continuation;
+	inputFrames = 0;
+
+	return hr;
+}
+
+HRESULT AudioPlay::TimeStretchSource::Read(_Out_writes_(frameCount * format.channels) float* buffer, _In_ UINT32 frameCount, _Out_ UINT32& framesRead)
+{
+	HRESULT hr = S_OK;
+
+	UINT32 channels = format.channels;
+
+	framesRead = 0;
+
+	while (framesRead < frameCount)
+	{
+		float* output = buffer + static_cast<size_t>(framesRead) * channels;
+		UINT32 wanted = frameCount - framesRead;
+
+		if (blockOffset < blockFrames)
+		{
+			UINT32 available = blockFrames - blockOffset;
+			UINT32 count = available < wanted ? available : wanted;
+
+			memcpy(output, block + static_cast<size_t>(blockOffset) * channels, static_cast<size_t>(count) * channels * sizeof(float));
+
+			blockOffset += count;
+			framesRead += count;
+			outputPosition += count;
+			continue;
+		}
+
+		if (finished)
+		{
+			break;
+		}
+
+		float segmentRate = rate.load(std::memory_order_relaxed);
+
+		if (passthrough && segmentRate == 1.0f)
+		{
+			UINT32 passed = 0;
+
+			hr = PassThrough(output, wanted, passed); HR_FAIL(hr);
+
+			framesRead += passed;
+			outputPosition += passed;
+
+			if (passed < wanted)
+			{
+				finished = true;
+			}
+			continue;
+		}
+
+		if (passthrough)
+		{
+			hr = LeavePassthrough(); HR_FAIL(hr);
+		}
+		else if (segmentRate == 1.0f)
+		{
+			// The tail plus the rising half of the natural continuation is the continuation itself
+			passthrough = true;
+			Mark(continuation, 1.0f);
+			continue;
+		}
+
+		hr = NextSegment(segmentRate); HR_FAIL(hr);
+	}
+
+	return hr;
+}
+
+HRESULT AudioPlay::TimeStretchSource::Seek(_In_ UINT64 frame)
+{
+	HRESULT hr = source->Seek(frame); HR_FAIL(hr);
+
+	inputStart = frame;
+	inputFrames = 0;
+	sourceEnd = unknownEnd;
+	continuation = frame;
+	blockOffset = 0;
+	blockFrames = 0;
+	passthrough = true;
+	finished = false;
+	outputPosition = frame;
+
+	Mark(frame, 1.0f);
+
+	return hr;
+}
+
+HRESULT AudioPlay::TimeStretchSource::GetPosition(_Out_ UINT64& frame) const
+{
+	frame = GetInputPosition(outputPosition);
+
+	// The last segments overlap silence after the end
+	if (frame > sourceEnd)
+	{
+		frame = sourceEnd;
+	}
+
+	return S_OK;
+}
+
+HRESULT AudioPlay::TimeStretchSource::GetLength(_Out_ UINT64& frames) const
+{
+	return source->GetLength(frames);
+}
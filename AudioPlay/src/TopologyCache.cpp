@@ -0,0 +1,342 @@
+#include "TopologyCache.h"
+#include "AutoCriticalSection.h"
+
+#include <algorithm>
+#include <new>
+
+
+#define HR_FAIL_ACTION(hresult, action) if (FAILED(hresult)) { action; return hresult; }
+#define HR_FAIL(hresult) if (FAILED(hresult)) { return hresult; }
+
+
+namespace
+{
+	// Every topology gets its own copy, transforms may hold on to the type they were given
+	HRESULT CloneMediaType(_In_ IMFMediaType* source, _COM_Outptr_ IMFMediaType** pPtrType)
+	{
+		*pPtrType = nullptr;
+
+		AudioPlay::ComPtr<IMFMediaType> type;
+
+		HRESULT hr = MFCreateMediaType(&type); HR_FAIL(hr);
+		hr = source->CopyAllItems(type); HR_FAIL(hr);
+
+		*pPtrType = type.Detach();
+
+		return hr;
+	}
+
+	HRESULT GetStreamType(_In_ IMFStreamDescriptor* streamDescriptor, _COM_Outptr_ IMFMediaType** pPtrType)
+	{
+		*pPtrType = nullptr;
+
+		AudioPlay::ComPtr<IMFMediaTypeHandler> typeHandler;
+
+		HRESULT hr = streamDescriptor->GetMediaTypeHandler(&typeHandler); HR_FAIL(hr);
+
+		// Sources don't have to set a current type before the topology is resolved
+		if (FAILED(typeHandler->GetCurrentMediaType(pPtrType)))
+		{
+			hr = typeHandler->GetMediaTypeByIndex(0, pPtrType); HR_FAIL(hr);
+		}
+
+		return hr;
+	}
+}
+
+
+AudioPlay::TopologyCache::TopologyCache() :
+	statistics{ }
+{
+	InitializeCriticalSection(&criticalSection);
+}
+
+AudioPlay::TopologyCache::~TopologyCache()
+{
+	DeleteCriticalSection(&criticalSection);
+}
+
+AudioPlay::TopologyCache& AudioPlay::TopologyCache::Get()
+{
+	static TopologyCache instance;
+
+	return instance;
+}
+
+HRESULT AudioPlay::TopologyCache::MakeKey(_In_ IMFStreamDescriptor* streamDescriptor, _In_ bool offline, _Out_ TopologyKey& key)
+{
+	key = { };
+
+	if (streamDescriptor == nullptr)
+	{
+		return E_POINTER;
+	}
+
+	ComPtr<IMFMediaType> type;
+
+	HRESULT hr = GetStreamType(streamDescriptor, &type); HR_FAIL(hr);
+
+	hr = type->GetGUID(MF_MT_SUBTYPE, &key.subtype); HR_FAIL(hr);
+
+	key.sampleRate = MFGetAttributeUINT32(type, MF_MT_AUDIO_SAMPLES_PER_SECOND, 0);
+	key.channels = MFGetAttributeUINT32(type, MF_MT_AUDIO_NUM_CHANNELS, 0);
+	key.bitsPerSample = MFGetAttributeUINT32(type, MF_MT_AUDIO_BITS_PER_SAMPLE, 0);
+	key.channelMask = MFGetAttributeUINT32(type, MF_MT_AUDIO_CHANNEL_MASK, 0);
+	key.offline = offline;
+
+	return hr;
+}
+
+HRESULT AudioPlay::TopologyCache::Build(_In_ const TopologyKey& key, _In_ IMFStreamDescriptor* streamDescriptor, _In_ IMFTopology* topology,
+	_In_ IMFTopologyNode* sourceNode, _Out_ ComPtr<IMFTopologyNode>& last)
+{
+	last = nullptr;
+
+	std::vector<Step> steps;
+
+	try
+	{
+		AutoCriticalSection lock(&criticalSection);
+
+		auto entry = std::find_if(entries.begin(), entries.end(), [&key](const Entry& other) { return other.key == key; });
+
+		if (entry == entries.end())
+		{
+			statistics.misses++;
+			return S_FALSE;
+		}
+
+		steps = entry->steps;
+
+		std::rotate(entries.begin(), entry, entry + 1);
+		statistics.hits++;
+	}
+	catch (const std::bad_alloc&)
+	{
+		return E_OUTOFMEMORY;
+	}
+
+	// The stream connects straight to the sink
+	if (steps.empty())
+	{
+		last = sourceNode;
+		return S_OK;
+	}
+
+	ComPtr<IMFMediaType> inputType;
+	ComPtr<IMFTopologyNode> nodes[maxSteps];
+
+	HRESULT hr = GetStreamType(streamDescriptor, &inputType);
+
+	for (size_t index = 0; index < steps.size() && SUCCEEDED(hr); index++)
+	{
+		ComPtr<IMFTransform> transform;
+		ComPtr<IMFMediaType> outputType;
+
+		hr = CoCreateInstance(steps[index].clsid, nullptr, CLSCTX_INPROC_SERVER, IID_PPV_ARGS(&transform));
+
+		if (SUCCEEDED(hr))
+		{
+			hr = transform->SetInputType(0, inputType, 0);
+		}
+		if (SUCCEEDED(hr))
+		{
+			hr = CloneMediaType(steps[index].outputType, &outputType);
+		}
+		if (SUCCEEDED(hr))
+		{
+			hr = transform->SetOutputType(0, outputType, 0);
+		}
+		if (SUCCEEDED(hr))
+		{
+			hr = MFCreateTopologyNode(MF_TOPOLOGY_TRANSFORM_NODE, &nodes[index]);
+		}
+		if (SUCCEEDED(hr))
+		{
+			hr = nodes[index]->SetObject(transform);
+		}
+		if (SUCCEEDED(hr))
+		{
+			hr = nodes[index]->SetGUID(MF_TOPONODE_TRANSFORM_OBJECTID, steps[index].clsid);
+		}
+
+		inputType = outputType;
+	}
+
+	size_t added = 0;
+
+	for (; added < steps.size() && SUCCEEDED(hr); added++)
+	{
+		hr = topology->AddNode(nodes[added]);
+
+		if (SUCCEEDED(hr))
+		{
+			hr = (added == 0 ? sourceNode : nodes[added - 1].p)->ConnectOutput(0, nodes[added], 0);
+		}
+	}
+
+	if (FAILED(hr))
+	{
+		// The loader resolves this one from scratch, the entry is dropped so the next open learns it again
+		for (size_t index = 0; index < added; index++)
+		{
+			topology->RemoveNode(nodes[index]);
+		}
+
+		Remove(key);
+
+		return S_FALSE;
+	}
+
+	last = nodes[steps.size() - 1];
+
+	return S_OK;
+}
+
+HRESULT AudioPlay::TopologyCache::Learn(_In_ const TopologyKey& key, _In_ IMFTopology* fullTopology)
+{
+	if (fullTopology == nullptr)
+	{
+		return E_POINTER;
+	}
+
+	ComPtr<IMFCollection> sourceNodes;
+	ComPtr<IUnknown> element;
+	ComPtr<IMFTopologyNode> node;
+
+	HRESULT hr = fullTopology->GetSourceNodeCollection(&sourceNodes); HR_FAIL(hr);
+
+	DWORD sourceCount = 0;
+	hr = sourceNodes->GetElementCount(&sourceCount); HR_FAIL(hr);
+
+	if (sourceCount != 1)
+	{
+		return S_FALSE;
+	}
+
+	hr = sourceNodes->GetElement(0, &element); HR_FAIL(hr);
+	hr = element->QueryInterface(IID_PPV_ARGS(&node)); HR_FAIL(hr);
+
+	std::vector<Step> steps;
+
+	try
+	{
+		for (;;)
+		{
+			ComPtr<IMFTopologyNode> next;
+			DWORD nextInput = 0;
+
+			hr = node->GetOutput(0, &next, &nextInput); HR_FAIL(hr);
+
+			MF_TOPOLOGY_TYPE type = MF_TOPOLOGY_MAX;
+			hr = next->GetNodeType(&type); HR_FAIL(hr);
+
+			if (type == MF_TOPOLOGY_OUTPUT_NODE)
+			{
+				break;
+			}
+
+			// Tees and longer chains aren't worth remembering
+			if (type != MF_TOPOLOGY_TRANSFORM_NODE || steps.size() == maxSteps)
+			{
+				return S_FALSE;
+			}
+
+			ComPtr<IUnknown> object;
+			ComPtr<IMFTransform> transform;
+			ComPtr<IMFMediaType> outputType;
+
+			hr = next->GetObject(&object); HR_FAIL(hr);
+			hr = object->QueryInterface(IID_PPV_ARGS(&transform)); HR_FAIL(hr);
+
+			Step step = { };
+
+			// The loader sets the CLSID of the transforms it adds, DMO wrappers also tell it through IPersist
+			if (FAILED(next->GetGUID(MF_TOPONODE_TRANSFORM_OBJECTID, &step.clsid)))
+			{
+				ComPtr<IPersist> persist;
+
+				if (FAILED(object->QueryInterface(IID_PPV_ARGS(&persist))) || FAILED(persist->GetClassID(&step.clsid)))
+				{
+					return S_FALSE;
+				}
+			}
+
+			hr = transform->GetOutputCurrentType(0, &outputType); HR_FAIL(hr);
+			hr = CloneMediaType(outputType, &step.outputType); HR_FAIL(hr);
+
+			steps.push_back(step);
+
+			node = next;
+		}
+
+		AutoCriticalSection lock(&criticalSection);
+
+		auto entry = std::find_if(entries.begin(), entries.end(), [&key](const Entry& other) { return other.key == key; });
+
+		if (entry != entries.end())
+		{
+			entries.erase(entry);
+		}
+		else if (entries.size() == maxEntries)
+		{
+			entries.pop_back();
+		}
+
+		entries.insert(entries.begin(), Entry{ key, std::move(steps) });
+		statistics.learned++;
+	}
+	catch (const std::bad_alloc&)
+	{
+		return E_OUTOFMEMORY;
+	}
+
+	return S_OK;
+}
+
+void AudioPlay::TopologyCache::Remove(_In_ const TopologyKey& key)
+{
+	AutoCriticalSection lock(&criticalSection);
+
+	auto entry = std::find_if(entries.begin(), entries.end(), [&key](const Entry& other) { return other.key == key; });
+
+	if (entry != entries.end())
+	{
+		entries.erase(entry);
+	}
+
+	statistics.failures++;
+}
+
+void AudioPlay::TopologyCache::Clear()
+{
+	AutoCriticalSection lock(&criticalSection);
+
+	entries.clear();
+}
+
+void AudioPlay::TopologyCache::RecordOpen(_In_ std::chrono::microseconds latency, _In_ bool cached)
+{
+	AutoCriticalSection lock(&criticalSection);
+
+	if (cached)
+	{
+		statistics.cachedOpens++;
+		statistics.cachedOpenMicroseconds += latency.count();
+	}
+	else
+	{
+		statistics.uncachedOpens++;
+		statistics.uncachedOpenMicroseconds += latency.count();
+	}
+}
+
+AudioPlay::TopologyCacheStatistics AudioPlay::TopologyCache::GetStatistics()
+{
+	AutoCriticalSection lock(&criticalSection);
+
+	TopologyCacheStatistics result = statistics;
+	result.entryCount = static_cast<UINT32>(entries.size());
+
+	return result;
+}
@@ -0,0 +1,234 @@
+#include "TraceReplayer.h"
+
+#include <algorithm>
+#include <new>
+#include <unordered_map>
+
+
+#define HR_FAIL_ACTION(hresult, action) if (FAILED(hresult)) { action; return hresult; }
+#define HR_FAIL(hresult) if (FAILED(hresult)) { return hresult; }
+
+
+using std::chrono::duration_cast;
+using std::chrono::milliseconds;
+using std::chrono::nanoseconds;
+using std::chrono::steady_clock;
+
+
+using namespace std::chrono_literals;
+
+
+namespace
+{
+	using AudioPlay::AudioStateMachine;
+	using AudioPlay::AudioStates;
+	using AudioPlay::EventTraceCommand;
+	using AudioPlay::EventTraceRecord;
+
+	HRESULT IssueCommand(_In_ AudioStateMachine& stateMachine, _In_ const EventTraceRecord& record, _Out_ HRESULT& result)
+	{
+		result = S_OK;
+
+		switch (static_cast<EventTraceCommand>(record.code))
+		{
+			case EventTraceCommand::Open: stateMachine.OnOpening(record.argument != 0); break;
+			case EventTraceCommand::Start: result = stateMachine.Start(); break;
+			case EventTraceCommand::StartAt: result = stateMachine.Start(milliseconds(record.argument)); break;
+			case EventTraceCommand::Pause: result = stateMachine.Pause(); break;
+			case EventTraceCommand::Stop: result = stateMachine.Stop(); break;
+			case EventTraceCommand::Seek: result = stateMachine.Seek(milliseconds(record.argument)); break;
+			case EventTraceCommand::Close: result = stateMachine.Close(); break;
+			case EventTraceCommand::SetState: stateMachine.SetState(static_cast<AudioStates>(record.argument)); break;
+			case EventTraceCommand::SetLoop: stateMachine.SetLoop(record.argument != 0); break;
+			case EventTraceCommand::ResetPosition: stateMachine.ResetPosition(); break;
+			default: return HRESULT_FROM_WIN32(ERROR_INVALID_DATA);
+		}
+
+		return S_OK;
+	}
+}
+
+
+HRESULT AudioPlay::ReplayEventTrace(_In_ const std::vector<EventTraceRecord>& records, _In_ const TraceReplayOptions& options, _Out_ TraceReplayResult& result)
+{
+	result = { };
+	result.firstMismatch = EventTraceRecorder::noCause;
+
+	auto first = std::find_if(records.begin(), records.end(), [](const EventTraceRecord& record)
+		{
+			return record.kind == EventTraceKind::Command && static_cast<EventTraceCommand>(record.code) == EventTraceCommand::Open;
+		});
+
+	result.skippedRecords = first - records.begin();
+
+	if (first == records.end())
+	{
+		return S_FALSE;
+	}
+
+	VirtualClock clock;
+	ScriptedSession session(clock);
+	AudioStateMachine stateMachine(&session);
+
+	session.SetTarget(&stateMachine);
+	session.SetAnswerCommands(false);
+
+	const size_t begin = first - records.begin();
+	const UINT64 origin = first->timestamp;
+
+	std::vector<UINT64> replayTimes;
+
+	try
+	{
+		replayTimes.resize(records.size());
+	}
+	catch (const std::bad_alloc&)
+	{
+		return E_OUTOFMEMORY;
+	}
+
+	size_t end = begin;
+	auto replayStart = steady_clock::now();
+
+	for (; end < records.size() && records[end].sequence <= options.lastSequence; end++)
+	{
+		const EventTraceRecord& record = records[end];
+
+		// Handler records start before the event was recorded, they are only used for profiling
+		if (record.kind == EventTraceKind::Handler)
+		{
+			continue;
+		}
+
+		nanoseconds recordTime(record.timestamp > origin ? record.timestamp - origin : 0);
+
+		if (recordTime > clock.Now())
+		{
+			session.RunFor(recordTime - clock.Now());
+		}
+
+		HRESULT commandResult = S_OK;
+		bool resultMatches = true;
+
+		if (record.kind == EventTraceKind::Command)
+		{
+			// A failure the session returned is returned again, failures of the state machine itself come back on their own
+			session.SetCommandResult(FAILED(record.status) ? record.status : S_OK);
+
+			HRESULT hr = IssueCommand(stateMachine, record, commandResult); HR_FAIL(hr);
+
+			resultMatches = commandResult == record.status;
+
+			result.commands++;
+		}
+		else if (record.kind == EventTraceKind::Event)
+		{
+			// A restart after MESessionEnded goes to the session from inside the state machine
+			session.SetCommandResult(S_OK);
+			session.Post(record.code, 0ns, record.status);
+
+			auto handleStart = steady_clock::now();
+			session.RunFor(0ns);
+			replayTimes[end] = duration_cast<nanoseconds>(steady_clock::now() - handleStart).count();
+
+			result.events++;
+		}
+		else
+		{
+			return HRESULT_FROM_WIN32(ERROR_INVALID_DATA);
+		}
+
+		bool stateMatches = static_cast<UINT32>(stateMachine.GetState()) == record.state;
+
+		result.stateMismatches += stateMatches ? 0 : 1;
+		result.resultMismatches += resultMatches ? 0 : 1;
+
+		if ((!stateMatches || !resultMatches) && result.firstMismatch == EventTraceRecorder::noCause)
+		{
+			result.firstMismatch = record.sequence;
+		}
+
+		result.replayedRecords++;
+	}
+
+	result.replayNanoseconds = duration_cast<nanoseconds>(steady_clock::now() - replayStart).count();
+	result.virtualNanoseconds = clock.Now().count();
+
+	try
+	{
+		std::unordered_map<UINT32, size_t> commands;
+
+		for (size_t index = begin; index < end; index++)
+		{
+			const EventTraceRecord& record = records[index];
+
+			if (record.kind == EventTraceKind::Command)
+			{
+				commands[record.sequence] = index;
+				continue;
+			}
+
+			if (record.kind != EventTraceKind::Event || record.cause == EventTraceRecorder::noCause)
+			{
+				continue;
+			}
+
+			auto command = commands.find(record.cause);
+
+			if (command == commands.end())
+			{
+				continue;
+			}
+
+			const EventTraceRecord& commandRecord = records[command->second];
+
+			TraceTransition transition = { };
+			transition.commandSequence = commandRecord.sequence;
+			transition.eventSequence = record.sequence;
+			transition.command = static_cast<EventTraceCommand>(commandRecord.code);
+			transition.eventType = record.code;
+			transition.latencyNanoseconds = record.timestamp > commandRecord.timestamp ? record.timestamp - commandRecord.timestamp : 0;
+			transition.replayNanoseconds = replayTimes[index];
+
+			if (transition.latencyNanoseconds < static_cast<UINT64>(options.slowThreshold.count()))
+			{
+				continue;
+			}
+
+			// Audio::Invoke records its handler after the callback, before it sees the next event
+			for (size_t next = index + 1; next < end && records[next].kind != EventTraceKind::Event; next++)
+			{
+				if (records[next].kind == EventTraceKind::Handler && records[next].code == record.code)
+				{
+					transition.handlerNanoseconds = records[next].argument > 0 ? static_cast<UINT64>(records[next].argument) : 0;
+					break;
+				}
+			}
+
+			result.transitions.push_back(transition);
+		}
+
+		std::sort(result.transitions.begin(), result.transitions.end(), [](const TraceTransition& lhs, const TraceTransition& rhs)
+			{
+				return lhs.latencyNanoseconds > rhs.latencyNanoseconds;
+			});
+	}
+	catch (const std::bad_alloc&)
+	{
+		return E_OUTOFMEMORY;
+	}
+
+	return S_OK;
+}
+
+HRESULT AudioPlay::ReplayEventTrace(_In_z_ LPCWCH path, _In_ const TraceReplayOptions& options, _Out_ TraceReplayResult& result)
+{
+	result = { };
+	result.firstMismatch = EventTraceRecorder::noCause;
+
+	std::vector<EventTraceRecord> records;
+
+	HRESULT hr = LoadEventTrace(path, records); HR_FAIL(hr);
+
+	return ReplayEventTrace(records, options, result);
+}
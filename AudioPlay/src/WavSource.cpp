@@ -0,0 +1,590 @@
+#include "WavSource.h"
+#include "Simd.h"
+
+#include <cmath>
+#include <cstring>
+#include <new>
+
+
+#define HR_FAIL_ACTION(hresult, action) if (FAILED(hresult)) { action; return hresult; }
+#define HR_FAIL(hresult) if (FAILED(hresult)) { return hresult; }
+
+
+namespace
+{
+	constexpr WORD waveFormatPcm = 0x0001;
+	constexpr WORD waveFormatIeeeFloat = 0x0003;
+	constexpr WORD waveFormatExtensible = 0xFFFE;
+
+	// Frames converted per step of Read, small enough to stay in the cache
+	constexpr UINT32 convertFrames = 1024;
+
+	// The convert kernels don't apply gains
+	const AudioPlay::PcmChannelGains unityGains = { { 1.0f, 1.0f, 1.0f, 1.0f, 1.0f, 1.0f, 1.0f, 1.0f } };
+
+	inline bool HasTag(_In_reads_bytes_(4) const BYTE* data, _In_reads_(4) const char* tag)
+	{
+		return memcmp(data, tag, 4) == 0;
+	}
+
+	inline UINT16 ReadUInt16LE(_In_reads_bytes_(2) const BYTE* data)
+	{
+		return static_cast<UINT16>(data[0] | (data[1] << 8));
+	}
+	inline UINT32 ReadUInt32LE(_In_reads_bytes_(4) const BYTE* data)
+	{
+		return static_cast<UINT32>(data[0]) | (static_cast<UINT32>(data[1]) << 8) | (static_cast<UINT32>(data[2]) << 16) | (static_cast<UINT32>(data[3]) << 24);
+	}
+	inline UINT64 ReadUInt64LE(_In_reads_bytes_(8) const BYTE* data)
+	{
+		return static_cast<UINT64>(ReadUInt32LE(data)) | (static_cast<UINT64>(ReadUInt32LE(data + 4)) << 32);
+	}
+	inline UINT16 ReadUInt16BE(_In_reads_bytes_(2) const BYTE* data)
+	{
+		return static_cast<UINT16>((data[0] << 8) | data[1]);
+	}
+	inline UINT32 ReadUInt32BE(_In_reads_bytes_(4) const BYTE* data)
+	{
+		return (static_cast<UINT32>(data[0]) << 24) | (static_cast<UINT32>(data[1]) << 16) | (static_cast<UINT32>(data[2]) << 8) | static_cast<UINT32>(data[3]);
+	}
+
+	// AIFF stores the sample rate as an 80 bit IEEE extended float
+	double ReadExtended(_In_reads_bytes_(10) const BYTE* data)
+	{
+		int exponent = ((data[0] & 0x7F) << 8) | data[1];
+		UINT64 mantissa = (static_cast<UINT64>(ReadUInt32BE(data + 2)) << 32) | ReadUInt32BE(data + 6);
+
+		if (exponent == 0 && mantissa == 0)
+		{
+			return 0.0;
+		}
+
+		double value = std::ldexp(static_cast<double>(mantissa), exponent - 16383 - 63);
+
+		return (data[0] & 0x80) ? -value : value;
+	}
+
+	UINT32 BytesPerSample(AudioPlay::SampleEncoding encoding)
+	{
+		switch (encoding)
+		{
+			case AudioPlay::SampleEncoding::UInt8:
+			case AudioPlay::SampleEncoding::Int8:
+				return 1;
+			case AudioPlay::SampleEncoding::Int16:
+				return 2;
+			case AudioPlay::SampleEncoding::Int24:
+				return 3;
+			case AudioPlay::SampleEncoding::Int32:
+			case AudioPlay::SampleEncoding::Float32:
+				return 4;
+			case AudioPlay::SampleEncoding::Float64:
+				return 8;
+		}
+		return 0;
+	}
+
+	HRESULT EncodingFromBits(_In_ UINT32 bits, _In_ bool isFloat, _In_ bool signed8, _Out_ AudioPlay::SampleEncoding& encoding)
+	{
+		if (isFloat)
+		{
+			switch (bits)
+			{
+				case 32: encoding = AudioPlay::SampleEncoding::Float32; return S_OK;
+				case 64: encoding = AudioPlay::SampleEncoding::Float64; return S_OK;
+			}
+			return AUDIO_E_UNSUPPORTED_FORMAT;
+		}
+
+		// Samples are left aligned in their container, 20 bits are stored in 24
+		switch ((bits + 7) / 8)
+		{
+			case 1: encoding = signed8 ? AudioPlay::SampleEncoding::Int8 : AudioPlay::SampleEncoding::UInt8; return S_OK;
+			case 2: encoding = AudioPlay::SampleEncoding::Int16; return S_OK;
+			case 3: encoding = AudioPlay::SampleEncoding::Int24; return S_OK;
+			case 4: encoding = AudioPlay::SampleEncoding::Int32; return S_OK;
+		}
+		return AUDIO_E_UNSUPPORTED_FORMAT;
+	}
+
+	void ConvertInt16LE(_In_ const BYTE* source, _Out_writes_(count) float* destination, _In_ size_t count)
+	{
+		const float scale = 1.0f / 32768.0f;
+		size_t index = 0;
+
+		#ifdef AUDIOPLAY_SSE2
+		const __m128 scaleVector = _mm_set1_ps(scale);
+
+		for (; index + 8 <= count; index += 8)
+		{
+			__m128i samples = _mm_loadu_si128(reinterpret_cast<const __m128i*>(source + index * 2));
+
+			// Puts every sample in the upper half of a 32 bit lane, the arithmetic shift sign extends it
+			__m128i low = _mm_srai_epi32(_mm_unpacklo_epi16(samples, samples), 16);
+			__m128i high = _mm_srai_epi32(_mm_unpackhi_epi16(samples, samples), 16);
+
+			_mm_storeu_ps(destination + index, _mm_mul_ps(_mm_cvtepi32_ps(low), scaleVector));
+			_mm_storeu_ps(destination + index + 4, _mm_mul_ps(_mm_cvtepi32_ps(high), scaleVector));
+		}
+		#endif
+
+		for (; index < count; index++)
+		{
+			destination[index] = static_cast<INT16>(ReadUInt16LE(source + index * 2)) * scale;
+		}
+	}
+}
+
+void AudioPlay::ConvertSamples(_In_ const SampleLayout& layout, _In_ const BYTE* source, _Out_writes_(sampleCount) float* destination, _In_ size_t sampleCount)
+{
+	switch (layout.encoding)
+	{
+		case SampleEncoding::UInt8:
+		{
+			for (size_t index = 0; index < sampleCount; index++)
+			{
+				destination[index] = (static_cast<int>(source[index]) - 128) * (1.0f / 128.0f);
+			}
+			break;
+		}
+		case SampleEncoding::Int8:
+		{
+			for (size_t index = 0; index < sampleCount; index++)
+			{
+				destination[index] = static_cast<signed char>(source[index]) * (1.0f / 128.0f);
+			}
+			break;
+		}
+		case SampleEncoding::Int16:
+		{
+			if (!layout.bigEndian)
+			{
+				ConvertInt16LE(source, destination, sampleCount);
+				break;
+			}
+
+			for (size_t index = 0; index < sampleCount; index++)
+			{
+				destination[index] = static_cast<INT16>(ReadUInt16BE(source + index * 2)) * (1.0f / 32768.0f);
+			}
+			break;
+		}
+		case SampleEncoding::Int24:
+		{
+			for (size_t index = 0; index < sampleCount; index++)
+			{
+				const BYTE* sample = source + index * 3;
+				UINT32 value = layout.bigEndian ?
+					(static_cast<UINT32>(sample[0]) << 24) | (static_cast<UINT32>(sample[1]) << 16) | (static_cast<UINT32>(sample[2]) << 8) :
+					(static_cast<UINT32>(sample[2]) << 24) | (static_cast<UINT32>(sample[1]) << 16) | (static_cast<UINT32>(sample[0]) << 8);
+
+				destination[index] = static_cast<INT32>(value) * (1.0f / 2147483648.0f);
+			}
+			break;
+		}
+		case SampleEncoding::Int32:
+		{
+			for (size_t index = 0; index < sampleCount; index++)
+			{
+				UINT32 value = layout.bigEndian ? ReadUInt32BE(source + index * 4) : ReadUInt32LE(source + index * 4);
+				destination[index] = static_cast<INT32>(value) * (1.0f / 2147483648.0f);
+			}
+			break;
+		}
+		case SampleEncoding::Float32:
+		{
+			if (!layout.bigEndian)
+			{
+				memcpy(destination, source, sampleCount * sizeof(float));
+				break;
+			}
+
+			for (size_t index = 0; index < sampleCount; index++)
+			{
+				UINT32 bits = ReadUInt32BE(source + index * 4);
+				memcpy(destination + index, &bits, sizeof(float));
+			}
+			break;
+		}
+		case SampleEncoding::Float64:
+		{
+			for (size_t index = 0; index < sampleCount; index++)
+			{
+				const BYTE* sample = source + index * 8;
+				UINT64 bits = layout.bigEndian ?
+					(static_cast<UINT64>(ReadUInt32BE(sample)) << 32) | ReadUInt32BE(sample + 4) :
+					ReadUInt64LE(sample);
+
+				double value;
+				memcpy(&value, &bits, sizeof(double));
+				destination[index] = static_cast<float>(value);
+			}
+			break;
+		}
+	}
+}
+
+AudioPlay::WavSource::WavSource() :
+	layout{ SampleEncoding::Int16, false, 0 }, frames(nullptr), frameCount(0), position(0), convertKernel(nullptr)
+{
+}
+
+AudioPlay::WavSource::~WavSource()
+{
+}
+
+HRESULT AudioPlay::WavSource::Open(_In_z_ LPCWCH path, _COM_Outptr_ WavSource** pPtrSource)
+{
+	if (pPtrSource == nullptr)
+	{
+		return E_INVALIDARG;
+	}
+	*pPtrSource = nullptr;
+
+	ComPtr<MappedFile> mappedFile;
+
+	HRESULT hr = MappedFile::Open(path, &mappedFile); HR_FAIL(hr);
+
+	return Create(mappedFile, pPtrSource);
+}
+
+bool AudioPlay::WavSource::CanRead(_In_reads_bytes_(size) const BYTE* data, _In_ UINT64 size)
+{
+	if (data == nullptr || size < 12)
+	{
+		return false;
+	}
+
+	bool riff = (HasTag(data, "RIFF") || HasTag(data, "RF64") || HasTag(data, "BW64")) && HasTag(data + 8, "WAVE");
+	bool aiff = HasTag(data, "FORM") && (HasTag(data + 8, "AIFF") || HasTag(data + 8, "AIFC"));
+
+	return riff || aiff;
+}
+
+HRESULT AudioPlay::WavSource::Create(_In_ MemoryBlock* block, _COM_Outptr_ WavSource** pPtrSource)
+{
+	if (pPtrSource == nullptr)
+	{
+		return E_INVALIDARG;
+	}
+	*pPtrSource = nullptr;
+
+	if (block == nullptr)
+	{
+		return E_POINTER;
+	}
+
+	const BYTE* data = block->GetData();
+	UINT64 size = block->GetSize();
+
+	if (!CanRead(data, size))
+	{
+		return AUDIO_E_UNSUPPORTED_FORMAT;
+	}
+
+	ComPtr<WavSource> source;
+	source.Attach(new (std::nothrow) WavSource());
+
+	if (!source)
+	{
+		return E_OUTOFMEMORY;
+	}
+
+	source->block = block;
+
+	HRESULT hr = HasTag(data, "FORM") ? source->ParseAiff(data, size) : source->ParseRiff(data, size); HR_FAIL(hr);
+
+	if (!source->layout.bigEndian)
+	{
+		source->convertKernel = SelectPcmPipeline({ source->layout.encoding, source->format.channels, PcmLayout::Interleaved, PcmStages::Convert });
+	}
+
+	*pPtrSource = source.Detach();
+
+	return hr;
+}
+
+HRESULT AudioPlay::WavSource::ParseRiff(_In_reads_bytes_(size) const BYTE* data, _In_ UINT64 size)
+{
+	bool rf64 = !HasTag(data, "RIFF");
+	UINT64 ds64DataSize = 0;
+
+	bool formatFound = false;
+	const BYTE* dataChunk = nullptr;
+	UINT64 dataSize = 0;
+
+	UINT32 bitsPerSample = 0;
+	WORD formatTag = 0;
+
+	UINT64 offset = 12;
+
+	while (offset + 8 <= size)
+	{
+		const BYTE* chunk = data + offset;
+		UINT64 chunkSize = ReadUInt32LE(chunk + 4);
+		const BYTE* body = chunk + 8;
+		UINT64 available = size - offset - 8;
+
+		if (HasTag(chunk, "ds64"))
+		{
+			if (chunkSize < 24 || available < 24)
+			{
+				return AUDIO_E_INVALID_FORMAT;
+			}
+
+			ds64DataSize = ReadUInt64LE(body + 8);
+		}
+		else if (HasTag(chunk, "fmt "))
+		{
+			if (chunkSize < 16 || available < 16)
+			{
+				return AUDIO_E_INVALID_FORMAT;
+			}
+
+			formatTag = ReadUInt16LE(body);
+			format.channels = ReadUInt16LE(body + 2);
+			format.sampleRate = ReadUInt32LE(body + 4);
+			layout.blockAlign = ReadUInt16LE(body + 12);
+			bitsPerSample = ReadUInt16LE(body + 14);
+
+			if (formatTag == waveFormatExtensible)
+			{
+				if (chunkSize < 40 || available < 40)
+				{
+					return AUDIO_E_INVALID_FORMAT;
+				}
+
+				// The first two bytes of the sub format GUID are the actual format tag
+				formatTag = ReadUInt16LE(body + 24);
+			}
+
+			formatFound = true;
+		}
+		else if (HasTag(chunk, "data"))
+		{
+			dataChunk = body;
+			dataSize = (rf64 && chunkSize == 0xFFFFFFFF) ? ds64DataSize : chunkSize;
+
+			// Truncated files play up to where they end
+			dataSize = dataSize < available ? dataSize : available;
+
+			// Nothing after the data chunk is needed and RF64 data can be larger than the 32 bit chunk size says
+			break;
+		}
+
+		// Chunks are padded to an even size
+		offset += 8 + chunkSize + (chunkSize & 1);
+	}
+
+	if (!formatFound || dataChunk == nullptr)
+	{
+		return AUDIO_E_INVALID_FORMAT;
+	}
+	if (formatTag != waveFormatPcm && formatTag != waveFormatIeeeFloat)
+	{
+		return AUDIO_E_UNSUPPORTED_FORMAT;
+	}
+
+	HRESULT hr = EncodingFromBits(bitsPerSample, formatTag == waveFormatIeeeFloat, false, layout.encoding); HR_FAIL(hr);
+
+	layout.bigEndian = false;
+
+	if (format.channels == 0 || format.sampleRate == 0 || layout.blockAlign != format.channels * BytesPerSample(layout.encoding))
+	{
+		return AUDIO_E_INVALID_FORMAT;
+	}
+
+	frames = dataChunk;
+	frameCount = dataSize / layout.blockAlign;
+
+	return hr;
+}
+
+HRESULT AudioPlay::WavSource::ParseAiff(_In_reads_bytes_(size) const BYTE* data, _In_ UINT64 size)
+{
+	bool aifc = HasTag(data + 8, "AIFC");
+
+	bool commonFound = false;
+	const BYTE* soundData = nullptr;
+	UINT64 soundSize = 0;
+
+	UINT32 bitsPerSample = 0;
+	UINT32 declaredFrames = 0;
+	bool isFloat = false;
+
+	layout.bigEndian = true;
+
+	UINT64 offset = 12;
+
+	while (offset + 8 <= size)
+	{
+		const BYTE* chunk = data + offset;
+		UINT64 chunkSize = ReadUInt32BE(chunk + 4);
+		const BYTE* body = chunk + 8;
+		UINT64 available = size - offset - 8;
+
+		if (HasTag(chunk, "COMM"))
+		{
+			if (chunkSize < 18 || available < 18)
+			{
+				return AUDIO_E_INVALID_FORMAT;
+			}
+
+			format.channels = ReadUInt16BE(body);
+			declaredFrames = ReadUInt32BE(body + 2);
+			bitsPerSample = ReadUInt16BE(body + 6);
+
+			double sampleRate = ReadExtended(body + 8);
+			format.sampleRate = sampleRate > 0.0 && sampleRate < 4294967295.0 ? static_cast<UINT32>(sampleRate + 0.5) : 0;
+
+			if (aifc)
+			{
+				if (chunkSize < 22 || available < 22)
+				{
+					return AUDIO_E_INVALID_FORMAT;
+				}
+
+				const BYTE* compression = body + 18;
+
+				if (HasTag(compression, "sowt"))
+				{
+					layout.bigEndian = false;
+				}
+				else if (HasTag(compression, "fl32") || HasTag(compression, "FL32"))
+				{
+					isFloat = true;
+					bitsPerSample = 32;
+				}
+				else if (HasTag(compression, "fl64") || HasTag(compression, "FL64"))
+				{
+					isFloat = true;
+					bitsPerSample = 64;
+				}
+				else if (!HasTag(compression, "NONE") && !HasTag(compression, "twos"))
+				{
+					return AUDIO_E_UNSUPPORTED_FORMAT;
+				}
+			}
+
+			commonFound = true;
+		}
+		else if (HasTag(chunk, "SSND"))
+		{
+			if (chunkSize < 8 || available < 8)
+			{
+				return AUDIO_E_INVALID_FORMAT;
+			}
+
+			UINT32 dataOffset = ReadUInt32BE(body);
+
+			if (8 + static_cast<UINT64>(dataOffset) > chunkSize || 8 + static_cast<UINT64>(dataOffset) > available)
+			{
+				return AUDIO_E_INVALID_FORMAT;
+			}
+
+			soundData = body + 8 + dataOffset;
+			soundSize = chunkSize - 8 - dataOffset;
+
+			UINT64 soundAvailable = available - 8 - dataOffset;
+			soundSize = soundSize < soundAvailable ? soundSize : soundAvailable;
+		}
+
+		offset += 8 + chunkSize + (chunkSize & 1);
+	}
+
+	if (!commonFound || (soundData == nullptr && declaredFrames != 0))
+	{
+		return AUDIO_E_INVALID_FORMAT;
+	}
+
+	HRESULT hr = EncodingFromBits(bitsPerSample, isFloat, true, layout.encoding); HR_FAIL(hr);
+
+	layout.blockAlign = format.channels * BytesPerSample(layout.encoding);
+
+	if (format.channels == 0 || format.sampleRate == 0)
+	{
+		return AUDIO_E_INVALID_FORMAT;
+	}
+
+	frames = soundData;
+	frameCount = soundSize / layout.blockAlign;
+	frameCount = frameCount < declaredFrames ? frameCount : declaredFrames;
+
+	return hr;
+}
+
+HRESULT AudioPlay::WavSource::GetRawFrames(_In_ UINT64 frame, _Inout_ UINT64& count, _Outptr_ const BYTE** pPtrFrames) const
+{
+	if (pPtrFrames == nullptr)
+	{
+		return E_INVALIDARG;
+	}
+	*pPtrFrames = nullptr;
+
+	if (frame > frameCount)
+	{
+		count = 0;
+		return E_INVALIDARG;
+	}
+
+	UINT64 available = frameCount - frame;
+	count = count < available ? count : available;
+
+	*pPtrFrames = frames + frame * layout.blockAlign;
+
+	return S_OK;
+}
+
+HRESULT AudioPlay::WavSource::Read(_Out_writes_(frameCount * format.channels) float* buffer, _In_ UINT32 p_frameCount, _Out_ UINT32& framesRead)
+{
+	UINT64 available = frameCount - position;
+	framesRead = available < p_frameCount ? static_cast<UINT32>(available) : p_frameCount;
+
+	for (UINT32 done = 0; done < framesRead; done += convertFrames)
+	{
+		UINT32 count = framesRead - done < convertFrames ? framesRead - done : convertFrames;
+
+		const BYTE* source = frames + (position + done) * layout.blockAlign;
+		float* destination = buffer + static_cast<size_t>(done) * format.channels;
+
+		if (convertKernel)
+		{
+			const void* planes[] = { source };
+			convertKernel(planes, destination, count, format.channels, unityGains);
+		}
+		else
+		{
+			ConvertSamples(layout, source, destination, static_cast<size_t>(count) * format.channels);
+		}
+	}
+
+	position += framesRead;
+
+	return S_OK;
+}
+
+HRESULT AudioPlay::WavSource::Seek(_In_ UINT64 frame)
+{
+	if (frame > frameCount)
+	{
+		return E_INVALIDARG;
+	}
+
+	position = frame;
+
+	return S_OK;
+}
+
+HRESULT AudioPlay::WavSource::GetPosition(_Out_ UINT64& frame) const
+{
+	frame = position;
+
+	return S_OK;
+}
+
+HRESULT AudioPlay::WavSource::GetLength(_Out_ UINT64& frames) const
+{
+	frames = frameCount;
+
+	return S_OK;
+}
@@ -0,0 +1,243 @@
+#include "WorkStealingPool.h"
+
+#include <new>
+#include <system_error>
+
+
+#define HR_FAIL_ACTION(hresult, action) if (FAILED(hresult)) { action; return hresult; }
+#define HR_FAIL(hresult) if (FAILED(hresult)) { return hresult; }
+
+
+AudioPlay::WorkStealingPool::WorkStealingPool() :
+	referenceCount(1), workers(nullptr), workerCount(0), nextWorker(0), queued(0), pending(0), stopping(false)
+{
+}
+
+AudioPlay::WorkStealingPool::~WorkStealingPool()
+{
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		stopping = true;
+	}
+	wakeCondition.notify_all();
+
+	// The threads leave once the queues are empty
+	for (UINT32 index = 0; index < workerCount; index++)
+	{
+		if (workers[index].thread.joinable())
+		{
+			workers[index].thread.join();
+		}
+	}
+
+	delete[] workers;
+}
+
+HRESULT AudioPlay::WorkStealingPool::Create(_In_ UINT32 threadCount, _COM_Outptr_ WorkStealingPool** pPtrPool)
+{
+	if (pPtrPool == nullptr)
+	{
+		return E_INVALIDARG;
+	}
+	*pPtrPool = nullptr;
+
+	if (threadCount == 0)
+	{
+		threadCount = std::thread::hardware_concurrency();
+		threadCount = threadCount ? threadCount : 1;
+	}
+
+	ComPtr<WorkStealingPool> pool;
+	pool.Attach(new (std::nothrow) WorkStealingPool());
+
+	if (!pool)
+	{
+		return E_OUTOFMEMORY;
+	}
+
+	pool->workers = new (std::nothrow) Worker[threadCount];
+
+	if (pool->workers == nullptr)
+	{
+		return E_OUTOFMEMORY;
+	}
+
+	pool->workerCount = threadCount;
+
+	for (UINT32 index = 0; index < threadCount; index++)
+	{
+		pool->workers[index].executed = 0;
+		pool->workers[index].stolen = 0;
+	}
+
+	// The destructor only joins the threads that started
+	for (UINT32 index = 0; index < threadCount; index++)
+	{
+		try
+		{
+			pool->workers[index].thread = std::thread(&WorkStealingPool::Work, pool.p, index);
+		}
+		catch (const std::system_error&)
+		{
+			return E_OUTOFMEMORY;
+		}
+	}
+
+	*pPtrPool = pool.Detach();
+
+	return S_OK;
+}
+
+ULONG STDMETHODCALLTYPE AudioPlay::WorkStealingPool::AddRef()
+{
+	return ++referenceCount;
+}
+
+ULONG STDMETHODCALLTYPE AudioPlay::WorkStealingPool::Release()
+{
+	ULONG count = --referenceCount;
+	if (count == 0)
+	{
+		delete this;
+	}
+	return count;
+}
+
+HRESULT AudioPlay::WorkStealingPool::Submit(_In_ PoolTask callback, _In_opt_ void* context)
+{
+	if (callback == nullptr)
+	{
+		return E_POINTER;
+	}
+
+	UINT32 target = workerCount;
+	std::thread::id self = std::this_thread::get_id();
+
+	for (UINT32 index = 0; index < workerCount; index++)
+	{
+		if (workers[index].thread.get_id() == self)
+		{
+			target = index;
+			break;
+		}
+	}
+
+	// From outside the pool the queues take turns
+	if (target == workerCount)
+	{
+		target = nextWorker.fetch_add(1, std::memory_order_relaxed) % workerCount;
+	}
+
+	pending.fetch_add(1, std::memory_order_relaxed);
+
+	// Counted before it is queued so taking it never gets ahead of the count
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		queued.fetch_add(1, std::memory_order_relaxed);
+	}
+
+	try
+	{
+		Worker& worker = workers[target];
+		std::lock_guard<std::mutex> lock(worker.mutex);
+		worker.tasks.push_back({ callback, context });
+	}
+	catch (const std::bad_alloc&)
+	{
+		queued.fetch_sub(1, std::memory_order_relaxed);
+		pending.fetch_sub(1, std::memory_order_relaxed);
+		return E_OUTOFMEMORY;
+	}
+
+	wakeCondition.notify_one();
+
+	return S_OK;
+}
+
+bool AudioPlay::WorkStealingPool::Take(_In_ UINT32 index, _Out_ Task& task)
+{
+	{
+		Worker& own = workers[index];
+		std::lock_guard<std::mutex> lock(own.mutex);
+
+		// Newest first, what it submitted last is still in the cache
+		if (!own.tasks.empty())
+		{
+			task = own.tasks.back();
+			own.tasks.pop_back();
+			return true;
+		}
+	}
+
+	for (UINT32 step = 1; step < workerCount; step++)
+	{
+		Worker& victim = workers[(index + step) % workerCount];
+		std::lock_guard<std::mutex> lock(victim.mutex);
+
+		// Oldest first, the owner works from the other end
+		if (!victim.tasks.empty())
+		{
+			task = victim.tasks.front();
+			victim.tasks.pop_front();
+			workers[index].stolen.fetch_add(1, std::memory_order_relaxed);
+			return true;
+		}
+	}
+
+	return false;
+}
+
+void AudioPlay::WorkStealingPool::Work(_In_ UINT32 index)
+{
+	Worker& worker = workers[index];
+
+	while (true)
+	{
+		Task task;
+
+		if (Take(index, task))
+		{
+			queued.fetch_sub(1, std::memory_order_relaxed);
+
+			task.callback(task.context, index);
+
+			worker.executed.fetch_add(1, std::memory_order_relaxed);
+
+			if (pending.fetch_sub(1, std::memory_order_acq_rel) == 1)
+			{
+				std::lock_guard<std::mutex> lock(mutex);
+				idleCondition.notify_all();
+			}
+			continue;
+		}
+
+		std::unique_lock<std::mutex> lock(mutex);
+
+		if (stopping && queued.load(std::memory_order_relaxed) == 0)
+		{
+			return;
+		}
+
+		wakeCondition.wait(lock, [this] { return stopping || queued.load(std::memory_order_relaxed) != 0; });
+	}
+}
+
+void AudioPlay::WorkStealingPool::Wait()
+{
+	std::unique_lock<std::mutex> lock(mutex);
+
+	idleCondition.wait(lock, [this] { return pending.load(std::memory_order_acquire) == 0; });
+}
+
+AudioPlay::WorkStealingPoolStatistics AudioPlay::WorkStealingPool::GetStatistics() const
+{
+	WorkStealingPoolStatistics statistics = { };
+
+	for (UINT32 index = 0; index < workerCount; index++)
+	{
+		statistics.executed += workers[index].executed.load(std::memory_order_relaxed);
+		statistics.stolen += workers[index].stolen.load(std::memory_order_relaxed);
+	}
+
+	return statistics;
+}
@@ -0,0 +1,42 @@
+#pragma once
+
+#include "PortableTypes.h"
+
+#include <chrono>
+#include <cstdio>
+
+
+namespace AudioPlayBench
+{
+	// Runs body until minTime has passed and returns the mean time of a call in nanoseconds
+	template<class Body>
+	double TimePerCall(_In_ Body body, _In_ std::chrono::milliseconds minTime = std::chrono::milliseconds(200))
+	{
+		using std::chrono::steady_clock;
+
+		// Warms caches and branch predictors so the first calls don't count
+		for (int index = 0; index < 4; index++)
+		{
+			body();
+		}
+
+		UINT64 calls = 0;
+		auto start = steady_clock::now();
+		auto elapsed = steady_clock::duration::zero();
+
+		do
+		{
+			body();
+			calls++;
+			elapsed = steady_clock::now() - start;
+		} while (elapsed < minTime);
+
+		return std::chrono::duration<double, std::nano>(elapsed).count() / calls;
+	}
+
+	void Conversion();
+	void Dsp();
+	void Fft();
+	void PcmPipeline();
+	void StateMachine();
+}
@@ -0,0 +1,93 @@
+#include "Bench.h"
+#include "WavSource.h"
+
+#include <vector>
+
+
+using namespace AudioPlay;
+
+
+namespace
+{
+	// One Read of WavSource converts this many frames at a time
+	constexpr UINT32 blockFrames = 1024;
+
+	const char* EncodingName(SampleEncoding encoding)
+	{
+		switch (encoding)
+		{
+			case SampleEncoding::UInt8: return "uint8";
+			case SampleEncoding::Int16: return "int16";
+			case SampleEncoding::Int24: return "int24";
+			case SampleEncoding::Int32: return "int32";
+			case SampleEncoding::Float32: return "float32";
+			default: return "?";
+		}
+	}
+
+	UINT32 BytesPerSample(SampleEncoding encoding)
+	{
+		switch (encoding)
+		{
+			case SampleEncoding::UInt8: return 1;
+			case SampleEncoding::Int16: return 2;
+			case SampleEncoding::Int24: return 3;
+			default: return 4;
+		}
+	}
+}
+
+
+// Build AudioPlayBenchScalar too and compare, it has the same code without the SSE2 kernels
+void AudioPlayBench::Conversion()
+{
+	#ifdef AUDIOPLAY_SSE2
+	printf("SSE2 kernels, %u frame blocks\n", blockFrames);
+	#else
+	printf("scalar fallbacks, %u frame blocks\n", blockFrames);
+	#endif
+
+	const PcmChannelGains unityGains = { { 1.0f, 1.0f, 1.0f, 1.0f, 1.0f, 1.0f, 1.0f, 1.0f } };
+
+	for (SampleEncoding encoding : { SampleEncoding::UInt8, SampleEncoding::Int16, SampleEncoding::Int24, SampleEncoding::Int32, SampleEncoding::Float32 })
+	{
+		for (UINT32 channels : { 1u, 2u })
+		{
+			const size_t sampleCount = static_cast<size_t>(blockFrames) * channels;
+
+			std::vector<BYTE> source(sampleCount * BytesPerSample(encoding));
+			std::vector<float> destination(sampleCount);
+
+			// Small values so the float input stays in range
+			UINT32 seed = 1;
+			for (size_t index = 0; index + 4 <= source.size(); index += 4)
+			{
+				seed = seed * 1664525 + 1013904223;
+				source[index] = static_cast<BYTE>(seed >> 24);
+				source[index + 1] = static_cast<BYTE>(seed >> 16);
+				source[index + 2] = static_cast<BYTE>(seed >> 8) & 0x3F;
+				source[index + 3] = 0x3C;
+			}
+
+			// What WavSource::Read uses, the encodings without a kernel go through ConvertSamples
+			PcmPipelineKernel kernel = SelectPcmPipeline({ encoding, channels, PcmLayout::Interleaved, PcmStages::Convert });
+			SampleLayout layout = { encoding, false, channels * BytesPerSample(encoding) };
+
+			double perBlock = TimePerCall([&]()
+				{
+					if (kernel)
+					{
+						const void* planes[] = { source.data() };
+						kernel(planes, destination.data(), blockFrames, channels, unityGains);
+					}
+					else
+					{
+						ConvertSamples(layout, source.data(), destination.data(), sampleCount);
+					}
+				});
+
+			printf("%-8s %u ch  %-14s %7.3f ns/sample, %6.0f M samples/s\n", EncodingName(encoding), channels, kernel ? "pipeline" : "ConvertSamples",
+				perBlock / sampleCount, sampleCount * 1000.0 / perBlock);
+		}
+	}
+}
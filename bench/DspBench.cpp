@@ -0,0 +1,134 @@
+#include "Bench.h"
+#include "DspEffects.h"
+#include "SharedPcm.h"
+#include "SpectrumTap.h"
+
+#include <initializer_list>
+
+
+using namespace AudioPlay;
+
+
+namespace
+{
+	// 20 seconds of audio per measurement
+	constexpr UINT32 sampleRate = 48000;
+	constexpr UINT64 totalFrames = sampleRate * 20;
+
+	struct Candidate
+	{
+		const char* name;
+		ComPtr<DspEffect> effect;
+	};
+
+	ComPtr<DspEffect> MakeEq(UINT32 bands)
+	{
+		ComPtr<BiquadEq> eq;
+		if (FAILED(BiquadEq::Create(&eq)))
+		{
+			return nullptr;
+		}
+
+		for (UINT32 band = 0; band < bands; band++)
+		{
+			eq->SetBand(band, BiquadType::Peak, 60.0f * (1 << band), band & 1 ? -3.0f : 3.0f, 1.0f);
+		}
+
+		return ComPtr<DspEffect>(eq.p);
+	}
+
+	ComPtr<DspEffect> MakeLimiter()
+	{
+		ComPtr<Limiter> limiter;
+		if (FAILED(Limiter::Create(&limiter)))
+		{
+			return nullptr;
+		}
+
+		// Noise at full scale, the limiter works all the time
+		limiter->SetCeiling(-6.0f);
+		limiter->SetLookahead(5.0f);
+
+		return ComPtr<DspEffect>(limiter.p);
+	}
+
+	ComPtr<DspEffect> MakeCompressor()
+	{
+		ComPtr<Compressor> compressor;
+		if (FAILED(Compressor::Create(&compressor)))
+		{
+			return nullptr;
+		}
+
+		compressor->SetThreshold(-20.0f, 4.0f, 6.0f);
+
+		return ComPtr<DspEffect>(compressor.p);
+	}
+
+	ComPtr<DspEffect> MakeSpectrumTap()
+	{
+		ComPtr<SpectrumTap> tap;
+		if (FAILED(SpectrumTap::Create(4096, 30.0f, &tap)))
+		{
+			return nullptr;
+		}
+
+		return ComPtr<DspEffect>(tap.p);
+	}
+
+	ComPtr<DspEffect> MakeSharedPcmTap()
+	{
+		// Nobody waits on the ring, so waking readers isn't part of what is measured
+		ComPtr<SharedPcmWriter> writer;
+		ComPtr<SharedPcmTap> tap;
+		if (FAILED(SharedPcmWriter::Create(L"AudioPlayBench.Dsp", 1 << 16, DspEffect::maxChannels, &writer)) || FAILED(SharedPcmTap::Create(writer, &tap)))
+		{
+			return nullptr;
+		}
+
+		return ComPtr<DspEffect>(tap.p);
+	}
+}
+
+
+// MeasureDspEffect for every effect at the block sizes a device period gives, DspSource hands out up to 512 frames
+void AudioPlayBench::Dsp()
+{
+	Candidate candidates[] =
+	{
+		{ "eq 1 band", MakeEq(1) },
+		{ "eq 4 bands", MakeEq(4) },
+		{ "eq 8 bands", MakeEq(8) },
+		{ "limiter", MakeLimiter() },
+		{ "compressor", MakeCompressor() },
+		{ "spectrum tap", MakeSpectrumTap() },
+		{ "shared pcm tap", MakeSharedPcmTap() },
+	};
+
+	printf("%u Hz, %.0f s of noise per row, load is the share of one core at real time\n", sampleRate, static_cast<double>(totalFrames) / sampleRate);
+	printf("%-15s %-3s %6s %10s %9s\n", "effect", "ch", "block", "ns/frame", "load");
+
+	for (Candidate& candidate : candidates)
+	{
+		if (!candidate.effect)
+		{
+			printf("%-15s could not be created\n", candidate.name);
+			continue;
+		}
+
+		for (UINT32 channels : { 2u, 6u })
+		{
+			for (UINT32 blockFrames : { 64u, 256u, 512u })
+			{
+				DspEffectCost cost;
+
+				if (FAILED(MeasureDspEffect(candidate.effect, { sampleRate, channels }, blockFrames, totalFrames, cost)))
+				{
+					continue;
+				}
+
+				printf("%-15s %-3u %6u %10.2f %8.3f%%\n", candidate.name, channels, blockFrames, cost.nanosecondsPerFrame, cost.realtimeLoad * 100.0);
+			}
+		}
+	}
+}
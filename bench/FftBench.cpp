@@ -0,0 +1,33 @@
+#include "Bench.h"
+#include "Fft.h"
+#include "Simd.h"
+
+
+using namespace AudioPlay;
+
+
+// MeasureFft for every size RealFft takes, with what it costs a spectrum display at 60 updates a second
+void AudioPlayBench::Fft()
+{
+	#ifdef AUDIOPLAY_SSE2
+	printf("SSE2 butterflies\n");
+	#else
+	printf("scalar butterflies\n");
+	#endif
+
+	printf("%6s %13s %10s %12s\n", "size", "ns/transform", "ns/sample", "load at 60/s");
+
+	for (UINT32 fftSize = RealFft::minSize; fftSize <= RealFft::maxSize; fftSize *= 2)
+	{
+		// About the same amount of work for every size
+		UINT32 iterations = (1 << 24) / fftSize;
+		double nanoseconds = 0.0;
+
+		if (FAILED(MeasureFft(fftSize, iterations, nanoseconds)))
+		{
+			continue;
+		}
+
+		printf("%6u %13.0f %10.2f %11.4f%%\n", fftSize, nanoseconds, nanoseconds / fftSize, nanoseconds * 60.0 / 1e9 * 100.0);
+	}
+}
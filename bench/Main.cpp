@@ -0,0 +1,46 @@
+#include "Bench.h"
+
+#include <cstring>
+
+
+namespace
+{
+	struct Benchmark
+	{
+		const char* name;
+		void (*run)();
+	};
+
+	const Benchmark benchmarks[] =
+	{
+		{ "statemachine", AudioPlayBench::StateMachine },
+		{ "conversion", AudioPlayBench::Conversion },
+		{ "pcmpipeline", AudioPlayBench::PcmPipeline },
+		{ "dsp", AudioPlayBench::Dsp },
+		{ "fft", AudioPlayBench::Fft },
+	};
+}
+
+
+// Runs every benchmark, or the ones named on the command line
+int main(int argc, char** argv)
+{
+	for (const Benchmark& benchmark : benchmarks)
+	{
+		bool selected = argc < 2;
+
+		for (int index = 1; index < argc; index++)
+		{
+			selected |= strcmp(argv[index], benchmark.name) == 0;
+		}
+
+		if (selected)
+		{
+			printf("== %s\n", benchmark.name);
+			benchmark.run();
+			printf("\n");
+		}
+	}
+
+	return 0;
+}
@@ -0,0 +1,74 @@
+#include "Bench.h"
+#include "PcmKernels.h"
+
+#include <initializer_list>
+
+
+using namespace AudioPlay;
+
+
+namespace
+{
+	// What a decoder hands over at a time, and about 20 seconds at 48 kHz per configuration
+	constexpr UINT32 blockFrames = 1024;
+	constexpr UINT64 totalFrames = 1 << 20;
+
+	const char* EncodingName(SampleEncoding encoding)
+	{
+		switch (encoding)
+		{
+			case SampleEncoding::Int16: return "int16";
+			case SampleEncoding::Int32: return "int32";
+			case SampleEncoding::Float32: return "float32";
+			default: return "?";
+		}
+	}
+
+	const char* StagesName(PcmStages stages)
+	{
+		switch (stages)
+		{
+			case PcmStages::Convert: return "convert";
+			case PcmStages::Gain: return "gain";
+			case PcmStages::Mix: return "mix";
+			case PcmStages::GainMix: return "gain+mix";
+			default: return "?";
+		}
+	}
+}
+
+
+// MeasurePcmPipeline, the kernel SelectPcmPipeline picks against the generic loop that decides everything per sample
+void AudioPlayBench::PcmPipeline()
+{
+	#ifdef AUDIOPLAY_SSE2
+	printf("SSE2 kernels, %u frame blocks\n", blockFrames);
+	#else
+	printf("scalar kernels, %u frame blocks\n", blockFrames);
+	#endif
+
+	printf("%-8s %-3s %-12s %-9s %12s %12s %8s\n", "encoding", "ch", "layout", "stages", "kernel ns/f", "generic ns/f", "speedup");
+
+	for (SampleEncoding encoding : { SampleEncoding::Int16, SampleEncoding::Int32, SampleEncoding::Float32 })
+	{
+		for (UINT32 channels : { 1u, 2u, 6u })
+		{
+			for (PcmLayout layout : { PcmLayout::Interleaved, PcmLayout::Planar })
+			{
+				for (PcmStages stages : { PcmStages::Convert, PcmStages::GainMix })
+				{
+					PcmPipelineCost cost;
+
+					if (FAILED(MeasurePcmPipeline({ encoding, channels, layout, stages }, blockFrames, totalFrames, cost)))
+					{
+						continue;
+					}
+
+					printf("%-8s %-3u %-12s %-9s %12.3f %12.3f %7.2fx%s\n", EncodingName(encoding), channels,
+						layout == PcmLayout::Planar ? "planar" : "interleaved", StagesName(stages),
+						cost.kernelNanosecondsPerFrame, cost.genericNanosecondsPerFrame, cost.speedup, cost.specialized ? "" : "  shared kernel");
+				}
+			}
+		}
+	}
+}
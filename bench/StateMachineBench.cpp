@@ -0,0 +1,70 @@
+#include "Bench.h"
+#include "ScriptedSession.h"
+
+#include <random>
+
+
+using namespace AudioPlay;
+using namespace std::chrono_literals;
+
+
+void AudioPlayBench::StateMachine()
+{
+	// Event throughput, every Start and Pause is answered with its event
+	{
+		VirtualClock clock;
+		ScriptedSession session(clock);
+		AudioStateMachine stateMachine(&session);
+
+		session.SetTarget(&stateMachine);
+		stateMachine.OnOpening(false);
+		session.Open();
+		session.RunUntilIdle();
+
+		double perCall = TimePerCall([&]()
+			{
+				stateMachine.Start();
+				stateMachine.Pause();
+				session.RunUntilIdle();
+			});
+
+		printf("start + pause + 2 events   %8.1f ns, %.1f M events/s\n", perCall, 2000.0 / perCall);
+	}
+
+	// Whole random scenarios like the stress test runs
+	{
+		std::mt19937 random(1);
+
+		double perScenario = TimePerCall([&]()
+			{
+				VirtualClock clock;
+				ScriptedSession session(clock);
+				AudioStateMachine stateMachine(&session);
+
+				session.SetTarget(&stateMachine);
+				session.SetCommandLatency(std::chrono::microseconds(random() % 5000));
+				session.SetDuration(std::chrono::milliseconds(1000 + random() % 2000));
+				stateMachine.OnOpening(true);
+				session.Open();
+				session.RunUntilIdle();
+
+				for (int command = 0; command < 20; command++)
+				{
+					switch (random() % 4)
+					{
+						case 0: stateMachine.Start(); break;
+						case 1: stateMachine.Pause(); break;
+						case 2: stateMachine.Stop(); break;
+						default: stateMachine.Seek(std::chrono::milliseconds(random() % 900)); break;
+					}
+
+					session.RunFor(std::chrono::microseconds(random() % 6000));
+				}
+
+				stateMachine.Close();
+				session.RunUntilIdle();
+			});
+
+		printf("random 20 command scenario %8.1f us\n", perScenario / 1000);
+	}
+}
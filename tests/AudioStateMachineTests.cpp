@@ -0,0 +1,325 @@
+#include "ScriptedSession.h"
+
+#include <gtest/gtest.h>
+
+#include <random>
+
+
+using namespace AudioPlay;
+using namespace std::chrono_literals;
+
+using std::chrono::microseconds;
+using std::chrono::milliseconds;
+
+
+namespace
+{
+	class AudioStateMachineTest : public testing::Test
+	{
+		protected:
+		VirtualClock clock;
+		ScriptedSession session{ clock };
+		AudioStateMachine stateMachine{ &session };
+
+		void Open(bool waitForCapabilities = true)
+		{
+			session.SetTarget(&stateMachine);
+			stateMachine.OnOpening(waitForCapabilities);
+			session.Open();
+			session.RunUntilIdle();
+		}
+	};
+
+	bool IsTransitional(AudioStates state)
+	{
+		return (bool)(state & (AudioStates::Starting | AudioStates::Pausing | AudioStates::Stopping | AudioStates::Opening | AudioStates::Closing));
+	}
+}
+
+
+TEST_F(AudioStateMachineTest, ReadyAfterTopologyAndCapabilities)
+{
+	session.SetTarget(&stateMachine);
+	stateMachine.OnOpening(true);
+
+	session.Post(MESessionTopologySet, 1ms);
+	session.Post(MESessionCapabilitiesChanged, 2ms);
+
+	session.RunFor(1ms);
+	EXPECT_EQ(stateMachine.GetState(), AudioStates::Opening);
+
+	session.RunFor(1ms);
+	EXPECT_EQ(stateMachine.GetState(), AudioStates::Ready);
+}
+
+TEST_F(AudioStateMachineTest, ReadyAfterTopologyWithoutWaitingForCapabilities)
+{
+	session.SetTarget(&stateMachine);
+	session.SetCommandLatency(1ms);
+	stateMachine.OnOpening(false);
+	session.Open();
+
+	session.RunFor(1ms);
+	EXPECT_EQ(stateMachine.GetState(), AudioStates::Ready);
+}
+
+TEST_F(AudioStateMachineTest, CommandsSettleWhenAnswered)
+{
+	Open();
+	session.SetCommandLatency(2ms);
+
+	ASSERT_EQ(stateMachine.Start(), S_OK);
+	EXPECT_EQ(stateMachine.GetState(), AudioStates::Starting);
+	session.RunUntilIdle();
+	EXPECT_EQ(stateMachine.GetState(), AudioStates::Started);
+
+	ASSERT_EQ(stateMachine.Pause(), S_OK);
+	EXPECT_EQ(stateMachine.GetState(), AudioStates::Pausing);
+	session.RunUntilIdle();
+	EXPECT_EQ(stateMachine.GetState(), AudioStates::Paused);
+
+	ASSERT_EQ(stateMachine.Stop(), S_OK);
+	EXPECT_EQ(stateMachine.GetState(), AudioStates::Stopping);
+	session.RunUntilIdle();
+	EXPECT_EQ(stateMachine.GetState(), AudioStates::Stopped);
+
+	ASSERT_EQ(stateMachine.Close(), S_OK);
+	EXPECT_EQ(stateMachine.GetState(), AudioStates::Closing);
+	session.RunUntilIdle();
+	EXPECT_EQ(stateMachine.GetState(), AudioStates::Closed);
+}
+
+TEST_F(AudioStateMachineTest, OlderAnswerDoesNotOverrideNewestCommand)
+{
+	Open();
+	session.SetCommandLatency(10ms);
+
+	stateMachine.Start();
+	session.RunFor(5ms);
+	stateMachine.Pause();
+
+	// MESessionStarted arrives while the pause is still pending
+	session.RunFor(6ms);
+	EXPECT_EQ(stateMachine.GetState(), AudioStates::Pausing);
+
+	session.RunUntilIdle();
+	EXPECT_EQ(stateMachine.GetState(), AudioStates::Paused);
+}
+
+TEST_F(AudioStateMachineTest, FailedEventRestoresSettledState)
+{
+	Open();
+
+	session.FailNext(MESessionStarted, E_FAIL);
+	stateMachine.Start();
+	session.RunUntilIdle();
+
+	EXPECT_EQ(stateMachine.GetState(), AudioStates::Ready);
+}
+
+TEST_F(AudioStateMachineTest, FailedCommandRestoresPreviousState)
+{
+	Open();
+	stateMachine.Start();
+	session.RunUntilIdle();
+
+	session.SetCommandResult(E_FAIL);
+	EXPECT_EQ(stateMachine.Pause(), E_FAIL);
+	EXPECT_EQ(stateMachine.Stop(), E_FAIL);
+	EXPECT_EQ(stateMachine.GetState(), AudioStates::Started);
+}
+
+TEST_F(AudioStateMachineTest, CapabilitiesWhilePlayingKeepState)
+{
+	Open();
+	stateMachine.Start();
+	session.RunUntilIdle();
+
+	session.Post(MESessionCapabilitiesChanged, 0ms);
+	session.RunUntilIdle();
+
+	EXPECT_EQ(stateMachine.GetState(), AudioStates::Started);
+}
+
+TEST_F(AudioStateMachineTest, EndStopsOrLoops)
+{
+	Open();
+	session.SetDuration(100ms);
+
+	stateMachine.Start(0ms);
+	session.RunUntilIdle();
+	EXPECT_EQ(stateMachine.GetState(), AudioStates::Stopped);
+
+	stateMachine.SetLoop(true);
+	stateMachine.Start(0ms);
+
+	// Ended and restarted 10 times, every restart is answered with MESessionStarted
+	UINT64 events = session.RunFor(1050ms);
+	EXPECT_EQ(events, 21u);
+	EXPECT_EQ(stateMachine.GetState(), AudioStates::Started);
+
+	milliseconds position;
+	ASSERT_EQ(stateMachine.GetPosition(position), S_OK);
+	EXPECT_EQ(position, 50ms);
+}
+
+TEST_F(AudioStateMachineTest, PositionFollowsClockAndHoldsWhilePaused)
+{
+	Open();
+
+	stateMachine.Start(200ms);
+	session.RunFor(300ms);
+
+	milliseconds position;
+	ASSERT_EQ(stateMachine.GetPosition(position), S_OK);
+	EXPECT_EQ(position, 500ms);
+
+	stateMachine.Pause();
+	session.RunFor(300ms);
+	ASSERT_EQ(stateMachine.GetPosition(position), S_OK);
+	EXPECT_EQ(position, 500ms);
+
+	// Seeking while paused only moves the position, Start resumes from it
+	stateMachine.Seek(1000ms);
+	EXPECT_EQ(stateMachine.GetState(), AudioStates::Paused);
+	stateMachine.Start();
+	session.RunFor(100ms);
+	ASSERT_EQ(stateMachine.GetPosition(position), S_OK);
+	EXPECT_EQ(position, 1100ms);
+}
+
+TEST_F(AudioStateMachineTest, CommandsAfterCloseFail)
+{
+	Open();
+	stateMachine.Close();
+	session.RunUntilIdle();
+
+	milliseconds position;
+	EXPECT_EQ(stateMachine.Start(), AUDIO_E_CLOSED);
+	EXPECT_EQ(stateMachine.Pause(), AUDIO_E_CLOSED);
+	EXPECT_EQ(stateMachine.Stop(), AUDIO_E_CLOSED);
+	EXPECT_EQ(stateMachine.Seek(0ms), AUDIO_E_CLOSED);
+	EXPECT_EQ(stateMachine.GetPosition(position), AUDIO_E_CLOSED);
+}
+
+// Random commands racing with the answers to earlier ones, the state always ends where the last command said
+TEST(AudioStateMachineStress, RandomInterleavingsSettleOnLastCommand)
+{
+	constexpr int scenarios = 20000;
+
+	std::mt19937 random(1);
+
+	for (int scenario = 0; scenario < scenarios; scenario++)
+	{
+		VirtualClock clock;
+		ScriptedSession session(clock);
+		AudioStateMachine stateMachine(&session);
+
+		session.SetTarget(&stateMachine);
+		session.SetCommandLatency(microseconds(random() % 5000));
+		session.SetDuration(milliseconds(1000 + random() % 2000));
+		stateMachine.OnOpening(true);
+		session.Open();
+		session.RunUntilIdle();
+
+		ASSERT_EQ(stateMachine.GetState(), AudioStates::Ready) << "scenario " << scenario;
+
+		AudioStates expected = AudioStates::Ready;
+		int commands = 5 + random() % 20;
+
+		for (int command = 0; command < commands; command++)
+		{
+			HRESULT hr = S_OK;
+
+			switch (random() % 4)
+			{
+				case 0: hr = stateMachine.Start(); expected = AudioStates::Started; break;
+				case 1: hr = stateMachine.Pause(); expected = AudioStates::Paused; break;
+				case 2: hr = stateMachine.Stop(); expected = AudioStates::Stopped; break;
+				default:
+				{
+					hr = stateMachine.Seek(milliseconds(random() % 900));
+
+					if (stateMachine.GetState() == AudioStates::Starting)
+					{
+						expected = AudioStates::Started;
+					}
+					break;
+				}
+			}
+
+			ASSERT_EQ(hr, S_OK) << "scenario " << scenario;
+
+			// Only part of the latency so commands race with answers
+			session.RunFor(microseconds(random() % 6000));
+		}
+
+		session.SetDuration(0ms);
+		session.RunUntilIdle();
+
+		AudioStates state = stateMachine.GetState();
+
+		ASSERT_FALSE(IsTransitional(state)) << "scenario " << scenario;
+
+		// The end of the file can stop a started session before the last answer
+		if (!(expected == AudioStates::Started && state == AudioStates::Stopped))
+		{
+			ASSERT_EQ(state, expected) << "scenario " << scenario;
+		}
+
+		stateMachine.Close();
+		session.RunUntilIdle();
+
+		ASSERT_EQ(stateMachine.GetState(), AudioStates::Closed) << "scenario " << scenario;
+	}
+}
+
+// Events the session sends on its own, failures included, never leave the machine in a transitional state
+TEST(AudioStateMachineStress, RandomSessionEventsNeverStick)
+{
+	constexpr int scenarios = 5000;
+
+	const MediaEventType types[] = { MESessionStarted, MESessionPaused, MESessionStopped, MESessionEnded, MESessionCapabilitiesChanged };
+
+	std::mt19937 random(2);
+
+	for (int scenario = 0; scenario < scenarios; scenario++)
+	{
+		VirtualClock clock;
+		ScriptedSession session(clock);
+		AudioStateMachine stateMachine(&session);
+
+		session.SetTarget(&stateMachine);
+		session.SetCommandLatency(microseconds(random() % 3000));
+		stateMachine.OnOpening(random() % 2 == 0);
+		session.Open();
+		session.RunUntilIdle();
+
+		for (int step = 0; step < 30; step++)
+		{
+			if (random() % 3 == 0)
+			{
+				session.Post(types[random() % 5], microseconds(random() % 3000), random() % 8 == 0 ? E_FAIL : S_OK);
+			}
+			else if (random() % 2 == 0)
+			{
+				stateMachine.Start();
+			}
+			else
+			{
+				stateMachine.Pause();
+			}
+
+			if (random() % 10 == 0)
+			{
+				session.FailNext(random() % 2 ? MESessionStarted : MESessionPaused, E_FAIL);
+			}
+
+			session.RunFor(microseconds(random() % 4000));
+		}
+
+		session.RunUntilIdle();
+
+		ASSERT_FALSE(IsTransitional(stateMachine.GetState())) << "scenario " << scenario;
+	}
+}
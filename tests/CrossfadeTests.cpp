@@ -0,0 +1,173 @@
+#include "Crossfade.h"
+
+#include <gtest/gtest.h>
+
+#include <vector>
+
+
+using namespace AudioPlay;
+
+
+namespace
+{
+	// Mono frames of one value, says when it is destroyed
+	class ConstantSource : public PcmSource
+	{
+		float value;
+		UINT64 length;
+		UINT64 position;
+		bool& destroyed;
+
+		public:
+		ConstantSource(float p_value, UINT64 p_length, bool& p_destroyed) :
+			value(p_value), length(p_length), position(0), destroyed(p_destroyed)
+		{
+			format = { 48000, 1 };
+			destroyed = false;
+		}
+
+		~ConstantSource()
+		{
+			destroyed = true;
+		}
+
+		HRESULT Read(_Out_writes_(frameCount * format.channels) float* buffer, _In_ UINT32 frameCount, _Out_ UINT32& framesRead) override
+		{
+			framesRead = length - position < frameCount ? static_cast<UINT32>(length - position) : frameCount;
+
+			for (UINT32 frame = 0; frame < framesRead; frame++)
+			{
+				buffer[frame] = value;
+			}
+
+			position += framesRead;
+
+			return S_OK;
+		}
+
+		HRESULT Seek(_In_ UINT64 frame) override { position = frame; return S_OK; }
+		HRESULT GetPosition(_Out_ UINT64& frame) const override { frame = position; return S_OK; }
+		HRESULT GetLength(_Out_ UINT64& frames) const override { frames = length; return S_OK; }
+	};
+
+	// Only the crossfade source keeps the sources alive
+	ComPtr<PcmSource> MakeSource(float value, UINT64 length, bool& destroyed)
+	{
+		ComPtr<PcmSource> source;
+		source.Attach(new ConstantSource(value, length, destroyed));
+
+		return source;
+	}
+
+	// Reads in blocks the way the audio thread does and checks nothing was destroyed while it did
+	std::vector<float> ReadAll(CrossfadeSource* crossfade, const bool& destroyed)
+	{
+		std::vector<float> output;
+		float block[256];
+		UINT32 framesRead = 0;
+
+		do
+		{
+			EXPECT_EQ(crossfade->Read(block, 256, framesRead), S_OK);
+			EXPECT_FALSE(destroyed) << "released in Read after " << output.size() << " frames";
+
+			output.insert(output.end(), block, block + framesRead);
+		}
+		while (framesRead == 256);
+
+		return output;
+	}
+}
+
+
+// The outgoing source could be a decoder whose teardown waits on Media Foundation, Read never releases it
+TEST(CrossfadeSource, OutgoingSourceIsReleasedByTheControlThread)
+{
+	bool firstDestroyed = false;
+	bool secondDestroyed = false;
+
+	ComPtr<CrossfadeSource> crossfade;
+	ASSERT_EQ(CrossfadeSource::Create(MakeSource(1.0f, 1000, firstDestroyed), &crossfade), S_OK);
+	ASSERT_EQ(crossfade->Queue(MakeSource(2.0f, 1000, secondDestroyed), 200, CrossfadeCurve::Linear), S_OK);
+
+	std::vector<float> output = ReadAll(crossfade, firstDestroyed);
+
+	ASSERT_EQ(output.size(), 1800u);
+	EXPECT_EQ(output[0], 1.0f);
+	EXPECT_EQ(output[799], 1.0f);
+	EXPECT_EQ(output[1000], 2.0f);
+	EXPECT_EQ(output[1799], 2.0f);
+	EXPECT_FALSE(crossfade->IsFading());
+
+	crossfade->ReleaseRetired();
+	EXPECT_TRUE(firstDestroyed);
+	EXPECT_FALSE(secondDestroyed);
+
+	crossfade = nullptr;
+	EXPECT_TRUE(secondDestroyed);
+}
+
+TEST(CrossfadeSource, QueueReleasesWhatTheLastTransitionLeft)
+{
+	bool firstDestroyed = false;
+	bool secondDestroyed = false;
+	bool thirdDestroyed = false;
+
+	ComPtr<CrossfadeSource> crossfade;
+	ASSERT_EQ(CrossfadeSource::Create(MakeSource(1.0f, 300, firstDestroyed), &crossfade), S_OK);
+	ASSERT_EQ(crossfade->CrossfadeNow(MakeSource(2.0f, 10000, secondDestroyed), 100, CrossfadeCurve::EqualPower), S_OK);
+
+	float block[256];
+	UINT32 framesRead = 0;
+	ASSERT_EQ(crossfade->Read(block, 256, framesRead), S_OK);
+	EXPECT_EQ(framesRead, 256u);
+	EXPECT_FALSE(firstDestroyed);
+
+	ASSERT_EQ(crossfade->Queue(MakeSource(3.0f, 1000, thirdDestroyed), 100, CrossfadeCurve::Linear), S_OK);
+	EXPECT_TRUE(firstDestroyed);
+}
+
+// A queued source that is replaced before its fade started goes the same way
+TEST(CrossfadeSource, ReplacedQueuedSourceIsRetired)
+{
+	bool firstDestroyed = false;
+	bool secondDestroyed = false;
+	bool thirdDestroyed = false;
+
+	ComPtr<CrossfadeSource> crossfade;
+	ASSERT_EQ(CrossfadeSource::Create(MakeSource(1.0f, 10000, firstDestroyed), &crossfade), S_OK);
+	ASSERT_EQ(crossfade->Queue(MakeSource(2.0f, 1000, secondDestroyed), 200, CrossfadeCurve::Linear), S_OK);
+
+	float block[256];
+	UINT32 framesRead = 0;
+	ASSERT_EQ(crossfade->Read(block, 256, framesRead), S_OK);
+
+	// Taken over by the next Read, which doesn't collect retired sources
+	std::vector<float> points = { 0.0f, 1.0f };
+	ASSERT_EQ(crossfade->SetCustomCurve(points.data(), 2), S_OK);
+	ASSERT_EQ(crossfade->Queue(MakeSource(3.0f, 1000, thirdDestroyed), 200, CrossfadeCurve::Custom), S_OK);
+
+	ASSERT_EQ(crossfade->Read(block, 256, framesRead), S_OK);
+	EXPECT_FALSE(secondDestroyed);
+
+	crossfade->ReleaseRetired();
+	EXPECT_TRUE(secondDestroyed);
+	EXPECT_FALSE(thirdDestroyed);
+	EXPECT_FALSE(firstDestroyed);
+}
+
+TEST(CrossfadeSource, DestructorReleasesRetiredSources)
+{
+	bool firstDestroyed = false;
+	bool secondDestroyed = false;
+
+	ComPtr<CrossfadeSource> crossfade;
+	ASSERT_EQ(CrossfadeSource::Create(MakeSource(1.0f, 500, firstDestroyed), &crossfade), S_OK);
+	ASSERT_EQ(crossfade->Queue(MakeSource(2.0f, 500, secondDestroyed), 100, CrossfadeCurve::Linear), S_OK);
+
+	ReadAll(crossfade, firstDestroyed);
+
+	crossfade = nullptr;
+	EXPECT_TRUE(firstDestroyed);
+	EXPECT_TRUE(secondDestroyed);
+}
@@ -0,0 +1,227 @@
+#include "Fingerprinter.h"
+
+#include <gtest/gtest.h>
+
+#include <cmath>
+#include <random>
+
+
+using namespace AudioPlay;
+
+
+namespace
+{
+	constexpr double pi = 3.14159265358979323846;
+
+	struct Note
+	{
+		double start;
+		double length;
+		double frequency;
+		double amplitude;
+	};
+
+	// Notes with harmonics over a chord that changes every two seconds, described in seconds so every rate renders the same music
+	class SyntheticTrack
+	{
+		std::vector<Note> notes;
+		double length;
+
+		public:
+		SyntheticTrack(UINT32 seed, double p_length) : length(p_length)
+		{
+			std::mt19937 random(seed);
+			std::uniform_real_distribution<double> unit(0.0, 1.0);
+
+			for (double time = 0.0; time < length; )
+			{
+				double noteLength = 0.1 + 0.3 * unit(random);
+				notes.push_back({ time, noteLength, 110.0 * std::pow(2.0, std::floor(unit(random) * 36.0) / 12.0), 0.2 + 0.3 * unit(random) });
+				time += noteLength * (0.5 + unit(random));
+			}
+
+			for (double time = 0.0; time < length; time += 2.0)
+			{
+				for (int voice = 0; voice < 3; voice++)
+				{
+					notes.push_back({ time, 2.0, 220.0 * std::pow(2.0, std::floor(unit(random) * 24.0) / 12.0), 0.1 });
+				}
+			}
+
+			// Cymbal-like bursts above the fingerprint's output rate, a resampler without a proper low-pass folds them into the bands
+			for (double time = 0.0; time < length; time += 0.25)
+			{
+				for (int partial = 0; partial < 8; partial++)
+				{
+					notes.push_back({ time, 0.2, 6000.0 + 10000.0 * unit(random), 0.15 });
+				}
+			}
+		}
+
+		std::vector<float> Render(UINT32 sampleRate) const
+		{
+			std::vector<float> samples(static_cast<size_t>(length * sampleRate), 0.0f);
+
+			for (const Note& note : notes)
+			{
+				size_t first = static_cast<size_t>(std::ceil(note.start * sampleRate));
+				size_t last = static_cast<size_t>((note.start + note.length) * sampleRate);
+
+				for (size_t index = first; index < last && index < samples.size(); index++)
+				{
+					double time = static_cast<double>(index) / sampleRate - note.start;
+					// Short attack, exponential decay
+					double envelope = note.amplitude * std::fmin(time / 0.01, 1.0) * std::exp(-3.0 * time / note.length);
+					double value = 0.0;
+
+					// Band-limited like a real recording, harmonics past the Nyquist frequency of the rate would fold back
+					for (int harmonic = 1; harmonic <= 4 && note.frequency * harmonic < sampleRate / 2.0; harmonic++)
+					{
+						value += std::sin(2.0 * pi * note.frequency * harmonic * time) / harmonic;
+					}
+
+					samples[index] += static_cast<float>(envelope * value * 0.25);
+				}
+			}
+
+			return samples;
+		}
+	};
+
+	Fingerprint Compute(const std::vector<float>& samples, UINT32 sampleRate)
+	{
+		ComPtr<PcmBufferSource> source;
+		EXPECT_EQ(PcmBufferSource::Create({ sampleRate, 1 }, samples.data(), samples.size(), &source), S_OK);
+
+		Fingerprinter fingerprinter;
+		EXPECT_EQ(fingerprinter.Initialize(), S_OK);
+
+		Fingerprint fingerprint;
+		EXPECT_EQ(fingerprinter.Compute(source, 0, fingerprint), S_OK);
+
+		return fingerprint;
+	}
+
+	float Similarity(const Fingerprint& a, const Fingerprint& b)
+	{
+		size_t count = a.hashes.size() < b.hashes.size() ? a.hashes.size() : b.hashes.size();
+		size_t errors = 0;
+
+		for (size_t index = 0; index < count; index++)
+		{
+			UINT32 difference = a.hashes[index] ^ b.hashes[index];
+
+			for (; difference; difference &= difference - 1)
+			{
+				errors++;
+			}
+		}
+
+		return 1.0f - static_cast<float>(errors) / (count * 32.0f);
+	}
+
+	void CountPair(const FingerprintMatch& a, const FingerprintMatch& b, void* context)
+	{
+		auto pairs = static_cast<std::vector<std::pair<UINT64, UINT64>>*>(context);
+
+		pairs->push_back({ a.id, b.id });
+	}
+}
+
+
+TEST(Fingerprinter, SameTrackAtAnotherSampleRateKeepsItsHashes)
+{
+	SyntheticTrack track(1, 20.0);
+
+	Fingerprint at44100 = Compute(track.Render(44100), 44100);
+	Fingerprint at48000 = Compute(track.Render(48000), 48000);
+
+	ASSERT_GT(at44100.hashes.size(), 400u);
+	EXPECT_LE(std::abs(static_cast<int>(at44100.hashes.size()) - static_cast<int>(at48000.hashes.size())), 1);
+
+	float similarity = Similarity(at44100, at48000);
+	EXPECT_GT(similarity, 0.97f) << "similarity " << similarity;
+
+	// Lookup finds candidates through hashes that are equal or a bit apart
+	size_t close = 0;
+	for (size_t index = 0; index < at44100.hashes.size() && index < at48000.hashes.size(); index++)
+	{
+		UINT32 difference = at44100.hashes[index] ^ at48000.hashes[index];
+		close += (difference & (difference - 1)) == 0 ? 1 : 0;
+	}
+	EXPECT_GT(close, at44100.hashes.size() * 9 / 10);
+}
+
+TEST(Fingerprinter, DifferentTracksAreUnrelated)
+{
+	Fingerprint a = Compute(SyntheticTrack(1, 20.0).Render(44100), 44100);
+	Fingerprint b = Compute(SyntheticTrack(2, 20.0).Render(44100), 44100);
+
+	float similarity = Similarity(a, b);
+	EXPECT_LT(similarity, 0.6f) << "similarity " << similarity;
+}
+
+TEST(FingerprintIndex, FindsSameTrackAt44100And48000)
+{
+	ComPtr<FingerprintIndex> index;
+	ASSERT_EQ(FingerprintIndex::Create(FingerprintIndex::defaultIndexStride, &index), S_OK);
+
+	for (UINT32 seed = 1; seed <= 6; seed++)
+	{
+		ASSERT_EQ(index->Add(seed, Compute(SyntheticTrack(seed, 20.0).Render(44100), 44100)), S_OK);
+	}
+
+	// Added last so FindDuplicates reports it as the second of the pair
+	ASSERT_EQ(index->Add(100, Compute(SyntheticTrack(3, 20.0).Render(48000), 48000)), S_OK);
+	ASSERT_EQ(index->Build(), S_OK);
+
+	std::vector<FingerprintMatch> matches;
+	ASSERT_EQ(index->Lookup(Compute(SyntheticTrack(3, 20.0).Render(48000), 48000), 0.65f, matches), S_OK);
+	ASSERT_EQ(matches.size(), 2u);
+	EXPECT_EQ(matches[0].id + matches[1].id, 103u);
+	EXPECT_EQ(matches[1].offset, 0);
+	EXPECT_GT(matches[1].similarity, 0.9f);
+
+	std::vector<std::pair<UINT64, UINT64>> pairs;
+	ASSERT_EQ(index->FindDuplicates(0.65f, CountPair, &pairs), S_OK);
+	ASSERT_EQ(pairs.size(), 1u);
+	EXPECT_EQ(pairs[0].first, 3u);
+	EXPECT_EQ(pairs[0].second, 100u);
+}
+
+TEST(FingerprintIndex, FindsQueryWithoutASingleExactHash)
+{
+	std::mt19937 random(7);
+
+	ComPtr<FingerprintIndex> index;
+	ASSERT_EQ(FingerprintIndex::Create(FingerprintIndex::defaultIndexStride, &index), S_OK);
+
+	Fingerprint stored = { { }, 10000 };
+	for (int hash = 0; hash < 400; hash++)
+	{
+		stored.hashes.push_back(random());
+	}
+
+	ASSERT_EQ(index->Add(1, stored), S_OK);
+	ASSERT_EQ(index->Build(), S_OK);
+
+	// Every hash a bit away from the stored one, shifted by 10 hashes
+	Fingerprint query = { { }, 10000 };
+	for (size_t position = 10; position < stored.hashes.size(); position++)
+	{
+		query.hashes.push_back(stored.hashes[position] ^ (1u << (1 + random() % 30)));
+	}
+
+	std::vector<FingerprintMatch> matches;
+	ASSERT_EQ(index->Lookup(query, 0.65f, matches), S_OK);
+	ASSERT_EQ(matches.size(), 1u);
+	EXPECT_EQ(matches[0].offset, 10);
+	EXPECT_FLOAT_EQ(matches[0].similarity, 1.0f - 1.0f / 32);
+
+	// Three bits away is too far for a candidate
+	for (UINT32& hash : query.hashes)
+	{
+		hash ^= 0x80000001u;
+	}
+	EXPECT_EQ(index->Lookup(query, 0.65f, matches), S_FALSE);
+}
@@ -0,0 +1,265 @@
+#include "FlacSource.h"
+
+#include <gtest/gtest.h>
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <fstream>
+#include <iterator>
+#include <string>
+#include <vector>
+
+
+using namespace AudioPlay;
+
+
+namespace
+{
+	// Written by tests/data/MakeFlacCorpus.py
+	struct CorpusFile
+	{
+		const char* name;
+		UINT32 bitsPerSample;
+		UINT32 channels;
+		UINT32 sampleRate;
+		UINT64 frames;
+		UINT32 blockSize;
+	};
+
+	void PrintTo(const CorpusFile& file, std::ostream* stream)
+	{
+		*stream << file.name;
+	}
+
+	const CorpusFile corpus[] =
+	{
+		{ "s8_stereo_1152", 8, 2, 22050, 13000, 1152 },
+		{ "s16_mono_4096", 16, 1, 44100, 20000, 4096 },
+		{ "s16_stereo_1152", 16, 2, 48000, 17281, 1152 },
+		{ "s24_stereo_4096", 24, 2, 96000, 16385, 4096 },
+		{ "s24_6ch_1152", 24, 6, 48000, 7000, 1152 },
+	};
+
+	// STREAMINFO is the first block, right after "fLaC" and its 4 byte header
+	constexpr size_t streamInfoOffset = 8;
+	constexpr size_t md5Offset = streamInfoOffset + 18;
+
+	std::string CorpusPath(const CorpusFile& file)
+	{
+		return std::string(AUDIOPLAY_TEST_DATA "/flac/") + file.name + ".flac";
+	}
+
+	std::vector<BYTE> ReadCorpusFile(const CorpusFile& file)
+	{
+		std::ifstream stream(CorpusPath(file), std::ios::binary);
+
+		return std::vector<BYTE>(std::istreambuf_iterator<char>(stream), std::istreambuf_iterator<char>());
+	}
+
+	HRESULT CreateSource(const std::vector<BYTE>& bytes, ComPtr<FlacSource>& source)
+	{
+		ComPtr<MemoryBlock> block;
+
+		HRESULT hr = MemoryBlock::CreateFromSpan(bytes.data(), bytes.size(), &block);
+
+		if (SUCCEEDED(hr))
+		{
+			hr = FlacSource::Create(block, &source);
+		}
+
+		return hr;
+	}
+
+	// Decodes to the end, the samples are put back into the integers the encoder hashed
+	HRESULT DecodeAll(FlacSource* source, std::vector<INT32>& samples)
+	{
+		const UINT32 channels = source->GetFormat().channels;
+		const double scale = std::ldexp(1.0, static_cast<int>(source->GetBitsPerSample()) - 1);
+
+		std::vector<float> buffer(1000 * channels);
+		UINT32 framesRead = 0;
+
+		samples.clear();
+
+		do
+		{
+			HRESULT hr = source->Read(buffer.data(), 1000, framesRead);
+
+			if (FAILED(hr))
+			{
+				return hr;
+			}
+
+			for (UINT32 index = 0; index < framesRead * channels; index++)
+			{
+				samples.push_back(static_cast<INT32>(std::lround(buffer[index] * scale)));
+			}
+		}
+		while (framesRead == 1000);
+
+		return S_OK;
+	}
+
+	std::vector<BYTE> ComputeMd5(const std::vector<INT32>& samples, UINT32 bitsPerSample)
+	{
+		const UINT32 bytesPerSample = (bitsPerSample + 7) / 8;
+
+		std::vector<BYTE> bytes;
+		for (INT32 sample : samples)
+		{
+			for (UINT32 byte = 0; byte < bytesPerSample; byte++)
+			{
+				bytes.push_back(static_cast<BYTE>(static_cast<UINT32>(sample) >> (byte * 8)));
+			}
+		}
+
+		std::vector<BYTE> digest(16);
+
+		Md5 md5;
+		md5.Update(bytes.data(), bytes.size());
+		md5.Finish(digest.data());
+
+		return digest;
+	}
+
+	std::string Md5Hex(const char* text)
+	{
+		BYTE digest[16];
+
+		Md5 md5;
+		md5.Update(text, strlen(text));
+		md5.Finish(digest);
+
+		std::string hex;
+		for (BYTE byte : digest)
+		{
+			const char digits[] = "0123456789abcdef";
+			hex += digits[byte >> 4];
+			hex += digits[byte & 15];
+		}
+
+		return hex;
+	}
+
+	class FlacCorpusTest : public testing::TestWithParam<CorpusFile>
+	{
+	};
+}
+
+
+TEST(Md5, MatchesRfc1321TestSuite)
+{
+	EXPECT_EQ(Md5Hex(""), "d41d8cd98f00b204e9800998ecf8427e");
+	EXPECT_EQ(Md5Hex("abc"), "900150983cd24fb0d6963f7d28e17f72");
+	EXPECT_EQ(Md5Hex("message digest"), "f96b697d7cb7938d525a2f31aaf161d0");
+	EXPECT_EQ(Md5Hex("abcdefghijklmnopqrstuvwxyz"), "c3fcd3d76192e4007dfb496cca67e13b");
+	EXPECT_EQ(Md5Hex("12345678901234567890123456789012345678901234567890123456789012345678901234567890"), "57edf4a22be3c955ac49da2e2107b67a");
+}
+
+TEST_P(FlacCorpusTest, ReadsStreamInfo)
+{
+	const CorpusFile& file = GetParam();
+	std::vector<BYTE> bytes = ReadCorpusFile(file);
+	ASSERT_GT(bytes.size(), md5Offset + 16) << CorpusPath(file);
+
+	ComPtr<FlacSource> source;
+	ASSERT_EQ(CreateSource(bytes, source), S_OK);
+
+	UINT64 length = 0;
+	ASSERT_EQ(source->GetLength(length), S_OK);
+
+	EXPECT_EQ(source->GetBitsPerSample(), file.bitsPerSample);
+	EXPECT_EQ(source->GetFormat().channels, file.channels);
+	EXPECT_EQ(source->GetFormat().sampleRate, file.sampleRate);
+	EXPECT_EQ(length, file.frames);
+
+	// Minimum and maximum block size, the last block is shorter but doesn't count
+	EXPECT_EQ((bytes[streamInfoOffset] << 8) | bytes[streamInfoOffset + 1], static_cast<int>(file.blockSize));
+	EXPECT_EQ((bytes[streamInfoOffset + 2] << 8) | bytes[streamInfoOffset + 3], static_cast<int>(file.blockSize));
+}
+
+// The stored checksum, the decoder's own and one computed here from the decoded samples all agree
+TEST_P(FlacCorpusTest, DecodedSamplesMatchStoredMd5)
+{
+	const CorpusFile& file = GetParam();
+	std::vector<BYTE> bytes = ReadCorpusFile(file);
+	ASSERT_GT(bytes.size(), md5Offset + 16) << CorpusPath(file);
+
+	ComPtr<FlacSource> source;
+	ASSERT_EQ(CreateSource(bytes, source), S_OK);
+
+	std::vector<INT32> samples;
+	ASSERT_EQ(DecodeAll(source, samples), S_OK);
+	EXPECT_EQ(samples.size(), file.frames * file.channels);
+
+	std::vector<BYTE> stored(bytes.begin() + md5Offset, bytes.begin() + md5Offset + 16);
+	EXPECT_EQ(ComputeMd5(samples, file.bitsPerSample), stored);
+	EXPECT_EQ(source->GetVerificationResult(), S_OK);
+
+	std::string path = CorpusPath(file);
+	std::wstring widePath(path.begin(), path.end());
+	EXPECT_EQ(FlacSource::Verify(widePath.c_str()), S_OK);
+}
+
+TEST_P(FlacCorpusTest, WrongStoredMd5IsCorrupt)
+{
+	const CorpusFile& file = GetParam();
+	std::vector<BYTE> bytes = ReadCorpusFile(file);
+	ASSERT_GT(bytes.size(), md5Offset + 16) << CorpusPath(file);
+
+	bytes[md5Offset + 7] ^= 0x10;
+
+	ComPtr<FlacSource> source;
+	ASSERT_EQ(CreateSource(bytes, source), S_OK);
+
+	std::vector<INT32> samples;
+	ASSERT_EQ(DecodeAll(source, samples), S_OK);
+	EXPECT_EQ(source->GetVerificationResult(), AUDIO_E_CORRUPT_DATA);
+}
+
+TEST_P(FlacCorpusTest, MissingMd5IsNotVerified)
+{
+	const CorpusFile& file = GetParam();
+	std::vector<BYTE> bytes = ReadCorpusFile(file);
+	ASSERT_GT(bytes.size(), md5Offset + 16) << CorpusPath(file);
+
+	std::fill(bytes.begin() + md5Offset, bytes.begin() + md5Offset + 16, BYTE(0));
+
+	ComPtr<FlacSource> source;
+	ASSERT_EQ(CreateSource(bytes, source), S_OK);
+
+	std::vector<INT32> samples;
+	ASSERT_EQ(DecodeAll(source, samples), S_OK);
+	EXPECT_EQ(source->GetVerificationResult(), S_FALSE);
+}
+
+// Only a decode from the first frame without a seek can be checked
+TEST_P(FlacCorpusTest, SeekStopsVerificationUntilRewound)
+{
+	const CorpusFile& file = GetParam();
+	std::vector<BYTE> bytes = ReadCorpusFile(file);
+	ASSERT_GT(bytes.size(), md5Offset + 16) << CorpusPath(file);
+
+	ComPtr<FlacSource> source;
+	ASSERT_EQ(CreateSource(bytes, source), S_OK);
+
+	std::vector<INT32> whole;
+	ASSERT_EQ(DecodeAll(source, whole), S_OK);
+
+	const UINT64 middle = file.frames / 2 + 1;
+	ASSERT_EQ(source->Seek(middle), S_OK);
+
+	std::vector<INT32> tail;
+	ASSERT_EQ(DecodeAll(source, tail), S_OK);
+	EXPECT_EQ(source->GetVerificationResult(), S_FALSE);
+	ASSERT_EQ(tail.size(), (file.frames - middle) * file.channels);
+	EXPECT_TRUE(std::equal(tail.begin(), tail.end(), whole.begin() + middle * file.channels));
+
+	ASSERT_EQ(source->Seek(0), S_OK);
+	ASSERT_EQ(DecodeAll(source, whole), S_OK);
+	EXPECT_EQ(source->GetVerificationResult(), S_OK);
+}
+
+INSTANTIATE_TEST_SUITE_P(Corpus, FlacCorpusTest, testing::ValuesIn(corpus),
+	[](const testing::TestParamInfo<CorpusFile>& info) { return std::string(info.param.name); });
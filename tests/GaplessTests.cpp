@@ -0,0 +1,420 @@
+#include "GaplessInfo.h"
+
+#include <gtest/gtest.h>
+
+#include <cstring>
+#include <string>
+#include <vector>
+
+
+using namespace AudioPlay;
+
+
+namespace
+{
+	void AppendBigEndian32(std::vector<BYTE>& bytes, UINT32 value)
+	{
+		for (int shift = 24; shift >= 0; shift -= 8)
+		{
+			bytes.push_back(static_cast<BYTE>(value >> shift));
+		}
+	}
+
+	void AppendLittleEndian(std::vector<BYTE>& bytes, UINT64 value, UINT32 size)
+	{
+		for (UINT32 byte = 0; byte < size; byte++)
+		{
+			bytes.push_back(static_cast<BYTE>(value >> (byte * 8)));
+		}
+	}
+
+	void AppendText(std::vector<BYTE>& bytes, const char* text)
+	{
+		bytes.insert(bytes.end(), text, text + strlen(text));
+	}
+
+	// The first frame of a LAME encode, an Info header with every optional field and the LAME tag
+	std::vector<BYTE> MakeLameMp3(bool mpeg1, bool mono, UINT32 mp3Frames, UINT32 encoderDelay, UINT32 padding, bool id3 = false)
+	{
+		std::vector<BYTE> bytes;
+
+		if (id3)
+		{
+			// 100 bytes of tag as a syncsafe size, with a frame sync inside that isn't a Layer III header
+			const BYTE header[] = { 'I', 'D', '3', 4, 0, 0, 0, 0, 0, 100 };
+			bytes.insert(bytes.end(), header, header + sizeof(header));
+			bytes.resize(bytes.size() + 100, 0);
+			bytes[20] = 0xFF;
+			bytes[21] = 0xFF;
+		}
+
+		// 128 kbit/s at 44.1 or 22.05 kHz, Layer III, no CRC
+		bytes.insert(bytes.end(), { 0xFF, static_cast<BYTE>(mpeg1 ? 0xFB : 0xF3), 0x90, static_cast<BYTE>(mono ? 0xC4 : 0x44) });
+
+		size_t sideInfoSize = mpeg1 ? (mono ? 17 : 32) : (mono ? 9 : 17);
+		bytes.resize(bytes.size() + sideInfoSize, 0);
+
+		AppendText(bytes, "Info");
+		AppendBigEndian32(bytes, 0x0F);
+		AppendBigEndian32(bytes, mp3Frames);
+		AppendBigEndian32(bytes, 417 * mp3Frames);
+		bytes.resize(bytes.size() + 100, 0x55);
+		AppendBigEndian32(bytes, 57);
+
+		// Version string, revision and VBR method, lowpass, replay gain, flags and bitrate, then the 12 bit delay and padding
+		size_t lame = bytes.size();
+		AppendText(bytes, "LAME3.100");
+		bytes.resize(lame + 36, 0);
+		bytes[lame + 21] = static_cast<BYTE>(encoderDelay >> 4);
+		bytes[lame + 22] = static_cast<BYTE>(((encoderDelay & 0x0F) << 4) | (padding >> 8));
+		bytes[lame + 23] = static_cast<BYTE>(padding);
+
+		// The rest of the frame
+		bytes.resize(bytes.size() + 200, 0);
+
+		return bytes;
+	}
+
+	std::vector<BYTE> Box(const char* type, const std::vector<BYTE>& payload)
+	{
+		std::vector<BYTE> bytes;
+		AppendBigEndian32(bytes, static_cast<UINT32>(payload.size() + 8));
+		AppendText(bytes, type);
+		bytes.insert(bytes.end(), payload.begin(), payload.end());
+
+		return bytes;
+	}
+
+	std::vector<BYTE> Concatenate(std::initializer_list<std::vector<BYTE>> parts)
+	{
+		std::vector<BYTE> bytes;
+		for (const std::vector<BYTE>& part : parts)
+		{
+			bytes.insert(bytes.end(), part.begin(), part.end());
+		}
+
+		return bytes;
+	}
+
+	// ftyp, then moov/udta/meta/ilst with an iTunes free form item before the one that counts
+	std::vector<BYTE> MakeItunesMp4(const char* smpb, bool fullBoxMeta = true)
+	{
+		std::vector<BYTE> fullBox = { 0, 0, 0, 0 };
+		std::vector<BYTE> dataHeader = { 0, 0, 0, 1, 0, 0, 0, 0 };
+
+		std::vector<BYTE> smpbText = dataHeader;
+		AppendText(smpbText, smpb);
+
+		std::vector<BYTE> otherText = dataHeader;
+		AppendText(otherText, "0");
+
+		std::vector<BYTE> mean = fullBox;
+		AppendText(mean, "com.apple.iTunes");
+		std::vector<BYTE> smpbName = fullBox;
+		AppendText(smpbName, "iTunSMPB");
+		std::vector<BYTE> otherName = fullBox;
+		AppendText(otherName, "iTunNORM");
+
+		std::vector<BYTE> ilst = Box("ilst", Concatenate({
+			Box("----", Concatenate({ Box("mean", mean), Box("name", otherName), Box("data", otherText) })),
+			Box("----", Concatenate({ Box("mean", mean), Box("name", smpbName), Box("data", smpbText) })) }));
+
+		std::vector<BYTE> hdlr = Box("hdlr", std::vector<BYTE>(25, 0));
+		std::vector<BYTE> meta = Box("meta", fullBoxMeta ? Concatenate({ fullBox, hdlr, ilst }) : Concatenate({ hdlr, ilst }));
+
+		std::vector<BYTE> ftypPayload;
+		AppendText(ftypPayload, "M4A ");
+		AppendBigEndian32(ftypPayload, 0);
+		AppendText(ftypPayload, "isomM4A ");
+
+		return Concatenate({ Box("ftyp", ftypPayload), Box("moov", Concatenate({ Box("mvhd", std::vector<BYTE>(100, 0)), Box("udta", meta) })),
+			Box("mdat", std::vector<BYTE>(64, 0xAA)) });
+	}
+
+	void AppendOggPage(std::vector<BYTE>& bytes, UINT64 granule, UINT32 serial, UINT32 sequence, const std::vector<BYTE>& packet)
+	{
+		AppendText(bytes, "OggS");
+		bytes.push_back(0);
+		bytes.push_back(sequence == 0 ? 0x02 : 0x00);
+		AppendLittleEndian(bytes, granule, 8);
+		AppendLittleEndian(bytes, serial, 4);
+		AppendLittleEndian(bytes, sequence, 4);
+		// The decoder checks the CRC, the parser doesn't
+		AppendLittleEndian(bytes, 0, 4);
+
+		std::vector<BYTE> segments(packet.size() / 255, 255);
+		segments.push_back(static_cast<BYTE>(packet.size() % 255));
+
+		bytes.push_back(static_cast<BYTE>(segments.size()));
+		bytes.insert(bytes.end(), segments.begin(), segments.end());
+		bytes.insert(bytes.end(), packet.begin(), packet.end());
+	}
+
+	// OpusHead, OpusTags, audio pages and, for a stream that isn't cut off, the last page with the end granule position
+	std::vector<BYTE> MakeOggOpus(UINT32 preSkip, UINT64 endGranule, bool cutOff = false)
+	{
+		const UINT32 serial = 0x1234ABCD;
+
+		std::vector<BYTE> head;
+		AppendText(head, "OpusHead");
+		head.push_back(1);
+		head.push_back(2);
+		AppendLittleEndian(head, preSkip, 2);
+		AppendLittleEndian(head, 44100, 4);
+		AppendLittleEndian(head, 0, 2);
+		head.push_back(0);
+
+		std::vector<BYTE> tags;
+		AppendText(tags, "OpusTags");
+		AppendLittleEndian(tags, 0, 4);
+		AppendLittleEndian(tags, 0, 4);
+
+		std::vector<BYTE> bytes;
+		AppendOggPage(bytes, 0, serial, 0, head);
+		AppendOggPage(bytes, 0, serial, 1, tags);
+		AppendOggPage(bytes, 48000, serial, 2, std::vector<BYTE>(600, 0x11));
+		// A page of another stream in between, its granule position doesn't count
+		AppendOggPage(bytes, 999999, serial + 1, 0, std::vector<BYTE>(40, 0x22));
+
+		if (!cutOff)
+		{
+			AppendOggPage(bytes, endGranule, serial, 3, std::vector<BYTE>(600, 0x33));
+			// The start of a packet that continues on a page that isn't there
+			AppendOggPage(bytes, ~0ULL, serial, 4, std::vector<BYTE>(255, 0x44));
+		}
+
+		return bytes;
+	}
+
+	// Both channels carry the frame number, the right one negated
+	HRESULT CreateRamp(UINT64 frames, ComPtr<PcmBufferSource>& source)
+	{
+		std::vector<float> samples;
+		for (UINT64 frame = 0; frame < frames; frame++)
+		{
+			samples.push_back(static_cast<float>(frame));
+			samples.push_back(-static_cast<float>(frame));
+		}
+
+		return PcmBufferSource::Create({ 48000, 2 }, samples.data(), frames, &source);
+	}
+
+	// Reads the trimmed source to its end in uneven pieces and checks every frame is the next one of the inner source
+	UINT64 ReadToEnd(PcmSource* source, UINT64 firstInnerFrame)
+	{
+		std::vector<float> buffer(2 * 1000);
+		UINT64 frames = 0;
+		UINT32 framesRead = 0;
+		UINT32 request = 1;
+
+		do
+		{
+			EXPECT_EQ(source->Read(buffer.data(), request, framesRead), S_OK);
+
+			for (UINT32 frame = 0; frame < framesRead; frame++)
+			{
+				EXPECT_EQ(buffer[frame * 2], static_cast<float>(firstInnerFrame + frames + frame)) << "frame " << frames + frame;
+			}
+
+			frames += framesRead;
+			request = request * 3 % 997 + 1;
+		}
+		while (framesRead != 0);
+
+		return frames;
+	}
+}
+
+
+TEST(GaplessInfo, LameTagOfMpeg1Stereo)
+{
+	std::vector<BYTE> mp3 = MakeLameMp3(true, false, 100, 576, 1260);
+
+	GaplessInfo info;
+	ASSERT_EQ(ReadGaplessInfo(mp3.data(), mp3.size(), info), S_OK);
+
+	// The decoder's 529 frames of delay are added to the encoder's and moved out of the padding
+	EXPECT_EQ(info.leadingFrames, 576u + 529u);
+	EXPECT_EQ(info.trailingFrames, 1260u - 529u);
+	EXPECT_EQ(info.validFrames, 100u * 1152u - 576u - 1260u);
+}
+
+TEST(GaplessInfo, LameTagOfMpeg2MonoBehindId3Tag)
+{
+	std::vector<BYTE> mp3 = MakeLameMp3(false, true, 40, 1105, 300, true);
+
+	GaplessInfo info;
+	ASSERT_EQ(ReadGaplessInfo(mp3.data(), mp3.size(), info), S_OK);
+
+	// Half as many frames per MPEG-2 frame, padding shorter than the decoder delay leaves none
+	EXPECT_EQ(info.leadingFrames, 1105u + 529u);
+	EXPECT_EQ(info.trailingFrames, 0u);
+	EXPECT_EQ(info.validFrames, 40u * 576u - 1105u - 300u);
+}
+
+TEST(GaplessInfo, Mp3WithoutLameTag)
+{
+	std::vector<BYTE> mp3 = MakeLameMp3(true, false, 100, 576, 1260);
+	memcpy(mp3.data() + 4 + 32 + 8 + 4 + 4 + 100 + 4, "Fake", 4);
+
+	GaplessInfo info = { 1, 2, 3 };
+	EXPECT_EQ(ReadGaplessInfo(mp3.data(), mp3.size(), info), S_FALSE);
+	EXPECT_EQ(info.leadingFrames, 0u);
+	EXPECT_EQ(info.trailingFrames, 0u);
+	EXPECT_EQ(info.validFrames, 0u);
+
+	// Cut off inside the tag
+	mp3 = MakeLameMp3(true, false, 100, 576, 1260);
+	EXPECT_EQ(ReadGaplessInfo(mp3.data(), 4 + 32 + 8 + 4 + 4 + 100 + 4 + 10, info), S_FALSE);
+}
+
+TEST(GaplessInfo, ItunSmpbOfMp4)
+{
+	std::vector<BYTE> mp4 = MakeItunesMp4(" 00000000 00000840 000001CA 00000000001CEF36 00000000 00000000 00000000 00000000");
+
+	GaplessInfo info;
+	ASSERT_EQ(ReadGaplessInfo(mp4.data(), mp4.size(), info), S_OK);
+
+	EXPECT_EQ(info.leadingFrames, 2112u);
+	EXPECT_EQ(info.trailingFrames, 458u);
+	EXPECT_EQ(info.validFrames, 1896246u);
+
+	// QuickTime writes meta without version and flags
+	mp4 = MakeItunesMp4(" 00000000 00000840 00000000 0000000000000800", false);
+	ASSERT_EQ(ReadGaplessInfo(mp4.data(), mp4.size(), info), S_OK);
+	EXPECT_EQ(info.leadingFrames, 2112u);
+	EXPECT_EQ(info.trailingFrames, 0u);
+	EXPECT_EQ(info.validFrames, 2048u);
+}
+
+TEST(GaplessInfo, BrokenItunSmpbIsCorrupt)
+{
+	std::vector<BYTE> mp4 = MakeItunesMp4(" 00000000 00000840");
+
+	GaplessInfo info;
+	EXPECT_EQ(ReadGaplessInfo(mp4.data(), mp4.size(), info), AUDIO_E_CORRUPT_DATA);
+	EXPECT_EQ(info.leadingFrames, 0u);
+}
+
+TEST(GaplessInfo, OpusPreSkipAndEndGranule)
+{
+	std::vector<BYTE> opus = MakeOggOpus(312, 96000 + 312);
+
+	GaplessInfo info;
+	ASSERT_EQ(ReadGaplessInfo(opus.data(), opus.size(), info), S_OK);
+
+	EXPECT_EQ(info.leadingFrames, 312u);
+	EXPECT_EQ(info.trailingFrames, 0u);
+	EXPECT_EQ(info.validFrames, 96000u);
+}
+
+TEST(GaplessInfo, CutOffOpusKeepsPreSkip)
+{
+	std::vector<BYTE> opus = MakeOggOpus(3840, 0, true);
+
+	GaplessInfo info;
+	ASSERT_EQ(ReadGaplessInfo(opus.data(), opus.size(), info), S_OK);
+
+	// The last page that is there is the audio page, that's where the stream ends for now
+	EXPECT_EQ(info.leadingFrames, 3840u);
+	EXPECT_EQ(info.validFrames, 48000u - 3840u);
+
+	// An end before the pre-skip is over
+	opus = MakeOggOpus(3840, 1000);
+	EXPECT_EQ(ReadGaplessInfo(opus.data(), opus.size(), info), AUDIO_E_CORRUPT_DATA);
+}
+
+TEST(GaplessInfo, OtherFilesHaveNone)
+{
+	std::vector<BYTE> flac = { 'f', 'L', 'a', 'C', 0, 0, 0, 34 };
+	flac.resize(200, 0);
+
+	GaplessInfo info;
+	EXPECT_EQ(ReadGaplessInfo(flac.data(), flac.size(), info), S_FALSE);
+
+	std::vector<BYTE> vorbis = MakeOggOpus(312, 1000);
+	memcpy(vorbis.data() + 28, "OpusHeaX", 8);
+	EXPECT_EQ(ReadGaplessInfo(vorbis.data(), vorbis.size(), info), S_FALSE);
+
+	EXPECT_EQ(ReadGaplessInfo(nullptr, 0, info), E_POINTER);
+}
+
+TEST(TrimSource, LengthFromTheTag)
+{
+	ComPtr<PcmBufferSource> inner;
+	ASSERT_EQ(CreateRamp(20000, inner), S_OK);
+
+	// What the LAME tag of MakeLameMp3(true, false, 16, 576, 1260) says
+	GaplessInfo info = { 576 + 529, 1260 - 529, 16 * 1152 - 576 - 1260 };
+
+	ComPtr<TrimSource> trim;
+	ASSERT_EQ(TrimSource::Create(inner, info, &trim), S_OK);
+
+	UINT64 length = 0;
+	ASSERT_EQ(trim->GetLength(length), S_OK);
+	EXPECT_EQ(length, 16u * 1152u - 576u - 1260u);
+
+	EXPECT_EQ(ReadToEnd(trim, 1105), length);
+
+	UINT64 position = 0;
+	ASSERT_EQ(trim->GetPosition(position), S_OK);
+	EXPECT_EQ(position, length);
+}
+
+TEST(TrimSource, LengthFromTheInnerSource)
+{
+	ComPtr<PcmBufferSource> inner;
+	ASSERT_EQ(CreateRamp(10000, inner), S_OK);
+
+	// No valid frame count, as in an Opus stream cut off before its last page
+	ComPtr<TrimSource> trim;
+	ASSERT_EQ(TrimSource::Create(inner, { 1105, 731, 0 }, &trim), S_OK);
+
+	UINT64 length = 0;
+	ASSERT_EQ(trim->GetLength(length), S_OK);
+	EXPECT_EQ(length, 10000u - 1105u - 731u);
+
+	EXPECT_EQ(ReadToEnd(trim, 1105), length);
+}
+
+TEST(TrimSource, SeeksAreInTrimmedFrames)
+{
+	std::vector<BYTE> opus = MakeOggOpus(312, 4000 + 312);
+
+	GaplessInfo info;
+	ASSERT_EQ(ReadGaplessInfo(opus.data(), opus.size(), info), S_OK);
+
+	// Stands in for the decoder, which has some padding after the end granule position
+	ComPtr<PcmBufferSource> inner;
+	ASSERT_EQ(CreateRamp(312 + 4000 + 648, inner), S_OK);
+
+	ComPtr<TrimSource> trim;
+	ASSERT_EQ(TrimSource::Create(inner, info, &trim), S_OK);
+
+	float frame[2];
+	UINT32 framesRead = 0;
+	UINT64 position = 0;
+
+	for (UINT64 target : { 0ull, 1ull, 2500ull, 3999ull })
+	{
+		ASSERT_EQ(trim->Seek(target), S_OK);
+		ASSERT_EQ(trim->GetPosition(position), S_OK);
+		EXPECT_EQ(position, target);
+
+		ASSERT_EQ(trim->Read(frame, 1, framesRead), S_OK);
+		ASSERT_EQ(framesRead, 1u);
+		EXPECT_EQ(frame[0], static_cast<float>(312 + target));
+		EXPECT_EQ(frame[1], -static_cast<float>(312 + target));
+
+		ASSERT_EQ(trim->GetPosition(position), S_OK);
+		EXPECT_EQ(position, target + 1);
+	}
+
+	// The padding is never played, not even after a seek near the end
+	ASSERT_EQ(trim->Seek(3990), S_OK);
+	EXPECT_EQ(ReadToEnd(trim, 312 + 3990), 10u);
+
+	ASSERT_EQ(trim->Seek(4000), S_OK);
+	ASSERT_EQ(trim->Read(frame, 1, framesRead), S_OK);
+	EXPECT_EQ(framesRead, 0u);
+}
@@ -0,0 +1,352 @@
+#include "FlacSource.h"
+#include "OfflineRender.h"
+#include "PcmSink.h"
+#include "WavSource.h"
+
+#include <gtest/gtest.h>
+
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <iterator>
+#include <string>
+#include <vector>
+
+
+using namespace AudioPlay;
+
+
+namespace
+{
+	// 24 bit, 6 channels and 7000 frames, the last block RenderOffline reads is short
+	constexpr UINT32 corpusChannels = 6;
+	constexpr UINT32 corpusSampleRate = 48000;
+	constexpr UINT64 corpusFrames = 7000;
+
+	// RIFF, WAVE, JUNK, fmt, fact and the data chunk header in front of the samples
+	constexpr size_t wavHeaderSize = 94;
+
+	std::vector<BYTE> ReadFile(const std::string& path)
+	{
+		std::ifstream stream(path, std::ios::binary);
+
+		return std::vector<BYTE>(std::istreambuf_iterator<char>(stream), std::istreambuf_iterator<char>());
+	}
+
+	UINT32 Get16(const std::vector<BYTE>& bytes, size_t offset)
+	{
+		return bytes[offset] | (bytes[offset + 1] << 8);
+	}
+
+	UINT32 Get32(const std::vector<BYTE>& bytes, size_t offset)
+	{
+		return Get16(bytes, offset) | (Get16(bytes, offset + 2) << 16);
+	}
+
+	std::string GetTag(const std::vector<BYTE>& bytes, size_t offset)
+	{
+		return std::string(bytes.begin() + offset, bytes.begin() + offset + 4);
+	}
+
+	HRESULT OpenCorpusFile(std::vector<BYTE>& bytes, ComPtr<PcmSource>& source)
+	{
+		bytes = ReadFile(AUDIOPLAY_TEST_DATA "/flac/s24_6ch_1152.flac");
+
+		ComPtr<MemoryBlock> block;
+		ComPtr<FlacSource> flac;
+
+		HRESULT hr = MemoryBlock::CreateFromSpan(bytes.data(), bytes.size(), &block);
+
+		if (SUCCEEDED(hr))
+		{
+			hr = FlacSource::Create(block, &flac);
+		}
+
+		source = ComPtr<PcmSource>(flac.p);
+
+		return hr;
+	}
+
+	// Reads in another block size than RenderOffline so that it doesn't hide its own mistakes
+	std::vector<float> DecodeAll(PcmSource* source)
+	{
+		const UINT32 channels = source->GetFormat().channels;
+
+		std::vector<float> samples;
+		std::vector<float> buffer(1000 * channels);
+		UINT32 framesRead = 0;
+
+		do
+		{
+			EXPECT_EQ(source->Read(buffer.data(), 1000, framesRead), S_OK);
+			samples.insert(samples.end(), buffer.begin(), buffer.begin() + framesRead * channels);
+		}
+		while (framesRead == 1000);
+
+		return samples;
+	}
+
+	// Every sample distinct, so a frame in the wrong place shows up
+	std::vector<float> MakeRamp(UINT64 frames, UINT32 channels)
+	{
+		std::vector<float> samples(static_cast<size_t>(frames * channels));
+
+		for (size_t index = 0; index < samples.size(); index++)
+		{
+			samples[index] = static_cast<float>(index % 1000003) / 1000003.0f;
+		}
+
+		return samples;
+	}
+
+	// A file under the test temp directory, removed again when the test is over
+	class WavFilePcmSinkTest : public testing::Test
+	{
+		protected:
+		std::string path;
+		std::wstring widePath;
+
+		void SetUp() override
+		{
+			path = testing::TempDir() + "PcmSinkTests." + testing::UnitTest::GetInstance()->current_test_info()->name() + ".wav";
+			widePath.assign(path.begin(), path.end());
+		}
+
+		void TearDown() override
+		{
+			std::remove(path.c_str());
+		}
+
+		void ExpectHeader(const std::vector<BYTE>& file, const PcmFormat& format, UINT64 frames)
+		{
+			const UINT32 blockAlign = format.channels * sizeof(float);
+			const UINT32 dataSize = static_cast<UINT32>(frames * blockAlign);
+
+			ASSERT_EQ(file.size(), wavHeaderSize + dataSize);
+
+			EXPECT_EQ(GetTag(file, 0), "RIFF");
+			EXPECT_EQ(Get32(file, 4), file.size() - 8);
+			EXPECT_EQ(GetTag(file, 8), "WAVE");
+
+			// Reserved for ds64, nothing in it as long as the file stays under 4 GB
+			EXPECT_EQ(GetTag(file, 12), "JUNK");
+			EXPECT_EQ(Get32(file, 16), 28u);
+			EXPECT_EQ(std::vector<BYTE>(file.begin() + 20, file.begin() + 48), std::vector<BYTE>(28, 0));
+
+			EXPECT_EQ(GetTag(file, 48), "fmt ");
+			EXPECT_EQ(Get32(file, 52), 18u);
+			EXPECT_EQ(Get16(file, 56), 0x0003u);
+			EXPECT_EQ(Get16(file, 58), format.channels);
+			EXPECT_EQ(Get32(file, 60), format.sampleRate);
+			EXPECT_EQ(Get32(file, 64), format.sampleRate * blockAlign);
+			EXPECT_EQ(Get16(file, 68), blockAlign);
+			EXPECT_EQ(Get16(file, 70), 32u);
+			EXPECT_EQ(Get16(file, 72), 0u);
+
+			EXPECT_EQ(GetTag(file, 74), "fact");
+			EXPECT_EQ(Get32(file, 78), 4u);
+			EXPECT_EQ(Get32(file, 82), frames);
+
+			EXPECT_EQ(GetTag(file, 86), "data");
+			EXPECT_EQ(Get32(file, 90), dataSize);
+		}
+	};
+}
+
+
+// RenderOffline hands over every frame of the source, in order and not a frame more
+TEST(RenderOffline, BufferSinkGetsEveryFrameOfTheSource)
+{
+	std::vector<BYTE> bytes;
+	ComPtr<PcmSource> source;
+	ASSERT_EQ(OpenCorpusFile(bytes, source), S_OK);
+
+	std::vector<float> expected = DecodeAll(source);
+	ASSERT_EQ(expected.size(), corpusFrames * corpusChannels);
+	ASSERT_EQ(source->Seek(0), S_OK);
+
+	ComPtr<BufferPcmSink> sink;
+	ASSERT_EQ(BufferPcmSink::Create(&sink), S_OK);
+
+	OfflineRenderStats stats;
+	ASSERT_EQ(RenderOffline(source, sink, &stats), S_OK);
+
+	EXPECT_EQ(stats.frames, corpusFrames);
+	EXPECT_GT(stats.speed, 0.0);
+
+	EXPECT_EQ(sink->GetFormat().sampleRate, corpusSampleRate);
+	EXPECT_EQ(sink->GetFormat().channels, corpusChannels);
+	ASSERT_EQ(sink->GetFrameCount(), corpusFrames);
+	EXPECT_EQ(memcmp(sink->GetFrames(), expected.data(), expected.size() * sizeof(float)), 0);
+}
+
+TEST(RenderOffline, NullSinkCountsFramesOfEachStream)
+{
+	std::vector<BYTE> bytes;
+	ComPtr<PcmSource> source;
+	ASSERT_EQ(OpenCorpusFile(bytes, source), S_OK);
+
+	ComPtr<NullPcmSink> sink;
+	ASSERT_EQ(NullPcmSink::Create(&sink), S_OK);
+
+	ASSERT_EQ(RenderOffline(source, sink, nullptr), S_OK);
+	EXPECT_EQ(sink->GetFramesWritten(), corpusFrames);
+
+	// A second render starts counting again
+	ASSERT_EQ(source->Seek(corpusFrames - 100), S_OK);
+	ASSERT_EQ(RenderOffline(source, sink, nullptr), S_OK);
+	EXPECT_EQ(sink->GetFramesWritten(), 100u);
+}
+
+TEST(RenderOffline, MissingSourceOrSinkIsRejected)
+{
+	ComPtr<NullPcmSink> sink;
+	ASSERT_EQ(NullPcmSink::Create(&sink), S_OK);
+
+	OfflineRenderStats stats = { 1, 1, 1.0 };
+	EXPECT_EQ(RenderOffline(nullptr, sink, &stats), E_POINTER);
+	EXPECT_EQ(stats.frames, 0u);
+	EXPECT_EQ(stats.nanoseconds, 0u);
+}
+
+// Past the 65536 frames the buffer starts with, growing it keeps what was written
+TEST(BufferPcmSink, GrowingKeepsEveryFrame)
+{
+	constexpr UINT32 channels = 2;
+	constexpr UINT64 frames = 300000;
+	std::vector<float> samples = MakeRamp(frames, channels);
+
+	ComPtr<BufferPcmSink> sink;
+	ASSERT_EQ(BufferPcmSink::Create(&sink), S_OK);
+	ASSERT_EQ(sink->BeginStream({ 44100, channels }), S_OK);
+
+	// Odd sizes, the writes don't line up with the capacity
+	for (UINT64 frame = 0; frame < frames; )
+	{
+		UINT32 frameCount = static_cast<UINT32>(frames - frame < 7777 ? frames - frame : 7777);
+		ASSERT_EQ(sink->Write(samples.data() + frame * channels, frameCount), S_OK);
+		frame += frameCount;
+	}
+
+	ASSERT_EQ(sink->EndStream(), S_OK);
+	ASSERT_EQ(sink->GetFrameCount(), frames);
+	EXPECT_EQ(memcmp(sink->GetFrames(), samples.data(), samples.size() * sizeof(float)), 0);
+
+	// The next stream replaces the frames
+	ASSERT_EQ(sink->BeginStream({ 48000, 1 }), S_OK);
+	EXPECT_EQ(sink->GetFrameCount(), 0u);
+	ASSERT_EQ(sink->Write(samples.data(), 10), S_OK);
+	EXPECT_EQ(sink->GetFrameCount(), 10u);
+	EXPECT_EQ(memcmp(sink->GetFrames(), samples.data(), 10 * sizeof(float)), 0);
+}
+
+TEST(BufferPcmSink, WriteNeedsAStream)
+{
+	float frame[2] = { 0.5f, -0.5f };
+
+	ComPtr<BufferPcmSink> sink;
+	ASSERT_EQ(BufferPcmSink::Create(&sink), S_OK);
+
+	EXPECT_EQ(sink->Write(frame, 1), E_UNEXPECTED);
+	EXPECT_EQ(sink->BeginStream({ 48000, 0 }), E_INVALIDARG);
+	EXPECT_EQ(sink->Write(frame, 1), E_UNEXPECTED);
+	EXPECT_EQ(sink->GetFrameCount(), 0u);
+}
+
+// The header says what was written and WavSource reads back the same samples
+TEST_F(WavFilePcmSinkTest, RenderedFileReadsBackBitExact)
+{
+	std::vector<BYTE> bytes;
+	ComPtr<PcmSource> source;
+	ASSERT_EQ(OpenCorpusFile(bytes, source), S_OK);
+
+	std::vector<float> expected = DecodeAll(source);
+	ASSERT_EQ(source->Seek(0), S_OK);
+
+	ComPtr<WavFilePcmSink> sink;
+	ASSERT_EQ(WavFilePcmSink::Create(widePath.c_str(), &sink), S_OK);
+	ASSERT_EQ(RenderOffline(source, sink, nullptr), S_OK);
+
+	std::vector<BYTE> file = ReadFile(path);
+	ExpectHeader(file, { corpusSampleRate, corpusChannels }, corpusFrames);
+
+	ComPtr<MemoryBlock> block;
+	ComPtr<WavSource> wav;
+	ASSERT_EQ(MemoryBlock::CreateFromSpan(file.data(), file.size(), &block), S_OK);
+	ASSERT_EQ(WavSource::Create(block, &wav), S_OK);
+
+	UINT64 length = 0;
+	ASSERT_EQ(wav->GetLength(length), S_OK);
+	EXPECT_EQ(length, corpusFrames);
+	EXPECT_EQ(wav->GetFormat().sampleRate, corpusSampleRate);
+	EXPECT_EQ(wav->GetFormat().channels, corpusChannels);
+
+	std::vector<float> samples = DecodeAll(wav);
+	ASSERT_EQ(samples.size(), expected.size());
+	EXPECT_EQ(memcmp(samples.data(), expected.data(), expected.size() * sizeof(float)), 0);
+}
+
+// EndStream only finishes the file once, later calls find nothing to do
+TEST_F(WavFilePcmSinkTest, EndStreamClosesTheFile)
+{
+	std::vector<float> samples = MakeRamp(100, 1);
+
+	ComPtr<WavFilePcmSink> sink;
+	ASSERT_EQ(WavFilePcmSink::Create(widePath.c_str(), &sink), S_OK);
+	ASSERT_EQ(sink->BeginStream({ 22050, 1 }), S_OK);
+	ASSERT_EQ(sink->Write(samples.data(), 100), S_OK);
+
+	EXPECT_EQ(sink->EndStream(), S_OK);
+	EXPECT_EQ(sink->EndStream(), S_FALSE);
+	EXPECT_EQ(sink->Write(samples.data(), 100), E_UNEXPECTED);
+	EXPECT_EQ(sink->BeginStream({ 22050, 1 }), E_UNEXPECTED);
+
+	ExpectHeader(ReadFile(path), { 22050, 1 }, 100);
+}
+
+// Released without EndStream, say by a render that failed, the file still has a valid header for what was written
+TEST_F(WavFilePcmSinkTest, ReleaseFinishesTheFile)
+{
+	std::vector<float> samples = MakeRamp(333, 2);
+
+	ComPtr<WavFilePcmSink> sink;
+	ASSERT_EQ(WavFilePcmSink::Create(widePath.c_str(), &sink), S_OK);
+	ASSERT_EQ(sink->BeginStream({ 44100, 2 }), S_OK);
+	ASSERT_EQ(sink->Write(samples.data(), 333), S_OK);
+
+	// Until then the header holds the sizes of an empty stream
+	ASSERT_EQ(fflush(nullptr), 0);
+	std::vector<BYTE> partial = ReadFile(path);
+	ASSERT_GE(partial.size(), wavHeaderSize);
+	EXPECT_EQ(Get32(partial, 90), 0u);
+
+	sink = nullptr;
+
+	std::vector<BYTE> file = ReadFile(path);
+	ExpectHeader(file, { 44100, 2 }, 333);
+	EXPECT_EQ(memcmp(file.data() + wavHeaderSize, samples.data(), samples.size() * sizeof(float)), 0);
+}
+
+TEST_F(WavFilePcmSinkTest, FormatsAWavCantHoldAreRejected)
+{
+	float frame = 0.0f;
+
+	ComPtr<WavFilePcmSink> sink;
+	ASSERT_EQ(WavFilePcmSink::Create(widePath.c_str(), &sink), S_OK);
+
+	EXPECT_EQ(sink->Write(&frame, 1), E_UNEXPECTED);
+	EXPECT_EQ(sink->BeginStream({ 48000, 0 }), E_INVALIDARG);
+	EXPECT_EQ(sink->BeginStream({ 48000, 0x10000 }), E_INVALIDARG);
+	EXPECT_EQ(sink->BeginStream({ 0, 2 }), E_INVALIDARG);
+
+	// Nothing was started, the file stays empty
+	EXPECT_EQ(sink->EndStream(), S_OK);
+	EXPECT_EQ(ReadFile(path).size(), 0u);
+}
+
+TEST(WavFilePcmSink, UnwritablePathFails)
+{
+	ComPtr<WavFilePcmSink> sink;
+	EXPECT_TRUE(FAILED(WavFilePcmSink::Create(L"/nonexistent-directory/PcmSinkTests.wav", &sink)));
+	EXPECT_EQ(static_cast<WavFilePcmSink*>(sink), nullptr);
+}
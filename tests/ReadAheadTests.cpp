@@ -0,0 +1,185 @@
+#include "ReadAheadStream.h"
+
+#include <gtest/gtest.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <thread>
+#include <vector>
+
+
+using namespace AudioPlay;
+using namespace std::chrono_literals;
+
+
+namespace
+{
+	constexpr UINT32 chunkSize = 16 * 1024;
+	constexpr UINT32 depth = 8;
+
+	// Reads from memory, so the throttling is all the storage costs
+	class MemoryByteReader : public ByteReader
+	{
+		std::vector<BYTE> bytes;
+
+		public:
+		explicit MemoryByteReader(size_t size) :
+			bytes(size)
+		{
+			for (size_t index = 0; index < size; index++)
+			{
+				bytes[index] = static_cast<BYTE>(index * 7 + (index >> 12));
+			}
+		}
+
+		HRESULT ReadAt(_In_ UINT64 offset, _Out_writes_bytes_to_(byteCount, bytesRead) BYTE* buffer, _In_ UINT32 byteCount, _Out_ UINT32& bytesRead) override
+		{
+			bytesRead = offset < bytes.size() ? static_cast<UINT32>(std::min<UINT64>(byteCount, bytes.size() - offset)) : 0;
+			memcpy(buffer, bytes.data() + offset, bytesRead);
+
+			return S_OK;
+		}
+
+		UINT64 GetSize() const override { return bytes.size(); }
+
+		const BYTE* GetBytes() const { return bytes.data(); }
+	};
+
+	// A slow network share, each 16 KB chunk takes about 4 ms
+	class ReadAheadTest : public testing::Test
+	{
+		protected:
+		ComPtr<MemoryByteReader> memory;
+		ComPtr<ThrottledByteReader> throttled;
+		ComPtr<ReadAheadStream> stream;
+
+		void Open(size_t size)
+		{
+			memory.Attach(new MemoryByteReader(size));
+			ASSERT_EQ(ThrottledByteReader::Create(memory, 2ms, 8 * 1024 * 1024, &throttled), S_OK);
+			ASSERT_EQ(ReadAheadStream::Create(throttled, { chunkSize, depth }, &stream), S_OK);
+		}
+
+		// Until the I/O thread has read this many chunks, false if it never gets there
+		bool WaitForFetches(UINT64 fetches)
+		{
+			auto deadline = std::chrono::steady_clock::now() + 10s;
+
+			while (stream->GetStatistics().fetches < fetches)
+			{
+				if (std::chrono::steady_clock::now() > deadline)
+				{
+					return false;
+				}
+				std::this_thread::sleep_for(1ms);
+			}
+
+			// Anything past what was expected would show up as a read of the underlying reader
+			std::this_thread::sleep_for(20ms);
+
+			return true;
+		}
+
+		void ExpectRead(UINT64 position, UINT32 byteCount)
+		{
+			std::vector<BYTE> buffer(byteCount);
+			UINT32 bytesRead = 0;
+
+			ASSERT_EQ(stream->Seek(position), S_OK);
+			ASSERT_EQ(stream->Read(buffer.data(), byteCount, bytesRead), S_OK);
+			ASSERT_EQ(bytesRead, byteCount);
+			EXPECT_EQ(memcmp(buffer.data(), memory->GetBytes() + position, byteCount), 0) << "at " << position;
+		}
+	};
+}
+
+
+// Reading slower than storage delivers, the window stays ahead and no read waits
+TEST_F(ReadAheadTest, PlaybackRateReadsNeverStallOnceFull)
+{
+	constexpr UINT32 readSize = 4096;
+	constexpr UINT32 fileChunks = 40;
+
+	Open(fileChunks * chunkSize);
+
+	// The chunk under the position and depth ahead
+	ASSERT_TRUE(WaitForFetches(depth + 1));
+	EXPECT_EQ(throttled->GetReadCount(), depth + 1);
+
+	std::vector<BYTE> buffer(readSize);
+	UINT64 position = 0;
+
+	while (position < stream->GetSize())
+	{
+		UINT32 bytesRead = 0;
+		ASSERT_EQ(stream->Read(buffer.data(), readSize, bytesRead), S_OK);
+		ASSERT_EQ(bytesRead, readSize);
+		ASSERT_EQ(memcmp(buffer.data(), memory->GetBytes() + position, readSize), 0) << "at " << position;
+
+		position += bytesRead;
+
+		// A quarter of what the throttled reader delivers
+		std::this_thread::sleep_for(4ms);
+	}
+
+	ReadAheadStatistics statistics = stream->GetStatistics();
+	EXPECT_EQ(statistics.stalls, 0u);
+	EXPECT_EQ(statistics.hits, statistics.chunkReads);
+	EXPECT_EQ(statistics.bytesRead, stream->GetSize());
+	// Every chunk once
+	EXPECT_EQ(statistics.fetches, fileChunks);
+	EXPECT_EQ(throttled->GetReadCount(), fileChunks);
+}
+
+// The whole file fits in the window, seeking around it is served from memory
+TEST_F(ReadAheadTest, SeeksInsideTheWindowDontReadStorage)
+{
+	Open((depth + 1) * chunkSize - 100);
+
+	ASSERT_TRUE(WaitForFetches(depth + 1));
+	const UINT64 readCount = throttled->GetReadCount();
+	EXPECT_EQ(readCount, depth + 1);
+
+	for (UINT64 position : { UINT64(5 * chunkSize + 10), UINT64(100), UINT64(8 * chunkSize + 1000), UINT64(2 * chunkSize - 50), UINT64(7 * chunkSize) })
+	{
+		ExpectRead(position, 1000);
+	}
+
+	// The last chunk is short, the read ends with the file
+	std::vector<BYTE> buffer(1000);
+	UINT32 bytesRead = 0;
+	ASSERT_EQ(stream->Seek(stream->GetSize() - 10), S_OK);
+	ASSERT_EQ(stream->Read(buffer.data(), 1000, bytesRead), S_OK);
+	EXPECT_EQ(bytesRead, 10u);
+
+	std::this_thread::sleep_for(20ms);
+
+	EXPECT_EQ(throttled->GetReadCount(), readCount);
+	EXPECT_EQ(stream->GetStatistics().stalls, 0u);
+}
+
+// The chunk behind the position is kept, a short seek back costs nothing either
+TEST_F(ReadAheadTest, SeekBackOneChunkDoesntReadStorage)
+{
+	Open(40 * chunkSize);
+
+	ASSERT_TRUE(WaitForFetches(depth + 1));
+
+	// Into chunk 3, the window is chunks 3 to 3 + depth
+	ExpectRead(3 * chunkSize + 100, 1000);
+	ASSERT_TRUE(WaitForFetches(depth + 4));
+
+	const UINT64 readCount = throttled->GetReadCount();
+	EXPECT_EQ(readCount, depth + 4);
+
+	// Chunk 2 is still loaded and so is the window from there
+	ExpectRead(2 * chunkSize + 5000, 1000);
+	ExpectRead(3 * chunkSize + 7000, 1000);
+	ExpectRead(2 * chunkSize, 1000);
+
+	std::this_thread::sleep_for(20ms);
+
+	EXPECT_EQ(throttled->GetReadCount(), readCount);
+	EXPECT_EQ(stream->GetStatistics().stalls, 0u);
+}
@@ -0,0 +1,311 @@
+#include "SharedPcm.h"
+
+#include <gtest/gtest.h>
+
+#include <chrono>
+#include <string>
+
+#include <poll.h>
+#include <signal.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+
+using namespace AudioPlay;
+
+
+namespace
+{
+	// Both streams of tests/SharedPcmWriterProcess.cpp, stereo then mono
+	constexpr UINT32 blockFrames = 480;
+	constexpr UINT32 streamCount = 2;
+
+	// What a reader saw of the writer's frames
+	struct ReadResult
+	{
+		UINT64 framesRead = 0;
+		UINT32 blocks = 0;
+		UINT32 streamsStarted = 0;
+		UINT32 gaps = 0;
+		UINT32 wrongSamples = 0;
+		UINT64 firstFrame = 0;
+		UINT64 endFrame = 0;
+	};
+
+	// The writer runs SharedPcmWriterProcess on the other end of two pipes, as another program would
+	class WriterProcess
+	{
+		pid_t process = -1;
+		int toWriter = -1;
+		int fromWriter = -1;
+
+		public:
+		std::wstring name;
+
+		~WriterProcess()
+		{
+			Kill();
+		}
+
+		bool Start(const char* test, UINT32 capacityFrames, UINT32 blocksPerStream, UINT32 pauseMicroseconds)
+		{
+			std::string narrowName = std::string("SharedPcmTests.") + test + "." + std::to_string(getpid());
+			name.assign(narrowName.begin(), narrowName.end());
+
+			int input[2];
+			int output[2];
+			if (pipe(input) != 0 || pipe(output) != 0)
+			{
+				return false;
+			}
+
+			std::string capacity = std::to_string(capacityFrames);
+			std::string blocks = std::to_string(blocksPerStream);
+			std::string pause = std::to_string(pauseMicroseconds);
+
+			process = fork();
+
+			if (process == 0)
+			{
+				dup2(input[0], STDIN_FILENO);
+				dup2(output[1], STDOUT_FILENO);
+				close(input[1]);
+				close(output[0]);
+
+				execl(AUDIOPLAY_SHARED_PCM_WRITER, AUDIOPLAY_SHARED_PCM_WRITER, narrowName.c_str(), capacity.c_str(), blocks.c_str(), pause.c_str(), static_cast<char*>(nullptr));
+				_exit(127);
+			}
+
+			close(input[0]);
+			close(output[1]);
+			toWriter = input[1];
+			fromWriter = output[0];
+
+			return process > 0 && Expect('r');
+		}
+
+		bool Signal()
+		{
+			char signal = 'g';
+			return write(toWriter, &signal, 1) == 1;
+		}
+
+		// Blocks until the writer sends the signal
+		bool Expect(char expected)
+		{
+			char signal = 0;
+			return read(fromWriter, &signal, 1) == 1 && signal == expected;
+		}
+
+		// True once the writer sent 'd', everything it had to write is in the ring
+		bool IsDone()
+		{
+			pollfd descriptor = { fromWriter, POLLIN, 0 };
+			return poll(&descriptor, 1, 0) == 1 && Expect('d');
+		}
+
+		// The exit code
+		int Finish()
+		{
+			int status = 0;
+			waitpid(process, &status, 0);
+			process = -1;
+
+			return WIFEXITED(status) ? WEXITSTATUS(status) : -1;
+		}
+
+		void Kill()
+		{
+			if (process > 0)
+			{
+				kill(process, SIGKILL);
+				waitpid(process, nullptr, 0);
+				process = -1;
+			}
+
+			if (toWriter != -1)
+			{
+				close(toWriter);
+				close(fromWriter);
+				toWriter = -1;
+				fromWriter = -1;
+			}
+		}
+	};
+
+	HRESULT OpenReader(const std::wstring& name, ComPtr<SharedPcmReader>& reader)
+	{
+		return SharedPcmReader::Open(name.c_str(), &reader);
+	}
+
+	// Checks every block against the writer's pattern and that each one carries on where the last one stopped
+	void ReadAvailable(SharedPcmReader* reader, ReadResult& result)
+	{
+		SharedPcmBlock block;
+
+		while (reader->Acquire(block) == S_OK)
+		{
+			if (block.streamStarted)
+			{
+				result.streamsStarted++;
+			}
+			else if (result.blocks > 0 && block.firstFrame != result.endFrame + block.droppedFrames)
+			{
+				result.gaps++;
+			}
+
+			if (result.blocks == 0)
+			{
+				result.firstFrame = block.firstFrame;
+			}
+
+			for (UINT32 frame = 0; frame < block.frameCount; frame++)
+			{
+				for (UINT32 channel = 0; channel < block.format.channels; channel++)
+				{
+					float expected = static_cast<float>((block.firstFrame + frame) % 1000000) + channel * 0.25f;
+
+					if (block.frames[frame * block.format.channels + channel] != expected)
+					{
+						result.wrongSamples++;
+					}
+				}
+			}
+
+			EXPECT_TRUE(reader->Release(block)) << "frame " << block.firstFrame;
+
+			result.blocks++;
+			result.framesRead += block.frameCount;
+			result.endFrame = block.firstFrame + block.frameCount;
+		}
+	}
+}
+
+
+// A reader that keeps up gets every frame in order, and waits on the writer between its blocks
+TEST(SharedPcmProcess, ReaderThatKeepsUpSeesEveryFrame)
+{
+	constexpr UINT32 blocksPerStream = 100;
+
+	WriterProcess writer;
+	ASSERT_TRUE(writer.Start("KeepsUp", 1 << 16, blocksPerStream, 2000));
+
+	ComPtr<SharedPcmReader> reader;
+	ASSERT_EQ(OpenReader(writer.name, reader), S_OK);
+	EXPECT_EQ(reader->GetCapacityFrames(), 1u << 16);
+	EXPECT_EQ(reader->GetState(), SharedPcmState::Idle);
+
+	ASSERT_TRUE(writer.Signal());
+
+	ReadResult result;
+	bool done = false;
+	auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(30);
+
+	while (!done && std::chrono::steady_clock::now() < deadline)
+	{
+		done = writer.IsDone();
+		ReadAvailable(reader, result);
+
+		if (!done)
+		{
+			reader->Wait(100);
+		}
+	}
+
+	ASSERT_TRUE(done);
+	EXPECT_EQ(reader->GetState(), SharedPcmState::Ended);
+
+	EXPECT_EQ(result.framesRead, UINT64(streamCount) * blocksPerStream * blockFrames);
+	EXPECT_EQ(result.firstFrame, 0u);
+	EXPECT_EQ(result.endFrame, result.framesRead);
+	EXPECT_EQ(result.streamsStarted, streamCount);
+	EXPECT_EQ(result.gaps, 0u);
+	EXPECT_EQ(result.wrongSamples, 0u);
+
+	EXPECT_EQ(reader->GetDroppedFrames(), 0u);
+	EXPECT_EQ(reader->GetTornBlocks(), 0u);
+	// The writer pauses after every block, the reader got there first at least once
+	EXPECT_GT(reader->GetUnderruns(), 0u);
+
+	ASSERT_TRUE(writer.Signal());
+	EXPECT_EQ(writer.Finish(), 0);
+
+	EXPECT_EQ(reader->Wait(1000), S_OK);
+	EXPECT_EQ(reader->GetState(), SharedPcmState::Closed);
+}
+
+// A reader that only looks after the writer is done gets the newest ring full, the rest of that stream is counted as dropped
+TEST(SharedPcmProcess, ReaderThatFallsBehindCountsDroppedFrames)
+{
+	constexpr UINT32 capacityFrames = 4096;
+	constexpr UINT32 blocksPerStream = 200;
+	constexpr UINT64 streamFrames = UINT64(blocksPerStream) * blockFrames;
+
+	WriterProcess writer;
+	ASSERT_TRUE(writer.Start("FallsBehind", capacityFrames, blocksPerStream, 0));
+
+	ComPtr<SharedPcmReader> reader;
+	ASSERT_EQ(OpenReader(writer.name, reader), S_OK);
+
+	ASSERT_TRUE(writer.Signal());
+	ASSERT_TRUE(writer.Expect('d'));
+
+	ReadResult result;
+	ReadAvailable(reader, result);
+
+	// The first stream ended before the reader looked, it moves straight to the second one
+	EXPECT_EQ(result.streamsStarted, 1u);
+	EXPECT_EQ(result.framesRead, capacityFrames);
+	EXPECT_EQ(result.firstFrame, streamCount * streamFrames - capacityFrames);
+	EXPECT_EQ(result.endFrame, streamCount * streamFrames);
+	EXPECT_EQ(result.gaps, 0u);
+	EXPECT_EQ(result.wrongSamples, 0u);
+
+	EXPECT_EQ(reader->GetDroppedFrames(), streamFrames - capacityFrames);
+	EXPECT_EQ(reader->GetDroppedFrames() + result.framesRead, streamFrames);
+	EXPECT_EQ(reader->GetTornBlocks(), 0u);
+	// Nothing was asked for while the writer streamed
+	EXPECT_EQ(reader->GetUnderruns(), 0u);
+
+	ASSERT_TRUE(writer.Signal());
+	EXPECT_EQ(writer.Finish(), 0);
+}
+
+// A writer that is killed never says Closed, the reader finds out its process is gone and another writer takes the name over
+TEST(SharedPcmProcess, KilledWriterIsSeenAsClosed)
+{
+	WriterProcess writer;
+	ASSERT_TRUE(writer.Start("Killed", 1 << 16, 100000, 2000));
+
+	ComPtr<SharedPcmReader> reader;
+	ASSERT_EQ(OpenReader(writer.name, reader), S_OK);
+	ASSERT_TRUE(writer.Signal());
+
+	ReadResult result;
+	auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(30);
+
+	while (result.framesRead < 10 * blockFrames && std::chrono::steady_clock::now() < deadline)
+	{
+		reader->Wait(100);
+		ReadAvailable(reader, result);
+	}
+
+	ASSERT_GE(result.framesRead, 10u * blockFrames);
+	EXPECT_EQ(reader->GetState(), SharedPcmState::Streaming);
+
+	writer.Kill();
+
+	while (reader->GetState() != SharedPcmState::Closed && std::chrono::steady_clock::now() < deadline)
+	{
+		reader->Wait(100);
+		ReadAvailable(reader, result);
+	}
+
+	EXPECT_EQ(reader->GetState(), SharedPcmState::Closed);
+	EXPECT_EQ(result.gaps, 0u);
+	EXPECT_EQ(result.wrongSamples, 0u);
+	EXPECT_EQ(reader->GetDroppedFrames(), 0u);
+
+	ComPtr<SharedPcmWriter> replacement;
+	EXPECT_EQ(SharedPcmWriter::Create(writer.name.c_str(), 1 << 16, 2, &replacement), S_OK);
+}
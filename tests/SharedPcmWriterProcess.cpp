@@ -0,0 +1,87 @@
+#include "SharedPcm.h"
+
+#include <cstdlib>
+#include <string>
+#include <vector>
+
+#include <time.h>
+#include <unistd.h>
+
+
+using namespace AudioPlay;
+
+
+// The other side of SharedPcmTests, run as its own process
+// SharedPcmWriterProcess name capacityFrames blocksPerStream pauseMicroseconds
+// Writes 'r' to stdout once the ring exists, streams when a byte comes on stdin, writes 'd' when it is done
+// and closes the ring when the next byte comes
+int main(int argc, char** argv)
+{
+	if (argc != 5)
+	{
+		return 1;
+	}
+
+	std::string narrowName = argv[1];
+	std::wstring name(narrowName.begin(), narrowName.end());
+	const UINT32 capacityFrames = static_cast<UINT32>(strtoul(argv[2], nullptr, 10));
+	const UINT32 blocksPerStream = static_cast<UINT32>(strtoul(argv[3], nullptr, 10));
+	const long pauseMicroseconds = strtol(argv[4], nullptr, 10);
+
+	// Frame f has f % 1000000 + channel / 4 in every channel, so the reader can tell where any sample came from
+	constexpr UINT32 blockFrames = 480;
+	const PcmFormat streams[] = { { 48000, 2 }, { 44100, 1 } };
+
+	ComPtr<SharedPcmWriter> writer;
+	if (FAILED(SharedPcmWriter::Create(name.c_str(), capacityFrames, 2, &writer)))
+	{
+		return 2;
+	}
+
+	char signal = 'r';
+	if (write(STDOUT_FILENO, &signal, 1) != 1 || read(STDIN_FILENO, &signal, 1) != 1)
+	{
+		return 3;
+	}
+
+	std::vector<float> block(blockFrames * 2);
+
+	for (const PcmFormat& format : streams)
+	{
+		if (FAILED(writer->BeginStream(format)))
+		{
+			return 4;
+		}
+
+		for (UINT32 index = 0; index < blocksPerStream; index++)
+		{
+			const UINT64 firstFrame = writer->GetWrittenFrames();
+
+			for (UINT32 frame = 0; frame < blockFrames; frame++)
+			{
+				for (UINT32 channel = 0; channel < format.channels; channel++)
+				{
+					block[frame * format.channels + channel] = static_cast<float>((firstFrame + frame) % 1000000) + channel * 0.25f;
+				}
+			}
+
+			writer->Write(block.data(), blockFrames);
+
+			if (pauseMicroseconds > 0)
+			{
+				timespec pause = { 0, pauseMicroseconds * 1000 };
+				nanosleep(&pause, nullptr);
+			}
+		}
+
+		writer->EndStream();
+	}
+
+	signal = 'd';
+	if (write(STDOUT_FILENO, &signal, 1) != 1 || read(STDIN_FILENO, &signal, 1) != 1)
+	{
+		return 5;
+	}
+
+	return 0;
+}
@@ -0,0 +1,316 @@
+#include "WavSource.h"
+
+#include <gtest/gtest.h>
+
+#include <cmath>
+#include <cstring>
+#include <vector>
+
+
+using namespace AudioPlay;
+
+
+namespace
+{
+	constexpr WORD waveFormatPcm = 0x0001;
+	constexpr WORD waveFormatIeeeFloat = 0x0003;
+	constexpr WORD waveFormatMpegLayer3 = 0x0055;
+	constexpr WORD waveFormatExtensible = 0xFFFE;
+
+	// Not a multiple of the 4 and 8 samples the SSE2 kernels take at once, so their scalar tails run too
+	constexpr UINT32 testFrames = 37;
+
+	void Append16(std::vector<BYTE>& bytes, UINT32 value)
+	{
+		bytes.push_back(static_cast<BYTE>(value));
+		bytes.push_back(static_cast<BYTE>(value >> 8));
+	}
+
+	void Append32(std::vector<BYTE>& bytes, UINT32 value)
+	{
+		Append16(bytes, value);
+		Append16(bytes, value >> 16);
+	}
+
+	void AppendChunk(std::vector<BYTE>& bytes, const char* tag, const std::vector<BYTE>& body, UINT32 declaredSize)
+	{
+		bytes.insert(bytes.end(), tag, tag + 4);
+		Append32(bytes, declaredSize);
+		bytes.insert(bytes.end(), body.begin(), body.end());
+
+		// Chunks are padded to an even size
+		if (body.size() & 1)
+		{
+			bytes.push_back(0);
+		}
+	}
+
+	struct WavDescription
+	{
+		WORD formatTag;
+		UINT32 channels;
+		UINT32 bitsPerSample;
+		// Inside WAVE_FORMAT_EXTENSIBLE if it isn't 0
+		WORD subFormat;
+		// Put in front of the data chunk with an odd size
+		bool oddChunk;
+	};
+
+	std::vector<BYTE> MakeWav(const WavDescription& description, const std::vector<BYTE>& samples, UINT32 declaredDataSize)
+	{
+		const UINT32 blockAlign = description.channels * description.bitsPerSample / 8;
+
+		std::vector<BYTE> format;
+		Append16(format, description.subFormat ? waveFormatExtensible : description.formatTag);
+		Append16(format, description.channels);
+		Append32(format, 48000);
+		Append32(format, 48000 * blockAlign);
+		Append16(format, blockAlign);
+		Append16(format, description.bitsPerSample);
+
+		if (description.subFormat)
+		{
+			Append16(format, 22);
+			Append16(format, description.bitsPerSample);
+			Append32(format, description.channels == 2 ? 3 : 4);
+
+			// KSDATAFORMAT_SUBTYPE_PCM and _IEEE_FLOAT only differ in the first two bytes
+			const BYTE guidTail[] = { 0x00, 0x00, 0x00, 0x00, 0x10, 0x00, 0x80, 0x00, 0x00, 0xAA, 0x00, 0x38, 0x9B, 0x71 };
+			Append16(format, description.subFormat);
+			format.insert(format.end(), guidTail, guidTail + sizeof(guidTail));
+		}
+
+		std::vector<BYTE> chunks;
+		AppendChunk(chunks, "fmt ", format, static_cast<UINT32>(format.size()));
+
+		if (description.oddChunk)
+		{
+			std::vector<BYTE> list = { 'I', 'N', 'F', 'O', 'I', 'N', 'A', 'M', 3, 0, 0, 0, 'a', 'b', 0 };
+			AppendChunk(chunks, "LIST", list, static_cast<UINT32>(list.size()));
+		}
+
+		AppendChunk(chunks, "data", samples, declaredDataSize);
+
+		std::vector<BYTE> file = { 'R', 'I', 'F', 'F' };
+		Append32(file, static_cast<UINT32>(chunks.size() + 4));
+		file.insert(file.end(), { 'W', 'A', 'V', 'E' });
+		file.insert(file.end(), chunks.begin(), chunks.end());
+
+		return file;
+	}
+
+	// Full scale values at both ends and a ramp between them
+	std::vector<INT64> TestValues(UINT32 count, UINT32 bits)
+	{
+		const INT64 maximum = (INT64(1) << (bits - 1)) - 1;
+		const INT64 minimum = -maximum - 1;
+
+		std::vector<INT64> values = { minimum, maximum, 0, -1, 1 };
+
+		while (values.size() < count)
+		{
+			INT64 index = static_cast<INT64>(values.size());
+			values.push_back(minimum + (maximum - minimum) * index / static_cast<INT64>(count));
+		}
+
+		return values;
+	}
+
+	void AppendSample(std::vector<BYTE>& bytes, INT64 value, UINT32 bits)
+	{
+		for (UINT32 byte = 0; byte < bits / 8; byte++)
+		{
+			bytes.push_back(static_cast<BYTE>(static_cast<UINT64>(value) >> (byte * 8)));
+		}
+	}
+
+	class WavSourceTest : public testing::Test
+	{
+		protected:
+		std::vector<BYTE> file;
+		ComPtr<MemoryBlock> block;
+		ComPtr<WavSource> source;
+
+		HRESULT Open(std::vector<BYTE> bytes)
+		{
+			source = nullptr;
+			block = nullptr;
+			file = std::move(bytes);
+
+			HRESULT hr = MemoryBlock::CreateFromSpan(file.data(), file.size(), &block);
+
+			return SUCCEEDED(hr) ? WavSource::Create(block, &source) : hr;
+		}
+
+		std::vector<float> ReadAll()
+		{
+			UINT64 length = 0;
+			source->GetLength(length);
+
+			std::vector<float> samples(static_cast<size_t>(length) * source->GetFormat().channels);
+			UINT32 framesRead = 0;
+			EXPECT_EQ(source->Read(samples.data(), static_cast<UINT32>(length), framesRead), S_OK);
+			EXPECT_EQ(framesRead, length);
+
+			return samples;
+		}
+
+		// Integers are scaled to [-1, 1), 8 bit WAV samples are unsigned
+		void ExpectIntegers(const WavDescription& description)
+		{
+			const UINT32 bits = description.bitsPerSample;
+			std::vector<INT64> values = TestValues(testFrames * description.channels, bits);
+
+			std::vector<BYTE> samples;
+			for (INT64 value : values)
+			{
+				AppendSample(samples, bits == 8 ? value + 128 : value, bits);
+			}
+
+			ASSERT_EQ(Open(MakeWav(description, samples, static_cast<UINT32>(samples.size()))), S_OK);
+			EXPECT_EQ(source->GetFormat().channels, description.channels);
+			EXPECT_EQ(source->GetFormat().sampleRate, 48000u);
+
+			std::vector<float> decoded = ReadAll();
+			ASSERT_EQ(decoded.size(), values.size());
+
+			for (size_t index = 0; index < values.size(); index++)
+			{
+				ASSERT_EQ(decoded[index], static_cast<float>(std::ldexp(static_cast<double>(values[index]), 1 - static_cast<int>(bits)))) << "sample " << index;
+			}
+		}
+	};
+}
+
+
+TEST_F(WavSourceTest, UnsignedEightBit)
+{
+	ExpectIntegers({ waveFormatPcm, 2, 8, 0, false });
+}
+
+TEST_F(WavSourceTest, SixteenBit)
+{
+	ExpectIntegers({ waveFormatPcm, 1, 16, 0, false });
+	ExpectIntegers({ waveFormatPcm, 2, 16, 0, false });
+	ExpectIntegers({ waveFormatPcm, 6, 16, 0, false });
+}
+
+TEST_F(WavSourceTest, TwentyFourBit)
+{
+	ExpectIntegers({ waveFormatPcm, 2, 24, 0, false });
+}
+
+TEST_F(WavSourceTest, ThirtyTwoBit)
+{
+	ExpectIntegers({ waveFormatPcm, 1, 32, 0, false });
+	ExpectIntegers({ waveFormatPcm, 2, 32, 0, false });
+}
+
+TEST_F(WavSourceTest, ExtensiblePcm)
+{
+	ExpectIntegers({ waveFormatPcm, 2, 16, waveFormatPcm, false });
+	ExpectIntegers({ waveFormatPcm, 2, 24, waveFormatPcm, false });
+}
+
+TEST_F(WavSourceTest, FloatIsPassedThrough)
+{
+	for (WORD subFormat : { WORD(0), waveFormatIeeeFloat })
+	{
+		std::vector<float> values;
+		std::vector<BYTE> samples;
+
+		for (UINT32 index = 0; index < testFrames * 2; index++)
+		{
+			// Beyond full scale too, nothing is clipped
+			float value = (static_cast<float>(index) - testFrames) / 20.0f;
+			UINT32 bits;
+			memcpy(&bits, &value, sizeof(bits));
+
+			values.push_back(value);
+			Append32(samples, bits);
+		}
+
+		ASSERT_EQ(Open(MakeWav({ waveFormatIeeeFloat, 2, 32, subFormat, false }, samples, static_cast<UINT32>(samples.size()))), S_OK);
+		EXPECT_EQ(ReadAll(), values);
+	}
+}
+
+TEST_F(WavSourceTest, SkipsOddSizedChunkAndItsPadding)
+{
+	ExpectIntegers({ waveFormatPcm, 2, 16, 0, true });
+	ExpectIntegers({ waveFormatPcm, 1, 24, 0, true });
+}
+
+// The last whole frame that is in the file is the last one read, whatever the data chunk says
+TEST_F(WavSourceTest, TruncatedDataChunkEndsAtLastWholeFrame)
+{
+	std::vector<BYTE> samples;
+	for (INT64 value : TestValues(testFrames * 2, 16))
+	{
+		AppendSample(samples, value, 16);
+	}
+
+	std::vector<BYTE> bytes = MakeWav({ waveFormatPcm, 2, 16, 0, false }, samples, 100000);
+	// Half a frame left at the end
+	bytes.resize(bytes.size() - 2);
+
+	ASSERT_EQ(Open(bytes), S_OK);
+
+	UINT64 length = 0;
+	ASSERT_EQ(source->GetLength(length), S_OK);
+	EXPECT_EQ(length, testFrames - 1);
+
+	std::vector<float> decoded(testFrames * 2);
+	UINT32 framesRead = 0;
+	ASSERT_EQ(source->Read(decoded.data(), testFrames, framesRead), S_OK);
+	EXPECT_EQ(framesRead, testFrames - 1);
+
+	ASSERT_EQ(source->Read(decoded.data(), testFrames, framesRead), S_OK);
+	EXPECT_EQ(framesRead, 0u);
+}
+
+TEST_F(WavSourceTest, SeekIsExactToTheFrame)
+{
+	std::vector<INT64> values = TestValues(testFrames * 2, 16);
+	std::vector<BYTE> samples;
+	for (INT64 value : values)
+	{
+		AppendSample(samples, value, 16);
+	}
+
+	ASSERT_EQ(Open(MakeWav({ waveFormatPcm, 2, 16, 0, false }, samples, static_cast<UINT32>(samples.size()))), S_OK);
+
+	ASSERT_EQ(source->Seek(11), S_OK);
+
+	float frame[2];
+	UINT32 framesRead = 0;
+	ASSERT_EQ(source->Read(frame, 1, framesRead), S_OK);
+	EXPECT_EQ(frame[0], values[22] / 32768.0f);
+	EXPECT_EQ(frame[1], values[23] / 32768.0f);
+
+	UINT64 position = 0;
+	ASSERT_EQ(source->GetPosition(position), S_OK);
+	EXPECT_EQ(position, 12u);
+
+	EXPECT_EQ(source->Seek(testFrames), S_OK);
+	EXPECT_EQ(source->Seek(testFrames + 1), E_INVALIDARG);
+}
+
+TEST_F(WavSourceTest, RejectsWhatItCantRead)
+{
+	std::vector<BYTE> samples(testFrames * 4);
+
+	EXPECT_EQ(Open(MakeWav({ waveFormatMpegLayer3, 2, 16, 0, false }, samples, static_cast<UINT32>(samples.size()))), AUDIO_E_UNSUPPORTED_FORMAT);
+	EXPECT_EQ(Open(MakeWav({ waveFormatPcm, 2, 16, waveFormatMpegLayer3, false }, samples, static_cast<UINT32>(samples.size()))), AUDIO_E_UNSUPPORTED_FORMAT);
+
+	// A block align that doesn't match the channels and bits
+	std::vector<BYTE> bytes = MakeWav({ waveFormatPcm, 2, 16, 0, false }, samples, static_cast<UINT32>(samples.size()));
+	bytes[12 + 8 + 12] = 3;
+	EXPECT_EQ(Open(bytes), AUDIO_E_INVALID_FORMAT);
+
+	// No data chunk
+	bytes.resize(12 + 8 + 16);
+	EXPECT_EQ(Open(bytes), AUDIO_E_INVALID_FORMAT);
+
+	EXPECT_EQ(Open({ 'R', 'I', 'F', 'F', 0, 0, 0, 0, 'A', 'V', 'I', ' ' }), AUDIO_E_UNSUPPORTED_FORMAT);
+}
@@ -0,0 +1,32 @@
+# Writes the FLAC files FlacTests decodes, libFLAC through libsndfile stores the MD5 of the samples in STREAMINFO
+# Needs numpy and soundfile, the files are checked in so the tests don't
+import os
+
+import numpy as np
+import soundfile
+
+
+def signal(frames, channels, rate, seed):
+	random = np.random.default_rng(seed)
+	t = np.arange(frames) / rate
+	columns = []
+	for channel in range(channels):
+		tone = 0.4 * np.sin(2 * np.pi * (220 + 110 * channel) * t) + 0.2 * np.sin(2 * np.pi * 1375.5 * t + channel)
+		columns.append(tone + 0.02 * random.standard_normal(frames))
+	return np.clip(np.stack(columns, axis=1), -1, 1)
+
+
+# Name, subtype, channels, rate, frames, compression level, libFLAC uses 1152 sample blocks at level 0 and 4096 above
+corpus = [
+	('s8_stereo_1152', 'PCM_S8', 2, 22050, 13000, 0.0),
+	('s16_mono_4096', 'PCM_16', 1, 44100, 20000, 0.5),
+	('s16_stereo_1152', 'PCM_16', 2, 48000, 17281, 0.0),
+	('s24_stereo_4096', 'PCM_24', 2, 96000, 16385, 1.0),
+	('s24_6ch_1152', 'PCM_24', 6, 48000, 7000, 0.0),
+]
+
+directory = os.path.join(os.path.dirname(os.path.abspath(__file__)), 'flac')
+os.makedirs(directory, exist_ok=True)
+
+for seed, (name, subtype, channels, rate, frames, level) in enumerate(corpus):
+	soundfile.write(os.path.join(directory, name + '.flac'), signal(frames, channels, rate, seed), rate, subtype=subtype, compression_level=level)